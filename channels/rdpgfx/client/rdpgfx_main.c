@@ -1667,7 +1667,12 @@ static UINT rdpgfx_on_data_received(IWTSVirtualChannelCallback*
 	BYTE* pDstData = NULL;
 	RDPGFX_CHANNEL_CALLBACK* callback = (RDPGFX_CHANNEL_CALLBACK*) pChannelCallback;
 	RDPGFX_PLUGIN* gfx = (RDPGFX_PLUGIN*) callback->plugin;
+	RdpgfxClientContext* context = (RdpgfxClientContext*) gfx->iface.pInterface;
 	UINT error = CHANNEL_RC_OK;
+
+	if (context && context->OnRawData)
+		return context->OnRawData(context, data);
+
 	status = zgfx_decompress(gfx->zgfx, Stream_Pointer(data), Stream_GetRemainingLength(data),
 	                         &pDstData, &DstSize, 0);
 
@@ -2084,7 +2089,7 @@ UINT DVCPluginEntry(IDRDYNVC_ENTRY_POINTS* pEntryPoints)
 		gfx->iface.Disconnected = NULL;
 		gfx->iface.Terminated = rdpgfx_plugin_terminated;
 		gfx->rdpcontext = ((freerdp*)gfx->settings->instance)->context;
-		gfx->SurfaceTable = HashTable_New(TRUE);
+		gfx->SurfaceTable = HashTable_NewEx(TRUE, HASHTABLE_FLAG_OPEN_ADDRESSING);
 
 		if (!gfx->SurfaceTable)
 		{
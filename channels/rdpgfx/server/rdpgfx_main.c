@@ -142,6 +142,37 @@ out:
 	return error;
 }
 
+/**
+ * Function description
+ * Writes the remaining data of s to the channel without ZGFX encoding it,
+ * the caller owns s.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT rdpgfx_server_send_raw(RdpgfxServerContext* context, wStream* s)
+{
+	ULONG written;
+	const size_t length = Stream_GetRemainingLength(s);
+
+	if (length > UINT32_MAX)
+		return ERROR_INVALID_DATA;
+
+	if (!WTSVirtualChannelWrite(context->priv->rdpgfx_channel,
+	                            (PCHAR) Stream_Pointer(s), (ULONG) length, &written))
+	{
+		WLog_ERR(TAG, "WTSVirtualChannelWrite failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	if (written < length)
+	{
+		WLog_WARN(TAG, "Unexpected bytes written: %"PRIu32"/%"PRIuz"",
+		          written, length);
+	}
+
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  * Create new stream for single rdpgfx packet. The new stream length
@@ -1478,6 +1509,10 @@ static BOOL rdpgfx_server_open(RdpgfxServerContext* context)
 			goto out_close;
 		}
 
+		if (context->rdpcontext)
+			zgfx_set_compression_level(priv->zgfx,
+			                           context->rdpcontext->settings->GfxCompressionLevel);
+
 		if (priv->ownThread)
 		{
 			if (!(priv->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
@@ -1589,6 +1624,7 @@ RdpgfxServerContext* rdpgfx_server_context_new(HANDLE vcm)
 	context->CapsConfirm = rdpgfx_send_caps_confirm_pdu;
 	context->FrameAcknowledge = NULL;
 	context->QoeFrameAcknowledge = NULL;
+	context->SendRaw = rdpgfx_server_send_raw;
 	context->priv = priv = (RdpgfxServerPrivate*)
 	                       calloc(1, sizeof(RdpgfxServerPrivate));
 
@@ -134,6 +134,14 @@ static UINT xf_UpdateSurfaces(RdpgfxClientContext* context)
 		return CHANNEL_RC_OK;
 
 	EnterCriticalSection(&context->mux);
+	status = gdi_graphics_pipeline_flush(gdi);
+
+	if (status != CHANNEL_RC_OK)
+	{
+		LeaveCriticalSection(&context->mux);
+		return status;
+	}
+
 	context->GetSurfaceIds(context, &pSurfaceIds, &count);
 
 	for (index = 0; index < count; index++)
@@ -376,6 +384,8 @@ static UINT xf_DeleteSurface(RdpgfxClientContext* context,
 	xfGfxSurface* surface = NULL;
 	UINT status;
 	EnterCriticalSection(&context->mux);
+	/* Errors of pending messages do not matter, the surface is discarded */
+	gdi_graphics_pipeline_flush((rdpGdi*) context->custom);
 	surface = (xfGfxSurface*) context->GetSurfaceData(context,
 	          deleteSurface->surfaceId);
 
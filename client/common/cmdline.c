@@ -2435,6 +2435,15 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 			else if (strcmp(arg->Value, "image") == 0)
 				settings->RemoteFxCodecMode = 0x02;
 		}
+		CommandLineSwitchCase(arg, "rfx-pipeline")
+		{
+			LONGLONG val;
+
+			if (!value_to_int(arg->Value, &val, 0, 16))
+				return COMMAND_LINE_ERROR_UNEXPECTED_VALUE;
+
+			settings->RemoteFxPipelineDepth = (UINT32)val;
+		}
 		CommandLineSwitchCase(arg, "frame-ack")
 		{
 			LONGLONG val;
@@ -2620,6 +2629,10 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 
 			settings->TlsSecLevel = (UINT32)val;
 		}
+		CommandLineSwitchCase(arg, "tls-kernel")
+		{
+			settings->TlsKernelOffload = enable;
+		}
 		CommandLineSwitchCase(arg, "cert-name")
 		{
 			if (!copy_value(arg->Value, &settings->CertificateName))
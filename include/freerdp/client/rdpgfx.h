@@ -94,6 +94,7 @@ typedef UINT(*pcRdpgfxFrameAcknowledge)(RdpgfxClientContext* context,
                                         const RDPGFX_FRAME_ACKNOWLEDGE_PDU* frameAcknowledge);
 typedef UINT(*pcRdpgfxQoeFrameAcknowledge)(RdpgfxClientContext* context,
                                         const RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoeFrameAcknowledge);
+typedef UINT(*pcRdpgfxOnRawData)(RdpgfxClientContext* context, wStream* s);
 
 typedef UINT(*pcRdpgfxMapWindowForSurface)(RdpgfxClientContext* context, UINT16 surfaceID,
         UINT64 windowID);
@@ -138,6 +139,10 @@ struct _rdpgfx_client_context
 	pcRdpgfxFrameAcknowledge FrameAcknowledge;
 	pcRdpgfxQoeFrameAcknowledge QoeFrameAcknowledge;
 
+	/* When set, receives the still compressed channel data instead of the
+	 * PDU callbacks above. */
+	pcRdpgfxOnRawData OnRawData;
+
 	/* No locking required */
 	pcRdpgfxUpdateSurfaces UpdateSurfaces;
 	pcRdpgfxUpdateSurfaceArea UpdateSurfaceArea;
@@ -144,6 +144,15 @@ FREERDP_API BOOL region16_intersects_rect(const REGION16* src,
 FREERDP_API BOOL region16_intersect_rect(REGION16* dst, const REGION16* src,
         const RECTANGLE_16* arg2);
 
+/** removes a rectangle from src and stores the resulting region in dst
+ * @param dst destination region
+ * @param src the source region
+ * @param rect the rectangle to remove
+ * @return if the operation was successful (false meaning out-of-memory)
+ */
+FREERDP_API BOOL region16_subtract_rect(REGION16* dst, const REGION16* src,
+                                        const RECTANGLE_16* rect);
+
 /** release internal data associated with this region
  * @param region the region to release
  */
@@ -178,6 +178,23 @@ FREERDP_API BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UIN
                                      BYTE* dst, UINT32 dstFormat,
                                      UINT32 dstStride, UINT32 dstHeight,
                                      REGION16* invalidRegion);
+
+/**
+ * Pipelined decoding: with a depth > 0 rfx_process_message_async returns once
+ * the message is parsed and decodes its tiles on the thread pool while the
+ * next messages arrive. Up to depth messages are in flight, they are drawn to
+ * their dst and added to their invalidRegion in submission order.
+ * dst and invalidRegion must not be used until rfx_process_message_flush
+ * returned. rfx_process_message flushes before it decodes.
+ */
+FREERDP_API BOOL rfx_context_set_pipeline_depth(RFX_CONTEXT* context, UINT32 depth);
+FREERDP_API BOOL rfx_process_message_async(RFX_CONTEXT* context, const BYTE* data,
+        UINT32 length, UINT32 left, UINT32 top,
+        BYTE* dst, UINT32 dstFormat,
+        UINT32 dstStride, UINT32 dstHeight,
+        REGION16* invalidRegion);
+FREERDP_API BOOL rfx_process_message_flush(RFX_CONTEXT* context);
+
 FREERDP_API UINT16 rfx_message_get_tile_count(RFX_MESSAGE* message);
 FREERDP_API UINT16 rfx_message_get_rect_count(RFX_MESSAGE* message);
 FREERDP_API void rfx_message_free(RFX_CONTEXT* context, RFX_MESSAGE* message);
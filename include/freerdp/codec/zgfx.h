@@ -32,6 +32,12 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE			65535
 
+/* 0 sends PDUs uncompressed, higher levels search harder for matches */
+#define ZGFX_DEFAULT_COMPRESSION_LEVEL		2
+/* progressive, ClearCodec and H.264 payloads barely shrink, servers compress on request only */
+#define ZGFX_SERVER_COMPRESSION_LEVEL		0
+#define ZGFX_MAX_COMPRESSION_LEVEL		9
+
 typedef struct _ZGFX_CONTEXT ZGFX_CONTEXT;
 
 #ifdef __cplusplus
@@ -45,6 +51,8 @@ FREERDP_API int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 S
 FREERDP_API int zgfx_compress_to_stream(ZGFX_CONTEXT* zgfx, wStream* sDst,
                                         const BYTE* pUncompressed, UINT32 uncompressedSize, UINT32* pFlags);
 
+FREERDP_API void zgfx_set_compression_level(ZGFX_CONTEXT* zgfx, DWORD CompressionLevel);
+
 FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
 FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
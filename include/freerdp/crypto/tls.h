@@ -82,6 +82,8 @@ struct rdp_tls
 	int alertLevel;
 	int alertDescription;
 	BOOL isGatewayTransport;
+	BOOL kernelSend;
+	BOOL kernelRecv;
 };
 
 #ifdef __cplusplus
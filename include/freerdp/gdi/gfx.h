@@ -65,6 +65,11 @@ FREERDP_API BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext*
         pcRdpgfxMapWindowForSurface map,
         pcRdpgfxUnmapWindowForSurface unmap,
         pcRdpgfxUpdateSurfaceArea update);
+/**
+ * Surface commands may still be decoded in the background when they return. Clients that
+ * replace UpdateSurfaces or DeleteSurface have to call this before they touch a surface.
+ */
+FREERDP_API UINT gdi_graphics_pipeline_flush(rdpGdi* gdi);
 FREERDP_API void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx);
 
 #ifdef __cplusplus
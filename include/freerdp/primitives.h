@@ -85,6 +85,15 @@ typedef pstatus_t (*__copy_8u_AC4r_t)(
     BYTE* pDst,
     INT32 dstStep,	/* bytes */
     INT32 width,  INT32 height);	/* pixels */
+typedef pstatus_t (*__compare_32u_t)(
+    const BYTE* pSrc1, UINT32 src1Step,	/* bytes */
+    const BYTE* pSrc2, UINT32 src2Step,	/* bytes */
+    UINT32 width, UINT32 height,	/* pixels */
+    BOOL* pEqual);
+typedef pstatus_t (*__solid_32u_t)(
+    const BYTE* pSrc, UINT32 srcStep,	/* bytes */
+    UINT32 width, UINT32 height,	/* pixels */
+    UINT32* pColor, BOOL* pSolid);
 typedef pstatus_t (*__set_8u_t)(
     BYTE val,
     BYTE* pDst,
@@ -203,6 +212,11 @@ typedef pstatus_t (*__RGBToAVC444YUV_t)(
     BYTE* pMainDst[3], const UINT32 dstMainStep[3],
     BYTE* pAuxDst[3], const UINT32 dstAuxStep[3],
     const prim_size_t* roi);
+typedef pstatus_t (*__convertColor_8u_t)(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette);
 typedef pstatus_t (*__andC_32u_t)(
     const UINT32* pSrc,
     UINT32 val,
@@ -220,6 +234,9 @@ typedef struct
 	__copy_t copy;						/* memcpy/memmove, basically */
 	__copy_8u_t copy_8u;				/* more strongly typed */
 	__copy_8u_AC4r_t copy_8u_AC4r;		/* pixel copy function */
+	/* Memory comparison routines */
+	__compare_32u_t compare_32u;		/* 32bpp block compare */
+	__solid_32u_t solid_32u;			/* 32bpp single color test */
 	/* Memory setting routines */
 	__set_8u_t set_8u;					/* memset, basically */
 	__set_32s_t set_32s;
@@ -255,6 +272,8 @@ typedef struct
 	__YUV444ToRGB_8u_P3AC4R_t YUV444ToRGB_8u_P3AC4R;
 	__RGBToAVC444YUV_t RGBToAVC444YUV;
 	__RGBToAVC444YUV_t RGBToAVC444YUVv2;
+	/* Pixel format conversion, like FreeRDPConvertColor for each pixel */
+	__convertColor_8u_t convertColor_8u;
 } primitives_t;
 
 #ifdef __cplusplus
@@ -264,6 +283,21 @@ extern "C" {
 FREERDP_API primitives_t* primitives_get(void);
 FREERDP_API primitives_t* primitives_get_generic(void);
 
+/* Times the implementations of each routine and makes primitives_get() use
+ * the fastest ones instead of those picked from the processor features.
+ * With a cacheFile a previous result is loaded from it, otherwise the new one
+ * is written to it. Setting the FREERDP_PRIMITIVES_CALIBRATE environment
+ * variable to a cache file does this on the first primitives_get().
+ * The routines are only timed once per process, later calls reuse the result.
+ * Call it before other threads use the primitives.
+ */
+FREERDP_API BOOL primitives_calibrate(const char* cacheFile);
+
+/* Returns the name of the routine at index of primitives_get() and the
+ * instruction set of the implementation in use, NULL past the last one.
+ */
+FREERDP_API const char* primitives_get_dispatch(size_t index, const char** implementation);
+
 #ifdef __cplusplus
 }
 #endif
@@ -75,6 +75,7 @@ typedef UINT(*psRdpgfxFrameAcknowledge)(RdpgfxServerContext* context,
                                         const RDPGFX_FRAME_ACKNOWLEDGE_PDU* frameAcknowledge);
 typedef UINT(*psRdpgfxQoeFrameAcknowledge)(RdpgfxServerContext* context,
         const RDPGFX_QOE_FRAME_ACKNOWLEDGE_PDU* qoeFrameAcknowledge);
+typedef UINT(*psRdpgfxSendRaw)(RdpgfxServerContext* context, wStream* s);
 
 struct _rdpgfx_server_context
 {
@@ -108,6 +109,9 @@ struct _rdpgfx_server_context
 	psRdpgfxFrameAcknowledge FrameAcknowledge;
 	psRdpgfxQoeFrameAcknowledge QoeFrameAcknowledge;
 
+	/* Writes already ZGFX encoded data to the channel as is. */
+	psRdpgfxSendRaw SendRaw;
+
 	RdpgfxServerPrivate* priv;
 	rdpContext* rdpcontext;
 };
@@ -50,6 +50,8 @@ typedef struct rdp_shadow_encoder rdpShadowEncoder;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
+typedef struct rdp_shadow_encode_cache rdpShadowEncodeCache;
+typedef struct rdp_shadow_gfx_cache rdpShadowGfxCache;
 
 typedef struct _RDP_SHADOW_ENTRY_POINTS RDP_SHADOW_ENTRY_POINTS;
 typedef int (*pfnShadowSubsystemEntry)(RDP_SHADOW_ENTRY_POINTS* pEntryPoints);
@@ -130,6 +132,7 @@ struct rdp_shadow_server
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
 	rdpShadowSubsystem* subsystem;
+	rdpShadowEncodeCache* encodeCache;
 
 	DWORD port;
 	BOOL mayView;
@@ -145,6 +148,9 @@ struct rdp_shadow_server
 	UINT32 h264BitRate;
 	FLOAT h264FrameRate;
 	UINT32 h264QP;
+	BOOL gfxProgressive;
+	UINT32 gfxCompressionLevel;
+	BOOL kernelTls;
 
 	char* ipcSocket;
 	char* ConfigPath;
@@ -168,6 +174,12 @@ struct rdp_shadow_surface
 
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
+
+	/* Content of moveRect in the previous frame moved by moveX/moveY */
+	BOOL moved;
+	RECTANGLE_16 moveRect;
+	INT32 moveX;
+	INT32 moveY;
 };
 
 struct _RDP_SHADOW_ENTRY_POINTS
@@ -315,6 +327,11 @@ FREERDP_API int shadow_capture_align_clip_rect(RECTANGLE_16* rect,
         RECTANGLE_16* clip);
 FREERDP_API int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth,
                                        UINT32 nHeight, BYTE* pData2, UINT32 nStep2, RECTANGLE_16* rect);
+FREERDP_API int shadow_capture_compare_region(rdpShadowCapture* capture, BYTE* pData1,
+        UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
+        REGION16* region);
+FREERDP_API int shadow_capture_detect_move(BYTE* pData1, UINT32 nStep1, BYTE* pData2,
+        UINT32 nStep2, const REGION16* region, RECTANGLE_16* rect, INT32* dx, INT32* dy);
 
 FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
@@ -532,6 +532,8 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_MaxTimeInCheckLoop                                 (  26)
 #define FreeRDP_AcceptedCert                                       (  27)
 #define FreeRDP_AcceptedCertLength                                 (  28)
+#define FreeRDP_TransportBatchThreshold                            (  29)
+#define FreeRDP_TransportBatchTimeout                              (  30)
 #define FreeRDP_RdpVersion                                         ( 128)
 #define FreeRDP_DesktopWidth                                       ( 129)
 #define FreeRDP_DesktopHeight                                      ( 130)
@@ -652,6 +654,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_NtlmSamFile                                        (1103)
 #define FreeRDP_FIPSMode                                           (1104)
 #define FreeRDP_TlsSecLevel                                        (1105)
+#define FreeRDP_TlsKernelOffload                                   (1106)
 #define FreeRDP_MstscCookieMode                                    (1152)
 #define FreeRDP_CookieMaxLength                                    (1153)
 #define FreeRDP_PreconnectionId                                    (1154)
@@ -831,6 +834,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_RemoteFxCodecMode                                  (3651)
 #define FreeRDP_RemoteFxImageCodec                                 (3652)
 #define FreeRDP_RemoteFxCaptureFlags                               (3653)
+#define FreeRDP_RemoteFxPipelineDepth                              (3654)
 #define FreeRDP_NSCodec                                            (3712)
 #define FreeRDP_NSCodecId                                          (3713)
 #define FreeRDP_FrameAcknowledge                                   (3714)
@@ -849,6 +853,7 @@ typedef struct _RDPDR_PARALLEL RDPDR_PARALLEL;
 #define FreeRDP_GfxSendQoeAck                                      (3846)
 #define FreeRDP_GfxAVC444v2                                        (3847)
 #define FreeRDP_GfxCapsFilter                                      (3848)
+#define FreeRDP_GfxCompressionLevel                                (3849)
 #define FreeRDP_BitmapCacheV3CodecId                               (3904)
 #define FreeRDP_DrawNineGridEnabled                                (3968)
 #define FreeRDP_DrawNineGridCacheSize                              (3969)
@@ -914,7 +919,9 @@ struct rdp_settings
 	ALIGN64 UINT32 MaxTimeInCheckLoop;       /* 26 */
 	ALIGN64 char*  AcceptedCert;             /* 27 */
 	ALIGN64 UINT32 AcceptedCertLength;       /* 28 */
-	UINT64 padding0064[64 - 29]; /* 29 */
+	ALIGN64 UINT32 TransportBatchThreshold;  /* 29 */
+	ALIGN64 UINT32 TransportBatchTimeout;    /* 30 */
+	UINT64 padding0064[64 - 31]; /* 31 */
 	UINT64 padding0128[128 - 64]; /* 64 */
 
 	/**
@@ -1094,7 +1101,8 @@ struct rdp_settings
 	ALIGN64 char*  NtlmSamFile;                  /* 1103 */
 	ALIGN64 BOOL   FIPSMode;                     /* 1104 */
 	ALIGN64 UINT32 TlsSecLevel;                  /* 1105 */
-	UINT64 padding1152[1152 - 1106]; /* 1106 */
+	ALIGN64 BOOL   TlsKernelOffload;             /* 1106 */
+	UINT64 padding1152[1152 - 1107]; /* 1107 */
 
 	/* Connection Cookie */
 	ALIGN64 BOOL   MstscCookieMode;      /* 1152 */
@@ -1412,7 +1420,8 @@ struct rdp_settings
 	ALIGN64 UINT32 RemoteFxCodecMode;    /* 3651 */
 	ALIGN64 BOOL   RemoteFxImageCodec;   /* 3652 */
 	ALIGN64 UINT32 RemoteFxCaptureFlags; /* 3653 */
-	UINT64 padding3712[3712 - 3654]; /* 3654 */
+	ALIGN64 UINT32 RemoteFxPipelineDepth; /* 3654 */
+	UINT64 padding3712[3712 - 3655]; /* 3655 */
 
 	/* NSCodec */
 	ALIGN64 BOOL   NSCodec;                          /* 3712 */
@@ -1438,7 +1447,8 @@ struct rdp_settings
 	ALIGN64 BOOL GfxSendQoeAck;    /* 3846 */
 	ALIGN64 BOOL GfxAVC444v2;      /* 3847 */
 	ALIGN64 UINT32 GfxCapsFilter;  /* 3848 */
-	UINT64 padding3904[3904 - 3849]; /* 3849 */
+	ALIGN64 UINT32 GfxCompressionLevel; /* 3849 */
+	UINT64 padding3904[3904 - 3850]; /* 3850 */
 
 	/**
 	 * Caches
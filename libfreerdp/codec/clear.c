@@ -26,6 +26,7 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/stream.h>
 
 #include <freerdp/codec/color.h>
 #include <freerdp/codec/clear.h>
@@ -39,6 +40,12 @@
 
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
+#define CLEARCODEC_GLYPH_SIZE 4000
+
+/* encoder lookup tables, mapping a pixel hash to a cache index + 1 */
+#define CLEARCODEC_VBAR_HASH_SIZE 65536
+#define CLEARCODEC_VBAR_SHORT_HASH_SIZE 32768
+#define CLEARCODEC_GLYPH_HASH_SIZE 8192
 
 struct _CLEAR_GLYPH_ENTRY
 {
@@ -66,11 +73,19 @@ struct _CLEAR_CONTEXT
 	UINT32 nTempStep;
 	UINT32 TempFormat;
 	UINT32 format;
-	CLEAR_GLYPH_ENTRY GlyphCache[4000];
+	CLEAR_GLYPH_ENTRY GlyphCache[CLEARCODEC_GLYPH_SIZE];
 	UINT32 VBarStorageCursor;
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* encoder state */
+	wStream* EncodeStream;
+	BOOL CacheReset;
+	UINT32 GlyphCacheCursor;
+	UINT32* GlyphHash;
+	UINT32* VBarHash;
+	UINT32* ShortVBarHash;
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] =
@@ -952,7 +967,7 @@ static BOOL clear_decompress_glyph_data(CLEAR_CONTEXT* clear,
 
 	Stream_Read_UINT16(s, glyphIndex);
 
-	if (glyphIndex >= 4000)
+	if (glyphIndex >= CLEARCODEC_GLYPH_SIZE)
 	{
 		WLog_ERR(TAG, "Invalid glyphIndex %"PRIu16"", glyphIndex);
 		return FALSE;
@@ -1173,18 +1188,417 @@ fail:
 	return rc;
 }
 
+static UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261UL;
+
+	for (i = 0; i < count; i++)
+	{
+		hash ^= pixels[i];
+		hash *= 16777619UL;
+	}
+
+	hash ^= count;
+	return hash;
+}
+
+static BOOL clear_cache_entry_match(const BYTE* cached, UINT32 cachedCount,
+                                    const UINT32* pixels, UINT32 count)
+{
+	if (cachedCount != count)
+		return FALSE;
+
+	if (count == 0)
+		return TRUE;
+
+	if (!cached)
+		return FALSE;
+
+	return memcmp(cached, pixels, count * sizeof(UINT32)) == 0;
+}
+
+static BOOL clear_cache_entry_store(BYTE** ppCached, UINT32* pSize, UINT32* pCount,
+                                    const UINT32* pixels, UINT32 count)
+{
+	if (count > *pSize)
+	{
+		BYTE* tmp = (BYTE*) realloc(*ppCached, count * sizeof(UINT32));
+
+		if (!tmp)
+		{
+			WLog_ERR(TAG, "cache entry realloc %"PRIuz" failed", count * sizeof(UINT32));
+			return FALSE;
+		}
+
+		*ppCached = tmp;
+		*pSize = count;
+	}
+
+	if (count > 0)
+		CopyMemory(*ppCached, pixels, count * sizeof(UINT32));
+
+	*pCount = count;
+	return TRUE;
+}
+
+static INLINE void clear_write_bgr(wStream* s, UINT32 pixel)
+{
+	const BYTE* px = (const BYTE*) &pixel;
+	Stream_Write_UINT8(s, px[0]); /* b */
+	Stream_Write_UINT8(s, px[1]); /* g */
+	Stream_Write_UINT8(s, px[2]); /* r */
+}
+
+static INLINE UINT32 clear_run_length_size(UINT32 runLength)
+{
+	if (runLength < 0xFF)
+		return 1;
+
+	if (runLength < 0xFFFF)
+		return 3;
+
+	return 7;
+}
+
+static INLINE void clear_write_run_length(wStream* s, UINT32 runLength)
+{
+	if (runLength < 0xFF)
+	{
+		Stream_Write_UINT8(s, runLength);
+	}
+	else if (runLength < 0xFFFF)
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, runLength);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, 0xFF);
+		Stream_Write_UINT16(s, 0xFFFF);
+		Stream_Write_UINT32(s, runLength);
+	}
+}
+
+static UINT32 clear_residual_size(const UINT32* pixels, UINT32 pixelCount)
+{
+	UINT32 index = 0;
+	UINT32 size = 0;
+
+	while (index < pixelCount)
+	{
+		UINT32 runLength = 1;
+
+		while (((index + runLength) < pixelCount) && (pixels[index + runLength] == pixels[index]))
+			runLength++;
+
+		size += 3 + clear_run_length_size(runLength);
+		index += runLength;
+	}
+
+	return size;
+}
+
+static BOOL clear_compress_residual_data(wStream* s, const UINT32* pixels, UINT32 pixelCount)
+{
+	UINT32 index = 0;
+
+	while (index < pixelCount)
+	{
+		UINT32 runLength = 1;
+
+		while (((index + runLength) < pixelCount) && (pixels[index + runLength] == pixels[index]))
+			runLength++;
+
+		if (!Stream_EnsureRemainingCapacity(s, 3 + 7))
+			return FALSE;
+
+		clear_write_bgr(s, pixels[index]);
+		clear_write_run_length(s, runLength);
+		index += runLength;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_compress_vbar(CLEAR_CONTEXT* clear, wStream* s, const UINT32* vBar,
+                                UINT32 vBarHeight, UINT32 colorBkg)
+{
+	UINT32 y;
+	UINT32 hash;
+	UINT32 index;
+	UINT32 vBarYOn;
+	UINT32 vBarYOff;
+	UINT32 vBarShortPixelCount;
+	CLEAR_VBAR_ENTRY* vBarEntry;
+	CLEAR_VBAR_ENTRY* vBarShortEntry;
+
+	if (!Stream_EnsureRemainingCapacity(s, 3 + (vBarHeight * 3)))
+		return FALSE;
+
+	/* VBAR_CACHE_HIT */
+	hash = clear_hash_pixels(vBar, vBarHeight);
+	index = clear->VBarHash[hash % CLEARCODEC_VBAR_HASH_SIZE];
+
+	if (index)
+	{
+		vBarEntry = &(clear->VBarStorage[index - 1]);
+
+		if (clear_cache_entry_match(vBarEntry->pixels, vBarEntry->count, vBar, vBarHeight))
+		{
+			Stream_Write_UINT16(s, 0x8000 | (index - 1));
+			return TRUE;
+		}
+	}
+
+	/* strip the background pixels above and below the short vBar */
+	vBarYOn = 0;
+
+	while ((vBarYOn < vBarHeight) && (vBar[vBarYOn] == colorBkg))
+		vBarYOn++;
+
+	vBarYOff = vBarHeight;
+
+	while ((vBarYOff > vBarYOn) && (vBar[vBarYOff - 1] == colorBkg))
+		vBarYOff--;
+
+	vBarShortPixelCount = vBarYOff - vBarYOn;
+	hash = clear_hash_pixels(&vBar[vBarYOn], vBarShortPixelCount);
+	index = clear->ShortVBarHash[hash % CLEARCODEC_VBAR_SHORT_HASH_SIZE];
+	vBarShortEntry = index ? &(clear->ShortVBarStorage[index - 1]) : NULL;
+
+	if (vBarShortEntry && clear_cache_entry_match(vBarShortEntry->pixels, vBarShortEntry->count,
+	        &vBar[vBarYOn], vBarShortPixelCount))
+	{
+		/* SHORT_VBAR_CACHE_HIT */
+		Stream_Write_UINT16(s, 0x4000 | (index - 1));
+		Stream_Write_UINT8(s, vBarYOn);
+	}
+	else
+	{
+		/* SHORT_VBAR_CACHE_MISS */
+		Stream_Write_UINT16(s, (vBarYOff << 8) | vBarYOn);
+
+		for (y = vBarYOn; y < vBarYOff; y++)
+			clear_write_bgr(s, vBar[y]);
+
+		vBarShortEntry = &(clear->ShortVBarStorage[clear->ShortVBarStorageCursor]);
+
+		if (!clear_cache_entry_store(&vBarShortEntry->pixels, &vBarShortEntry->size,
+		                             &vBarShortEntry->count, &vBar[vBarYOn], vBarShortPixelCount))
+			return FALSE;
+
+		clear->ShortVBarHash[hash % CLEARCODEC_VBAR_SHORT_HASH_SIZE] =
+		    clear->ShortVBarStorageCursor + 1;
+		clear->ShortVBarStorageCursor =
+		    (clear->ShortVBarStorageCursor + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
+	}
+
+	/* both short vBar cases store the full vBar at the cursor */
+	vBarEntry = &(clear->VBarStorage[clear->VBarStorageCursor]);
+
+	if (!clear_cache_entry_store(&vBarEntry->pixels, &vBarEntry->size, &vBarEntry->count,
+	                             vBar, vBarHeight))
+		return FALSE;
+
+	hash = clear_hash_pixels(vBar, vBarHeight);
+	clear->VBarHash[hash % CLEARCODEC_VBAR_HASH_SIZE] = clear->VBarStorageCursor + 1;
+	clear->VBarStorageCursor = (clear->VBarStorageCursor + 1) % CLEARCODEC_VBAR_SIZE;
+	return TRUE;
+}
+
+static BOOL clear_compress_bands_data(CLEAR_CONTEXT* clear, wStream* s,
+                                      const UINT32* pixels, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x, y;
+	UINT32 yStart;
+	UINT32 vBar[52];
+
+	for (yStart = 0; yStart < nHeight; yStart += 52)
+	{
+		const UINT32 vBarHeight = MIN(52, nHeight - yStart);
+		/* text is mostly drawn on a uniform background */
+		const UINT32 colorBkg = pixels[yStart * nWidth];
+
+		if (!Stream_EnsureRemainingCapacity(s, 11))
+			return FALSE;
+
+		Stream_Write_UINT16(s, 0); /* xStart */
+		Stream_Write_UINT16(s, nWidth - 1); /* xEnd */
+		Stream_Write_UINT16(s, yStart); /* yStart */
+		Stream_Write_UINT16(s, yStart + vBarHeight - 1); /* yEnd */
+		clear_write_bgr(s, colorBkg);
+
+		for (x = 0; x < nWidth; x++)
+		{
+			for (y = 0; y < vBarHeight; y++)
+				vBar[y] = pixels[((yStart + y) * nWidth) + x];
+
+			if (!clear_compress_vbar(clear, s, vBar, vBarHeight, colorBkg))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_compress_glyph_data(CLEAR_CONTEXT* clear, const UINT32* pixels,
+                                      UINT32 nWidth, UINT32 nHeight, BYTE* glyphFlags,
+                                      UINT16* glyphIndex)
+{
+	UINT32 hash;
+	UINT32 index;
+	CLEAR_GLYPH_ENTRY* glyphEntry;
+	const UINT32 count = nWidth * nHeight;
+
+	/* only small bitmaps are eligible for glyph caching */
+	if (count > 1024)
+		return TRUE;
+
+	hash = clear_hash_pixels(pixels, count);
+	index = clear->GlyphHash[hash % CLEARCODEC_GLYPH_HASH_SIZE];
+
+	if (index)
+	{
+		glyphEntry = &(clear->GlyphCache[index - 1]);
+
+		if (clear_cache_entry_match((const BYTE*) glyphEntry->pixels, glyphEntry->count,
+		                            pixels, count))
+		{
+			*glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX | CLEARCODEC_FLAG_GLYPH_HIT;
+			*glyphIndex = index - 1;
+			return TRUE;
+		}
+	}
+
+	/* the decoder stores the decoded bitmap at the glyph index */
+	glyphEntry = &(clear->GlyphCache[clear->GlyphCacheCursor]);
+
+	if (!clear_cache_entry_store((BYTE**) &glyphEntry->pixels, &glyphEntry->size,
+	                             &glyphEntry->count, pixels, count))
+		return FALSE;
+
+	*glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+	*glyphIndex = clear->GlyphCacheCursor;
+	clear->GlyphHash[hash % CLEARCODEC_GLYPH_HASH_SIZE] = clear->GlyphCacheCursor + 1;
+	clear->GlyphCacheCursor = (clear->GlyphCacheCursor + 1) % CLEARCODEC_GLYPH_SIZE;
+	return TRUE;
+}
+
 int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
+                   UINT32 SrcFormat, UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep,
                    BYTE** ppDstData, UINT32* pDstSize)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!", __FUNCTION__);
+	UINT32 i;
+	UINT32 pixelCount;
+	UINT32 residualSize;
+	UINT32 bandsSize;
+	size_t headerPos;
+	size_t layerPos;
+	BYTE glyphFlags = 0;
+	UINT16 glyphIndex = 0;
+	UINT32* pixels;
+	wStream* s;
+
+	if (!clear || !clear->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF))
+		return -1;
+
+	if (SrcSize < (nSrcStep * (nHeight - 1)) + (nWidth * GetBytesPerPixel(SrcFormat)))
+		return -1;
+
+	if (!clear_resize_buffer(clear, nWidth, nHeight))
+		return -1;
+
+	/* work on opaque BGRX32 pixels, the same representation the caches use */
+	pixels = (UINT32*) clear->TempBuffer;
+	pixelCount = nWidth * nHeight;
+
+	if (!freerdp_image_copy(clear->TempBuffer, clear->format, 0, 0, 0, nWidth, nHeight,
+	                        pSrcData, SrcFormat, nSrcStep, 0, 0, NULL, FREERDP_FLIP_NONE))
+		return -1;
+
+	for (i = 0; i < pixelCount; i++)
+		((BYTE*) &pixels[i])[3] = 0xFF;
+
+	s = clear->EncodeStream;
+	Stream_SetPosition(s, 0);
+
+	if (clear->CacheReset)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear->VBarStorageCursor = 0;
+		clear->ShortVBarStorageCursor = 0;
+		ZeroMemory(clear->VBarHash, CLEARCODEC_VBAR_HASH_SIZE * sizeof(UINT32));
+		ZeroMemory(clear->ShortVBarHash, CLEARCODEC_VBAR_SHORT_HASH_SIZE * sizeof(UINT32));
+		clear->CacheReset = FALSE;
+	}
+
+	if (!clear_compress_glyph_data(clear, pixels, nWidth, nHeight, &glyphFlags, &glyphIndex))
+		return -1;
+
+	if (!Stream_EnsureRemainingCapacity(s, 4 + 12))
+		return -1;
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, clear->seqNumber);
+	clear->seqNumber = (clear->seqNumber + 1) % 256;
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_INDEX)
+		Stream_Write_UINT16(s, glyphIndex);
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_HIT)
+		goto finish;
+
+	headerPos = Stream_GetPosition(s);
+	Stream_Seek(s, 12);
+	layerPos = Stream_GetPosition(s);
+	residualSize = 0;
+	bandsSize = 0;
+
+	/**
+	 * Flat content is cheapest as a residual run-length layer. Use it when
+	 * it beats the best case of the bands layer, where every vBar is a
+	 * cache hit, otherwise cover the bitmap with bands of cached vBars.
+	 */
+	if (clear_residual_size(pixels, pixelCount) <=
+	    (((nHeight + 51) / 52) * (11 + (nWidth * 2))))
+	{
+		if (!clear_compress_residual_data(s, pixels, pixelCount))
+			return -1;
+
+		residualSize = (UINT32)(Stream_GetPosition(s) - layerPos);
+	}
+	else
+	{
+		if (!clear_compress_bands_data(clear, s, pixels, nWidth, nHeight))
+			return -1;
+
+		bandsSize = (UINT32)(Stream_GetPosition(s) - layerPos);
+	}
+
+	layerPos = Stream_GetPosition(s);
+	Stream_SetPosition(s, headerPos);
+	Stream_Write_UINT32(s, residualSize); /* residualByteCount */
+	Stream_Write_UINT32(s, bandsSize); /* bandsByteCount */
+	Stream_Write_UINT32(s, 0); /* subcodecByteCount */
+	Stream_SetPosition(s, layerPos);
+finish:
+	Stream_SealLength(s);
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32) Stream_Length(s);
 	return 1;
 }
+
 BOOL clear_context_reset(CLEAR_CONTEXT* clear)
 {
 	if (!clear)
 		return FALSE;
 
 	clear->seqNumber = 0;
+	clear->CacheReset = TRUE;
 	return TRUE;
 }
 CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
@@ -1210,6 +1624,17 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	if (!clear->TempBuffer)
 		goto error_nsc;
 
+	if (Compressor)
+	{
+		clear->EncodeStream = Stream_New(NULL, 4096);
+		clear->GlyphHash = (UINT32*) calloc(CLEARCODEC_GLYPH_HASH_SIZE, sizeof(UINT32));
+		clear->VBarHash = (UINT32*) calloc(CLEARCODEC_VBAR_HASH_SIZE, sizeof(UINT32));
+		clear->ShortVBarHash = (UINT32*) calloc(CLEARCODEC_VBAR_SHORT_HASH_SIZE, sizeof(UINT32));
+
+		if (!clear->EncodeStream || !clear->GlyphHash || !clear->VBarHash || !clear->ShortVBarHash)
+			goto error_nsc;
+	}
+
 	if (!clear_context_reset(clear))
 		goto error_nsc;
 
@@ -1227,8 +1652,12 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 
 	nsc_context_free(clear->nsc);
 	free(clear->TempBuffer);
+	Stream_Free(clear->EncodeStream, TRUE);
+	free(clear->GlyphHash);
+	free(clear->VBarHash);
+	free(clear->ShortVBarHash);
 
-	for (i = 0; i < 4000; i++)
+	for (i = 0; i < CLEARCODEC_GLYPH_SIZE; i++)
 		free(clear->GlyphCache[i].pixels);
 
 	for (i = 0; i < 32768; i++)
@@ -676,25 +676,15 @@ BOOL freerdp_image_copy(BYTE* pDstData, DWORD DstFormat,
 	}
 	else
 	{
-		UINT32 x, y;
-
-		for (y = 0; y < nHeight; y++)
-		{
-			const BYTE* srcLine = &pSrcData[(y + nYSrc) *
-			                                            nSrcStep * srcVMultiplier +
-			                                            srcVOffset];
-			BYTE* dstLine = &pDstData[(y + nYDst) *
-			                                      nDstStep * dstVMultiplier + dstVOffset];
-
-			for (x = 0; x < nWidth; x++)
-			{
-				UINT32 dstColor;
-				UINT32 color = ReadColor(&srcLine[(x + nXSrc) * srcByte],
-				                         SrcFormat);
-				dstColor = FreeRDPConvertColor(color, SrcFormat, DstFormat, palette);
-				WriteColor(&dstLine[(x + nXDst) * dstByte], DstFormat, dstColor);
-			}
-		}
+		primitives_t* prims = primitives_get();
+		const BYTE* srcLine = &pSrcData[nYSrc * nSrcStep * srcVMultiplier + srcVOffset];
+		BYTE* dstLine = &pDstData[nYDst * nDstStep * dstVMultiplier + dstVOffset];
+
+		if (prims->convertColor_8u(&srcLine[xSrcOffset], (INT32)nSrcStep * srcVMultiplier,
+		                           SrcFormat, &dstLine[xDstOffset],
+		                           (INT32)nDstStep * dstVMultiplier, DstFormat,
+		                           nWidth, nHeight, palette) != PRIMITIVES_SUCCESS)
+			return FALSE;
 	}
 
 	return TRUE;
@@ -34,6 +34,7 @@
 #include "rfx_differential.h"
 #include "rfx_quantization.h"
 #include "rfx_rlgr.h"
+#include "rfx_encode.h"
 #include "progressive.h"
 
 #define TAG FREERDP_TAG("codec.progressive")
@@ -1930,10 +1931,940 @@ INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive,
 	return rc;
 }
 
+/**
+ * Encoder quantization: a single quantization value set is used for all tiles,
+ * the progressive quality levels below are applied on top of it.
+ */
+static const RFX_COMPONENT_CODEC_QUANT progressive_encode_quant =
+{
+	6, 6, 6, 6, 6, 6, 6, 6, 6, 6
+};
+
+/**
+ * Progressive quality levels used by the encoder, from the coarse first pass
+ * to the last upgrade pass before full quality (quality index 0xFF).
+ * Values are in LL3, HL3, LH3, HH3, HL2, LH2, HH2, HL1, LH1, HH1 order.
+ */
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_encode_quant_prog[] =
+{
+	{
+		25,
+		{ 2, 3, 3, 3, 4, 4, 4, 5, 5, 5 },
+		{ 2, 4, 4, 4, 5, 5, 5, 6, 6, 6 },
+		{ 2, 4, 4, 4, 5, 5, 5, 6, 6, 6 }
+	},
+	{
+		50,
+		{ 1, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+		{ 1, 3, 3, 3, 4, 4, 4, 5, 5, 5 },
+		{ 1, 3, 3, 3, 4, 4, 4, 5, 5, 5 }
+	},
+	{
+		75,
+		{ 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 },
+		{ 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 },
+		{ 0, 1, 1, 1, 2, 2, 2, 3, 3, 3 }
+	}
+};
+
+#define PROGRESSIVE_ENCODE_PASSES	(ARRAYSIZE(progressive_encode_quant_prog) + 1)
+
+static INLINE void progressive_component_codec_quant_write(BYTE* block,
+        const RFX_COMPONENT_CODEC_QUANT* quantVal)
+{
+	block[0] = (quantVal->LL3 & 0x0F) | (quantVal->HL3 << 4);
+	block[1] = (quantVal->LH3 & 0x0F) | (quantVal->HH3 << 4);
+	block[2] = (quantVal->HL2 & 0x0F) | (quantVal->LH2 << 4);
+	block[3] = (quantVal->HH2 & 0x0F) | (quantVal->HL1 << 4);
+	block[4] = (quantVal->LH1 & 0x0F) | (quantVal->HH1 << 4);
+}
+
+static INLINE const RFX_PROGRESSIVE_CODEC_QUANT* progressive_encode_get_quant_prog(
+    PROGRESSIVE_CONTEXT* progressive, UINT16 pass)
+{
+	if (pass < ARRAYSIZE(progressive_encode_quant_prog))
+		return &progressive_encode_quant_prog[pass];
+
+	return &(progressive->quantProgValFull);
+}
+
+static INLINE BYTE progressive_encode_get_quality(UINT16 pass)
+{
+	if (pass < ARRAYSIZE(progressive_encode_quant_prog))
+		return (BYTE) pass;
+
+	return 0xFF;
+}
+
+/**
+ * Forward reduce-extrapolate DWT, inverse of progressive_rfx_idwt_x/y:
+ *
+ * H[n] = (X[2n+1] - ((X[2n] + X[2n+2]) / 2)) / 2
+ * L[0] = X[0] + H[0]
+ * L[n] = X[2n] + ((H[n-1] + H[n]) / 2)
+ */
+static INLINE void progressive_rfx_dwt_encode_1d(const INT16* pX, int nXStep,
+        INT16* pL, int nLStep, INT16* pH, int nHStep, int nLowCount, int nHighCount)
+{
+	int n;
+	INT16 X0, X1, X2;
+	INT16 H0, H1;
+
+	for (n = 0; n < nHighCount; n++)
+	{
+		X0 = pX[(2 * n) * nXStep];
+		X1 = pX[(2 * n + 1) * nXStep];
+		X2 = pX[(2 * n + 2) * nXStep];
+		pH[n * nHStep] = (INT16)((X1 - ((X0 + X2) / 2)) / 2);
+	}
+
+	H0 = pH[0];
+	pL[0] = (INT16)(pX[0] + H0);
+
+	for (n = 1; n < nHighCount; n++)
+	{
+		H1 = pH[n * nHStep];
+		pL[n * nLStep] = (INT16)(pX[(2 * n) * nXStep] + ((H0 + H1) / 2));
+		H0 = H1;
+	}
+
+	X2 = pX[(2 * nHighCount) * nXStep];
+
+	if (nLowCount <= (nHighCount + 1))
+	{
+		pL[nHighCount * nLStep] = (INT16)(X2 + H0);
+	}
+	else
+	{
+		pL[nHighCount * nLStep] = (INT16)(X2 + (H0 / 2));
+		pL[(nHighCount + 1) * nLStep] = (INT16)((2 * pX[(2 * nHighCount + 1) * nXStep]) - X2);
+	}
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp,
+        int level)
+{
+	int i;
+	int offset;
+	int nBandL;
+	int nBandH;
+	int nStep;
+	INT16* HL, *LH;
+	INT16* HH, *LL;
+	INT16* L, *H;
+	nBandL = progressive_rfx_get_band_l_count(level);
+	nBandH = progressive_rfx_get_band_h_count(level);
+	nStep = nBandL + nBandH;
+	offset = 0;
+	HL = &buffer[offset];
+	offset += (nBandH * nBandL);
+	LH = &buffer[offset];
+	offset += (nBandL * nBandH);
+	HH = &buffer[offset];
+	offset += (nBandH * nBandH);
+	LL = &buffer[offset];
+	offset = 0;
+	L = &temp[offset];
+	offset += (nBandL * nStep);
+	H = &temp[offset];
+
+	/* vertical (X -> L + H) */
+	for (i = 0; i < nStep; i++)
+		progressive_rfx_dwt_encode_1d(&buffer[i], nStep, &L[i], nStep, &H[i], nStep,
+		                              nBandL, nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (i = 0; i < nBandL; i++)
+		progressive_rfx_dwt_encode_1d(&L[i * nStep], 1, &LL[i * nBandL], 1,
+		                              &HL[i * nBandH], 1, nBandL, nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (i = 0; i < nBandH; i++)
+		progressive_rfx_dwt_encode_1d(&H[i * nStep], 1, &LH[i * nBandL], 1,
+		                              &HH[i * nBandH], 1, nBandL, nBandH);
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode(INT16* buffer, INT16* temp)
+{
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+}
+
+static INLINE void progressive_rfx_encode_block(INT16* buffer, int length, UINT32 factor)
+{
+	int index;
+	INT16 half;
+
+	if (!factor)
+		return;
+
+	half = (1 << (factor - 1));
+
+	for (index = 0; index < length; index++)
+		buffer[index] = (buffer[index] + half) >> factor;
+}
+
+static INLINE void progressive_rfx_encode_quant(INT16* buffer,
+        const RFX_COMPONENT_CODEC_QUANT* quant)
+{
+	/* The coefficients are scaled by << 5 at RGB->YCbCr phase, so quant - 6 + 5 */
+	progressive_rfx_encode_block(&buffer[0], 1023, quant->HL1 - 1); /* HL1 */
+	progressive_rfx_encode_block(&buffer[1023], 1023, quant->LH1 - 1); /* LH1 */
+	progressive_rfx_encode_block(&buffer[2046], 961, quant->HH1 - 1); /* HH1 */
+	progressive_rfx_encode_block(&buffer[3007], 272, quant->HL2 - 1); /* HL2 */
+	progressive_rfx_encode_block(&buffer[3279], 272, quant->LH2 - 1); /* LH2 */
+	progressive_rfx_encode_block(&buffer[3551], 256, quant->HH2 - 1); /* HH2 */
+	progressive_rfx_encode_block(&buffer[3807], 72, quant->HL3 - 1); /* HL3 */
+	progressive_rfx_encode_block(&buffer[3879], 72, quant->LH3 - 1); /* LH3 */
+	progressive_rfx_encode_block(&buffer[3951], 64, quant->HH3 - 1); /* HH3 */
+	progressive_rfx_encode_block(&buffer[4015], 81, quant->LL3 - 1); /* LL3 */
+}
+
+static INLINE void progressive_rfx_encode_first_block(const INT16* coeffs, INT16* buffer,
+        int length, UINT32 numBits, BOOL nonLL)
+{
+	int index;
+
+	if (!nonLL)
+	{
+		/* LL3 upgrades are unsigned raw bits, truncate towards -inf */
+		for (index = 0; index < length; index++)
+			buffer[index] = coeffs[index] >> numBits;
+
+		return;
+	}
+
+	/* other bands use sign-magnitude bit planes, truncate towards zero */
+	for (index = 0; index < length; index++)
+	{
+		if (coeffs[index] < 0)
+			buffer[index] = -((-coeffs[index]) >> numBits);
+		else
+			buffer[index] = coeffs[index] >> numBits;
+	}
+}
+
+static INLINE int progressive_rfx_encode_first_component(const INT16* coeffs,
+        const RFX_COMPONENT_CODEC_QUANT* bits, INT16* buffer,
+        BYTE* pDstData, UINT32 DstSize)
+{
+	progressive_rfx_encode_first_block(&coeffs[0], &buffer[0], 1023, bits->HL1, TRUE); /* HL1 */
+	progressive_rfx_encode_first_block(&coeffs[1023], &buffer[1023], 1023, bits->LH1, TRUE); /* LH1 */
+	progressive_rfx_encode_first_block(&coeffs[2046], &buffer[2046], 961, bits->HH1, TRUE); /* HH1 */
+	progressive_rfx_encode_first_block(&coeffs[3007], &buffer[3007], 272, bits->HL2, TRUE); /* HL2 */
+	progressive_rfx_encode_first_block(&coeffs[3279], &buffer[3279], 272, bits->LH2, TRUE); /* LH2 */
+	progressive_rfx_encode_first_block(&coeffs[3551], &buffer[3551], 256, bits->HH2, TRUE); /* HH2 */
+	progressive_rfx_encode_first_block(&coeffs[3807], &buffer[3807], 72, bits->HL3, TRUE); /* HL3 */
+	progressive_rfx_encode_first_block(&coeffs[3879], &buffer[3879], 72, bits->LH3, TRUE); /* LH3 */
+	progressive_rfx_encode_first_block(&coeffs[3951], &buffer[3951], 64, bits->HH3, TRUE); /* HH3 */
+	progressive_rfx_encode_first_block(&coeffs[4015], &buffer[4015], 81, bits->LL3, FALSE); /* LL3 */
+	rfx_differential_encode(&buffer[4015], 81); /* LL3 */
+	ZeroMemory(pDstData, DstSize);
+	return rfx_rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+}
+
+static INLINE void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+        INT16 input, UINT32 numBits)
+{
+	int k;
+	UINT32 bit;
+	UINT32 mag;
+	UINT32 max;
+	wBitStream* bs = state->srl;
+	k = state->kp / 8;
+
+	if (!input)
+	{
+		/* zero encoding, a complete run of (1 << k) zeros is a '0' bit */
+		state->nz++;
+
+		if (state->nz == (1 << k))
+		{
+			bit = 0;
+			BitStream_Write_Bits(bs, bit, 1);
+			state->nz = 0;
+			state->kp += 4;
+
+			if (state->kp > 80)
+				state->kp = 80;
+		}
+
+		return;
+	}
+
+	/* '1' bit, the remaining run of nz < (1 << k) zeros is in the next k bits */
+	bit = 1;
+	BitStream_Write_Bits(bs, bit, 1);
+
+	if (k)
+	{
+		bit = (UINT32) state->nz;
+		BitStream_Write_Bits(bs, bit, k);
+	}
+
+	state->nz = 0;
+	/* unary encoding */
+	/* write sign bit */
+	bit = (input < 0) ? 1 : 0;
+	BitStream_Write_Bits(bs, bit, 1);
+	state->kp -= 6;
+
+	if (state->kp < 0)
+		state->kp = 0;
+
+	if (numBits == 1)
+		return;
+
+	mag = (input < 0) ? -input : input;
+	max = (1 << numBits) - 1;
+	bit = 0;
+
+	while (mag > 1)
+	{
+		BitStream_Write_Bits(bs, bit, 1);
+		mag--;
+	}
+
+	if ((UINT32)((input < 0) ? -input : input) < max)
+	{
+		bit = 1;
+		BitStream_Write_Bits(bs, bit, 1);
+	}
+}
+
+static INLINE void progressive_rfx_srl_write_finish(RFX_PROGRESSIVE_UPGRADE_STATE* state)
+{
+	UINT32 bit;
+	wBitStream* bs = state->srl;
+
+	/* trailing zeros are sent as a complete run */
+	if (state->nz)
+	{
+		bit = 0;
+		BitStream_Write_Bits(bs, bit, 1);
+		state->nz = 0;
+	}
+
+	BitStream_Flush(bs);
+}
+
+static INLINE void progressive_rfx_raw_write(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+        UINT32 input, UINT32 numBits)
+{
+	wBitStream* bs = state->raw;
+	input &= ((1 << numBits) - 1);
+	BitStream_Write_Bits(bs, input, numBits);
+}
+
+static INLINE void progressive_rfx_upgrade_block_encode(RFX_PROGRESSIVE_UPGRADE_STATE* state,
+        const INT16* coeffs, UINT32 length, UINT32 oldBits, UINT32 newBits)
+{
+	UINT32 index;
+	UINT32 mag;
+	UINT32 numBits;
+	INT16 input;
+
+	if (oldBits <= newBits)
+		return;
+
+	numBits = oldBits - newBits;
+
+	if (!state->nonLL)
+	{
+		for (index = 0; index < length; index++)
+			progressive_rfx_raw_write(state, (UINT32)(coeffs[index] >> newBits), numBits);
+
+		return;
+	}
+
+	for (index = 0; index < length; index++)
+	{
+		mag = (coeffs[index] < 0) ? -coeffs[index] : coeffs[index];
+
+		if (mag >> oldBits)
+		{
+			/* sign is known to the decoder, write to raw */
+			progressive_rfx_raw_write(state, mag >> newBits, numBits);
+		}
+		else
+		{
+			/* sign == 0, write to srl */
+			input = (INT16)(mag >> newBits);
+
+			if (coeffs[index] < 0)
+				input = -input;
+
+			progressive_rfx_srl_write(state, input, numBits);
+		}
+	}
+}
+
+static INLINE int progressive_rfx_upgrade_component_encode(const INT16* coeffs,
+        const RFX_COMPONENT_CODEC_QUANT* oldBits, const RFX_COMPONENT_CODEC_QUANT* newBits,
+        BYTE* srlData, UINT32* srlLen, BYTE* rawData, UINT32* rawLen, UINT32 capacity)
+{
+	wBitStream s_srl;
+	wBitStream s_raw;
+	RFX_PROGRESSIVE_UPGRADE_STATE state;
+	ZeroMemory(&s_srl, sizeof(wBitStream));
+	ZeroMemory(&s_raw, sizeof(wBitStream));
+	ZeroMemory(&state, sizeof(RFX_PROGRESSIVE_UPGRADE_STATE));
+	state.kp = 8;
+	state.mode = 0;
+	state.srl = &s_srl;
+	state.raw = &s_raw;
+	BitStream_Attach(state.srl, srlData, capacity);
+	BitStream_Attach(state.raw, rawData, capacity);
+
+	state.nonLL = TRUE;
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[0], 1023,
+	                                     oldBits->HL1, newBits->HL1); /* HL1 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[1023], 1023,
+	                                     oldBits->LH1, newBits->LH1); /* LH1 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[2046], 961,
+	                                     oldBits->HH1, newBits->HH1); /* HH1 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3007], 272,
+	                                     oldBits->HL2, newBits->HL2); /* HL2 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3279], 272,
+	                                     oldBits->LH2, newBits->LH2); /* LH2 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3551], 256,
+	                                     oldBits->HH2, newBits->HH2); /* HH2 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3807], 72,
+	                                     oldBits->HL3, newBits->HL3); /* HL3 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3879], 72,
+	                                     oldBits->LH3, newBits->LH3); /* LH3 */
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[3951], 64,
+	                                     oldBits->HH3, newBits->HH3); /* HH3 */
+
+	state.nonLL = FALSE;
+	progressive_rfx_upgrade_block_encode(&state, &coeffs[4015], 81,
+	                                     oldBits->LL3, newBits->LL3); /* LL3 */
+	progressive_rfx_srl_write_finish(&state);
+	BitStream_Flush(state.raw);
+	*srlLen = (state.srl->position + 7) / 8;
+	*rawLen = (state.raw->position + 7) / 8;
+
+	if ((*srlLen > capacity) || (*rawLen > capacity))
+		return -1;
+
+	return 1;
+}
+
+static int progressive_encode_tile_first(PROGRESSIVE_CONTEXT* progressive,
+        RFX_PROGRESSIVE_TILE* tile, const BYTE* pSrcData, UINT32 SrcFormat,
+        UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight)
+{
+	int status;
+	int index;
+	UINT32 blockLen;
+	BYTE* pBuffer;
+	BYTE* pDstBuffer;
+	INT16* temp;
+	INT16* pSrcDst[3];
+	INT16* pCurrent[3];
+	BYTE* pDstData[3];
+	UINT32 dstLen[3];
+	const RFX_COMPONENT_CODEC_QUANT* bits[3];
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+	wStream* s = progressive->buffer;
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+
+	if (!tile->current)
+	{
+		tile->current = (BYTE*) _aligned_malloc((8192 + 32) * 3, 16);
+
+		if (!tile->current)
+			return -1;
+	}
+
+	quantProg = progressive_encode_get_quant_prog(progressive, 0);
+	bits[0] = &(quantProg->yQuantValues);
+	bits[1] = &(quantProg->cbQuantValues);
+	bits[2] = &(quantProg->crQuantValues);
+
+	pBuffer = tile->current;
+	pCurrent[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pCurrent[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pCurrent[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	pBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pDstBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	temp = (INT16*) BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
+
+	if (!pBuffer || !pDstBuffer || !temp)
+	{
+		status = -1;
+		goto fail;
+	}
+
+	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	rfx_encode_format_rgb(pSrcData, nWidth, nHeight, nSrcStep, SrcFormat, NULL,
+	                      pCurrent[0], pCurrent[1], pCurrent[2]);
+	prims->RGBToYCbCr_16s16s_P3P3((const INT16**) pCurrent, 64 * sizeof(INT16),
+	                              pCurrent, 64 * sizeof(INT16), &roi_64x64);
+
+	for (index = 0; index < 3; index++)
+	{
+		pDstData[index] = &pDstBuffer[(8192 + 32) * index];
+		progressive_rfx_dwt_2d_encode(pCurrent[index], temp);
+		progressive_rfx_encode_quant(pCurrent[index], &progressive_encode_quant);
+		status = progressive_rfx_encode_first_component(pCurrent[index], bits[index],
+		         pSrcDst[index], pDstData[index], 8192);
+
+		if ((status <= 0) || (status > 8192))
+		{
+			status = -1;
+			goto fail;
+		}
+
+		dstLen[index] = (UINT32) status;
+	}
+
+	blockLen = 6 + 17 + dstLen[0] + dstLen[1] + dstLen[2];
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+	{
+		status = -1;
+		goto fail;
+	}
+
+	tile->blockType = PROGRESSIVE_WBT_TILE_FIRST;
+	tile->blockLen = blockLen;
+	tile->quantIdxY = 0;
+	tile->quantIdxCb = 0;
+	tile->quantIdxCr = 0;
+	tile->flags = 0;
+	tile->quality = progressive_encode_get_quality(0);
+	tile->pass = 1;
+	Stream_Write_UINT16(s, tile->blockType); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, tile->blockLen); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, tile->quantIdxY); /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, tile->quantIdxCb); /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, tile->quantIdxCr); /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx); /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx); /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, tile->flags); /* flags (1 byte) */
+	Stream_Write_UINT8(s, tile->quality); /* quality (1 byte) */
+	Stream_Write_UINT16(s, dstLen[0]); /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, dstLen[1]); /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, dstLen[2]); /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0); /* tailLen (2 bytes) */
+	Stream_Write(s, pDstData[0], dstLen[0]);
+	Stream_Write(s, pDstData[1], dstLen[1]);
+	Stream_Write(s, pDstData[2], dstLen[2]);
+	status = 1;
+fail:
+	BufferPool_Return(progressive->bufferPool, temp);
+	BufferPool_Return(progressive->bufferPool, pDstBuffer);
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	return status;
+}
+
+static int progressive_encode_tile_upgrade(PROGRESSIVE_CONTEXT* progressive,
+        RFX_PROGRESSIVE_TILE* tile)
+{
+	int status = -1;
+	int index;
+	UINT32 blockLen;
+	BYTE* pBuffer;
+	BYTE* pSrlBuffer;
+	BYTE* pRawBuffer;
+	INT16* pCurrent[3];
+	BYTE* pSrlData[3];
+	BYTE* pRawData[3];
+	UINT32 srlLen[3];
+	UINT32 rawLen[3];
+	const RFX_COMPONENT_CODEC_QUANT* oldBits[3];
+	const RFX_COMPONENT_CODEC_QUANT* newBits[3];
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProgOld;
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+	wStream* s = progressive->buffer;
+
+	if (!tile->current || !tile->pass)
+		return -1;
+
+	quantProgOld = progressive_encode_get_quant_prog(progressive, tile->pass - 1);
+	quantProg = progressive_encode_get_quant_prog(progressive, tile->pass);
+	oldBits[0] = &(quantProgOld->yQuantValues);
+	oldBits[1] = &(quantProgOld->cbQuantValues);
+	oldBits[2] = &(quantProgOld->crQuantValues);
+	newBits[0] = &(quantProg->yQuantValues);
+	newBits[1] = &(quantProg->cbQuantValues);
+	newBits[2] = &(quantProg->crQuantValues);
+
+	pBuffer = tile->current;
+	pCurrent[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pCurrent[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pCurrent[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	pSrlBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+	pRawBuffer = (BYTE*) BufferPool_Take(progressive->bufferPool, -1);
+
+	if (!pSrlBuffer || !pRawBuffer)
+		goto fail;
+
+	for (index = 0; index < 3; index++)
+	{
+		pSrlData[index] = &pSrlBuffer[(8192 + 32) * index];
+		pRawData[index] = &pRawBuffer[(8192 + 32) * index];
+
+		if (progressive_rfx_upgrade_component_encode(pCurrent[index], oldBits[index],
+		        newBits[index], pSrlData[index], &srlLen[index],
+		        pRawData[index], &rawLen[index], 8192) < 0)
+			goto fail;
+	}
+
+	blockLen = 6 + 20;
+
+	for (index = 0; index < 3; index++)
+		blockLen += srlLen[index] + rawLen[index];
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		goto fail;
+
+	tile->blockType = PROGRESSIVE_WBT_TILE_UPGRADE;
+	tile->blockLen = blockLen;
+	tile->quality = progressive_encode_get_quality(tile->pass);
+	tile->pass++;
+	Stream_Write_UINT16(s, tile->blockType); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, tile->blockLen); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, tile->quantIdxY); /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, tile->quantIdxCb); /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, tile->quantIdxCr); /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, tile->xIdx); /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, tile->yIdx); /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, tile->quality); /* quality (1 byte) */
+	Stream_Write_UINT16(s, srlLen[0]); /* ySrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[0]); /* yRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[1]); /* cbSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[1]); /* cbRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[2]); /* crSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[2]); /* crRawLen (2 bytes) */
+
+	for (index = 0; index < 3; index++)
+	{
+		Stream_Write(s, pSrlData[index], srlLen[index]);
+		Stream_Write(s, pRawData[index], rawLen[index]);
+	}
+
+	status = 1;
+fail:
+	BufferPool_Return(progressive->bufferPool, pRawBuffer);
+	BufferPool_Return(progressive->bufferPool, pSrlBuffer);
+	return status;
+}
+
+static BOOL progressive_write_header_blocks(PROGRESSIVE_CONTEXT* progressive)
+{
+	wStream* s = progressive->buffer;
+
+	if (!Stream_EnsureRemainingCapacity(s, 12 + 10))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_SYNC); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12); /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, 0xCACCACCA); /* magic (4 bytes) */
+	Stream_Write_UINT16(s, 0x0100); /* version (2 bytes) */
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_CONTEXT); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 10); /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0); /* ctxId (1 byte) */
+	Stream_Write_UINT16(s, 64); /* tileSize (2 bytes) */
+	Stream_Write_UINT8(s, RFX_SUBBAND_DIFFING); /* flags (1 byte) */
+	return TRUE;
+}
+
+static BOOL progressive_write_region_header(PROGRESSIVE_CONTEXT* progressive,
+        const RECTANGLE_16* rects, UINT32 numRects)
+{
+	UINT32 index;
+	BYTE block[16];
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg;
+	wStream* s = progressive->buffer;
+	const UINT32 numProgQuant = ARRAYSIZE(progressive_encode_quant_prog);
+
+	if (!Stream_EnsureRemainingCapacity(s, 6 + 12 + (numRects * 8) + 5 + (numProgQuant * 16)))
+		return FALSE;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 0); /* blockLen (4 bytes), filled in later */
+	Stream_Write_UINT8(s, 64); /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, numRects); /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1); /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, numProgQuant); /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE); /* flags (1 byte) */
+	Stream_Write_UINT16(s, 0); /* numTiles (2 bytes), filled in later */
+	Stream_Write_UINT32(s, 0); /* tileDataSize (4 bytes), filled in later */
+
+	for (index = 0; index < numRects; index++)
+	{
+		Stream_Write_UINT16(s, rects[index].left); /* x (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].top); /* y (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].right - rects[index].left); /* width (2 bytes) */
+		Stream_Write_UINT16(s, rects[index].bottom - rects[index].top); /* height (2 bytes) */
+	}
+
+	progressive_component_codec_quant_write(block, &progressive_encode_quant);
+	Stream_Write(s, block, 5); /* quantVals (5 bytes) */
+
+	for (index = 0; index < numProgQuant; index++)
+	{
+		quantProg = &progressive_encode_quant_prog[index];
+		block[0] = quantProg->quality;
+		progressive_component_codec_quant_write(&block[1], &(quantProg->yQuantValues));
+		progressive_component_codec_quant_write(&block[6], &(quantProg->cbQuantValues));
+		progressive_component_codec_quant_write(&block[11], &(quantProg->crQuantValues));
+		Stream_Write(s, block, 16); /* quantProgVals (16 bytes) */
+	}
+
+	return TRUE;
+}
+
+/**
+ * The caller painted the tiles inside rect on its own (e.g. a solid fill),
+ * do not refine their previous content with upgrade passes any more.
+ */
+BOOL progressive_cancel_upgrades(PROGRESSIVE_CONTEXT* progressive, UINT16 surfaceId,
+                                 const RECTANGLE_16* rect)
+{
+	UINT32 xIdx, yIdx;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+
+	if (!progressive || !rect)
+		return FALSE;
+
+	surface = (PROGRESSIVE_SURFACE_CONTEXT*) progressive_get_surface_data(progressive,
+	          surfaceId);
+
+	if (!surface)
+		return TRUE;
+
+	for (yIdx = (rect->top + 63U) / 64; yIdx < surface->gridHeight; yIdx++)
+	{
+		const UINT32 y = yIdx * 64;
+
+		if (MIN(y + 64, surface->height) > rect->bottom)
+			break;
+
+		for (xIdx = (rect->left + 63U) / 64; xIdx < surface->gridWidth; xIdx++)
+		{
+			const UINT32 x = xIdx * 64;
+
+			if (MIN(x + 64, surface->width) > rect->right)
+				break;
+
+			surface->tiles[(yIdx * surface->gridWidth) + xIdx].pass = 0;
+		}
+	}
+
+	return TRUE;
+}
+
 int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
-                         UINT32 SrcSize, BYTE** ppDstData, UINT32* pDstSize)
+                         UINT32 SrcSize, UINT32 SrcFormat, UINT32 Width, UINT32 Height,
+                         UINT32 Stride, const REGION16* invalidRegion, UINT16 surfaceId,
+                         BYTE** ppDstData, UINT32* pDstSize)
 {
-	return -1;
+	int rc = -1;
+	UINT32 i;
+	UINT32 index;
+	UINT32 xIdx, yIdx;
+	UINT32 numTiles = 0;
+	UINT32 numRects = 0;
+	size_t regionPos;
+	size_t tilesPos;
+	size_t endPos;
+	const RECTANGLE_16* rects;
+	RECTANGLE_16 surfaceRect;
+	RECTANGLE_16 tileRect;
+	REGION16 updateRegion;
+	RFX_PROGRESSIVE_TILE* tile;
+	PROGRESSIVE_SURFACE_CONTEXT* surface;
+	wStream* s;
+
+	if (!progressive || !ppDstData || !pDstSize)
+		return -1;
+
+	*ppDstData = NULL;
+	*pDstSize = 0;
+
+	if (progressive_create_surface_context(progressive, surfaceId, Width, Height) < 0)
+		return -1;
+
+	surface = (PROGRESSIVE_SURFACE_CONTEXT*) progressive_get_surface_data(progressive,
+	          surfaceId);
+
+	if (!surface || (surface->width != Width) || (surface->height != Height))
+		return -1;
+
+	if (progressive->cTiles < surface->gridSize)
+	{
+		RFX_PROGRESSIVE_TILE** tmpBuf = (RFX_PROGRESSIVE_TILE**) realloc(progressive->tiles,
+		                                surface->gridSize * sizeof(RFX_PROGRESSIVE_TILE*));
+
+		if (!tmpBuf)
+			return -1;
+
+		progressive->tiles = tmpBuf;
+		progressive->cTiles = surface->gridSize;
+	}
+
+	surfaceRect.left = 0;
+	surfaceRect.top = 0;
+	surfaceRect.right = Width;
+	surfaceRect.bottom = Height;
+	region16_init(&updateRegion);
+
+	/* tiles which still have upgrade passes to go */
+	for (index = 0; index < surface->gridSize; index++)
+	{
+		tile = &(surface->tiles[index]);
+		tile->blockType = 0;
+
+		if ((tile->pass > 0) && (tile->pass < PROGRESSIVE_ENCODE_PASSES))
+			tile->blockType = PROGRESSIVE_WBT_TILE_UPGRADE;
+	}
+
+	/* invalidated tiles restart with the first pass */
+	if (invalidRegion && !region16_is_empty(invalidRegion))
+	{
+		if (!pSrcData || (SrcSize < (Stride * Height)))
+			goto fail;
+
+		if (!region16_intersect_rect(&updateRegion, invalidRegion, &surfaceRect))
+			goto fail;
+
+		rects = region16_rects(&updateRegion, &numRects);
+
+		for (i = 0; i < numRects; i++)
+		{
+			for (yIdx = rects[i].top / 64; yIdx < (rects[i].bottom + 63U) / 64; yIdx++)
+			{
+				for (xIdx = rects[i].left / 64; xIdx < (rects[i].right + 63U) / 64; xIdx++)
+				{
+					tile = &(surface->tiles[(yIdx * surface->gridWidth) + xIdx]);
+					tile->blockType = PROGRESSIVE_WBT_TILE_FIRST;
+				}
+			}
+		}
+	}
+
+	for (yIdx = 0; yIdx < surface->gridHeight; yIdx++)
+	{
+		for (xIdx = 0; xIdx < surface->gridWidth; xIdx++)
+		{
+			tile = &(surface->tiles[(yIdx * surface->gridWidth) + xIdx]);
+
+			if (!tile->blockType)
+				continue;
+
+			tile->xIdx = xIdx;
+			tile->yIdx = yIdx;
+			tile->x = xIdx * 64;
+			tile->y = yIdx * 64;
+			tile->width = MIN(64, Width - tile->x);
+			tile->height = MIN(64, Height - tile->y);
+			progressive->tiles[numTiles++] = tile;
+
+			if (tile->blockType == PROGRESSIVE_WBT_TILE_UPGRADE)
+			{
+				tileRect.left = tile->x;
+				tileRect.top = tile->y;
+				tileRect.right = tile->x + tile->width;
+				tileRect.bottom = tile->y + tile->height;
+
+				if (!region16_union_rect(&updateRegion, &updateRegion, &tileRect))
+					goto fail;
+			}
+		}
+	}
+
+	if (!numTiles)
+	{
+		rc = 0;
+		goto fail;
+	}
+
+	if (!progressive->buffer)
+	{
+		progressive->buffer = Stream_New(NULL, 4096);
+
+		if (!progressive->buffer)
+			goto fail;
+	}
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+
+	if (!progressive->syncSent)
+	{
+		if (!progressive_write_header_blocks(progressive))
+			goto fail;
+
+		progressive->syncSent = TRUE;
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 12))
+		goto fail;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 12); /* blockLen (4 bytes) */
+	Stream_Write_UINT32(s, progressive->frameIndex++); /* frameIndex (4 bytes) */
+	Stream_Write_UINT16(s, 1); /* regionCount (2 bytes) */
+	regionPos = Stream_GetPosition(s);
+	rects = region16_rects(&updateRegion, &numRects);
+
+	if (numRects > UINT16_MAX)
+		goto fail;
+
+	if (!progressive_write_region_header(progressive, rects, numRects))
+		goto fail;
+
+	tilesPos = Stream_GetPosition(s);
+
+	for (index = 0; index < numTiles; index++)
+	{
+		int status;
+		tile = progressive->tiles[index];
+
+		if (tile->blockType == PROGRESSIVE_WBT_TILE_FIRST)
+		{
+			const BYTE* pTileData = &pSrcData[(tile->y * Stride) +
+			                                  (tile->x * GetBytesPerPixel(SrcFormat))];
+			status = progressive_encode_tile_first(progressive, tile, pTileData, SrcFormat,
+			                                       Stride, tile->width, tile->height);
+		}
+		else
+			status = progressive_encode_tile_upgrade(progressive, tile);
+
+		if (status < 0)
+			goto fail;
+	}
+
+	endPos = Stream_GetPosition(s);
+	Stream_SetPosition(s, regionPos + 2);
+	Stream_Write_UINT32(s, (UINT32)(endPos - regionPos)); /* blockLen (4 bytes) */
+	Stream_SetPosition(s, regionPos + 12);
+	Stream_Write_UINT16(s, numTiles); /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(endPos - tilesPos)); /* tileDataSize (4 bytes) */
+	Stream_SetPosition(s, endPos);
+
+	if (!Stream_EnsureRemainingCapacity(s, 6))
+		goto fail;
+
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_END); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, 6); /* blockLen (4 bytes) */
+	Stream_SealLength(s);
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32) Stream_Length(s);
+	rc = 1;
+fail:
+	region16_uninit(&updateRegion);
+	return rc;
 }
 
 BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
@@ -1941,6 +2872,8 @@ BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return FALSE;
 
+	progressive->frameIndex = 0;
+	progressive->syncSent = FALSE;
 	return TRUE;
 }
 
@@ -2009,6 +2942,7 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	free(progressive->tiles);
 	free(progressive->quantVals);
 	free(progressive->quantProgVals);
+	Stream_Free(progressive->buffer, TRUE);
 
 	if (progressive->SurfaceContexts)
 	{
@@ -22,6 +22,7 @@
 #define INTERNAL_CODEC_PROGRESSIVE_H
 
 #include <winpr/wlog.h>
+#include <winpr/stream.h>
 #include <winpr/collections.h>
 
 #include <freerdp/codec/rfx.h>
@@ -227,6 +228,10 @@ struct _PROGRESSIVE_CONTEXT
 
 	wHashTable* SurfaceContexts;
 	wLog* log;
+
+	wStream* buffer;
+	UINT32 frameIndex;
+	BOOL syncSent;
 };
 
 #endif /* INTERNAL_CODEC_PROGRESSIVE_H */
@@ -801,6 +801,66 @@ BOOL region16_intersect_rect(REGION16* dst, const REGION16* src, const RECTANGLE
 	return region16_simplify_bands(dst);
 }
 
+BOOL region16_subtract_rect(REGION16* dst, const REGION16* src, const RECTANGLE_16* rect)
+{
+	REGION16 result;
+	const RECTANGLE_16* srcPtr, *endPtr;
+	UINT32 nbRects;
+	BOOL ret = TRUE;
+	assert(src);
+	assert(src->data);
+
+	if (!region16_intersects_rect(src, rect))
+		return region16_copy(dst, src);
+
+	srcPtr = region16_rects(src, &nbRects);
+	region16_init(&result);
+
+	/* keep the parts of each rectangle above, below, left and right of the
+	 * removed one, region16_union_rect() merges them back into bands
+	 */
+	for (endPtr = srcPtr + nbRects; ret && (srcPtr < endPtr); srcPtr++)
+	{
+		RECTANGLE_16 common, parts[4];
+		int i;
+
+		if (!rectangles_intersection(srcPtr, rect, &common))
+		{
+			ret = region16_union_rect(&result, &result, srcPtr);
+			continue;
+		}
+
+		parts[0].left = srcPtr->left;
+		parts[0].top = srcPtr->top;
+		parts[0].right = srcPtr->right;
+		parts[0].bottom = common.top;
+		parts[1].left = srcPtr->left;
+		parts[1].top = common.bottom;
+		parts[1].right = srcPtr->right;
+		parts[1].bottom = srcPtr->bottom;
+		parts[2].left = srcPtr->left;
+		parts[2].top = common.top;
+		parts[2].right = common.left;
+		parts[2].bottom = common.bottom;
+		parts[3].left = common.right;
+		parts[3].top = common.top;
+		parts[3].right = srcPtr->right;
+		parts[3].bottom = common.bottom;
+
+		for (i = 0; ret && (i < 4); i++)
+		{
+			if (!rectangle_is_empty(&parts[i]))
+				ret = region16_union_rect(&result, &result, &parts[i]);
+		}
+	}
+
+	if (ret)
+		ret = region16_copy(dst, &result);
+
+	region16_uninit(&result);
+	return ret;
+}
+
 void region16_uninit(REGION16* region)
 {
 	assert(region);
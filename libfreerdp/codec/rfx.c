@@ -32,6 +32,7 @@
 #include <winpr/tchar.h>
 #include <winpr/sysinfo.h>
 #include <winpr/registry.h>
+#include <winpr/interlocked.h>
 #include <winpr/tchar.h>
 
 #include <freerdp/log.h>
@@ -261,6 +262,10 @@ RFX_CONTEXT* rfx_context_new(BOOL encoder)
 	if (!priv->BufferPool)
 		goto error_BufferPool;
 
+	if (!(priv->PipelineEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto error_PipelineEvent;
+
+	InitializeCriticalSection(&priv->PipelineLock);
 #ifdef _WIN32
 	{
 		BOOL isVistaOrLater;
@@ -340,6 +345,9 @@ RFX_CONTEXT* rfx_context_new(BOOL encoder)
 error_threadPool_minimum:
 	CloseThreadpool(priv->ThreadPool);
 error_threadPool:
+	DeleteCriticalSection(&priv->PipelineLock);
+	CloseHandle(priv->PipelineEvent);
+error_PipelineEvent:
 	BufferPool_Free(priv->BufferPool);
 error_BufferPool:
 	ObjectPool_Free(priv->TilePool);
@@ -362,6 +370,7 @@ void rfx_context_free(RFX_CONTEXT* context)
 	assert(NULL != context->priv->TilePool);
 	assert(NULL != context->priv->BufferPool);
 	priv = context->priv;
+	rfx_process_message_flush(context);
 	rfx_message_free(context, &context->currentMessage);
 	free(context->quants);
 	ObjectPool_Free(priv->TilePool);
@@ -380,6 +389,8 @@ void rfx_context_free(RFX_CONTEXT* context)
 #endif
 	}
 
+	DeleteCriticalSection(&priv->PipelineLock);
+	CloseHandle(priv->PipelineEvent);
 	BufferPool_Free(context->priv->BufferPool);
 	free(context->priv);
 	free(context);
@@ -406,6 +417,8 @@ BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height)
 	if (!context)
 		return FALSE;
 
+	/* nothing decoded before the reset may land afterwards */
+	rfx_process_message_flush(context);
 	context->width = width;
 	context->height = height;
 	context->state = RFX_STATE_SEND_HEADERS;
@@ -748,7 +761,8 @@ static void CALLBACK rfx_process_message_tile_work_callback(
 }
 
 static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
-                                        RFX_MESSAGE* message, wStream* s, UINT16* pExpectedBlockType)
+                                        RFX_MESSAGE* message, wStream* s, UINT16* pExpectedBlockType,
+                                        BOOL decodeTiles)
 {
 	BOOL rc;
 	int i, close_cnt;
@@ -859,7 +873,7 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
 	message->tiles = tmpTiles;
 	message->numTiles = numTiles;
 
-	if (context->priv->UseThreads)
+	if (decodeTiles && context->priv->UseThreads)
 	{
 		work_objects = (PTP_WORK*) calloc(message->numTiles, sizeof(PTP_WORK));
 		params = (RFX_TILE_PROCESS_WORK_PARAM*) calloc(message->numTiles,
@@ -941,7 +955,11 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
 		tile->x = tile->xIdx * 64;
 		tile->y = tile->yIdx * 64;
 
-		if (context->priv->UseThreads)
+		if (!decodeTiles)
+		{
+			/* the tile data stays referenced until the pipeline decoded it */
+		}
+		else if (context->priv->UseThreads)
 		{
 			assert(params);
 			params[i].context = context;
@@ -956,7 +974,6 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
 				break;
 			}
 
-			SubmitThreadpoolWork(work_objects[i]);
 			close_cnt = i + 1;
 		}
 		else
@@ -967,8 +984,13 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
 		Stream_SetPosition(s, pos);
 	}
 
+	if (!decodeTiles)
+		return rc;
+
 	if (context->priv->UseThreads)
 	{
+		SubmitThreadpoolWorkBatch(work_objects, close_cnt);
+
 		for (i = 0; i < close_cnt; i++)
 		{
 			WaitForThreadpoolWorkCallbacks(work_objects[i], FALSE);
@@ -991,26 +1013,13 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context,
 	return rc;
 }
 
-BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
-                         UINT32 left, UINT32 top,
-                         BYTE* dst, UINT32 dstFormat,
-                         UINT32 dstStride, UINT32 dstHeight,
-                         REGION16* invalidRegion)
+static BOOL rfx_process_message_blocks(RFX_CONTEXT* context, RFX_MESSAGE* message, wStream* s,
+                                       BOOL decodeTiles)
 {
-	REGION16 updateRegion;
 	UINT32 blockLen;
 	UINT32 blockType;
-	RFX_MESSAGE* message = &context->currentMessage;
-	wStream inStream, *s = &inStream;
 	BOOL ok = TRUE;
 
-	if (!context || !data || !length)
-		return FALSE;
-
-	Stream_StaticInit(s, (BYTE*)data, length);
-
-	message->freeRects = TRUE;
-
 	while (ok && Stream_GetRemainingLength(s) > 6)
 	{
 		wStream subStream;
@@ -1123,7 +1132,8 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 				break;
 
 			case WBT_EXTENSION:
-				ok = rfx_process_message_tileset(context, message, &subStream, &context->expectedDataBlockType);
+				ok = rfx_process_message_tileset(context, message, &subStream, &context->expectedDataBlockType,
+				                                 decodeTiles);
 				break;
 
 			case WBT_FRAME_END:
@@ -1136,71 +1146,398 @@ BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
 		}
 	}
 
-	if (ok)
+	return ok;
+}
+
+/* copies the decoded tiles clipped to the message rectangles to dst */
+static BOOL rfx_process_message_update(RFX_MESSAGE* message, UINT32 format,
+                                       UINT32 left, UINT32 top,
+                                       BYTE* dst, UINT32 dstFormat,
+                                       UINT32 dstStride, UINT32 dstHeight,
+                                       REGION16* invalidRegion)
+{
+	UINT32 i, j;
+	BOOL rc = TRUE;
+	UINT32 nbUpdateRects;
+	REGION16 updateRegion;
+	REGION16 clippingRects;
+	const RECTANGLE_16* updateRects;
+	const DWORD formatSize = GetBytesPerPixel(format);
+	const UINT32 dstWidth = dstStride / GetBytesPerPixel(dstFormat);
+	region16_init(&clippingRects);
+
+	for (i = 0; i < message->numRects; i++)
+	{
+		RECTANGLE_16 clippingRect;
+		const RFX_RECT* rect = &(message->rects[i]);
+		clippingRect.left = MIN(left + rect->x, dstWidth);
+		clippingRect.top = MIN(top + rect->y, dstHeight);
+		clippingRect.right = MIN(clippingRect.left + rect->width, dstWidth);
+		clippingRect.bottom = MIN(clippingRect.top + rect->height, dstHeight);
+		region16_union_rect(&clippingRects, &clippingRects, &clippingRect);
+	}
+
+	for (i = 0; rc && (i < message->numTiles); i++)
 	{
-		UINT32 i, j;
-		UINT32 nbUpdateRects;
-		REGION16 clippingRects;
-		const RECTANGLE_16* updateRects;
-		const DWORD formatSize = GetBytesPerPixel(context->pixel_format);
-		const UINT32 dstWidth = dstStride / GetBytesPerPixel(dstFormat);
-		region16_init(&clippingRects);
+		RECTANGLE_16 updateRect;
+		const RFX_TILE* tile = rfx_message_get_tile(message, i);
+		updateRect.left = left + tile->x;
+		updateRect.top = top + tile->y;
+		updateRect.right = updateRect.left + 64;
+		updateRect.bottom = updateRect.top + 64;
+		region16_init(&updateRegion);
+		region16_intersect_rect(&updateRegion, &clippingRects, &updateRect);
+		updateRects = region16_rects(&updateRegion, &nbUpdateRects);
 
-		for (i = 0; i < message->numRects; i++)
+		for (j = 0; j < nbUpdateRects; j++)
 		{
-			RECTANGLE_16 clippingRect;
-			const RFX_RECT* rect = &(message->rects[i]);
-			clippingRect.left = MIN(left + rect->x, dstWidth);
-			clippingRect.top = MIN(top + rect->y, dstHeight);
-			clippingRect.right = MIN(clippingRect.left + rect->width, dstWidth);
-			clippingRect.bottom = MIN(clippingRect.top + rect->height, dstHeight);
-			region16_union_rect(&clippingRects, &clippingRects, &clippingRect);
+			const UINT32 stride = 64 * formatSize;
+			const UINT32 nXDst = updateRects[j].left;
+			const UINT32 nYDst = updateRects[j].top;
+			const UINT32 nXSrc = nXDst - updateRect.left;
+			const UINT32 nYSrc = nYDst - updateRect.top;
+			const UINT32 nWidth = updateRects[j].right - updateRects[j].left;
+			const UINT32 nHeight = updateRects[j].bottom - updateRects[j].top;
+
+			if (!freerdp_image_copy(dst, dstFormat, dstStride,
+			                        nXDst, nYDst, nWidth, nHeight,
+			                        tile->data, format, stride, nXSrc, nYSrc, NULL, FREERDP_FLIP_NONE))
+			{
+				rc = FALSE;
+				break;
+			}
+
+			if (invalidRegion)
+				region16_union_rect(invalidRegion, invalidRegion, &updateRects[j]);
 		}
 
-		for (i = 0; i < message->numTiles; i++)
+		region16_uninit(&updateRegion);
+	}
+
+	region16_uninit(&clippingRects);
+	return rc;
+}
+
+BOOL rfx_process_message(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
+                         UINT32 left, UINT32 top,
+                         BYTE* dst, UINT32 dstFormat,
+                         UINT32 dstStride, UINT32 dstHeight,
+                         REGION16* invalidRegion)
+{
+	RFX_MESSAGE* message;
+	wStream inStream, *s = &inStream;
+
+	if (!context || !data || !length)
+		return FALSE;
+
+	/* messages still in the pipeline are older and have to be drawn first */
+	if (!rfx_process_message_flush(context))
+		return FALSE;
+
+	message = &context->currentMessage;
+	Stream_StaticInit(s, (BYTE*)data, length);
+	message->freeRects = TRUE;
+
+	if (!rfx_process_message_blocks(context, message, s, TRUE))
+		return FALSE;
+
+	return rfx_process_message_update(message, context->pixel_format, left, top, dst, dstFormat,
+	                                  dstStride, dstHeight, invalidRegion);
+}
+
+/**
+ * Decoder pipeline
+ *
+ * rfx_process_message_async parses a message on the calling thread, copies
+ * what the tiles reference and queues one work item per tile. The tiles of
+ * up to PipelineDepth messages are decoded by the thread pool at the same
+ * time. A message is drawn once all its tiles are decoded and all older
+ * messages were drawn, so destinations are updated in submission order.
+ */
+
+typedef struct
+{
+	RFX_PIPELINE_MESSAGE* message;
+	RFX_TILE* tile;
+} RFX_PIPELINE_TILE_PARAM;
+
+struct _RFX_PIPELINE_MESSAGE
+{
+	RFX_CONTEXT* context;
+	RFX_MESSAGE message;
+	BYTE* data;
+	UINT32* quants;
+	RLGR_MODE mode;
+	UINT32 format;
+
+	UINT32 left;
+	UINT32 top;
+	BYTE* dst;
+	UINT32 dstFormat;
+	UINT32 dstStride;
+	UINT32 dstHeight;
+	REGION16* invalidRegion;
+
+	PTP_WORK* work;
+	RFX_PIPELINE_TILE_PARAM* params;
+	volatile LONG pending;
+	BOOL failed;
+
+	RFX_PIPELINE_MESSAGE* next;
+};
+
+static void rfx_pipeline_message_free(RFX_CONTEXT* context, RFX_PIPELINE_MESSAGE* pm)
+{
+	UINT32 i;
+
+	if (!pm)
+		return;
+
+	if (pm->work)
+	{
+		for (i = 0; i < pm->message.numTiles; i++)
 		{
-			RECTANGLE_16 updateRect;
-			const RFX_TILE* tile = rfx_message_get_tile(message, i);
-			updateRect.left = left + tile->x;
-			updateRect.top = top + tile->y;
-			updateRect.right = updateRect.left + 64;
-			updateRect.bottom = updateRect.top + 64;
-			region16_init(&updateRegion);
-			region16_intersect_rect(&updateRegion, &clippingRects, &updateRect);
-			updateRects = region16_rects(&updateRegion, &nbUpdateRects);
-
-			for (j = 0; j < nbUpdateRects; j++)
-			{
-				const UINT32 stride = 64 * formatSize;
-				const UINT32 nXDst = updateRects[j].left;
-				const UINT32 nYDst = updateRects[j].top;
-				const UINT32 nXSrc = nXDst - updateRect.left;
-				const UINT32 nYSrc = nYDst - updateRect.top;
-				const UINT32 nWidth = updateRects[j].right - updateRects[j].left;
-				const UINT32 nHeight = updateRects[j].bottom - updateRects[j].top;
-
-				if (!freerdp_image_copy(dst, dstFormat, dstStride,
-				                        nXDst, nYDst, nWidth, nHeight,
-				                        tile->data, context->pixel_format, stride, nXSrc, nYSrc, NULL, FREERDP_FLIP_NONE))
-				{
-					region16_uninit(&updateRegion);
-					return FALSE;
-				}
+			if (pm->work[i])
+				CloseThreadpoolWork(pm->work[i]);
+		}
+	}
 
-				if (invalidRegion)
-					region16_union_rect(invalidRegion, invalidRegion, &updateRects[j]);
-			}
+	rfx_message_free(context, &pm->message);
+	free(pm->work);
+	free(pm->params);
+	free(pm->quants);
+	free(pm->data);
+	free(pm);
+}
+
+/* draws the finished messages at the head of the pipeline */
+static void rfx_pipeline_retire(RFX_CONTEXT* context)
+{
+	RFX_PIPELINE_MESSAGE* pm;
+	RFX_CONTEXT_PRIV* priv = context->priv;
+	EnterCriticalSection(&priv->PipelineLock);
+
+	while ((pm = priv->PipelineHead) && (InterlockedCompareExchange(&pm->pending, 0, 0) == 0))
+	{
+		priv->PipelineHead = pm->next;
+
+		if (!priv->PipelineHead)
+			priv->PipelineTail = NULL;
 
-			region16_uninit(&updateRegion);
+		if (pm->failed ||
+		    !rfx_process_message_update(&pm->message, pm->format, pm->left, pm->top, pm->dst,
+		                                pm->dstFormat, pm->dstStride, pm->dstHeight,
+		                                pm->invalidRegion))
+		{
+			WLog_Print(priv->log, WLOG_ERROR, "failed to decode frame %"PRIu32"",
+			           pm->message.frameIdx);
+			priv->PipelineFailed = TRUE;
 		}
 
-		region16_uninit(&clippingRects);
-		return TRUE;
+		rfx_pipeline_message_free(context, pm);
+		priv->PipelineCount--;
+		SetEvent(priv->PipelineEvent);
+	}
+
+	LeaveCriticalSection(&priv->PipelineLock);
+}
+
+static void CALLBACK rfx_pipeline_tile_work_callback(PTP_CALLBACK_INSTANCE instance,
+        void* context, PTP_WORK work)
+{
+	RFX_PIPELINE_TILE_PARAM* param = (RFX_PIPELINE_TILE_PARAM*) context;
+	RFX_PIPELINE_MESSAGE* pm = param->message;
+	RFX_CONTEXT* rfx = pm->context;
+
+	if (!rfx_decode_rgb_ex(rfx, param->tile, pm->quants, pm->mode, pm->format,
+	                       param->tile->data, 64 * 4))
+		pm->failed = TRUE;
+
+	/* the message, param and work may be gone once the count dropped */
+	if (InterlockedDecrement(&pm->pending) == 0)
+		rfx_pipeline_retire(rfx);
+}
+
+/* waits until at most count messages are in the pipeline */
+static void rfx_pipeline_wait(RFX_CONTEXT* context, UINT32 count)
+{
+	RFX_CONTEXT_PRIV* priv = context->priv;
+
+	while (TRUE)
+	{
+		UINT32 inflight;
+		EnterCriticalSection(&priv->PipelineLock);
+		inflight = priv->PipelineCount;
+
+		/* winpr has no auto-reset events, retiring sets it under the lock as well */
+		if (inflight > count)
+			ResetEvent(priv->PipelineEvent);
+
+		LeaveCriticalSection(&priv->PipelineLock);
+
+		if (inflight <= count)
+			break;
+
+		WaitForSingleObject(priv->PipelineEvent, INFINITE);
+	}
+}
+
+static BOOL rfx_pipeline_submit(RFX_CONTEXT* context, RFX_PIPELINE_MESSAGE* pm)
+{
+	UINT32 i;
+	UINT32 count = 0;
+	RFX_CONTEXT_PRIV* priv = context->priv;
+	const UINT32 numTiles = pm->message.numTiles;
+
+	if ((numTiles > 0) && priv->UseThreads)
+	{
+		pm->work = (PTP_WORK*) calloc(numTiles, sizeof(PTP_WORK));
+		pm->params = (RFX_PIPELINE_TILE_PARAM*) calloc(numTiles, sizeof(RFX_PIPELINE_TILE_PARAM));
+
+		if (!pm->work || !pm->params)
+			return FALSE;
+
+		for (count = 0; count < numTiles; count++)
+		{
+			pm->params[count].message = pm;
+			pm->params[count].tile = pm->message.tiles[count];
+
+			if (!(pm->work[count] = CreateThreadpoolWork(rfx_pipeline_tile_work_callback,
+			                        (void*) &pm->params[count], &priv->ThreadPoolEnv)))
+			{
+				WLog_ERR(TAG, "CreateThreadpoolWork failed.");
+				return FALSE;
+			}
+		}
+	}
+	else
+	{
+		/* no thread pool, decode right away */
+		for (i = 0; i < numTiles; i++)
+		{
+			if (!rfx_decode_rgb_ex(context, pm->message.tiles[i], pm->quants, pm->mode, pm->format,
+			                       pm->message.tiles[i]->data, 64 * 4))
+				pm->failed = TRUE;
+		}
+	}
+
+	pm->pending = (LONG) count;
+	EnterCriticalSection(&priv->PipelineLock);
+
+	if (priv->PipelineTail)
+		priv->PipelineTail->next = pm;
+	else
+		priv->PipelineHead = pm;
+
+	priv->PipelineTail = pm;
+	priv->PipelineCount++;
+	LeaveCriticalSection(&priv->PipelineLock);
+
+	if (count > 0)
+		SubmitThreadpoolWorkBatch(pm->work, count);
+	else
+		rfx_pipeline_retire(context);
+
+	return TRUE;
+}
+
+BOOL rfx_context_set_pipeline_depth(RFX_CONTEXT* context, UINT32 depth)
+{
+	if (!context || context->encoder)
+		return FALSE;
+
+	rfx_pipeline_wait(context, 0);
+	context->priv->PipelineDepth = depth;
+	return TRUE;
+}
+
+BOOL rfx_process_message_async(RFX_CONTEXT* context, const BYTE* data, UINT32 length,
+                               UINT32 left, UINT32 top,
+                               BYTE* dst, UINT32 dstFormat,
+                               UINT32 dstStride, UINT32 dstHeight,
+                               REGION16* invalidRegion)
+{
+	wStream s;
+	RFX_PIPELINE_MESSAGE* pm;
+	RFX_CONTEXT_PRIV* priv;
+
+	if (!context || !data || !length)
+		return FALSE;
+
+	priv = context->priv;
+
+	if (priv->PipelineDepth == 0)
+		return rfx_process_message(context, data, length, left, top, dst, dstFormat, dstStride,
+		                           dstHeight, invalidRegion);
+
+	/* bounded queue, wait for the oldest message to be drawn */
+	rfx_pipeline_wait(context, priv->PipelineDepth - 1);
+	pm = (RFX_PIPELINE_MESSAGE*) calloc(1, sizeof(RFX_PIPELINE_MESSAGE));
+
+	if (!pm)
+		return FALSE;
+
+	pm->context = context;
+	pm->message.freeArray = TRUE;
+	pm->message.freeRects = TRUE;
+
+	/* the tiles point into the message data, keep a copy until they are decoded */
+	if (!(pm->data = (BYTE*) malloc(length)))
+		goto fail;
+
+	CopyMemory(pm->data, data, length);
+	Stream_StaticInit(&s, pm->data, length);
+
+	if (!rfx_process_message_blocks(context, &pm->message, &s, FALSE))
+		goto fail;
+
+	/* later messages may change these while the tiles are decoded */
+	if (pm->message.numTiles > 0)
+	{
+		const size_t size = context->numQuant * 10 * sizeof(UINT32);
+
+		if (!(pm->quants = (UINT32*) malloc(size)))
+			goto fail;
+
+		CopyMemory(pm->quants, context->quants, size);
 	}
 
+	pm->mode = context->mode;
+	pm->format = context->pixel_format;
+	pm->left = left;
+	pm->top = top;
+	pm->dst = dst;
+	pm->dstFormat = dstFormat;
+	pm->dstStride = dstStride;
+	pm->dstHeight = dstHeight;
+	pm->invalidRegion = invalidRegion;
+
+	if (!rfx_pipeline_submit(context, pm))
+		goto fail;
+
+	return TRUE;
+fail:
+	rfx_pipeline_message_free(context, pm);
 	return FALSE;
 }
 
+BOOL rfx_process_message_flush(RFX_CONTEXT* context)
+{
+	BOOL rc;
+	RFX_CONTEXT_PRIV* priv;
+
+	if (!context)
+		return FALSE;
+
+	priv = context->priv;
+	rfx_pipeline_wait(context, 0);
+	EnterCriticalSection(&priv->PipelineLock);
+	rc = !priv->PipelineFailed;
+	priv->PipelineFailed = FALSE;
+	LeaveCriticalSection(&priv->PipelineLock);
+	return rc;
+}
+
 UINT16 rfx_message_get_tile_count(RFX_MESSAGE* message)
 {
 	return message->numTiles;
@@ -26,6 +26,10 @@
 /* stride is bytes between rows in the output buffer. */
 FREERDP_LOCAL BOOL rfx_decode_rgb(RFX_CONTEXT* context, RFX_TILE* tile,
                                   BYTE* rgb_buffer, int stride);
+/* decodes with the given quantization values, entropy mode and pixel format */
+FREERDP_LOCAL BOOL rfx_decode_rgb_ex(RFX_CONTEXT* context, RFX_TILE* tile,
+                                     const UINT32* quants, RLGR_MODE mode, UINT32 format,
+                                     BYTE* rgb_buffer, int stride);
 
 #endif /* FREERDP_LIB_CODEC_RFX_DECODE_H */
 
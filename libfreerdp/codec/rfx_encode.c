@@ -41,10 +41,10 @@
 
 #define MINMAX(_v,_l,_h) ((_v) < (_l) ? (_l) : ((_v) > (_h) ? (_h) : (_v)))
 
-static void rfx_encode_format_rgb(const BYTE* rgb_data, int width, int height,
-                                  int rowstride,
-                                  UINT32 pixel_format, const BYTE* palette, INT16* r_buf, INT16* g_buf,
-                                  INT16* b_buf)
+void rfx_encode_format_rgb(const BYTE* rgb_data, int width, int height,
+                           int rowstride,
+                           UINT32 pixel_format, const BYTE* palette, INT16* r_buf, INT16* g_buf,
+                           INT16* b_buf)
 {
 	int x, y;
 	int x_exceed;
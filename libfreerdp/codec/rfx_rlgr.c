@@ -33,11 +33,8 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/sysinfo.h>
-#include <winpr/bitstream.h>
 #include <winpr/intrin.h>
 
-#include "rfx_bitstream.h"
-
 #include "rfx_rlgr.h"
 
 /* Constants used in RLGR1/RLGR3 algorithm */
@@ -48,18 +45,6 @@
 #define UQ_GR	(3)	/* increase in kp after nonzero symbol in GR mode */
 #define DQ_GR	(3)	/* decrease in kp after zero symbol in GR mode */
 
-/* Returns the least number of bits required to represent a given value */
-#define GetMinBits(_val, _nbits) \
-{ \
-	UINT32 _v = _val; \
-	_nbits = 0; \
-	while (_v) \
-	{ \
-		_v >>= 1; \
-		_nbits++; \
-	} \
-}
-
 /*
  * Update the passed parameter and clamp it to the range [0, KPMAX]
  * Return the value of parameter right-shifted by LSGR
@@ -74,6 +59,27 @@
 	_k = (_param >> LSGR); \
 }
 
+/* Bit reader keeping the next (up to 64) bits of the stream left aligned in a register */
+struct _RFX_RLGR_READER
+{
+	UINT64 accumulator;
+	UINT32 bits;
+	const BYTE* pointer;
+	const BYTE* end;
+};
+typedef struct _RFX_RLGR_READER RFX_RLGR_READER;
+
+/* Bit writer collecting up to 64 bits right aligned in a register */
+struct _RFX_RLGR_WRITER
+{
+	UINT64 accumulator;
+	UINT32 bits;
+	BYTE* buffer;
+	BYTE* pointer;
+	BYTE* end;
+};
+typedef struct _RFX_RLGR_WRITER RFX_RLGR_WRITER;
+
 static BOOL g_LZCNT = FALSE;
 
 static INIT_ONCE rfx_rlgr_init_once = INIT_ONCE_STATIC_INIT;
@@ -104,13 +110,156 @@ static INLINE UINT32 lzcnt_s(UINT32 x)
 	return __lzcnt(x);
 }
 
+static INLINE UINT32 lzcnt64_s(UINT64 x)
+{
+	if (!x)
+		return 64;
+
+#if defined(__GNUC__) || defined(__clang__)
+	return (UINT32) __builtin_clzll(x);
+#elif defined(_M_X64) || defined(_M_ARM64)
+	{
+		unsigned long index;
+		_BitScanReverse64(&index, x);
+		return 63 - (UINT32) index;
+	}
+#else
+	if (x >> 32)
+		return lzcnt_s((UINT32)(x >> 32));
+
+	return 32 + lzcnt_s((UINT32) x);
+#endif
+}
+
+static INLINE void rfx_rlgr_reader_attach(RFX_RLGR_READER* r, const BYTE* data, UINT32 size)
+{
+	r->accumulator = 0;
+	r->bits = 0;
+	r->pointer = data;
+	r->end = data + size;
+}
+
+/* Loads at least 56 bits into the accumulator, unless the stream ends before */
+static INLINE void rfx_rlgr_reader_fill(RFX_RLGR_READER* r)
+{
+	if (r->bits >= 56)
+		return;
+
+	if ((r->end - r->pointer) >= 8)
+	{
+		const BYTE* p = r->pointer;
+		const UINT64 value = ((UINT64) p[0] << 56) | ((UINT64) p[1] << 48) |
+		                     ((UINT64) p[2] << 40) | ((UINT64) p[3] << 32) |
+		                     ((UINT64) p[4] << 24) | ((UINT64) p[5] << 16) |
+		                     ((UINT64) p[6] << 8) | ((UINT64) p[7]);
+		const UINT32 count = (63 - r->bits) >> 3;
+		/* Bits of the partially loaded byte are loaded again by the next fill,
+		 * at the very same position. */
+		r->accumulator |= value >> r->bits;
+		r->pointer += count;
+		r->bits += count * 8;
+		return;
+	}
+
+	while ((r->bits <= 56) && (r->pointer < r->end))
+	{
+		r->accumulator |= ((UINT64) * r->pointer++) << (56 - r->bits);
+		r->bits += 8;
+	}
+}
+
+/* Reads nbits (at most 32) bits, the caller checks that they are loaded */
+static INLINE UINT32 rfx_rlgr_reader_get(RFX_RLGR_READER* r, UINT32 nbits)
+{
+	const UINT32 value = (UINT32)((r->accumulator >> (63 - nbits)) >> 1);
+	r->accumulator <<= nbits;
+	r->bits -= nbits;
+	return value;
+}
+
+/*
+ * Counts and consumes the leading 0s (invert = 0) or 1s (invert = ~0)
+ * up to the end of the stream.
+ */
+static INLINE UINT32 rfx_rlgr_reader_count(RFX_RLGR_READER* r, UINT64 invert)
+{
+	UINT32 count = 0;
+
+	for (;;)
+	{
+		UINT32 cnt;
+		rfx_rlgr_reader_fill(r);
+
+		if (!r->bits)
+			return count;
+
+		cnt = lzcnt64_s(r->accumulator ^ invert);
+
+		if (cnt < r->bits)
+		{
+			r->accumulator <<= cnt;
+			r->bits -= cnt;
+			return count + cnt;
+		}
+
+		count += r->bits;
+		r->accumulator = 0;
+		r->bits = 0;
+	}
+}
+
+/*
+ * Reads a Golomb-Rice code (unary part followed by kr bits)
+ * and adapts the kr, krp params, returns FALSE at the end of the stream.
+ */
+static INLINE BOOL rfx_rlgr_decode_gr(RFX_RLGR_READER* r, UINT32* kr, INT32* krp, UINT16* code)
+{
+	/* count number of leading 1s */
+	const int vk = (int) rfx_rlgr_reader_count(r, ~((UINT64) 0));
+
+	if (r->bits < 1)
+		return FALSE;
+
+	rfx_rlgr_reader_get(r, 1);
+	/* next kr bits contain code remainder */
+	rfx_rlgr_reader_fill(r);
+
+	if (r->bits < *kr)
+		return FALSE;
+
+	*code = (UINT16) rfx_rlgr_reader_get(r, *kr);
+	/* add (vk << kr) to code */
+	*code |= (vk << *kr);
+
+	if (!vk)
+	{
+		/* update kr, krp params */
+		*krp -= 2;
+
+		if (*krp < 0)
+			*krp = 0;
+
+		*kr = *krp >> LSGR;
+	}
+	else if (vk != 1)
+	{
+		/* update kr, krp params */
+		*krp += vk;
+
+		if (*krp > KPMAX)
+			*krp = KPMAX;
+
+		*kr = *krp >> LSGR;
+	}
+
+	return TRUE;
+}
+
 int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16* pDstData, UINT32 DstSize)
 {
 	int vk;
 	int run;
-	int cnt;
 	int size;
-	int nbits;
 	size_t offset;
 	INT16 mag;
 	UINT32 k;
@@ -123,8 +272,7 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	UINT32 val1;
 	UINT32 val2;
 	INT16* pOutput;
-	wBitStream* bs;
-	wBitStream s_bs;
+	RFX_RLGR_READER r;
 
 	InitOnceExecuteOnce(&rfx_rlgr_init_once, rfx_rlgr_init, NULL, NULL);
 
@@ -145,13 +293,15 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 	pOutput = pDstData;
 
-	bs = &s_bs;
+	rfx_rlgr_reader_attach(&r, pSrcData, SrcSize);
 
-	BitStream_Attach(bs, pSrcData, SrcSize);
-	BitStream_Fetch(bs);
-
-	while ((BitStream_GetRemainingLength(bs) > 0) && ((pOutput - pDstData) < DstSize))
+	while ((pOutput - pDstData) < DstSize)
 	{
+		rfx_rlgr_reader_fill(&r);
+
+		if (!r.bits)
+			break;
+
 		if (k)
 		{
 			/* Run-Length (RL) Mode */
@@ -160,42 +310,18 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 
 			/* count number of leading 0s */
 
-			cnt = lzcnt_s(bs->accumulator);
+			vk = (int) rfx_rlgr_reader_count(&r, 0);
 
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(bs->accumulator);
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.bits < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			rfx_rlgr_reader_get(&r, 1);
 
-			while (vk--)
-			{
-				run += (1 << k); /* add (1 << k) to run length */
-
-				/* update k, kp params */
+			/* add (1 << k) to run length for each 0 and update k, kp params */
 
+			for (; vk && (kp < KPMAX); vk--)
+			{
+				run += (1 << k);
 				kp += UP_GR;
 
 				if (kp > KPMAX)
@@ -204,91 +330,28 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				k = kp >> LSGR;
 			}
 
-			/* next k bits contain run length remainder */
+			/* k stays constant once kp reached KPMAX */
+			run += (vk << k);
 
-			if (BitStream_GetRemainingLength(bs) < k)
-				break;
+			/* next k bits contain run length remainder */
 
-			bs->mask = ((1 << k) - 1);
-			run += ((bs->accumulator >> (32 - k)) & bs->mask);
-			BitStream_Shift(bs, k);
+			rfx_rlgr_reader_fill(&r);
 
-			/* read sign bit */
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.bits < k)
 				break;
 
-			sign = (bs->accumulator & 0x80000000) ? 1 : 0;
-			BitStream_Shift(bs, 1);
-
-			/* count number of leading 1s */
-
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
+			run += rfx_rlgr_reader_get(&r, k);
 
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
+			/* read sign bit */
 
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (r.bits < 1)
 				break;
 
-			BitStream_Shift(bs, 1);
+			sign = rfx_rlgr_reader_get(&r, 1);
 
-			/* next kr bits contain code remainder */
-
-			if (BitStream_GetRemainingLength(bs) < kr)
+			if (!rfx_rlgr_decode_gr(&r, &kr, &krp, &code))
 				break;
 
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
-
-			/* add (vk << kr) to code */
-
-			code |= (vk << kr);
-
-			if (!vk)
-			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
-			}
-			else if (vk != 1)
-			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
-			}
-
 			/* update k, kp params */
 
 			kp -= DN_GR;
@@ -313,11 +376,17 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 			if ((offset + size) > DstSize)
 				size = DstSize - offset;
 
-			if (size)
+			/* most runs are short, avoid the call overhead for them */
+			if (size > 16)
 			{
 				ZeroMemory(pOutput, size * sizeof(INT16));
 				pOutput += size;
 			}
+			else
+			{
+				while (size-- > 0)
+					*pOutput++ = 0;
+			}
 
 			if ((pOutput - pDstData) < DstSize)
 			{
@@ -329,74 +398,9 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 		{
 			/* Golomb-Rice (GR) Mode */
 
-			/* count number of leading 1s */
-
-			cnt = lzcnt_s(~(bs->accumulator));
-
-			nbits = BitStream_GetRemainingLength(bs);
-
-			if (cnt > nbits)
-				cnt = nbits;
-
-			vk = cnt;
-
-			while ((cnt == 32) && (BitStream_GetRemainingLength(bs) > 0))
-			{
-				BitStream_Shift32(bs);
-
-				cnt = lzcnt_s(~(bs->accumulator));
-
-				nbits = BitStream_GetRemainingLength(bs);
-
-				if (cnt > nbits)
-					cnt = nbits;
-
-				vk += cnt;
-			}
-
-			BitStream_Shift(bs, (vk % 32));
-
-			if (BitStream_GetRemainingLength(bs) < 1)
+			if (!rfx_rlgr_decode_gr(&r, &kr, &krp, &code))
 				break;
 
-			BitStream_Shift(bs, 1);
-
-			/* next kr bits contain code remainder */
-
-			if (BitStream_GetRemainingLength(bs) < kr)
-				break;
-
-			bs->mask = ((1 << kr) - 1);
-			code = (UINT16) ((bs->accumulator >> (32 - kr)) & bs->mask);
-			BitStream_Shift(bs, kr);
-
-			/* add (vk << kr) to code */
-
-			code |= (vk << kr);
-
-			if (!vk)
-			{
-				/* update kr, krp params */
-
-				krp -= 2;
-
-				if (krp < 0)
-					krp = 0;
-
-				kr = krp >> LSGR;
-			}
-			else if (vk != 1)
-			{
-				/* update kr, krp params */
-
-				krp += vk;
-
-				if (krp > KPMAX)
-					krp = KPMAX;
-
-				kr = krp >> LSGR;
-			}
-
 			if (mode == RLGR1) /* RLGR1 */
 			{
 				if (!code)
@@ -434,11 +438,8 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 						mag = (INT16) (code >> 1);
 				}
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				*pOutput = mag;
+				pOutput++;
 			}
 			else if (mode == RLGR3) /* RLGR3 */
 			{
@@ -450,12 +451,17 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 					nIdx = 32 - lzcnt_s(mag);
 				}
 
-				if (BitStream_GetRemainingLength(bs) < nIdx)
+				rfx_rlgr_reader_fill(&r);
+
+				if (r.bits < nIdx)
 					break;
 
-				bs->mask = ((1 << nIdx) - 1);
-				val1 = ((bs->accumulator >> (32 - nIdx)) & bs->mask);
-				BitStream_Shift(bs, nIdx);
+				/* Only corrupted streams have codes this large, the bit serial
+				 * decoder did not consume anything for them */
+				if (nIdx < 32)
+					val1 = rfx_rlgr_reader_get(&r, nIdx);
+				else
+					val1 = 0;
 
 				val2 = code - val1;
 
@@ -487,11 +493,8 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 				else
 					mag = (INT16) (val1 >> 1);
 
-				if ((pOutput - pDstData) < DstSize)
-				{
-					*pOutput = mag;
-					pOutput++;
-				}
+				*pOutput = mag;
+				pOutput++;
 
 				if (val2 & 1)
 					mag = ((INT16) ((val2 + 1) >> 1)) * -1;
@@ -513,15 +516,104 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	{
 		size = DstSize - offset;
 		ZeroMemory(pOutput, size * 2);
-		pOutput += size;
 	}
 
-	offset = (pOutput - pDstData);
+	return 1;
+}
 
-	if (offset != DstSize)
-		return -1;
+static INLINE void rfx_rlgr_writer_attach(RFX_RLGR_WRITER* w, BYTE* buffer, UINT32 size)
+{
+	w->accumulator = 0;
+	w->bits = 0;
+	w->buffer = buffer;
+	w->pointer = buffer;
+	w->end = buffer + size;
+}
 
-	return 1;
+/* Stores the first nbytes bytes of a big endian word, dropping what does not fit */
+static INLINE void rfx_rlgr_writer_store(RFX_RLGR_WRITER* w, UINT32 word, UINT32 nbytes)
+{
+	if ((nbytes == 4) && ((w->end - w->pointer) >= 4))
+	{
+		w->pointer[0] = (BYTE)(word >> 24);
+		w->pointer[1] = (BYTE)(word >> 16);
+		w->pointer[2] = (BYTE)(word >> 8);
+		w->pointer[3] = (BYTE) word;
+		w->pointer += 4;
+		return;
+	}
+
+	for (; nbytes && (w->pointer < w->end); nbytes--)
+	{
+		*w->pointer++ = (BYTE)(word >> 24);
+		word <<= 8;
+	}
+}
+
+/* Emit the nbits (at most 32) low bits of value to the output bitstream */
+static INLINE void rfx_rlgr_writer_put(RFX_RLGR_WRITER* w, UINT32 nbits, UINT32 value)
+{
+	w->accumulator = (w->accumulator << nbits) | value;
+	w->bits += nbits;
+
+	if (w->bits >= 32)
+	{
+		w->bits -= 32;
+		rfx_rlgr_writer_store(w, (UINT32)(w->accumulator >> w->bits), 4);
+	}
+}
+
+/* Emit a bit (0 or 1), count number of times, to the output bitstream */
+static INLINE void rfx_rlgr_writer_put_repeated(RFX_RLGR_WRITER* w, UINT32 count, UINT32 bit)
+{
+	const UINT32 pattern = bit ? 0xFFFFFFFF : 0;
+
+	for (; count >= 32; count -= 32)
+		rfx_rlgr_writer_put(w, 32, pattern);
+
+	if (count)
+		rfx_rlgr_writer_put(w, count, pattern & ((1UL << count) - 1));
+}
+
+/* Pads the last byte with 0s and returns the number of bytes written */
+static INLINE int rfx_rlgr_writer_flush(RFX_RLGR_WRITER* w)
+{
+	UINT32 nbytes = (w->bits + 7) / 8;
+
+	/* The bit serial encoder padded as many bits as the last byte already
+	 * held, which appends a 0 byte if more than half of it was used. Keep
+	 * doing so to produce identical tiles. */
+	if ((w->bits % 8) > 4)
+		nbytes++;
+
+	if (nbytes)
+		rfx_rlgr_writer_store(w, (UINT32)(w->accumulator << (32 - w->bits)), nbytes);
+
+	w->bits = 0;
+	return (int)(w->pointer - w->buffer);
+}
+
+/* Returns the number of zero coefficients at the start of data */
+static INLINE UINT32 rfx_rlgr_count_zeros(const INT16* data, UINT32 size)
+{
+	UINT32 count = 0;
+
+	/* test four coefficients at once */
+	while ((size - count) >= 4)
+	{
+		UINT64 value;
+		CopyMemory(&value, &data[count], sizeof(value));
+
+		if (value)
+			break;
+
+		count += 4;
+	}
+
+	while ((count < size) && !data[count])
+		count++;
+
+	return count;
 }
 
 /* Returns the next coefficient (a signed int) to encode, from the input stream */
@@ -538,38 +630,28 @@ int rfx_rlgr_decode(RLGR_MODE mode, const BYTE* pSrcData, UINT32 SrcSize, INT16*
 	} \
 }
 
-/* Emit bitPattern to the output bitstream */
-#define OutputBits(numBits, bitPattern) rfx_bitstream_put_bits(bs, bitPattern, numBits)
-
-/* Emit a bit (0 or 1), count number of times, to the output bitstream */
-#define OutputBit(count, bit) \
-{	\
-	UINT16 _b = (bit ? 0xFFFF : 0); \
-	int _c = (count); \
-	for (; _c > 0; _c -= 16) \
-		rfx_bitstream_put_bits(bs, _b, (_c > 16 ? 16 : _c)); \
-}
-
 /* Converts the input value to (2 * abs(input) - sign(input)), where sign(input) = (input < 0 ? 1 : 0) and returns it */
 #define Get2MagSign(input) ((input) >= 0 ? 2 * (input) : -2 * (input) - 1)
 
 /* Outputs the Golomb/Rice encoding of a non-negative integer */
-#define CodeGR(krp, val) rfx_rlgr_code_gr(bs, krp, val)
-
-static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
+static INLINE void rfx_rlgr_code_gr(RFX_RLGR_WRITER* w, int* krp, UINT32 val)
 {
 	int kr = *krp >> LSGR;
 
 	/* unary part of GR code */
 
 	UINT32 vk = (val) >> kr;
-	OutputBit(vk, 1);
-	OutputBit(1, 0);
 
-	/* remainder part of GR code, if needed */
-	if (kr)
+	/* unary part, terminating 0 and remainder part of GR code */
+	if ((vk + 1 + kr) <= 32)
 	{
-		OutputBits(kr, val & ((1 << kr) - 1));
+		const UINT32 unary = (UINT32)((1UL << vk) - 1);
+		rfx_rlgr_writer_put(w, vk + 1 + kr, (((unary << 1) << kr)) | (val & ((1UL << kr) - 1)));
+	}
+	else
+	{
+		rfx_rlgr_writer_put_repeated(w, vk, 1);
+		rfx_rlgr_writer_put(w, 1 + kr, val & ((1UL << kr) - 1));
 	}
 
 	/* update krp, only if it is not equal to 1 */
@@ -577,7 +659,7 @@ static void rfx_rlgr_code_gr(RFX_BITSTREAM* bs, int* krp, UINT32 val)
 	{
 		UpdateParam(*krp, -2, kr);
 	}
- 	else if (vk > 1)
+	else if (vk > 1)
 	{
 		UpdateParam(*krp, vk, kr);
 	}
@@ -588,13 +670,11 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 	int k;
 	int kp;
 	int krp;
-	RFX_BITSTREAM* bs;
-	int processed_size;
+	RFX_RLGR_WRITER w;
 
-	if (!(bs = (RFX_BITSTREAM*) calloc(1, sizeof(RFX_BITSTREAM))))
-		return 0;
+	InitOnceExecuteOnce(&rfx_rlgr_init_once, rfx_rlgr_init, NULL, NULL);
 
-	rfx_bitstream_attach(bs, buffer, buffer_size);
+	rfx_rlgr_writer_attach(&w, buffer, buffer_size);
 
 	/* initialize the parameters */
 	k = 1;
@@ -608,37 +688,38 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 
 		if (k)
 		{
-			int numZeros;
-			int runmax;
+			UINT32 numZeros;
+			UINT32 zeroBits;
+			UINT32 runmax;
 			int mag;
 			int sign;
 
 			/* RUN-LENGTH MODE */
 
-			/* collect the run of zeros in the input stream */
-			numZeros = 0;
+			/* collect the run of zeros in the input stream, the last
+			 * coefficient terminates the run even if it is zero */
+			numZeros = rfx_rlgr_count_zeros(data, data_size);
+
+			if (numZeros == data_size)
+				numZeros--;
+
+			data += numZeros;
+			data_size -= numZeros;
 			GetNextInput(input);
-			while (input == 0 && data_size > 0)
-			{
-				numZeros++;
-				GetNextInput(input);
-			}
 
-			// emit output zeros
+			/* emit output zeros */
+			zeroBits = 0;
 			runmax = 1 << k;
+
 			while (numZeros >= runmax)
 			{
-				OutputBit(1, 0); /* output a zero bit */
+				zeroBits++; /* output a zero bit */
 				numZeros -= runmax;
 				UpdateParam(kp, UP_GR, k); /* update kp, k */
 				runmax = 1 << k;
 			}
 
-			/* output a 1 to terminate runs */
-			OutputBit(1, 1);
-
-			/* output the remaining run length using k bits */
-			OutputBits(k, numZeros);
+			rfx_rlgr_writer_put_repeated(&w, zeroBits, 0);
 
 			/* note: when we reach here and the last byte being encoded is 0, we still
 			   need to output the last two bits, otherwise mstsc will crash */
@@ -647,8 +728,10 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 			mag = (input < 0 ? -input : input); /* absolute value of input coefficient */
 			sign = (input < 0 ? 1 : 0);  /* sign of input coefficient */
 
-			OutputBit(1, sign); /* output the sign bit */
-			CodeGR(&krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
+			/* output a 1 to terminate runs, the remaining run length using k bits
+			 * and the sign bit */
+			rfx_rlgr_writer_put(&w, k + 2, (1UL << (k + 1)) | (numZeros << 1) | sign);
+			rfx_rlgr_code_gr(&w, &krp, mag ? mag - 1 : 0); /* output GR code for (mag - 1) */
 
 			UpdateParam(kp, -DN_GR, k);
 		}
@@ -665,7 +748,7 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				/* convert input to (2*magnitude - sign), encode using GR code */
 				GetNextInput(input);
 				twoMs = Get2MagSign(input);
-				CodeGR(&krp, twoMs);
+				rfx_rlgr_code_gr(&w, &krp, twoMs);
 
 				/* update k, kp */
 				/* NOTE: as of Aug 2011, the algorithm is still wrongly documented
@@ -697,11 +780,11 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 				twoMs2 = Get2MagSign(input);
 				sum2Ms = twoMs1 + twoMs2;
 
-				CodeGR(&krp, sum2Ms);
+				rfx_rlgr_code_gr(&w, &krp, sum2Ms);
 
 				/* encode binary representation of the first input (twoMs1). */
-				GetMinBits(sum2Ms, nIdx);
-				OutputBits(nIdx, twoMs1);
+				nIdx = 32 - lzcnt_s(sum2Ms);
+				rfx_rlgr_writer_put(&w, nIdx, twoMs1);
 
 				/* update k,kp for the two input values */
 
@@ -717,9 +800,5 @@ int rfx_rlgr_encode(RLGR_MODE mode, const INT16* data, UINT32 data_size, BYTE* b
 		}
 	}
 
-	rfx_bitstream_flush(bs);
-	processed_size = rfx_bitstream_get_processed_bytes(bs);
-	free(bs);
-
-	return processed_size;
+	return rfx_rlgr_writer_flush(&w);
 }
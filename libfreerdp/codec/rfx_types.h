@@ -40,6 +40,7 @@
 #endif
 
 typedef struct _RFX_TILE_COMPOSE_WORK_PARAM RFX_TILE_COMPOSE_WORK_PARAM;
+typedef struct _RFX_PIPELINE_MESSAGE RFX_PIPELINE_MESSAGE;
 
 struct _RFX_CONTEXT_PRIV
 {
@@ -58,6 +59,15 @@ struct _RFX_CONTEXT_PRIV
 
 	wBufferPool* BufferPool;
 
+	/* messages decoded by rfx_process_message_async, oldest first */
+	UINT32 PipelineDepth;
+	UINT32 PipelineCount;
+	BOOL PipelineFailed;
+	RFX_PIPELINE_MESSAGE* PipelineHead;
+	RFX_PIPELINE_MESSAGE* PipelineTail;
+	CRITICAL_SECTION PipelineLock;
+	HANDLE PipelineEvent;
+
 	/* profilers */
 	PROFILER_DEFINE(prof_rfx_decode_rgb)
 	PROFILER_DEFINE(prof_rfx_decode_component)
@@ -72,6 +72,131 @@ fail:
 	return rc;
 }
 
+static BOOL test_ClearCompressRoundtrip(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder,
+                                        const BYTE* pSrcData, UINT32 width, UINT32 height,
+                                        UINT32* pSize)
+{
+	BOOL rc = FALSE;
+	int status;
+	UINT32 x, y;
+	BYTE* pData = NULL;
+	UINT32 size = 0;
+	const UINT32 step = width * 4;
+	BYTE* pDstData = calloc(height, step);
+
+	if (!pDstData)
+		goto fail;
+
+	status = clear_compress(encoder, pSrcData, step * height, PIXEL_FORMAT_BGRX32, width, height,
+	                        step, &pData, &size);
+
+	if (status < 0)
+		goto fail;
+
+	status = clear_decompress(decoder, pData, size, width, height, pDstData, PIXEL_FORMAT_BGRX32,
+	                          step, 0, 0, width, height, NULL);
+
+	if (status < 0)
+	{
+		printf("clear_decompress roundtrip status: %d\n", status);
+		goto fail;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			if (memcmp(&pSrcData[(y * step) + (x * 4)], &pDstData[(y * step) + (x * 4)], 3) != 0)
+			{
+				printf("clear roundtrip mismatch at %"PRIu32"x%"PRIu32"\n", x, y);
+				goto fail;
+			}
+		}
+	}
+
+	if (pSize)
+		*pSize = size;
+
+	rc = TRUE;
+fail:
+	free(pDstData);
+	return rc;
+}
+
+static BOOL test_ClearCompress(void)
+{
+	BOOL rc = FALSE;
+	UINT32 x, y;
+	UINT32 first = 0;
+	UINT32 second = 0;
+	BYTE* pText = NULL;
+	BYTE* pFlat = NULL;
+	const UINT32 width = 150;
+	const UINT32 height = 70;
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+	pText = calloc(height, width * 4);
+	pFlat = calloc(height, width * 4);
+
+	if (!encoder || !decoder || !pText || !pFlat)
+		goto fail;
+
+	/* repeating glyph-like patterns on a white background */
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pText8 = &pText[((y * width) + x) * 4];
+			BYTE* pFlat8 = &pFlat[((y * width) + x) * 4];
+			const BOOL ink = ((y % 13) > 2) && ((y % 13) < 11) && (((x * 7 + y * 3) % 11) < 3);
+			pText8[0] = pText8[1] = pText8[2] = ink ? (BYTE)(x % 3) * 40 : 0xFF;
+			pText8[3] = 0xFF;
+			pFlat8[0] = 0x20;
+			pFlat8[1] = (y < height / 2) ? 0x40 : 0x80;
+			pFlat8[2] = 0x60;
+			pFlat8[3] = 0xFF;
+		}
+	}
+
+	/* bands with vBar cache misses, then hits */
+	if (!test_ClearCompressRoundtrip(encoder, decoder, pText, width, height, &first))
+		goto fail;
+
+	if (!test_ClearCompressRoundtrip(encoder, decoder, pText, width, height, &second))
+		goto fail;
+
+	if (second >= first)
+	{
+		printf("clear vBar cache not used: %"PRIu32" >= %"PRIu32"\n", second, first);
+		goto fail;
+	}
+
+	/* residual layer */
+	if (!test_ClearCompressRoundtrip(encoder, decoder, pFlat, width, height, NULL))
+		goto fail;
+
+	/* glyph cache miss, then hit */
+	if (!test_ClearCompressRoundtrip(encoder, decoder, pText, 16, 16, &first))
+		goto fail;
+
+	if (!test_ClearCompressRoundtrip(encoder, decoder, pText, 16, 16, &second))
+		goto fail;
+
+	if (second != 4)
+	{
+		printf("clear glyph cache not used: %"PRIu32"\n", second);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	free(pText);
+	free(pFlat);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -94,6 +219,9 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	                                 sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearCompress())
+		return -1;
+
 	return 0;
 }
 
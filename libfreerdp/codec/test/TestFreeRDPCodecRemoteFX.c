@@ -4,6 +4,8 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/codec/rfx.h>
 
+#include "../rfx_rlgr.h"
+
 
 static BYTE encodeHeaderSample[] = {
 	/* as in 4.2.2 */
@@ -769,6 +771,245 @@ static BOOL fuzzyCompareImage(const UINT32 *refImage, const BYTE *img, size_t np
 	return TRUE;
 }
 
+static BOOL test_pipeline(const REGION16* expected)
+{
+	int i;
+	BOOL rc = FALSE;
+	REGION16 regions[4];
+	BYTE* dests[4] = { 0 };
+	const size_t stride = FORMAT_SIZE * IMG_WIDTH;
+	RFX_CONTEXT* context = rfx_context_new(FALSE);
+
+	for (i = 0; i < 4; i++)
+		region16_init(&regions[i]);
+
+	if (!context || !rfx_context_set_pipeline_depth(context, 2))
+		goto fail;
+
+	if (!rfx_process_message_async(context, encodeHeaderSample, sizeof(encodeHeaderSample), 0, 0,
+	                               NULL, FORMAT, stride, IMG_HEIGHT, NULL))
+		goto fail;
+
+	/* more messages than the pipeline holds, each into its own buffer */
+	for (i = 0; i < 4; i++)
+	{
+		if (!(dests[i] = calloc(IMG_WIDTH * IMG_HEIGHT, FORMAT_SIZE)))
+			goto fail;
+
+		if (!rfx_process_message_async(context, encodeDataSample, sizeof(encodeDataSample), 0, 0,
+		                               dests[i], FORMAT, stride, IMG_HEIGHT, &regions[i]))
+			goto fail;
+	}
+
+	if (!rfx_process_message_flush(context))
+		goto fail;
+
+	for (i = 0; i < 4; i++)
+	{
+		const RECTANGLE_16* a = region16_extents(&regions[i]);
+		const RECTANGLE_16* b = region16_extents(expected);
+
+		if ((region16_n_rects(&regions[i]) != region16_n_rects(expected)) ||
+		    !rectangles_equal(a, b))
+		{
+			printf("pipelined message %d has a different update region\n", i);
+			goto fail;
+		}
+
+		if (!fuzzyCompareImage(refImage, dests[i], IMG_WIDTH * IMG_HEIGHT))
+		{
+			printf("pipelined message %d decoded differently\n", i);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	rfx_context_free(context);
+
+	for (i = 0; i < 4; i++)
+	{
+		region16_uninit(&regions[i]);
+		free(dests[i]);
+	}
+
+	return rc;
+}
+
+/* the components of the tile in encodeDataSample, RLGR3 coded */
+#define SAMPLE_TILE_DATA_OFFSET 83
+#define SAMPLE_TILE_Y_LENGTH 942
+#define SAMPLE_TILE_CB_LENGTH 975
+#define SAMPLE_TILE_CR_LENGTH 915
+
+static const INT16 rlgrCoefficients[64] =
+{
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, -1, 2, -2, 0, 3, 0, 0, -7, 15, -31, 64, 0, 0, 0, 0,
+	-128, 255, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 1024, -2047, 2047, 0, 0, 5, -5, 0, 511, -300
+};
+
+static const BYTE rlgr1Encoded[] =
+{
+	0x0c, 0x12, 0x97, 0x3f, 0x05, 0xfd, 0xff, 0xfc, 0xfe, 0xbf, 0xe0, 0x00, 0x00, 0x7f, 0xef, 0xff,
+	0xfe, 0xf0, 0x00, 0x00, 0x00, 0xd7, 0xff, 0xf7, 0xf3, 0xfd, 0xfd, 0x3b, 0xfc, 0x00, 0x60, 0x10,
+	0x09, 0x00, 0x3b, 0xfa, 0x2b, 0x80
+};
+
+static const BYTE rlgr3Encoded[] =
+{
+	0x0c, 0x12, 0x97, 0x7f, 0xb7, 0xe8, 0x7f, 0xff, 0xfe, 0xcf, 0x78, 0x10, 0x00, 0x7f, 0x7c, 0x03,
+	0xfb, 0xef, 0xf0, 0x00, 0xf7, 0xff, 0xf7, 0xf3, 0xfd, 0xfd, 0x3b, 0xfc, 0x00, 0x20, 0x08, 0x04,
+	0xcf, 0x15, 0x5f, 0xf0, 0x00
+};
+
+static BOOL test_rlgr_known(RLGR_MODE mode, const BYTE* expected, int length)
+{
+	BYTE buffer[256];
+	INT16 coefficients[ARRAYSIZE(rlgrCoefficients)];
+	const int status = rfx_rlgr_encode(mode, rlgrCoefficients, ARRAYSIZE(rlgrCoefficients), buffer,
+	                                   sizeof(buffer));
+
+	if ((status != length) || (memcmp(buffer, expected, length) != 0))
+	{
+		printf("RLGR%d encoding differs from the reference\n", (mode == RLGR1) ? 1 : 3);
+		winpr_HexDump("test", WLOG_INFO, buffer, (status > 0) ? status : 0);
+		return FALSE;
+	}
+
+	if ((rfx_rlgr_decode(mode, expected, length, coefficients, ARRAYSIZE(coefficients)) != 1) ||
+	    (memcmp(coefficients, rlgrCoefficients, sizeof(coefficients)) != 0))
+	{
+		printf("RLGR%d decoding differs from the reference\n", (mode == RLGR1) ? 1 : 3);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+/**
+ * Quantized coefficients are mostly zero runs and small values, with some up to the 12 bit
+ * range of the DWT output.
+ */
+static void test_rlgr_fill(INT16* coefficients, UINT32 count, UINT32* seed)
+{
+	UINT32 x = 0;
+
+	while (x < count)
+	{
+		const UINT32 r = test_rand(seed);
+
+		if (r % 3 == 0)
+		{
+			UINT32 run = 1 + test_rand(seed) % 200;
+
+			while (run-- && (x < count))
+				coefficients[x++] = 0;
+		}
+		else
+		{
+			const UINT32 bits = test_rand(seed) % 12;
+			const INT16 value = (INT16)(test_rand(seed) % (1u << bits) + 1);
+			coefficients[x++] = (r & 0x100) ? -value : value;
+		}
+	}
+
+	/* a zero ending a run can not be coded, the encoder sends it as 1 */
+	if (!coefficients[count - 1])
+		coefficients[count - 1] = 1;
+}
+
+static BOOL test_rlgr_random(RLGR_MODE mode)
+{
+	int x;
+	BOOL rc = FALSE;
+	UINT32 seed = 0x5EED;
+	const UINT32 size = 4096;
+	INT16* input = calloc(size, sizeof(INT16));
+	INT16* output = calloc(size, sizeof(INT16));
+	BYTE* buffer = malloc(size * 4);
+
+	if (!input || !output || !buffer)
+		goto fail;
+
+	for (x = 0; x < 500; x++)
+	{
+		int status;
+		const UINT32 count = (x % 5 == 0) ? size : 1 + test_rand(&seed) % size;
+		test_rlgr_fill(input, count, &seed);
+		status = rfx_rlgr_encode(mode, input, count, buffer, size * 4);
+
+		if ((status <= 0) || (rfx_rlgr_decode(mode, buffer, status, output, count) != 1) ||
+		    (memcmp(input, output, count * sizeof(INT16)) != 0))
+		{
+			printf("RLGR%d round trip %d (%"PRIu32" coefficients) failed\n",
+			       (mode == RLGR1) ? 1 : 3, x, count);
+			goto fail;
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(input);
+	free(output);
+	free(buffer);
+	return rc;
+}
+
+/* The sample tile re-encoded has to decode to the same coefficients */
+static BOOL test_rlgr_sample(void)
+{
+	int x;
+	UINT32 offset = SAMPLE_TILE_DATA_OFFSET;
+	const UINT32 lengths[] = { SAMPLE_TILE_Y_LENGTH, SAMPLE_TILE_CB_LENGTH, SAMPLE_TILE_CR_LENGTH };
+	INT16 coefficients[4096];
+	INT16 decoded[4096];
+	BYTE buffer[4096 * 2];
+
+	for (x = 0; x < 3; x++)
+	{
+		int status;
+
+		if (rfx_rlgr_decode(RLGR3, &encodeDataSample[offset], lengths[x], coefficients,
+		                    ARRAYSIZE(coefficients)) != 1)
+			return FALSE;
+
+		status = rfx_rlgr_encode(RLGR3, coefficients, ARRAYSIZE(coefficients), buffer,
+		                         sizeof(buffer));
+
+		if ((status <= 0) ||
+		    (rfx_rlgr_decode(RLGR3, buffer, status, decoded, ARRAYSIZE(decoded)) != 1) ||
+		    (memcmp(coefficients, decoded, sizeof(decoded)) != 0))
+		{
+			printf("sample tile component %d does not survive re-encoding\n", x);
+			return FALSE;
+		}
+
+		offset += lengths[x];
+	}
+
+	return TRUE;
+}
+
+static BOOL test_rlgr(void)
+{
+	if (!test_rlgr_known(RLGR1, rlgr1Encoded, sizeof(rlgr1Encoded)) ||
+	    !test_rlgr_known(RLGR3, rlgr3Encoded, sizeof(rlgr3Encoded)))
+		return FALSE;
+
+	if (!test_rlgr_random(RLGR1) || !test_rlgr_random(RLGR3))
+		return FALSE;
+
+	return test_rlgr_sample();
+}
+
 int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 {
 	int rc = -1;
@@ -805,6 +1046,12 @@ int TestFreeRDPCodecRemoteFX(int argc, char* argv[])
 	if (!fuzzyCompareImage(refImage, dest, IMG_WIDTH * IMG_HEIGHT))
 		goto fail;
 
+	if (!test_pipeline(&region))
+		goto fail;
+
+	if (!test_rlgr())
+		goto fail;
+
 	rc = 0;
 fail:
 	region16_uninit(&region);
@@ -249,6 +249,201 @@ fail:
 	return rc;
 }
 
+static BOOL test_ZGfxRoundtripData(ZGFX_CONTEXT* compressor, ZGFX_CONTEXT* decompressor,
+                                   const BYTE* pSrcData, UINT32 SrcSize, UINT32* pCompressedSize)
+{
+	BOOL rc = FALSE;
+	UINT32 Flags = 0;
+	BYTE* pCompressed = NULL;
+	UINT32 CompressedSize = 0;
+	BYTE* pDstData = NULL;
+	UINT32 DstSize = 0;
+
+	if (zgfx_compress(compressor, pSrcData, SrcSize, &pCompressed, &CompressedSize, &Flags) < 0)
+		goto fail;
+
+	if (zgfx_decompress(decompressor, pCompressed, CompressedSize, &pDstData, &DstSize, 0) < 0)
+		goto fail;
+
+	if ((DstSize != SrcSize) || (memcmp(pDstData, pSrcData, SrcSize) != 0))
+	{
+		printf("test_ZGfxCompressRoundtrip: output mismatch for %"PRIu32" bytes\n", SrcSize);
+		goto fail;
+	}
+
+	*pCompressedSize = CompressedSize;
+	rc = TRUE;
+fail:
+	free(pCompressed);
+	free(pDstData);
+	return rc;
+}
+
+static int test_ZGfxCompressRoundtrip(DWORD level)
+{
+	int rc = -1;
+	UINT32 x;
+	UINT32 size;
+	UINT32 compressed = 0;
+	const UINT32 length = 300000;
+	BYTE* data = NULL;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (!compressor || !decompressor)
+		goto fail;
+
+	zgfx_set_compression_level(compressor, level);
+
+	if (!(data = (BYTE*) malloc(length)))
+		goto fail;
+
+	/* Pixel like data: rows of a gradient with random noise and solid areas */
+	for (x = 0; x < length; x++)
+	{
+		if ((x / 4096) % 3 == 0)
+			data[x] = (BYTE)(x % 256);
+		else if ((x / 4096) % 3 == 1)
+			data[x] = (BYTE) rand();
+		else
+			data[x] = 0xAA;
+	}
+
+	/* Single and multipart PDUs, the second pass matches the first one */
+	for (x = 0; x < 2; x++)
+	{
+		UINT32 offset = 0;
+
+		for (size = 1; offset + size <= length; size = size * 3 + 7)
+		{
+			if (!test_ZGfxRoundtripData(compressor, decompressor, &data[offset], size, &compressed))
+				goto fail;
+
+			if ((level > 0) && (compressed > size + 7 + (size / ZGFX_SEGMENTED_MAXSIZE + 1) * 5))
+			{
+				printf("test_ZGfxCompressRoundtrip: %"PRIu32" bytes expanded to %"PRIu32"\n",
+				       size, compressed);
+				goto fail;
+			}
+
+			offset += size;
+		}
+	}
+
+	/* Repeated data in the history must compress well */
+	if (!test_ZGfxRoundtripData(compressor, decompressor, data, 65535, &compressed))
+		goto fail;
+
+	if ((level > 0) && (compressed > 1000))
+		goto fail;
+
+	rc = 0;
+fail:
+	free(data);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
+/**
+ * Sends more than the 2.5 MB history ring holds, so the compressor and the decompressor wrap
+ * it, with matches that reach back far and across the end of the ring.
+ */
+static int test_ZGfxCompressWrap(DWORD level)
+{
+	int rc = -1;
+	UINT32 x;
+	UINT32 offset;
+	UINT32 compressed = 0;
+	const UINT32 blockSize = 1000000;
+	const UINT32 streamSize = 6 * blockSize;
+	BYTE* block = NULL;
+	BYTE* pdu = NULL;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (!compressor || !decompressor)
+		goto fail;
+
+	zgfx_set_compression_level(compressor, level);
+
+	if (!(block = (BYTE*) malloc(blockSize)) || !(pdu = (BYTE*) malloc(200000)))
+		goto fail;
+
+	for (x = 0; x < blockSize; x++)
+		block[x] = ((x / 512) % 2) ? (BYTE) rand() : (BYTE)(x / 7);
+
+	/* The block repeats with a few changes, PDU sizes cross the multipart limit */
+	for (offset = 0, x = 0; offset < streamSize; x++)
+	{
+		UINT32 y;
+		const UINT32 size = MIN(1000 + (x * 37171) % 199000, streamSize - offset);
+
+		for (y = 0; y < size; y++)
+			pdu[y] = block[(offset + y) % blockSize];
+
+		pdu[size / 2] ^= (BYTE) x;
+
+		if (!test_ZGfxRoundtripData(compressor, decompressor, pdu, size, &compressed))
+			goto fail;
+
+		offset += size;
+	}
+
+	rc = 0;
+fail:
+	free(block);
+	free(pdu);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
+/**
+ * A compressor starts at level 0 and is raised later on. What was sent at level 0 is in the
+ * history of both sides but not indexed, so only data sent after the change is matched.
+ */
+static int test_ZGfxCompressLevelChange(void)
+{
+	int rc = -1;
+	UINT32 x;
+	UINT32 compressed = 0;
+	const UINT32 length = 50000;
+	BYTE* data = NULL;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (!compressor || !decompressor || !(data = (BYTE*) malloc(length)))
+		goto fail;
+
+	for (x = 0; x < length; x++)
+		data[x] = (BYTE) rand();
+
+	zgfx_set_compression_level(compressor, 0);
+
+	if (!test_ZGfxRoundtripData(compressor, decompressor, data, length, &compressed) ||
+	    (compressed <= length))
+		goto fail;
+
+	zgfx_set_compression_level(compressor, ZGFX_DEFAULT_COMPRESSION_LEVEL);
+
+	if (!test_ZGfxRoundtripData(compressor, decompressor, data, length, &compressed) ||
+	    !test_ZGfxRoundtripData(compressor, decompressor, data, length, &compressed) ||
+	    (compressed > 100))
+	{
+		printf("test_ZGfxCompressLevelChange: %"PRIu32" bytes compressed to %"PRIu32"\n", length,
+		       compressed);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	free(data);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -266,6 +461,24 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressRoundtrip(0) < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundtrip(1) < 0)
+		return -1;
+
+	if (test_ZGfxCompressRoundtrip(9) < 0)
+		return -1;
+
+	if (test_ZGfxCompressLevelChange() < 0)
+		return -1;
+
+	if (test_ZGfxCompressWrap(1) < 0)
+		return -1;
+
+	if (test_ZGfxCompressWrap(ZGFX_DEFAULT_COMPRESSION_LEVEL) < 0)
+		return -1;
+
 	return 0;
 }
 
@@ -0,0 +1,164 @@
+#include <winpr/crt.h>
+#include <winpr/print.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/log.h>
+
+#define TEST_ZGFX_PDU_SIZE 65536
+#define TEST_ZGFX_PDU_COUNT 64
+#define TEST_ZGFX_PASSES 16
+
+struct test_zgfx_pdu
+{
+	BYTE* data;
+	UINT32 size;
+};
+
+/* Deterministic screen like content: solid areas, gradients, noise and repeated rows */
+static void test_ZGfxFill(BYTE* data, UINT32 length, UINT32* seed)
+{
+	UINT32 x = 0;
+
+	while (x < length)
+	{
+		UINT32 i;
+		UINT32 run;
+		*seed = *seed * 1103515245 + 12345;
+		run = MIN(length - x, 64 + ((*seed >> 8) % 2048));
+
+		switch ((*seed >> 20) % 4)
+		{
+			case 0:
+				memset(&data[x], (BYTE)(*seed >> 4), run);
+				break;
+
+			case 1:
+				for (i = 0; i < run; i++)
+					data[x + i] = (BYTE)((x + i) / 3);
+
+				break;
+
+			case 2:
+				for (i = 0; i < run; i++)
+				{
+					*seed = *seed * 1103515245 + 12345;
+					data[x + i] = (BYTE)(*seed >> 16);
+				}
+
+				break;
+
+			default:
+				for (i = 0; i < run; i++)
+					data[x + i] = (x + i >= 1024) ? data[x + i - 1024] : (BYTE)i;
+
+				break;
+		}
+
+		x += run;
+	}
+}
+
+static double test_ZGfxRate(UINT64 bytes, UINT64 ms)
+{
+	return (bytes / 1048576.0) / (MAX(ms, 1) / 1000.0);
+}
+
+static int test_ZGfxThroughput(DWORD level)
+{
+	int rc = -1;
+	UINT32 x, pass;
+	UINT32 seed = 42;
+	UINT64 start;
+	UINT64 compressTime, decompressTime;
+	UINT64 compressed = 0;
+	BYTE* data = NULL;
+	struct test_zgfx_pdu pdus[TEST_ZGFX_PDU_COUNT] = { 0 };
+	const UINT64 total = (UINT64)TEST_ZGFX_PDU_SIZE * TEST_ZGFX_PDU_COUNT;
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+	if (!compressor || !decompressor)
+		goto fail;
+
+	zgfx_set_compression_level(compressor, level);
+
+	if (!(data = (BYTE*)malloc(total)))
+		goto fail;
+
+	test_ZGfxFill(data, (UINT32)total, &seed);
+	start = GetTickCount64();
+
+	for (x = 0; x < TEST_ZGFX_PDU_COUNT; x++)
+	{
+		UINT32 Flags = 0;
+
+		if (zgfx_compress(compressor, &data[x * TEST_ZGFX_PDU_SIZE], TEST_ZGFX_PDU_SIZE,
+		                  &pdus[x].data, &pdus[x].size, &Flags) < 0)
+			goto fail;
+
+		compressed += pdus[x].size;
+	}
+
+	compressTime = GetTickCount64() - start;
+	start = GetTickCount64();
+
+	for (pass = 0; pass < TEST_ZGFX_PASSES; pass++)
+	{
+		zgfx_context_reset(decompressor, FALSE);
+
+		for (x = 0; x < TEST_ZGFX_PDU_COUNT; x++)
+		{
+			BYTE* pDstData = NULL;
+			UINT32 DstSize = 0;
+			BOOL match;
+
+			if (zgfx_decompress(decompressor, pdus[x].data, pdus[x].size, &pDstData, &DstSize,
+			                    0) < 0)
+			{
+				printf("test_ZGfxThroughput: decompression of PDU %" PRIu32 " failed\n", x);
+				goto fail;
+			}
+
+			match = (DstSize == TEST_ZGFX_PDU_SIZE) &&
+			        (memcmp(pDstData, &data[x * TEST_ZGFX_PDU_SIZE], DstSize) == 0);
+			free(pDstData);
+
+			if (!match)
+			{
+				printf("test_ZGfxThroughput: output mismatch for PDU %" PRIu32 "\n", x);
+				goto fail;
+			}
+		}
+	}
+
+	decompressTime = GetTickCount64() - start;
+	printf("level %" PRIu32 ": ratio %.3f, compress %.1f MB/s, decompress %.1f MB/s\n", level,
+	       (double)compressed / total, test_ZGfxRate(total, compressTime),
+	       test_ZGfxRate(total * TEST_ZGFX_PASSES, decompressTime));
+	rc = 0;
+fail:
+
+	for (x = 0; x < TEST_ZGFX_PDU_COUNT; x++)
+		free(pdus[x].data);
+
+	free(data);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	return rc;
+}
+
+int TestFreeRDPCodecZGfxThroughput(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (test_ZGfxThroughput(1) < 0)
+		return -1;
+
+	if (test_ZGfxThroughput(2) < 0)
+		return -1;
+
+	return 0;
+}
@@ -881,6 +881,77 @@ out:
 	return retCode;
 }
 
+static int test_r1_r3_minus_r11(void)
+{
+	REGION16 region, difference;
+	int retCode = -1;
+	const RECTANGLE_16* rects;
+	UINT32 nbRects;
+	RECTANGLE_16 r1 = {  0, 101, 200, 201};
+	RECTANGLE_16 r3 = {150, 151, 250, 251};
+	RECTANGLE_16 r11 = {170, 151, 600, 301};
+	RECTANGLE_16 r12 = {  0,   0,  50,  50};
+	RECTANGLE_16 r1_r3_minus_r11[] =
+	{
+		{  0, 101, 200, 151},
+		{  0, 151, 170, 201},
+		{150, 201, 170, 251},
+	};
+	region16_init(&region);
+	region16_init(&difference);
+
+	/*
+	 * +===============================================================
+	 * |
+	 * |+-----+                          +-----+
+	 * ||     |                          |     |
+	 * ||     +------+                   |     +
+	 * || r1+r3      |         (r1+r3) - r11   |
+	 * ||     +----------------+         |   +-+
+	 * |+---+ |      |         |  ====>  +-+ |
+	 * |    | |      |         |           | |
+	 * |    | |      |         |           | |
+	 * |    +-|------+         |           +-+
+	 * |      |            r11 |
+	 * |      +----------------+
+	 */
+	if (!region16_union_rect(&region, &region, &r1))
+		goto out;
+
+	if (!region16_union_rect(&region, &region, &r3))
+		goto out;
+
+	if (!region16_subtract_rect(&difference, &region, &r11))
+		goto out;
+
+	rects = region16_rects(&difference, &nbRects);
+
+	if (!rects || nbRects != 3 || !compareRectangles(rects, r1_r3_minus_r11, nbRects))
+		goto out;
+
+	/* removing a disjoint rectangle keeps the region, in place as well */
+	if (!region16_subtract_rect(&difference, &difference, &r12))
+		goto out;
+
+	rects = region16_rects(&difference, &nbRects);
+
+	if (!rects || nbRects != 3 || !compareRectangles(rects, r1_r3_minus_r11, nbRects))
+		goto out;
+
+	/* removing the extents leaves nothing */
+	if (!region16_subtract_rect(&difference, &difference, region16_extents(&region)))
+		goto out;
+
+	if (!region16_is_empty(&difference))
+		goto out;
+
+	retCode = 0;
+out:
+	region16_uninit(&difference);
+	region16_uninit(&region);
+	return retCode;
+}
+
 typedef int (*TestFunction)(void);
 struct UnitaryTest
 {
@@ -904,6 +975,7 @@ static struct UnitaryTest tests[] =
 	{"norbert's case",			test_norbert_case},
 	{"norbert's case 2", 		test_norbert2_case},
 	{"empty rectangle case",	test_empty_rectangle},
+	{"(R1+R3)-R11",				test_r1_r3_minus_r11},
 
 	{NULL, NULL}
 };
@@ -166,9 +166,10 @@ BOOL yuv_context_decode(YUV_CONTEXT* context, const BYTE* pYUVData[3], UINT32 iS
 			ret = FALSE;
 			break;
 		}
-		SubmitThreadpoolWork(work_objects[i]);
 	}
 
+	SubmitThreadpoolWorkBatch(work_objects, waitCount);
+
 	for (i = 0; i < waitCount; i++)
 	{
 		WaitForThreadpoolWorkCallbacks(work_objects[i], FALSE);
@@ -42,6 +42,14 @@
  * Minimum match length: 3 bytes
  */
 
+#define ZGFX_HASH_BITS			16
+#define ZGFX_HASH_SIZE			(1 << ZGFX_HASH_BITS)
+#define ZGFX_HASH_NIL			0xFFFFFFFF
+#define ZGFX_MIN_MATCH			3
+#define ZGFX_MAX_UNENCODED		0x7FFF
+#define ZGFX_PREFIX_BITS		9
+#define ZGFX_PREFIX_INVALID		0xFF
+
 struct _ZGFX_TOKEN
 {
 	UINT32 prefixLength;
@@ -56,20 +64,70 @@ struct _ZGFX_CONTEXT
 {
 	BOOL Compressor;
 
-	const BYTE* pbInputCurrent;
-	const BYTE* pbInputEnd;
-
-	UINT32 bits;
-	UINT32 cBitsRemaining;
-	UINT32 BitsCurrent;
-	UINT32 cBitsCurrent;
-
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
 
 	BYTE HistoryBuffer[2500000];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	UINT32 CompressionLevel;
+	UINT32* HashTable;
+	UINT32* HashChain;
+	UINT32 LiteralCode[256];
+	UINT32 LiteralLength[256];
+};
+
+struct _ZGFX_BIT_WRITER
+{
+	BYTE* buffer;
+	size_t capacity;
+	size_t length;
+	UINT32 accumulator;
+	UINT32 bits;
+	BOOL overflow;
+};
+typedef struct _ZGFX_BIT_WRITER ZGFX_BIT_WRITER;
+
+/* Bit reader keeping the next (up to 64) bits of the segment left aligned in a register */
+struct _ZGFX_BIT_READER
+{
+	UINT64 accumulator;
+	UINT32 bits;
+	UINT32 remaining; /* bits left to decode in the segment */
+	const BYTE* pointer;
+	const BYTE* end;
+};
+typedef struct _ZGFX_BIT_READER ZGFX_BIT_READER;
+
+/* Token decoded from the next ZGFX_PREFIX_BITS bits of the stream */
+struct _ZGFX_PREFIX
+{
+	BYTE length;
+	BYTE token; /* index in ZGFX_TOKEN_TABLE or ZGFX_PREFIX_INVALID */
+};
+typedef struct _ZGFX_PREFIX ZGFX_PREFIX;
+
+struct _ZGFX_EFFORT
+{
+	UINT32 chainLength; /* hash chain entries compared per position */
+	UINT32 niceLength; /* match length ending the search early */
+};
+typedef struct _ZGFX_EFFORT ZGFX_EFFORT;
+
+/* Match finder effort per compression level, 0 disables compression */
+static const ZGFX_EFFORT ZGFX_EFFORT_TABLE[ZGFX_MAX_COMPRESSION_LEVEL + 1] =
+{
+	{    0,     0 },
+	{    1,    32 },
+	{    2,    32 },
+	{    4,    64 },
+	{    8,    64 },
+	{   16,   128 },
+	{   32,   256 },
+	{   64,  1024 },
+	{  256,  4096 },
+	{ 1024, 65535 }
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] =
@@ -118,25 +176,126 @@ static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] =
 	{ 0 }
 };
 
-static INLINE BOOL zgfx_GetBits(ZGFX_CONTEXT* _zgfx, UINT32 _nbits)
+static ZGFX_PREFIX ZGFX_PREFIX_TABLE[1 << ZGFX_PREFIX_BITS];
+
+static INIT_ONCE zgfx_prefix_init_once = INIT_ONCE_STATIC_INIT;
+
+/* Every token prefix fills the table entries starting with its code */
+static BOOL CALLBACK zgfx_prefix_init(PINIT_ONCE once, PVOID param, PVOID* context)
 {
-	if (!_zgfx)
-		return FALSE;
+	size_t index;
+
+	for (index = 0; index < ARRAYSIZE(ZGFX_PREFIX_TABLE); index++)
+	{
+		ZGFX_PREFIX_TABLE[index].length = ZGFX_PREFIX_BITS;
+		ZGFX_PREFIX_TABLE[index].token = ZGFX_PREFIX_INVALID;
+	}
+
+	for (index = 0; ZGFX_TOKEN_TABLE[index].prefixLength != 0; index++)
+	{
+		const ZGFX_TOKEN* token = &ZGFX_TOKEN_TABLE[index];
+		const UINT32 shift = ZGFX_PREFIX_BITS - token->prefixLength;
+		const UINT32 first = token->prefixCode << shift;
+		UINT32 x;
+
+		for (x = first; x < first + (1UL << shift); x++)
+		{
+			ZGFX_PREFIX_TABLE[x].length = (BYTE)token->prefixLength;
+			ZGFX_PREFIX_TABLE[x].token = (BYTE)index;
+		}
+	}
+
+	return TRUE;
+}
 
-	while (_zgfx->cBitsCurrent < _nbits)
+static INLINE void zgfx_bit_reader_attach(ZGFX_BIT_READER* r, const BYTE* data, size_t size,
+                                          UINT32 remaining)
+{
+	r->accumulator = 0;
+	r->bits = 0;
+	r->remaining = remaining;
+	r->pointer = data;
+	r->end = data + size;
+}
+
+/* Loads at least 56 bits into the accumulator, unless the segment ends before */
+static INLINE void zgfx_bit_reader_fill(ZGFX_BIT_READER* r)
+{
+	if (r->bits >= 56)
+		return;
+
+	if ((r->end - r->pointer) >= 8)
 	{
-		_zgfx->BitsCurrent <<= 8;
+		const BYTE* p = r->pointer;
+		const UINT64 value = ((UINT64)p[0] << 56) | ((UINT64)p[1] << 48) |
+		                     ((UINT64)p[2] << 40) | ((UINT64)p[3] << 32) |
+		                     ((UINT64)p[4] << 24) | ((UINT64)p[5] << 16) |
+		                     ((UINT64)p[6] << 8) | ((UINT64)p[7]);
+		const UINT32 count = (63 - r->bits) >> 3;
+		/* Bits of the partially loaded byte are loaded again by the next fill,
+		 * at the very same position. */
+		r->accumulator |= value >> r->bits;
+		r->pointer += count;
+		r->bits += count * 8;
+		return;
+	}
 
-		if (_zgfx->pbInputCurrent < _zgfx->pbInputEnd)
-			_zgfx->BitsCurrent += *(_zgfx->pbInputCurrent)++;
+	while ((r->bits <= 56) && (r->pointer < r->end))
+	{
+		r->accumulator |= ((UINT64)*r->pointer++) << (56 - r->bits);
+		r->bits += 8;
+	}
+}
 
-		_zgfx->cBitsCurrent += 8;
+/* Returns the next nbits (1 to 32) bits without consuming them, zero past the segment end */
+static INLINE UINT32 zgfx_bit_reader_peek(const ZGFX_BIT_READER* r, UINT32 nbits)
+{
+	return (UINT32)(r->accumulator >> (64 - nbits));
+}
+
+static INLINE BOOL zgfx_bit_reader_skip(ZGFX_BIT_READER* r, UINT32 nbits)
+{
+	if (nbits > r->remaining)
+		return FALSE;
+
+	r->accumulator <<= nbits;
+	r->bits -= nbits;
+	r->remaining -= nbits;
+	return TRUE;
+}
+
+/* Reads nbits (0 to 32) bits, the caller fills the accumulator beforehand */
+static INLINE BOOL zgfx_bit_reader_get(ZGFX_BIT_READER* r, UINT32 nbits, UINT32* value)
+{
+	if (nbits == 0)
+	{
+		*value = 0;
+		return TRUE;
 	}
 
-	_zgfx->cBitsRemaining -= _nbits;
-	_zgfx->cBitsCurrent -= _nbits;
-	_zgfx->bits = _zgfx->BitsCurrent >> _zgfx->cBitsCurrent;
-	_zgfx->BitsCurrent &= ((1 << _zgfx->cBitsCurrent) - 1);
+	*value = zgfx_bit_reader_peek(r, nbits);
+	return zgfx_bit_reader_skip(r, nbits);
+}
+
+/* Drops the bits up to the next byte boundary and returns the position of that byte */
+static INLINE const BYTE* zgfx_bit_reader_align(ZGFX_BIT_READER* r)
+{
+	if (!zgfx_bit_reader_skip(r, r->bits % 8))
+		return NULL;
+
+	return r->pointer - (r->bits / 8);
+}
+
+/* Continues reading after count bytes were taken from the byte aligned position */
+static INLINE BOOL zgfx_bit_reader_advance(ZGFX_BIT_READER* r, const BYTE* position, UINT32 count)
+{
+	if ((count > (size_t)(r->end - position)) || (count > r->remaining / 8))
+		return FALSE;
+
+	r->accumulator = 0;
+	r->bits = 0;
+	r->remaining -= count * 8;
+	r->pointer = position + count;
 	return TRUE;
 }
 
@@ -171,66 +330,68 @@ static void zgfx_history_buffer_ring_write(ZGFX_CONTEXT* zgfx, const BYTE* src,
 	}
 }
 
-static void zgfx_history_buffer_ring_read(ZGFX_CONTEXT* zgfx, int offset, BYTE* dst, UINT32 count)
+/**
+ * Appends a match to the output buffer. The segment is written to the history
+ * only once it is decoded, so sources in the current segment are copied from
+ * the output buffer and older ones from the history.
+ */
+static BOOL zgfx_copy_match(ZGFX_CONTEXT* zgfx, UINT32 distance, UINT32 count)
 {
-	UINT32 front;
-	UINT32 index;
-	INT32 bytes;
-	UINT32 valid;
-	INT32 bytesLeft;
-	BYTE* dptr = dst;
-	BYTE* origDst = dst;
-
-	if ((count <= 0) || (count > INT32_MAX))
-		return;
+	const BYTE* src;
+	BYTE* dst = &zgfx->OutputBuffer[zgfx->OutputCount];
 
-	bytesLeft = (INT32)count;
-	index = (zgfx->HistoryIndex + zgfx->HistoryBufferSize - offset) % zgfx->HistoryBufferSize;
-	bytes = MIN(bytesLeft, offset);
+	if ((distance > zgfx->HistoryBufferSize) ||
+	    (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount))
+		return FALSE;
 
-	if ((index + bytes) <= zgfx->HistoryBufferSize)
-	{
-		CopyMemory(dptr, &(zgfx->HistoryBuffer[index]), bytes);
-	}
-	else
-	{
-		front = zgfx->HistoryBufferSize - index;
-		CopyMemory(dptr, &(zgfx->HistoryBuffer[index]), front);
-		CopyMemory(&dptr[front], zgfx->HistoryBuffer, bytes - front);
-	}
+	zgfx->OutputCount += count;
 
-	if ((bytesLeft -= bytes) == 0)
-		return;
+	if (distance > (size_t)(dst - zgfx->OutputBuffer))
+	{
+		const UINT32 back = distance - (UINT32)(dst - zgfx->OutputBuffer);
+		const UINT32 bytes = MIN(back, count);
+		const UINT32 index =
+		    (zgfx->HistoryIndex + zgfx->HistoryBufferSize - back) % zgfx->HistoryBufferSize;
 
-	dptr += bytes;
-	valid = bytes;
+		if (index + bytes <= zgfx->HistoryBufferSize)
+		{
+			CopyMemory(dst, &zgfx->HistoryBuffer[index], bytes);
+		}
+		else
+		{
+			const UINT32 front = zgfx->HistoryBufferSize - index;
+			CopyMemory(dst, &zgfx->HistoryBuffer[index], front);
+			CopyMemory(&dst[front], zgfx->HistoryBuffer, bytes - front);
+		}
 
-	do
-	{
-		bytes = valid;
+		dst += bytes;
+		count -= bytes;
+	}
 
-		if (bytes > bytesLeft)
-			bytes = bytesLeft;
+	/* Overlapping matches repeat the source, the copied run doubles every pass */
+	src = dst - distance;
 
-		CopyMemory(dptr, origDst, bytes);
-		dptr += bytes;
-		valid <<= 1;
+	while (count > 0)
+	{
+		const UINT32 bytes = MIN(count, (UINT32)(dst - src));
+		CopyMemory(dst, src, bytes);
+		dst += bytes;
+		count -= bytes;
 	}
-	while ((bytesLeft -= bytes) > 0);
+
+	return TRUE;
 }
 
 static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t segmentSize)
 {
-	BYTE c;
 	BYTE flags;
-	UINT32 extra = 0;
-	int opIndex;
-	UINT32 haveBits;
-	UINT32 inPrefix;
+	UINT32 value;
 	UINT32 count;
 	UINT32 distance;
 	BYTE* pbSegment;
 	size_t cbSegment;
+	size_t cBitsRemaining;
+	ZGFX_BIT_READER reader;
 
 	if (!zgfx || !stream)
 		return FALSE;
@@ -258,107 +419,99 @@ static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t
 		return TRUE;
 	}
 
-	zgfx->pbInputCurrent = pbSegment;
-	zgfx->pbInputEnd = &pbSegment[cbSegment - 1];
+	if (cbSegment < 1)
+		return FALSE;
+
 	/* NumberOfBitsToDecode = ((NumberOfBytesToDecode - 1) * 8) - ValueOfLastByte */
-	zgfx->cBitsRemaining = 8 * (cbSegment - 1) - *zgfx->pbInputEnd;
-	zgfx->cBitsCurrent = 0;
-	zgfx->BitsCurrent = 0;
+	cBitsRemaining = 8 * (cbSegment - 1);
 
-	while (zgfx->cBitsRemaining)
+	if (cBitsRemaining < pbSegment[cbSegment - 1])
+		return FALSE;
+
+	cBitsRemaining -= pbSegment[cbSegment - 1];
+	InitOnceExecuteOnce(&zgfx_prefix_init_once, zgfx_prefix_init, NULL, NULL);
+	zgfx_bit_reader_attach(&reader, pbSegment, cbSegment - 1, (UINT32)cBitsRemaining);
+
+	while (reader.remaining)
 	{
-		haveBits = 0;
-		inPrefix = 0;
+		const ZGFX_TOKEN* token;
+		ZGFX_PREFIX prefix;
+		zgfx_bit_reader_fill(&reader);
+		prefix = ZGFX_PREFIX_TABLE[zgfx_bit_reader_peek(&reader, ZGFX_PREFIX_BITS)];
+
+		if ((prefix.token == ZGFX_PREFIX_INVALID) || !zgfx_bit_reader_skip(&reader, prefix.length))
+			return FALSE;
+
+		token = &ZGFX_TOKEN_TABLE[prefix.token];
+
+		if (!zgfx_bit_reader_get(&reader, token->valueBits, &value))
+			return FALSE;
+
+		if (token->tokenType == 0)
+		{
+			/* Literal */
+			if (zgfx->OutputCount >= sizeof(zgfx->OutputBuffer))
+				return FALSE;
+
+			zgfx->OutputBuffer[zgfx->OutputCount++] = (BYTE)(token->valueBase + value);
+			continue;
+		}
 
-		for (opIndex = 0; ZGFX_TOKEN_TABLE[opIndex].prefixLength != 0; opIndex++)
+		distance = token->valueBase + value;
+		zgfx_bit_reader_fill(&reader);
+
+		if (distance != 0)
 		{
-			while (haveBits < ZGFX_TOKEN_TABLE[opIndex].prefixLength)
+			/* Match */
+			if (!zgfx_bit_reader_get(&reader, 1, &value))
+				return FALSE;
+
+			if (value == 0)
 			{
-				zgfx_GetBits(zgfx, 1);
-				inPrefix = (inPrefix << 1) + zgfx->bits;
-				haveBits++;
+				count = 3;
 			}
-
-			if (inPrefix == ZGFX_TOKEN_TABLE[opIndex].prefixCode)
+			else
 			{
-				if (ZGFX_TOKEN_TABLE[opIndex].tokenType == 0)
-				{
-					/* Literal */
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					c = (BYTE)(ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits);
-					zgfx->HistoryBuffer[zgfx->HistoryIndex] = c;
+				/* (n - 1) one bits and a zero bit, then n + 1 bits of count - 2^(n + 1) */
+				const UINT32 next = zgfx_bit_reader_peek(&reader, 16);
+				UINT32 ones = 0;
 
-					if (++zgfx->HistoryIndex == zgfx->HistoryBufferSize)
-						zgfx->HistoryIndex = 0;
+				while ((ones < 16) && (next & (0x8000 >> ones)))
+					ones++;
 
-					if (zgfx->OutputCount >= sizeof(zgfx->OutputBuffer))
-						return FALSE;
+				/* Longer matches do not fit into the output buffer */
+				if ((ones > 14) || !zgfx_bit_reader_skip(&reader, ones + 1) ||
+				    !zgfx_bit_reader_get(&reader, ones + 2, &value))
+					return FALSE;
 
-					zgfx->OutputBuffer[zgfx->OutputCount++] = c;
-				}
-				else
-				{
-					zgfx_GetBits(zgfx, ZGFX_TOKEN_TABLE[opIndex].valueBits);
-					distance = ZGFX_TOKEN_TABLE[opIndex].valueBase + zgfx->bits;
-
-					if (distance != 0)
-					{
-						/* Match */
-						zgfx_GetBits(zgfx, 1);
-
-						if (zgfx->bits == 0)
-						{
-							count = 3;
-						}
-						else
-						{
-							count = 4;
-							extra = 2;
-							zgfx_GetBits(zgfx, 1);
-
-							while (zgfx->bits == 1)
-							{
-								count *= 2;
-								extra++;
-								zgfx_GetBits(zgfx, 1);
-							}
-
-							zgfx_GetBits(zgfx, extra);
-							count += zgfx->bits;
-						}
-
-						if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
-							return FALSE;
-
-						zgfx_history_buffer_ring_read(zgfx, distance, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx_history_buffer_ring_write(zgfx, &(zgfx->OutputBuffer[zgfx->OutputCount]), count);
-						zgfx->OutputCount += count;
-					}
-					else
-					{
-						/* Unencoded */
-						zgfx_GetBits(zgfx, 15);
-						count = zgfx->bits;
-						zgfx->cBitsRemaining -= zgfx->cBitsCurrent;
-						zgfx->cBitsCurrent = 0;
-						zgfx->BitsCurrent = 0;
-
-						if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
-							return FALSE;
-
-						CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), zgfx->pbInputCurrent, count);
-						zgfx_history_buffer_ring_write(zgfx, zgfx->pbInputCurrent, count);
-						zgfx->pbInputCurrent += count;
-						zgfx->cBitsRemaining -= (8 * count);
-						zgfx->OutputCount += count;
-					}
-				}
-
-				break;
+				count = (4UL << ones) + value;
 			}
+
+			if (!zgfx_copy_match(zgfx, distance, count))
+				return FALSE;
+		}
+		else
+		{
+			/* Unencoded */
+			const BYTE* position;
+
+			if (!zgfx_bit_reader_get(&reader, 15, &count))
+				return FALSE;
+
+			if (count > sizeof(zgfx->OutputBuffer) - zgfx->OutputCount)
+				return FALSE;
+
+			position = zgfx_bit_reader_align(&reader);
+
+			if (!position || !zgfx_bit_reader_advance(&reader, position, count))
+				return FALSE;
+
+			CopyMemory(&(zgfx->OutputBuffer[zgfx->OutputCount]), position, count);
+			zgfx->OutputCount += count;
 		}
 	}
 
+	zgfx_history_buffer_ring_write(zgfx, zgfx->OutputBuffer, zgfx->OutputCount);
 	return TRUE;
 }
 
@@ -451,19 +604,385 @@ fail:
 	return status;
 }
 
+static INLINE void zgfx_bit_writer_init(ZGFX_BIT_WRITER* w, BYTE* buffer, size_t capacity)
+{
+	w->buffer = buffer;
+	w->capacity = capacity;
+	w->length = 0;
+	w->accumulator = 0;
+	w->bits = 0;
+	w->overflow = FALSE;
+}
+
+/* Appends the nbits (at most 24) low bits of value, most significant bit first */
+static INLINE void zgfx_bit_writer_put(ZGFX_BIT_WRITER* w, UINT32 nbits, UINT32 value)
+{
+	w->accumulator = (w->accumulator << nbits) | value;
+	w->bits += nbits;
+
+	while (w->bits >= 8)
+	{
+		w->bits -= 8;
+
+		if (w->length < w->capacity)
+			w->buffer[w->length++] = (BYTE)(w->accumulator >> w->bits);
+		else
+			w->overflow = TRUE;
+	}
+}
+
+static INLINE void zgfx_bit_writer_align(ZGFX_BIT_WRITER* w)
+{
+	if (w->bits)
+		zgfx_bit_writer_put(w, 8 - w->bits, 0);
+}
+
+static INLINE void zgfx_bit_writer_write(ZGFX_BIT_WRITER* w, const BYTE* data, size_t length)
+{
+	if (length > w->capacity - w->length)
+	{
+		w->overflow = TRUE;
+		return;
+	}
+
+	CopyMemory(&w->buffer[w->length], data, length);
+	w->length += length;
+}
+
+static INLINE UINT32 zgfx_history_hash(const ZGFX_CONTEXT* zgfx, UINT32 index)
+{
+	UINT32 value;
+	UINT32 index1 = index + 1;
+	UINT32 index2 = index + 2;
+
+	if (index1 >= zgfx->HistoryBufferSize)
+		index1 -= zgfx->HistoryBufferSize;
+
+	if (index2 >= zgfx->HistoryBufferSize)
+		index2 -= zgfx->HistoryBufferSize;
+
+	value = ((UINT32) zgfx->HistoryBuffer[index] << 16) |
+	        ((UINT32) zgfx->HistoryBuffer[index1] << 8) | zgfx->HistoryBuffer[index2];
+	return (value * 2654435761U) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_history_insert(ZGFX_CONTEXT* zgfx, UINT32 index)
+{
+	const UINT32 hash = zgfx_history_hash(zgfx, index);
+	zgfx->HashChain[index] = zgfx->HashTable[hash];
+	zgfx->HashTable[hash] = index;
+}
+
+/* Returns the number of equal bytes (up to max) at two positions of the history */
+static UINT32 zgfx_history_match_length(const ZGFX_CONTEXT* zgfx, UINT32 a, UINT32 b, UINT32 max)
+{
+	UINT32 length = 0;
+
+	while (length < max)
+	{
+		UINT32 i = 0;
+		UINT32 chunk = max - length;
+		const BYTE* pa = &zgfx->HistoryBuffer[a];
+		const BYTE* pb = &zgfx->HistoryBuffer[b];
+		chunk = MIN(chunk, zgfx->HistoryBufferSize - a);
+		chunk = MIN(chunk, zgfx->HistoryBufferSize - b);
+
+		while ((i < chunk) && (pa[i] == pb[i]))
+			i++;
+
+		length += i;
+
+		if (i < chunk)
+			break;
+
+		if ((a += chunk) == zgfx->HistoryBufferSize)
+			a = 0;
+
+		if ((b += chunk) == zgfx->HistoryBufferSize)
+			b = 0;
+	}
+
+	return length;
+}
+
+/**
+ * Walks the hash chain of the history position index for the longest earlier
+ * occurrence of the data at index and inserts index into the chain.
+ * Returns the match length, 0 if there is none.
+ */
+static UINT32 zgfx_history_find_match(ZGFX_CONTEXT* zgfx, UINT32 index, UINT32 maxLength,
+                                      UINT32 maxDistance, UINT32* pDistance)
+{
+	UINT32 bestLength = 0;
+	UINT32 lastDistance = 0;
+	const ZGFX_EFFORT* effort = &ZGFX_EFFORT_TABLE[zgfx->CompressionLevel];
+	UINT32 chain = effort->chainLength;
+	const UINT32 niceLength = MIN(effort->niceLength, maxLength);
+	const UINT32 hash = zgfx_history_hash(zgfx, index);
+	UINT32 candidate = zgfx->HashTable[hash];
+	zgfx->HashChain[index] = candidate;
+	zgfx->HashTable[hash] = index;
+
+	for (; (candidate != ZGFX_HASH_NIL) && (chain > 0); chain--)
+	{
+		UINT32 length;
+		const UINT32 distance = (index >= candidate) ? index - candidate :
+		                        index + zgfx->HistoryBufferSize - candidate;
+
+		/* Distances grow along the chain, anything else is a stale entry
+		 * from an earlier pass over the history ring */
+		if ((distance <= lastDistance) || (distance > maxDistance))
+			break;
+
+		lastDistance = distance;
+		length = zgfx_history_match_length(zgfx, candidate, index, maxLength);
+
+		if (length > bestLength)
+		{
+			bestLength = length;
+			*pDistance = distance;
+
+			if (bestLength >= niceLength)
+				break;
+		}
+
+		candidate = zgfx->HashChain[candidate];
+	}
+
+	return bestLength;
+}
+
+static const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	const ZGFX_TOKEN* token;
+
+	for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+	{
+		if ((token->tokenType == 1) && (distance >= token->valueBase) &&
+		    ((distance - token->valueBase) < (1UL << token->valueBits)))
+			return token;
+	}
+
+	return NULL;
+}
+
+/* Number of bits used to encode the length of a match */
+static INLINE UINT32 zgfx_match_length_bits(UINT32 count)
+{
+	UINT32 extra = 0;
+
+	if (count == 3)
+		return 1;
+
+	while ((count >> extra) > 1)
+		extra++;
+
+	return 2 * extra;
+}
+
+static void zgfx_write_match(ZGFX_BIT_WRITER* w, const ZGFX_TOKEN* token, UINT32 distance,
+                             UINT32 count)
+{
+	UINT32 extra = 0;
+	zgfx_bit_writer_put(w, token->prefixLength, token->prefixCode);
+	zgfx_bit_writer_put(w, token->valueBits, distance - token->valueBase);
+
+	if (count == 3)
+	{
+		zgfx_bit_writer_put(w, 1, 0);
+		return;
+	}
+
+	/* (extra - 1) 1 bits and a 0 bit select the range [2^extra, 2^(extra+1)) */
+	while ((count >> extra) > 1)
+		extra++;
+
+	zgfx_bit_writer_put(w, extra, ((1UL << (extra - 1)) - 1) << 1);
+	zgfx_bit_writer_put(w, extra, count - (1UL << extra));
+}
+
+/* Writes count bytes as literal tokens or as unencoded bytes, whichever is shorter */
+static void zgfx_write_literals(ZGFX_CONTEXT* zgfx, ZGFX_BIT_WRITER* w, const BYTE* data,
+                                UINT32 count)
+{
+	while (count > 0)
+	{
+		UINT32 index;
+		UINT32 literalBits = 0;
+		UINT32 unencodedBits;
+		const UINT32 chunk = MIN(count, ZGFX_MAX_UNENCODED);
+
+		for (index = 0; index < chunk; index++)
+			literalBits += zgfx->LiteralLength[data[index]];
+
+		/* token (5 bits), distance 0 (5 bits), count (15 bits) and byte alignment */
+		unencodedBits = ((w->bits + 25 + 7) & ~7) - w->bits + 8 * chunk;
+
+		if (unencodedBits < literalBits)
+		{
+			zgfx_bit_writer_put(w, 5, 17);
+			zgfx_bit_writer_put(w, 5, 0);
+			zgfx_bit_writer_put(w, 15, chunk);
+			zgfx_bit_writer_align(w);
+			zgfx_bit_writer_write(w, data, chunk);
+		}
+		else
+		{
+			for (index = 0; index < chunk; index++)
+				zgfx_bit_writer_put(w, zgfx->LiteralLength[data[index]], zgfx->LiteralCode[data[index]]);
+		}
+
+		data += chunk;
+		count -= chunk;
+	}
+}
+
+/**
+ * Compresses a segment already appended to the history at index start
+ * into the output buffer. Returns the compressed size, or 0 if the
+ * result would not be smaller than the input.
+ */
+static size_t zgfx_compress_history(ZGFX_CONTEXT* zgfx, UINT32 start, const BYTE* pSrcData,
+                                    UINT32 SrcSize)
+{
+	UINT32 pos = 0;
+	UINT32 literalStart = 0;
+	ZGFX_BIT_WRITER w;
+	/* The oldest SrcSize bytes of the history were overwritten by the segment */
+	const UINT32 maxDistance = zgfx->HistoryBufferSize - SrcSize;
+	/* compressed data and the padding byte have to be smaller than the input */
+	zgfx_bit_writer_init(&w, zgfx->OutputBuffer, MIN(SrcSize - 2, sizeof(zgfx->OutputBuffer)));
+
+	while ((pos < SrcSize) && !w.overflow)
+	{
+		UINT32 index;
+		UINT32 length = 0;
+		UINT32 distance = 0;
+		const ZGFX_TOKEN* token = NULL;
+
+		if ((SrcSize - pos) < ZGFX_MIN_MATCH)
+		{
+			pos = SrcSize;
+			break;
+		}
+
+		index = start + pos;
+
+		if (index >= zgfx->HistoryBufferSize)
+			index -= zgfx->HistoryBufferSize;
+
+		length = zgfx_history_find_match(zgfx, index, SrcSize - pos, maxDistance, &distance);
+
+		if (length >= ZGFX_MIN_MATCH)
+		{
+			UINT32 x;
+			UINT32 literalBits = 0;
+			token = zgfx_distance_token(distance);
+
+			/* short matches far away can be longer than the literals */
+			for (x = 0; (x < length) && (x < 4); x++)
+				literalBits += zgfx->LiteralLength[pSrcData[pos + x]];
+
+			if (token && (length < 5) &&
+			    ((token->prefixLength + token->valueBits + zgfx_match_length_bits(length)) >= literalBits))
+				token = NULL;
+		}
+
+		if (!token)
+		{
+			pos++;
+			continue;
+		}
+
+		zgfx_write_literals(zgfx, &w, &pSrcData[literalStart], pos - literalStart);
+		zgfx_write_match(&w, token, distance, length);
+
+		for (pos++, length--; length > 0; pos++, length--)
+		{
+			if (++index >= zgfx->HistoryBufferSize)
+				index = 0;
+
+			if ((SrcSize - pos) >= ZGFX_MIN_MATCH)
+				zgfx_history_insert(zgfx, index);
+		}
+
+		literalStart = pos;
+	}
+
+	zgfx_write_literals(zgfx, &w, &pSrcData[literalStart], SrcSize - literalStart);
+	/* the last byte holds the number of unused bits of the one before */
+	{
+		const UINT32 padding = (8 - w.bits) & 7;
+		zgfx_bit_writer_align(&w);
+		zgfx_bit_writer_put(&w, 8, padding);
+	}
+
+	if (w.overflow)
+		return 0;
+
+	return w.length;
+}
+
+/* The match finder needs about 10 MB, it is only allocated once a level above 0 is used */
+static BOOL zgfx_hash_init(ZGFX_CONTEXT* zgfx)
+{
+	if (zgfx->HashTable)
+		return TRUE;
+
+	zgfx->HashTable = (UINT32*) malloc(ZGFX_HASH_SIZE * sizeof(UINT32));
+	zgfx->HashChain = (UINT32*) calloc(zgfx->HistoryBufferSize, sizeof(UINT32));
+
+	if (!zgfx->HashTable || !zgfx->HashChain)
+	{
+		free(zgfx->HashTable);
+		free(zgfx->HashChain);
+		zgfx->HashTable = NULL;
+		zgfx->HashChain = NULL;
+		return FALSE;
+	}
+
+	memset(zgfx->HashTable, 0xFF, ZGFX_HASH_SIZE * sizeof(UINT32));
+	return TRUE;
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
                                   UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	size_t compressedSize = 0;
+	const UINT32 start = zgfx->HistoryIndex;
+	BYTE flags;
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
+	if ((zgfx->CompressionLevel > 0) && !zgfx_hash_init(zgfx))
+	{
+		WLog_ERR(TAG, "zgfx_hash_init failed!");
+		return FALSE;
+	}
+
 	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags)); /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	flags = (BYTE)((*pFlags) & ~PACKET_COMPRESSED);
+	/* The decompressor adds every segment to its history, compressed or not */
+	zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+
+	if ((zgfx->CompressionLevel > 0) && (SrcSize > 4))
+		compressedSize = zgfx_compress_history(zgfx, start, pSrcData, SrcSize);
+
+	if (compressedSize > 0)
+	{
+		Stream_Write_UINT8(s, flags | PACKET_COMPRESSED); /* header (1 byte) */
+		Stream_Write(s, zgfx->OutputBuffer, compressedSize);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, flags); /* header (1 byte) */
+		Stream_Write(s, pSrcData, SrcSize);
+	}
+
 	return TRUE;
 }
 
@@ -562,9 +1081,20 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 }
 
 
+void zgfx_set_compression_level(ZGFX_CONTEXT* zgfx, DWORD CompressionLevel)
+{
+	if (!zgfx)
+		return;
+
+	zgfx->CompressionLevel = MIN(CompressionLevel, ZGFX_MAX_COMPRESSION_LEVEL);
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+
+	if (zgfx->HashTable)
+		memset(zgfx->HashTable, 0xFF, ZGFX_HASH_SIZE * sizeof(UINT32));
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -576,6 +1106,30 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 	{
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
+
+		if (Compressor)
+		{
+			const ZGFX_TOKEN* token;
+			UINT32 index;
+			zgfx->CompressionLevel = ZGFX_DEFAULT_COMPRESSION_LEVEL;
+
+			/* "0" followed by the byte, unless the byte has a shorter code of its own */
+			for (index = 0; index < 256; index++)
+			{
+				zgfx->LiteralCode[index] = index;
+				zgfx->LiteralLength[index] = 9;
+			}
+
+			for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+			{
+				if ((token->tokenType == 0) && (token->valueBits == 0))
+				{
+					zgfx->LiteralCode[token->valueBase] = token->prefixCode;
+					zgfx->LiteralLength[token->valueBase] = token->prefixLength;
+				}
+			}
+		}
+
 		zgfx_context_reset(zgfx, FALSE);
 	}
 
@@ -584,6 +1138,11 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->HashTable);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
 
@@ -195,6 +195,9 @@ BOOL freerdp_settings_get_bool(rdpSettings* settings, size_t id)
 		case FreeRDP_FIPSMode:
 			return settings->FIPSMode;
 
+		case FreeRDP_TlsKernelOffload:
+			return settings->TlsKernelOffload;
+
 		case FreeRDP_MstscCookieMode:
 			return settings->MstscCookieMode;
 
@@ -752,6 +755,10 @@ BOOL freerdp_settings_set_bool(rdpSettings* settings, size_t id, BOOL val)
 			settings->FIPSMode = val;
 			break;
 
+		case FreeRDP_TlsKernelOffload:
+			settings->TlsKernelOffload = val;
+			break;
+
 		case FreeRDP_MstscCookieMode:
 			settings->MstscCookieMode = val;
 			break;
@@ -1249,6 +1256,12 @@ UINT32 freerdp_settings_get_uint32(rdpSettings* settings, size_t id)
 		case FreeRDP_AcceptedCertLength:
 			return settings->AcceptedCertLength;
 
+		case FreeRDP_TransportBatchThreshold:
+			return settings->TransportBatchThreshold;
+
+		case FreeRDP_TransportBatchTimeout:
+			return settings->TransportBatchTimeout;
+
 		case FreeRDP_RdpVersion:
 			return settings->RdpVersion;
 
@@ -1507,6 +1520,9 @@ UINT32 freerdp_settings_get_uint32(rdpSettings* settings, size_t id)
 		case FreeRDP_RemoteFxCaptureFlags:
 			return settings->RemoteFxCaptureFlags;
 
+		case FreeRDP_RemoteFxPipelineDepth:
+			return settings->RemoteFxPipelineDepth;
+
 		case FreeRDP_NSCodecId:
 			return settings->NSCodecId;
 
@@ -1525,6 +1541,9 @@ UINT32 freerdp_settings_get_uint32(rdpSettings* settings, size_t id)
 		case FreeRDP_GfxCapsFilter:
 			return settings->GfxCapsFilter;
 
+		case FreeRDP_GfxCompressionLevel:
+			return settings->GfxCompressionLevel;
+
 		case FreeRDP_BitmapCacheV3CodecId:
 			return settings->BitmapCacheV3CodecId;
 
@@ -1585,6 +1604,14 @@ BOOL freerdp_settings_set_uint32(rdpSettings* settings, size_t id, UINT32 val)
 			settings->AcceptedCertLength = val;
 			break;
 
+		case FreeRDP_TransportBatchThreshold:
+			settings->TransportBatchThreshold = val;
+			break;
+
+		case FreeRDP_TransportBatchTimeout:
+			settings->TransportBatchTimeout = val;
+			break;
+
 		case FreeRDP_RdpVersion:
 			settings->RdpVersion = val;
 			break;
@@ -1929,6 +1956,10 @@ BOOL freerdp_settings_set_uint32(rdpSettings* settings, size_t id, UINT32 val)
 			settings->RemoteFxCaptureFlags = val;
 			break;
 
+		case FreeRDP_RemoteFxPipelineDepth:
+			settings->RemoteFxPipelineDepth = val;
+			break;
+
 		case FreeRDP_NSCodecId:
 			settings->NSCodecId = val;
 			break;
@@ -1953,6 +1984,10 @@ BOOL freerdp_settings_set_uint32(rdpSettings* settings, size_t id, UINT32 val)
 			settings->GfxCapsFilter = val;
 			break;
 
+		case FreeRDP_GfxCompressionLevel:
+			settings->GfxCompressionLevel = val;
+			break;
+
 		case FreeRDP_BitmapCacheV3CodecId:
 			settings->BitmapCacheV3CodecId = val;
 			break;
@@ -125,7 +125,7 @@ rdpChannels* freerdp_channels_new(freerdp* instance)
 		goto error;
 
 	channels->queue->object.fnObjectFree = channel_queue_free;
-	channels->openHandles = HashTable_New(TRUE);
+	channels->openHandles = HashTable_NewEx(TRUE, HASHTABLE_FLAG_OPEN_ADDRESSING);
 
 	if (!channels->openHandles)
 		goto error;
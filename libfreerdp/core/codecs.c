@@ -64,6 +64,14 @@ BOOL freerdp_client_codecs_prepare(rdpCodecs* codecs, UINT32 flags,
 			WLog_ERR(TAG, "Failed to create rfx codec context");
 			return FALSE;
 		}
+
+		if (codecs->context && codecs->context->settings &&
+		    !rfx_context_set_pipeline_depth(codecs->rfx,
+		                                    codecs->context->settings->RemoteFxPipelineDepth))
+		{
+			WLog_ERR(TAG, "Failed to set rfx pipeline depth");
+			return FALSE;
+		}
 	}
 
 	if ((flags & FREERDP_CODEC_CLEARCODEC) && !codecs->clear)
@@ -755,7 +755,7 @@ rdpInput* input_new(rdpRdp* rdp)
 	if (!input)
 		return NULL;
 
-	input->queue = MessageQueue_New(&cb);
+	input->queue = MessageQueue_NewEx(&cb, WMQ_FLAG_LOCKFREE);
 
 	if (!input->queue)
 	{
@@ -2650,7 +2650,8 @@ static BOOL update_message_register_interface(rdpUpdateProxy* message, rdpUpdate
 static DWORD WINAPI update_message_proxy_thread(LPVOID arg)
 {
 	rdpUpdate* update = (rdpUpdate*)arg;
-	wMessage message;
+	wMessage messages[32];
+	int count;
 
 	if (!update || !update->queue)
 	{
@@ -2660,14 +2661,18 @@ static DWORD WINAPI update_message_proxy_thread(LPVOID arg)
 		return 1;
 	}
 
-	while (MessageQueue_Wait(update->queue))
+	while ((count = MessageQueue_GetBatch(update->queue, messages, ARRAYSIZE(messages))) > 0)
 	{
-		int status = 0;
+		int index;
 
-		if (MessageQueue_Peek(update->queue, &message, TRUE))
-			status = update_message_queue_process_message(update, &message);
+		/* WMQ_QUIT is always the last message of a batch */
+		for (index = 0; index < count; index++)
+		{
+			if (!update_message_queue_process_message(update, &messages[index]))
+				break;
+		}
 
-		if (!status)
+		if (index < count)
 			break;
 	}
 
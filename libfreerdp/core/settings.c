@@ -37,6 +37,7 @@
 #include <winpr/registry.h>
 
 #include <freerdp/settings.h>
+#include <freerdp/codec/zgfx.h>
 #include <freerdp/build-config.h>
 #include <ctype.h>
 
@@ -335,6 +336,8 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->ServerMode = (flags & FREERDP_SETTINGS_SERVER_MODE) ? TRUE : FALSE;
 	settings->WaitForOutputBufferFlush = TRUE;
 	settings->MaxTimeInCheckLoop = 100;
+	settings->TransportBatchThreshold = 16384;
+	settings->TransportBatchTimeout = 10;
 	settings->DesktopWidth = 1024;
 	settings->DesktopHeight = 768;
 	settings->Workarea = FALSE;
@@ -377,6 +380,7 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->EncryptionMethods = ENCRYPTION_METHOD_NONE;
 	settings->EncryptionLevel = ENCRYPTION_LEVEL_NONE;
 	settings->FIPSMode = FALSE;
+	settings->TlsKernelOffload = FALSE;
 	settings->CompressionEnabled = TRUE;
 	settings->LogonNotify = TRUE;
 	settings->BrushSupportLevel = BRUSH_COLOR_FULL;
@@ -532,6 +536,7 @@ rdpSettings* freerdp_settings_new(DWORD flags)
 	settings->GfxH264 = FALSE;
 	settings->GfxAVC444 = FALSE;
 	settings->GfxSendQoeAck = FALSE;
+	settings->GfxCompressionLevel = ZGFX_SERVER_COMPRESSION_LEVEL;
 	settings->ClientAutoReconnectCookie = (ARC_CS_PRIVATE_PACKET*) calloc(1,
 	                                      sizeof(ARC_CS_PRIVATE_PACKET));
 
@@ -86,6 +86,17 @@
 #include "tcp.h"
 #include "../crypto/opensslcompat.h"
 
+#ifdef WITH_KERNEL_TLS
+#include <linux/tls.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 #define TAG FREERDP_TAG("core")
 
 /* Simple Socket BIO */
@@ -94,6 +105,11 @@ struct _WINPR_BIO_SIMPLE_SOCKET
 {
 	SOCKET socket;
 	HANDLE hEvent;
+#ifdef WITH_KERNEL_TLS
+	BOOL ktlsSend;
+	BOOL ktlsRecv;
+	BYTE ktlsRecordType;
+#endif
 };
 typedef struct _WINPR_BIO_SIMPLE_SOCKET WINPR_BIO_SIMPLE_SOCKET;
 
@@ -106,6 +122,133 @@ long transport_bio_simple_callback(BIO* bio, int mode, const char* argp, int arg
 	return 1;
 }
 
+#ifdef WITH_KERNEL_TLS
+static BOOL transport_bio_simple_set_ktls(WINPR_BIO_SIMPLE_SOCKET* ptr,
+        const struct tls_crypto_info* info, BOOL tx)
+{
+	socklen_t length;
+
+	if (!info)
+		return FALSE;
+
+	switch (info->cipher_type)
+	{
+		case TLS_CIPHER_AES_GCM_128:
+			length = sizeof(struct tls12_crypto_info_aes_gcm_128);
+			break;
+#ifdef TLS_CIPHER_AES_GCM_256
+
+		case TLS_CIPHER_AES_GCM_256:
+			length = sizeof(struct tls12_crypto_info_aes_gcm_256);
+			break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+
+		case TLS_CIPHER_CHACHA20_POLY1305:
+			length = sizeof(struct tls12_crypto_info_chacha20_poly1305);
+			break;
+#endif
+
+		default:
+			return FALSE;
+	}
+
+	/* EEXIST: the ULP was already attached for the other direction */
+	if ((setsockopt((int) ptr->socket, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) &&
+	    (errno != EEXIST))
+		return FALSE;
+
+	if (setsockopt((int) ptr->socket, SOL_TLS, tx ? TLS_TX : TLS_RX, info, length) != 0)
+		return FALSE;
+
+	if (tx)
+		ptr->ktlsSend = TRUE;
+	else
+		ptr->ktlsRecv = TRUE;
+
+	return TRUE;
+}
+
+/**
+ * Non application data records (alerts, handshake messages) have to be
+ * tagged with their content type, the kernel frames everything else as
+ * application data.
+ */
+static int transport_bio_simple_send_record(WINPR_BIO_SIMPLE_SOCKET* ptr, const char* buf,
+        int size)
+{
+	struct iovec iov;
+	struct msghdr msg = { 0 };
+	struct cmsghdr* cmsg;
+	union
+	{
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(BYTE))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	iov.iov_base = (void*) buf;
+	iov.iov_len = (size_t) size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(BYTE));
+	*((BYTE*) CMSG_DATA(cmsg)) = ptr->ktlsRecordType;
+	return (int) sendmsg((int) ptr->socket, &msg, 0);
+}
+
+/**
+ * With kernel TLS receive enabled OpenSSL expects one record per read,
+ * prefixed with a record header carrying the content type the kernel
+ * reports in the control message.
+ */
+static int transport_bio_simple_recv_record(WINPR_BIO_SIMPLE_SOCKET* ptr, char* buf, int size)
+{
+	int status;
+	struct iovec iov;
+	struct msghdr msg = { 0 };
+	struct cmsghdr* cmsg;
+	BYTE* header = (BYTE*) buf;
+	union
+	{
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(BYTE))];
+	} control;
+
+	if (size < SSL3_RT_HEADER_LENGTH + EVP_GCM_TLS_TAG_LEN)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	iov.iov_base = buf + SSL3_RT_HEADER_LENGTH;
+	iov.iov_len = (size_t)(size - SSL3_RT_HEADER_LENGTH - EVP_GCM_TLS_TAG_LEN);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	status = (int) recvmsg((int) ptr->socket, &msg, 0);
+
+	if (status <= 0)
+		return status;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+
+	if (!cmsg || (cmsg->cmsg_level != SOL_TLS) || (cmsg->cmsg_type != TLS_GET_RECORD_TYPE))
+		return status;
+
+	header[0] = *((BYTE*) CMSG_DATA(cmsg));
+	header[1] = TLS1_2_VERSION_MAJOR;
+	header[2] = TLS1_2_VERSION_MINOR;
+	header[3] = (status >> 8) & 0xFF;
+	header[4] = status & 0xFF;
+	return status + SSL3_RT_HEADER_LENGTH;
+}
+#endif
+
 static int transport_bio_simple_write(BIO* bio, const char* buf, int size)
 {
 	int error;
@@ -116,7 +259,19 @@ static int transport_bio_simple_write(BIO* bio, const char* buf, int size)
 		return 0;
 
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
-	status = _send(ptr->socket, buf, size, 0);
+#ifdef WITH_KERNEL_TLS
+
+	if (ptr->ktlsRecordType)
+	{
+		/* like OpenSSL's socket BIO the type only applies until the record is out */
+		status = transport_bio_simple_send_record(ptr, buf, size);
+
+		if (status == size)
+			ptr->ktlsRecordType = 0;
+	}
+	else
+#endif
+		status = _send(ptr->socket, buf, size, 0);
 
 	if (status <= 0)
 	{
@@ -147,7 +302,13 @@ static int transport_bio_simple_read(BIO* bio, char* buf, int size)
 
 	BIO_clear_flags(bio, BIO_FLAGS_READ);
 	WSAResetEvent(ptr->hEvent);
-	status = _recv(ptr->socket, buf, size, 0);
+#ifdef WITH_KERNEL_TLS
+
+	if (ptr->ktlsRecv)
+		status = transport_bio_simple_recv_record(ptr, buf, size);
+	else
+#endif
+		status = _recv(ptr->socket, buf, size, 0);
 
 	if (status > 0)
 	{
@@ -343,6 +504,31 @@ static long transport_bio_simple_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
 		case BIO_CTRL_FLUSH:
 			status = 1;
 			break;
+#ifdef WITH_KERNEL_TLS
+
+		case BIO_CTRL_SET_KTLS:
+			status = transport_bio_simple_set_ktls(ptr, (const struct tls_crypto_info*) arg2,
+			                                       arg1 ? TRUE : FALSE) ? 1 : 0;
+			break;
+
+		case BIO_CTRL_GET_KTLS_SEND:
+			status = ptr->ktlsSend ? 1 : 0;
+			break;
+
+		case BIO_CTRL_GET_KTLS_RECV:
+			status = ptr->ktlsRecv ? 1 : 0;
+			break;
+
+		case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+			ptr->ktlsRecordType = (BYTE) arg1;
+			status = 0;
+			break;
+
+		case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+			ptr->ktlsRecordType = 0;
+			status = 0;
+			break;
+#endif
 
 		default:
 			status = 0;
@@ -356,6 +542,11 @@ static int transport_bio_simple_init(BIO* bio, SOCKET socket, int shutdown)
 {
 	WINPR_BIO_SIMPLE_SOCKET* ptr = (WINPR_BIO_SIMPLE_SOCKET*) BIO_get_data(bio);
 	ptr->socket = socket;
+#ifdef WITH_KERNEL_TLS
+	ptr->ktlsSend = FALSE;
+	ptr->ktlsRecv = FALSE;
+	ptr->ktlsRecordType = 0;
+#endif
 	BIO_set_shutdown(bio, shutdown);
 	BIO_set_flags(bio, BIO_FLAGS_SHOULD_RETRY);
 	BIO_set_init(bio, 1);
@@ -460,6 +651,9 @@ struct _WINPR_BIO_BUFFERED_SOCKET
 	BOOL readBlocked;
 	BOOL writeBlocked;
 	RingBuffer xmitBuffer;
+#ifdef WITH_KERNEL_TLS
+	BOOL ktlsControl;
+#endif
 };
 typedef struct _WINPR_BIO_BUFFERED_SOCKET WINPR_BIO_BUFFERED_SOCKET;
 
@@ -469,6 +663,53 @@ long transport_bio_buffered_callback(BIO* bio, int mode, const char* argp, int a
 	return 1;
 }
 
+static int transport_bio_buffered_write(BIO* bio, const char* buf, int num);
+
+#ifdef WITH_KERNEL_TLS
+/**
+ * Control records bypass the xmit buffer: once the socket took part of one, the rest
+ * has to be sent with the same record type, the kernel would frame it as data otherwise.
+ */
+static int transport_bio_buffered_write_record(BIO* next_bio, const char* buf, int num)
+{
+	int status;
+	int offset = 0;
+
+	while (offset < num)
+	{
+		status = BIO_write(next_bio, buf + offset, num - offset);
+
+		if (status <= 0)
+		{
+			if (!BIO_should_retry(next_bio) || (BIO_wait_write(next_bio, 100) < 0))
+				return -1;
+
+			continue;
+		}
+
+		offset += status;
+	}
+
+	return num;
+}
+
+static BOOL transport_bio_buffered_drain(BIO* bio)
+{
+	WINPR_BIO_BUFFERED_SOCKET* ptr = (WINPR_BIO_BUFFERED_SOCKET*) BIO_get_data(bio);
+
+	while (ringbuffer_used(&ptr->xmitBuffer))
+	{
+		if (transport_bio_buffered_write(bio, NULL, 0) < 0)
+			return FALSE;
+
+		if (ringbuffer_used(&ptr->xmitBuffer) && (BIO_wait_write(BIO_next(bio), 100) < 0))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+#endif
+
 static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 {
 	int i, ret;
@@ -481,10 +722,63 @@ static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 	ret = num;
 	ptr->writeBlocked = FALSE;
 	BIO_clear_flags(bio, BIO_FLAGS_WRITE);
+	next_bio = BIO_next(bio);
+#ifdef WITH_KERNEL_TLS
+
+	if (ptr->ktlsControl && buf && num)
+	{
+		ptr->ktlsControl = FALSE;
+		ret = transport_bio_buffered_write_record(next_bio, buf, num);
+
+		if (ret < 0)
+			BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
 
-	/* we directly append extra bytes in the xmit buffer, this could be prevented
-	 * but for now it makes the code more simple.
+		return ret;
+	}
+
+#endif
+
+	/* when nothing is queued the data goes straight to the socket and only
+	 * what it did not take is copied to the xmit buffer.
 	 */
+	if (buf && num && !ringbuffer_used(&ptr->xmitBuffer))
+	{
+		int offset = 0;
+
+		while (offset < num)
+		{
+			status = BIO_write(next_bio, buf + offset, num - offset);
+
+			if (status <= 0)
+			{
+				if (!BIO_should_retry(next_bio))
+				{
+					BIO_clear_flags(bio, BIO_FLAGS_SHOULD_RETRY);
+					return -1; /* fatal error */
+				}
+
+				if (BIO_should_write(next_bio))
+				{
+					BIO_set_flags(bio, BIO_FLAGS_WRITE);
+					ptr->writeBlocked = TRUE;
+				}
+
+				break;
+			}
+
+			offset += status;
+		}
+
+		if ((offset < num) &&
+		    !ringbuffer_write(&ptr->xmitBuffer, (const BYTE*) buf + offset, num - offset))
+		{
+			WLog_ERR(TAG, "an error occurred when writing (num: %d)", num);
+			return -1;
+		}
+
+		return ret;
+	}
+
 	if (buf && num && !ringbuffer_write(&ptr->xmitBuffer, (const BYTE*) buf, num))
 	{
 		WLog_ERR(TAG, "an error occurred when writing (num: %d)", num);
@@ -493,7 +787,6 @@ static int transport_bio_buffered_write(BIO* bio, const char* buf, int num)
 
 	committedBytes = 0;
 	nchunks = ringbuffer_peek(&ptr->xmitBuffer, chunks, ringbuffer_used(&ptr->xmitBuffer));
-	next_bio = BIO_next(bio);
 
 	for (i = 0; i < nchunks; i++)
 	{
@@ -600,6 +893,26 @@ static long transport_bio_buffered_ctrl(BIO* bio, int cmd, long arg1, void* arg2
 		case BIO_C_WRITE_BLOCKED:
 			status = (int) ptr->writeBlocked;
 			break;
+#ifdef WITH_KERNEL_TLS
+
+		case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+
+			/* queued application data must leave before the control record */
+			if (!transport_bio_buffered_drain(bio))
+			{
+				status = -1;
+				break;
+			}
+
+			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+			ptr->ktlsControl = TRUE;
+			break;
+
+		case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+			ptr->ktlsControl = FALSE;
+			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
+			break;
+#endif
 
 		default:
 			status = BIO_ctrl(BIO_next(bio), cmd, arg1, arg2);
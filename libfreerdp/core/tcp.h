@@ -35,6 +35,7 @@
 #include <winpr/crypto.h>
 
 #include <openssl/bio.h>
+#include <openssl/ssl.h>
 
 #include <freerdp/utils/ringbuffer.h>
 
@@ -60,6 +61,20 @@
 #define BIO_wait_read(b, c)		BIO_ctrl(b, BIO_C_WAIT_READ, c, NULL)
 #define BIO_wait_write(b, c)		BIO_ctrl(b, BIO_C_WAIT_WRITE, c, NULL)
 
+#if defined(__linux__) && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS) && \
+    !defined(LIBRESSL_VERSION_NUMBER) && (OPENSSL_VERSION_NUMBER >= 0x30000000L) && \
+    defined(BIO_get_ktls_send)
+#define WITH_KERNEL_TLS
+
+/**
+ * Controls OpenSSL 3 sends to its BIOs when SSL_OP_ENABLE_KTLS is set. Only the getters are
+ * public, these values are from OpenSSL's include/internal/bio.h.
+ */
+#define BIO_CTRL_SET_KTLS			72
+#define BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG	74
+#define BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG		75
+#endif
+
 FREERDP_LOCAL BIO_METHOD* BIO_s_simple_socket(void);
 FREERDP_LOCAL BIO_METHOD* BIO_s_buffered_socket(void);
 
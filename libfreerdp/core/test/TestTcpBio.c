@@ -0,0 +1,240 @@
+#include <winpr/crt.h>
+#include <winpr/thread.h>
+
+#include "../tcp.h"
+
+#ifdef WITH_KERNEL_TLS
+#include <sys/socket.h>
+#include <linux/tls.h>
+
+#define TEST_DATA_CHUNK 4096
+#define TEST_RECORD_SIZE (256 * 1024)
+#define TEST_TAIL_SIZE 1000
+
+struct test_reader
+{
+	int fd;
+	BYTE* data;
+	size_t size;
+	size_t capacity;
+};
+
+static DWORD WINAPI test_reader_proc(LPVOID arg)
+{
+	struct test_reader* reader = (struct test_reader*) arg;
+
+	while (1)
+	{
+		ssize_t status;
+
+		if (reader->size == reader->capacity)
+		{
+			const size_t capacity = reader->capacity ? reader->capacity * 2 : 0x10000;
+			BYTE* tmp = (BYTE*) realloc(reader->data, capacity);
+
+			if (!tmp)
+				return 1;
+
+			reader->data = tmp;
+			reader->capacity = capacity;
+		}
+
+		status = recv(reader->fd, reader->data + reader->size, reader->capacity - reader->size, 0);
+
+		if (status <= 0)
+			return (status == 0) ? 0 : 1;
+
+		reader->size += (size_t) status;
+	}
+}
+
+static BOOL test_expect(const struct test_reader* reader, size_t* offset, BYTE value, size_t count)
+{
+	size_t x;
+
+	if (reader->size - *offset < count)
+		return FALSE;
+
+	for (x = 0; x < count; x++)
+	{
+		if (reader->data[*offset + x] != value)
+		{
+			fprintf(stderr, "unexpected byte at %" PRIuz "\n", *offset + x);
+			return FALSE;
+		}
+	}
+
+	*offset += count;
+	return TRUE;
+}
+
+static BOOL test_flush(BIO* bio)
+{
+	while (BIO_wpending(bio) > 0)
+	{
+		if (BIO_flush(bio) < 0)
+			return FALSE;
+
+		if ((BIO_wpending(bio) > 0) && (BIO_wait_write(BIO_next(bio), 100) < 0))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_ktls_setup(BIO* bio)
+{
+	struct tls_crypto_info info = { 0 };
+
+	if (BIO_get_ktls_send(bio) || BIO_get_ktls_recv(bio))
+		return FALSE;
+
+	/* no kernel support for the cipher, OpenSSL keeps encrypting itself */
+	info.version = TLS_1_2_VERSION;
+	info.cipher_type = 0xFFFF;
+
+	if (BIO_ctrl(bio, BIO_CTRL_SET_KTLS, 1, &info) != 0)
+		return FALSE;
+
+	return !BIO_get_ktls_send(bio);
+}
+
+/**
+ * A control record written while application data is queued must follow that data and go
+ * out as a whole, even when the socket only takes part of it.
+ */
+static BOOL test_ktls_control_record(BIO* bio, int fd)
+{
+	BOOL rc = FALSE;
+	size_t offset = 0;
+	size_t queued = 0;
+	HANDLE thread = NULL;
+	BYTE* buffer = NULL;
+	struct test_reader reader = { 0 };
+	reader.fd = fd;
+
+	if (!(buffer = (BYTE*) malloc(TEST_RECORD_SIZE)))
+		goto fail;
+
+	memset(buffer, 'A', TEST_DATA_CHUNK);
+
+	while (!BIO_write_blocked(bio))
+	{
+		if (BIO_write(bio, buffer, TEST_DATA_CHUNK) != TEST_DATA_CHUNK)
+			goto fail;
+
+		queued += TEST_DATA_CHUNK;
+	}
+
+	if (BIO_wpending(bio) <= 0)
+		goto fail;
+
+	if (!(thread = CreateThread(NULL, 0, test_reader_proc, &reader, 0, NULL)))
+		goto fail;
+
+	if (BIO_ctrl(bio, BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG, SSL3_RT_ALERT, NULL) < 0)
+		goto fail;
+
+	if (BIO_wpending(bio) != 0)
+	{
+		fprintf(stderr, "application data still queued before the control record\n");
+		goto fail;
+	}
+
+	memset(buffer, 'C', TEST_RECORD_SIZE);
+
+	if (BIO_write(bio, buffer, TEST_RECORD_SIZE) != TEST_RECORD_SIZE)
+		goto fail;
+
+	if (BIO_wpending(bio) != 0)
+	{
+		fprintf(stderr, "control record got queued\n");
+		goto fail;
+	}
+
+	memset(buffer, 'D', TEST_TAIL_SIZE);
+
+	if ((BIO_write(bio, buffer, TEST_TAIL_SIZE) != TEST_TAIL_SIZE) || !test_flush(bio))
+		goto fail;
+
+	shutdown(BIO_get_fd(bio, NULL), SHUT_WR);
+
+	if (WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0)
+		goto fail;
+
+	if (!test_expect(&reader, &offset, 'A', queued) ||
+	    !test_expect(&reader, &offset, 'C', TEST_RECORD_SIZE) ||
+	    !test_expect(&reader, &offset, 'D', TEST_TAIL_SIZE) || (offset != reader.size))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (thread)
+	{
+		shutdown(BIO_get_fd(bio, NULL), SHUT_WR);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	free(reader.data);
+	free(buffer);
+	return rc;
+}
+#endif
+
+int TestTcpBio(int argc, char* argv[])
+{
+#ifdef WITH_KERNEL_TLS
+	int rc = -1;
+	int sv[2];
+	int sndbuf = 4096;
+	BIO* socketBio = NULL;
+	BIO* bufferedBio = NULL;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		return -1;
+
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	if (!(socketBio = BIO_new(BIO_s_simple_socket())))
+		goto fail;
+
+	BIO_set_fd(socketBio, sv[0], BIO_CLOSE);
+	sv[0] = -1;
+	BIO_set_nonblock(socketBio, TRUE);
+
+	if (!(bufferedBio = BIO_new(BIO_s_buffered_socket())))
+		goto fail;
+
+	bufferedBio = BIO_push(bufferedBio, socketBio);
+	socketBio = NULL;
+
+	if (!test_ktls_setup(bufferedBio))
+	{
+		fprintf(stderr, "kernel TLS setup controls failed\n");
+		goto fail;
+	}
+
+	if (!test_ktls_control_record(bufferedBio, sv[1]))
+		goto fail;
+
+	rc = 0;
+fail:
+	BIO_free_all(bufferedBio);
+	BIO_free_all(socketBio);
+
+	if (sv[0] >= 0)
+		close(sv[0]);
+
+	close(sv[1]);
+	return rc;
+#else
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	printf("kernel TLS not available, skipping\n");
+	return 0;
+#endif
+}
@@ -0,0 +1,385 @@
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <openssl/bio.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../transport.h"
+
+#define TEST_THRESHOLD 1000
+#define TEST_TIMEOUT 10
+
+/* what reached the BIO, one entry per BIO_write */
+static wStream* testWritten = NULL;
+static size_t testWrites = 0;
+static BOOL testWriteFails = FALSE;
+
+static int test_bio_write(BIO* bio, const char* buf, int size)
+{
+	BIO_clear_flags(bio, BIO_FLAGS_WRITE | BIO_FLAGS_SHOULD_RETRY);
+
+	if (testWriteFails)
+		return -1;
+
+	if (!Stream_EnsureRemainingCapacity(testWritten, (size_t) size))
+		return -1;
+
+	Stream_Write(testWritten, buf, (size_t) size);
+	testWrites++;
+	return size;
+}
+
+static int test_bio_read(BIO* bio, char* buf, int size)
+{
+	WINPR_UNUSED(buf);
+	WINPR_UNUSED(size);
+	/* nothing to read yet */
+	BIO_clear_flags(bio, BIO_FLAGS_READ);
+	BIO_set_flags(bio, BIO_FLAGS_READ | BIO_FLAGS_SHOULD_RETRY);
+	return -1;
+}
+
+static long test_bio_ctrl(BIO* bio, int cmd, long arg1, void* arg2)
+{
+	WINPR_UNUSED(bio);
+	WINPR_UNUSED(arg1);
+	WINPR_UNUSED(arg2);
+	return (cmd == BIO_CTRL_FLUSH) ? 1 : 0;
+}
+
+static int test_bio_new(BIO* bio)
+{
+	BIO_set_init(bio, 1);
+	return 1;
+}
+
+static int test_bio_free(BIO* bio)
+{
+	WINPR_UNUSED(bio);
+	return 1;
+}
+
+static BIO_METHOD* test_bio_method(void)
+{
+	static BIO_METHOD* bio_methods = NULL;
+
+	if (bio_methods == NULL)
+	{
+		if (!(bio_methods = BIO_meth_new(BIO_TYPE_SOURCE_SINK, "TestTransportBatch")))
+			return NULL;
+
+		BIO_meth_set_write(bio_methods, test_bio_write);
+		BIO_meth_set_read(bio_methods, test_bio_read);
+		BIO_meth_set_ctrl(bio_methods, test_bio_ctrl);
+		BIO_meth_set_create(bio_methods, test_bio_new);
+		BIO_meth_set_destroy(bio_methods, test_bio_free);
+	}
+
+	return bio_methods;
+}
+
+/* a PDU of length bytes, all set to value */
+static int test_write(rdpTransport* transport, BYTE value, size_t length)
+{
+	int status;
+	wStream* s = Stream_New(NULL, length);
+
+	if (!s)
+		return -1;
+
+	memset(Stream_Buffer(s), value, length);
+	Stream_Seek(s, length);
+	status = transport_write(transport, s);
+	Stream_Free(s, TRUE);
+	return status;
+}
+
+/* the BIO has to have seen writes BIO_writes with these PDUs, in order */
+static BOOL test_expect(size_t writes, const BYTE* values, const size_t* lengths, size_t count)
+{
+	size_t x;
+	size_t offset = 0;
+	const BYTE* data = Stream_Buffer(testWritten);
+
+	if (testWrites != writes)
+	{
+		fprintf(stderr, "expected %"PRIuz" BIO writes, got %"PRIuz"\n", writes, testWrites);
+		return FALSE;
+	}
+
+	for (x = 0; x < count; x++)
+	{
+		size_t y;
+
+		for (y = 0; y < lengths[x]; y++)
+		{
+			if ((offset >= Stream_GetPosition(testWritten)) || (data[offset++] != values[x]))
+			{
+				fprintf(stderr, "PDU %"PRIuz" was not written as expected\n", x);
+				return FALSE;
+			}
+		}
+	}
+
+	if (offset != Stream_GetPosition(testWritten))
+	{
+		fprintf(stderr, "%"PRIuz" bytes were written, expected %"PRIuz"\n",
+		        Stream_GetPosition(testWritten), offset);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static rdpTransport* test_transport_new(rdpContext* context)
+{
+	rdpTransport* transport;
+	BIO_METHOD* method = test_bio_method();
+	testWrites = 0;
+	testWriteFails = FALSE;
+	Stream_SetPosition(testWritten, 0);
+
+	if (!method || !(context->settings = freerdp_settings_new(0)))
+		return NULL;
+
+	context->settings->TransportBatchThreshold = TEST_THRESHOLD;
+	context->settings->TransportBatchTimeout = TEST_TIMEOUT;
+
+	if (!(transport = transport_new(context)))
+		return NULL;
+
+	transport->blocking = FALSE;
+
+	if (!(transport->frontBio = BIO_new(method)))
+	{
+		transport_free(transport);
+		return NULL;
+	}
+
+	return transport;
+}
+
+static void test_transport_free(rdpContext* context, rdpTransport* transport)
+{
+	transport_free(transport);
+	freerdp_settings_free(context->settings);
+	context->settings = NULL;
+}
+
+/* only the outermost batch writes */
+static BOOL test_batch_nested(void)
+{
+	BOOL rc = FALSE;
+	rdpContext context = { 0 };
+	rdpTransport* transport = test_transport_new(&context);
+	const BYTE values[] = { 1, 2, 3 };
+	const size_t lengths[] = { 100, 200, 300 };
+
+	if (!transport)
+		goto fail;
+
+	transport_begin_batch(transport);
+	transport_begin_batch(transport);
+
+	if (test_write(transport, values[0], lengths[0]) != (int) lengths[0])
+		goto fail;
+
+	if ((transport_end_batch(transport) != 0) || !test_expect(0, NULL, NULL, 0))
+		goto fail;
+
+	if (test_write(transport, values[1], lengths[1]) != (int) lengths[1])
+		goto fail;
+
+	if ((transport_end_batch(transport) != (int)(lengths[0] + lengths[1])) ||
+	    !test_expect(1, values, lengths, 2))
+		goto fail;
+
+	/* without a batch PDUs go out directly, an unbalanced end does not change that */
+	if ((transport_end_batch(transport) != 0) ||
+	    (test_write(transport, values[2], lengths[2]) != (int) lengths[2]) ||
+	    !test_expect(2, values, lengths, 3))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_transport_free(&context, transport);
+	return rc;
+}
+
+/* a full batch is written right away, larger PDUs are not copied but keep their order */
+static BOOL test_batch_threshold(void)
+{
+	BOOL rc = FALSE;
+	rdpContext context = { 0 };
+	rdpTransport* transport = test_transport_new(&context);
+	const BYTE values[] = { 1, 2, 3, 4, 5 };
+	const size_t lengths[] = { 400, 400, 400, 300, TEST_THRESHOLD * 2 };
+
+	if (!transport)
+		goto fail;
+
+	transport_begin_batch(transport);
+
+	if ((test_write(transport, values[0], lengths[0]) != (int) lengths[0]) ||
+	    (test_write(transport, values[1], lengths[1]) != (int) lengths[1]) ||
+	    !test_expect(0, NULL, NULL, 0))
+		goto fail;
+
+	if ((test_write(transport, values[2], lengths[2]) != (int) lengths[2]) ||
+	    !test_expect(1, values, lengths, 3))
+		goto fail;
+
+	if ((test_write(transport, values[3], lengths[3]) != (int) lengths[3]) ||
+	    (test_write(transport, values[4], lengths[4]) != (int) lengths[4]) ||
+	    !test_expect(3, values, lengths, 5))
+		goto fail;
+
+	if ((transport_end_batch(transport) != 0) || !test_expect(3, values, lengths, 5))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_transport_free(&context, transport);
+	return rc;
+}
+
+/**
+ * The timeout is not a timer of its own, it is checked by the next write and by
+ * transport_check_fds.
+ */
+static BOOL test_batch_timeout(void)
+{
+	BOOL rc = FALSE;
+	rdpContext context = { 0 };
+	rdpTransport* transport = test_transport_new(&context);
+	const BYTE values[] = { 1, 2, 3 };
+	const size_t lengths[] = { 100, 100, 100 };
+
+	if (!transport)
+		goto fail;
+
+	transport_begin_batch(transport);
+
+	if ((test_write(transport, values[0], lengths[0]) != (int) lengths[0]) ||
+	    !test_expect(0, NULL, NULL, 0))
+		goto fail;
+
+	Sleep(TEST_TIMEOUT * 2);
+
+	if ((test_write(transport, values[1], lengths[1]) != (int) lengths[1]) ||
+	    !test_expect(1, values, lengths, 2))
+		goto fail;
+
+	if ((test_write(transport, values[2], lengths[2]) != (int) lengths[2]) ||
+	    (transport_check_fds(transport) < 0) || !test_expect(1, values, lengths, 2))
+		goto fail;
+
+	Sleep(TEST_TIMEOUT * 2);
+
+	if ((transport_check_fds(transport) < 0) || !test_expect(2, values, lengths, 3))
+		goto fail;
+
+	if ((transport_end_batch(transport) != 0) || !test_expect(2, values, lengths, 3))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_transport_free(&context, transport);
+	return rc;
+}
+
+/* a failed write drops what is queued and closes the transport, the batch can still be ended */
+static BOOL test_batch_write_failure(void)
+{
+	BOOL rc = FALSE;
+	rdpContext context = { 0 };
+	rdpTransport* transport = test_transport_new(&context);
+	const BYTE values[] = { 1, 2, 3 };
+	const size_t lengths[] = { 400, 700, 100 };
+
+	if (!transport)
+		goto fail;
+
+	transport_begin_batch(transport);
+	testWriteFails = TRUE;
+
+	/* queued, nothing is written yet */
+	if (test_write(transport, values[0], lengths[0]) != (int) lengths[0])
+		goto fail;
+
+	/* fills the batch, the flush fails */
+	if (test_write(transport, values[1], lengths[1]) >= 0)
+		goto fail;
+
+	if ((transport->layer != TRANSPORT_LAYER_CLOSED) || (transport_end_batch(transport) != 0))
+		goto fail;
+
+	/* the failed PDUs are gone, later ones go out directly */
+	testWriteFails = FALSE;
+
+	if ((test_write(transport, values[2], lengths[2]) != (int) lengths[2]) ||
+	    !test_expect(1, &values[2], &lengths[2], 1))
+		goto fail;
+
+	/* the same when the end of the batch writes */
+	transport_begin_batch(transport);
+
+	if (test_write(transport, values[0], lengths[0]) != (int) lengths[0])
+		goto fail;
+
+	testWriteFails = TRUE;
+
+	if (transport_end_batch(transport) >= 0)
+		goto fail;
+
+	testWriteFails = FALSE;
+
+	if ((transport_end_batch(transport) != 0) || (transport_flush_batch(transport) != 0) ||
+	    !test_expect(1, &values[2], &lengths[2], 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_transport_free(&context, transport);
+	return rc;
+}
+
+int TestTransportBatch(int argc, char* argv[])
+{
+	int rc = -1;
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!(testWritten = Stream_New(NULL, 4096)))
+		return -1;
+
+	if (!test_batch_nested())
+	{
+		fprintf(stderr, "nested batches failed\n");
+		goto fail;
+	}
+
+	if (!test_batch_threshold())
+	{
+		fprintf(stderr, "batch threshold failed\n");
+		goto fail;
+	}
+
+	if (!test_batch_timeout())
+	{
+		fprintf(stderr, "batch timeout failed\n");
+		goto fail;
+	}
+
+	if (!test_batch_write_failure())
+	{
+		fprintf(stderr, "batch write failure failed\n");
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	Stream_Free(testWritten, TRUE);
+	return rc;
+}
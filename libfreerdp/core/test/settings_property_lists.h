@@ -65,6 +65,7 @@ static const size_t bool_list_indices[] =
 	FreeRDP_DisableCredentialsDelegation,
 	FreeRDP_VmConnectMode,
 	FreeRDP_FIPSMode,
+	FreeRDP_TlsKernelOffload,
 	FreeRDP_MstscCookieMode,
 	FreeRDP_SendPreconnectionPdu,
 	FreeRDP_SmartcardLogon,
@@ -182,6 +183,8 @@ static const size_t uint32_list_indices[] =
 	FreeRDP_ServerPort,
 	FreeRDP_MaxTimeInCheckLoop,
 	FreeRDP_AcceptedCertLength,
+	FreeRDP_TransportBatchThreshold,
+	FreeRDP_TransportBatchTimeout,
 	FreeRDP_RdpVersion,
 	FreeRDP_DesktopWidth,
 	FreeRDP_DesktopHeight,
@@ -268,12 +271,14 @@ static const size_t uint32_list_indices[] =
 	FreeRDP_RemoteFxCodecId,
 	FreeRDP_RemoteFxCodecMode,
 	FreeRDP_RemoteFxCaptureFlags,
+	FreeRDP_RemoteFxPipelineDepth,
 	FreeRDP_NSCodecId,
 	FreeRDP_FrameAcknowledge,
 	FreeRDP_NSCodecColorLossLevel,
 	FreeRDP_JpegCodecId,
 	FreeRDP_JpegQuality,
 	FreeRDP_GfxCapsFilter,
+	FreeRDP_GfxCompressionLevel,
 	FreeRDP_BitmapCacheV3CodecId,
 	FreeRDP_DrawNineGridCacheSize,
 	FreeRDP_DrawNineGridCacheEntries,
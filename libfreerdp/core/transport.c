@@ -786,38 +786,22 @@ int transport_read_pdu(rdpTransport* transport, wStream* s)
 	return Stream_Length(s);
 }
 
-int transport_write(rdpTransport* transport, wStream* s)
+/**
+ * Writes length bytes to the front BIO, the caller holds the WriteLock.
+ */
+static int transport_write_bytes(rdpTransport* transport, const BYTE* data, size_t length)
 {
-	size_t length;
 	int status = -1;
-	int writtenlength = 0;
-
-	if (!s)
-		return -1;
-
-	if (!transport)
-		goto fail;
-
-	if (!transport->frontBio)
-	{
-		transport->layer = TRANSPORT_LAYER_CLOSED;
-		goto fail;
-	}
-
-	EnterCriticalSection(&(transport->WriteLock));
-	length = Stream_GetPosition(s);
-	writtenlength = length;
-	Stream_SetPosition(s, 0);
 
 	if (length > 0)
 	{
-		WLog_Packet(transport->log, WLOG_TRACE, Stream_Buffer(s), length,
+		WLog_Packet(transport->log, WLOG_TRACE, data, length,
 		            WLOG_PACKET_OUTBOUND);
 	}
 
 	while (length > 0)
 	{
-		status = BIO_write(transport->frontBio, Stream_Pointer(s), length);
+		status = BIO_write(transport->frontBio, data, length);
 
 		if (status <= 0)
 		{
@@ -869,10 +853,9 @@ int transport_write(rdpTransport* transport, wStream* s)
 		}
 
 		length -= status;
-		Stream_Seek(s, status);
+		data += status;
 	}
 
-	transport->written += writtenlength;
 out_cleanup:
 
 	if (status < 0)
@@ -881,12 +864,168 @@ out_cleanup:
 		transport->layer = TRANSPORT_LAYER_CLOSED;
 	}
 
+	return status;
+}
+
+/**
+ * Writes the batched PDUs with a single BIO_write, the caller holds the WriteLock.
+ */
+static int transport_flush_batch_locked(rdpTransport* transport)
+{
+	int status;
+	size_t length;
+
+	if (!transport->batch || (Stream_GetPosition(transport->batch) == 0))
+		return 0;
+
+	length = Stream_GetPosition(transport->batch);
+	Stream_SetPosition(transport->batch, 0);
+
+	if (!transport->frontBio)
+	{
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		return -1;
+	}
+
+	status = transport_write_bytes(transport, Stream_Buffer(transport->batch), length);
+	return (status < 0) ? status : (int) length;
+}
+
+/* polled by writes and transport_check_fds, nothing flushes a quiet transport on its own */
+static BOOL transport_batch_expired(rdpTransport* transport)
+{
+	const UINT32 timeout = transport->settings->TransportBatchTimeout;
+	return (GetTickCount() - transport->batchStart) >= timeout;
+}
+
+/**
+ * Queues s behind the batched PDUs, the caller holds the WriteLock.
+ * Returns FALSE if s has to be written directly.
+ */
+static BOOL transport_batch_write(rdpTransport* transport, wStream* s, int* status)
+{
+	const size_t length = Stream_GetPosition(s);
+	const UINT32 threshold = transport->settings->TransportBatchThreshold;
+
+	if ((transport->batchDepth == 0) || (threshold == 0))
+		return FALSE;
+
+	/* larger PDUs would only be copied around */
+	if (length >= threshold)
+	{
+		*status = transport_flush_batch_locked(transport);
+		return (*status < 0);
+	}
+
+	if (!transport->batch && !(transport->batch = Stream_New(NULL, threshold * 2)))
+		return FALSE;
+
+	if (Stream_GetPosition(transport->batch) == 0)
+		transport->batchStart = GetTickCount();
+
+	if (!Stream_EnsureRemainingCapacity(transport->batch, length))
+		return FALSE;
+
+	Stream_Write(transport->batch, Stream_Buffer(s), length);
+	*status = (int) length;
+
+	if ((Stream_GetPosition(transport->batch) >= threshold) || transport_batch_expired(transport))
+	{
+		const int rc = transport_flush_batch_locked(transport);
+
+		if (rc < 0)
+			*status = rc;
+	}
+
+	return TRUE;
+}
+
+int transport_write(rdpTransport* transport, wStream* s)
+{
+	size_t length;
+	int status = -1;
+	int writtenlength = 0;
+
+	if (!s)
+		return -1;
+
+	if (!transport)
+		goto fail;
+
+	if (!transport->frontBio)
+	{
+		transport->layer = TRANSPORT_LAYER_CLOSED;
+		goto fail;
+	}
+
+	EnterCriticalSection(&(transport->WriteLock));
+	length = Stream_GetPosition(s);
+	writtenlength = length;
+
+	if (!transport_batch_write(transport, s, &status))
+	{
+		/* keep the order of the PDUs */
+		status = transport_flush_batch_locked(transport);
+
+		if (status >= 0)
+		{
+			Stream_SetPosition(s, 0);
+			status = transport_write_bytes(transport, Stream_Buffer(s), length);
+			Stream_Seek(s, length);
+		}
+	}
+
+	if (status >= 0)
+		transport->written += writtenlength;
+
 	LeaveCriticalSection(&(transport->WriteLock));
 fail:
 	Stream_Release(s);
 	return status;
 }
 
+void transport_begin_batch(rdpTransport* transport)
+{
+	if (!transport)
+		return;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	transport->batchDepth++;
+	LeaveCriticalSection(&(transport->WriteLock));
+}
+
+int transport_end_batch(rdpTransport* transport)
+{
+	int status = 0;
+
+	if (!transport)
+		return -1;
+
+	EnterCriticalSection(&(transport->WriteLock));
+
+	if (transport->batchDepth > 0)
+		transport->batchDepth--;
+
+	if (transport->batchDepth == 0)
+		status = transport_flush_batch_locked(transport);
+
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status;
+}
+
+int transport_flush_batch(rdpTransport* transport)
+{
+	int status;
+
+	if (!transport)
+		return -1;
+
+	EnterCriticalSection(&(transport->WriteLock));
+	status = transport_flush_batch_locked(transport);
+	LeaveCriticalSection(&(transport->WriteLock));
+	return status;
+}
+
 DWORD transport_get_event_handles(rdpTransport* transport, HANDLE* events,
                                   DWORD count)
 {
@@ -999,6 +1138,21 @@ int transport_check_fds(rdpTransport* transport)
 
 	dueDate = now + transport->settings->MaxTimeInCheckLoop;
 
+	/* a batch that was left open must not delay its PDUs for too long */
+	if (transport->batch && (Stream_GetPosition(transport->batch) > 0))
+	{
+		EnterCriticalSection(&(transport->WriteLock));
+
+		if ((Stream_GetPosition(transport->batch) > 0) && transport_batch_expired(transport) &&
+		    (transport_flush_batch_locked(transport) < 0))
+		{
+			LeaveCriticalSection(&(transport->WriteLock));
+			return -1;
+		}
+
+		LeaveCriticalSection(&(transport->WriteLock));
+	}
+
 	if (transport->haveMoreBytesToRead)
 	{
 		transport->haveMoreBytesToRead = FALSE;
@@ -1120,6 +1274,11 @@ BOOL transport_disconnect(rdpTransport* transport)
 
 	transport->frontBio = NULL;
 	transport->layer = TRANSPORT_LAYER_TCP;
+
+	/* whatever is still batched can not be sent anymore */
+	if (transport->batch)
+		Stream_SetPosition(transport->batch, 0);
+
 	return status;
 }
 
@@ -1198,6 +1357,7 @@ void transport_free(rdpTransport* transport)
 		Stream_Release(transport->ReceiveBuffer);
 
 	StreamPool_Free(transport->ReceivePool);
+	Stream_Free(transport->batch, TRUE);
 	CloseHandle(transport->connectedEvent);
 	CloseHandle(transport->rereadEvent);
 	DeleteCriticalSection(&(transport->ReadLock));
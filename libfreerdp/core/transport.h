@@ -79,6 +79,11 @@ struct rdp_transport
 	HANDLE rereadEvent;
 	BOOL haveMoreBytesToRead;
 	wLog* log;
+
+	/* PDUs written between transport_begin_batch and transport_end_batch, guarded by WriteLock */
+	wStream* batch;
+	UINT32 batchDepth;
+	DWORD batchStart;
 };
 
 FREERDP_LOCAL wStream* transport_send_stream_init(rdpTransport* transport,
@@ -97,6 +102,17 @@ FREERDP_LOCAL BOOL transport_accept_nla(rdpTransport* transport);
 FREERDP_LOCAL int transport_read_pdu(rdpTransport* transport, wStream* s);
 FREERDP_LOCAL int transport_write(rdpTransport* transport, wStream* s);
 
+/**
+ * Between these calls transport_write only queues the PDUs. They are written with a single
+ * BIO_write (one TLS record per 16k) when the outermost batch ends, once
+ * TransportBatchThreshold bytes are queued or the oldest one waited TransportBatchTimeout ms.
+ * There is no timer for the latter, it is only checked by the next transport_write and by
+ * transport_check_fds. A batch that stays open without either holds its PDUs until it ends.
+ */
+FREERDP_LOCAL void transport_begin_batch(rdpTransport* transport);
+FREERDP_LOCAL int transport_end_batch(rdpTransport* transport);
+FREERDP_LOCAL int transport_flush_batch(rdpTransport* transport);
+
 FREERDP_LOCAL void transport_get_fds(rdpTransport* transport, void** rfds,
                                      int* rcount);
 FREERDP_LOCAL int transport_check_fds(rdpTransport* transport);
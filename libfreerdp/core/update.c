@@ -787,6 +787,8 @@ static BOOL _update_begin_paint(rdpContext* context)
 	update->combineUpdates = TRUE;
 	update->numberOrders = 0;
 	update->us = s;
+	/* everything sent until EndPaint goes out together */
+	transport_begin_batch(context->rdp->transport);
 	return TRUE;
 }
 
@@ -816,7 +818,7 @@ static BOOL _update_end_paint(rdpContext* context)
 	update->numberOrders = 0;
 	update->us = NULL;
 	Stream_Free(s, TRUE);
-	return TRUE;
+	return transport_end_batch(context->rdp->transport) >= 0;
 }
 
 static void update_flush(rdpContext* context)
@@ -1093,6 +1095,27 @@ out_fail:
 	return ret;
 }
 
+/**
+ * The PDUs of a surface frame are written together when it ends.
+ */
+static void update_begin_frame_batch(rdpRdp* rdp)
+{
+	if (rdp->frameBatch)
+		return;
+
+	transport_begin_batch(rdp->transport);
+	rdp->frameBatch = TRUE;
+}
+
+static BOOL update_end_frame_batch(rdpRdp* rdp)
+{
+	if (!rdp->frameBatch)
+		return TRUE;
+
+	rdp->frameBatch = FALSE;
+	return transport_end_batch(rdp->transport) >= 0;
+}
+
 static BOOL update_send_surface_frame_marker(rdpContext* context,
         const SURFACE_FRAME_MARKER* surfaceFrameMarker)
 {
@@ -1105,6 +1128,9 @@ static BOOL update_send_surface_frame_marker(rdpContext* context,
 	if (!s)
 		return FALSE;
 
+	if (surfaceFrameMarker->frameAction == SURFACECMD_FRAMEACTION_BEGIN)
+		update_begin_frame_batch(rdp);
+
 	if (!update_write_surfcmd_frame_marker(s, surfaceFrameMarker->frameAction,
 	                                       surfaceFrameMarker->frameId) ||
 	    !fastpath_send_update_pdu(rdp->fastpath, FASTPATH_UPDATETYPE_SURFCMDS, s,
@@ -1114,6 +1140,11 @@ static BOOL update_send_surface_frame_marker(rdpContext* context,
 	update_force_flush(context);
 	ret = TRUE;
 out_fail:
+
+	/* a failed frame is not continued, do not hold back whatever else gets sent */
+	if (!ret || (surfaceFrameMarker->frameAction == SURFACECMD_FRAMEACTION_END))
+		ret = update_end_frame_batch(rdp) && ret;
+
 	Stream_Release(s);
 	return ret;
 }
@@ -1133,6 +1164,8 @@ static BOOL update_send_surface_frame_bits(rdpContext* context,
 
 	if (first)
 	{
+		update_begin_frame_batch(rdp);
+
 		if (!update_write_surfcmd_frame_marker(s, SURFACECMD_FRAMEACTION_BEGIN,
 		                                       frameId))
 			goto out_fail;
@@ -1151,6 +1184,10 @@ static BOOL update_send_surface_frame_bits(rdpContext* context,
 	                               cmd->skipCompression);
 	update_force_flush(context);
 out_fail:
+
+	if (!ret || last)
+		ret = update_end_frame_batch(rdp) && ret;
+
 	Stream_Release(s);
 	return ret;
 }
@@ -2194,7 +2231,7 @@ rdpUpdate* update_new(rdpRdp* rdp)
 	update->SuppressOutput = update_send_suppress_output;
 	update->initialState = TRUE;
 	update->autoCalculateBitmapData = TRUE;
-	update->queue = MessageQueue_New(&cb);
+	update->queue = MessageQueue_NewEx(&cb, WMQ_FLAG_LOCKFREE);
 
 	if (!update->queue)
 		goto fail;
@@ -663,7 +663,19 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method,
 	SSL_CTX_set_mode(tls->ctx,
 	                 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_ENABLE_PARTIAL_WRITE);
 	SSL_CTX_set_options(tls->ctx, options);
-	SSL_CTX_set_read_ahead(tls->ctx, 1);
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+
+	/**
+	 * Hand the session keys to the kernel after the handshake.
+	 * The receive side is only offloaded when OpenSSL holds no records
+	 * read ahead of the handshake, so read ahead stays off.
+	 */
+	if (settings->TlsKernelOffload)
+		SSL_CTX_set_options(tls->ctx, SSL_OP_ENABLE_KTLS);
+	else
+#endif
+		SSL_CTX_set_read_ahead(tls->ctx, 1);
+
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	SSL_CTX_set_min_proto_version(tls->ctx, TLS1_VERSION); /* min version */
 	SSL_CTX_set_max_proto_version(tls->ctx, 0); /* highest supported version by library */
@@ -694,6 +706,21 @@ static BOOL tls_prepare(rdpTls* tls, BIO* underlying, SSL_METHOD* method,
 	return TRUE;
 }
 
+static void tls_update_kernel_offload(rdpTls* tls)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+
+	if (!tls->settings->TlsKernelOffload)
+		return;
+
+	tls->kernelSend = BIO_get_ktls_send(SSL_get_wbio(tls->ssl)) ? TRUE : FALSE;
+	tls->kernelRecv = BIO_get_ktls_recv(SSL_get_rbio(tls->ssl)) ? TRUE : FALSE;
+	WLog_DBG(TAG, "kernel TLS offload: send %s, receive %s (%s, %s)",
+	         tls->kernelSend ? "on" : "off", tls->kernelRecv ? "on" : "off",
+	         SSL_get_version(tls->ssl), SSL_get_cipher_name(tls->ssl));
+#endif
+}
+
 static int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 {
 	CryptoCert cert;
@@ -783,6 +810,7 @@ static int tls_do_handshake(rdpTls* tls, BOOL clientMode)
 	}
 	while (TRUE);
 
+	tls_update_kernel_offload(tls);
 	cert = tls_get_certificate(tls, clientMode);
 
 	if (!cert)
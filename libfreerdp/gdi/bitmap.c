@@ -39,6 +39,7 @@
 
 #include "brush.h"
 #include "clipping.h"
+#include "rop3.h"
 #include "../gdi/gdi.h"
 
 #define TAG FREERDP_TAG("gdi.bitmap")
@@ -166,180 +167,6 @@ HGDI_BITMAP gdi_CreateCompatibleBitmap(HGDI_DC hdc, UINT32 nWidth,
 	return hBitmap;
 }
 
-static BOOL op_not(UINT32* stack, UINT32* stackp)
-{
-	if (!stack || !stackp)
-		return FALSE;
-
-	if (*stackp < 1)
-		return FALSE;
-
-	stack[(*stackp) - 1] = ~stack[(*stackp) - 1];
-	return TRUE;
-}
-
-static BOOL op_and(UINT32* stack, UINT32* stackp)
-{
-	if (!stack || !stackp)
-		return FALSE;
-
-	if (*stackp < 2)
-		return FALSE;
-
-	(*stackp)--;
-	stack[(*stackp) - 1] &= stack[(*stackp)];
-	return TRUE;
-}
-
-static BOOL op_or(UINT32* stack, UINT32* stackp)
-{
-	if (!stack || !stackp)
-		return FALSE;
-
-	if (*stackp < 2)
-		return FALSE;
-
-	(*stackp)--;
-	stack[(*stackp) - 1] |= stack[(*stackp)];
-	return TRUE;
-}
-
-static BOOL op_xor(UINT32* stack, UINT32* stackp)
-{
-	if (!stack || !stackp)
-		return FALSE;
-
-	if (*stackp < 2)
-		return FALSE;
-
-	(*stackp)--;
-	stack[(*stackp) - 1] ^= stack[(*stackp)];
-	return TRUE;
-}
-
-static UINT32 process_rop(UINT32 src, UINT32 dst, UINT32 pat, const char* rop,
-                          UINT32 format)
-{
-	DWORD stack[10] = { 0 };
-	DWORD stackp = 0;
-
-	while (*rop != '\0')
-	{
-		char op = *rop++;
-
-		switch (op)
-		{
-			case '0':
-				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
-				break;
-
-			case '1':
-				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
-				break;
-
-			case 'D':
-				stack[stackp++] = dst;
-				break;
-
-			case 'S':
-				stack[stackp++] = src;
-				break;
-
-			case 'P':
-				stack[stackp++] = pat;
-				break;
-
-			case 'x':
-				op_xor(stack, &stackp);
-				break;
-
-			case 'a':
-				op_and(stack, &stackp);
-				break;
-
-			case 'o':
-				op_or(stack, &stackp);
-				break;
-
-			case 'n':
-				op_not(stack, &stackp);
-				break;
-
-			default:
-				break;
-		}
-	}
-
-	return stack[0];
-}
-
-static INLINE BOOL BitBlt_write(HGDI_DC hdcDest, HGDI_DC hdcSrc, INT32 nXDest,
-                                INT32 nYDest, INT32 nXSrc, INT32 nYSrc, INT32 x, INT32 y,
-                                BOOL useSrc, BOOL usePat, UINT32 style,
-                                const char* rop, const gdiPalette* palette)
-{
-	UINT32 dstColor;
-	UINT32 colorA;
-	UINT32 colorB = 0;
-	UINT32 colorC = 0;
-	const INT32 dstX = nXDest + x;
-	const INT32 dstY = nYDest + y;
-	BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, dstX, dstY);
-
-	if (!dstp)
-	{
-		WLog_ERR(TAG, "dstp=%p", (void*) dstp);
-		return FALSE;
-	}
-
-	colorA = ReadColor(dstp, hdcDest->format);
-
-	if (useSrc)
-	{
-		const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc + x, nYSrc + y);
-
-		if (!srcp)
-		{
-			WLog_ERR(TAG, "srcp=%p", (void*) srcp);
-			return FALSE;
-		}
-
-		colorC = ReadColor(srcp, hdcSrc->format);
-		colorC = FreeRDPConvertColor(colorC, hdcSrc->format, hdcDest->format, palette);
-	}
-
-	if (usePat)
-	{
-		switch (style)
-		{
-			case GDI_BS_SOLID:
-				colorB = hdcDest->brush->color;
-				break;
-
-			case GDI_BS_HATCHED:
-			case GDI_BS_PATTERN:
-				{
-					const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest + y);
-
-					if (!patp)
-					{
-						WLog_ERR(TAG, "patp=%p", (void*) patp);
-						return FALSE;
-					}
-
-					colorB = ReadColor(patp, hdcDest->format);
-				}
-				break;
-
-			default:
-				break;
-		}
-	}
-
-	dstColor = process_rop(colorC, colorA, colorB, rop, hdcDest->format);
-	return WriteColor(dstp, hdcDest->format, dstColor);
-}
-
 static BOOL adjust_src_coordinates(HGDI_DC hdcSrc, INT32 nWidth, INT32 nHeight,
                                    INT32* px, INT32* py)
 {
@@ -445,15 +272,117 @@ static BOOL adjust_src_dst_coordinates(HGDI_DC hdcDest, INT32* pnXSrc, INT32* pn
 	return TRUE;
 }
 
+/**
+ * 32bpp destinations are combined in place in memory byte order, the source
+ * and pattern rows are stored the same way. Other formats are read into a row
+ * of colors and written back afterwards.
+ */
+
+static INLINE void BitBlt_store(UINT32* row, INT32 x, UINT32 color, UINT32 format, BOOL inPlace)
+{
+	if (inPlace)
+		WriteColor((BYTE*) &row[x], format, color);
+	else
+		row[x] = color;
+}
+
+static BOOL BitBlt_load_pattern(HGDI_DC hdcDest, UINT32* pat, INT32 nXDest, INT32 nYDest,
+                                INT32 nWidth, BOOL inPlace)
+{
+	INT32 x;
+	INT32 period = nWidth;
+	const HGDI_BITMAP hBmpBrush = hdcDest->brush->pattern;
+
+	/* the brush repeats every width pixels */
+	if (hBmpBrush && (hBmpBrush->width > 0) && ((INT32) hBmpBrush->width < nWidth))
+		period = (INT32) hBmpBrush->width;
+
+	for (x = 0; x < period; x++)
+	{
+		const BYTE* patp = gdi_get_brush_pointer(hdcDest, nXDest + x, nYDest);
+
+		if (!patp)
+		{
+			WLog_ERR(TAG, "patp=%p", (const void*) patp);
+			return FALSE;
+		}
+
+		BitBlt_store(pat, x, ReadColor(patp, hdcDest->format), hdcDest->format, inPlace);
+	}
+
+	for (; x < nWidth; x++)
+		pat[x] = pat[x - period];
+
+	return TRUE;
+}
+
+static const UINT32* BitBlt_load_source(HGDI_DC hdcDest, HGDI_DC hdcSrc, UINT32* src,
+                                        INT32 nXSrc, INT32 nYSrc, INT32 nWidth, BOOL inPlace,
+                                        const gdiPalette* palette)
+{
+	INT32 x;
+	const UINT32 srcBpp = GetBytesPerPixel(hdcSrc->format);
+	const BYTE* srcp = gdi_get_bitmap_pointer(hdcSrc, nXSrc, nYSrc);
+
+	if (!srcp)
+	{
+		WLog_ERR(TAG, "srcp=%p", (const void*) srcp);
+		return NULL;
+	}
+
+	if (inPlace && (hdcSrc->format == hdcDest->format))
+	{
+		UINT32 mask;
+		const UINT32* row = (const UINT32*) srcp;
+
+		if (ColorHasAlpha(hdcSrc->format))
+		{
+			if (hdcSrc->selectedObject != hdcDest->selectedObject)
+				return row;
+
+			/* the row may overlap the destination row */
+			MoveMemory(src, srcp, nWidth * sizeof(UINT32));
+			return src;
+		}
+
+		/* the conversion only sets the unused alpha bits */
+		WriteColor((BYTE*) &mask, hdcDest->format, FreeRDPGetColor(hdcDest->format, 0, 0, 0, 0xFF));
+
+		for (x = 0; x < nWidth; x++)
+			src[x] = row[x] | mask;
+
+		return src;
+	}
+
+	for (x = 0; x < nWidth; x++)
+	{
+		UINT32 color = ReadColor(&srcp[x * srcBpp], hdcSrc->format);
+		color = FreeRDPConvertColor(color, hdcSrc->format, hdcDest->format, palette);
+		BitBlt_store(src, x, color, hdcDest->format, inPlace);
+	}
+
+	return src;
+}
+
 static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest,
                            INT32 nWidth, INT32 nHeight, HGDI_DC hdcSrc,
-                           INT32 nXSrc, INT32 nYSrc, const char* rop, const gdiPalette* palette)
+                           INT32 nXSrc, INT32 nYSrc, DWORD rop, const gdiPalette* palette)
 {
 	INT32 x, y;
 	UINT32 style = 0;
+	BOOL rc = FALSE;
+	BOOL inPlace;
 	BOOL useSrc = FALSE;
 	BOOL usePat = FALSE;
-	const char* iter = rop;
+	BOOL useConstant = FALSE;
+	UINT32 dstBpp;
+	UINT32* buffer;
+	UINT32* dstRow;
+	UINT32* srcRow;
+	UINT32* patRow;
+	UINT32 rows[3 * 256];
+	gdiRop3Kernel kernel;
+	const char* iter = gdi_rop_to_string(rop);
 
 	while (*iter != '\0')
 	{
@@ -475,6 +404,21 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest,
 	if (!hdcDest)
 		return FALSE;
 
+	/* black and white include the alpha channel, copy them as a pattern */
+	if ((rop == GDI_BLACKNESS) || (rop == GDI_WHITENESS))
+	{
+		useConstant = TRUE;
+		kernel = gdi_get_rop3_kernel(GDI_PATCOPY);
+	}
+	else
+		kernel = gdi_get_rop3_kernel(rop);
+
+	if (!kernel)
+	{
+		WLog_ERR(TAG, "unsupported raster operation 0x%08"PRIX32"", rop);
+		return FALSE;
+	}
+
 	if (!adjust_src_dst_coordinates(hdcDest, &nXSrc, &nYSrc, &nXDest, &nYDest, &nWidth, &nHeight))
 		return FALSE;
 
@@ -504,60 +448,91 @@ static BOOL BitBlt_process(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest,
 		}
 	}
 
-	if ((nXDest > nXSrc) && (nYDest > nYSrc))
+	if ((nWidth < 1) || (nHeight < 1))
+		return TRUE;
+
+	buffer = rows;
+
+	if (nWidth > 256)
 	{
-		for (y = nHeight - 1; y >= 0; y--)
-		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest,
-				                  nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
+		if (!(buffer = (UINT32*) calloc(3ULL * nWidth, sizeof(UINT32))))
+			return FALSE;
 	}
-	else if (nXDest > nXSrc)
+
+	dstRow = buffer;
+	srcRow = &buffer[nWidth];
+	patRow = &buffer[2 * nWidth];
+	dstBpp = GetBytesPerPixel(hdcDest->format);
+	inPlace = (dstBpp == 4);
+
+	if (useConstant || (usePat && (style == GDI_BS_SOLID)))
 	{
-		for (y = 0; y < nHeight; y++)
-		{
-			for (x = nWidth - 1; x >= 0; x--)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest,
-				                  nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
-		}
+		UINT32 color;
+
+		if (rop == GDI_BLACKNESS)
+			color = FreeRDPGetColor(hdcDest->format, 0, 0, 0, 0xFF);
+		else if (rop == GDI_WHITENESS)
+			color = FreeRDPGetColor(hdcDest->format, 0xFF, 0xFF, 0xFF, 0xFF);
+		else
+			color = hdcDest->brush->color;
+
+		for (x = 0; x < nWidth; x++)
+			BitBlt_store(patRow, x, color, hdcDest->format, inPlace);
 	}
-	else if (nYDest > nYSrc)
+
+	for (y = 0; y < nHeight; y++)
 	{
-		for (y = nHeight - 1; y >= 0; y--)
+		UINT32* d;
+		const UINT32* s = NULL;
+		/* copy overlapping areas in the right order */
+		const INT32 row = (nYDest > nYSrc) ? (nHeight - 1 - y) : y;
+		BYTE* dstp = gdi_get_bitmap_pointer(hdcDest, nXDest, nYDest + row);
+
+		if (!dstp)
+		{
+			WLog_ERR(TAG, "dstp=%p", (void*) dstp);
+			goto out;
+		}
+
+		if (useSrc)
+		{
+			if (!(s = BitBlt_load_source(hdcDest, hdcSrc, srcRow, nXSrc, nYSrc + row, nWidth,
+			                             inPlace, palette)))
+				goto out;
+		}
+
+		if (usePat && (style != GDI_BS_SOLID))
+		{
+			if (!BitBlt_load_pattern(hdcDest, patRow, nXDest, nYDest + row, nWidth, inPlace))
+				goto out;
+		}
+
+		if (inPlace)
+			d = (UINT32*) dstp;
+		else
 		{
 			for (x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest,
-				                  nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+				dstRow[x] = ReadColor(&dstp[x * dstBpp], hdcDest->format);
+
+			d = dstRow;
 		}
-	}
-	else
-	{
-		for (y = 0; y < nHeight; y++)
+
+		kernel(d, s, (usePat || useConstant) ? patRow : NULL, (UINT32) nWidth);
+
+		if (!inPlace)
 		{
 			for (x = 0; x < nWidth; x++)
-			{
-				if (!BitBlt_write(hdcDest, hdcSrc, nXDest, nYDest,
-				                  nXSrc, nYSrc, x, y, useSrc,
-				                  usePat, style, rop, palette))
-					return FALSE;
-			}
+				WriteColor(&dstp[x * dstBpp], hdcDest->format, dstRow[x]);
 		}
 	}
 
-	return TRUE;
+	rc = TRUE;
+out:
+
+	if (buffer != rows)
+		free(buffer);
+
+	return rc;
 }
 
 /**
@@ -641,7 +616,7 @@ BOOL gdi_BitBlt(HGDI_DC hdcDest, INT32 nXDest, INT32 nYDest,
 		default:
 			if (!BitBlt_process(hdcDest, nXDest, nYDest,
 			                    nWidth, nHeight, hdcSrc,
-			                    nXSrc, nYSrc, gdi_rop_to_string(rop), palette))
+			                    nXSrc, nYSrc, rop, palette))
 				return FALSE;
 
 			break;
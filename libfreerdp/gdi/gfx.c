@@ -43,6 +43,29 @@ static DWORD gfx_align_scanline(DWORD widthInBytes, DWORD alignment)
 	return scanline;
 }
 
+/**
+ * Waits for RemoteFX messages still being decoded in the background.
+ * Every command that reads or writes surface memory has to call this first,
+ * see gdi_graphics_pipeline_flush.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT gdi_FlushRemoteFX(rdpGdi* gdi)
+{
+	rdpCodecs* codecs = gdi->context->codecs;
+
+	if (!codecs || !codecs->rfx)
+		return CHANNEL_RC_OK;
+
+	if (!rfx_process_message_flush(codecs->rfx))
+	{
+		WLog_ERR(TAG, "Failed to process RemoteFX message");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	return CHANNEL_RC_OK;
+}
+
 /**
  * Function description
  *
@@ -62,6 +85,8 @@ static UINT gdi_ResetGraphics(RdpgfxClientContext* context,
 	rdpUpdate* update = gdi->context->update;
 	rdpSettings* settings = gdi->context->settings;
 	EnterCriticalSection(&context->mux);
+	/* Errors of pending messages do not matter, their content is discarded */
+	gdi_FlushRemoteFX(gdi);
 	DesktopWidth = resetGraphics->width;
 	DesktopHeight = resetGraphics->height;
 
@@ -172,8 +197,15 @@ static UINT gdi_UpdateSurfaces(RdpgfxClientContext* context)
 		return CHANNEL_RC_OK;
 
 	EnterCriticalSection(&context->mux);
+	status = gdi_FlushRemoteFX(gdi);
+
+	if (status != CHANNEL_RC_OK)
+	{
+		LeaveCriticalSection(&context->mux);
+		return status;
+	}
+
 	context->GetSurfaceIds(context, &pSurfaceIds, &count);
-	status = CHANNEL_RC_OK;
 
 	for (index = 0; index < count; index++)
 	{
@@ -303,6 +335,25 @@ static UINT gdi_SurfaceCommand_RemoteFX(rdpGdi* gdi,
 	}
 
 	rfx_context_set_pixel_format(surface->codecs->rfx, cmd->format);
+
+	/* Without a per area callback the decoded tiles only have to be
+	 * composed before the frame ends and the surfaces are presented, so
+	 * the decoding can overlap with the reception of the next messages.
+	 * Outside of a frame the surfaces are presented right away. */
+	if (!context->UpdateSurfaceArea && gdi->inGfxFrame)
+	{
+		if (!rfx_process_message_async(surface->codecs->rfx, cmd->data, cmd->length,
+		                               cmd->left, cmd->top,
+		                               surface->data, surface->format, surface->scanline,
+		                               surface->height, &surface->invalidRegion))
+		{
+			WLog_ERR(TAG, "Failed to process RemoteFX message");
+			return ERROR_INTERNAL_ERROR;
+		}
+
+		return CHANNEL_RC_OK;
+	}
+
 	region16_init(&invalidRegion);
 
 	if (!rfx_process_message(surface->codecs->rfx, cmd->data, cmd->length,
@@ -887,6 +938,18 @@ static UINT gdi_SurfaceCommand(RdpgfxClientContext* context,
 	           FreeRDPGetColorFormatName(cmd->format), cmd->left, cmd->top, cmd->right,
 	           cmd->bottom, cmd->width, cmd->height, cmd->length, (void*) cmd->data, (void*) cmd->extra);
 
+	/* Only RemoteFX messages may queue up behind each other */
+	if (cmd->codecId != RDPGFX_CODECID_CAVIDEO)
+	{
+		status = gdi_FlushRemoteFX(gdi);
+
+		if (status != CHANNEL_RC_OK)
+		{
+			LeaveCriticalSection(&context->mux);
+			return status;
+		}
+	}
+
 	switch (cmd->codecId)
 	{
 		case RDPGFX_CODECID_UNCOMPRESSED:
@@ -1023,6 +1086,8 @@ static UINT gdi_DeleteSurface(RdpgfxClientContext* context,
 	rdpCodecs* codecs = NULL;
 	gdiGfxSurface* surface = NULL;
 	EnterCriticalSection(&context->mux);
+	/* Errors of pending messages do not matter, the surface is discarded */
+	gdi_FlushRemoteFX((rdpGdi*) context->custom);
 	surface = (gdiGfxSurface*) context->GetSurfaceData(context, deleteSurface->surfaceId);
 
 	if (surface)
@@ -1066,6 +1131,10 @@ static UINT gdi_SolidFill(RdpgfxClientContext* context,
 	RECTANGLE_16 invalidRect;
 	rdpGdi* gdi = (rdpGdi*) context->custom;
 	EnterCriticalSection(&context->mux);
+
+	if (gdi_FlushRemoteFX(gdi) != CHANNEL_RC_OK)
+		goto fail;
+
 	surface = (gdiGfxSurface*) context->GetSurfaceData(context,
 	          solidFill->surfaceId);
 
@@ -1137,6 +1206,10 @@ static UINT gdi_SurfaceToSurface(RdpgfxClientContext* context,
 	gdiGfxSurface* surfaceDst;
 	rdpGdi* gdi = (rdpGdi*) context->custom;
 	EnterCriticalSection(&context->mux);
+
+	if (gdi_FlushRemoteFX(gdi) != CHANNEL_RC_OK)
+		goto fail;
+
 	rectSrc = &(surfaceToSurface->rectSrc);
 	surfaceSrc = (gdiGfxSurface*) context->GetSurfaceData(context,
 	             surfaceToSurface->surfaceIdSrc);
@@ -1207,6 +1280,10 @@ static UINT gdi_SurfaceToCache(RdpgfxClientContext* context,
 	gdiGfxCacheEntry* cacheEntry;
 	UINT rc = ERROR_INTERNAL_ERROR;
 	EnterCriticalSection(&context->mux);
+
+	if (gdi_FlushRemoteFX((rdpGdi*) context->custom) != CHANNEL_RC_OK)
+		goto fail;
+
 	rect = &(surfaceToCache->rectSrc);
 	surface = (gdiGfxSurface*) context->GetSurfaceData(context, surfaceToCache->surfaceId);
 
@@ -1260,6 +1337,10 @@ static UINT gdi_CacheToSurface(RdpgfxClientContext* context,
 	RECTANGLE_16 invalidRect;
 	rdpGdi* gdi = (rdpGdi*) context->custom;
 	EnterCriticalSection(&context->mux);
+
+	if (gdi_FlushRemoteFX(gdi) != CHANNEL_RC_OK)
+		goto fail;
+
 	surface = (gdiGfxSurface*) context->GetSurfaceData(context, cacheToSurface->surfaceId);
 	cacheEntry = (gdiGfxCacheEntry*) context->GetCacheSlotData(context, cacheToSurface->cacheSlot);
 
@@ -1502,6 +1583,14 @@ BOOL gdi_graphics_pipeline_init_ex(rdpGdi* gdi, RdpgfxClientContext* gfx,
 	return TRUE;
 }
 
+UINT gdi_graphics_pipeline_flush(rdpGdi* gdi)
+{
+	if (!gdi || !gdi->context)
+		return ERROR_INVALID_PARAMETER;
+
+	return gdi_FlushRemoteFX(gdi);
+}
+
 void gdi_graphics_pipeline_uninit(rdpGdi* gdi, RdpgfxClientContext* gfx)
 {
 	if (gdi)
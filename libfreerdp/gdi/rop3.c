@@ -0,0 +1,383 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI ROP3 Raster Operation Kernels
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/gdi/gdi.h>
+
+#include "rop3.h"
+
+/**
+ * Each of the 256 ternary raster operations is compiled into its own row
+ * kernel instead of interpreting the reverse polish notation per pixel.
+ * D, S and P refer to the destination, source and pattern pixel.
+ */
+
+#define D dst[x]
+#define S src[x]
+#define P pat[x]
+
+#define GDI_ROP3_KERNEL(_code, _expr) \
+	static void gdi_rop3_##_code(UINT32* dst, const UINT32* src, const UINT32* pat, \
+	                             UINT32 count) \
+	{ \
+		UINT32 x; \
+		for (x = 0; x < count; x++) \
+			dst[x] = (_expr); \
+	}
+
+/* Generated by scripts/gdiRop3Kernels.py from the rop3_code_table in gdi.c */
+GDI_ROP3_KERNEL(00, 0) /* GDI_BLACKNESS 0 */
+GDI_ROP3_KERNEL(01, ~(D | (P | S))) /* GDI_DPSoon DPSoon */
+GDI_ROP3_KERNEL(02, D & ~(P | S)) /* GDI_DPSona DPSona */
+GDI_ROP3_KERNEL(03, ~(P | S)) /* GDI_PSon PSon */
+GDI_ROP3_KERNEL(04, S & ~(D | P)) /* GDI_SDPona SDPona */
+GDI_ROP3_KERNEL(05, ~(D | P)) /* GDI_DPon DPon */
+GDI_ROP3_KERNEL(06, ~(P | ~(D ^ S))) /* GDI_PDSxnon PDSxnon */
+GDI_ROP3_KERNEL(07, ~(P | (D & S))) /* GDI_PDSaon PDSaon */
+GDI_ROP3_KERNEL(08, S & (D & ~P)) /* GDI_SDPnaa SDPnaa */
+GDI_ROP3_KERNEL(09, ~(P | (D ^ S))) /* GDI_PDSxon PDSxon */
+GDI_ROP3_KERNEL(0A, D & ~P) /* GDI_DPna DPna */
+GDI_ROP3_KERNEL(0B, ~(P | (S & ~D))) /* GDI_PSDnaon PSDnaon */
+GDI_ROP3_KERNEL(0C, S & ~P) /* GDI_SPna SPna */
+GDI_ROP3_KERNEL(0D, ~(P | (D & ~S))) /* GDI_PDSnaon PDSnaon */
+GDI_ROP3_KERNEL(0E, ~(P | ~(D | S))) /* GDI_PDSonon PDSonon */
+GDI_ROP3_KERNEL(0F, ~P) /* GDI_Pn Pn */
+GDI_ROP3_KERNEL(10, P & ~(D | S)) /* GDI_PDSona PDSona */
+GDI_ROP3_KERNEL(11, ~(D | S)) /* GDI_NOTSRCERASE DSon */
+GDI_ROP3_KERNEL(12, ~(S | ~(D ^ P))) /* GDI_SDPxnon SDPxnon */
+GDI_ROP3_KERNEL(13, ~(S | (D & P))) /* GDI_SDPaon SDPaon */
+GDI_ROP3_KERNEL(14, ~(D | ~(P ^ S))) /* GDI_DPSxnon DPSxnon */
+GDI_ROP3_KERNEL(15, ~(D | (P & S))) /* GDI_DPSaon DPSaon */
+GDI_ROP3_KERNEL(16, P ^ (S ^ (D & ~(P & S)))) /* GDI_PSDPSanaxx PSDPSanaxx */
+GDI_ROP3_KERNEL(17, ~(S ^ ((S ^ P) & (D ^ S)))) /* GDI_SSPxDSxaxn SSPxDSxaxn */
+GDI_ROP3_KERNEL(18, (S ^ P) & (P ^ D)) /* GDI_SPxPDxa SPxPDxa */
+GDI_ROP3_KERNEL(19, ~(S ^ (D & ~(P & S)))) /* GDI_SDPSanaxn SDPSanaxn */
+GDI_ROP3_KERNEL(1A, P ^ (D | (S & P))) /* GDI_PDSPaox PDSPaox */
+GDI_ROP3_KERNEL(1B, ~(S ^ (D & (P ^ S)))) /* GDI_SDPSxaxn SDPSxaxn */
+GDI_ROP3_KERNEL(1C, P ^ (S | (D & P))) /* GDI_PSDPaox PSDPaox */
+GDI_ROP3_KERNEL(1D, ~(D ^ (S & (P ^ D)))) /* GDI_DSPDxaxn DSPDxaxn */
+GDI_ROP3_KERNEL(1E, P ^ (D | S)) /* GDI_PDSox PDSox */
+GDI_ROP3_KERNEL(1F, ~(P & (D | S))) /* GDI_PDSoan PDSoan */
+GDI_ROP3_KERNEL(20, D & (P & ~S)) /* GDI_DPSnaa DPSnaa */
+GDI_ROP3_KERNEL(21, ~(S | (D ^ P))) /* GDI_SDPxon SDPxon */
+GDI_ROP3_KERNEL(22, D & ~S) /* GDI_DSna DSna */
+GDI_ROP3_KERNEL(23, ~(S | (P & ~D))) /* GDI_SPDnaon SPDnaon */
+GDI_ROP3_KERNEL(24, (S ^ P) & (D ^ S)) /* GDI_SPxDSxa SPxDSxa */
+GDI_ROP3_KERNEL(25, ~(P ^ (D & ~(S & P)))) /* GDI_PDSPanaxn PDSPanaxn */
+GDI_ROP3_KERNEL(26, S ^ (D | (P & S))) /* GDI_SDPSaox SDPSaox */
+GDI_ROP3_KERNEL(27, S ^ (D | ~(P ^ S))) /* GDI_SDPSxnox SDPSxnox */
+GDI_ROP3_KERNEL(28, D & (P ^ S)) /* GDI_DPSxa DPSxa */
+GDI_ROP3_KERNEL(29, ~(P ^ (S ^ (D | (P & S))))) /* GDI_PSDPSaoxxn PSDPSaoxxn */
+GDI_ROP3_KERNEL(2A, D & ~(P & S)) /* GDI_DPSana DPSana */
+GDI_ROP3_KERNEL(2B, ~(S ^ ((S ^ P) & (P ^ D)))) /* GDI_SSPxPDxaxn SSPxPDxaxn */
+GDI_ROP3_KERNEL(2C, S ^ (P & (D | S))) /* GDI_SPDSoax SPDSoax */
+GDI_ROP3_KERNEL(2D, P ^ (S | ~D)) /* GDI_PSDnox PSDnox */
+GDI_ROP3_KERNEL(2E, P ^ (S | (D ^ P))) /* GDI_PSDPxox PSDPxox */
+GDI_ROP3_KERNEL(2F, ~(P & (S | ~D))) /* GDI_PSDnoan PSDnoan */
+GDI_ROP3_KERNEL(30, P & ~S) /* GDI_PSna PSna */
+GDI_ROP3_KERNEL(31, ~(S | (D & ~P))) /* GDI_SDPnaon SDPnaon */
+GDI_ROP3_KERNEL(32, S ^ (D | (P | S))) /* GDI_SDPSoox SDPSoox */
+GDI_ROP3_KERNEL(33, ~S) /* GDI_NOTSRCCOPY Sn */
+GDI_ROP3_KERNEL(34, S ^ (P | (D & S))) /* GDI_SPDSaox SPDSaox */
+GDI_ROP3_KERNEL(35, S ^ (P | ~(D ^ S))) /* GDI_SPDSxnox SPDSxnox */
+GDI_ROP3_KERNEL(36, S ^ (D | P)) /* GDI_SDPox SDPox */
+GDI_ROP3_KERNEL(37, ~(S & (D | P))) /* GDI_SDPoan SDPoan */
+GDI_ROP3_KERNEL(38, P ^ (S & (D | P))) /* GDI_PSDPoax PSDPoax */
+GDI_ROP3_KERNEL(39, S ^ (P | ~D)) /* GDI_SPDnox SPDnox */
+GDI_ROP3_KERNEL(3A, S ^ (P | (D ^ S))) /* GDI_SPDSxox SPDSxox */
+GDI_ROP3_KERNEL(3B, ~(S & (P | ~D))) /* GDI_SPDnoan SPDnoan */
+GDI_ROP3_KERNEL(3C, P ^ S) /* GDI_PSx PSx */
+GDI_ROP3_KERNEL(3D, S ^ (P | ~(D | S))) /* GDI_SPDSonox SPDSonox */
+GDI_ROP3_KERNEL(3E, S ^ (P | (D & ~S))) /* GDI_SPDSnaox SPDSnaox */
+GDI_ROP3_KERNEL(3F, ~(P & S)) /* GDI_PSan PSan */
+GDI_ROP3_KERNEL(40, P & (S & ~D)) /* GDI_PSDnaa PSDnaa */
+GDI_ROP3_KERNEL(41, ~(D | (P ^ S))) /* GDI_DPSxon DPSxon */
+GDI_ROP3_KERNEL(42, (S ^ D) & (P ^ D)) /* GDI_SDxPDxa SDxPDxa */
+GDI_ROP3_KERNEL(43, ~(S ^ (P & ~(D & S)))) /* GDI_SPDSanaxn SPDSanaxn */
+GDI_ROP3_KERNEL(44, S & ~D) /* GDI_SRCERASE SDna */
+GDI_ROP3_KERNEL(45, ~(D | (P & ~S))) /* GDI_DPSnaon DPSnaon */
+GDI_ROP3_KERNEL(46, D ^ (S | (P & D))) /* GDI_DSPDaox DSPDaox */
+GDI_ROP3_KERNEL(47, ~(P ^ (S & (D ^ P)))) /* GDI_PSDPxaxn PSDPxaxn */
+GDI_ROP3_KERNEL(48, S & (D ^ P)) /* GDI_SDPxa SDPxa */
+GDI_ROP3_KERNEL(49, ~(P ^ (D ^ (S | (P & D))))) /* GDI_PDSPDaoxxn PDSPDaoxxn */
+GDI_ROP3_KERNEL(4A, D ^ (P & (S | D))) /* GDI_DPSDoax DPSDoax */
+GDI_ROP3_KERNEL(4B, P ^ (D | ~S)) /* GDI_PDSnox PDSnox */
+GDI_ROP3_KERNEL(4C, S & ~(D & P)) /* GDI_SDPana SDPana */
+GDI_ROP3_KERNEL(4D, ~(S ^ ((S ^ P) | (D ^ S)))) /* GDI_SSPxDSxoxn SSPxDSxoxn */
+GDI_ROP3_KERNEL(4E, P ^ (D | (S ^ P))) /* GDI_PDSPxox PDSPxox */
+GDI_ROP3_KERNEL(4F, ~(P & (D | ~S))) /* GDI_PDSnoan PDSnoan */
+GDI_ROP3_KERNEL(50, P & ~D) /* GDI_PDna PDna */
+GDI_ROP3_KERNEL(51, ~(D | (S & ~P))) /* GDI_DSPnaon DSPnaon */
+GDI_ROP3_KERNEL(52, D ^ (P | (S & D))) /* GDI_DPSDaox DPSDaox */
+GDI_ROP3_KERNEL(53, ~(S ^ (P & (D ^ S)))) /* GDI_SPDSxaxn SPDSxaxn */
+GDI_ROP3_KERNEL(54, ~(D | ~(P | S))) /* GDI_DPSonon DPSonon */
+GDI_ROP3_KERNEL(55, ~D) /* GDI_DSTINVERT Dn */
+GDI_ROP3_KERNEL(56, D ^ (P | S)) /* GDI_DPSox DPSox */
+GDI_ROP3_KERNEL(57, ~(D & (P | S))) /* GDI_DPSoan DPSoan */
+GDI_ROP3_KERNEL(58, P ^ (D & (S | P))) /* GDI_PDSPoax PDSPoax */
+GDI_ROP3_KERNEL(59, D ^ (P | ~S)) /* GDI_DPSnox DPSnox */
+GDI_ROP3_KERNEL(5A, D ^ P) /* GDI_PATINVERT DPx */
+GDI_ROP3_KERNEL(5B, D ^ (P | ~(S | D))) /* GDI_DPSDonox DPSDonox */
+GDI_ROP3_KERNEL(5C, D ^ (P | (S ^ D))) /* GDI_DPSDxox DPSDxox */
+GDI_ROP3_KERNEL(5D, ~(D & (P | ~S))) /* GDI_DPSnoan DPSnoan */
+GDI_ROP3_KERNEL(5E, D ^ (P | (S & ~D))) /* GDI_DPSDnaox DPSDnaox */
+GDI_ROP3_KERNEL(5F, ~(D & P)) /* GDI_DPan DPan */
+GDI_ROP3_KERNEL(60, P & (D ^ S)) /* GDI_PDSxa PDSxa */
+GDI_ROP3_KERNEL(61, ~(D ^ (S ^ (P | (D & S))))) /* GDI_DSPDSaoxxn DSPDSaoxxn */
+GDI_ROP3_KERNEL(62, D ^ (S & (P | D))) /* GDI_DSPDoax DSPDoax */
+GDI_ROP3_KERNEL(63, S ^ (D | ~P)) /* GDI_SDPnox SDPnox */
+GDI_ROP3_KERNEL(64, S ^ (D & (P | S))) /* GDI_SDPSoax SDPSoax */
+GDI_ROP3_KERNEL(65, D ^ (S | ~P)) /* GDI_DSPnox DSPnox */
+GDI_ROP3_KERNEL(66, D ^ S) /* GDI_SRCINVERT DSx */
+GDI_ROP3_KERNEL(67, S ^ (D | ~(P | S))) /* GDI_SDPSonox SDPSonox */
+GDI_ROP3_KERNEL(68, ~(D ^ (S ^ (P | ~(D | S))))) /* GDI_DSPDSonoxxn DSPDSonoxxn */
+GDI_ROP3_KERNEL(69, ~(P ^ (D ^ S))) /* GDI_PDSxxn PDSxxn */
+GDI_ROP3_KERNEL(6A, D ^ (P & S)) /* GDI_DPSax DPSax */
+GDI_ROP3_KERNEL(6B, ~(P ^ (S ^ (D & (P | S))))) /* GDI_PSDPSoaxxn PSDPSoaxxn */
+GDI_ROP3_KERNEL(6C, S ^ (D & P)) /* GDI_SDPax SDPax */
+GDI_ROP3_KERNEL(6D, ~(P ^ (D ^ (S & (P | D))))) /* GDI_PDSPDoaxxn PDSPDoaxxn */
+GDI_ROP3_KERNEL(6E, S ^ (D & (P | ~S))) /* GDI_SDPSnoax SDPSnoax */
+GDI_ROP3_KERNEL(6F, ~(P & ~(D ^ S))) /* GDI_PDSxnan PDSxnan */
+GDI_ROP3_KERNEL(70, P & ~(D & S)) /* GDI_PDSana PDSana */
+GDI_ROP3_KERNEL(71, ~(S ^ ((S ^ D) & (P ^ D)))) /* GDI_SSDxPDxaxn SSDxPDxaxn */
+GDI_ROP3_KERNEL(72, S ^ (D | (P ^ S))) /* GDI_SDPSxox SDPSxox */
+GDI_ROP3_KERNEL(73, ~(S & (D | ~P))) /* GDI_SDPnoan SDPnoan */
+GDI_ROP3_KERNEL(74, D ^ (S | (P ^ D))) /* GDI_DSPDxox DSPDxox */
+GDI_ROP3_KERNEL(75, ~(D & (S | ~P))) /* GDI_DSPnoan DSPnoan */
+GDI_ROP3_KERNEL(76, S ^ (D | (P & ~S))) /* GDI_SDPSnaox SDPSnaox */
+GDI_ROP3_KERNEL(77, ~(D & S)) /* GDI_DSan DSan */
+GDI_ROP3_KERNEL(78, P ^ (D & S)) /* GDI_PDSax PDSax */
+GDI_ROP3_KERNEL(79, ~(D ^ (S ^ (P & (D | S))))) /* GDI_DSPDSoaxxn DSPDSoaxxn */
+GDI_ROP3_KERNEL(7A, D ^ (P & (S | ~D))) /* GDI_DPSDnoax DPSDnoax */
+GDI_ROP3_KERNEL(7B, ~(S & ~(D ^ P))) /* GDI_SDPxnan SDPxnan */
+GDI_ROP3_KERNEL(7C, S ^ (P & (D | ~S))) /* GDI_SPDSnoax SPDSnoax */
+GDI_ROP3_KERNEL(7D, ~(D & ~(P ^ S))) /* GDI_DPSxnan DPSxnan */
+GDI_ROP3_KERNEL(7E, (S ^ P) | (D ^ S)) /* GDI_SPxDSxo SPxDSxo */
+GDI_ROP3_KERNEL(7F, ~(D & (P & S))) /* GDI_DPSaan DPSaan */
+GDI_ROP3_KERNEL(80, D & (P & S)) /* GDI_DPSaa DPSaa */
+GDI_ROP3_KERNEL(81, ~((S ^ P) | (D ^ S))) /* GDI_SPxDSxon SPxDSxon */
+GDI_ROP3_KERNEL(82, D & ~(P ^ S)) /* GDI_DPSxna DPSxna */
+GDI_ROP3_KERNEL(83, ~(S ^ (P & (D | ~S)))) /* GDI_SPDSnoaxn SPDSnoaxn */
+GDI_ROP3_KERNEL(84, S & ~(D ^ P)) /* GDI_SDPxna SDPxna */
+GDI_ROP3_KERNEL(85, ~(P ^ (D & (S | ~P)))) /* GDI_PDSPnoaxn PDSPnoaxn */
+GDI_ROP3_KERNEL(86, D ^ (S ^ (P & (D | S)))) /* GDI_DSPDSoaxx DSPDSoaxx */
+GDI_ROP3_KERNEL(87, ~(P ^ (D & S))) /* GDI_PDSaxn PDSaxn */
+GDI_ROP3_KERNEL(88, D & S) /* GDI_SRCAND DSa */
+GDI_ROP3_KERNEL(89, ~(S ^ (D | (P & ~S)))) /* GDI_SDPSnaoxn SDPSnaoxn */
+GDI_ROP3_KERNEL(8A, D & (S | ~P)) /* GDI_DSPnoa DSPnoa */
+GDI_ROP3_KERNEL(8B, ~(D ^ (S | (P ^ D)))) /* GDI_DSPDxoxn DSPDxoxn */
+GDI_ROP3_KERNEL(8C, S & (D | ~P)) /* GDI_SDPnoa SDPnoa */
+GDI_ROP3_KERNEL(8D, ~(S ^ (D | (P ^ S)))) /* GDI_SDPSxoxn SDPSxoxn */
+GDI_ROP3_KERNEL(8E, S ^ ((S ^ D) & (P ^ D))) /* GDI_SSDxPDxax SSDxPDxax */
+GDI_ROP3_KERNEL(8F, ~(P & ~(D & S))) /* GDI_PDSanan PDSanan */
+GDI_ROP3_KERNEL(90, P & ~(D ^ S)) /* GDI_PDSxna PDSxna */
+GDI_ROP3_KERNEL(91, ~(S ^ (D & (P | ~S)))) /* GDI_SDPSnoaxn SDPSnoaxn */
+GDI_ROP3_KERNEL(92, D ^ (P ^ (S & (D | P)))) /* GDI_DPSDPoaxx DPSDPoaxx */
+GDI_ROP3_KERNEL(93, ~(S ^ (P & D))) /* GDI_SPDaxn SPDaxn */
+GDI_ROP3_KERNEL(94, P ^ (S ^ (D & (P | S)))) /* GDI_PSDPSoaxx PSDPSoaxx */
+GDI_ROP3_KERNEL(95, ~(D ^ (P & S))) /* GDI_DPSaxn DPSaxn */
+GDI_ROP3_KERNEL(96, D ^ (P ^ S)) /* GDI_DPSxx DPSxx */
+GDI_ROP3_KERNEL(97, P ^ (S ^ (D | ~(P | S)))) /* GDI_PSDPSonoxx PSDPSonoxx */
+GDI_ROP3_KERNEL(98, ~(S ^ (D | ~(P | S)))) /* GDI_SDPSonoxn SDPSonoxn */
+GDI_ROP3_KERNEL(99, ~(D ^ S)) /* GDI_DSxn DSxn */
+GDI_ROP3_KERNEL(9A, D ^ (P & ~S)) /* GDI_DPSnax DPSnax */
+GDI_ROP3_KERNEL(9B, ~(S ^ (D & (P | S)))) /* GDI_SDPSoaxn SDPSoaxn */
+GDI_ROP3_KERNEL(9C, S ^ (P & ~D)) /* GDI_SPDnax SPDnax */
+GDI_ROP3_KERNEL(9D, ~(D ^ (S & (P | D)))) /* GDI_DSPDoaxn DSPDoaxn */
+GDI_ROP3_KERNEL(9E, D ^ (S ^ (P | (D & S)))) /* GDI_DSPDSaoxx DSPDSaoxx */
+GDI_ROP3_KERNEL(9F, ~(P & (D ^ S))) /* GDI_PDSxan PDSxan */
+GDI_ROP3_KERNEL(A0, D & P) /* GDI_DPa DPa */
+GDI_ROP3_KERNEL(A1, ~(P ^ (D | (S & ~P)))) /* GDI_PDSPnaoxn PDSPnaoxn */
+GDI_ROP3_KERNEL(A2, D & (P | ~S)) /* GDI_DPSnoa DPSnoa */
+GDI_ROP3_KERNEL(A3, ~(D ^ (P | (S ^ D)))) /* GDI_DPSDxoxn DPSDxoxn */
+GDI_ROP3_KERNEL(A4, ~(P ^ (D | ~(S | P)))) /* GDI_PDSPonoxn PDSPonoxn */
+GDI_ROP3_KERNEL(A5, ~(P ^ D)) /* GDI_PDxn PDxn */
+GDI_ROP3_KERNEL(A6, D ^ (S & ~P)) /* GDI_DSPnax DSPnax */
+GDI_ROP3_KERNEL(A7, ~(P ^ (D & (S | P)))) /* GDI_PDSPoaxn PDSPoaxn */
+GDI_ROP3_KERNEL(A8, D & (P | S)) /* GDI_DPSoa DPSoa */
+GDI_ROP3_KERNEL(A9, ~(D ^ (P | S))) /* GDI_DPSoxn DPSoxn */
+GDI_ROP3_KERNEL(AA, D) /* GDI_DSTCOPY D */
+GDI_ROP3_KERNEL(AB, D | ~(P | S)) /* GDI_DPSono DPSono */
+GDI_ROP3_KERNEL(AC, S ^ (P & (D ^ S))) /* GDI_SPDSxax SPDSxax */
+GDI_ROP3_KERNEL(AD, ~(D ^ (P | (S & D)))) /* GDI_DPSDaoxn DPSDaoxn */
+GDI_ROP3_KERNEL(AE, D | (S & ~P)) /* GDI_DSPnao DSPnao */
+GDI_ROP3_KERNEL(AF, D | ~P) /* GDI_DPno DPno */
+GDI_ROP3_KERNEL(B0, P & (D | ~S)) /* GDI_PDSnoa PDSnoa */
+GDI_ROP3_KERNEL(B1, ~(P ^ (D | (S ^ P)))) /* GDI_PDSPxoxn PDSPxoxn */
+GDI_ROP3_KERNEL(B2, S ^ ((S ^ P) | (D ^ S))) /* GDI_SSPxDSxox SSPxDSxox */
+GDI_ROP3_KERNEL(B3, ~(S & ~(D & P))) /* GDI_SDPanan SDPanan */
+GDI_ROP3_KERNEL(B4, P ^ (S & ~D)) /* GDI_PSDnax PSDnax */
+GDI_ROP3_KERNEL(B5, ~(D ^ (P & (S | D)))) /* GDI_DPSDoaxn DPSDoaxn */
+GDI_ROP3_KERNEL(B6, D ^ (P ^ (S | (D & P)))) /* GDI_DPSDPaoxx DPSDPaoxx */
+GDI_ROP3_KERNEL(B7, ~(S & (D ^ P))) /* GDI_SDPxan SDPxan */
+GDI_ROP3_KERNEL(B8, P ^ (S & (D ^ P))) /* GDI_PSDPxax PSDPxax */
+GDI_ROP3_KERNEL(B9, ~(D ^ (S | (P & D)))) /* GDI_DSPDaoxn DSPDaoxn */
+GDI_ROP3_KERNEL(BA, D | (P & ~S)) /* GDI_DPSnao DPSnao */
+GDI_ROP3_KERNEL(BB, D | ~S) /* GDI_MERGEPAINT DSno */
+GDI_ROP3_KERNEL(BC, S ^ (P & ~(D & S))) /* GDI_SPDSanax SPDSanax */
+GDI_ROP3_KERNEL(BD, ~((S ^ D) & (P ^ D))) /* GDI_SDxPDxan SDxPDxan */
+GDI_ROP3_KERNEL(BE, D | (P ^ S)) /* GDI_DPSxo DPSxo */
+GDI_ROP3_KERNEL(BF, D | ~(P & S)) /* GDI_DPSano DPSano */
+GDI_ROP3_KERNEL(C0, P & S) /* GDI_MERGECOPY PSa */
+GDI_ROP3_KERNEL(C1, ~(S ^ (P | (D & ~S)))) /* GDI_SPDSnaoxn SPDSnaoxn */
+GDI_ROP3_KERNEL(C2, ~(S ^ (P | ~(D | S)))) /* GDI_SPDSonoxn SPDSonoxn */
+GDI_ROP3_KERNEL(C3, ~(P ^ S)) /* GDI_PSxn PSxn */
+GDI_ROP3_KERNEL(C4, S & (P | ~D)) /* GDI_SPDnoa SPDnoa */
+GDI_ROP3_KERNEL(C5, ~(S ^ (P | (D ^ S)))) /* GDI_SPDSxoxn SPDSxoxn */
+GDI_ROP3_KERNEL(C6, S ^ (D & ~P)) /* GDI_SDPnax SDPnax */
+GDI_ROP3_KERNEL(C7, ~(P ^ (S & (D | P)))) /* GDI_PSDPoaxn PSDPoaxn */
+GDI_ROP3_KERNEL(C8, S & (D | P)) /* GDI_SDPoa SDPoa */
+GDI_ROP3_KERNEL(C9, ~(S ^ (P | D))) /* GDI_SPDoxn SPDoxn */
+GDI_ROP3_KERNEL(CA, D ^ (P & (S ^ D))) /* GDI_DPSDxax DPSDxax */
+GDI_ROP3_KERNEL(CB, ~(S ^ (P | (D & S)))) /* GDI_SPDSaoxn SPDSaoxn */
+GDI_ROP3_KERNEL(CC, S) /* GDI_SRCCOPY S */
+GDI_ROP3_KERNEL(CD, S | ~(D | P)) /* GDI_SDPono SDPono */
+GDI_ROP3_KERNEL(CE, S | (D & ~P)) /* GDI_SDPnao SDPnao */
+GDI_ROP3_KERNEL(CF, S | ~P) /* GDI_SPno SPno */
+GDI_ROP3_KERNEL(D0, P & (S | ~D)) /* GDI_PSDnoa PSDnoa */
+GDI_ROP3_KERNEL(D1, ~(P ^ (S | (D ^ P)))) /* GDI_PSDPxoxn PSDPxoxn */
+GDI_ROP3_KERNEL(D2, P ^ (D & ~S)) /* GDI_PDSnax PDSnax */
+GDI_ROP3_KERNEL(D3, ~(S ^ (P & (D | S)))) /* GDI_SPDSoaxn SPDSoaxn */
+GDI_ROP3_KERNEL(D4, S ^ ((S ^ P) & (P ^ D))) /* GDI_SSPxPDxax SSPxPDxax */
+GDI_ROP3_KERNEL(D5, ~(D & ~(P & S))) /* GDI_DPSanan DPSanan */
+GDI_ROP3_KERNEL(D6, P ^ (S ^ (D | (P & S)))) /* GDI_PSDPSaoxx PSDPSaoxx */
+GDI_ROP3_KERNEL(D7, ~(D & (P ^ S))) /* GDI_DPSxan DPSxan */
+GDI_ROP3_KERNEL(D8, P ^ (D & (S ^ P))) /* GDI_PDSPxax PDSPxax */
+GDI_ROP3_KERNEL(D9, ~(S ^ (D | (P & S)))) /* GDI_SDPSaoxn SDPSaoxn */
+GDI_ROP3_KERNEL(DA, D ^ (P & ~(S & D))) /* GDI_DPSDanax DPSDanax */
+GDI_ROP3_KERNEL(DB, ~((S ^ P) & (D ^ S))) /* GDI_SPxDSxan SPxDSxan */
+GDI_ROP3_KERNEL(DC, S | (P & ~D)) /* GDI_SPDnao SPDnao */
+GDI_ROP3_KERNEL(DD, S | ~D) /* GDI_SDno SDno */
+GDI_ROP3_KERNEL(DE, S | (D ^ P)) /* GDI_SDPxo SDPxo */
+GDI_ROP3_KERNEL(DF, S | ~(D & P)) /* GDI_SDPano SDPano */
+GDI_ROP3_KERNEL(E0, P & (D | S)) /* GDI_PDSoa PDSoa */
+GDI_ROP3_KERNEL(E1, ~(P ^ (D | S))) /* GDI_PDSoxn PDSoxn */
+GDI_ROP3_KERNEL(E2, D ^ (S & (P ^ D))) /* GDI_DSPDxax DSPDxax */
+GDI_ROP3_KERNEL(E3, ~(P ^ (S | (D & P)))) /* GDI_PSDPaoxn PSDPaoxn */
+GDI_ROP3_KERNEL(E4, S ^ (D & (P ^ S))) /* GDI_SDPSxax SDPSxax */
+GDI_ROP3_KERNEL(E5, ~(P ^ (D | (S & P)))) /* GDI_PDSPaoxn PDSPaoxn */
+GDI_ROP3_KERNEL(E6, S ^ (D & ~(P & S))) /* GDI_SDPSanax SDPSanax */
+GDI_ROP3_KERNEL(E7, ~((S ^ P) & (P ^ D))) /* GDI_SPxPDxan SPxPDxan */
+GDI_ROP3_KERNEL(E8, S ^ ((S ^ P) & (D ^ S))) /* GDI_SSPxDSxax SSPxDSxax */
+GDI_ROP3_KERNEL(E9, ~(D ^ (S ^ (P & ~(D & S))))) /* GDI_DSPDSanaxxn DSPDSanaxxn */
+GDI_ROP3_KERNEL(EA, D | (P & S)) /* GDI_DPSao DPSao */
+GDI_ROP3_KERNEL(EB, D | ~(P ^ S)) /* GDI_DPSxno DPSxno */
+GDI_ROP3_KERNEL(EC, S | (D & P)) /* GDI_SDPao SDPao */
+GDI_ROP3_KERNEL(ED, S | ~(D ^ P)) /* GDI_SDPxno SDPxno */
+GDI_ROP3_KERNEL(EE, D | S) /* GDI_SRCPAINT DSo */
+GDI_ROP3_KERNEL(EF, S | (D | ~P)) /* GDI_SDPnoo SDPnoo */
+GDI_ROP3_KERNEL(F0, P) /* GDI_PATCOPY P */
+GDI_ROP3_KERNEL(F1, P | ~(D | S)) /* GDI_PDSono PDSono */
+GDI_ROP3_KERNEL(F2, P | (D & ~S)) /* GDI_PDSnao PDSnao */
+GDI_ROP3_KERNEL(F3, P | ~S) /* GDI_PSno PSno */
+GDI_ROP3_KERNEL(F4, P | (S & ~D)) /* GDI_PSDnao PSDnao */
+GDI_ROP3_KERNEL(F5, P | ~D) /* GDI_PDno PDno */
+GDI_ROP3_KERNEL(F6, P | (D ^ S)) /* GDI_PDSxo PDSxo */
+GDI_ROP3_KERNEL(F7, P | ~(D & S)) /* GDI_PDSano PDSano */
+GDI_ROP3_KERNEL(F8, P | (D & S)) /* GDI_PDSao PDSao */
+GDI_ROP3_KERNEL(F9, P | ~(D ^ S)) /* GDI_PDSxno PDSxno */
+GDI_ROP3_KERNEL(FA, D | P) /* GDI_DPo DPo */
+GDI_ROP3_KERNEL(FB, D | (P | ~S)) /* GDI_PATPAINT DPSnoo */
+GDI_ROP3_KERNEL(FC, P | S) /* GDI_PSo PSo */
+GDI_ROP3_KERNEL(FD, P | (S | ~D)) /* GDI_PSDnoo PSDnoo */
+GDI_ROP3_KERNEL(FE, D | (P | S)) /* GDI_DPSoo DPSoo */
+GDI_ROP3_KERNEL(FF, 0xFFFFFFFF) /* GDI_WHITENESS 1 */
+
+#undef D
+#undef S
+#undef P
+
+static const gdiRop3Kernel gdi_rop3_generic[256] =
+{
+	gdi_rop3_00, gdi_rop3_01, gdi_rop3_02, gdi_rop3_03, gdi_rop3_04, gdi_rop3_05, gdi_rop3_06, gdi_rop3_07,
+	gdi_rop3_08, gdi_rop3_09, gdi_rop3_0A, gdi_rop3_0B, gdi_rop3_0C, gdi_rop3_0D, gdi_rop3_0E, gdi_rop3_0F,
+	gdi_rop3_10, gdi_rop3_11, gdi_rop3_12, gdi_rop3_13, gdi_rop3_14, gdi_rop3_15, gdi_rop3_16, gdi_rop3_17,
+	gdi_rop3_18, gdi_rop3_19, gdi_rop3_1A, gdi_rop3_1B, gdi_rop3_1C, gdi_rop3_1D, gdi_rop3_1E, gdi_rop3_1F,
+	gdi_rop3_20, gdi_rop3_21, gdi_rop3_22, gdi_rop3_23, gdi_rop3_24, gdi_rop3_25, gdi_rop3_26, gdi_rop3_27,
+	gdi_rop3_28, gdi_rop3_29, gdi_rop3_2A, gdi_rop3_2B, gdi_rop3_2C, gdi_rop3_2D, gdi_rop3_2E, gdi_rop3_2F,
+	gdi_rop3_30, gdi_rop3_31, gdi_rop3_32, gdi_rop3_33, gdi_rop3_34, gdi_rop3_35, gdi_rop3_36, gdi_rop3_37,
+	gdi_rop3_38, gdi_rop3_39, gdi_rop3_3A, gdi_rop3_3B, gdi_rop3_3C, gdi_rop3_3D, gdi_rop3_3E, gdi_rop3_3F,
+	gdi_rop3_40, gdi_rop3_41, gdi_rop3_42, gdi_rop3_43, gdi_rop3_44, gdi_rop3_45, gdi_rop3_46, gdi_rop3_47,
+	gdi_rop3_48, gdi_rop3_49, gdi_rop3_4A, gdi_rop3_4B, gdi_rop3_4C, gdi_rop3_4D, gdi_rop3_4E, gdi_rop3_4F,
+	gdi_rop3_50, gdi_rop3_51, gdi_rop3_52, gdi_rop3_53, gdi_rop3_54, gdi_rop3_55, gdi_rop3_56, gdi_rop3_57,
+	gdi_rop3_58, gdi_rop3_59, gdi_rop3_5A, gdi_rop3_5B, gdi_rop3_5C, gdi_rop3_5D, gdi_rop3_5E, gdi_rop3_5F,
+	gdi_rop3_60, gdi_rop3_61, gdi_rop3_62, gdi_rop3_63, gdi_rop3_64, gdi_rop3_65, gdi_rop3_66, gdi_rop3_67,
+	gdi_rop3_68, gdi_rop3_69, gdi_rop3_6A, gdi_rop3_6B, gdi_rop3_6C, gdi_rop3_6D, gdi_rop3_6E, gdi_rop3_6F,
+	gdi_rop3_70, gdi_rop3_71, gdi_rop3_72, gdi_rop3_73, gdi_rop3_74, gdi_rop3_75, gdi_rop3_76, gdi_rop3_77,
+	gdi_rop3_78, gdi_rop3_79, gdi_rop3_7A, gdi_rop3_7B, gdi_rop3_7C, gdi_rop3_7D, gdi_rop3_7E, gdi_rop3_7F,
+	gdi_rop3_80, gdi_rop3_81, gdi_rop3_82, gdi_rop3_83, gdi_rop3_84, gdi_rop3_85, gdi_rop3_86, gdi_rop3_87,
+	gdi_rop3_88, gdi_rop3_89, gdi_rop3_8A, gdi_rop3_8B, gdi_rop3_8C, gdi_rop3_8D, gdi_rop3_8E, gdi_rop3_8F,
+	gdi_rop3_90, gdi_rop3_91, gdi_rop3_92, gdi_rop3_93, gdi_rop3_94, gdi_rop3_95, gdi_rop3_96, gdi_rop3_97,
+	gdi_rop3_98, gdi_rop3_99, gdi_rop3_9A, gdi_rop3_9B, gdi_rop3_9C, gdi_rop3_9D, gdi_rop3_9E, gdi_rop3_9F,
+	gdi_rop3_A0, gdi_rop3_A1, gdi_rop3_A2, gdi_rop3_A3, gdi_rop3_A4, gdi_rop3_A5, gdi_rop3_A6, gdi_rop3_A7,
+	gdi_rop3_A8, gdi_rop3_A9, gdi_rop3_AA, gdi_rop3_AB, gdi_rop3_AC, gdi_rop3_AD, gdi_rop3_AE, gdi_rop3_AF,
+	gdi_rop3_B0, gdi_rop3_B1, gdi_rop3_B2, gdi_rop3_B3, gdi_rop3_B4, gdi_rop3_B5, gdi_rop3_B6, gdi_rop3_B7,
+	gdi_rop3_B8, gdi_rop3_B9, gdi_rop3_BA, gdi_rop3_BB, gdi_rop3_BC, gdi_rop3_BD, gdi_rop3_BE, gdi_rop3_BF,
+	gdi_rop3_C0, gdi_rop3_C1, gdi_rop3_C2, gdi_rop3_C3, gdi_rop3_C4, gdi_rop3_C5, gdi_rop3_C6, gdi_rop3_C7,
+	gdi_rop3_C8, gdi_rop3_C9, gdi_rop3_CA, gdi_rop3_CB, gdi_rop3_CC, gdi_rop3_CD, gdi_rop3_CE, gdi_rop3_CF,
+	gdi_rop3_D0, gdi_rop3_D1, gdi_rop3_D2, gdi_rop3_D3, gdi_rop3_D4, gdi_rop3_D5, gdi_rop3_D6, gdi_rop3_D7,
+	gdi_rop3_D8, gdi_rop3_D9, gdi_rop3_DA, gdi_rop3_DB, gdi_rop3_DC, gdi_rop3_DD, gdi_rop3_DE, gdi_rop3_DF,
+	gdi_rop3_E0, gdi_rop3_E1, gdi_rop3_E2, gdi_rop3_E3, gdi_rop3_E4, gdi_rop3_E5, gdi_rop3_E6, gdi_rop3_E7,
+	gdi_rop3_E8, gdi_rop3_E9, gdi_rop3_EA, gdi_rop3_EB, gdi_rop3_EC, gdi_rop3_ED, gdi_rop3_EE, gdi_rop3_EF,
+	gdi_rop3_F0, gdi_rop3_F1, gdi_rop3_F2, gdi_rop3_F3, gdi_rop3_F4, gdi_rop3_F5, gdi_rop3_F6, gdi_rop3_F7,
+	gdi_rop3_F8, gdi_rop3_F9, gdi_rop3_FA, gdi_rop3_FB, gdi_rop3_FC, gdi_rop3_FD, gdi_rop3_FE, gdi_rop3_FF
+};
+
+static gdiRop3Kernel gdi_rop3_kernels[256];
+static INIT_ONCE gdi_rop3_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK gdi_rop3_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	CopyMemory(gdi_rop3_kernels, gdi_rop3_generic, sizeof(gdi_rop3_kernels));
+#ifdef WITH_SSE2
+
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		gdi_rop3_init_sse2(gdi_rop3_kernels);
+
+#endif
+	return TRUE;
+}
+
+/**
+ * Get the row kernel for a raster operation code.
+ * @param rop raster operation code
+ * @return the kernel, NULL for unknown codes
+ */
+
+gdiRop3Kernel gdi_get_rop3_kernel(DWORD rop)
+{
+	BYTE code;
+	InitOnceExecuteOnce(&gdi_rop3_once, gdi_rop3_init, NULL, NULL);
+
+	/* SPaDSnao, same truth table as DSPDxax */
+	if (rop == GDI_GLYPH_ORDER)
+		return gdi_rop3_kernels[0xE2];
+
+	code = (BYTE)((rop >> 16) & 0xFF);
+
+	if (gdi_rop3_code(code) != rop)
+		return NULL;
+
+	return gdi_rop3_kernels[code];
+}
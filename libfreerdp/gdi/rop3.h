@@ -0,0 +1,46 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI ROP3 Raster Operation Kernels
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_GDI_ROP3_H
+#define FREERDP_LIB_GDI_ROP3_H
+
+#include <freerdp/api.h>
+#include <freerdp/gdi/gdi.h>
+
+/**
+ * Applies a raster operation to a row of count pixels.
+ * dst holds the destination pixels and receives the result, src and pat hold
+ * the source and pattern pixels converted to the destination format. Pixels
+ * are combined bitwise, src and pat may be NULL if the operation ignores them.
+ */
+typedef void (*gdiRop3Kernel)(UINT32* dst, const UINT32* src, const UINT32* pat, UINT32 count);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+FREERDP_LOCAL gdiRop3Kernel gdi_get_rop3_kernel(DWORD rop);
+
+#ifdef WITH_SSE2
+FREERDP_LOCAL void gdi_rop3_init_sse2(gdiRop3Kernel kernels[256]);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_LIB_GDI_ROP3_H */
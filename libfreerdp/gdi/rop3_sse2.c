@@ -0,0 +1,78 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * GDI ROP3 Raster Operation Kernels - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+
+#include <emmintrin.h>
+
+#include "rop3.h"
+
+/**
+ * The raster operations used by most legacy drawing orders, four pixels at
+ * a time. Rows are not aligned, the remainder is done one pixel at a time.
+ */
+
+#define D dst[x]
+#define S src[x]
+#define P pat[x]
+
+#define VD _mm_loadu_si128((const __m128i*) &dst[x])
+#define VS _mm_loadu_si128((const __m128i*) &src[x])
+#define VP _mm_loadu_si128((const __m128i*) &pat[x])
+
+#define GDI_ROP3_SSE2_KERNEL(_name, _vexpr, _expr) \
+	static void gdi_rop3_##_name##_sse2(UINT32* dst, const UINT32* src, const UINT32* pat, \
+	                                     UINT32 count) \
+	{ \
+		UINT32 x = 0; \
+		for (; x + 4 <= count; x += 4) \
+			_mm_storeu_si128((__m128i*) &dst[x], (_vexpr)); \
+		for (; x < count; x++) \
+			dst[x] = (_expr); \
+	}
+
+GDI_ROP3_SSE2_KERNEL(SRCCOPY, VS, S)
+GDI_ROP3_SSE2_KERNEL(SRCINVERT, _mm_xor_si128(VS, VD), S ^ D)
+GDI_ROP3_SSE2_KERNEL(SRCAND, _mm_and_si128(VS, VD), S & D)
+GDI_ROP3_SSE2_KERNEL(SRCPAINT, _mm_or_si128(VS, VD), S | D)
+GDI_ROP3_SSE2_KERNEL(PATCOPY, VP, P)
+GDI_ROP3_SSE2_KERNEL(PATINVERT, _mm_xor_si128(VP, VD), P ^ D)
+GDI_ROP3_SSE2_KERNEL(DSTINVERT, _mm_xor_si128(VD, _mm_set1_epi32(-1)), ~D)
+GDI_ROP3_SSE2_KERNEL(MERGECOPY, _mm_and_si128(VP, VS), P & S)
+
+#undef D
+#undef S
+#undef P
+#undef VD
+#undef VS
+#undef VP
+
+void gdi_rop3_init_sse2(gdiRop3Kernel kernels[256])
+{
+	kernels[(GDI_SRCCOPY >> 16) & 0xFF] = gdi_rop3_SRCCOPY_sse2;
+	kernels[(GDI_SRCINVERT >> 16) & 0xFF] = gdi_rop3_SRCINVERT_sse2;
+	kernels[(GDI_SRCAND >> 16) & 0xFF] = gdi_rop3_SRCAND_sse2;
+	kernels[(GDI_SRCPAINT >> 16) & 0xFF] = gdi_rop3_SRCPAINT_sse2;
+	kernels[(GDI_PATCOPY >> 16) & 0xFF] = gdi_rop3_PATCOPY_sse2;
+	kernels[(GDI_PATINVERT >> 16) & 0xFF] = gdi_rop3_PATINVERT_sse2;
+	kernels[(GDI_DSTINVERT >> 16) & 0xFF] = gdi_rop3_DSTINVERT_sse2;
+	kernels[(GDI_MERGECOPY >> 16) & 0xFF] = gdi_rop3_MERGECOPY_sse2;
+}
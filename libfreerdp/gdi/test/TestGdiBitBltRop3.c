@@ -0,0 +1,368 @@
+
+#include <freerdp/gdi/gdi.h>
+
+#include <freerdp/gdi/dc.h>
+#include <freerdp/gdi/bitmap.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+
+#include "brush.h"
+
+#define TEST_WIDTH	37
+#define TEST_HEIGHT	13
+
+#define BENCH_WIDTH	1024
+#define BENCH_HEIGHT	768
+#define BENCH_RUNS	20
+
+/**
+ * Reference implementation of a raster operation, interprets the reverse
+ * polish notation of the operation per pixel the way gdi_BitBlt used to.
+ */
+static UINT32 reference_rop(const char* rop, UINT32 dst, UINT32 src, UINT32 pat, UINT32 format)
+{
+	UINT32 stack[10] = { 0 };
+	UINT32 stackp = 0;
+
+	while (*rop != '\0')
+	{
+		switch (*rop++)
+		{
+			case '0':
+				stack[stackp++] = FreeRDPGetColor(format, 0, 0, 0, 0xFF);
+				break;
+
+			case '1':
+				stack[stackp++] = FreeRDPGetColor(format, 0xFF, 0xFF, 0xFF, 0xFF);
+				break;
+
+			case 'D':
+				stack[stackp++] = dst;
+				break;
+
+			case 'S':
+				stack[stackp++] = src;
+				break;
+
+			case 'P':
+				stack[stackp++] = pat;
+				break;
+
+			case 'n':
+				stack[stackp - 1] = ~stack[stackp - 1];
+				break;
+
+			case 'a':
+				stackp--;
+				stack[stackp - 1] &= stack[stackp];
+				break;
+
+			case 'o':
+				stackp--;
+				stack[stackp - 1] |= stack[stackp];
+				break;
+
+			case 'x':
+				stackp--;
+				stack[stackp - 1] ^= stack[stackp];
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return stack[0];
+}
+
+/* src may be the original destination for blits within one bitmap */
+static void reference_blt(HGDI_BITMAP hDst, const BYTE* dst, const BYTE* src, UINT32 srcFormat,
+                          UINT32 srcStride, INT32 nXDest, INT32 nYDest, INT32 nWidth,
+                          INT32 nHeight, INT32 nXSrc, INT32 nYSrc, HGDI_BRUSH brush,
+                          const char* rop)
+{
+	INT32 x, y;
+	const UINT32 dstBpp = GetBytesPerPixel(hDst->format);
+	const UINT32 srcBpp = GetBytesPerPixel(srcFormat);
+
+	for (y = 0; y < nHeight; y++)
+	{
+		for (x = 0; x < nWidth; x++)
+		{
+			UINT32 color;
+			UINT32 pat = brush->color;
+			const size_t dstOffset = (nYDest + y) * hDst->scanline + (nXDest + x) * dstBpp;
+			const BYTE* srcp = &src[(nYSrc + y) * srcStride + (nXSrc + x) * srcBpp];
+			UINT32 s = ReadColor(srcp, srcFormat);
+			s = FreeRDPConvertColor(s, srcFormat, hDst->format, NULL);
+
+			if (brush->style == GDI_BS_PATTERN)
+			{
+				const HGDI_BITMAP hPat = brush->pattern;
+				const UINT32 px = (nXDest + x) % hPat->width;
+				const UINT32 py = (nYDest + y) % hPat->height;
+				pat = ReadColor(&hPat->data[py * hPat->scanline + px * dstBpp], hDst->format);
+			}
+
+			color = reference_rop(rop, ReadColor(&dst[dstOffset], hDst->format), s, pat, hDst->format);
+			WriteColor(&hDst->data[dstOffset], hDst->format, color);
+		}
+	}
+}
+
+static HGDI_BITMAP test_create_bitmap(UINT32 width, UINT32 height, UINT32 format, UINT32 seed)
+{
+	UINT32 x;
+	HGDI_BITMAP hBmp;
+	const size_t size = 1ULL * width * height * GetBytesPerPixel(format);
+	BYTE* data = _aligned_malloc(size, 16);
+
+	if (!data)
+		return NULL;
+
+	for (x = 0; x < size; x++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[x] = (BYTE)(seed >> 16);
+	}
+
+	if (!(hBmp = gdi_CreateBitmap(width, height, format, data)))
+		_aligned_free(data);
+
+	return hBmp;
+}
+
+static BOOL test_compare(HGDI_BITMAP hBmp, const BYTE* expected, const char* name, UINT32 format)
+{
+	if (memcmp(hBmp->data, expected, hBmp->scanline * hBmp->height) == 0)
+		return TRUE;
+
+	fprintf(stderr, "%s: result mismatch for %s\n", name, FreeRDPGetColorFormatName(format));
+	return FALSE;
+}
+
+/**
+ * Blit every raster operation with a solid and a pattern brush between two
+ * bitmaps and within the destination bitmap, compare against the reference.
+ */
+static BOOL test_rop3_kernels(UINT32 srcFormat, UINT32 dstFormat)
+{
+	UINT32 i, j;
+	BOOL rc = FALSE;
+	HGDI_DC hdcSrc = NULL;
+	HGDI_DC hdcDst = NULL;
+	HGDI_BITMAP hBmpSrc = NULL;
+	HGDI_BITMAP hBmpDst = NULL;
+	HGDI_BITMAP hBmpPat = NULL;
+	HGDI_BRUSH brushes[2] = { NULL, NULL };
+	BYTE* original = NULL;
+	BYTE* expected = NULL;
+	size_t size;
+
+	if (!(hdcSrc = gdi_GetDC()) || !(hdcDst = gdi_GetDC()))
+		goto fail;
+
+	hdcSrc->format = srcFormat;
+	hdcDst->format = dstFormat;
+
+	if (!(hBmpSrc = test_create_bitmap(TEST_WIDTH, TEST_HEIGHT, srcFormat, 1)) ||
+	    !(hBmpDst = test_create_bitmap(TEST_WIDTH, TEST_HEIGHT, dstFormat, 2)) ||
+	    !(hBmpPat = test_create_bitmap(8, 8, dstFormat, 3)))
+		goto fail;
+
+	size = hBmpDst->scanline * hBmpDst->height;
+
+	if (!(original = malloc(size)) || !(expected = malloc(size)))
+		goto fail;
+
+	CopyMemory(original, hBmpDst->data, size);
+
+	if (!(brushes[0] = gdi_CreateSolidBrush(FreeRDPGetColor(dstFormat, 0x12, 0x34, 0x56, 0xFF))) ||
+	    !(brushes[1] = gdi_CreatePatternBrush(hBmpPat)))
+		goto fail;
+
+	gdi_SelectObject(hdcSrc, (HGDIOBJECT) hBmpSrc);
+	gdi_SelectObject(hdcDst, (HGDIOBJECT) hBmpDst);
+
+	for (j = 0; j < ARRAYSIZE(brushes); j++)
+	{
+		hdcDst->brush = brushes[j];
+
+		for (i = 0; i < 256; i++)
+		{
+			const DWORD rop = gdi_rop3_code((BYTE) i);
+			const char* name = gdi_rop3_code_string((BYTE) i);
+
+			/* both have their own implementation */
+			if ((rop == GDI_SRCCOPY) || (rop == GDI_DSTCOPY))
+				continue;
+
+			CopyMemory(hBmpDst->data, original, size);
+			reference_blt(hBmpDst, original, hBmpSrc->data, srcFormat, hBmpSrc->scanline,
+			              0, 0, TEST_WIDTH - 2, TEST_HEIGHT - 1, 2, 1, hdcDst->brush, name);
+			CopyMemory(expected, hBmpDst->data, size);
+			CopyMemory(hBmpDst->data, original, size);
+
+			if (!gdi_BitBlt(hdcDst, 0, 0, TEST_WIDTH - 2, TEST_HEIGHT - 1, hdcSrc, 2, 1, rop,
+			                NULL) || !test_compare(hBmpDst, expected, name, dstFormat))
+				goto fail;
+
+			if (srcFormat != dstFormat)
+				continue;
+
+			/* overlapping blits, in both directions */
+			CopyMemory(hBmpDst->data, original, size);
+			reference_blt(hBmpDst, original, original, dstFormat, hBmpDst->scanline,
+			              3, 2, TEST_WIDTH - 3, TEST_HEIGHT - 2, 0, 0, hdcDst->brush, name);
+			CopyMemory(expected, hBmpDst->data, size);
+			CopyMemory(hBmpDst->data, original, size);
+
+			if (!gdi_BitBlt(hdcDst, 3, 2, TEST_WIDTH - 3, TEST_HEIGHT - 2, hdcDst, 0, 0, rop,
+			                NULL) || !test_compare(hBmpDst, expected, name, dstFormat))
+				goto fail;
+
+			CopyMemory(hBmpDst->data, original, size);
+			reference_blt(hBmpDst, original, original, dstFormat, hBmpDst->scanline,
+			              0, 0, TEST_WIDTH - 3, TEST_HEIGHT - 2, 3, 2, hdcDst->brush, name);
+			CopyMemory(expected, hBmpDst->data, size);
+			CopyMemory(hBmpDst->data, original, size);
+
+			if (!gdi_BitBlt(hdcDst, 0, 0, TEST_WIDTH - 3, TEST_HEIGHT - 2, hdcDst, 3, 2, rop,
+			                NULL) || !test_compare(hBmpDst, expected, name, dstFormat))
+				goto fail;
+		}
+	}
+
+	if (gdi_BitBlt(hdcDst, 0, 0, TEST_WIDTH, TEST_HEIGHT, hdcSrc, 0, 0, 0x00AA0000, NULL))
+	{
+		fprintf(stderr, "invalid raster operation accepted\n");
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (hdcDst)
+		hdcDst->brush = NULL;
+
+	gdi_DeleteObject((HGDIOBJECT) brushes[0]);
+	gdi_DeleteObject((HGDIOBJECT) brushes[1]);
+	gdi_DeleteObject((HGDIOBJECT) hBmpPat);
+	gdi_DeleteObject((HGDIOBJECT) hBmpSrc);
+	gdi_DeleteObject((HGDIOBJECT) hBmpDst);
+	gdi_DeleteDC(hdcSrc);
+	gdi_DeleteDC(hdcDst);
+	free(original);
+	free(expected);
+	return rc;
+}
+
+/**
+ * Time the raster operations common in legacy drawing orders against the
+ * per pixel reference.
+ */
+static BOOL test_rop3_speed(void)
+{
+	UINT32 i, j;
+	BOOL rc = FALSE;
+	HGDI_DC hdcSrc = NULL;
+	HGDI_DC hdcDst = NULL;
+	HGDI_BITMAP hBmpSrc = NULL;
+	HGDI_BITMAP hBmpDst = NULL;
+	HGDI_BRUSH brush = NULL;
+	BYTE* original = NULL;
+	const UINT32 format = PIXEL_FORMAT_BGRX32;
+	const DWORD rops[] =
+	{
+		GDI_SRCINVERT, GDI_SRCAND, GDI_SRCPAINT, GDI_PATCOPY, GDI_PATINVERT,
+		GDI_DSTINVERT, GDI_MERGECOPY, GDI_DSPDxax, GDI_PSDPxax
+	};
+
+	if (!(hdcSrc = gdi_GetDC()) || !(hdcDst = gdi_GetDC()))
+		goto fail;
+
+	hdcSrc->format = format;
+	hdcDst->format = format;
+
+	if (!(hBmpSrc = test_create_bitmap(BENCH_WIDTH, BENCH_HEIGHT, format, 1)) ||
+	    !(hBmpDst = test_create_bitmap(BENCH_WIDTH, BENCH_HEIGHT, format, 2)) ||
+	    !(brush = gdi_CreateSolidBrush(FreeRDPGetColor(format, 0x12, 0x34, 0x56, 0xFF))))
+		goto fail;
+
+	if (!(original = malloc(hBmpDst->scanline * hBmpDst->height)))
+		goto fail;
+
+	CopyMemory(original, hBmpDst->data, hBmpDst->scanline * hBmpDst->height);
+	gdi_SelectObject(hdcSrc, (HGDIOBJECT) hBmpSrc);
+	gdi_SelectObject(hdcDst, (HGDIOBJECT) hBmpDst);
+	hdcDst->brush = brush;
+
+	for (i = 0; i < ARRAYSIZE(rops); i++)
+	{
+		UINT64 start, kernel, reference;
+		const char* name = gdi_rop_to_string(rops[i]);
+		start = GetTickCount64();
+
+		for (j = 0; j < BENCH_RUNS; j++)
+		{
+			if (!gdi_BitBlt(hdcDst, 0, 0, BENCH_WIDTH, BENCH_HEIGHT, hdcSrc, 0, 0, rops[i], NULL))
+				goto fail;
+		}
+
+		kernel = GetTickCount64() - start;
+		start = GetTickCount64();
+		reference_blt(hBmpDst, original, hBmpSrc->data, format, hBmpSrc->scanline, 0, 0,
+		              BENCH_WIDTH, BENCH_HEIGHT, 0, 0, brush, name);
+		reference = (GetTickCount64() - start) * BENCH_RUNS;
+		printf("%-10s %dx%d: %6"PRIu64" us, reference %6"PRIu64" us (%"PRIu64"x)\n", name,
+		       BENCH_WIDTH, BENCH_HEIGHT, kernel * 1000 / BENCH_RUNS, reference * 1000 / BENCH_RUNS,
+		       reference / (kernel ? kernel : 1));
+	}
+
+	rc = TRUE;
+fail:
+
+	if (hdcDst)
+		hdcDst->brush = NULL;
+
+	gdi_DeleteObject((HGDIOBJECT) brush);
+	gdi_DeleteObject((HGDIOBJECT) hBmpSrc);
+	gdi_DeleteObject((HGDIOBJECT) hBmpDst);
+	gdi_DeleteDC(hdcSrc);
+	gdi_DeleteDC(hdcDst);
+	free(original);
+	return rc;
+}
+
+int TestGdiBitBltRop3(int argc, char* argv[])
+{
+	UINT32 x;
+	const UINT32 formatList[][2] =
+	{
+		{ PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_BGRX32 },
+		{ PIXEL_FORMAT_RGBA32, PIXEL_FORMAT_RGBA32 },
+		{ PIXEL_FORMAT_BGR24, PIXEL_FORMAT_BGR24 },
+		{ PIXEL_FORMAT_RGB16, PIXEL_FORMAT_RGB16 },
+		{ PIXEL_FORMAT_RGB16, PIXEL_FORMAT_BGRA32 },
+		{ PIXEL_FORMAT_XRGB32, PIXEL_FORMAT_BGR16 }
+	};
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	for (x = 0; x < ARRAYSIZE(formatList); x++)
+	{
+		if (!test_rop3_kernels(formatList[x][0], formatList[x][1]))
+		{
+			fprintf(stderr, "test_rop3_kernels(SrcFormat=%s, DstFormat=%s) failed!\n",
+			        FreeRDPGetColorFormatName(formatList[x][0]),
+			        FreeRDPGetColorFormatName(formatList[x][1]));
+			return -1;
+		}
+	}
+
+	if (!test_rop3_speed())
+		return -1;
+
+	return 0;
+}
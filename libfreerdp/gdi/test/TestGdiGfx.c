@@ -0,0 +1,399 @@
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codecs.h>
+#include <freerdp/gdi/gdi.h>
+#include <freerdp/gdi/gfx.h>
+#include <freerdp/codec/rfx.h>
+
+#include "../../codec/rfx_types.h"
+
+#define TEST_SURFACE_ID 1
+#define TEST_WIDTH 256
+#define TEST_HEIGHT 128
+
+struct test_gfx
+{
+	rdpContext context;
+	rdpGdi gdi;
+	RdpgfxClientContext gfx;
+	void* surface;
+	BYTE* message;
+	UINT32 messageLength;
+	HANDLE release;
+	PTP_WORK blocker;
+
+	pcRdpgfxDeleteSurface DeleteSurface;
+	UINT32 updates;
+	UINT32 updatePending;
+	BOOL updateEmpty;
+};
+
+static struct test_gfx* testGfx = NULL;
+
+static UINT test_SetSurfaceData(RdpgfxClientContext* context, UINT16 surfaceId, void* pData)
+{
+	WINPR_UNUSED(context);
+
+	if (surfaceId != TEST_SURFACE_ID)
+		return ERROR_INVALID_PARAMETER;
+
+	testGfx->surface = pData;
+	return CHANNEL_RC_OK;
+}
+
+static void* test_GetSurfaceData(RdpgfxClientContext* context, UINT16 surfaceId)
+{
+	WINPR_UNUSED(context);
+	return (surfaceId == TEST_SURFACE_ID) ? testGfx->surface : NULL;
+}
+
+static UINT test_GetSurfaceIds(RdpgfxClientContext* context, UINT16** ppSurfaceIds,
+                               UINT16* count_out)
+{
+	WINPR_UNUSED(context);
+	*ppSurfaceIds = NULL;
+	*count_out = 0;
+
+	if (!testGfx->surface)
+		return CHANNEL_RC_OK;
+
+	if (!(*ppSurfaceIds = calloc(1, sizeof(UINT16))))
+		return CHANNEL_RC_NO_MEMORY;
+
+	(*ppSurfaceIds)[0] = TEST_SURFACE_ID;
+	*count_out = 1;
+	return CHANNEL_RC_OK;
+}
+
+static UINT32 test_pending(void)
+{
+	return testGfx->context.codecs->rfx->priv->PipelineCount;
+}
+
+/* like a client that presents the surfaces itself */
+static UINT test_UpdateSurfaces(RdpgfxClientContext* context)
+{
+	gdiGfxSurface* surface = (gdiGfxSurface*) context->GetSurfaceData(context, TEST_SURFACE_ID);
+	UINT status = gdi_graphics_pipeline_flush((rdpGdi*) context->custom);
+
+	if (status != CHANNEL_RC_OK)
+		return status;
+
+	testGfx->updates++;
+	testGfx->updatePending = test_pending();
+	testGfx->updateEmpty = !surface || region16_is_empty(&surface->invalidRegion);
+
+	if (surface)
+		region16_clear(&surface->invalidRegion);
+
+	return CHANNEL_RC_OK;
+}
+
+/* like a client that frees its own surfaces */
+static UINT test_DeleteSurface(RdpgfxClientContext* context,
+                               const RDPGFX_DELETE_SURFACE_PDU* deleteSurface)
+{
+	UINT status = gdi_graphics_pipeline_flush((rdpGdi*) context->custom);
+
+	if ((status != CHANNEL_RC_OK) || (test_pending() != 0))
+		return ERROR_INTERNAL_ERROR;
+
+	return testGfx->DeleteSurface(context, deleteSurface);
+}
+
+static void CALLBACK test_blocker(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	WaitForSingleObject((HANDLE) context, INFINITE);
+}
+
+/* a RemoteFX message with the headers and a few tiles */
+static BOOL test_encode_message(struct test_gfx* test)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	RFX_RECT rect = { 0, 0, TEST_WIDTH, TEST_HEIGHT };
+	const UINT32 stride = TEST_WIDTH * 4;
+	BYTE* image = malloc(stride * TEST_HEIGHT);
+	RFX_CONTEXT* encoder = rfx_context_new(TRUE);
+	wStream* s = Stream_New(NULL, 1024);
+
+	if (!image || !encoder || !s || !rfx_context_reset(encoder, TEST_WIDTH, TEST_HEIGHT))
+		goto fail;
+
+	rfx_context_set_pixel_format(encoder, PIXEL_FORMAT_BGRX32);
+
+	for (x = 0; x < stride * TEST_HEIGHT; x++)
+		image[x] = (BYTE)(x * 7 + x / stride);
+
+	if (!rfx_compose_message(encoder, s, &rect, 1, image, TEST_WIDTH, TEST_HEIGHT, (int) stride))
+		goto fail;
+
+	test->messageLength = (UINT32) Stream_GetPosition(s);
+	test->message = Stream_Buffer(s);
+	Stream_Free(s, FALSE);
+	s = NULL;
+	rc = TRUE;
+fail:
+	Stream_Free(s, TRUE);
+	rfx_context_free(encoder);
+	free(image);
+	return rc;
+}
+
+static void test_gfx_free(struct test_gfx* test)
+{
+	if (!test)
+		return;
+
+	if (test->blocker)
+	{
+		SetEvent(test->release);
+		WaitForThreadpoolWorkCallbacks(test->blocker, FALSE);
+		CloseThreadpoolWork(test->blocker);
+	}
+
+	if (test->surface)
+	{
+		RDPGFX_DELETE_SURFACE_PDU pdu = { TEST_SURFACE_ID };
+		test->gfx.DeleteSurface(&test->gfx, &pdu);
+	}
+
+	gdi_graphics_pipeline_uninit(&test->gdi, &test->gfx);
+	codecs_free(test->context.codecs);
+	freerdp_settings_free(test->context.settings);
+
+	if (test->release)
+		CloseHandle(test->release);
+
+	free(test->message);
+	free(test);
+	testGfx = NULL;
+}
+
+/**
+ * A pipeline whose only decoding thread is held by a blocker, so the RemoteFX tiles of a
+ * surface command stay in flight until test_gfx_release.
+ */
+static struct test_gfx* test_gfx_new(void)
+{
+	RDPGFX_CREATE_SURFACE_PDU create = { 0 };
+	struct test_gfx* test = calloc(1, sizeof(struct test_gfx));
+	RFX_CONTEXT_PRIV* priv;
+
+	if (!(testGfx = test))
+		return NULL;
+
+	if (!(test->context.settings = freerdp_settings_new(0)))
+		goto fail;
+
+	test->context.settings->RemoteFxPipelineDepth = 2;
+	test->context.gdi = &test->gdi;
+	test->gdi.context = &test->context;
+
+	if (!(test->context.codecs = codecs_new(&test->context)) ||
+	    !freerdp_client_codecs_prepare(test->context.codecs, FREERDP_CODEC_REMOTEFX, TEST_WIDTH,
+	                                   TEST_HEIGHT))
+		goto fail;
+
+	priv = test->context.codecs->rfx->priv;
+
+	if (!priv->UseThreads)
+		goto fail;
+
+	/* a pool of a single thread instead of one per processor */
+	CloseThreadpool(priv->ThreadPool);
+
+	if (!(priv->ThreadPool = CreateThreadpool(NULL)))
+		goto fail;
+
+	SetThreadpoolThreadMaximum(priv->ThreadPool, 1);
+	SetThreadpoolCallbackPool(&priv->ThreadPoolEnv, priv->ThreadPool);
+
+	if (!(test->release = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+	    !(test->blocker = CreateThreadpoolWork(test_blocker, test->release, &priv->ThreadPoolEnv)))
+		goto fail;
+
+	if (!gdi_graphics_pipeline_init(&test->gdi, &test->gfx) || !test_encode_message(test))
+		goto fail;
+
+	test->gfx.SetSurfaceData = test_SetSurfaceData;
+	test->gfx.GetSurfaceData = test_GetSurfaceData;
+	test->gfx.GetSurfaceIds = test_GetSurfaceIds;
+	test->gdi.graphicsReset = TRUE;
+	create.surfaceId = TEST_SURFACE_ID;
+	create.width = TEST_WIDTH;
+	create.height = TEST_HEIGHT;
+	create.pixelFormat = GFX_PIXEL_FORMAT_XRGB_8888;
+
+	if (test->gfx.CreateSurface(&test->gfx, &create) != CHANNEL_RC_OK)
+		goto fail;
+
+	SubmitThreadpoolWork(test->blocker);
+	return test;
+fail:
+	test_gfx_free(test);
+	return NULL;
+}
+
+static void test_gfx_release(struct test_gfx* test)
+{
+	SetEvent(test->release);
+}
+
+static DWORD WINAPI test_surface_command_thread(LPVOID arg)
+{
+	struct test_gfx* test = (struct test_gfx*) arg;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	cmd.surfaceId = TEST_SURFACE_ID;
+	cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.right = TEST_WIDTH;
+	cmd.bottom = TEST_HEIGHT;
+	cmd.width = TEST_WIDTH;
+	cmd.height = TEST_HEIGHT;
+	cmd.data = test->message;
+	cmd.length = test->messageLength;
+	return test->gfx.SurfaceCommand(&test->gfx, &cmd);
+}
+
+static DWORD WINAPI test_delete_surface_thread(LPVOID arg)
+{
+	struct test_gfx* test = (struct test_gfx*) arg;
+	RDPGFX_DELETE_SURFACE_PDU pdu = { TEST_SURFACE_ID };
+	return test->gfx.DeleteSurface(&test->gfx, &pdu);
+}
+
+static BOOL test_run(LPTHREAD_START_ROUTINE proc, struct test_gfx* test, BOOL release)
+{
+	DWORD status = ERROR_INTERNAL_ERROR;
+	HANDLE thread = CreateThread(NULL, 0, proc, test, 0, NULL);
+
+	if (!thread)
+		return FALSE;
+
+	if (release)
+	{
+		Sleep(50);
+		test_gfx_release(test);
+	}
+
+	WaitForSingleObject(thread, INFINITE);
+	GetExitCodeThread(thread, &status);
+	CloseHandle(thread);
+	return status == CHANNEL_RC_OK;
+}
+
+/* the surface must not be freed while its tiles are still being decoded into it */
+static BOOL test_gfx_delete_in_flight(BOOL clientCallbacks)
+{
+	BOOL rc = FALSE;
+	HANDLE thread = NULL;
+	RDPGFX_START_FRAME_PDU start = { 0 };
+	struct test_gfx* test = test_gfx_new();
+
+	if (!test)
+		goto fail;
+
+	if (clientCallbacks)
+	{
+		test->DeleteSurface = test->gfx.DeleteSurface;
+		test->gfx.DeleteSurface = test_DeleteSurface;
+	}
+
+	if ((test->gfx.StartFrame(&test->gfx, &start) != CHANNEL_RC_OK) ||
+	    !test_run(test_surface_command_thread, test, FALSE))
+		goto fail;
+
+	if (test_pending() != 1)
+	{
+		fprintf(stderr, "the RemoteFX message is not decoded in the background\n");
+		goto fail;
+	}
+
+	if (!(thread = CreateThread(NULL, 0, test_delete_surface_thread, test, 0, NULL)))
+		goto fail;
+
+	if (WaitForSingleObject(thread, 50) != WAIT_TIMEOUT)
+	{
+		fprintf(stderr, "the surface was deleted while it was decoded\n");
+		goto fail;
+	}
+
+	test_gfx_release(test);
+	WaitForSingleObject(thread, INFINITE);
+
+	if (test->surface || (test_pending() != 0))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (thread)
+	{
+		if (test)
+			test_gfx_release(test);
+
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	if (!rc)
+		fprintf(stderr, "%s(%d) failed\n", __FUNCTION__, clientCallbacks);
+
+	test_gfx_free(test);
+	return rc;
+}
+
+/* outside of a frame the surfaces are presented right away, with the message decoded */
+static BOOL test_gfx_outside_frame(void)
+{
+	BOOL rc = FALSE;
+	struct test_gfx* test = test_gfx_new();
+
+	if (!test)
+		goto fail;
+
+	test->gfx.UpdateSurfaces = test_UpdateSurfaces;
+
+	if (!test_run(test_surface_command_thread, test, TRUE))
+		goto fail;
+
+	if ((test->updates != 1) || (test->updatePending != 0) || test->updateEmpty)
+	{
+		fprintf(stderr, "%"PRIu32" updates, %"PRIu32" pending, empty %"PRId32"\n", test->updates,
+		        test->updatePending, test->updateEmpty);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __FUNCTION__);
+
+	test_gfx_free(test);
+	return rc;
+}
+
+int TestGdiGfx(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_gfx_delete_in_flight(FALSE))
+		return -1;
+
+	if (!test_gfx_delete_in_flight(TRUE))
+		return -1;
+
+	if (!test_gfx_outside_frame())
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,395 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Optimized YUV/RGB conversion operations using AVX2
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/crt.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+static __RGBToAVC444YUV_t fallback_RGBToAVC444YUV = NULL;
+
+/****************************************************************************/
+/* AVX2 YUV -> RGB conversion                                               */
+/****************************************************************************/
+
+/* Converts 16 pixels of 16 bit Y, U and V values, bit exact to YUV2R, YUV2G
+ * and YUV2B. The products are split so that they fit into 16 bit:
+ *
+ * R = (256 * Y + 403 * E) >> 8 = Y + E + ((147 * E) >> 8)
+ * G = (256 * Y - 48 * D - 120 * E) >> 8 = Y + ((-48 * D - 120 * E) >> 8)
+ * B = (256 * Y + 475 * D) >> 8 = Y + D + ((219 * D) >> 8)
+ */
+static INLINE BYTE* avx2_YUV444Pixel(BYTE* dst, __m256i Y, __m256i U, __m256i V, BOOL bgrx)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+	const __m256i D = _mm256_sub_epi16(U, c128);
+	const __m256i E = _mm256_sub_epi16(V, c128);
+	const __m256i r147 = _mm256_srai_epi16(_mm256_mullo_epi16(E, _mm256_set1_epi16(147)), 8);
+	const __m256i g48 = _mm256_mullo_epi16(D, _mm256_set1_epi16(48));
+	const __m256i g120 = _mm256_mullo_epi16(E, _mm256_set1_epi16(120));
+	const __m256i gde = _mm256_sub_epi16(_mm256_setzero_si256(), _mm256_add_epi16(g48, g120));
+	const __m256i b219 = _mm256_srai_epi16(_mm256_mullo_epi16(D, _mm256_set1_epi16(219)), 8);
+	const __m256i R = _mm256_add_epi16(_mm256_add_epi16(Y, E), r147);
+	const __m256i G = _mm256_add_epi16(Y, _mm256_srai_epi16(gde, 8));
+	const __m256i B = _mm256_add_epi16(_mm256_add_epi16(Y, D), b219);
+
+	/* the pack clips to [0, 255] */
+	if (bgrx)
+		return avx2_write_pixels(dst, B, G, R);
+
+	return avx2_write_pixels(dst, R, G, B);
+}
+
+static INLINE BYTE* avx2_writePixel(BYTE* dst, BYTE Y, BYTE U, BYTE V, BOOL bgrx)
+{
+	const BYTE r = YUV2R(Y, U, V);
+	const BYTE g = YUV2G(Y, U, V);
+	const BYTE b = YUV2B(Y, U, V);
+
+	if (bgrx)
+		return writePixelBGRX(dst, 4, PIXEL_FORMAT_BGRX32, r, g, b, 0xFF);
+
+	return writePixelRGBX(dst, 4, PIXEL_FORMAT_RGBX32, r, g, b, 0xFF);
+}
+
+static pstatus_t avx2_YUV420ToRGB_X(
+    const BYTE** pSrc, const UINT32* srcStep,
+    BYTE* pDst, UINT32 dstStep, BOOL bgrx,
+    const prim_size_t* roi)
+{
+	const UINT32 nWidth = roi->width;
+	const UINT32 nHeight = roi->height;
+	const UINT32 pad = roi->width % 16;
+	UINT32 y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		UINT32 x;
+		BYTE* dst = pDst + dstStep * y;
+		const BYTE* YData = pSrc[0] + y * srcStep[0];
+		const BYTE* UData = pSrc[1] + (y / 2) * srcStep[1];
+		const BYTE* VData = pSrc[2] + (y / 2) * srcStep[2];
+
+		for (x = 0; x < nWidth - pad; x += 16)
+		{
+			const __m128i uRaw = _mm_loadl_epi64((const __m128i*) UData);
+			const __m128i vRaw = _mm_loadl_epi64((const __m128i*) VData);
+			const __m256i Y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) YData));
+			/* each chroma value covers two pixels */
+			const __m256i U = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(uRaw, uRaw));
+			const __m256i V = _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(vRaw, vRaw));
+			dst = avx2_YUV444Pixel(dst, Y, U, V, bgrx);
+			YData += 16;
+			UData += 8;
+			VData += 8;
+		}
+
+		for (x = 0; x < pad; x++)
+		{
+			dst = avx2_writePixel(dst, *YData++, *UData, *VData, bgrx);
+
+			if (x % 2)
+			{
+				UData++;
+				VData++;
+			}
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_YUV420ToRGB(
+    const BYTE** pSrc, const UINT32* srcStep,
+    BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+    const prim_size_t* roi)
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_YUV420ToRGB_X(pSrc, srcStep, pDst, dstStep, TRUE, roi);
+
+		case PIXEL_FORMAT_RGBX32:
+		case PIXEL_FORMAT_RGBA32:
+			return avx2_YUV420ToRGB_X(pSrc, srcStep, pDst, dstStep, FALSE, roi);
+
+		default:
+			return generic->YUV420ToRGB_8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat, roi);
+	}
+}
+
+static pstatus_t avx2_YUV444ToRGB_8u_P3AC4R_X(
+    const BYTE** pSrc, const UINT32* srcStep,
+    BYTE* pDst, UINT32 dstStep, BOOL bgrx,
+    const prim_size_t* roi)
+{
+	const UINT32 nWidth = roi->width;
+	const UINT32 nHeight = roi->height;
+	const UINT32 pad = roi->width % 16;
+	UINT32 y;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		UINT32 x;
+		BYTE* dst = pDst + dstStep * y;
+		const BYTE* YData = pSrc[0] + y * srcStep[0];
+		const BYTE* UData = pSrc[1] + y * srcStep[1];
+		const BYTE* VData = pSrc[2] + y * srcStep[2];
+
+		for (x = 0; x < nWidth - pad; x += 16)
+		{
+			const __m256i Y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) YData));
+			const __m256i U = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) UData));
+			const __m256i V = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) VData));
+			dst = avx2_YUV444Pixel(dst, Y, U, V, bgrx);
+			YData += 16;
+			UData += 16;
+			VData += 16;
+		}
+
+		for (x = 0; x < pad; x++)
+			dst = avx2_writePixel(dst, *YData++, *UData++, *VData++, bgrx);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_YUV444ToRGB_8u_P3AC4R(const BYTE** pSrc, const UINT32* srcStep,
+        BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+        const prim_size_t* roi)
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_YUV444ToRGB_8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, TRUE, roi);
+
+		case PIXEL_FORMAT_RGBX32:
+		case PIXEL_FORMAT_RGBA32:
+			return avx2_YUV444ToRGB_8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, FALSE, roi);
+
+		default:
+			return generic->YUV444ToRGB_8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat, roi);
+	}
+}
+
+/****************************************************************************/
+/* AVX2 RGB -> AVC444-YUV conversion                                       **/
+/****************************************************************************/
+
+/* The factors of the SSSE3 version, see prim_YUV_ssse3.c */
+#define AVX2_BGRX_FACTORS(_a_, _b_, _c_) \
+	_mm256_setr_epi8(_a_, _b_, _c_, 0, _a_, _b_, _c_, 0, _a_, _b_, _c_, 0, _a_, _b_, _c_, 0, \
+	                 _a_, _b_, _c_, 0, _a_, _b_, _c_, 0, _a_, _b_, _c_, 0, _a_, _b_, _c_, 0)
+#define AVX2_BGRX_Y_FACTORS AVX2_BGRX_FACTORS(9, 92, 27)
+#define AVX2_BGRX_U_FACTORS AVX2_BGRX_FACTORS(127, -99, -29)
+#define AVX2_BGRX_V_FACTORS AVX2_BGRX_FACTORS(-12, -116, 127)
+
+#define Y_SHIFT 7
+#define UV_SHIFT 8
+
+/* The horizontal sums of 32 pixels work on each 128 bit lane and leave groups
+ * of 4 pixels in the order 0 2 4 6 | 1 3 5 7, this puts them back in order.
+ */
+static INLINE __m256i avx2_reorder(__m256i v)
+{
+	return _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+/* 32 luma values */
+static INLINE __m256i avx2_RGBToY(const __m256i x[4])
+{
+	const __m256i y_factors = AVX2_BGRX_Y_FACTORS;
+	const __m256i y1 = _mm256_srli_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x[0], y_factors),
+	                                     _mm256_maddubs_epi16(x[1], y_factors)), Y_SHIFT);
+	const __m256i y2 = _mm256_srli_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x[2], y_factors),
+	                                     _mm256_maddubs_epi16(x[3], y_factors)), Y_SHIFT);
+	return avx2_reorder(_mm256_packus_epi16(y1, y2));
+}
+
+/* 32 chroma values */
+static INLINE __m256i avx2_RGBToUV(const __m256i x[4], __m256i factors)
+{
+	const __m256i c1 = _mm256_srai_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x[0], factors),
+	                                     _mm256_maddubs_epi16(x[1], factors)), UV_SHIFT);
+	const __m256i c2 = _mm256_srai_epi16(_mm256_hadd_epi16(_mm256_maddubs_epi16(x[2], factors),
+	                                     _mm256_maddubs_epi16(x[3], factors)), UV_SHIFT);
+	return _mm256_sub_epi8(avx2_reorder(_mm256_packs_epi16(c1, c2)), _mm256_set1_epi8(-128));
+}
+
+/* 16 values of a 2x2 subsampled chroma plane from the even and odd row */
+static INLINE void avx2_store_average(BYTE* dst, __m256i even, __m256i odd)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(even, zero),
+	                                    _mm256_unpacklo_epi8(odd, zero));
+	const __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(even, zero),
+	                                    _mm256_unpackhi_epi8(odd, zero));
+	const __m256i avg16 = _mm256_srai_epi16(_mm256_hadd_epi16(lo, hi), 2);
+	const __m256i avg = _mm256_packus_epi16(avg16, avg16);
+	_mm_storeu_si128((__m128i*) dst, _mm256_castsi256_si128(_mm256_permute4x64_epi64(avg, 0x08)));
+}
+
+/* 16 values of the even (odd = 0) or odd (odd = 1) columns */
+static INLINE void avx2_store_columns(BYTE* dst, __m256i v, BYTE odd)
+{
+	const __m256i mask = _mm256_broadcastsi128_si256(_mm_set_epi8(
+	                         0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+	                         14 + odd, 12 + odd, 10 + odd, 8 + odd, 6 + odd, 4 + odd, 2 + odd, 0 + odd));
+	const __m256i columns = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, mask), 0x08);
+	_mm_storeu_si128((__m128i*) dst, _mm256_castsi256_si128(columns));
+}
+
+/* Same storage distribution as ssse3_RGBToAVC444YUV_BGRX_DOUBLE_ROW,
+ * 32 pixels at a time. */
+static INLINE void avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(
+    const BYTE* srcEven, const BYTE* srcOdd, BYTE* b1Even, BYTE* b1Odd, BYTE* b2,
+    BYTE* b3, BYTE* b4, BYTE* b5, BYTE* b6, BYTE* b7, UINT32 width)
+{
+	UINT32 x;
+	const __m256i u_factors = AVX2_BGRX_U_FACTORS;
+	const __m256i v_factors = AVX2_BGRX_V_FACTORS;
+
+	for (x = 0; x < width; x += 32)
+	{
+		UINT32 i;
+		__m256i xe[4], xo[4];
+		__m256i ue, ve, uo, vo;
+
+		for (i = 0; i < 4; i++)
+		{
+			xe[i] = _mm256_loadu_si256((const __m256i*)(srcEven + 32 * i));
+			xo[i] = _mm256_loadu_si256((const __m256i*)(srcOdd + 32 * i));
+		}
+
+		srcEven += 128;
+		srcOdd += 128;
+		/* y [b1] */
+		_mm256_storeu_si256((__m256i*) b1Even, avx2_RGBToY(xe));
+		b1Even += 32;
+		ue = avx2_RGBToUV(xe, u_factors);
+		ve = avx2_RGBToUV(xe, v_factors);
+
+		if (b1Odd)
+		{
+			_mm256_storeu_si256((__m256i*) b1Odd, avx2_RGBToY(xo));
+			b1Odd += 32;
+			uo = avx2_RGBToUV(xo, u_factors);
+			vo = avx2_RGBToUV(xo, v_factors);
+			/* 2x 2y -> b2, b3 */
+			avx2_store_average(b2, ue, uo);
+			avx2_store_average(b3, ve, vo);
+			/* x 2y+1 -> b4, b5 */
+			_mm256_storeu_si256((__m256i*) b4, uo);
+			_mm256_storeu_si256((__m256i*) b5, vo);
+			b4 += 32;
+			b5 += 32;
+		}
+		else
+		{
+			avx2_store_columns(b2, ue, 0);
+			avx2_store_columns(b3, ve, 0);
+		}
+
+		b2 += 16;
+		b3 += 16;
+		/* 2x+1 2y -> b6, b7 */
+		avx2_store_columns(b6, ue, 1);
+		avx2_store_columns(b7, ve, 1);
+		b6 += 16;
+		b7 += 16;
+	}
+}
+
+static pstatus_t avx2_RGBToAVC444YUV_BGRX(
+    const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+    BYTE* pDst1[3], const UINT32 dst1Step[3],
+    BYTE* pDst2[3], const UINT32 dst2Step[3],
+    const prim_size_t* roi)
+{
+	UINT32 y;
+	const BYTE* pMaxSrc = pSrc + (roi->height - 1) * srcStep;
+
+	if (roi->height < 1 || roi->width < 1)
+		return !PRIMITIVES_SUCCESS;
+
+	if (roi->width % 32)
+		return fallback_RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2, dst2Step,
+		                               roi);
+
+	for (y = 0; y < roi->height; y += 2)
+	{
+		const BOOL last = (y >= (roi->height - 1));
+		const BYTE* srcEven = y < roi->height ? pSrc + y * srcStep : pMaxSrc;
+		const BYTE* srcOdd = !last ? pSrc + (y + 1) * srcStep : pMaxSrc;
+		const UINT32 i = y >> 1;
+		const UINT32 n = (i & ~7) + i;
+		BYTE* b1Even = pDst1[0] + y * dst1Step[0];
+		BYTE* b1Odd = !last ? (b1Even + dst1Step[0]) : NULL;
+		BYTE* b2 = pDst1[1] + (y / 2) * dst1Step[1];
+		BYTE* b3 = pDst1[2] + (y / 2) * dst1Step[2];
+		BYTE* b4 = pDst2[0] + dst2Step[0] * n;
+		BYTE* b5 = b4 + 8 * dst2Step[0];
+		BYTE* b6 = pDst2[1] + (y / 2) * dst2Step[1];
+		BYTE* b7 = pDst2[2] + (y / 2) * dst2Step[2];
+		avx2_RGBToAVC444YUV_BGRX_DOUBLE_ROW(srcEven, srcOdd, b1Even, b1Odd, b2, b3, b4, b5, b6, b7,
+		                                    roi->width);
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_RGBToAVC444YUV(
+    const BYTE* pSrc, UINT32 srcFormat, UINT32 srcStep,
+    BYTE* pDst1[3], const UINT32 dst1Step[3],
+    BYTE* pDst2[3], const UINT32 dst2Step[3],
+    const prim_size_t* roi)
+{
+	switch (srcFormat)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			return avx2_RGBToAVC444YUV_BGRX(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2, dst2Step,
+			                                roi);
+
+		default:
+			return fallback_RGBToAVC444YUV(pSrc, srcFormat, srcStep, pDst1, dst1Step, pDst2, dst2Step,
+			                               roi);
+	}
+}
+
+void primitives_init_YUV_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	fallback_RGBToAVC444YUV = prims->RGBToAVC444YUV;
+	prims->YUV420ToRGB_8u_P3AC4R = avx2_YUV420ToRGB;
+	prims->YUV444ToRGB_8u_P3AC4R = avx2_YUV444ToRGB_8u_P3AC4R;
+	prims->RGBToAVC444YUV = avx2_RGBToAVC444YUV;
+}
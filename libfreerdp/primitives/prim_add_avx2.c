@@ -0,0 +1,75 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized add operations using AVX2.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_add_16s(
+    const INT16* pSrc1,
+    const INT16* pSrc2,
+    INT16* pDst,
+    UINT32 len)
+{
+	while (len >= 32)
+	{
+		const __m256i a0 = _mm256_loadu_si256((const __m256i*) pSrc1);
+		const __m256i a1 = _mm256_loadu_si256((const __m256i*)(pSrc1 + 16));
+		const __m256i b0 = _mm256_loadu_si256((const __m256i*) pSrc2);
+		const __m256i b1 = _mm256_loadu_si256((const __m256i*)(pSrc2 + 16));
+		_mm256_storeu_si256((__m256i*) pDst, _mm256_adds_epi16(a0, b0));
+		_mm256_storeu_si256((__m256i*)(pDst + 16), _mm256_adds_epi16(a1, b1));
+		pSrc1 += 32;
+		pSrc2 += 32;
+		pDst += 32;
+		len -= 32;
+	}
+
+	if (len >= 16)
+	{
+		const __m256i a = _mm256_loadu_si256((const __m256i*) pSrc1);
+		const __m256i b = _mm256_loadu_si256((const __m256i*) pSrc2);
+		_mm256_storeu_si256((__m256i*) pDst, _mm256_adds_epi16(a, b));
+		pSrc1 += 16;
+		pSrc2 += 16;
+		pDst += 16;
+		len -= 16;
+	}
+
+	if (len > 0)
+		return generic->add_16s(pSrc1, pSrc2, pDst, len);
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_add_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->add_16s = avx2_add_16s;
+}
@@ -0,0 +1,110 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized alpha blending routines using AVX2.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ *
+ * Note: the blend is the one of the SSE2 version, see prim_alphaComp_opt.c
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* Blends 2 pixels of each 128 bit lane, expanded to 16 bit per channel. */
+static INLINE __m256i avx2_alphaComp_blend(__m256i s1, __m256i s2)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+	/* d = s1 - s2 */
+	const __m256i d = _mm256_subs_epi16(s1, s2);
+	/* broadcast the alpha of each pixel to all its channels and add one */
+	__m256i a = _mm256_shufflelo_epi16(s1, 0xff);
+	a = _mm256_shufflehi_epi16(a, 0xff);
+	a = _mm256_adds_epi16(a, one);
+	/* ((d * a) >> 8) + s2 */
+	a = _mm256_mullo_epi16(a, d);
+	a = _mm256_srai_epi16(a, 8);
+	a = _mm256_adds_epi16(a, s2);
+	/* mask off remainders or the pack gets confused */
+	return _mm256_and_si256(a, _mm256_set1_epi16(0x00FF));
+}
+
+static pstatus_t avx2_alphaComp_argb(
+    const BYTE* pSrc1,  UINT32 src1Step,
+    const BYTE* pSrc2,  UINT32 src2Step,
+    BYTE* pDst,  UINT32 dstStep,
+    UINT32 width,  UINT32 height)
+{
+	UINT32 y;
+	const __m256i zero = _mm256_setzero_si256();
+
+	if ((width == 0) || (height == 0))
+		return PRIMITIVES_SUCCESS;
+
+	if (width < 8)     /* pointless if too small */
+		return generic->alphaComp_argb(pSrc1, src1Step, pSrc2, src2Step,
+		                               pDst, dstStep, width, height);
+
+	for (y = 0; y < height; y++)
+	{
+		UINT32 x;
+		const BYTE* sptr1 = pSrc1 + y * src1Step;
+		const BYTE* sptr2 = pSrc2 + y * src2Step;
+		BYTE* dptr = pDst + y * dstStep;
+
+		/* 8 pixels at a time */
+		for (x = 0; x + 8 <= width; x += 8)
+		{
+			const __m256i s1 = _mm256_loadu_si256((const __m256i*) sptr1);
+			const __m256i s2 = _mm256_loadu_si256((const __m256i*) sptr2);
+			const __m256i lo = avx2_alphaComp_blend(_mm256_unpacklo_epi8(s1, zero),
+			                                        _mm256_unpacklo_epi8(s2, zero));
+			const __m256i hi = avx2_alphaComp_blend(_mm256_unpackhi_epi8(s1, zero),
+			                                        _mm256_unpackhi_epi8(s2, zero));
+			_mm256_storeu_si256((__m256i*) dptr, _mm256_packus_epi16(lo, hi));
+			sptr1 += 32;
+			sptr2 += 32;
+			dptr += 32;
+		}
+
+		/* Finish off the remainder. */
+		if (x < width)
+		{
+			const pstatus_t status = generic->alphaComp_argb(sptr1, src1Step, sptr2, src2Step,
+			                         dptr, dstStep, width - x, 1);
+
+			if (status != PRIMITIVES_SUCCESS)
+				return status;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_alphaComp_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->alphaComp_argb = avx2_alphaComp_argb;
+}
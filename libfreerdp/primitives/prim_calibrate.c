@@ -0,0 +1,745 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Benchmark based selection of the primitives implementations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ *
+ * Each entry of primitives_t is timed once with the implementation of every
+ * instruction set table on a size representative for its callers and the
+ * fastest one is used. The result is kept for the process and can be kept
+ * in a cache file, which is only trusted if it was written by the same
+ * version for the same instruction sets.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#include <winpr/crt.h>
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/version.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+#define TAG FREERDP_TAG("primitives")
+
+#define CALIBRATE_MAGIC "FreeRDP primitives calibration 1"
+#define CALIBRATE_MAX_PIXELS (1024 * 16)
+#define CALIBRATE_PADDING 1024
+#define CALIBRATE_ROUNDS 5
+#define CALIBRATE_CALLS 8
+/* a routine replaces the default one only if it is this many percent faster */
+#define CALIBRATE_MARGIN 5
+
+typedef pstatus_t (*prim_fkt_t)(void);
+
+typedef struct
+{
+	BYTE* rgb[3];		/* 32bpp images */
+	BYTE* solid;		/* single color 32bpp image */
+	INT16* planes16[6];	/* 3 source and 3 destination planes */
+	BYTE* planes8[9];	/* 3 source, 3 main and 3 auxiliary planes */
+} prim_calibrate_buffers_t;
+
+typedef void (*prim_calibrate_fkt_t)(const primitives_t* prims,
+                                     const prim_calibrate_buffers_t* b, const prim_size_t* size);
+
+typedef struct
+{
+	const char* name;
+	size_t offset;
+	prim_calibrate_fkt_t run;
+	prim_size_t size;
+} prim_calibrate_entry_t;
+
+/* ------------------------------------------------------------------------- */
+static void run_copy(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                     const prim_size_t* s)
+{
+	prims->copy(b->rgb[0], b->rgb[1], (INT32)(s->width * s->height * 4));
+}
+
+static void run_copy_8u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                        const prim_size_t* s)
+{
+	prims->copy_8u(b->rgb[0], b->rgb[1], (INT32)(s->width * s->height * 4));
+}
+
+static void run_copy_8u_AC4r(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                             const prim_size_t* s)
+{
+	prims->copy_8u_AC4r(b->rgb[0], (INT32)s->width * 4, b->rgb[1], (INT32)s->width * 4,
+	                    (INT32)s->width, (INT32)s->height);
+}
+
+static void run_compare_32u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                            const prim_size_t* s)
+{
+	BOOL equal;
+	prims->compare_32u(b->rgb[0], s->width * 4, b->rgb[0], s->width * 4, s->width, s->height,
+	                   &equal);
+}
+
+static void run_solid_32u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                          const prim_size_t* s)
+{
+	UINT32 color;
+	BOOL solid;
+	prims->solid_32u(b->solid, s->width * 4, s->width, s->height, &color, &solid);
+}
+
+static void run_set_8u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                       const prim_size_t* s)
+{
+	prims->set_8u(0xA5, b->rgb[1], s->width * s->height * 4);
+}
+
+static void run_set_32s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                        const prim_size_t* s)
+{
+	prims->set_32s(-0x5A5A5A5A, (INT32*) b->rgb[1], s->width * s->height);
+}
+
+static void run_set_32u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                        const prim_size_t* s)
+{
+	prims->set_32u(0xA5A5A5A5, (UINT32*) b->rgb[1], s->width * s->height);
+}
+
+static void run_zero(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                     const prim_size_t* s)
+{
+	prims->zero(b->rgb[1], s->width * s->height * 4);
+}
+
+static void run_add_16s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                        const prim_size_t* s)
+{
+	prims->add_16s(b->planes16[0], b->planes16[1], b->planes16[3], s->width * s->height);
+}
+
+static void run_andC_32u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                         const prim_size_t* s)
+{
+	prims->andC_32u((const UINT32*) b->rgb[0], 0xFF00FF00, (UINT32*) b->rgb[1],
+	                (INT32)(s->width * s->height));
+}
+
+static void run_orC_32u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                        const prim_size_t* s)
+{
+	prims->orC_32u((const UINT32*) b->rgb[0], 0xFF00FF00, (UINT32*) b->rgb[1],
+	               (INT32)(s->width * s->height));
+}
+
+static void run_lShiftC_16s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                            const prim_size_t* s)
+{
+	prims->lShiftC_16s(b->planes16[0], 3, b->planes16[3], s->width * s->height);
+}
+
+static void run_lShiftC_16u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                            const prim_size_t* s)
+{
+	prims->lShiftC_16u((const UINT16*) b->planes16[0], 3, (UINT16*) b->planes16[3],
+	                   s->width * s->height);
+}
+
+static void run_rShiftC_16s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                            const prim_size_t* s)
+{
+	prims->rShiftC_16s(b->planes16[0], 3, b->planes16[3], s->width * s->height);
+}
+
+static void run_rShiftC_16u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                            const prim_size_t* s)
+{
+	prims->rShiftC_16u((const UINT16*) b->planes16[0], 3, (UINT16*) b->planes16[3],
+	                   s->width * s->height);
+}
+
+static void run_shiftC_16s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                           const prim_size_t* s)
+{
+	prims->shiftC_16s(b->planes16[0], -3, b->planes16[3], s->width * s->height);
+}
+
+static void run_shiftC_16u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                           const prim_size_t* s)
+{
+	prims->shiftC_16u((const UINT16*) b->planes16[0], -3, (UINT16*) b->planes16[3],
+	                  s->width * s->height);
+}
+
+static void run_alphaComp_argb(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                               const prim_size_t* s)
+{
+	prims->alphaComp_argb(b->rgb[0], s->width * 4, b->rgb[1], s->width * 4, b->rgb[2],
+	                      s->width * 4, s->width, s->height);
+}
+
+static void run_sign_16s(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                         const prim_size_t* s)
+{
+	prims->sign_16s(b->planes16[0], b->planes16[3], s->width * s->height);
+}
+
+static void run_yCbCrToRGB_16s8u_P3AC4R(const primitives_t* prims,
+                                        const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const INT16* src[3] = { b->planes16[0], b->planes16[1], b->planes16[2] };
+	prims->yCbCrToRGB_16s8u_P3AC4R(src, s->width * 2, b->rgb[1], s->width * 4,
+	                               PIXEL_FORMAT_BGRX32, s);
+}
+
+static void run_yCbCrToRGB_16s16s_P3P3(const primitives_t* prims,
+                                       const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const INT16* src[3] = { b->planes16[0], b->planes16[1], b->planes16[2] };
+	INT16* dst[3] = { b->planes16[3], b->planes16[4], b->planes16[5] };
+	prims->yCbCrToRGB_16s16s_P3P3(src, (INT32)s->width * 2, dst, (INT32)s->width * 2, s);
+}
+
+static void run_RGBToYCbCr_16s16s_P3P3(const primitives_t* prims,
+                                       const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const INT16* src[3] = { b->planes16[0], b->planes16[1], b->planes16[2] };
+	INT16* dst[3] = { b->planes16[3], b->planes16[4], b->planes16[5] };
+	prims->RGBToYCbCr_16s16s_P3P3(src, (INT32)s->width * 2, dst, (INT32)s->width * 2, s);
+}
+
+static void run_RGBToRGB_16s8u_P3AC4R(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const INT16* src[3] = { b->planes16[0], b->planes16[1], b->planes16[2] };
+	prims->RGBToRGB_16s8u_P3AC4R(src, s->width * 2, b->rgb[1], s->width * 4,
+	                             PIXEL_FORMAT_BGRX32, s);
+}
+
+static void run_YCoCgToRGB_8u_AC4R(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                                   const prim_size_t* s)
+{
+	prims->YCoCgToRGB_8u_AC4R(b->rgb[0], (INT32)s->width * 4, b->rgb[1], PIXEL_FORMAT_BGRX32,
+	                          (INT32)s->width * 4, s->width, s->height, 2, TRUE);
+}
+
+static void run_YUV420ToRGB_8u_P3AC4R(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const BYTE* src[3] = { b->planes8[0], b->planes8[1], b->planes8[2] };
+	const UINT32 step[3] = { s->width, s->width / 2, s->width / 2 };
+	prims->YUV420ToRGB_8u_P3AC4R(src, step, b->rgb[1], s->width * 4, PIXEL_FORMAT_BGRX32, s);
+}
+
+static void run_RGBToYUV420_8u_P3AC4R(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	BYTE* dst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	UINT32 step[3] = { s->width, s->width / 2, s->width / 2 };
+	prims->RGBToYUV420_8u_P3AC4R(b->rgb[0], PIXEL_FORMAT_BGRX32, s->width * 4, dst, step, s);
+}
+
+static void run_RGBToYUV444_8u_P3AC4R(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	BYTE* dst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	UINT32 step[3] = { s->width, s->width, s->width };
+	prims->RGBToYUV444_8u_P3AC4R(b->rgb[0], PIXEL_FORMAT_BGRX32, s->width * 4, dst, step, s);
+}
+
+static void run_YUV420CombineToYUV444(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const BYTE* src[3] = { b->planes8[0], b->planes8[1], b->planes8[2] };
+	const UINT32 srcStep[3] = { s->width, s->width / 2, s->width / 2 };
+	BYTE* dst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	const UINT32 dstStep[3] = { s->width, s->width, s->width };
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)s->width, (UINT16)s->height };
+	prims->YUV420CombineToYUV444(AVC444_LUMA, src, srcStep, s->width, s->height, dst, dstStep,
+	                             &rect);
+}
+
+static void run_YUV444SplitToYUV420(const primitives_t* prims,
+                                    const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const BYTE* src[3] = { b->planes8[0], b->planes8[1], b->planes8[2] };
+	const UINT32 srcStep[3] = { s->width, s->width, s->width };
+	BYTE* mainDst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	BYTE* auxDst[3] = { b->planes8[6], b->planes8[7], b->planes8[8] };
+	const UINT32 dstStep[3] = { s->width, s->width / 2, s->width / 2 };
+	prims->YUV444SplitToYUV420(src, srcStep, mainDst, dstStep, auxDst, dstStep, s);
+}
+
+static void run_YUV444ToRGB_8u_P3AC4R(const primitives_t* prims,
+                                      const prim_calibrate_buffers_t* b, const prim_size_t* s)
+{
+	const BYTE* src[3] = { b->planes8[0], b->planes8[1], b->planes8[2] };
+	const UINT32 step[3] = { s->width, s->width, s->width };
+	prims->YUV444ToRGB_8u_P3AC4R(src, step, b->rgb[1], s->width * 4, PIXEL_FORMAT_BGRX32, s);
+}
+
+static void run_RGBToAVC444YUV(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                               const prim_size_t* s)
+{
+	BYTE* mainDst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	BYTE* auxDst[3] = { b->planes8[6], b->planes8[7], b->planes8[8] };
+	const UINT32 step[3] = { s->width, s->width / 2, s->width / 2 };
+	prims->RGBToAVC444YUV(b->rgb[0], PIXEL_FORMAT_BGRX32, s->width * 4, mainDst, step, auxDst, step, s);
+}
+
+static void run_RGBToAVC444YUVv2(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                                 const prim_size_t* s)
+{
+	BYTE* mainDst[3] = { b->planes8[3], b->planes8[4], b->planes8[5] };
+	BYTE* auxDst[3] = { b->planes8[6], b->planes8[7], b->planes8[8] };
+	const UINT32 step[3] = { s->width, s->width / 2, s->width / 2 };
+	prims->RGBToAVC444YUVv2(b->rgb[0], PIXEL_FORMAT_BGRX32, s->width * 4, mainDst, step, auxDst, step,
+	                        s);
+}
+
+static void run_convertColor_8u(const primitives_t* prims, const prim_calibrate_buffers_t* b,
+                                const prim_size_t* s)
+{
+	prims->convertColor_8u(b->rgb[0], (INT32)s->width * 4, PIXEL_FORMAT_BGRX32, b->rgb[1],
+	                       (INT32)s->width * 4, PIXEL_FORMAT_RGBX32, s->width, s->height, NULL);
+}
+
+#define CALIBRATE_ENTRY_SIZE(_name_, _width_, _height_) \
+	{ #_name_, offsetof(primitives_t, _name_), run_##_name_, { _width_, _height_ } }
+/* A RemoteFX tile, the unit most callers work on */
+#define CALIBRATE_ENTRY(_name_) CALIBRATE_ENTRY_SIZE(_name_, 64, 64)
+/* A band of a frame, the YUV and color conversions run on whole rectangles */
+#define CALIBRATE_ENTRY_BAND(_name_) CALIBRATE_ENTRY_SIZE(_name_, 256, 64)
+
+static const prim_calibrate_entry_t calibrateEntries[] =
+{
+	CALIBRATE_ENTRY(copy),
+	CALIBRATE_ENTRY(copy_8u),
+	CALIBRATE_ENTRY(copy_8u_AC4r),
+	CALIBRATE_ENTRY(compare_32u),
+	CALIBRATE_ENTRY(solid_32u),
+	CALIBRATE_ENTRY(set_8u),
+	CALIBRATE_ENTRY(set_32s),
+	CALIBRATE_ENTRY(set_32u),
+	CALIBRATE_ENTRY(zero),
+	CALIBRATE_ENTRY(add_16s),
+	CALIBRATE_ENTRY(andC_32u),
+	CALIBRATE_ENTRY(orC_32u),
+	CALIBRATE_ENTRY(lShiftC_16s),
+	CALIBRATE_ENTRY(lShiftC_16u),
+	CALIBRATE_ENTRY(rShiftC_16s),
+	CALIBRATE_ENTRY(rShiftC_16u),
+	CALIBRATE_ENTRY(shiftC_16s),
+	CALIBRATE_ENTRY(shiftC_16u),
+	CALIBRATE_ENTRY(alphaComp_argb),
+	CALIBRATE_ENTRY(sign_16s),
+	CALIBRATE_ENTRY(yCbCrToRGB_16s8u_P3AC4R),
+	CALIBRATE_ENTRY(yCbCrToRGB_16s16s_P3P3),
+	CALIBRATE_ENTRY(RGBToYCbCr_16s16s_P3P3),
+	CALIBRATE_ENTRY(RGBToRGB_16s8u_P3AC4R),
+	CALIBRATE_ENTRY(YCoCgToRGB_8u_AC4R),
+	CALIBRATE_ENTRY_BAND(YUV420ToRGB_8u_P3AC4R),
+	CALIBRATE_ENTRY_BAND(RGBToYUV420_8u_P3AC4R),
+	CALIBRATE_ENTRY_BAND(RGBToYUV444_8u_P3AC4R),
+	CALIBRATE_ENTRY_BAND(YUV420CombineToYUV444),
+	CALIBRATE_ENTRY_BAND(YUV444SplitToYUV420),
+	CALIBRATE_ENTRY_BAND(YUV444ToRGB_8u_P3AC4R),
+	CALIBRATE_ENTRY_BAND(RGBToAVC444YUV),
+	CALIBRATE_ENTRY_BAND(RGBToAVC444YUVv2),
+	CALIBRATE_ENTRY_BAND(convertColor_8u)
+};
+
+/* The instruction set chosen for each entry, the first calibration of the
+ * process times the routines, later ones reuse it. */
+static BOOL calibrateDone = FALSE;
+static prim_isa_t calibrateIsa[ARRAYSIZE(calibrateEntries)];
+
+/* ------------------------------------------------------------------------- */
+static INLINE prim_fkt_t* prim_entry(const primitives_t* prims, size_t offset)
+{
+	return (prim_fkt_t*)((const BYTE*) prims + offset);
+}
+
+/* The lowest instruction set level that has the routine prims uses. */
+static prim_isa_t prim_entry_isa(primitives_t* const tables[PRIM_ISA_COUNT],
+                                 const primitives_t* prims, size_t offset)
+{
+	int isa;
+	const prim_fkt_t fkt = *prim_entry(prims, offset);
+
+	for (isa = PRIM_ISA_GENERIC; isa < PRIM_ISA_COUNT; isa++)
+	{
+		if (tables[isa] && (*prim_entry(tables[isa], offset) == fkt))
+			return (prim_isa_t) isa;
+	}
+
+	return PRIM_ISA_COUNT;
+}
+
+static UINT64 prim_calibrate_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (UINT64)(now.QuadPart * 1000000000.0 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (UINT64) ts.tv_sec * 1000000000ULL + (UINT64) ts.tv_nsec;
+#endif
+}
+
+/* Nanoseconds per pixel at the size of the entry, the best of a few rounds
+ * keeps out interruptions. */
+static double prim_calibrate_time(const prim_calibrate_entry_t* entry, const primitives_t* prims,
+                                  const prim_calibrate_buffers_t* buffers)
+{
+	int round;
+	UINT64 best = 0;
+	const prim_size_t* size = &entry->size;
+	/* warm up the caches */
+	entry->run(prims, buffers, size);
+
+	for (round = 0; round < CALIBRATE_ROUNDS; round++)
+	{
+		int call;
+		UINT64 delta;
+		const UINT64 start = prim_calibrate_now();
+
+		for (call = 0; call < CALIBRATE_CALLS; call++)
+			entry->run(prims, buffers, size);
+
+		delta = prim_calibrate_now() - start;
+
+		if ((round == 0) || (delta < best))
+			best = delta;
+	}
+
+	return (double) best / CALIBRATE_CALLS / (size->width * size->height);
+}
+
+static void prim_calibrate_buffers_free(prim_calibrate_buffers_t* b)
+{
+	size_t x;
+
+	for (x = 0; x < ARRAYSIZE(b->rgb); x++)
+		_aligned_free(b->rgb[x]);
+
+	_aligned_free(b->solid);
+
+	for (x = 0; x < ARRAYSIZE(b->planes16); x++)
+		_aligned_free(b->planes16[x]);
+
+	for (x = 0; x < ARRAYSIZE(b->planes8); x++)
+		_aligned_free(b->planes8[x]);
+}
+
+static BOOL prim_calibrate_buffers_new(prim_calibrate_buffers_t* b)
+{
+	size_t x, i;
+	ZeroMemory(b, sizeof(prim_calibrate_buffers_t));
+
+	for (x = 0; x < ARRAYSIZE(b->rgb); x++)
+	{
+		if (!(b->rgb[x] = _aligned_malloc(CALIBRATE_MAX_PIXELS * 4 + CALIBRATE_PADDING, 32)))
+			goto fail;
+
+		for (i = 0; i < CALIBRATE_MAX_PIXELS * 4 + CALIBRATE_PADDING; i++)
+			b->rgb[x][i] = (BYTE)((i * 2654435761U) >> 24);
+	}
+
+	/* solid_32u has to scan all of it */
+	if (!(b->solid = _aligned_malloc(CALIBRATE_MAX_PIXELS * 4 + CALIBRATE_PADDING, 32)))
+		goto fail;
+
+	FillMemory(b->solid, CALIBRATE_MAX_PIXELS * 4 + CALIBRATE_PADDING, 0xA5);
+
+	for (x = 0; x < ARRAYSIZE(b->planes16); x++)
+	{
+		if (!(b->planes16[x] = _aligned_malloc(CALIBRATE_MAX_PIXELS * 2 + CALIBRATE_PADDING, 32)))
+			goto fail;
+
+		/* in the range the RemoteFX decoder produces */
+		for (i = 0; i < (CALIBRATE_MAX_PIXELS * 2 + CALIBRATE_PADDING) / 2; i++)
+			b->planes16[x][i] = (INT16)(((i * 2654435761U) >> 20) % 8192) - 4096;
+	}
+
+	for (x = 0; x < ARRAYSIZE(b->planes8); x++)
+	{
+		if (!(b->planes8[x] = _aligned_malloc(CALIBRATE_MAX_PIXELS + CALIBRATE_PADDING, 32)))
+			goto fail;
+
+		for (i = 0; i < CALIBRATE_MAX_PIXELS + CALIBRATE_PADDING; i++)
+			b->planes8[x][i] = (BYTE)((i * 2654435761U) >> 24);
+	}
+
+	return TRUE;
+fail:
+	prim_calibrate_buffers_free(b);
+	return FALSE;
+}
+
+/* ------------------------------------------------------------------------- */
+static DWORD prim_calibrate_isa_mask(primitives_t* const tables[PRIM_ISA_COUNT])
+{
+	int isa;
+	DWORD mask = 0;
+
+	for (isa = PRIM_ISA_GENERIC; isa < PRIM_ISA_COUNT; isa++)
+	{
+		if (tables[isa])
+			mask |= 1 << isa;
+	}
+
+	return mask;
+}
+
+static BOOL prim_calibrate_load(primitives_t* const tables[PRIM_ISA_COUNT], primitives_t* prims,
+                                const char* cacheFile)
+{
+	FILE* fp;
+	char line[256];
+	char header[256];
+	primitives_t loaded = *prims;
+	size_t count = 0;
+	BOOL rc = FALSE;
+
+	if (!PathFileExistsA(cacheFile))
+		return FALSE;
+
+	if (!(fp = fopen(cacheFile, "r")))
+		return FALSE;
+
+	sprintf_s(header, sizeof(header), "%s %s %"PRIu32"\n", CALIBRATE_MAGIC, FREERDP_VERSION_FULL,
+	          prim_calibrate_isa_mask(tables));
+
+	if (!fgets(line, sizeof(line), fp) || (strcmp(line, header) != 0))
+		goto out;
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		size_t x;
+		int isa;
+		char name[64];
+		char isaName[16];
+		const prim_calibrate_entry_t* entry = NULL;
+
+		if (sscanf(line, "%63s %15s", name, isaName) != 2)
+			goto out;
+
+		for (x = 0; x < ARRAYSIZE(calibrateEntries); x++)
+		{
+			if (strcmp(calibrateEntries[x].name, name) == 0)
+				entry = &calibrateEntries[x];
+		}
+
+		for (isa = PRIM_ISA_GENERIC; isa < PRIM_ISA_COUNT; isa++)
+		{
+			if (strcmp(primitives_get_isa_name((prim_isa_t) isa), isaName) == 0)
+				break;
+		}
+
+		if (!entry || (isa == PRIM_ISA_COUNT) || !tables[isa])
+			goto out;
+
+		*prim_entry(&loaded, entry->offset) = *prim_entry(tables[isa], entry->offset);
+		count++;
+	}
+
+	/* all or nothing, a partial file falls back to a new calibration */
+	if (count != ARRAYSIZE(calibrateEntries))
+		goto out;
+
+	*prims = loaded;
+	rc = TRUE;
+out:
+	fclose(fp);
+	return rc;
+}
+
+static BOOL prim_calibrate_save(primitives_t* const tables[PRIM_ISA_COUNT],
+                                const primitives_t* prims, const char* cacheFile)
+{
+	FILE* fp;
+	size_t x;
+	size_t length;
+	char* cacheFileNew;
+	BOOL rc = TRUE;
+
+	/* write to a new file first, a concurrent start must not read half of it */
+	length = strlen(cacheFile) + 5;
+
+	if (!(cacheFileNew = malloc(length)))
+		return FALSE;
+
+	sprintf_s(cacheFileNew, length, "%s.new", cacheFile);
+
+	if (!(fp = fopen(cacheFileNew, "w")))
+	{
+		free(cacheFileNew);
+		return FALSE;
+	}
+
+	if (fprintf(fp, "%s %s %"PRIu32"\n", CALIBRATE_MAGIC, FREERDP_VERSION_FULL,
+	            prim_calibrate_isa_mask(tables)) < 0)
+		rc = FALSE;
+
+	for (x = 0; rc && (x < ARRAYSIZE(calibrateEntries)); x++)
+	{
+		const prim_calibrate_entry_t* entry = &calibrateEntries[x];
+		const prim_isa_t isa = prim_entry_isa(tables, prims, entry->offset);
+
+		if (fprintf(fp, "%s %s\n", entry->name, primitives_get_isa_name(isa)) < 0)
+			rc = FALSE;
+	}
+
+	if (fclose(fp) != 0)
+		rc = FALSE;
+
+	if (rc)
+		rc = MoveFileExA(cacheFileNew, cacheFile, MOVEFILE_REPLACE_EXISTING);
+
+	if (!rc)
+		DeleteFileA(cacheFileNew);
+
+	free(cacheFileNew);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+BOOL primitives_calibrate_table(primitives_t* const tables[PRIM_ISA_COUNT],
+                                const primitives_t* prims, primitives_t* calibrated,
+                                const char* cacheFile)
+{
+	size_t x;
+	prim_calibrate_buffers_t buffers;
+	*calibrated = *prims;
+
+	if (cacheFile && prim_calibrate_load(tables, calibrated, cacheFile))
+	{
+		WLog_DBG(TAG, "loaded primitives calibration from %s", cacheFile);
+
+		for (x = 0; x < ARRAYSIZE(calibrateEntries); x++)
+			calibrateIsa[x] = prim_entry_isa(tables, calibrated, calibrateEntries[x].offset);
+
+		calibrateDone = TRUE;
+		return TRUE;
+	}
+
+	if (calibrateDone)
+	{
+		for (x = 0; x < ARRAYSIZE(calibrateEntries); x++)
+		{
+			const prim_isa_t isa = calibrateIsa[x];
+			const size_t offset = calibrateEntries[x].offset;
+
+			if ((isa < PRIM_ISA_COUNT) && tables[isa])
+				*prim_entry(calibrated, offset) = *prim_entry(tables[isa], offset);
+		}
+	}
+	else
+	{
+		if (!prim_calibrate_buffers_new(&buffers))
+			return FALSE;
+
+		for (x = 0; x < ARRAYSIZE(calibrateEntries); x++)
+		{
+			int isa;
+			const prim_calibrate_entry_t* entry = &calibrateEntries[x];
+			prim_fkt_t* dst = prim_entry(calibrated, entry->offset);
+			/* the routine selected from the processor features is the default */
+			double best = prim_calibrate_time(entry, prims, &buffers);
+			const double current = best;
+
+			for (isa = PRIM_ISA_GENERIC; isa < PRIM_ISA_COUNT; isa++)
+			{
+				double t;
+				const primitives_t* candidate = tables[isa];
+
+				/* each distinct implementation is timed once */
+				if (!candidate || (prim_entry_isa(tables, candidate, entry->offset) != isa) ||
+				    (*prim_entry(candidate, entry->offset) == *prim_entry(prims, entry->offset)))
+					continue;
+
+				t = prim_calibrate_time(entry, candidate, &buffers);
+
+				if ((t < best) && (t * (100 + CALIBRATE_MARGIN) < current * 100))
+				{
+					best = t;
+					*dst = *prim_entry(candidate, entry->offset);
+				}
+			}
+
+			calibrateIsa[x] = prim_entry_isa(tables, calibrated, entry->offset);
+			WLog_DBG(TAG, "%s: %s, %.3f ns per pixel at %"PRIu32"x%"PRIu32, entry->name,
+			         primitives_get_isa_name(calibrateIsa[x]), best, entry->size.width,
+			         entry->size.height);
+		}
+
+		prim_calibrate_buffers_free(&buffers);
+		calibrateDone = TRUE;
+	}
+
+	if (cacheFile && !prim_calibrate_save(tables, calibrated, cacheFile))
+		WLog_WARN(TAG, "failed to save the primitives calibration to %s", cacheFile);
+
+	return TRUE;
+}
+
+/**
+ * Other threads may call through prims meanwhile. Each routine is swapped
+ * with a single pointer store, the old and the new one compute the same.
+ */
+void primitives_publish_table(primitives_t* prims, const primitives_t* calibrated)
+{
+	size_t x;
+
+	for (x = 0; x < ARRAYSIZE(calibrateEntries); x++)
+	{
+		const size_t offset = calibrateEntries[x].offset;
+		PVOID volatile* dst = (PVOID volatile*) prim_entry(prims, offset);
+		const PVOID fkt = (PVOID) *prim_entry(calibrated, offset);
+		const PVOID current = *dst;
+
+		if (current != fkt)
+			InterlockedCompareExchangePointer(dst, fkt, current);
+	}
+}
+
+const char* primitives_calibrate_entry(primitives_t* const tables[PRIM_ISA_COUNT],
+                                       const primitives_t* prims, size_t index,
+                                       const char** implementation)
+{
+	const prim_calibrate_entry_t* entry;
+
+	if (index >= ARRAYSIZE(calibrateEntries))
+		return NULL;
+
+	entry = &calibrateEntries[index];
+
+	if (implementation)
+		*implementation = primitives_get_isa_name(prim_entry_isa(tables, prims, entry->offset));
+
+	return entry->name;
+}
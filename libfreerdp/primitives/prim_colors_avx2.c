@@ -0,0 +1,139 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized Color conversion operations using AVX2.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+
+/*---------------------------------------------------------------------------*/
+/* Same fixed point arithmetic as the SSE2 version, see
+ * sse2_yCbCrToRGB_16s8u_P3AC4R_BGRX in prim_colors_opt.c, 16 pixels at a time.
+ * The blue value goes to the first byte of a pixel for BGRX, the red value
+ * for RGBX.
+ */
+static pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R_X(
+    const INT16* pSrc[3], UINT32 srcStep,
+    BYTE* pDst, UINT32 dstStep, BOOL bgrx,
+    const prim_size_t* roi)	/* region of interest */
+{
+	const __m256i r_cr = _mm256_set1_epi16(22986);	/*  1.403 << 14 */
+	const __m256i g_cb = _mm256_set1_epi16(-5636);	/* -0.344 << 14 */
+	const __m256i g_cr = _mm256_set1_epi16(-11698);	/* -0.714 << 14 */
+	const __m256i b_cb = _mm256_set1_epi16(28999);	/*  1.770 << 14 */
+	const __m256i c4096 = _mm256_set1_epi16(4096);
+	const UINT32 pad = roi->width % 16;
+	UINT32 yp;
+
+	for (yp = 0; yp < roi->height; ++yp)
+	{
+		UINT32 i;
+		const INT16* y_buf = (const INT16*)((const BYTE*) pSrc[0] + yp * srcStep);
+		const INT16* cb_buf = (const INT16*)((const BYTE*) pSrc[1] + yp * srcStep);
+		const INT16* cr_buf = (const INT16*)((const BYTE*) pSrc[2] + yp * srcStep);
+		BYTE* d_buf = pDst + yp * dstStep;
+
+		for (i = 0; i < roi->width - pad; i += 16)
+		{
+			__m256i y, cb, cr, r, g, b;
+			/* y = (y + 4096) >> 2 */
+			y = _mm256_loadu_si256((const __m256i*) y_buf);
+			y = _mm256_srai_epi16(_mm256_add_epi16(y, c4096), 2);
+			cb = _mm256_loadu_si256((const __m256i*) cb_buf);
+			cr = _mm256_loadu_si256((const __m256i*) cr_buf);
+			/* (y + HIWORD(cr*22986)) >> 3 */
+			r = _mm256_add_epi16(y, _mm256_mulhi_epi16(cr, r_cr));
+			r = _mm256_srai_epi16(r, 3);
+			/* (y + HIWORD(cb*-5636) + HIWORD(cr*-11698)) >> 3 */
+			g = _mm256_add_epi16(y, _mm256_mulhi_epi16(cb, g_cb));
+			g = _mm256_add_epi16(g, _mm256_mulhi_epi16(cr, g_cr));
+			g = _mm256_srai_epi16(g, 3);
+			/* (y + HIWORD(cb*28999)) >> 3 */
+			b = _mm256_add_epi16(y, _mm256_mulhi_epi16(cb, b_cb));
+			b = _mm256_srai_epi16(b, 3);
+
+			/* the pack clips to [0, 255] */
+			if (bgrx)
+				d_buf = avx2_write_pixels(d_buf, b, g, r);
+			else
+				d_buf = avx2_write_pixels(d_buf, r, g, b);
+
+			y_buf += 16;
+			cb_buf += 16;
+			cr_buf += 16;
+		}
+
+		for (i = 0; i < pad; i++)
+		{
+			const INT32 divisor = 16;
+			const INT32 Y = ((*y_buf++) + 4096) << divisor;
+			const INT32 Cb = (*cb_buf++);
+			const INT32 Cr = (*cr_buf++);
+			const INT32 CrR = Cr * (INT32)(1.402525f * (1 << divisor));
+			const INT32 CrG = Cr * (INT32)(0.714401f * (1 << divisor));
+			const INT32 CbG = Cb * (INT32)(0.343730f * (1 << divisor));
+			const INT32 CbB = Cb * (INT32)(1.769905f * (1 << divisor));
+			const INT16 R = ((INT16)((CrR + Y) >> divisor) >> 5);
+			const INT16 G = ((INT16)((Y - CbG - CrG) >> divisor) >> 5);
+			const INT16 B = ((INT16)((CbB + Y) >> divisor) >> 5);
+
+			if (bgrx)
+				d_buf = writePixelBGRX(d_buf, 4, PIXEL_FORMAT_BGRX32, CLIP(R), CLIP(G), CLIP(B), 0xFF);
+			else
+				d_buf = writePixelRGBX(d_buf, 4, PIXEL_FORMAT_RGBX32, CLIP(R), CLIP(G), CLIP(B), 0xFF);
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R(
+    const INT16* pSrc[3], UINT32 srcStep,
+    BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+    const prim_size_t* roi)	/* region of interest */
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, TRUE, roi);
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, FALSE, roi);
+
+		default:
+			return generic->yCbCrToRGB_16s8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat, roi);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_colors_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->yCbCrToRGB_16s8u_P3AC4R = avx2_yCbCrToRGB_16s8u_P3AC4R;
+}
@@ -0,0 +1,102 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Block comparison operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+/* ----------------------------------------------------------------------------
+ * Compare two blocks of 32bpp pixels, stop at the first differing row.
+ */
+static pstatus_t general_compare_32u(
+    const BYTE* pSrc1, UINT32 src1Step,
+    const BYTE* pSrc2, UINT32 src2Step,
+    UINT32 width, UINT32 height,
+    BOOL* pEqual)
+{
+	UINT32 y;
+	const size_t rowSize = width * 4;
+
+	if (!pSrc1 || !pSrc2 || !pEqual)
+		return -1;
+
+	*pEqual = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		if (memcmp(pSrc1, pSrc2, rowSize) != 0)
+		{
+			*pEqual = FALSE;
+			break;
+		}
+
+		pSrc1 += src1Step;
+		pSrc2 += src2Step;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------------
+ * Check whether all pixels of a 32bpp block have the color of the first one.
+ */
+static pstatus_t general_solid_32u(
+    const BYTE* pSrc, UINT32 srcStep,
+    UINT32 width, UINT32 height,
+    UINT32* pColor, BOOL* pSolid)
+{
+	UINT32 x, y;
+	UINT32 color;
+
+	if (!pSrc || !pColor || !pSolid || (width == 0) || (height == 0))
+		return -1;
+
+	memcpy(&color, pSrc, sizeof(color));
+	*pColor = color;
+	*pSolid = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			UINT32 pixel;
+			memcpy(&pixel, &pSrc[x * 4], sizeof(pixel));
+
+			if (pixel != color)
+			{
+				*pSolid = FALSE;
+				return PRIMITIVES_SUCCESS;
+			}
+		}
+
+		pSrc += srcStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_compare(
+    primitives_t* prims)
+{
+	/* Start with the default. */
+	prims->compare_32u = general_compare_32u;
+	prims->solid_32u = general_solid_32u;
+}
@@ -0,0 +1,293 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized block comparison operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+# include <emmintrin.h>
+#endif /* WITH_SSE2 */
+#ifdef WITH_NEON
+# include <arm_neon.h>
+#endif /* WITH_NEON */
+
+#include "prim_internal.h"
+
+static primitives_t* generic = NULL;
+
+/* ------------------------------------------------------------------------- */
+#ifdef WITH_SSE2
+static pstatus_t sse2_compare_32u(
+    const BYTE* pSrc1, UINT32 src1Step,
+    const BYTE* pSrc2, UINT32 src2Step,
+    UINT32 width, UINT32 height,
+    BOOL* pEqual)
+{
+	UINT32 x, y;
+	const UINT32 rowSize = width * 4;
+	const UINT32 vecSize = rowSize & ~0x3FU;
+
+	if (!pSrc1 || !pSrc2 || !pEqual)
+		return -1;
+
+	if (rowSize < 16)
+		return generic->compare_32u(pSrc1, src1Step, pSrc2, src2Step, width, height, pEqual);
+
+	*pEqual = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		__m128i diff = _mm_setzero_si128();
+		const BYTE* p1 = pSrc1;
+		const BYTE* p2 = pSrc2;
+
+		/* Accumulate the XOR of 64 bytes per iteration, test once per row */
+		for (x = 0; x < vecSize; x += 64)
+		{
+			__m128i a0 = _mm_loadu_si128((const __m128i*) &p1[x]);
+			__m128i b0 = _mm_loadu_si128((const __m128i*) &p2[x]);
+			__m128i a1 = _mm_loadu_si128((const __m128i*) &p1[x + 16]);
+			__m128i b1 = _mm_loadu_si128((const __m128i*) &p2[x + 16]);
+			__m128i a2 = _mm_loadu_si128((const __m128i*) &p1[x + 32]);
+			__m128i b2 = _mm_loadu_si128((const __m128i*) &p2[x + 32]);
+			__m128i a3 = _mm_loadu_si128((const __m128i*) &p1[x + 48]);
+			__m128i b3 = _mm_loadu_si128((const __m128i*) &p2[x + 48]);
+			diff = _mm_or_si128(diff, _mm_xor_si128(a0, b0));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a1, b1));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a2, b2));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a3, b3));
+		}
+
+		for (; x + 16 <= rowSize; x += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*) &p1[x]);
+			__m128i b = _mm_loadu_si128((const __m128i*) &p2[x]);
+			diff = _mm_or_si128(diff, _mm_xor_si128(a, b));
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+		{
+			*pEqual = FALSE;
+			break;
+		}
+
+		if ((x < rowSize) && (memcmp(&p1[x], &p2[x], rowSize - x) != 0))
+		{
+			*pEqual = FALSE;
+			break;
+		}
+
+		pSrc1 += src1Step;
+		pSrc2 += src2Step;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_solid_32u(
+    const BYTE* pSrc, UINT32 srcStep,
+    UINT32 width, UINT32 height,
+    UINT32* pColor, BOOL* pSolid)
+{
+	UINT32 x, y;
+	UINT32 color;
+	__m128i fill;
+	const UINT32 rowSize = width * 4;
+	const UINT32 vecSize = rowSize & ~0x3FU;
+
+	if (!pSrc || !pColor || !pSolid || (width == 0) || (height == 0))
+		return -1;
+
+	if (rowSize < 16)
+		return generic->solid_32u(pSrc, srcStep, width, height, pColor, pSolid);
+
+	memcpy(&color, pSrc, sizeof(color));
+	fill = _mm_set1_epi32((int) color);
+	*pColor = color;
+	*pSolid = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		__m128i diff = _mm_setzero_si128();
+
+		for (x = 0; x < vecSize; x += 64)
+		{
+			__m128i a0 = _mm_loadu_si128((const __m128i*) &pSrc[x]);
+			__m128i a1 = _mm_loadu_si128((const __m128i*) &pSrc[x + 16]);
+			__m128i a2 = _mm_loadu_si128((const __m128i*) &pSrc[x + 32]);
+			__m128i a3 = _mm_loadu_si128((const __m128i*) &pSrc[x + 48]);
+			diff = _mm_or_si128(diff, _mm_xor_si128(a0, fill));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a1, fill));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a2, fill));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a3, fill));
+		}
+
+		/* The last vector overlaps the previous one, the row is all pixels */
+		if (x < rowSize)
+		{
+			for (; x + 16 <= rowSize; x += 16)
+				diff = _mm_or_si128(diff, _mm_xor_si128(_mm_loadu_si128((const __m128i*) &pSrc[x]), fill));
+
+			if (x < rowSize)
+				diff = _mm_or_si128(diff,
+				                    _mm_xor_si128(_mm_loadu_si128((const __m128i*) &pSrc[rowSize - 16]), fill));
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+		{
+			*pSolid = FALSE;
+			break;
+		}
+
+		pSrc += srcStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_SSE2 */
+
+/* ------------------------------------------------------------------------- */
+#ifdef WITH_NEON
+static pstatus_t neon_compare_32u(
+    const BYTE* pSrc1, UINT32 src1Step,
+    const BYTE* pSrc2, UINT32 src2Step,
+    UINT32 width, UINT32 height,
+    BOOL* pEqual)
+{
+	UINT32 x, y;
+	const UINT32 rowSize = width * 4;
+
+	if (!pSrc1 || !pSrc2 || !pEqual)
+		return -1;
+
+	if (rowSize < 16)
+		return generic->compare_32u(pSrc1, src1Step, pSrc2, src2Step, width, height, pEqual);
+
+	*pEqual = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		uint8x16_t diff = vdupq_n_u8(0);
+		uint64x2_t folded;
+		const BYTE* p1 = pSrc1;
+		const BYTE* p2 = pSrc2;
+
+		for (x = 0; x + 16 <= rowSize; x += 16)
+		{
+			const uint8x16_t a = vld1q_u8(&p1[x]);
+			const uint8x16_t b = vld1q_u8(&p2[x]);
+			diff = vorrq_u8(diff, veorq_u8(a, b));
+		}
+
+		folded = vreinterpretq_u64_u8(diff);
+
+		if ((vgetq_lane_u64(folded, 0) | vgetq_lane_u64(folded, 1)) != 0)
+		{
+			*pEqual = FALSE;
+			break;
+		}
+
+		if ((x < rowSize) && (memcmp(&p1[x], &p2[x], rowSize - x) != 0))
+		{
+			*pEqual = FALSE;
+			break;
+		}
+
+		pSrc1 += src1Step;
+		pSrc2 += src2Step;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_solid_32u(
+    const BYTE* pSrc, UINT32 srcStep,
+    UINT32 width, UINT32 height,
+    UINT32* pColor, BOOL* pSolid)
+{
+	UINT32 x, y;
+	UINT32 color;
+	uint32x4_t fill;
+	const UINT32 rowSize = width * 4;
+
+	if (!pSrc || !pColor || !pSolid || (width == 0) || (height == 0))
+		return -1;
+
+	if (rowSize < 16)
+		return generic->solid_32u(pSrc, srcStep, width, height, pColor, pSolid);
+
+	memcpy(&color, pSrc, sizeof(color));
+	fill = vdupq_n_u32(color);
+	*pColor = color;
+	*pSolid = TRUE;
+
+	for (y = 0; y < height; y++)
+	{
+		uint32x4_t diff = vdupq_n_u32(0);
+		uint64x2_t folded;
+
+		for (x = 0; x + 16 <= rowSize; x += 16)
+			diff = vorrq_u32(diff, veorq_u32(vld1q_u32((const uint32_t*) &pSrc[x]), fill));
+
+		/* The last vector overlaps the previous one, the row is all pixels */
+		if (x < rowSize)
+			diff = vorrq_u32(diff, veorq_u32(vld1q_u32((const uint32_t*) &pSrc[rowSize - 16]), fill));
+
+		folded = vreinterpretq_u64_u32(diff);
+
+		if ((vgetq_lane_u64(folded, 0) | vgetq_lane_u64(folded, 1)) != 0)
+		{
+			*pSolid = FALSE;
+			break;
+		}
+
+		pSrc += srcStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_NEON */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_compare_opt(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	primitives_init_compare(prims);
+	/* Pick tuned versions if possible. */
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresent(PF_SSE2_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->compare_32u = sse2_compare_32u;
+		prims->solid_32u = sse2_solid_32u;
+	}
+
+#elif defined(WITH_NEON)
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+	{
+		prims->compare_32u = neon_compare_32u;
+		prims->solid_32u = neon_solid_32u;
+	}
+
+#endif
+}
@@ -0,0 +1,308 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Pixel format conversion operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+/* ------------------------------------------------------------------------- */
+/* Find out which source byte ends up in which destination byte by
+ * converting two pixels with distinct byte values.
+ */
+static BOOL convert_get_shuffle(UINT32 SrcFormat, UINT32 DstFormat, BYTE shuffle[4],
+                                BYTE fill[4])
+{
+	UINT32 i, j, k;
+	const BYTE probe[2][4] = { { 0x01, 0x02, 0x03, 0x04 }, { 0x10, 0x20, 0x30, 0x40 } };
+	BYTE out[2][4] = { { 0 } };
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	for (i = 0; i < 2; i++)
+	{
+		UINT32 color = ReadColor(probe[i], SrcFormat);
+		color = FreeRDPConvertColor(color, SrcFormat, DstFormat, NULL);
+		WriteColor(out[i], DstFormat, color);
+	}
+
+	ZeroMemory(fill, 4);
+
+	for (j = 0; j < dstBpp; j++)
+	{
+		/* constant, e.g. the alpha of a format without alpha channel */
+		if (out[0][j] == out[1][j])
+		{
+			shuffle[j] = 0x80;
+			fill[j] = out[0][j];
+			continue;
+		}
+
+		for (k = 0; k < srcBpp; k++)
+		{
+			if ((out[0][j] == probe[0][k]) && (out[1][j] == probe[1][k]))
+				break;
+		}
+
+		if (k >= srcBpp)
+			return FALSE;
+
+		shuffle[j] = (BYTE) k;
+	}
+
+	return TRUE;
+}
+
+static BOOL convert_get_layout16(UINT32 format, BYTE* redShift, BYTE* greenBits, BYTE* blueShift)
+{
+	switch (format)
+	{
+		case PIXEL_FORMAT_RGB16:
+			*redShift = 11;
+			*greenBits = 6;
+			*blueShift = 0;
+			return TRUE;
+
+		case PIXEL_FORMAT_BGR16:
+			*redShift = 0;
+			*greenBits = 6;
+			*blueShift = 11;
+			return TRUE;
+
+		case PIXEL_FORMAT_RGB15:
+			*redShift = 10;
+			*greenBits = 5;
+			*blueShift = 0;
+			return TRUE;
+
+		case PIXEL_FORMAT_BGR15:
+			*redShift = 0;
+			*greenBits = 5;
+			*blueShift = 10;
+			return TRUE;
+
+		default:
+			return FALSE;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+BOOL primitives_convert_prepare(prim_convert_t* conv, UINT32 SrcFormat, UINT32 DstFormat,
+                                const gdiPalette* palette)
+{
+	UINT32 i;
+
+	if (!conv)
+		return FALSE;
+
+	conv->type = PRIM_CONVERT_PIXEL;
+	conv->SrcFormat = SrcFormat;
+	conv->DstFormat = DstFormat;
+	conv->palette = palette;
+	conv->srcBpp = GetBytesPerPixel(SrcFormat);
+	conv->dstBpp = GetBytesPerPixel(DstFormat);
+
+	switch (conv->srcBpp)
+	{
+		case 1:
+			if ((SrcFormat != PIXEL_FORMAT_RGB8) || !palette || (conv->dstBpp < 2))
+				break;
+
+			for (i = 0; i < 256; i++)
+			{
+				const UINT32 color = FreeRDPConvertColor(i, SrcFormat, DstFormat, palette);
+				WriteColor(conv->lut[i], DstFormat, color);
+			}
+
+			conv->type = PRIM_CONVERT_PALETTE;
+			break;
+
+		case 2:
+			if ((conv->dstBpp < 3) ||
+			    !convert_get_layout16(SrcFormat, &conv->redShift, &conv->greenBits, &conv->blueShift))
+				break;
+
+			/* shuffle indices refer to blue, green and red */
+			if (convert_get_shuffle(PIXEL_FORMAT_BGRX32, DstFormat, conv->shuffle, conv->fill))
+				conv->type = PRIM_CONVERT_FROM_16;
+
+			break;
+
+		case 3:
+		case 4:
+			if (conv->dstBpp == 2)
+			{
+				if (!convert_get_layout16(DstFormat, &conv->redShift, &conv->greenBits,
+				                          &conv->blueShift))
+					break;
+
+				/* shuffle holds the source bytes of blue, green and red */
+				if (convert_get_shuffle(SrcFormat, PIXEL_FORMAT_BGRX32, conv->shuffle, conv->fill) &&
+				    !(conv->shuffle[0] & 0x80) && !(conv->shuffle[1] & 0x80) &&
+				    !(conv->shuffle[2] & 0x80))
+					conv->type = PRIM_CONVERT_TO_16;
+			}
+			else if (conv->dstBpp >= 3)
+			{
+				if (convert_get_shuffle(SrcFormat, DstFormat, conv->shuffle, conv->fill))
+					conv->type = PRIM_CONVERT_SHUFFLE;
+			}
+
+			break;
+
+		default:
+			break;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_convert_row(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                            UINT32 width)
+{
+	UINT32 x, j;
+	const UINT32 srcBpp = conv->srcBpp;
+	const UINT32 dstBpp = conv->dstBpp;
+
+	switch (conv->type)
+	{
+		case PRIM_CONVERT_PALETTE:
+			if (dstBpp == 4)
+			{
+				for (x = 0; x < width; x++)
+				{
+					memcpy(pDst, conv->lut[*pSrc++], 4);
+					pDst += 4;
+				}
+			}
+			else
+			{
+				for (x = 0; x < width; x++)
+				{
+					memcpy(pDst, conv->lut[*pSrc++], dstBpp);
+					pDst += dstBpp;
+				}
+			}
+
+			break;
+
+		case PRIM_CONVERT_SHUFFLE:
+			for (x = 0; x < width; x++)
+			{
+				for (j = 0; j < dstBpp; j++)
+				{
+					const BYTE index = conv->shuffle[j];
+					pDst[j] = (index & 0x80) ? conv->fill[j] : pSrc[index];
+				}
+
+				pSrc += srcBpp;
+				pDst += dstBpp;
+			}
+
+			break;
+
+		case PRIM_CONVERT_TO_16:
+			{
+				const BYTE greenShift = 8 - conv->greenBits;
+
+				for (x = 0; x < width; x++)
+				{
+					const UINT32 b = pSrc[conv->shuffle[0]];
+					const UINT32 g = pSrc[conv->shuffle[1]];
+					const UINT32 r = pSrc[conv->shuffle[2]];
+					const UINT32 color = ((r >> 3) << conv->redShift) | ((g >> greenShift) << 5) |
+					                     ((b >> 3) << conv->blueShift);
+					pDst[0] = (BYTE) color;
+					pDst[1] = (BYTE)(color >> 8);
+					pSrc += srcBpp;
+					pDst += 2;
+				}
+			}
+			break;
+
+		case PRIM_CONVERT_FROM_16:
+			{
+				const BYTE greenShift = 8 - conv->greenBits;
+				const UINT32 greenMask = (1 << conv->greenBits) - 1;
+
+				for (x = 0; x < width; x++)
+				{
+					BYTE bgr[3];
+					const UINT32 color = ((UINT32) pSrc[1] << 8) | pSrc[0];
+					bgr[0] = (BYTE)(((color >> conv->blueShift) & 0x1F) << 3);
+					bgr[1] = (BYTE)(((color >> 5) & greenMask) << greenShift);
+					bgr[2] = (BYTE)(((color >> conv->redShift) & 0x1F) << 3);
+
+					for (j = 0; j < dstBpp; j++)
+					{
+						const BYTE index = conv->shuffle[j];
+						pDst[j] = (index & 0x80) ? conv->fill[j] : bgr[index];
+					}
+
+					pSrc += 2;
+					pDst += dstBpp;
+				}
+			}
+			break;
+
+		default:
+			for (x = 0; x < width; x++)
+			{
+				UINT32 color = ReadColor(pSrc, conv->SrcFormat);
+				color = FreeRDPConvertColor(color, conv->SrcFormat, conv->DstFormat, conv->palette);
+				WriteColor(pDst, conv->DstFormat, color);
+				pSrc += srcBpp;
+				pDst += dstBpp;
+			}
+
+			break;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t general_convertColor_8u(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette)
+{
+	UINT32 y;
+	prim_convert_t conv;
+
+	if (!primitives_convert_prepare(&conv, SrcFormat, DstFormat, palette))
+		return -1;
+
+	for (y = 0; y < height; y++)
+	{
+		primitives_convert_row(&conv, pSrc, pDst, width);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert(primitives_t* prims)
+{
+	prims->convertColor_8u = general_convertColor_8u;
+}
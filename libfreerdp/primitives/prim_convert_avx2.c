@@ -0,0 +1,157 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized pixel format conversion operations using AVX2.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static __convertColor_8u_t fallback = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* 32bpp to 32bpp, 8 pixels at a time */
+static void avx2_convert_shuffle32(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                                   UINT32 width)
+{
+	UINT32 x, p, j;
+	BYTE mask[16];
+	UINT32 fill;
+	__m256i shuffleMask, fillValue;
+	memcpy(&fill, conv->fill, sizeof(fill));
+
+	for (p = 0; p < 4; p++)
+	{
+		for (j = 0; j < 4; j++)
+		{
+			const BYTE index = conv->shuffle[j];
+			mask[p * 4 + j] = (index & 0x80) ? 0x80 : (BYTE)(p * 4 + index);
+		}
+	}
+
+	/* vpshufb works on each 128 bit lane, both lanes use the same mask */
+	shuffleMask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) mask));
+	fillValue = _mm256_set1_epi32((int) fill);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*) pSrc);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffleMask), fillValue);
+		_mm256_storeu_si256((__m256i*) pDst, v);
+		pSrc += 32;
+		pDst += 32;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static INLINE __m256i avx2_convert_pack16(const prim_convert_t* conv, __m256i v)
+{
+	const __m256i mask5 = _mm256_set1_epi32(0x1F);
+	const __m256i maskG = _mm256_set1_epi32((1 << conv->greenBits) - 1);
+	__m256i b = _mm256_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[0] + 3));
+	__m256i g = _mm256_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[1] + 8 - conv->greenBits));
+	__m256i r = _mm256_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[2] + 3));
+	b = _mm256_sll_epi32(_mm256_and_si256(b, mask5), _mm_cvtsi32_si128(conv->blueShift));
+	g = _mm256_slli_epi32(_mm256_and_si256(g, maskG), 5);
+	r = _mm256_sll_epi32(_mm256_and_si256(r, mask5), _mm_cvtsi32_si128(conv->redShift));
+	v = _mm256_or_si256(_mm256_or_si256(b, g), r);
+	/* sign extend so that the saturating pack keeps all 16 bits */
+	return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+/* 32bpp to 15/16bpp, 16 pixels at a time */
+static void avx2_convert_to16(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                              UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m256i lo = avx2_convert_pack16(conv, _mm256_loadu_si256((const __m256i*) pSrc));
+		const __m256i hi = avx2_convert_pack16(conv,
+		                                       _mm256_loadu_si256((const __m256i*)(pSrc + 32)));
+		/* the pack interleaves the lanes, put the pixels back in order */
+		const __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i*) pDst, v);
+		pSrc += 64;
+		pDst += 32;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t avx2_convertColor_8u(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette)
+{
+	UINT32 y;
+	prim_convert_t conv;
+	fkt_convertRow convertRow = NULL;
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	if ((srcBpp != 4) || ((dstBpp != 4) && (dstBpp != 2)))
+		return fallback(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat, width, height, palette);
+
+	if (!primitives_convert_prepare(&conv, SrcFormat, DstFormat, palette))
+		return -1;
+
+	switch (conv.type)
+	{
+		case PRIM_CONVERT_SHUFFLE:
+			convertRow = avx2_convert_shuffle32;
+			break;
+
+		case PRIM_CONVERT_TO_16:
+			convertRow = avx2_convert_to16;
+			break;
+
+		default:
+			return fallback(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat, width, height,
+			                palette);
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		convertRow(&conv, pSrc, pDst, width);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert_avx2(primitives_t* prims)
+{
+	fallback = prims->convertColor_8u;
+	prims->convertColor_8u = avx2_convertColor_8u;
+}
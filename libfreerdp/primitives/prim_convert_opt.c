@@ -0,0 +1,334 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized pixel format conversion operations.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+#include <winpr/sysinfo.h>
+
+#ifdef WITH_SSE2
+#include <emmintrin.h>
+#elif defined(WITH_NEON)
+#include <arm_neon.h>
+#endif /* WITH_SSE2 else WITH_NEON */
+
+#include "prim_internal.h"
+
+static primitives_t* generic = NULL;
+
+#ifdef WITH_SSE2
+/* ------------------------------------------------------------------------- */
+/* 32bpp to 32bpp, 4 pixels at a time */
+static void sse2_convert_shuffle32(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                                   UINT32 width)
+{
+	UINT32 x, j;
+	UINT32 fill;
+	__m128i fillValue;
+	__m128i srcShift[4];
+	__m128i dstShift[4];
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	memcpy(&fill, conv->fill, sizeof(fill));
+	fillValue = _mm_set1_epi32((int) fill);
+
+	for (j = 0; j < 4; j++)
+	{
+		srcShift[j] = _mm_cvtsi32_si128(8 * (conv->shuffle[j] & 0x03));
+		dstShift[j] = _mm_cvtsi32_si128(8 * j);
+	}
+
+	for (x = 0; x + 4 <= width; x += 4)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*) pSrc);
+		__m128i out = fillValue;
+
+		for (j = 0; j < 4; j++)
+		{
+			__m128i t;
+
+			if (conv->shuffle[j] & 0x80)
+				continue;
+
+			t = _mm_srl_epi32(v, srcShift[j]);
+			t = _mm_and_si128(t, byteMask);
+			t = _mm_sll_epi32(t, dstShift[j]);
+			out = _mm_or_si128(out, t);
+		}
+
+		_mm_storeu_si128((__m128i*) pDst, out);
+		pSrc += 16;
+		pDst += 16;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static INLINE __m128i sse2_convert_pack16(const prim_convert_t* conv, __m128i v)
+{
+	const __m128i mask5 = _mm_set1_epi32(0x1F);
+	const __m128i maskG = _mm_set1_epi32((1 << conv->greenBits) - 1);
+	__m128i b = _mm_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[0] + 3));
+	__m128i g = _mm_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[1] + 8 - conv->greenBits));
+	__m128i r = _mm_srl_epi32(v, _mm_cvtsi32_si128(8 * conv->shuffle[2] + 3));
+	b = _mm_sll_epi32(_mm_and_si128(b, mask5), _mm_cvtsi32_si128(conv->blueShift));
+	g = _mm_slli_epi32(_mm_and_si128(g, maskG), 5);
+	r = _mm_sll_epi32(_mm_and_si128(r, mask5), _mm_cvtsi32_si128(conv->redShift));
+	v = _mm_or_si128(_mm_or_si128(b, g), r);
+	/* sign extend so that the saturating pack keeps all 16 bits */
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+/* 32bpp to 15/16bpp, 8 pixels at a time */
+static void sse2_convert_to16(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                              UINT32 width)
+{
+	UINT32 x;
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		const __m128i lo = sse2_convert_pack16(conv, _mm_loadu_si128((const __m128i*) pSrc));
+		const __m128i hi = sse2_convert_pack16(conv, _mm_loadu_si128((const __m128i*)(pSrc + 16)));
+		_mm_storeu_si128((__m128i*) pDst, _mm_packs_epi32(lo, hi));
+		pSrc += 32;
+		pDst += 16;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static INLINE __m128i sse2_convert_unpack16(const prim_convert_t* conv, __m128i v,
+        __m128i fillValue)
+{
+	UINT32 j;
+	__m128i bgr[3];
+	__m128i out = fillValue;
+	const __m128i mask5 = _mm_set1_epi32(0x1F);
+	const __m128i maskG = _mm_set1_epi32((1 << conv->greenBits) - 1);
+	bgr[0] = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(conv->blueShift)), mask5);
+	bgr[0] = _mm_slli_epi32(bgr[0], 3);
+	bgr[1] = _mm_and_si128(_mm_srli_epi32(v, 5), maskG);
+	bgr[1] = _mm_sll_epi32(bgr[1], _mm_cvtsi32_si128(8 - conv->greenBits));
+	bgr[2] = _mm_and_si128(_mm_srl_epi32(v, _mm_cvtsi32_si128(conv->redShift)), mask5);
+	bgr[2] = _mm_slli_epi32(bgr[2], 3);
+
+	for (j = 0; j < 4; j++)
+	{
+		if (conv->shuffle[j] & 0x80)
+			continue;
+
+		out = _mm_or_si128(out, _mm_sll_epi32(bgr[conv->shuffle[j]], _mm_cvtsi32_si128(8 * j)));
+	}
+
+	return out;
+}
+
+/* 15/16bpp to 32bpp, 8 pixels at a time */
+static void sse2_convert_from16(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                                UINT32 width)
+{
+	UINT32 x;
+	UINT32 fill;
+	__m128i fillValue;
+	const __m128i zero = _mm_setzero_si128();
+	memcpy(&fill, conv->fill, sizeof(fill));
+	fillValue = _mm_set1_epi32((int) fill);
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*) pSrc);
+		const __m128i lo = sse2_convert_unpack16(conv, _mm_unpacklo_epi16(v, zero), fillValue);
+		const __m128i hi = sse2_convert_unpack16(conv, _mm_unpackhi_epi16(v, zero), fillValue);
+		_mm_storeu_si128((__m128i*) pDst, lo);
+		_mm_storeu_si128((__m128i*)(pDst + 16), hi);
+		pSrc += 16;
+		pDst += 32;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t sse2_convertColor_8u(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette)
+{
+	UINT32 y;
+	prim_convert_t conv;
+	fkt_convertRow convertRow = NULL;
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	if (!(((srcBpp == 4) && (dstBpp == 4)) || ((srcBpp == 4) && (dstBpp == 2)) ||
+	      ((srcBpp == 2) && (dstBpp == 4))))
+		return generic->convertColor_8u(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat,
+		                                width, height, palette);
+
+	if (!primitives_convert_prepare(&conv, SrcFormat, DstFormat, palette))
+		return -1;
+
+	switch (conv.type)
+	{
+		case PRIM_CONVERT_SHUFFLE:
+			convertRow = sse2_convert_shuffle32;
+			break;
+
+		case PRIM_CONVERT_TO_16:
+			convertRow = sse2_convert_to16;
+			break;
+
+		case PRIM_CONVERT_FROM_16:
+			convertRow = sse2_convert_from16;
+			break;
+
+		default:
+			convertRow = primitives_convert_row;
+			break;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		convertRow(&conv, pSrc, pDst, width);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+#elif defined(WITH_NEON)
+/* ------------------------------------------------------------------------- */
+/* 24/32bpp to 24/32bpp, 16 pixels at a time */
+static void neon_convert_shuffle(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                                 UINT32 width)
+{
+	UINT32 x, j;
+	const UINT32 srcBpp = conv->srcBpp;
+	const UINT32 dstBpp = conv->dstBpp;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		uint8x16_t in[4];
+		uint8x16_t out[4];
+
+		if (srcBpp == 4)
+		{
+			const uint8x16x4_t v = vld4q_u8(pSrc);
+			in[0] = v.val[0];
+			in[1] = v.val[1];
+			in[2] = v.val[2];
+			in[3] = v.val[3];
+		}
+		else
+		{
+			const uint8x16x3_t v = vld3q_u8(pSrc);
+			in[0] = v.val[0];
+			in[1] = v.val[1];
+			in[2] = v.val[2];
+			in[3] = v.val[2];
+		}
+
+		for (j = 0; j < dstBpp; j++)
+		{
+			const BYTE index = conv->shuffle[j];
+			out[j] = (index & 0x80) ? vdupq_n_u8(conv->fill[j]) : in[index & 0x03];
+		}
+
+		if (dstBpp == 4)
+		{
+			uint8x16x4_t v;
+			v.val[0] = out[0];
+			v.val[1] = out[1];
+			v.val[2] = out[2];
+			v.val[3] = out[3];
+			vst4q_u8(pDst, v);
+		}
+		else
+		{
+			uint8x16x3_t v;
+			v.val[0] = out[0];
+			v.val[1] = out[1];
+			v.val[2] = out[2];
+			vst3q_u8(pDst, v);
+		}
+
+		pSrc += 16 * srcBpp;
+		pDst += 16 * dstBpp;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t neon_convertColor_8u(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette)
+{
+	UINT32 y;
+	prim_convert_t conv;
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	if ((srcBpp < 3) || (dstBpp < 3))
+		return generic->convertColor_8u(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat,
+		                                width, height, palette);
+
+	if (!primitives_convert_prepare(&conv, SrcFormat, DstFormat, palette))
+		return -1;
+
+	for (y = 0; y < height; y++)
+	{
+		if (conv.type == PRIM_CONVERT_SHUFFLE)
+			neon_convert_shuffle(&conv, pSrc, pDst, width);
+		else
+			primitives_convert_row(&conv, pSrc, pDst, width);
+
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+#endif /* WITH_SSE2 else WITH_NEON */
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert_opt(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	primitives_init_convert(prims);
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+		prims->convertColor_8u = sse2_convertColor_8u;
+
+	/* the SSSE3 kernels fall back to the entry they replace */
+	primitives_init_convert_ssse3(prims);
+#elif defined(WITH_NEON)
+
+	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
+		prims->convertColor_8u = neon_convertColor_8u;
+
+#endif /* WITH_SSE2 */
+}
@@ -0,0 +1,121 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized pixel format conversion operations using SSSE3.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <freerdp/codec/color.h>
+
+#include "prim_internal.h"
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static __convertColor_8u_t fallback = NULL;
+
+/* ------------------------------------------------------------------------- */
+/* 24/32bpp to 24/32bpp with a single pshufb per 16 bytes. A 16 byte
+ * register holds 4 pixels of 32bpp or 5 pixels of 24bpp.
+ */
+static void ssse3_convert_shuffle(const prim_convert_t* conv, const BYTE* pSrc, BYTE* pDst,
+                                  UINT32 width)
+{
+	UINT32 x, p, j;
+	BYTE mask[16];
+	BYTE fill[16];
+	__m128i shuffleMask, fillValue;
+	const UINT32 srcBpp = conv->srcBpp;
+	const UINT32 dstBpp = conv->dstBpp;
+	const UINT32 pixels = 16 / ((srcBpp > dstBpp) ? srcBpp : dstBpp);
+	memset(mask, 0x80, sizeof(mask));
+	memset(fill, 0, sizeof(fill));
+
+	for (p = 0; p < pixels; p++)
+	{
+		for (j = 0; j < dstBpp; j++)
+		{
+			const BYTE index = conv->shuffle[j];
+
+			if (index & 0x80)
+				fill[p * dstBpp + j] = conv->fill[j];
+			else
+				mask[p * dstBpp + j] = (BYTE)(p * srcBpp + index);
+		}
+	}
+
+	shuffleMask = _mm_loadu_si128((const __m128i*) mask);
+	fillValue = _mm_loadu_si128((const __m128i*) fill);
+
+	/* loads and stores are 16 bytes wide, stay inside the row */
+	for (x = 0; ((x * srcBpp + 16) <= (width * srcBpp)) && ((x * dstBpp + 16) <= (width * dstBpp));
+	     x += pixels)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*) pSrc);
+		v = _mm_or_si128(_mm_shuffle_epi8(v, shuffleMask), fillValue);
+		_mm_storeu_si128((__m128i*) pDst, v);
+		pSrc += pixels * srcBpp;
+		pDst += pixels * dstBpp;
+	}
+
+	primitives_convert_row(conv, pSrc, pDst, width - x);
+}
+
+/* ------------------------------------------------------------------------- */
+static pstatus_t ssse3_convertColor_8u(
+    const BYTE* pSrc, INT32 srcStep, UINT32 SrcFormat,
+    BYTE* pDst, INT32 dstStep, UINT32 DstFormat,
+    UINT32 width, UINT32 height,
+    const gdiPalette* palette)
+{
+	UINT32 y;
+	prim_convert_t conv;
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	if ((srcBpp < 3) || (dstBpp < 3))
+		return fallback(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat, width, height, palette);
+
+	if (!primitives_convert_prepare(&conv, SrcFormat, DstFormat, palette))
+		return -1;
+
+	if (conv.type != PRIM_CONVERT_SHUFFLE)
+		return fallback(pSrc, srcStep, SrcFormat, pDst, dstStep, DstFormat, width, height, palette);
+
+	for (y = 0; y < height; y++)
+	{
+		ssse3_convert_shuffle(&conv, pSrc, pDst, width);
+		pSrc += srcStep;
+		pDst += dstStep;
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_convert_ssse3(primitives_t* prims)
+{
+	if (IsProcessorFeaturePresentEx(PF_EX_SSSE3))
+	{
+		fallback = prims->convertColor_8u;
+		prims->convertColor_8u = ssse3_convertColor_8u;
+	}
+}
@@ -45,6 +45,27 @@
 	 : _mm_load_si128((__m128i *) (_ptr_)))
 #endif
 
+#if defined(WITH_SSE2) && defined(__AVX2__)
+#include <immintrin.h>
+
+/* Writes 16 pixels from 16 bit channel values, c0 goes to the first byte of
+ * each pixel, c2 to the third and the last one is set to 0xFF.
+ * Values are clipped to [0, 255].
+ */
+static INLINE BYTE* avx2_write_pixels(BYTE* dst, __m256i c0, __m256i c1, __m256i c2)
+{
+	const __m256i c01 = _mm256_packus_epi16(c0, c1);
+	const __m256i c23 = _mm256_packus_epi16(c2, _mm256_set1_epi16(0xFF));
+	const __m256i p01 = _mm256_unpacklo_epi8(c01, _mm256_srli_si256(c01, 8));
+	const __m256i p23 = _mm256_unpacklo_epi8(c23, _mm256_srli_si256(c23, 8));
+	const __m256i lo = _mm256_unpacklo_epi16(p01, p23);
+	const __m256i hi = _mm256_unpackhi_epi16(p01, p23);
+	_mm256_storeu_si256((__m256i*) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+	return dst + 64;
+}
+#endif
+
 static INLINE BYTE* writePixelBGRX(BYTE* dst, DWORD formatSize, UINT32 format,
                                    BYTE R, BYTE G, BYTE B, BYTE A)
 {
@@ -180,8 +201,71 @@ static INLINE BYTE YUV2B(INT32 Y, INT32 U, INT32 V)
 	return CLIP(b8);
 }
 
+/* How convertColor_8u handles a pair of formats, see primitives_convert_prepare */
+typedef enum
+{
+	PRIM_CONVERT_PIXEL,		/* FreeRDPConvertColor for each pixel */
+	PRIM_CONVERT_SHUFFLE,	/* 24/32bpp to 24/32bpp, bytes are moved around */
+	PRIM_CONVERT_TO_16,		/* 24/32bpp to 15/16bpp */
+	PRIM_CONVERT_FROM_16,	/* 15/16bpp to 24/32bpp */
+	PRIM_CONVERT_PALETTE	/* 8bpp to 16/24/32bpp with a lookup table */
+} prim_convert_type;
+
+typedef struct
+{
+	prim_convert_type type;
+	UINT32 SrcFormat;
+	UINT32 DstFormat;
+	const gdiPalette* palette;
+	UINT32 srcBpp;
+	UINT32 dstBpp;
+	/* Byte i of the destination pixel is byte shuffle[i] of the source pixel,
+	 * or fill[i] if shuffle[i] is 0x80. For 15/16bpp sources the index
+	 * refers to blue, green and red. For 15/16bpp destinations shuffle holds
+	 * the source bytes of blue, green and red. */
+	BYTE shuffle[4];
+	BYTE fill[4];
+	BYTE redShift;
+	BYTE greenBits;
+	BYTE blueShift;
+	BYTE lut[256][4];
+} prim_convert_t;
+
+FREERDP_LOCAL BOOL primitives_convert_prepare(prim_convert_t* conv, UINT32 SrcFormat,
+        UINT32 DstFormat, const gdiPalette* palette);
+FREERDP_LOCAL void primitives_convert_row(const prim_convert_t* conv, const BYTE* pSrc,
+        BYTE* pDst, UINT32 width);
+
+typedef void (*fkt_convertRow)(const prim_convert_t*, const BYTE*, BYTE*, UINT32);
+
+/* Instruction set levels of the primitives, each level starts from the
+ * routines of the previous one and replaces those it implements.
+ */
+typedef enum
+{
+	PRIM_ISA_GENERIC,
+	PRIM_ISA_SIMD,	/* SSE2 to SSSE3 or NEON */
+	PRIM_ISA_AVX2,
+	PRIM_ISA_COUNT
+} prim_isa_t;
+
+/* Returns NULL if the build or the CPU lacks the instruction set. */
+FREERDP_LOCAL primitives_t* primitives_get_isa(prim_isa_t isa);
+FREERDP_LOCAL const char* primitives_get_isa_name(prim_isa_t isa);
+
+/* Fills calibrated with prims, each routine replaced by the fastest one of
+ * tables, see prim_calibrate.c. tables holds NULL for unavailable
+ * instruction sets. prims itself is left alone. */
+FREERDP_LOCAL BOOL primitives_calibrate_table(primitives_t* const tables[PRIM_ISA_COUNT],
+        const primitives_t* prims, primitives_t* calibrated, const char* cacheFile);
+/* Switches a table already in use to the calibrated routines. */
+FREERDP_LOCAL void primitives_publish_table(primitives_t* prims, const primitives_t* calibrated);
+FREERDP_LOCAL const char* primitives_calibrate_entry(primitives_t* const tables[PRIM_ISA_COUNT],
+        const primitives_t* prims, size_t index, const char** implementation);
+
 /* Function prototypes for all the init/deinit routines. */
 FREERDP_LOCAL void primitives_init_copy(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_compare(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_set(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_add(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_andor(primitives_t* prims);
@@ -191,9 +275,11 @@ FREERDP_LOCAL void primitives_init_alphaComp(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_colors(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YCoCg(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_convert(primitives_t* prims);
 
 #if defined(WITH_SSE2) || defined(WITH_NEON)
 FREERDP_LOCAL void primitives_init_copy_opt(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_compare_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_set_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_add_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_andor_opt(primitives_t* prims);
@@ -203,6 +289,18 @@ FREERDP_LOCAL void primitives_init_alphaComp_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_colors_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YCoCg_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV_opt(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_convert_opt(primitives_t* prims);
+#endif
+
+#if defined(WITH_SSE2)
+FREERDP_LOCAL void primitives_init_convert_ssse3(primitives_t* prims);
+
+FREERDP_LOCAL void primitives_init_add_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_shift_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_alphaComp_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_colors_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_YUV_avx2(primitives_t* prims);
+FREERDP_LOCAL void primitives_init_convert_avx2(primitives_t* prims);
 #endif
 
 #endif /* FREERDP_LIB_PRIM_INTERNAL_H */
@@ -65,7 +65,7 @@ static pstatus_t general_set_32s(
 	span = 1;
 	*dptr = val;
 	remaining = len - 1;
-	prims = primitives_get();
+	prims = primitives_get_generic();
 
 	while (remaining)
 	{
@@ -102,7 +102,7 @@ static pstatus_t general_set_32u(
 	span = 1;
 	*dptr = val;
 	remaining = len - 1;
-	prims = primitives_get();
+	prims = primitives_get_generic();
 
 	while (remaining)
 	{
@@ -0,0 +1,71 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * Optimized shift operations using AVX2.
+ * vi:ts=4 sw=4:
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <immintrin.h>
+
+#if !defined(WITH_SSE2)
+#error "This file needs WITH_SSE2 enabled!"
+#endif
+
+static primitives_t* generic = NULL;
+
+/* Shifts 16 values at a time, the rest is left to the generic version.
+ * Like the generic version a shift by 0 does not touch the destination.
+ */
+#define AVX2_SHIFT_ROUTINE(_name_, _type_, _fallback_, _op_) \
+	static pstatus_t _name_(const _type_* pSrc, UINT32 val, _type_* pDst, UINT32 len) \
+	{ \
+		const __m128i count = _mm_cvtsi32_si128((int) val); \
+		if (val == 0) \
+			return PRIMITIVES_SUCCESS; \
+		while (len >= 16) \
+		{ \
+			const __m256i v = _mm256_loadu_si256((const __m256i*) pSrc); \
+			_mm256_storeu_si256((__m256i*) pDst, _op_(v, count)); \
+			pSrc += 16; \
+			pDst += 16; \
+			len -= 16; \
+		} \
+		if (len > 0) \
+			return _fallback_(pSrc, val, pDst, len); \
+		return PRIMITIVES_SUCCESS; \
+	}
+
+/* ------------------------------------------------------------------------- */
+AVX2_SHIFT_ROUTINE(avx2_lShiftC_16s, INT16, generic->lShiftC_16s, _mm256_sll_epi16)
+/* ------------------------------------------------------------------------- */
+AVX2_SHIFT_ROUTINE(avx2_rShiftC_16s, INT16, generic->rShiftC_16s, _mm256_sra_epi16)
+/* ------------------------------------------------------------------------- */
+AVX2_SHIFT_ROUTINE(avx2_lShiftC_16u, UINT16, generic->lShiftC_16u, _mm256_sll_epi16)
+/* ------------------------------------------------------------------------- */
+AVX2_SHIFT_ROUTINE(avx2_rShiftC_16u, UINT16, generic->rShiftC_16u, _mm256_srl_epi16)
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_shift_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->lShiftC_16s = avx2_lShiftC_16s;
+	prims->rShiftC_16s = avx2_rShiftC_16s;
+	prims->lShiftC_16u = avx2_lShiftC_16u;
+	prims->rShiftC_16u = avx2_rShiftC_16u;
+}
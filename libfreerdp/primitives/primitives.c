@@ -23,18 +23,27 @@
 #include <stdlib.h>
 
 #include <winpr/synch.h>
+#include <winpr/sysinfo.h>
+#include <winpr/environment.h>
+#include <freerdp/log.h>
 #include <freerdp/primitives.h>
 
 #include "prim_internal.h"
 
+#define TAG FREERDP_TAG("primitives")
+
 /* Singleton pointer used throughout the program when requested. */
 static primitives_t pPrimitivesGeneric = { 0 };
 static INIT_ONCE generic_primitives_InitOnce = INIT_ONCE_STATIC_INIT;
 #if defined(HAVE_OPTIMIZED_PRIMITIVES)
 static primitives_t pPrimitives = { 0 };
+static primitives_t pPrimitivesSimd = { 0 };
 static INIT_ONCE primitives_InitOnce = INIT_ONCE_STATIC_INIT;
 #endif
-
+#if defined(WITH_SSE2)
+static primitives_t pPrimitivesAvx2 = { 0 };
+static BOOL primitivesHaveAvx2 = FALSE;
+#endif
 
 /* ------------------------------------------------------------------------- */
 static BOOL CALLBACK primitives_init_generic(PINIT_ONCE once, PVOID param, PVOID* context)
@@ -46,32 +55,105 @@ static BOOL CALLBACK primitives_init_generic(PINIT_ONCE once, PVOID param, PVOID
 	primitives_init_andor(&pPrimitivesGeneric);
 	primitives_init_alphaComp(&pPrimitivesGeneric);
 	primitives_init_copy(&pPrimitivesGeneric);
+	primitives_init_compare(&pPrimitivesGeneric);
 	primitives_init_set(&pPrimitivesGeneric);
 	primitives_init_shift(&pPrimitivesGeneric);
 	primitives_init_sign(&pPrimitivesGeneric);
 	primitives_init_colors(&pPrimitivesGeneric);
 	primitives_init_YCoCg(&pPrimitivesGeneric);
 	primitives_init_YUV(&pPrimitivesGeneric);
+	primitives_init_convert(&pPrimitivesGeneric);
 	return TRUE;
 }
 
 #if defined(HAVE_OPTIMIZED_PRIMITIVES)
+static void primitives_init_simd(primitives_t* prims)
+{
+	/* Now call each section's initialization routine. */
+	primitives_init_add_opt(prims);
+	primitives_init_andor_opt(prims);
+	primitives_init_alphaComp_opt(prims);
+	primitives_init_copy_opt(prims);
+	primitives_init_compare_opt(prims);
+	primitives_init_set_opt(prims);
+	primitives_init_shift_opt(prims);
+	primitives_init_sign_opt(prims);
+	primitives_init_colors_opt(prims);
+	primitives_init_YCoCg_opt(prims);
+	primitives_init_YUV_opt(prims);
+	primitives_init_convert_opt(prims);
+}
+
+#if defined(WITH_SSE2)
+static void primitives_init_avx2(primitives_t* prims)
+{
+	/* Start with the SSE routines, AVX2 replaces those it implements. */
+	*prims = pPrimitivesSimd;
+	primitives_init_add_avx2(prims);
+	primitives_init_shift_avx2(prims);
+	primitives_init_alphaComp_avx2(prims);
+	primitives_init_colors_avx2(prims);
+	primitives_init_YUV_avx2(prims);
+	primitives_init_convert_avx2(prims);
+}
+#endif
+
+static void primitives_get_tables(primitives_t* tables[PRIM_ISA_COUNT])
+{
+	tables[PRIM_ISA_GENERIC] = &pPrimitivesGeneric;
+	tables[PRIM_ISA_SIMD] = &pPrimitivesSimd;
+#if defined(WITH_SSE2)
+	tables[PRIM_ISA_AVX2] = primitivesHaveAvx2 ? &pPrimitivesAvx2 : NULL;
+#else
+	tables[PRIM_ISA_AVX2] = NULL;
+#endif
+}
+
+static void primitives_calibrate_from_env(primitives_t* prims)
+{
+	char* cacheFile;
+	primitives_t calibrated;
+	primitives_t* tables[PRIM_ISA_COUNT];
+	const DWORD length = GetEnvironmentVariableA("FREERDP_PRIMITIVES_CALIBRATE", NULL, 0);
+
+	if (length == 0)
+		return;
+
+	if (!(cacheFile = calloc(length, sizeof(char))))
+		return;
+
+	if (GetEnvironmentVariableA("FREERDP_PRIMITIVES_CALIBRATE", cacheFile, length) == length - 1)
+	{
+		primitives_get_tables(tables);
+
+		if (primitives_calibrate_table(tables, prims, &calibrated, cacheFile))
+			*prims = calibrated;
+		else
+			WLog_WARN(TAG, "primitives calibration failed");
+	}
+
+	free(cacheFile);
+}
+
 static BOOL CALLBACK primitives_init(PINIT_ONCE once, PVOID param, PVOID* context)
 {
 	WINPR_UNUSED(once);
 	WINPR_UNUSED(param);
 	WINPR_UNUSED(context);
-	/* Now call each section's initialization routine. */
-	primitives_init_add_opt(&pPrimitives);
-	primitives_init_andor_opt(&pPrimitives);
-	primitives_init_alphaComp_opt(&pPrimitives);
-	primitives_init_copy_opt(&pPrimitives);
-	primitives_init_set_opt(&pPrimitives);
-	primitives_init_shift_opt(&pPrimitives);
-	primitives_init_sign_opt(&pPrimitives);
-	primitives_init_colors_opt(&pPrimitives);
-	primitives_init_YCoCg_opt(&pPrimitives);
-	primitives_init_YUV_opt(&pPrimitives);
+	primitives_init_simd(&pPrimitivesSimd);
+	pPrimitives = pPrimitivesSimd;
+#if defined(WITH_SSE2)
+
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		primitives_init_avx2(&pPrimitivesAvx2);
+		primitivesHaveAvx2 = TRUE;
+		pPrimitives = pPrimitivesAvx2;
+	}
+
+#endif
+	/* No other thread sees the table before the init once completed */
+	primitives_calibrate_from_env(&pPrimitives);
 	return TRUE;
 }
 #endif
@@ -94,3 +176,83 @@ primitives_t* primitives_get_generic(void)
 	return &pPrimitivesGeneric;
 }
 
+/* ------------------------------------------------------------------------- */
+BOOL primitives_calibrate(const char* cacheFile)
+{
+#if defined(HAVE_OPTIMIZED_PRIMITIVES)
+	primitives_t calibrated;
+	primitives_t* tables[PRIM_ISA_COUNT];
+	primitives_get();
+	primitives_get_tables(tables);
+
+	if (!primitives_calibrate_table(tables, &pPrimitives, &calibrated, cacheFile))
+		return FALSE;
+
+	primitives_publish_table(&pPrimitives, &calibrated);
+	return TRUE;
+#else
+	/* nothing to choose from */
+	WINPR_UNUSED(cacheFile);
+	return TRUE;
+#endif
+}
+
+const char* primitives_get_dispatch(size_t index, const char** implementation)
+{
+	primitives_t* tables[PRIM_ISA_COUNT] = { 0 };
+	primitives_t* prims = primitives_get();
+#if defined(HAVE_OPTIMIZED_PRIMITIVES)
+	primitives_get_tables(tables);
+#else
+	tables[PRIM_ISA_GENERIC] = prims;
+#endif
+	return primitives_calibrate_entry(tables, prims, index, implementation);
+}
+
+/* ------------------------------------------------------------------------- */
+primitives_t* primitives_get_isa(prim_isa_t isa)
+{
+	switch (isa)
+	{
+		case PRIM_ISA_GENERIC:
+			return primitives_get_generic();
+#if defined(HAVE_OPTIMIZED_PRIMITIVES)
+
+		case PRIM_ISA_SIMD:
+			primitives_get();
+			return &pPrimitivesSimd;
+#endif
+#if defined(WITH_SSE2)
+
+		case PRIM_ISA_AVX2:
+			primitives_get();
+			return primitivesHaveAvx2 ? &pPrimitivesAvx2 : NULL;
+#endif
+
+		default:
+			return NULL;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+const char* primitives_get_isa_name(prim_isa_t isa)
+{
+	switch (isa)
+	{
+		case PRIM_ISA_GENERIC:
+			return "generic";
+
+		case PRIM_ISA_SIMD:
+#if defined(WITH_NEON)
+			return "NEON";
+#else
+			return "SSE";
+#endif
+
+		case PRIM_ISA_AVX2:
+			return "AVX2";
+
+		default:
+			return "unknown";
+	}
+}
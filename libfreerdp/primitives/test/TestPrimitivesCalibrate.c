@@ -0,0 +1,146 @@
+/* test_calibrate.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include <winpr/file.h>
+#include <winpr/path.h>
+#include "prim_test.h"
+
+#define MAX_ENTRIES 64
+
+static size_t get_dispatch(const char* names[MAX_ENTRIES], const char* isas[MAX_ENTRIES])
+{
+	size_t x;
+
+	for (x = 0; x < MAX_ENTRIES; x++)
+	{
+		if (!(names[x] = primitives_get_dispatch(x, &isas[x])))
+			break;
+	}
+
+	return x;
+}
+
+static BOOL test_calibrate(const char* cacheFile)
+{
+	size_t x, count;
+	FILE* fp;
+	primitives_t before;
+	const char* names[MAX_ENTRIES];
+	const char* isas[MAX_ENTRIES];
+	const char* cachedIsas[MAX_ENTRIES];
+	/* A fresh calibration writes the cache file. */
+	DeleteFileA(cacheFile);
+
+	if (!primitives_calibrate(cacheFile))
+		return FALSE;
+
+	if (!PathFileExistsA(cacheFile))
+	{
+		printf("calibration did not write %s\n", cacheFile);
+		return FALSE;
+	}
+
+	count = get_dispatch(names, isas);
+
+	if ((count == 0) || (count == MAX_ENTRIES))
+	{
+		printf("unexpected number of dispatch entries %"PRIuz"\n", count);
+		return FALSE;
+	}
+
+	for (x = 0; x < count; x++)
+	{
+		if (!isas[x] || (strcmp(isas[x], "unknown") == 0))
+		{
+			printf("%s has no implementation\n", names[x]);
+			return FALSE;
+		}
+
+		printf("%-24s %s\n", names[x], isas[x]);
+	}
+
+	/* Loading the cache gives the same table. */
+	before = *primitives_get();
+
+	if (!primitives_calibrate(cacheFile))
+		return FALSE;
+
+	if (memcmp(&before, primitives_get(), sizeof(primitives_t)) != 0)
+	{
+		printf("cached calibration differs\n");
+		return FALSE;
+	}
+
+	if (get_dispatch(names, cachedIsas) != count)
+		return FALSE;
+
+	for (x = 0; x < count; x++)
+	{
+		if (strcmp(isas[x], cachedIsas[x]) != 0)
+			return FALSE;
+	}
+
+	/* A cache file from another version or machine is replaced. */
+	if (!(fp = fopen(cacheFile, "w")))
+		return FALSE;
+
+	fprintf(fp, "FreeRDP primitives calibration 0\nadd_16s AVX512\n");
+	fclose(fp);
+
+	if (!primitives_calibrate(cacheFile))
+		return FALSE;
+
+	if (!(fp = fopen(cacheFile, "r")))
+		return FALSE;
+
+	{
+		char line[256] = { 0 };
+		const BOOL rewritten = fgets(line, sizeof(line), fp) &&
+		                       (strncmp(line, "FreeRDP primitives calibration 1", 32) == 0);
+		fclose(fp);
+
+		if (!rewritten)
+		{
+			printf("stale cache file was not replaced\n");
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+int TestPrimitivesCalibrate(int argc, char* argv[])
+{
+	int rc = 1;
+	char* cacheFile = GetKnownSubPath(KNOWN_PATH_TEMP, "TestPrimitivesCalibrate.cache");
+	prim_test_setup(FALSE);
+
+	if (!cacheFile)
+		return 1;
+
+	if (test_calibrate(cacheFile))
+		rc = 0;
+
+	DeleteFileA(cacheFile);
+	free(cacheFile);
+	return rc;
+}
@@ -0,0 +1,194 @@
+/* test_compare.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include "prim_test.h"
+
+#define COMPARE_WIDTH 67
+#define COMPARE_HEIGHT 19
+#define COMPARE_STEP ((COMPARE_WIDTH + 5) * 4)
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_compare32u_func(void)
+{
+	BYTE ALIGN(src1[COMPARE_STEP * COMPARE_HEIGHT + 4]);
+	BYTE ALIGN(src2[COMPARE_STEP * COMPARE_HEIGHT + 4]);
+	UINT32 width, height, offset;
+	winpr_RAND(src1, sizeof(src1));
+
+	for (width = 1; width <= COMPARE_WIDTH; width++)
+	{
+		for (height = 1; height <= COMPARE_HEIGHT; height += 3)
+		{
+			BOOL equalGeneric = FALSE;
+			BOOL equalOptimized = FALSE;
+			const UINT32 size = (height - 1) * COMPARE_STEP + width * 4;
+			memcpy(src2, src1, sizeof(src2));
+
+			if ((generic->compare_32u(src1, COMPARE_STEP, src2, COMPARE_STEP, width, height,
+			                          &equalGeneric) != PRIMITIVES_SUCCESS) ||
+			    (optimized->compare_32u(src1 + 1, COMPARE_STEP, src2 + 1, COMPARE_STEP, width,
+			                            height, &equalOptimized) != PRIMITIVES_SUCCESS))
+				return FALSE;
+
+			if (!equalGeneric || !equalOptimized)
+			{
+				printf("COMPARE32U FAIL: equal blocks %"PRIu32"x%"PRIu32" reported different\n",
+				       width, height);
+				return FALSE;
+			}
+
+			/* Flip every byte of the block once, bytes in the padding must not matter */
+			for (offset = 0; offset < size; offset++)
+			{
+				const BOOL inside = ((offset % COMPARE_STEP) < width * 4);
+				src2[offset] ^= 0x40;
+
+				if ((generic->compare_32u(src1, COMPARE_STEP, src2, COMPARE_STEP, width, height,
+				                          &equalGeneric) != PRIMITIVES_SUCCESS) ||
+				    (optimized->compare_32u(src1, COMPARE_STEP, src2, COMPARE_STEP, width, height,
+				                            &equalOptimized) != PRIMITIVES_SUCCESS))
+					return FALSE;
+
+				src2[offset] ^= 0x40;
+
+				if ((equalGeneric == inside) || (equalOptimized == inside))
+				{
+					printf("COMPARE32U FAIL: %"PRIu32"x%"PRIu32" offset=%"PRIu32" generic=%d "
+					       "optimized=%d\n", width, height, offset, equalGeneric, equalOptimized);
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_solid32u_func(void)
+{
+	BYTE ALIGN(src[COMPARE_STEP * COMPARE_HEIGHT + 4]);
+	UINT32 width, height, offset;
+	const UINT32 fill = 0x80C0FFEE;
+
+	for (offset = 0; offset < sizeof(src); offset += 4)
+		memcpy(&src[offset], &fill, sizeof(fill));
+
+	for (width = 1; width <= COMPARE_WIDTH; width++)
+	{
+		for (height = 1; height <= COMPARE_HEIGHT; height += 3)
+		{
+			BOOL solidGeneric = FALSE;
+			BOOL solidOptimized = FALSE;
+			UINT32 colorGeneric = 0;
+			UINT32 colorOptimized = 0;
+			const UINT32 size = (height - 1) * COMPARE_STEP + width * 4;
+
+			if ((generic->solid_32u(src, COMPARE_STEP, width, height, &colorGeneric,
+			                        &solidGeneric) != PRIMITIVES_SUCCESS) ||
+			    (optimized->solid_32u(src, COMPARE_STEP, width, height, &colorOptimized,
+			                          &solidOptimized) != PRIMITIVES_SUCCESS))
+				return FALSE;
+
+			if (!solidGeneric || !solidOptimized || (colorGeneric != fill) ||
+			    (colorOptimized != fill))
+			{
+				printf("SOLID32U FAIL: solid block %"PRIu32"x%"PRIu32" not detected\n", width, height);
+				return FALSE;
+			}
+
+			/* Change every byte past the first pixel once, the padding must not matter */
+			for (offset = 4; offset < size; offset++)
+			{
+				const BOOL inside = ((offset % COMPARE_STEP) < width * 4);
+				src[offset] ^= 0x01;
+
+				if ((generic->solid_32u(src, COMPARE_STEP, width, height, &colorGeneric,
+				                        &solidGeneric) != PRIMITIVES_SUCCESS) ||
+				    (optimized->solid_32u(src, COMPARE_STEP, width, height, &colorOptimized,
+				                          &solidOptimized) != PRIMITIVES_SUCCESS))
+					return FALSE;
+
+				src[offset] ^= 0x01;
+
+				if ((solidGeneric == inside) || (solidOptimized == inside))
+				{
+					printf("SOLID32U FAIL: %"PRIu32"x%"PRIu32" offset=%"PRIu32" generic=%d "
+					       "optimized=%d\n", width, height, offset, solidGeneric, solidOptimized);
+					return FALSE;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_compare32u_speed(void)
+{
+	BYTE ALIGN(src1[MAX_TEST_SIZE * 4 + 4]);
+	BYTE ALIGN(src2[MAX_TEST_SIZE * 4 + 4]);
+	BOOL equal;
+	UINT32 color;
+	winpr_RAND(src1, sizeof(src1));
+	memcpy(src2, src1, sizeof(src2));
+
+	if (!speed_test("compare_32u", "16x16", g_Iterations,
+	                (speed_test_fkt)generic->compare_32u,
+	                (speed_test_fkt)optimized->compare_32u,
+	                src1, 64, src2, 64, 16, 16, &equal))
+		return FALSE;
+
+	if (!speed_test("compare_32u", "64x64", g_Iterations,
+	                (speed_test_fkt)generic->compare_32u,
+	                (speed_test_fkt)optimized->compare_32u,
+	                src1, 256, src2, 256, 64, 64, &equal))
+		return FALSE;
+
+	memset(src1, 0xA5, sizeof(src1));
+
+	if (!speed_test("solid_32u", "64x64", g_Iterations,
+	                (speed_test_fkt)generic->solid_32u,
+	                (speed_test_fkt)optimized->solid_32u,
+	                src1, 256, 64, 64, &color, &equal))
+		return FALSE;
+
+	return TRUE;
+}
+
+int TestPrimitivesCompare(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+	prim_test_setup(FALSE);
+
+	if (!test_compare32u_func())
+		return 1;
+
+	if (!test_solid32u_func())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_compare32u_speed())
+			return 1;
+	}
+
+	return 0;
+}
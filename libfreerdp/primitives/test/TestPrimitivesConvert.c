@@ -0,0 +1,258 @@
+/* test_convert.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include "prim_test.h"
+#include <freerdp/codec/color.h>
+#include <freerdp/utils/profiler.h>
+
+#define GUARD_BYTES 19
+
+static const UINT32 srcFormats[] =
+{
+	PIXEL_FORMAT_ARGB32,
+	PIXEL_FORMAT_XRGB32,
+	PIXEL_FORMAT_ABGR32,
+	PIXEL_FORMAT_XBGR32,
+	PIXEL_FORMAT_BGRA32,
+	PIXEL_FORMAT_BGRX32,
+	PIXEL_FORMAT_RGBA32,
+	PIXEL_FORMAT_RGBX32,
+	PIXEL_FORMAT_RGB24,
+	PIXEL_FORMAT_BGR24,
+	PIXEL_FORMAT_RGB16,
+	PIXEL_FORMAT_BGR16,
+	PIXEL_FORMAT_ARGB15,
+	PIXEL_FORMAT_RGB15,
+	PIXEL_FORMAT_ABGR15,
+	PIXEL_FORMAT_BGR15,
+	PIXEL_FORMAT_RGB8
+};
+
+/* ------------------------------------------------------------------------- */
+static void reference_convert(const BYTE* pSrc, UINT32 srcStep, UINT32 SrcFormat,
+                              BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+                              UINT32 width, UINT32 height, const gdiPalette* palette)
+{
+	UINT32 x, y;
+	const UINT32 srcBpp = GetBytesPerPixel(SrcFormat);
+	const UINT32 dstBpp = GetBytesPerPixel(DstFormat);
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			UINT32 color = ReadColor(&pSrc[y * srcStep + x * srcBpp], SrcFormat);
+			color = FreeRDPConvertColor(color, SrcFormat, DstFormat, palette);
+			WriteColor(&pDst[y * dstStep + x * dstBpp], DstFormat, color);
+		}
+	}
+}
+
+static BOOL check_convert(const char* name, primitives_t* prims, const BYTE* src,
+                          UINT32 SrcFormat, UINT32 DstFormat, UINT32 width, UINT32 height,
+                          const gdiPalette* palette)
+{
+	BOOL rc = FALSE;
+	BYTE* expected = NULL;
+	BYTE* actual = NULL;
+	const UINT32 srcStep = width * GetBytesPerPixel(SrcFormat) + 7;
+	/* the gap after each row catches writes past the end of a line */
+	const UINT32 dstStep = width * GetBytesPerPixel(DstFormat) + GUARD_BYTES;
+	const size_t size = dstStep * height + GUARD_BYTES;
+	expected = malloc(size);
+	actual = malloc(size);
+
+	if (!expected || !actual)
+		goto fail;
+
+	memset(expected, 0xA5, size);
+	memset(actual, 0xA5, size);
+	reference_convert(src, srcStep, SrcFormat, expected, dstStep, DstFormat, width, height,
+	                  palette);
+
+	if (prims->convertColor_8u(src, srcStep, SrcFormat, actual, dstStep, DstFormat,
+	                           width, height, palette) != PRIMITIVES_SUCCESS)
+	{
+		printf("%s convertColor_8u %s -> %s failed\n", name,
+		       FreeRDPGetColorFormatName(SrcFormat), FreeRDPGetColorFormatName(DstFormat));
+		goto fail;
+	}
+
+	if (memcmp(expected, actual, size) != 0)
+	{
+		size_t i;
+
+		for (i = 0; i < size; i++)
+		{
+			if (expected[i] != actual[i])
+				break;
+		}
+
+		printf("%s convertColor_8u %s -> %s [%"PRIu32"x%"PRIu32"] mismatch at offset %"PRIuz
+		       ": expected 0x%02"PRIx8" got 0x%02"PRIx8"\n", name,
+		       FreeRDPGetColorFormatName(SrcFormat), FreeRDPGetColorFormatName(DstFormat),
+		       width, height, i, expected[i], actual[i]);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(expected);
+	free(actual);
+	return rc;
+}
+
+static BOOL test_convertColor_8u_func(void)
+{
+	BOOL rc = FALSE;
+	UINT32 i, j, k;
+	BYTE* src = NULL;
+	gdiPalette palette;
+	const UINT32 widths[] = { 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 64, 67 };
+	const UINT32 height = 5;
+	const size_t size = (67 * 4 + 7) * height;
+	src = malloc(size);
+
+	if (!src)
+		return FALSE;
+
+	winpr_RAND(src, size);
+	palette.format = PIXEL_FORMAT_XRGB32;
+	winpr_RAND((BYTE*) palette.palette, sizeof(palette.palette));
+
+	for (i = 0; i < sizeof(srcFormats) / sizeof(srcFormats[0]); i++)
+	{
+		/* 8bpp is only a source format */
+		for (j = 0; j < sizeof(srcFormats) / sizeof(srcFormats[0]) - 1; j++)
+		{
+			for (k = 0; k < sizeof(widths) / sizeof(widths[0]); k++)
+			{
+				/* start at an odd offset to test unaligned access */
+				if (!check_convert("generic", generic, src + 1, srcFormats[i], srcFormats[j],
+				                   widths[k], height, &palette))
+					goto fail;
+
+				if (!check_convert("optimized", optimized, src + 1, srcFormats[i], srcFormats[j],
+				                   widths[k], height, &palette))
+					goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	free(src);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_convertColor_8u_speed(UINT32 SrcFormat, UINT32 DstFormat)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	BYTE* src = NULL;
+	BYTE* dst = NULL;
+	gdiPalette palette;
+	const UINT32 width = 1920;
+	const UINT32 height = 1080;
+	const UINT32 srcStep = width * GetBytesPerPixel(SrcFormat);
+	const UINT32 dstStep = width * GetBytesPerPixel(DstFormat);
+	PROFILER_DEFINE(refProf)
+	PROFILER_DEFINE(genericProf)
+	PROFILER_DEFINE(optProf)
+	src = _aligned_malloc(srcStep * height, 16);
+	dst = _aligned_malloc(dstStep * height, 16);
+
+	if (!src || !dst)
+		goto fail;
+
+	winpr_RAND(src, srcStep * height);
+	palette.format = PIXEL_FORMAT_XRGB32;
+	winpr_RAND((BYTE*) palette.palette, sizeof(palette.palette));
+	PROFILER_CREATE(refProf, "convertColor_8u-PIXEL")
+	PROFILER_CREATE(genericProf, "convertColor_8u-GENERIC")
+	PROFILER_CREATE(optProf, "convertColor_8u-OPT")
+
+	for (i = 0; i < 10; i++)
+	{
+		PROFILER_ENTER(refProf)
+		reference_convert(src, srcStep, SrcFormat, dst, dstStep, DstFormat, width, height,
+		                  &palette);
+		PROFILER_EXIT(refProf)
+		PROFILER_ENTER(genericProf)
+
+		if (generic->convertColor_8u(src, srcStep, SrcFormat, dst, dstStep, DstFormat,
+		                             width, height, &palette) != PRIMITIVES_SUCCESS)
+			goto loop_fail;
+
+		PROFILER_EXIT(genericProf)
+		PROFILER_ENTER(optProf)
+
+		if (optimized->convertColor_8u(src, srcStep, SrcFormat, dst, dstStep, DstFormat,
+		                               width, height, &palette) != PRIMITIVES_SUCCESS)
+			goto loop_fail;
+
+		PROFILER_EXIT(optProf)
+	}
+
+	printf("--------------------------- [%s -> %s] [%"PRIu32"x%"PRIu32"] ---------------------------\n",
+	       FreeRDPGetColorFormatName(SrcFormat), FreeRDPGetColorFormatName(DstFormat),
+	       width, height);
+	PROFILER_PRINT_HEADER
+	PROFILER_PRINT(refProf)
+	PROFILER_PRINT(genericProf)
+	PROFILER_PRINT(optProf)
+	PROFILER_PRINT_FOOTER
+	rc = TRUE;
+loop_fail:
+	PROFILER_FREE(refProf)
+	PROFILER_FREE(genericProf)
+	PROFILER_FREE(optProf)
+fail:
+	_aligned_free(src);
+	_aligned_free(dst);
+	return rc;
+}
+
+int TestPrimitivesConvert(int argc, char* argv[])
+{
+	prim_test_setup(FALSE);
+
+	if (!test_convertColor_8u_func())
+		return 1;
+
+	if (!test_convertColor_8u_speed(PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGBX32))
+		return 1;
+
+	if (!test_convertColor_8u_speed(PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGB16))
+		return 1;
+
+	if (!test_convertColor_8u_speed(PIXEL_FORMAT_RGB16, PIXEL_FORMAT_BGRX32))
+		return 1;
+
+	if (!test_convertColor_8u_speed(PIXEL_FORMAT_BGR24, PIXEL_FORMAT_BGRX32))
+		return 1;
+
+	if (!test_convertColor_8u_speed(PIXEL_FORMAT_RGB8, PIXEL_FORMAT_BGRX32))
+		return 1;
+
+	return 0;
+}
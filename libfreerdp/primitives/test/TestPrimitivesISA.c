@@ -0,0 +1,375 @@
+/* test_isa.c
+ * Checks the routines of each instruction set table against each other.
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <winpr/sysinfo.h>
+#include "../prim_internal.h"
+#include "prim_test.h"
+#include <freerdp/codec/color.h>
+
+#define TILE_WIDTH 256
+#define TILE_HEIGHT 64
+#define TILE_PIXELS (TILE_WIDTH * TILE_HEIGHT)
+
+/* Not a multiple of any vector width, to exercise the scalar tails. */
+#define ODD_LENGTH 1021
+
+static BOOL check_equal(const char* func, prim_isa_t isa, const void* expected,
+                        const void* actual, size_t size)
+{
+	size_t i;
+	const BYTE* e = (const BYTE*) expected;
+	const BYTE* a = (const BYTE*) actual;
+
+	for (i = 0; i < size; i++)
+	{
+		if (e[i] != a[i])
+		{
+			printf("%s %s mismatch at offset %"PRIuz": expected 0x%02"PRIx8" got 0x%02"PRIx8"\n",
+			       primitives_get_isa_name(isa), func, i, e[i], a[i]);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_add_shift(prim_isa_t isa, primitives_t* prims, primitives_t* ref)
+{
+	UINT32 val;
+	INT16 ALIGN(a[ODD_LENGTH]), ALIGN(b[ODD_LENGTH]);
+	INT16 ALIGN(expected[ODD_LENGTH]), ALIGN(actual[ODD_LENGTH]);
+	winpr_RAND((BYTE*) a, sizeof(a));
+	winpr_RAND((BYTE*) b, sizeof(b));
+
+	if ((ref->add_16s(a, b, expected, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+	    (prims->add_16s(a, b, actual, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+	    !check_equal("add_16s", isa, expected, actual, sizeof(expected)))
+		return FALSE;
+
+	for (val = 1; val < 16; val++)
+	{
+		if ((ref->lShiftC_16s(a, val, expected, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    (prims->lShiftC_16s(a, val, actual, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("lShiftC_16s", isa, expected, actual, sizeof(expected)))
+			return FALSE;
+
+		if ((ref->rShiftC_16s(a, val, expected, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    (prims->rShiftC_16s(a, val, actual, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("rShiftC_16s", isa, expected, actual, sizeof(expected)))
+			return FALSE;
+
+		if ((ref->lShiftC_16u((UINT16*) a, val, (UINT16*) expected, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    (prims->lShiftC_16u((UINT16*) a, val, (UINT16*) actual, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("lShiftC_16u", isa, expected, actual, sizeof(expected)))
+			return FALSE;
+
+		if ((ref->rShiftC_16u((UINT16*) a, val, (UINT16*) expected, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    (prims->rShiftC_16u((UINT16*) a, val, (UINT16*) actual, ODD_LENGTH) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("rShiftC_16u", isa, expected, actual, sizeof(expected)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_alphaComp(prim_isa_t isa, primitives_t* prims, primitives_t* ref)
+{
+	BOOL rc = FALSE;
+	const UINT32 step = TILE_WIDTH * 4;
+	const size_t size = step * TILE_HEIGHT;
+	BYTE* src1 = _aligned_malloc(size, 32);
+	BYTE* src2 = _aligned_malloc(size, 32);
+	BYTE* expected = _aligned_malloc(size, 32);
+	BYTE* actual = _aligned_malloc(size, 32);
+
+	if (!src1 || !src2 || !expected || !actual)
+		goto fail;
+
+	winpr_RAND(src1, size);
+	winpr_RAND(src2, size);
+
+	if ((ref->alphaComp_argb(src1, step, src2, step, expected, step, TILE_WIDTH,
+	                         TILE_HEIGHT) != PRIMITIVES_SUCCESS) ||
+	    (prims->alphaComp_argb(src1, step, src2, step, actual, step, TILE_WIDTH,
+	                           TILE_HEIGHT) != PRIMITIVES_SUCCESS))
+		goto fail;
+
+	rc = check_equal("alphaComp_argb", isa, expected, actual, size);
+fail:
+	_aligned_free(src1);
+	_aligned_free(src2);
+	_aligned_free(expected);
+	_aligned_free(actual);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_yCbCrToRGB(prim_isa_t isa, primitives_t* prims, primitives_t* ref)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	const UINT32 formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGBX32 };
+	const prim_size_t roi = { 64, 64 };
+	const size_t size = 64 * 64 * 4;
+	INT16* planes[3] = { NULL };
+	BYTE* expected = _aligned_malloc(size, 16);
+	BYTE* actual = _aligned_malloc(size, 16);
+
+	for (i = 0; i < 3; i++)
+	{
+		UINT32 x;
+
+		if (!(planes[i] = _aligned_malloc(64 * 64 * sizeof(INT16), 16)))
+			goto fail;
+
+		winpr_RAND((BYTE*) planes[i], 64 * 64 * sizeof(INT16));
+
+		/* keep the values in the range the RemoteFX decoder produces */
+		for (x = 0; x < 64 * 64; x++)
+			planes[i][x] = (INT16)(planes[i][x] % 4096);
+	}
+
+	if (!expected || !actual)
+		goto fail;
+
+	for (i = 0; i < ARRAYSIZE(formats); i++)
+	{
+		if ((ref->yCbCrToRGB_16s8u_P3AC4R((const INT16**) planes, 64 * sizeof(INT16), expected,
+		                                  64 * 4, formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    (prims->yCbCrToRGB_16s8u_P3AC4R((const INT16**) planes, 64 * sizeof(INT16), actual,
+		                                    64 * 4, formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("yCbCrToRGB_16s8u_P3AC4R", isa, expected, actual, size))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < 3; i++)
+		_aligned_free(planes[i]);
+
+	_aligned_free(expected);
+	_aligned_free(actual);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_YUVToRGB(prim_isa_t isa, primitives_t* prims, primitives_t* ref)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	const UINT32 formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGBX32 };
+	/* an odd width exercises the scalar tail of the vector versions */
+	const prim_size_t roi = { TILE_WIDTH - 6, TILE_HEIGHT };
+	const UINT32 srcStep[3] = { TILE_WIDTH, TILE_WIDTH, TILE_WIDTH };
+	const size_t size = TILE_PIXELS * 4;
+	BYTE* planes[3] = { NULL };
+	BYTE* expected = _aligned_malloc(size, 16);
+	BYTE* actual = _aligned_malloc(size, 16);
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!(planes[i] = _aligned_malloc(TILE_PIXELS, 16)))
+			goto fail;
+
+		winpr_RAND(planes[i], TILE_PIXELS);
+	}
+
+	if (!expected || !actual)
+		goto fail;
+
+	for (i = 0; i < ARRAYSIZE(formats); i++)
+	{
+		memset(expected, 0, size);
+		memset(actual, 0, size);
+
+		if ((ref->YUV420ToRGB_8u_P3AC4R((const BYTE**) planes, srcStep, expected, TILE_WIDTH * 4,
+		                                formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    (prims->YUV420ToRGB_8u_P3AC4R((const BYTE**) planes, srcStep, actual, TILE_WIDTH * 4,
+		                                  formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("YUV420ToRGB_8u_P3AC4R", isa, expected, actual, size))
+			goto fail;
+
+		if ((ref->YUV444ToRGB_8u_P3AC4R((const BYTE**) planes, srcStep, expected, TILE_WIDTH * 4,
+		                                formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    (prims->YUV444ToRGB_8u_P3AC4R((const BYTE**) planes, srcStep, actual, TILE_WIDTH * 4,
+		                                  formats[i], &roi) != PRIMITIVES_SUCCESS) ||
+		    !check_equal("YUV444ToRGB_8u_P3AC4R", isa, expected, actual, size))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < 3; i++)
+		_aligned_free(planes[i]);
+
+	_aligned_free(expected);
+	_aligned_free(actual);
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_RGBToAVC444YUV(prim_isa_t isa, primitives_t* prims, primitives_t* ref)
+{
+	BOOL rc = FALSE;
+	UINT32 i;
+	const prim_size_t roi = { TILE_WIDTH, TILE_HEIGHT };
+	const UINT32 step[3] = { TILE_WIDTH, TILE_WIDTH, TILE_WIDTH };
+	BYTE* src = _aligned_malloc(TILE_PIXELS * 4, 16);
+	BYTE* expected[6] = { NULL };
+	BYTE* actual[6] = { NULL };
+
+	if (!src)
+		goto fail;
+
+	winpr_RAND(src, TILE_PIXELS * 4);
+
+	for (i = 0; i < 6; i++)
+	{
+		expected[i] = _aligned_malloc(TILE_PIXELS, 16);
+		actual[i] = _aligned_malloc(TILE_PIXELS, 16);
+
+		if (!expected[i] || !actual[i])
+			goto fail;
+
+		memset(expected[i], 0, TILE_PIXELS);
+		memset(actual[i], 0, TILE_PIXELS);
+	}
+
+	if ((ref->RGBToAVC444YUV(src, PIXEL_FORMAT_BGRX32, TILE_WIDTH * 4, expected, step,
+	                         &expected[3], step, &roi) != PRIMITIVES_SUCCESS) ||
+	    (prims->RGBToAVC444YUV(src, PIXEL_FORMAT_BGRX32, TILE_WIDTH * 4, actual, step,
+	                           &actual[3], step, &roi) != PRIMITIVES_SUCCESS))
+		goto fail;
+
+	for (i = 0; i < 6; i++)
+	{
+		if (!check_equal("RGBToAVC444YUV", isa, expected[i], actual[i], TILE_PIXELS))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	_aligned_free(src);
+
+	for (i = 0; i < 6; i++)
+	{
+		_aligned_free(expected[i]);
+		_aligned_free(actual[i]);
+	}
+
+	return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_isa_speed(void)
+{
+	primitives_t* prims;
+	const prim_size_t roi = { TILE_WIDTH, TILE_HEIGHT };
+	const UINT32 step[3] = { TILE_WIDTH, TILE_WIDTH, TILE_WIDTH };
+	BYTE* rgb = _aligned_malloc(TILE_PIXELS * 4, 16);
+	BYTE* yuv = _aligned_malloc(TILE_PIXELS * 6, 16);
+	BYTE* planes[6];
+	UINT32 i;
+
+	if (!rgb || !yuv)
+	{
+		_aligned_free(rgb);
+		_aligned_free(yuv);
+		return FALSE;
+	}
+
+	winpr_RAND(rgb, TILE_PIXELS * 4);
+	winpr_RAND(yuv, TILE_PIXELS * 6);
+
+	for (i = 0; i < 6; i++)
+		planes[i] = &yuv[i * TILE_PIXELS];
+
+	MEASURE_ISA_SPEEDUP("add_16s", 1000, prims,
+	                    prims->add_16s((INT16*) yuv, (INT16*)(yuv + TILE_PIXELS * 2),
+	                                   (INT16*)(yuv + TILE_PIXELS * 4), TILE_PIXELS));
+	MEASURE_ISA_SPEEDUP("lShiftC_16s", 1000, prims,
+	                    prims->lShiftC_16s((INT16*) yuv, 5, (INT16*)(yuv + TILE_PIXELS * 2),
+	                                       TILE_PIXELS));
+	MEASURE_ISA_SPEEDUP("alphaComp_argb", 100, prims,
+	                    prims->alphaComp_argb(rgb, TILE_WIDTH * 4, rgb, TILE_WIDTH * 4, rgb,
+	                                          TILE_WIDTH * 4, TILE_WIDTH, TILE_HEIGHT));
+	MEASURE_ISA_SPEEDUP("YUV420ToRGB", 100, prims,
+	                    prims->YUV420ToRGB_8u_P3AC4R((const BYTE**) planes, step, rgb,
+	                            TILE_WIDTH * 4, PIXEL_FORMAT_BGRX32, &roi));
+	MEASURE_ISA_SPEEDUP("YUV444ToRGB", 100, prims,
+	                    prims->YUV444ToRGB_8u_P3AC4R((const BYTE**) planes, step, rgb,
+	                            TILE_WIDTH * 4, PIXEL_FORMAT_BGRX32, &roi));
+	MEASURE_ISA_SPEEDUP("RGBToAVC444YUV", 100, prims,
+	                    prims->RGBToAVC444YUV(rgb, PIXEL_FORMAT_BGRX32, TILE_WIDTH * 4, planes, step,
+	                                          &planes[3], step, &roi));
+	_aligned_free(rgb);
+	_aligned_free(yuv);
+	return TRUE;
+}
+
+int TestPrimitivesISA(int argc, char* argv[])
+{
+	int isa;
+	primitives_t* generic_prims = primitives_get_isa(PRIM_ISA_GENERIC);
+	primitives_t* simd_prims = primitives_get_isa(PRIM_ISA_SIMD);
+	prim_test_setup(FALSE);
+
+	for (isa = PRIM_ISA_SIMD; isa < PRIM_ISA_COUNT; isa++)
+	{
+		primitives_t* prims = primitives_get_isa((prim_isa_t) isa);
+
+		if (!prims)
+		{
+			printf("%s not available, skipping\n", primitives_get_isa_name((prim_isa_t) isa));
+			continue;
+		}
+
+		/* These are exact in every version. */
+		if (!test_add_shift((prim_isa_t) isa, prims, generic_prims))
+			return 1;
+
+		if (!test_YUVToRGB((prim_isa_t) isa, prims, generic_prims))
+			return 1;
+
+		/* The SSE versions of these use a different rounding than the generic
+		 * ones, the AVX2 versions have to match the SSE ones. */
+		if (isa > PRIM_ISA_SIMD)
+		{
+			if (!test_alphaComp((prim_isa_t) isa, prims, simd_prims))
+				return 1;
+
+			if (!test_yCbCrToRGB((prim_isa_t) isa, prims, simd_prims))
+				return 1;
+
+			if (!test_RGBToAVC444YUV((prim_isa_t) isa, prims, simd_prims))
+				return 1;
+		}
+	}
+
+	if (!test_isa_speed())
+		return 1;
+
+	return 0;
+}
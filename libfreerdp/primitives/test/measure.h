@@ -48,6 +48,7 @@
 #define MEASURE_SHOW_RESULTS(_result_)
 #define MEASURE_SHOW_RESULTS_SCALED(_scale_, _label_)
 #define MEASURE_TIMED(_label_, _init_iter_, _test_time_, _result_, _call_)
+#define MEASURE_ISA_SPEEDUP(_label_, _count_, _prims_, _call_)
 
 #else
 
@@ -134,6 +135,32 @@ extern void _floatprint(float t, char* output);
 		MEASURE_SHOW_RESULTS(_result_);  \
 	}
 
+/* Runs _call_ _count_ times with _prims_ set to each instruction set table
+ * available (see primitives_get_isa) and prints the speedup over generic.
+ */
+#define MEASURE_ISA_SPEEDUP(_label_, _count_, _prims_, _call_)  \
+	{   int _isa;  \
+		float _generic = 0.0f;  \
+		for (_isa = PRIM_ISA_GENERIC; _isa < PRIM_ISA_COUNT; _isa++)  \
+		{   struct timespec _start, _stop;  \
+			int _loop;  \
+			float _delta;  \
+			(_prims_) = primitives_get_isa((prim_isa_t) _isa);  \
+			if (!(_prims_))  \
+				continue;  \
+			clock_gettime(CLOCK_MONOTONIC_RAW, &_start);  \
+			for (_loop = 0; _loop < (_count_); _loop++)  \
+				_call_;  \
+			clock_gettime(CLOCK_MONOTONIC_RAW, &_stop);  \
+			_delta = _delta_time(&_start, &_stop);  \
+			if (_isa == PRIM_ISA_GENERIC)  \
+				_generic = _delta;  \
+			printf("%s %-8s: %9d iterations in %7.4f seconds, speedup %5.2fx\n",  \
+			       (_label_), primitives_get_isa_name((prim_isa_t) _isa), (_count_), _delta,  \
+			       (_delta > 0.0f) ? _generic / _delta : 0.0f);  \
+		}  \
+	}
+
 #endif
 
 #endif // __MEASURE_H_INCLUDED__
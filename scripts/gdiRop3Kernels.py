@@ -0,0 +1,59 @@
+#!/usr/bin/python
+#
+#  Generates the ROP3 row kernels of libfreerdp/gdi/rop3.c from the reverse
+#  polish notation strings in the rop3_code_table of libfreerdp/gdi/gdi.c
+#
+#    sample usage:
+#     $ python scripts/gdiRop3Kernels.py libfreerdp/gdi/gdi.c
+#     then replace the generated section of libfreerdp/gdi/rop3.c with the output
+import re
+import sys
+
+BINARY = { 'a': '&', 'o': '|', 'x': '^' }
+
+def toInfix(rop):
+    stack = []
+
+    for op in rop:
+        if op in 'DSP':
+            stack.append(op)
+        elif op == 'n':
+            stack.append('~' + stack.pop())
+        elif op in BINARY:
+            b = stack.pop()
+            a = stack.pop()
+            stack.append('(%s %s %s)' % (a, BINARY[op], b))
+        elif op == '0':
+            stack.append('0')
+        elif op == '1':
+            stack.append('0xFFFFFFFF')
+        else:
+            raise ValueError('invalid operator %s in %s' % (op, rop))
+
+    expr = stack[0]
+
+    if expr.startswith('(') and expr.endswith(')'):
+        expr = expr[1:-1]
+
+    return expr
+
+def truthTable(expr):
+    # the ROP3 index is the result for D = 0xAA, S = 0xCC, P = 0xF0
+    return eval(expr.replace('D', '0xAA').replace('S', '0xCC').replace('P', '0xF0')) & 0xFF
+
+if __name__ == '__main__':
+    source = open(sys.argv[1]).read()
+    table = source[source.index('rop3_code_table[]'):]
+    table = table[:table.index('};')]
+    entries = re.findall(r'\{\s*(GDI_\w+)\s*,\s*"(\w+)"\s*\}', table)
+
+    if len(entries) != 256:
+        raise ValueError('expected 256 ROP3 codes, found %d' % len(entries))
+
+    for code, (name, rop) in enumerate(entries):
+        expr = toInfix(rop)
+
+        if truthTable(expr) != code:
+            sys.stderr.write('warning: %s (%s) does not match code 0x%02X\n' % (name, rop, code))
+
+        print('GDI_ROP3_KERNEL(%02X, %s) /* %s %s */' % (code, expr, name, rop))
@@ -38,6 +38,7 @@ typedef struct connection_info connectionInfo;
 typedef struct proxy_events proxyEvents;
 typedef struct proxy_keyboard_event_info proxyKeyboardEventInfo;
 typedef struct proxy_mouse_event_info proxyMouseEventInfo;
+typedef struct proxy_gfx_event_info proxyGfxEventInfo;
 typedef PF_FILTER_RESULT(*proxyEvent)(connectionInfo* info, void* param);
 
 struct connection_info {
@@ -49,6 +50,7 @@ struct connection_info {
 struct proxy_events {
     proxyEvent KeyboardEvent;
     proxyEvent MouseEvent;
+    proxyEvent GfxEvent;
 };
 
 #pragma pack(push, 1)
@@ -64,6 +66,14 @@ struct proxy_mouse_event_info {
 };
 #pragma pack(pop)
 
+/* a single RDPGFX PDU, data points to the whole PDU including its header */
+struct proxy_gfx_event_info {
+    UINT16 cmdId;
+    UINT16 flags;
+    UINT32 pduLength;
+    const BYTE* data;
+};
+
 /* implement this method and register callbacks for proxy events
  * return TRUE if initialization succeeded, otherwise FALSE.
  **/
@@ -96,6 +96,7 @@ void pf_OnChannelDisconnectedEventHandler(void* data,
 			WLog_ERR(TAG, "failed to close gfx server");
 
 		gdi_graphics_pipeline_uninit(context->gdi, (RdpgfxClientContext*) e->pInterface);
+		pf_rdpgfx_pipeline_uninit(pc);
 	}
 	else if (strcmp(e->name, DISP_DVC_CHANNEL_NAME) == 0)
 	{
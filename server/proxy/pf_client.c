@@ -214,27 +214,11 @@ static void pf_client_post_disconnect(freerdp* instance)
 }
 
 /**
- * RDP main loop.
- * Connects RDP, loops while running and handles event and dispatch, cleans up
- * after the connection ends.
+ * Connects to the target, falling back to TLS if NLA fails.
  */
-static DWORD WINAPI pf_client_thread_proc(LPVOID arg)
+static BOOL pf_client_connect_target(freerdp* instance)
 {
-	freerdp* instance = (freerdp*)arg;
 	pClientContext* pc = (pClientContext*)instance->context;
-	proxyData* pdata = pc->pdata;
-	DWORD nCount;
-	DWORD status;
-	HANDLE handles[65];
-
-	/*
-	 * during redirection, freerdp's abort event might be overriden (reset) by the library, after
-	 * the server set it in order to shutdown the connection. it means that the server might signal
-	 * the client to abort, but the library code will override the signal and the client will
-	 * continue its work instead of exiting. That's why the client must wait on `pdata->abort_event`
-	 * too, which will never be modified by the library.
-	 */
-	handles[64] = pdata->abort_event;
 
 	/*
 	 * Only set the `during_connect_process` flag if NlaSecurity is enabled.
@@ -254,57 +238,44 @@ static DWORD WINAPI pf_client_thread_proc(LPVOID arg)
 			instance->settings->TlsSecurity = TRUE;
 
 			pc->during_connect_process = FALSE;
-			if (!freerdp_connect(instance))
+			if (proxy_data_shall_disconnect(pc->pdata) || !freerdp_connect(instance))
 			{
 				WLog_ERR(TAG, "connection failure");
-				return 0;
+				return FALSE;
 			}
 		}
 		else
 		{
 			WLog_ERR(TAG, "connection failure");
-			return 0;
+			return FALSE;
 		}
 	}
 
 	pc->during_connect_process = FALSE;
+	return TRUE;
+}
 
-	while (!freerdp_shall_disconnect(instance))
-	{
-		nCount = freerdp_get_event_handles(instance->context, &handles[0], 64);
-
-		if (nCount == 0)
-		{
-			WLog_ERR(TAG, "%s: freerdp_get_event_handles failed", __FUNCTION__);
-			break;
-		}
-
-		status = WaitForMultipleObjects(nCount, handles, FALSE, INFINITE);
-
-		if (status == WAIT_FAILED)
-		{
-			WLog_ERR(TAG, "%s: WaitForMultipleObjects failed with %"PRIu32"", __FUNCTION__,
-			         status);
-			break;
-		}
-
-		if (freerdp_shall_disconnect(instance))
-			break;
+BOOL pf_client_check_event_handles(pClientContext* pc)
+{
+	rdpContext* context = (rdpContext*) pc;
 
-		if (proxy_data_shall_disconnect(pdata))
-			break;
+	/*
+	 * during redirection, freerdp's abort event might be overriden (reset) by the library, after
+	 * the server set it in order to shutdown the connection. That's why the session's loop also
+	 * waits on `pdata->abort_event`, which will never be modified by the library.
+	 */
+	if (freerdp_shall_disconnect(context->instance))
+		return FALSE;
 
-		if (!freerdp_check_event_handles(instance->context))
-		{
-			if (freerdp_get_last_error(instance->context) == FREERDP_ERROR_SUCCESS)
-				WLog_ERR(TAG, "Failed to check FreeRDP event handles");
+	if (!freerdp_check_event_handles(context))
+	{
+		if (freerdp_get_last_error(context) == FREERDP_ERROR_SUCCESS)
+			WLog_ERR(TAG, "Failed to check FreeRDP event handles");
 
-			break;
-		}
+		return FALSE;
 	}
 
-	freerdp_disconnect(instance);
-	return 0;
+	return TRUE;
 }
 
 /**
@@ -413,16 +384,10 @@ static int pf_client_client_stop(rdpContext* context)
 	proxy_data_abort_connect(pdata);
 	freerdp_abort_connect(context->instance);
 
-	if (pdata->client_thread)
-	{
-		/*
-		 * Wait for client thread to finish. No need to call CloseHandle() here, as
-		 * it is the responsibility of `proxy_data_free`.
-		 */
-		WLog_DBG(TAG, "pf_client_client_stop(): waiting for thread to finish");
-		WaitForSingleObject(pdata->client_thread, INFINITE);
-		WLog_DBG(TAG, "pf_client_client_stop(): thread finished");
-	}
+	/* Wait for pf_server_handle_client to give up on connecting */
+	WLog_DBG(TAG, "pf_client_client_stop(): waiting for connect to finish");
+	WaitForSingleObject(pdata->connect_done, INFINITE);
+	WLog_DBG(TAG, "pf_client_client_stop(): connect finished");
 
 	return 0;
 }
@@ -441,14 +406,14 @@ int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints)
 }
 
 /**
- * Starts running a client connection towards target server.
+ * Starts a client connection towards target server, blocks until it is connected.
  */
-DWORD WINAPI pf_client_start(LPVOID arg)
+BOOL pf_client_connect(pClientContext* pc)
 {
-	rdpContext* context = (rdpContext*)arg;
+	rdpContext* context = (rdpContext*)pc;
 
 	if (freerdp_client_start(context) != 0)
-		return 1;
+		return FALSE;
 
-	return pf_client_thread_proc(context->instance);
+	return pf_client_connect_target(context->instance);
 }
@@ -26,6 +26,9 @@
 #include <winpr/wtypes.h>
 
 int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints);
-DWORD WINAPI pf_client_start(LPVOID arg);
+struct p_client_context;
+
+BOOL pf_client_connect(struct p_client_context* pc);
+BOOL pf_client_check_event_handles(struct p_client_context* pc);
 
 #endif /* FREERDP_SERVER_PROXY_PFCLIENT_H */
@@ -61,6 +61,9 @@ static BOOL pf_config_load_server(wIniFile* ini, proxyConfig* config)
 	if (!pf_config_get_uint16(ini, "Server", "Port", &config->Port))
 		return FALSE;
 
+	if (!pf_config_get_uint16(ini, "Server", "Threads", &config->Threads))
+		return FALSE;
+
 	return TRUE;
 }
 
@@ -78,6 +81,7 @@ static BOOL pf_config_load_target(wIniFile* ini, proxyConfig* config)
 static BOOL pf_config_load_channels(wIniFile* ini, proxyConfig* config)
 {
 	config->GFX = CONFIG_GET_BOOL(ini, "Channels", "GFX");
+	config->GFXPassthrough = CONFIG_GET_BOOL(ini, "Channels", "GFXPassthrough");
 	config->DisplayControl = CONFIG_GET_BOOL(ini, "Channels", "DisplayControl");
 	return TRUE;
 }
@@ -173,6 +177,7 @@ void pf_server_config_print(proxyConfig* config)
 	CONFIG_PRINT_SECTION("Server");
 	CONFIG_PRINT_STR(config, Host);
 	CONFIG_PRINT_UINT16(config, Port);
+	CONFIG_PRINT_UINT16(config, Threads);
 
 	if (!config->UseLoadBalanceInfo)
 	{
@@ -192,6 +197,7 @@ void pf_server_config_print(proxyConfig* config)
 
 	CONFIG_PRINT_SECTION("Channels");
 	CONFIG_PRINT_BOOL(config, GFX);
+	CONFIG_PRINT_BOOL(config, GFXPassthrough);
 	CONFIG_PRINT_BOOL(config, DisplayControl);
 }
 
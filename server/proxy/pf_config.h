@@ -25,6 +25,7 @@
 #include <winpr/ini.h>
 
 #include "pf_filters.h"
+#include "pf_loop.h"
 
 struct proxy_config
 {
@@ -32,6 +33,7 @@ struct proxy_config
 	char* Host;
 	UINT16 Port;
 	BOOL  LocalOnly;
+	UINT16 Threads;
 
 	/* target */
 	BOOL UseLoadBalanceInfo;
@@ -49,10 +51,14 @@ struct proxy_config
 
 	/* channels */
 	BOOL GFX;
+	BOOL GFXPassthrough;
 	BOOL DisplayControl;
 
 	/* filters */
 	filters_list* Filters;
+
+	/* event loops running the sessions, owned by pf_server_start */
+	proxyLoopPool* Loops;
 };
 
 typedef struct proxy_config proxyConfig;
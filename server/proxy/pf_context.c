@@ -167,6 +167,12 @@ proxyData* proxy_data_new()
 		return NULL;
 	}
 
+	if (!(pdata->connect_done = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		proxy_data_free(pdata);
+		return NULL;
+	}
+
 	return pdata;
 }
 
@@ -197,10 +203,10 @@ void proxy_data_free(proxyData* pdata)
 		pdata->abort_event = NULL;
 	}
 
-	if (pdata->client_thread)
+	if (pdata->connect_done)
 	{
-		CloseHandle(pdata->client_thread);
-		pdata->client_thread = NULL;
+		CloseHandle(pdata->connect_done);
+		pdata->connect_done = NULL;
 	}
 
 	free(pdata);
@@ -25,6 +25,7 @@
 #include <freerdp/freerdp.h>
 #include <freerdp/channels/wtsvc.h>
 #include <freerdp/client/rdpei.h>
+#include <freerdp/codec/zgfx.h>
 #include <freerdp/client/rdpgfx.h>
 #include <freerdp/server/rdpgfx.h>
 #include <freerdp/client/disp.h>
@@ -66,6 +67,14 @@ struct p_client_context
 	RdpgfxClientContext* gfx;
 	DispClientContext* disp;
 
+	/*
+	 * Used in GFX passthrough mode when a filter inspects GFX PDUs. The history of zgfx
+	 * follows the server's compressor. Once a filter ignored a PDU the compressed data no longer
+	 * matches the client's history, gfxReencode is set and all further data is sent uncompressed.
+	 */
+	ZGFX_CONTEXT* zgfx;
+	BOOL gfxReencode;
+
 	/*
 	 * In a case when freerdp_connect fails,
 	 * Used for NLA fallback feature, to check if the server should close the connection.
@@ -78,6 +87,13 @@ struct p_client_context
 };
 typedef struct p_client_context pClientContext;
 
+enum pf_connect_state
+{
+	PF_CONNECT_PENDING = 0,
+	PF_CONNECT_DONE,
+	PF_CONNECT_ORPHANED /* the loop dropped the session, pf_server_handle_client frees it */
+};
+
 /**
  * Holds data common to both sides of a proxy's session.
  */
@@ -89,7 +105,16 @@ struct proxy_data
 	pClientContext* pc;
 
 	HANDLE abort_event;
-	HANDLE client_thread;
+
+	/*
+	 * Set by pf_server_handle_client once it is done connecting the proxy's client, from then on
+	 * client_attached tells if loop also serves the proxy's client.
+	 */
+	HANDLE connect_done;
+	volatile LONG client_attached;
+	/* one of pf_connect_state, decides who frees a session ended during connect */
+	volatile LONG connect_state;
+	proxyLoop* loop;
 
 	connectionInfo* info;
 	filters_list* filters;
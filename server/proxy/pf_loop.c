@@ -0,0 +1,642 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server
+ *
+ * Copyright 2019 Mati Shabtay <matishabtay@gmail.com>
+ * Copyright 2019 Kobi Mizrachi <kmizrachi18@gmail.com>
+ * Copyright 2019 Idan Freiberg <speidy@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
+
+#include "pf_loop.h"
+#include "pf_server.h"
+#include "pf_context.h"
+#include "pf_log.h"
+
+#define TAG PROXY_TAG("loop")
+
+/* while a client does not read, its session is retried at this interval (ms) */
+#define PF_LOOP_BLOCKED_TIMEOUT 10
+/* handles a session needs at most, decides how many fit without epoll */
+#define PF_LOOP_SESSION_HANDLES 8
+#define PF_LOOP_NO_SESSION UINT32_MAX
+
+/* the handles of a session are registered next to each other */
+typedef struct
+{
+	proxyData* pdata; /* NULL once the session ended */
+	DWORD first;
+	DWORD count;
+	BOOL blocked;
+	BOOL attached;
+} proxyLoopSession;
+
+struct proxy_loop
+{
+	HANDLE thread;
+	HANDLE stopEvent;
+	HANDLE wakeEvent;
+	proxyLoopPool* pool;
+
+	/* sessions handed over by other threads, guarded by lock */
+	CRITICAL_SECTION lock;
+	wArrayList* pending;
+	volatile LONG stopped;
+
+	/* everything below is only used by the loop's thread */
+	proxyLoopSession* sessions;
+	DWORD* blocked;
+	DWORD sessionCount;
+	DWORD sessionCapacity;
+	DWORD blockedCount;
+	DWORD connecting;
+	PWAIT_SET set;
+	/* the handles in the set and the session each belongs to */
+	HANDLE* handles;
+	DWORD* owners;
+	DWORD* signalled;
+	DWORD handleCapacity;
+	BOOL rebuild;
+	BOOL ended;
+	UINT64 blockedTime;
+
+	volatile LONG load;
+	/* sessions the loop takes, only limited without epoll */
+	volatile LONG limit;
+};
+
+struct proxy_loop_pool
+{
+	proxyLoop* loops;
+	UINT32 count;
+};
+
+static BOOL pf_loop_pool_add_except(proxyLoopPool* pool, proxyData* pdata, proxyLoop* except);
+
+static BOOL pf_loop_add_session(proxyLoop* loop, proxyData* pdata)
+{
+	proxyLoopSession* session;
+
+	if (loop->sessionCount >= loop->sessionCapacity)
+	{
+		void* tmp;
+		const DWORD capacity = loop->sessionCapacity ? loop->sessionCapacity * 2 : 16;
+
+		if (!(tmp = realloc(loop->sessions, capacity * sizeof(proxyLoopSession))))
+			return FALSE;
+
+		loop->sessions = (proxyLoopSession*) tmp;
+
+		if (!(tmp = realloc(loop->blocked, capacity * sizeof(DWORD))))
+			return FALSE;
+
+		loop->blocked = (DWORD*) tmp;
+		loop->sessionCapacity = capacity;
+	}
+
+	session = &loop->sessions[loop->sessionCount++];
+	ZeroMemory(session, sizeof(proxyLoopSession));
+	session->pdata = pdata;
+	loop->rebuild = TRUE;
+	return TRUE;
+}
+
+static void pf_loop_take_pending(proxyLoop* loop, BOOL stop)
+{
+	int index;
+	EnterCriticalSection(&loop->lock);
+
+	for (index = 0; index < ArrayList_Count(loop->pending); index++)
+	{
+		proxyData* pdata = (proxyData*) ArrayList_GetItem(loop->pending, index);
+
+		if (!pf_loop_add_session(loop, pdata))
+		{
+			WLog_ERR(TAG, "failed to take over a new session");
+			pf_server_session_end(pdata);
+			InterlockedDecrement(&loop->load);
+		}
+	}
+
+	ArrayList_Clear(loop->pending);
+
+	if (stop)
+		InterlockedExchange(&loop->stopped, TRUE);
+
+	LeaveCriticalSection(&loop->lock);
+}
+
+/* hands a session the loop can not serve to another one, or ends it if there is none */
+static void pf_loop_move_session(proxyLoop* loop, proxyData* pdata)
+{
+	if (!pf_loop_pool_add_except(loop->pool, pdata, loop))
+	{
+		WLog_ERR(TAG, "no event loop can take the session, closing it");
+		pf_server_session_end(pdata);
+	}
+
+	InterlockedDecrement(&loop->load);
+}
+
+static BOOL pf_loop_reserve(proxyLoop* loop, DWORD count)
+{
+	void* tmp;
+	DWORD capacity = loop->handleCapacity ? loop->handleCapacity : 64;
+
+	if (count <= loop->handleCapacity)
+		return TRUE;
+
+	while (capacity < count)
+		capacity *= 2;
+
+	if (!(tmp = realloc(loop->handles, capacity * sizeof(HANDLE))))
+		return FALSE;
+
+	loop->handles = (HANDLE*) tmp;
+
+	if (!(tmp = realloc(loop->owners, capacity * sizeof(DWORD))))
+		return FALSE;
+
+	loop->owners = (DWORD*) tmp;
+
+	if (!(tmp = realloc(loop->signalled, capacity * sizeof(DWORD))))
+		return FALSE;
+
+	loop->signalled = (DWORD*) tmp;
+	loop->handleCapacity = capacity;
+	return TRUE;
+}
+
+static BOOL pf_loop_add_handle(proxyLoop* loop, HANDLE handle, DWORD owner)
+{
+	const DWORD index = WaitSetGetCount(loop->set);
+
+	if (!pf_loop_reserve(loop, index + 1) || !WaitSetAddHandle(loop->set, handle))
+		return FALSE;
+
+	loop->handles[index] = handle;
+	loop->owners[index] = owner;
+	return TRUE;
+}
+
+/* drops ended sessions, the wait set is rebuilt afterwards */
+static void pf_loop_compact(proxyLoop* loop)
+{
+	DWORD index;
+	DWORD count = 0;
+
+	for (index = 0; index < loop->sessionCount; index++)
+	{
+		if (loop->sessions[index].pdata)
+			loop->sessions[count++] = loop->sessions[index];
+	}
+
+	loop->sessionCount = count;
+	loop->ended = FALSE;
+	loop->rebuild = TRUE;
+}
+
+/**
+ * Registers the handles of all sessions. This is only done when sessions come and go or their
+ * handles change, e.g. once the proxy's client got connected. A session whose handles do not fit
+ * is moved to another loop, the others keep running.
+ */
+static BOOL pf_loop_rebuild(proxyLoop* loop)
+{
+	DWORD index = 0;
+	UINT64 limit;
+	HANDLE events[MAXIMUM_WAIT_OBJECTS];
+
+	if (loop->ended)
+		pf_loop_compact(loop);
+
+	WaitSetClear(loop->set);
+
+	if (!pf_loop_add_handle(loop, loop->stopEvent, PF_LOOP_NO_SESSION) ||
+	    !pf_loop_add_handle(loop, loop->wakeEvent, PF_LOOP_NO_SESSION))
+	{
+		WLog_ERR(TAG, "failed to wait for the loop's events");
+		return FALSE;
+	}
+
+	loop->blockedCount = 0;
+	loop->connecting = 0;
+
+	while (index < loop->sessionCount)
+	{
+		DWORD x;
+		proxyLoopSession* session = &loop->sessions[index];
+		proxyData* pdata = session->pdata;
+		const DWORD nCount = pf_server_session_get_event_handles(pdata, events, ARRAYSIZE(events));
+		session->first = WaitSetGetCount(loop->set);
+		session->count = nCount;
+		/* a session without handles is ended by pf_server_session_check */
+		session->blocked = (nCount == 0) || pf_server_session_is_blocked(pdata);
+		session->attached = InterlockedCompareExchange(&pdata->client_attached, 0, 0);
+
+		for (x = 0; x < nCount; x++)
+		{
+			if (!pf_loop_add_handle(loop, events[x], index))
+				break;
+		}
+
+		if (x == nCount)
+		{
+			if (session->blocked)
+				loop->blocked[loop->blockedCount++] = index;
+
+			if (!session->attached)
+				loop->connecting++;
+
+			index++;
+			continue;
+		}
+
+		/* only this session is affected, the last one takes its slot */
+		while (x-- > 0)
+			WaitSetRemoveHandle(loop->set, events[x]);
+
+		loop->sessions[index] = loop->sessions[--loop->sessionCount];
+
+		if (WaitSetGetCount(loop->set) + nCount > WaitSetGetMaxCount(loop->set))
+		{
+			WLog_WARN(TAG, "the session's handles do not fit into the wait set, moving it");
+			pf_loop_move_session(loop, pdata);
+		}
+		else
+		{
+			WLog_ERR(TAG, "failed to wait for the session's handles, closing it");
+			pf_server_session_end(pdata);
+			InterlockedDecrement(&loop->load);
+		}
+	}
+
+	/* what is left takes this many more sessions */
+	limit = loop->sessionCount + (WaitSetGetMaxCount(loop->set) - WaitSetGetCount(loop->set)) /
+	        PF_LOOP_SESSION_HANDLES;
+	InterlockedExchange(&loop->limit, (LONG)((limit < INT32_MAX) ? limit : INT32_MAX));
+	loop->rebuild = FALSE;
+	return TRUE;
+}
+
+/* checks the handles of a session against the registered ones */
+static BOOL pf_loop_session_changed(proxyLoop* loop, proxyLoopSession* session)
+{
+	HANDLE events[MAXIMUM_WAIT_OBJECTS];
+	const DWORD nCount = pf_server_session_get_event_handles(session->pdata, events,
+	                     ARRAYSIZE(events));
+
+	if (nCount != session->count)
+		return TRUE;
+
+	if (pf_server_session_is_blocked(session->pdata) != session->blocked)
+		return TRUE;
+
+	return memcmp(&loop->handles[session->first], events, nCount * sizeof(HANDLE)) != 0;
+}
+
+static void pf_loop_service(proxyLoop* loop, DWORD index)
+{
+	proxyLoopSession* session = &loop->sessions[index];
+	proxyData* pdata = session->pdata;
+
+	/* ended earlier in this iteration */
+	if (!pdata)
+		return;
+
+	if (!pf_server_session_check(pdata))
+	{
+		session->pdata = NULL;
+		loop->ended = TRUE;
+		loop->rebuild = TRUE;
+		pf_server_session_end(pdata);
+		InterlockedDecrement(&loop->load);
+		return;
+	}
+
+	if (!loop->rebuild && pf_loop_session_changed(loop, session))
+		loop->rebuild = TRUE;
+}
+
+/* the proxy's client of a session got connected, its handles join the set */
+static void pf_loop_check_attached(proxyLoop* loop)
+{
+	DWORD index;
+
+	if (loop->connecting == 0)
+		return;
+
+	for (index = 0; index < loop->sessionCount; index++)
+	{
+		proxyLoopSession* session = &loop->sessions[index];
+
+		if (session->pdata && !session->attached &&
+		    InterlockedCompareExchange(&session->pdata->client_attached, 0, 0))
+			loop->rebuild = TRUE;
+	}
+}
+
+/* a client that did not read is retried even if other sessions keep the loop busy */
+static void pf_loop_service_blocked(proxyLoop* loop, BOOL timeout)
+{
+	DWORD index;
+	const UINT64 now = GetTickCount64();
+
+	if (!timeout && (now - loop->blockedTime < PF_LOOP_BLOCKED_TIMEOUT))
+		return;
+
+	loop->blockedTime = now;
+
+	for (index = 0; index < loop->blockedCount; index++)
+		pf_loop_service(loop, loop->blocked[index]);
+}
+
+static DWORD WINAPI pf_loop_thread_proc(LPVOID arg)
+{
+	DWORD index;
+	BOOL woken = TRUE;
+	BOOL failed = FALSE;
+	proxyLoop* loop = (proxyLoop*) arg;
+
+	while (1)
+	{
+		DWORD x;
+		DWORD status;
+		DWORD count;
+		DWORD last = PF_LOOP_NO_SESSION;
+		BOOL rebuilt = FALSE;
+
+		if (woken)
+		{
+			/* reset before looking at the sessions, so no wakeup gets lost */
+			ResetEvent(loop->wakeEvent);
+			pf_loop_take_pending(loop, FALSE);
+			pf_loop_check_attached(loop);
+		}
+
+		if (loop->rebuild)
+		{
+			if (!pf_loop_rebuild(loop))
+			{
+				failed = TRUE;
+				break;
+			}
+
+			rebuilt = TRUE;
+		}
+
+		count = WaitSetGetCount(loop->set);
+		status = WaitForWaitSetEx(loop->set, loop->blockedCount ? PF_LOOP_BLOCKED_TIMEOUT : INFINITE,
+		                          loop->signalled, &count);
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForWaitSetEx failed with %"PRIu32"", GetLastError());
+
+			/* e.g. epoll got disabled, a fresh set moves sessions that do not fit */
+			if (!rebuilt)
+			{
+				loop->rebuild = TRUE;
+				continue;
+			}
+
+			failed = TRUE;
+			break;
+		}
+
+		woken = FALSE;
+
+		if (status == WAIT_OBJECT_0)
+		{
+			for (x = 0; x < count; x++)
+			{
+				const DWORD owner = loop->owners[loop->signalled[x]];
+
+				if (loop->signalled[x] == 0)
+					goto out;
+
+				if (loop->signalled[x] == 1)
+					woken = TRUE;
+
+				/* the indices are sorted, a session's handles are next to each other */
+				if ((owner == PF_LOOP_NO_SESSION) || (owner == last))
+					continue;
+
+				last = owner;
+				pf_loop_service(loop, owner);
+			}
+		}
+
+		if (loop->blockedCount)
+			pf_loop_service_blocked(loop, status == WAIT_TIMEOUT);
+	}
+
+out:
+	/* no sessions can be added from now on */
+	pf_loop_take_pending(loop, TRUE);
+
+	for (index = 0; index < loop->sessionCount; index++)
+	{
+		proxyData* pdata = loop->sessions[index].pdata;
+
+		if (!pdata)
+			continue;
+
+		/* a broken loop leaves its sessions to the others */
+		if (failed)
+			pf_loop_move_session(loop, pdata);
+		else
+		{
+			pf_server_session_end(pdata);
+			InterlockedDecrement(&loop->load);
+		}
+	}
+
+	loop->sessionCount = 0;
+	return 0;
+}
+
+static void pf_loop_uninit(proxyLoop* loop)
+{
+	if (loop->thread)
+	{
+		/* the pool already stopped all loops, so none moves sessions here anymore */
+		WaitForSingleObject(loop->thread, INFINITE);
+		CloseHandle(loop->thread);
+		DeleteCriticalSection(&loop->lock);
+	}
+
+	if (loop->stopEvent)
+		CloseHandle(loop->stopEvent);
+
+	if (loop->wakeEvent)
+		CloseHandle(loop->wakeEvent);
+
+	ArrayList_Free(loop->pending);
+	CloseWaitSet(loop->set);
+	free(loop->sessions);
+	free(loop->blocked);
+	free(loop->handles);
+	free(loop->owners);
+	free(loop->signalled);
+}
+
+static BOOL pf_loop_init(proxyLoop* loop, proxyLoopPool* pool)
+{
+	loop->pool = pool;
+	loop->limit = INT32_MAX;
+	/* the first iteration registers the loop's events */
+	loop->rebuild = TRUE;
+
+	if (!(loop->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!(loop->wakeEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!(loop->pending = ArrayList_New(FALSE)))
+		return FALSE;
+
+	if (!(loop->set = CreateWaitSet()))
+		return FALSE;
+
+	if (!InitializeCriticalSectionAndSpinCount(&loop->lock, 4000))
+		return FALSE;
+
+	if (!(loop->thread = CreateThread(NULL, 0, pf_loop_thread_proc, loop, 0, NULL)))
+	{
+		DeleteCriticalSection(&loop->lock);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+proxyLoopPool* pf_loop_pool_new(UINT32 threads)
+{
+	UINT32 index;
+	proxyLoopPool* pool = calloc(1, sizeof(proxyLoopPool));
+
+	if (!pool)
+		return NULL;
+
+	if (threads == 0)
+	{
+		SYSTEM_INFO sysinfo;
+		GetNativeSystemInfo(&sysinfo);
+		threads = MAX(sysinfo.dwNumberOfProcessors, 1);
+	}
+
+	if (!(pool->loops = calloc(threads, sizeof(proxyLoop))))
+		goto fail;
+
+	for (index = 0; index < threads; index++)
+	{
+		pool->count++;
+
+		if (!pf_loop_init(&pool->loops[index], pool))
+		{
+			WLog_ERR(TAG, "failed to start event loop %"PRIu32"", index);
+			goto fail;
+		}
+	}
+
+	WLog_INFO(TAG, "running sessions on %"PRIu32" event loops", threads);
+	return pool;
+fail:
+	pf_loop_pool_free(pool);
+	return NULL;
+}
+
+void pf_loop_pool_free(proxyLoopPool* pool)
+{
+	UINT32 index;
+
+	if (!pool)
+		return;
+
+	for (index = 0; index < pool->count; index++)
+	{
+		if (pool->loops[index].stopEvent)
+			SetEvent(pool->loops[index].stopEvent);
+	}
+
+	for (index = 0; index < pool->count; index++)
+		pf_loop_uninit(&pool->loops[index]);
+
+	free(pool->loops);
+	free(pool);
+}
+
+/* a loop that stopped or has no room for more handles is skipped */
+static BOOL pf_loop_pool_add_except(proxyLoopPool* pool, proxyData* pdata, proxyLoop* except)
+{
+	UINT32 index;
+	BOOL rc = FALSE;
+	proxyLoop* loop = NULL;
+	LONG load = 0;
+
+	for (index = 0; index < pool->count; index++)
+	{
+		proxyLoop* cur = &pool->loops[index];
+		const LONG curLoad = InterlockedCompareExchange(&cur->load, 0, 0);
+
+		if ((cur == except) || InterlockedCompareExchange(&cur->stopped, 0, 0) ||
+		    (curLoad >= InterlockedCompareExchange(&cur->limit, 0, 0)))
+			continue;
+
+		if (!loop || (curLoad < load))
+		{
+			loop = cur;
+			load = curLoad;
+		}
+	}
+
+	if (!loop)
+		return FALSE;
+
+	EnterCriticalSection(&loop->lock);
+
+	if (!loop->stopped && (ArrayList_Add(loop->pending, pdata) >= 0))
+	{
+		/* only the loop that owns the session sets it, pf_server_handle_client reads it */
+		InterlockedCompareExchangePointer((PVOID volatile*) &pdata->loop, loop, pdata->loop);
+		InterlockedIncrement(&loop->load);
+		rc = TRUE;
+	}
+
+	LeaveCriticalSection(&loop->lock);
+
+	if (rc)
+		pf_loop_wakeup(loop);
+
+	return rc;
+}
+
+BOOL pf_loop_pool_add(proxyLoopPool* pool, proxyData* pdata)
+{
+	return pf_loop_pool_add_except(pool, pdata, NULL);
+}
+
+void pf_loop_wakeup(proxyLoop* loop)
+{
+	SetEvent(loop->wakeEvent);
+}
@@ -0,0 +1,50 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server
+ *
+ * Copyright 2019 Mati Shabtay <matishabtay@gmail.com>
+ * Copyright 2019 Kobi Mizrachi <kmizrachi18@gmail.com>
+ * Copyright 2019 Idan Freiberg <speidy@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_PROXY_PFLOOP_H
+#define FREERDP_SERVER_PROXY_PFLOOP_H
+
+#include <winpr/wtypes.h>
+
+/**
+ * A fixed number of threads, each multiplexing both sides of many proxied sessions. A loop only
+ * services the sessions whose handles got signalled. Without epoll a loop takes as many sessions
+ * as fit into MAXIMUM_WAIT_OBJECTS handles, further ones go to other loops.
+ */
+typedef struct proxy_loop proxyLoop;
+typedef struct proxy_loop_pool proxyLoopPool;
+
+struct proxy_data;
+
+/* threads == 0 uses one thread per processor */
+proxyLoopPool* pf_loop_pool_new(UINT32 threads);
+void pf_loop_pool_free(proxyLoopPool* pool);
+
+/*
+ * hands the session to the least loaded loop with room for it, which frees it once it ends.
+ * Sessions may move to another loop later, pdata->loop tells the current one.
+ */
+BOOL pf_loop_pool_add(proxyLoopPool* pool, struct proxy_data* pdata);
+
+/* makes the loop collect the handles of its sessions again */
+void pf_loop_wakeup(proxyLoop* loop);
+
+#endif /* FREERDP_SERVER_PROXY_PFLOOP_H */
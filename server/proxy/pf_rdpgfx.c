@@ -23,6 +23,7 @@
 #include <freerdp/server/rdpgfx.h>
 
 #include <winpr/synch.h>
+#include <freerdp/codec/zgfx.h>
 
 #include "pf_rdpgfx.h"
 #include "pf_context.h"
@@ -288,6 +289,155 @@ static UINT pf_rdpgfx_cache_import_offer(RdpgfxServerContext* context,
 	return client->CacheImportOffer(client, cacheImportOffer);
 }
 
+/**
+ * Writes data as uncompressed ZGFX segments, which the client adds to its history as is.
+ */
+static wStream* pf_rdpgfx_segments_new(const BYTE* data, size_t length)
+{
+	size_t offset;
+	const size_t count = (length + ZGFX_SEGMENTED_MAXSIZE - 1) / ZGFX_SEGMENTED_MAXSIZE;
+	wStream* s = Stream_New(NULL, 7 + (count + 1) * 5 + length);
+
+	if (!s)
+		return NULL;
+
+	if (count <= 1)
+	{
+		Stream_Write_UINT8(s, ZGFX_SEGMENTED_SINGLE);
+		Stream_Write_UINT8(s, ZGFX_PACKET_COMPR_TYPE_RDP8);
+		Stream_Write(s, data, length);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, ZGFX_SEGMENTED_MULTIPART);
+		Stream_Write_UINT16(s, (UINT16) count);
+		Stream_Write_UINT32(s, (UINT32) length);
+
+		for (offset = 0; offset < length; offset += ZGFX_SEGMENTED_MAXSIZE)
+		{
+			const size_t size = MIN(length - offset, ZGFX_SEGMENTED_MAXSIZE);
+			Stream_Write_UINT32(s, (UINT32)(size + 1));
+			Stream_Write_UINT8(s, ZGFX_PACKET_COMPR_TYPE_RDP8);
+			Stream_Write(s, &data[offset], size);
+		}
+	}
+
+	Stream_SealLength(s);
+	Stream_SetPosition(s, 0);
+	return s;
+}
+
+static UINT pf_rdpgfx_send_uncompressed(RdpgfxServerContext* server, const BYTE* data,
+                                        size_t length)
+{
+	UINT error;
+	wStream* s;
+
+	if (length == 0)
+		return CHANNEL_RC_OK;
+
+	if (length > UINT32_MAX)
+		return ERROR_INVALID_DATA;
+
+	if (!(s = pf_rdpgfx_segments_new(data, length)))
+		return CHANNEL_RC_NO_MEMORY;
+
+	error = server->SendRaw(server, s);
+	Stream_Free(s, TRUE);
+	return error;
+}
+
+/**
+ * Passthrough mode: the server's data is forwarded as is. Only if a filter handles GFX events
+ * the data is decompressed to run the filters on each PDU.
+ */
+static UINT pf_rdpgfx_on_raw_data(RdpgfxClientContext* context, wStream* data)
+{
+	proxyData* pdata = (proxyData*) context->custom;
+	pClientContext* pc = pdata->pc;
+	RdpgfxServerContext* server = (RdpgfxServerContext*) pdata->ps->gfx;
+	BYTE* pDstData = NULL;
+	UINT32 DstSize = 0;
+	UINT32 offset = 0;
+	size_t kept = 0;
+	BOOL reencode;
+	UINT error = CHANNEL_RC_OK;
+
+	if (!pc->zgfx)
+		return server->SendRaw(server, data);
+
+	if (zgfx_decompress(pc->zgfx, Stream_Pointer(data), Stream_GetRemainingLength(data),
+	                    &pDstData, &DstSize, 0) < 0)
+	{
+		WLog_ERR(TAG, "zgfx_decompress failed!");
+		return ERROR_INTERNAL_ERROR;
+	}
+
+	reencode = pc->gfxReencode;
+
+	while (offset < DstSize)
+	{
+		proxyGfxEventInfo event;
+
+		if (DstSize - offset < RDPGFX_HEADER_SIZE)
+		{
+			error = ERROR_INVALID_DATA;
+			break;
+		}
+
+		event.data = &pDstData[offset];
+		event.cmdId = (UINT16) event.data[0] | ((UINT16) event.data[1] << 8);
+		event.flags = (UINT16) event.data[2] | ((UINT16) event.data[3] << 8);
+		event.pduLength = (UINT32) event.data[4] | ((UINT32) event.data[5] << 8) |
+		                  ((UINT32) event.data[6] << 16) | ((UINT32) event.data[7] << 24);
+
+		if ((event.pduLength < RDPGFX_HEADER_SIZE) || (event.pduLength > DstSize - offset))
+		{
+			WLog_ERR(TAG, "invalid PDU length %"PRIu32"", event.pduLength);
+			error = ERROR_INVALID_DATA;
+			break;
+		}
+
+		switch (pf_filters_run_by_type(pdata->config->Filters, FILTER_TYPE_GFX, pdata->info,
+		                               &event))
+		{
+			case FILTER_PASS:
+				if (reencode)
+					memmove(&pDstData[kept], event.data, event.pduLength);
+
+				kept += event.pduLength;
+				break;
+
+			case FILTER_IGNORE:
+				reencode = TRUE;
+				break;
+
+			case FILTER_DROP:
+			default:
+				error = ERROR_INTERNAL_ERROR;
+				break;
+		}
+
+		if (error)
+			break;
+
+		offset += event.pduLength;
+	}
+
+	if (!error)
+	{
+		if (!reencode)
+			error = server->SendRaw(server, data);
+		else
+			error = pf_rdpgfx_send_uncompressed(server, pDstData, kept);
+
+		pc->gfxReencode = reencode;
+	}
+
+	free(pDstData);
+	return error;
+}
+
 void pf_rdpgfx_pipeline_init(RdpgfxClientContext* gfx, RdpgfxServerContext* server,
                              proxyData* pdata)
 {
@@ -321,4 +471,30 @@ void pf_rdpgfx_pipeline_init(RdpgfxClientContext* gfx, RdpgfxServerContext* serv
 	server->FrameAcknowledge = pf_rdpgfx_frame_acknowledge;
 	server->CacheImportOffer = pf_rdpgfx_cache_import_offer;
 	server->QoeFrameAcknowledge = pf_rdpgfx_qoe_frame_acknowledge;
+
+	if (pdata->config->GFXPassthrough)
+	{
+		pClientContext* pc = pdata->pc;
+
+		if (pf_filters_has_type(pdata->config->Filters, FILTER_TYPE_GFX))
+		{
+			pc->zgfx = zgfx_context_new(FALSE);
+
+			if (!pc->zgfx)
+			{
+				WLog_ERR(TAG, "zgfx_context_new failed, GFX passthrough disabled");
+				return;
+			}
+		}
+
+		pc->gfxReencode = FALSE;
+		gfx->OnRawData = pf_rdpgfx_on_raw_data;
+	}
+}
+
+void pf_rdpgfx_pipeline_uninit(pClientContext* pc)
+{
+	zgfx_context_free(pc->zgfx);
+	pc->zgfx = NULL;
+	pc->gfxReencode = FALSE;
 }
@@ -30,5 +30,6 @@
 BOOL pf_server_rdpgfx_init(pServerContext* ps);
 void pf_rdpgfx_pipeline_init(RdpgfxClientContext* gfx, RdpgfxServerContext* server,
                              proxyData* pdata);
+void pf_rdpgfx_pipeline_uninit(pClientContext* pc);
 
 #endif /*FREERDP_SERVER_PROXY_PFRDPGFX_H*/
\ No newline at end of file
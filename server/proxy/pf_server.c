@@ -32,6 +32,7 @@
 #include <winpr/path.h>
 #include <winpr/winsock.h>
 #include <winpr/thread.h>
+#include <winpr/interlocked.h>
 
 #include <freerdp/channels/wtsvc.h>
 #include <freerdp/channels/channels.h>
@@ -50,6 +51,7 @@
 #include "pf_rdpgfx.h"
 #include "pf_disp.h"
 #include "pf_channels.h"
+#include "pf_loop.h"
 
 #define TAG PROXY_TAG("server")
 
@@ -168,13 +170,7 @@ static BOOL pf_server_post_connect(freerdp_peer* client)
 		return FALSE;
 	}
 
-	/* Start a proxy's client in it's own thread */
-	if (!(pdata->client_thread = CreateThread(NULL, 0, pf_client_start, pc, 0, NULL)))
-	{
-		WLog_ERR(TAG, "CreateThread failed!");
-		return FALSE;
-	}
-
+	/* The proxy's client connects once pf_server_handle_client handed the session to a loop */
 	return TRUE;
 }
 
@@ -191,21 +187,198 @@ static BOOL pf_server_adjust_monitor_layout(freerdp_peer* peer)
 }
 
 /**
- * Handles an incoming client connection, to be run in it's own thread.
+ * Returns the handles of the server's side of a session: the peer's transport, the channels
+ * and abort_event.
+ */
+static DWORD pf_server_get_peer_event_handles(proxyData* pdata, HANDLE* events, DWORD count)
+{
+	DWORD nCount;
+	pServerContext* ps = pdata->ps;
+	freerdp_peer* client = ((rdpContext*) ps)->peer;
+
+	if (count < 3)
+		return 0;
+
+	nCount = client->GetEventHandles(client, events, count - 2);
+
+	if (nCount == 0)
+	{
+		WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
+		return 0;
+	}
+
+	events[nCount++] = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
+	events[nCount++] = pdata->abort_event;
+	return nCount;
+}
+
+/**
+ * Processes whatever the client sent, returns FALSE when the session has to be closed.
+ */
+static BOOL pf_server_check_peer(proxyData* pdata)
+{
+	pServerContext* ps = pdata->ps;
+	freerdp_peer* client = ((rdpContext*) ps)->peer;
+
+	if (client->CheckFileDescriptor(client) != TRUE)
+		return FALSE;
+
+	if (WaitForSingleObject(WTSVirtualChannelManagerGetEventHandle(ps->vcm), 0) == WAIT_OBJECT_0)
+	{
+		if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
+		{
+			WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
+			return FALSE;
+		}
+	}
+
+	/* only disconnect after checking client's and vcm's file descriptors  */
+	if (proxy_data_shall_disconnect(pdata))
+	{
+		WLog_INFO(TAG, "abort_event is set, closing connection with client %s", client->hostname);
+		return FALSE;
+	}
+
+	switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
+	{
+		/* Dynamic channel status may have been changed after processing */
+		case DRDYNVC_STATE_NONE:
+
+			/* Initialize drdynvc channel */
+			if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
+			{
+				WLog_ERR(TAG, "Failed to initialize drdynvc channel");
+				return FALSE;
+			}
+
+			break;
+
+		case DRDYNVC_STATE_READY:
+			if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
+			{
+				SetEvent(ps->dynvcReady);
+			}
+
+			break;
+
+		default:
+			break;
+	}
+
+	return TRUE;
+}
+
+DWORD pf_server_session_get_event_handles(proxyData* pdata, HANDLE* events, DWORD count)
+{
+	DWORD tmp;
+	DWORD nCount = pf_server_get_peer_event_handles(pdata, events, count);
+
+	/*
+	 * The target is not read while the client is write-blocked, keep its handles out of the
+	 * set then. They are level-triggered and would wake the loop over and over.
+	 */
+	if ((nCount == 0) || !pdata->client_attached || pf_server_session_is_blocked(pdata))
+		return nCount;
+
+	tmp = freerdp_get_event_handles((rdpContext*) pdata->pc, &events[nCount], count - nCount);
+
+	if (tmp == 0)
+	{
+		WLog_ERR(TAG, "Failed to get the proxy's client event handles");
+		return 0;
+	}
+
+	return nCount + tmp;
+}
+
+BOOL pf_server_session_is_blocked(proxyData* pdata)
+{
+	freerdp_peer* client = ((rdpContext*) pdata->ps)->peer;
+	return pdata->client_attached && client->IsWriteBlocked(client);
+}
+
+BOOL pf_server_session_check(proxyData* pdata)
+{
+	freerdp_peer* client = ((rdpContext*) pdata->ps)->peer;
+
+	if (!pf_server_check_peer(pdata))
+		return FALSE;
+
+	if (!pdata->client_attached)
+		return TRUE;
+
+	/* Back-pressure: stop reading from the target while the client does not keep up */
+	if (client->IsWriteBlocked(client))
+	{
+		if (client->DrainOutputBuffer(client) < 0)
+			return FALSE;
+
+		if (client->IsWriteBlocked(client))
+			return TRUE;
+	}
+
+	return pf_client_check_event_handles(pdata->pc);
+}
+
+void pf_server_session_end(proxyData* pdata)
+{
+	proxy_data_abort_connect(pdata);
+
+	/* Waiting for a connect in progress would stall the loop, its thread frees the session */
+	if (InterlockedCompareExchange(&pdata->connect_state, PF_CONNECT_ORPHANED, PF_CONNECT_PENDING) ==
+	    PF_CONNECT_PENDING)
+	{
+		WLog_INFO(TAG, "pf_server_session_end(): connect still in progress, aborting it");
+		freerdp_abort_connect(((rdpContext*) pdata->pc)->instance);
+		return;
+	}
+
+	pf_server_session_free(pdata);
+}
+
+void pf_server_session_free(proxyData* pdata)
+{
+	pServerContext* ps = pdata->ps;
+	rdpContext* pc = (rdpContext*) pdata->pc;
+	freerdp_peer* client = ((rdpContext*) ps)->peer;
+	WLog_INFO(TAG, "pf_server_session_free(): starting shutdown of connection (client %s)", client->hostname);
+
+	if (pc)
+	{
+		WLog_INFO(TAG, "pf_server_session_free(): stopping proxy's client");
+		freerdp_client_stop(pc);
+
+		if (pdata->client_attached)
+			freerdp_disconnect(pc->instance);
+	}
+
+	WLog_INFO(TAG, "pf_server_session_free(): freeing server's channels");
+	pf_server_channels_free(ps);
+	WLog_INFO(TAG, "pf_server_session_free(): freeing proxy data");
+	proxy_data_free(pdata);
+	freerdp_client_context_free(pc);
+	client->Close(client);
+	client->Disconnect(client);
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+}
+
+/**
+ * Handles an incoming client connection until its connection sequence is done, to be run in
+ * it's own thread. The session is then handed to an event loop, while this thread connects
+ * the proxy's client to the target.
  *
  * arg is a pointer to a freerdp_peer representing the client.
  */
 static DWORD WINAPI pf_server_handle_client(LPVOID arg)
 {
-	HANDLE eventHandles[32];
-	HANDLE ChannelEvent;
+	HANDLE eventHandles[MAXIMUM_WAIT_OBJECTS];
 	DWORD eventCount;
-	DWORD tmp;
 	DWORD status;
 	pServerContext* ps;
-	rdpContext* pc;
 	proxyData* pdata;
 	proxyConfig* config;
+	proxyLoop* loop;
 	freerdp_peer* client = (freerdp_peer*)arg;
 
 	if (!init_p_server_context(client))
@@ -264,93 +437,57 @@ static DWORD WINAPI pf_server_handle_client(LPVOID arg)
 	client->settings->MultifragMaxRequestSize = 0xFFFFFF; /* FIXME */
 	client->Initialize(client);
 	WLog_INFO(TAG, "Client connected: %s", client->local ? "(local)" : client->hostname);
-	/* Main client event handling loop */
-	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
 
-	while (1)
+	/* The connection sequence with the client runs in this thread */
+	while (!pdata->pc)
 	{
-		eventCount = 0;
-		{
-			tmp = client->GetEventHandles(client, &eventHandles[eventCount], 32 - eventCount);
+		eventCount = pf_server_get_peer_event_handles(pdata, eventHandles, ARRAYSIZE(eventHandles));
 
-			if (tmp == 0)
-			{
-				WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
-				break;
-			}
+		if (eventCount == 0)
+			goto fail;
 
-			eventCount += tmp;
-		}
-		eventHandles[eventCount++] = ChannelEvent;
-		eventHandles[eventCount++] = pdata->abort_event;
-		eventHandles[eventCount++] = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
 		status = WaitForMultipleObjects(eventCount, eventHandles, FALSE, INFINITE);
 
 		if (status == WAIT_FAILED)
 		{
 			WLog_ERR(TAG, "WaitForMultipleObjects failed (errno: %d)", errno);
-			break;
+			goto fail;
 		}
 
-		if (client->CheckFileDescriptor(client) != TRUE)
-			break;
-
-		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
-		{
-			if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
-			{
-				WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
-				goto fail;
-			}
-		}
-
-		/* only disconnect after checking client's and vcm's file descriptors  */
-		if (proxy_data_shall_disconnect(pdata))
-		{
-			WLog_INFO(TAG, "abort_event is set, closing connection with client %s", client->hostname);
-			break;
-		}
-		
-		switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
-		{
-		/* Dynamic channel status may have been changed after processing */
-		case DRDYNVC_STATE_NONE:
-
-			/* Initialize drdynvc channel */
-			if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
-			{
-				WLog_ERR(TAG, "Failed to initialize drdynvc channel");
-				goto fail;
-			}
-
-			break;
+		if (!pf_server_check_peer(pdata))
+			goto fail;
+	}
 
-		case DRDYNVC_STATE_READY:
-			if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
-			{
-				SetEvent(ps->dynvcReady);
-			}
+	if (!pf_loop_pool_add(config->Loops, pdata))
+	{
+		WLog_ERR(TAG, "pf_server_handle_client(): no event loop available");
+		goto fail;
+	}
 
-			break;
+	/* The loop serves the client from now on, connect to the target meanwhile */
+	if (pf_client_connect(pdata->pc))
+		InterlockedExchange(&pdata->client_attached, TRUE);
+	else
+		proxy_data_abort_connect(pdata);
 
-		default:
-			break;
-		}
+	if (InterlockedCompareExchange(&pdata->connect_state, PF_CONNECT_DONE, PF_CONNECT_PENDING) ==
+	    PF_CONNECT_ORPHANED)
+	{
+		/* The loop ended the session while connecting and left it to this thread */
+		SetEvent(pdata->connect_done);
+		pf_server_session_free(pdata);
+		return 0;
 	}
 
+	/* The loop frees the session, but waits for this first. It may have moved to another loop. */
+	loop = (proxyLoop*) InterlockedCompareExchangePointer((PVOID volatile*) &pdata->loop, NULL, NULL);
+	pf_loop_wakeup(loop);
+	SetEvent(pdata->connect_done);
+	return 0;
 fail:
-
-	pc = (rdpContext*) pdata->pc;
-	WLog_INFO(TAG, "pf_server_handle_client(): starting shutdown of connection (client %s)", client->hostname);
-	WLog_INFO(TAG, "pf_server_handle_client(): stopping proxy's client");
-	freerdp_client_stop(pc);
-	WLog_INFO(TAG, "pf_server_handle_client(): freeing server's channels");
-	pf_server_channels_free(ps);
-	WLog_INFO(TAG, "pf_server_handle_client(): freeing proxy data");
-	proxy_data_free(pdata);
-	freerdp_client_context_free(pc);
-	client->Close(client);
-	client->Disconnect(client);
+	SetEvent(pdata->connect_done);
+	pf_server_session_free(pdata);
+	return 0;
 out_free_peer:
 	freerdp_peer_context_free(client);
 	freerdp_peer_free(client);
@@ -447,7 +584,11 @@ int pf_server_start(proxyConfig* config)
 
 	if (success)
 	{
-		pf_server_mainloop(listener);
+		if ((config->Loops = pf_loop_pool_new(config->Threads)))
+			pf_server_mainloop(listener);
+
+		pf_loop_pool_free(config->Loops);
+		config->Loops = NULL;
 	}
 
 	free(localSockPath);
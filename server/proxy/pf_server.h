@@ -26,4 +26,13 @@
 
 int pf_server_start(proxyConfig* config);
 
+/* used by the event loops, see pf_loop.h */
+struct proxy_data;
+
+DWORD pf_server_session_get_event_handles(struct proxy_data* pdata, HANDLE* events, DWORD count);
+BOOL pf_server_session_is_blocked(struct proxy_data* pdata);
+BOOL pf_server_session_check(struct proxy_data* pdata);
+void pf_server_session_end(struct proxy_data* pdata);
+void pf_server_session_free(struct proxy_data* pdata);
+
 #endif /* FREERDP_SERVER_PROXY_SERVER_H */
@@ -0,0 +1,254 @@
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/channels/rdpgfx.h>
+
+#include "../pf_rdpgfx.h"
+#include "../pf_context.h"
+#include "../pf_filters.h"
+
+#define TEST_BATCHES 3
+#define TEST_PDUS 4
+/* larger than a ZGFX segment, the server sends it as a multipart packet */
+#define TEST_LARGE_PDU 100000
+
+static wStream* testSent = NULL;
+static UINT16 testIgnoreCmdId = 0;
+static UINT32 testFilterCalls = 0;
+
+static UINT test_send_raw(RdpgfxServerContext* context, wStream* s)
+{
+	const size_t length = Stream_GetRemainingLength(s);
+	WINPR_UNUSED(context);
+
+	if (!Stream_EnsureRemainingCapacity(testSent, length))
+		return CHANNEL_RC_NO_MEMORY;
+
+	Stream_Write(testSent, Stream_Pointer(s), length);
+	return CHANNEL_RC_OK;
+}
+
+static PF_FILTER_RESULT test_gfx_event(connectionInfo* info, void* param)
+{
+	const proxyGfxEventInfo* event = (const proxyGfxEventInfo*) param;
+	WINPR_UNUSED(info);
+	testFilterCalls++;
+
+	if (testIgnoreCmdId && (event->cmdId == testIgnoreCmdId))
+		return FILTER_IGNORE;
+
+	return FILTER_PASS;
+}
+
+static size_t test_write_pdu(BYTE* data, UINT16 cmdId, UINT32 pduLength, BYTE seed)
+{
+	UINT32 x;
+	data[0] = (BYTE)(cmdId & 0xFF);
+	data[1] = (BYTE)(cmdId >> 8);
+	data[2] = 0;
+	data[3] = 0;
+	data[4] = (BYTE)(pduLength & 0xFF);
+	data[5] = (BYTE)((pduLength >> 8) & 0xFF);
+	data[6] = (BYTE)((pduLength >> 16) & 0xFF);
+	data[7] = (BYTE)(pduLength >> 24);
+
+	/* compressible, but different in every batch */
+	for (x = RDPGFX_HEADER_SIZE; x < pduLength; x++)
+		data[x] = (BYTE)((x / 7) ^ seed);
+
+	return pduLength;
+}
+
+/* A frame: start, a fill, a large surface command and the end */
+static size_t test_write_batch(BYTE* data, BYTE seed, BOOL ignoreFill)
+{
+	size_t length = 0;
+	length += test_write_pdu(&data[length], RDPGFX_CMDID_STARTFRAME, 16, seed);
+
+	if (!ignoreFill)
+		length += test_write_pdu(&data[length], RDPGFX_CMDID_SOLIDFILL, 20, seed);
+
+	length += test_write_pdu(&data[length], RDPGFX_CMDID_WIRETOSURFACE_1, TEST_LARGE_PDU, seed);
+	length += test_write_pdu(&data[length], RDPGFX_CMDID_ENDFRAME, 16, seed);
+	return length;
+}
+
+static BOOL test_register_filter(filters_list* list)
+{
+	proxyFilter* filter = (proxyFilter*) calloc(1, sizeof(proxyFilter));
+
+	if (!filter)
+		return FALSE;
+
+	filter->name = _strdup("test");
+	filter->enabled = TRUE;
+	filter->events = (proxyEvents*) calloc(1, sizeof(proxyEvents));
+
+	if (!filter->name || !filter->events || (ArrayList_Add(list, filter) < 0))
+	{
+		free(filter->name);
+		free(filter->events);
+		free(filter);
+		return FALSE;
+	}
+
+	filter->events->GfxEvent = test_gfx_event;
+	return TRUE;
+}
+
+/**
+ * Runs ZGFX compressed frames through the passthrough. Until a filter ignores a PDU the output
+ * has to be the input byte for byte. From then on the data goes out as uncompressed segments,
+ * which a client decompresses to the frames without the ignored PDUs.
+ */
+static BOOL test_gfx_passthrough(BOOL filter, UINT16 ignoreCmdId)
+{
+	int x;
+	BOOL rc = FALSE;
+	BOOL ignored = FALSE;
+	BYTE* batch = NULL;
+	BYTE* expected = NULL;
+	proxyConfig config = { 0 };
+	connectionInfo info = { 0 };
+	proxyData pdata = { 0 };
+	pClientContext pc = { 0 };
+	pServerContext ps = { 0 };
+	RdpgfxClientContext client = { 0 };
+	RdpgfxServerContext server = { 0 };
+	ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+	ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+	const size_t batchSize = RDPGFX_HEADER_SIZE * 8 + TEST_LARGE_PDU + 64;
+	testSent = Stream_New(NULL, 1024);
+	testFilterCalls = 0;
+	batch = (BYTE*) malloc(batchSize);
+	expected = (BYTE*) malloc(batchSize);
+
+	if (!compressor || !decompressor || !testSent || !batch || !expected ||
+	    !pf_filters_init(&config.Filters))
+		goto fail;
+
+	if (filter && !test_register_filter(config.Filters))
+		goto fail;
+
+	config.GFXPassthrough = TRUE;
+	server.SendRaw = test_send_raw;
+	ps.gfx = &server;
+	pc.gfx = &client;
+	pdata.config = &config;
+	pdata.info = &info;
+	pdata.ps = &ps;
+	pdata.pc = &pc;
+	pf_rdpgfx_pipeline_init(&client, &server, &pdata);
+
+	if (!client.OnRawData)
+		goto fail;
+
+	for (x = 0; x < TEST_BATCHES; x++)
+	{
+		wStream* s;
+		UINT error;
+		BYTE* pCompressed = NULL;
+		BYTE* pDecompressed = NULL;
+		UINT32 compressedSize = 0;
+		UINT32 decompressedSize = 0;
+		UINT32 flags = 0;
+		/* the first batch goes through compressed, later ones break the history */
+		const BOOL ignore = (x > 0) && ignoreCmdId;
+		const size_t length = test_write_batch(batch, (BYTE) x, FALSE);
+		const size_t expectedLength = test_write_batch(expected, (BYTE) x, ignore);
+		testIgnoreCmdId = ignore ? ignoreCmdId : 0;
+
+		if (zgfx_compress(compressor, batch, (UINT32) length, &pCompressed, &compressedSize,
+		                  &flags) < 0)
+			goto fail;
+
+		if (!(s = Stream_New(pCompressed, compressedSize)))
+		{
+			free(pCompressed);
+			goto fail;
+		}
+
+		Stream_SetPosition(testSent, 0);
+		error = client.OnRawData(&client, s);
+		Stream_SealLength(testSent);
+		Stream_SetPosition(testSent, 0);
+
+		if (error != CHANNEL_RC_OK)
+		{
+			fprintf(stderr, "passthrough of batch %d failed with %"PRIu32"\n", x, error);
+			Stream_Free(s, TRUE);
+			goto fail;
+		}
+
+		if ((!ignoreCmdId || (x == 0)) && ((Stream_Length(testSent) != compressedSize) ||
+		                     (memcmp(Stream_Buffer(testSent), pCompressed, compressedSize) != 0)))
+		{
+			fprintf(stderr, "batch %d was not forwarded as is\n", x);
+			Stream_Free(s, TRUE);
+			goto fail;
+		}
+
+		Stream_Free(s, TRUE);
+
+		/* what the client of the proxy sees, with the history of everything forwarded */
+		if (zgfx_decompress(decompressor, Stream_Buffer(testSent), (UINT32) Stream_Length(testSent),
+		                    &pDecompressed, &decompressedSize, 0) < 0)
+			goto fail;
+
+		ignored = (decompressedSize != length);
+
+		if ((decompressedSize != expectedLength) ||
+		    (memcmp(pDecompressed, expected, expectedLength) != 0))
+		{
+			fprintf(stderr, "batch %d decompressed to different PDUs\n", x);
+			free(pDecompressed);
+			goto fail;
+		}
+
+		free(pDecompressed);
+	}
+
+	if (ignoreCmdId && !ignored)
+		goto fail;
+
+	/* PDUs are only parsed for filters that handle GFX events */
+	if (testFilterCalls != (filter ? TEST_BATCHES * TEST_PDUS : 0))
+	{
+		fprintf(stderr, "the filter saw %"PRIu32" PDUs\n", testFilterCalls);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s(%d, 0x%04"PRIX16") failed\n", __FUNCTION__, filter, ignoreCmdId);
+
+	pf_rdpgfx_pipeline_uninit(&pc);
+	pf_filters_unregister_all(config.Filters);
+	zgfx_context_free(compressor);
+	zgfx_context_free(decompressor);
+	Stream_Free(testSent, TRUE);
+	testSent = NULL;
+	free(batch);
+	free(expected);
+	return rc;
+}
+
+int TestProxyGfxPassthrough(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_gfx_passthrough(FALSE, 0))
+		return -1;
+
+	if (!test_gfx_passthrough(TRUE, 0))
+		return -1;
+
+	if (!test_gfx_passthrough(TRUE, RDPGFX_CMDID_SOLIDFILL))
+		return -1;
+
+	return 0;
+}
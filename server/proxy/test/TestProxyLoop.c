@@ -0,0 +1,318 @@
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/interlocked.h>
+
+#include "../pf_loop.h"
+#include "../pf_server.h"
+#include "../pf_context.h"
+
+#define TEST_SESSIONS 20
+/* the same event several times turns epoll off, the loop is limited to 64 handles then */
+#define TEST_SHARED_HANDLES 4
+
+typedef struct
+{
+	proxyData pdata;
+	HANDLE event;
+	DWORD handles;
+	BOOL fail;
+	BOOL added;
+	volatile LONG checks;
+	volatile LONG ended;
+} testSession;
+
+static testSession testSessions[TEST_SESSIONS];
+
+/* the loop only talks to sessions through these, the real ones live in pf_server.c */
+DWORD pf_server_session_get_event_handles(proxyData* pdata, HANDLE* events, DWORD count)
+{
+	DWORD x;
+	testSession* session = (testSession*) pdata;
+
+	for (x = 0; (x < session->handles) && (x < count); x++)
+		events[x] = session->event;
+
+	return x;
+}
+
+BOOL pf_server_session_is_blocked(proxyData* pdata)
+{
+	WINPR_UNUSED(pdata);
+	return FALSE;
+}
+
+BOOL pf_server_session_check(proxyData* pdata)
+{
+	testSession* session = (testSession*) pdata;
+	ResetEvent(session->event);
+	InterlockedIncrement(&session->checks);
+	return !session->fail;
+}
+
+void pf_server_session_end(proxyData* pdata)
+{
+	testSession* session = (testSession*) pdata;
+	InterlockedIncrement(&session->ended);
+}
+
+static BOOL test_wait_for(volatile LONG* value, LONG expected)
+{
+	int x;
+
+	for (x = 0; x < 200; x++)
+	{
+		if (InterlockedCompareExchange(value, 0, 0) == expected)
+			return TRUE;
+
+		Sleep(5);
+	}
+
+	return FALSE;
+}
+
+static BOOL test_sessions_init(DWORD handles, BOOL attached)
+{
+	int x;
+	ZeroMemory(testSessions, sizeof(testSessions));
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		testSessions[x].handles = handles;
+		testSessions[x].pdata.client_attached = attached;
+
+		if (!(testSessions[x].event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void test_sessions_uninit(void)
+{
+	int x;
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (testSessions[x].event)
+			CloseHandle(testSessions[x].event);
+	}
+}
+
+/* a signalled session has to be serviced, but none of the others */
+static BOOL test_session_signal(int index)
+{
+	int x;
+	LONG checks[TEST_SESSIONS];
+
+	/* give sessions that are moved or ended the time to settle */
+	Sleep(50);
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+		checks[x] = InterlockedCompareExchange(&testSessions[x].checks, 0, 0);
+
+	SetEvent(testSessions[index].event);
+
+	if (!test_wait_for(&testSessions[index].checks, checks[index] + 1))
+	{
+		fprintf(stderr, "session %d was not serviced\n", index);
+		return FALSE;
+	}
+
+	Sleep(20);
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if ((x != index) && (testSessions[x].checks != checks[x]))
+		{
+			fprintf(stderr, "session %d was serviced for session %d\n", x, index);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_loop_service(void)
+{
+	int x;
+	BOOL rc = FALSE;
+	proxyLoopPool* pool = pf_loop_pool_new(1);
+
+	if (!pool || !test_sessions_init(1, TRUE))
+		goto fail;
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (!pf_loop_pool_add(pool, &testSessions[x].pdata))
+			goto fail;
+	}
+
+	for (x = 0; x < TEST_SESSIONS; x += 7)
+	{
+		if (!test_session_signal(x))
+			goto fail;
+	}
+
+	/* only the failing session ends */
+	testSessions[3].fail = TRUE;
+	SetEvent(testSessions[3].event);
+
+	if (!test_wait_for(&testSessions[3].ended, 1))
+		goto fail;
+
+	if (!test_session_signal(4) || !test_session_signal(2))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __FUNCTION__);
+
+	pf_loop_pool_free(pool);
+	test_sessions_uninit();
+	return rc;
+}
+
+/**
+ * Without epoll a loop does not take more sessions than fit into its wait set. Those that do not
+ * fit go to another loop if there is one, or are ended, the rest keeps running.
+ */
+static BOOL test_loop_limit(UINT32 threads)
+{
+	int x;
+	BOOL rc = FALSE;
+	int served = 0;
+	int rejected = 0;
+	proxyLoopPool* pool = pf_loop_pool_new(threads);
+
+	if (!pool || !test_sessions_init(TEST_SHARED_HANDLES, TRUE))
+		goto fail;
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		testSessions[x].added = pf_loop_pool_add(pool, &testSessions[x].pdata);
+
+		if (!testSessions[x].added)
+			rejected++;
+
+		/* let the loops see how many handles they have left */
+		Sleep(10);
+	}
+
+	Sleep(50);
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (!testSessions[x].added || testSessions[x].ended)
+			continue;
+
+		served++;
+
+		if (!test_session_signal(x))
+			goto fail;
+	}
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (testSessions[x].ended > 1)
+			goto fail;
+	}
+
+	/* 2 handles per loop for its own events */
+	if ((served == 0) ||
+	    ((DWORD) served > threads * ((MAXIMUM_WAIT_OBJECTS - 2) / TEST_SHARED_HANDLES)))
+		goto fail;
+
+	if ((threads > 1) && ((served != TEST_SESSIONS) || (rejected != 0)))
+		goto fail;
+
+	if ((threads == 1) && (served == TEST_SESSIONS))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s(%"PRIu32") failed, %d sessions served, %d rejected\n", __FUNCTION__,
+		        threads, served, rejected);
+
+	pf_loop_pool_free(pool);
+	test_sessions_uninit();
+	return rc;
+}
+
+/* sessions that get more handles once attached and no longer fit move to the other loop */
+static BOOL test_loop_grow(void)
+{
+	int x;
+	BOOL rc = FALSE;
+	int moved = 0;
+	proxyLoop* loop;
+	proxyLoopPool* pool = pf_loop_pool_new(2);
+
+	if (!pool || !test_sessions_init(1, FALSE))
+		goto fail;
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (!pf_loop_pool_add(pool, &testSessions[x].pdata))
+			goto fail;
+	}
+
+	Sleep(50);
+	loop = testSessions[0].pdata.loop;
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (testSessions[x].pdata.loop != loop)
+			continue;
+
+		testSessions[x].handles = TEST_SHARED_HANDLES * 2;
+		InterlockedExchange(&testSessions[x].pdata.client_attached, TRUE);
+	}
+
+	pf_loop_wakeup(loop);
+
+	for (x = 0; x < TEST_SESSIONS; x++)
+	{
+		if (testSessions[x].ended || !test_session_signal(x))
+			goto fail;
+
+		if ((testSessions[x].handles > 1) && (testSessions[x].pdata.loop != loop))
+			moved++;
+	}
+
+	if (moved == 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed, %d sessions moved\n", __FUNCTION__, moved);
+
+	pf_loop_pool_free(pool);
+	test_sessions_uninit();
+	return rc;
+}
+
+int TestProxyLoop(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_loop_service())
+		return -1;
+
+	if (!test_loop_limit(1))
+		return -1;
+
+	if (!test_loop_limit(2))
+		return -1;
+
+	if (!test_loop_grow())
+		return -1;
+
+	return 0;
+}
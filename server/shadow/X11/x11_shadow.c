@@ -765,14 +765,14 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 {
 	int count;
 	int status;
-	int x, y;
-	int width, height;
-	XImage* image;
+	UINT32 index;
+	UINT32 numRects = 0;
+	XImage* image = NULL;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	const RECTANGLE_16* rects;
 	server = subsystem->common.server;
 	surface = server->surface;
 	count = ArrayList_Count(server->clients);
@@ -780,6 +780,8 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	if (count < 1)
 		return 1;
 
+	region16_init(&invalidRegion);
+
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
 	surfaceRect.right = surface->width;
@@ -796,10 +798,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 		image = subsystem->fb_image;
 		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
 		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) & (image->data[surface->width * 4]), image->bytes_per_line,
-		                                &invalidRect);
+		status = shadow_capture_compare_region(server->capture, surface->data,
+		                                       surface->scanline, surface->width, surface->height,
+		                                       (BYTE*) & (image->data[surface->width * 4]), image->bytes_per_line,
+		                                       &invalidRegion);
 	}
 	else
 	{
@@ -815,9 +817,9 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 			goto fail_capture;
 		}
 
-		status = shadow_capture_compare(surface->data, surface->scanline,
-		                                surface->width, surface->height,
-		                                (BYTE*) image->data, image->bytes_per_line, &invalidRect);
+		status = shadow_capture_compare_region(server->capture, surface->data,
+		                                       surface->scanline, surface->width, surface->height,
+		                                       (BYTE*) image->data, image->bytes_per_line, &invalidRegion);
 	}
 
 	/* Restore the default error handler */
@@ -825,26 +827,41 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
-	if (status)
+	if (status > 0)
 	{
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
-		                    &invalidRect);
+		/* Keep the dirty tiles apart, only they are copied and encoded */
+		rects = region16_rects(&invalidRegion, &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+			                    &rects[index]);
+		}
+
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion),
 		                        &surfaceRect);
 
 		if (!region16_is_empty(&(surface->invalidRegion)))
 		{
-			extents = region16_extents(&(surface->invalidRegion));
-			x = extents->left;
-			y = extents->top;
-			width = extents->right - extents->left;
-			height = extents->bottom - extents->top;
-
-			if (!freerdp_image_copy(surface->data, surface->format,
-			                        surface->scanline, x, y, width, height,
-			                        (BYTE*) image->data, PIXEL_FORMAT_BGRX32,
-			                        image->bytes_per_line, x, y, NULL, FREERDP_FLIP_NONE))
-				goto fail_capture;
+			/* Look for scrolled or dragged content while the previous frame is still there */
+			surface->moved = (shadow_capture_detect_move(surface->data, surface->scanline,
+			                  (BYTE*) image->data, image->bytes_per_line,
+			                  &(surface->invalidRegion), &(surface->moveRect),
+			                  &(surface->moveX), &(surface->moveY)) > 0);
+			rects = region16_rects(&(surface->invalidRegion), &numRects);
+
+			for (index = 0; index < numRects; index++)
+			{
+				const RECTANGLE_16* rect = &rects[index];
+
+				if (!freerdp_image_copy(surface->data, surface->format,
+				                        surface->scanline, rect->left, rect->top,
+				                        rect->right - rect->left, rect->bottom - rect->top,
+				                        (BYTE*) image->data, PIXEL_FORMAT_BGRX32,
+				                        image->bytes_per_line, rect->left, rect->top, NULL,
+				                        FREERDP_FLIP_NONE))
+					goto fail_image_copy;
+			}
 
 			//x11_shadow_blend_cursor(subsystem);
 			count = ArrayList_Count(server->clients);
@@ -860,13 +877,22 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 			}
 
 			region16_clear(&(surface->invalidRegion));
+			surface->moved = FALSE;
 		}
 	}
 
 	if (!subsystem->use_xshm)
 		XDestroyImage(image);
 
+	region16_uninit(&invalidRegion);
 	return 1;
+fail_image_copy:
+
+	if (!subsystem->use_xshm)
+		XDestroyImage(image);
+
+	region16_uninit(&invalidRegion);
+	return 0;
 fail_capture:
 
 	if (!subsystem->use_xshm && image)
@@ -875,6 +901,7 @@ fail_capture:
 	XSetErrorHandler(NULL);
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
+	region16_uninit(&invalidRegion);
 	return 0;
 }
 
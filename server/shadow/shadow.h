@@ -31,6 +31,8 @@
 #include "shadow_subsystem.h"
 #include "shadow_lobby.h"
 #include "shadow_mcevent.h"
+#include "shadow_encode_cache.h"
+#include "shadow_gfx_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
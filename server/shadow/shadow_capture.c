@@ -22,8 +22,10 @@
 
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
+#include <freerdp/primitives.h>
 
 #include "shadow_surface.h"
 
@@ -31,6 +33,17 @@
 
 #define TAG SERVER_TAG("shadow")
 
+#define SHADOW_CAPTURE_TILE_SIZE		16
+#define SHADOW_CAPTURE_MAX_RUNS			32
+/* Below this many tiles splitting the frame costs more than it saves */
+#define SHADOW_CAPTURE_PARALLEL_MIN_TILES	4096
+/* Smaller dirty areas are cheaper to encode than to search for moves */
+#define SHADOW_CAPTURE_MOVE_MIN_SIZE		64
+#define SHADOW_CAPTURE_MOVE_MIN_LENGTH		32
+#define SHADOW_CAPTURE_MOVE_MIN_VOTES		8
+/* Columns are hashed over every n-th row only, matches are verified anyway */
+#define SHADOW_CAPTURE_MOVE_COLUMN_STEP		4
+
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 {
 	int dx, dy;
@@ -79,147 +92,566 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
-                           BYTE* pData2, UINT32 nStep2, RECTANGLE_16* rect)
+struct _SHADOW_CAPTURE_COMPARE_PARAM
 {
-	BOOL equal;
-	BOOL allEqual;
-	UINT32 tw, th;
-	UINT32 tx, ty, k;
-	UINT32 nrow, ncol;
-	UINT32 l, t, r, b;
-	BYTE* p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
-#endif
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
-#endif
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
-	l = ncol + 1;
-	r = 0;
-	t = nrow + 1;
-	b = 0;
-
-	for (ty = 0; ty < nrow; ty++)
-	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
+	const BYTE* pData1;
+	UINT32 nStep1;
+	const BYTE* pData2;
+	UINT32 nStep2;
+	UINT32 nWidth;
+	UINT32 nHeight;
+	UINT32 firstRow;
+	UINT32 lastRow;
+	REGION16 region;
+	BOOL success;
+};
+typedef struct _SHADOW_CAPTURE_COMPARE_PARAM SHADOW_CAPTURE_COMPARE_PARAM;
+
+static BOOL shadow_capture_add_run(REGION16* region, UINT32 left, UINT32 top,
+                                   UINT32 right, UINT32 bottom)
+{
+	RECTANGLE_16 rect;
+	rect.left = (UINT16) left;
+	rect.top = (UINT16) top;
+	rect.right = (UINT16) right;
+	rect.bottom = (UINT16) bottom;
+	return region16_union_rect(region, region, &rect);
+}
 
-		if (!th)
-			th = 16;
+/**
+ * Compare the tile rows [firstRow, lastRow) and add every horizontal run of
+ * dirty tiles to the region. Rows with too many runs (noise, dithering) are
+ * added as a single span to bound the region complexity.
+ */
+static void shadow_capture_compare_rows(SHADOW_CAPTURE_COMPARE_PARAM* param)
+{
+	UINT32 tx, ty;
+	UINT32 ncol = (param->nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	primitives_t* prims = primitives_get();
+	param->success = TRUE;
 
-		for (tx = 0; tx < ncol; tx++)
+	for (ty = param->firstRow; ty < param->lastRow; ty++)
+	{
+		UINT32 runs = 0;
+		UINT32 runStart = 0;
+		UINT32 spanLeft = 0;
+		UINT32 spanRight = 0;
+		BOOL inRun = FALSE;
+		const UINT32 top = ty * SHADOW_CAPTURE_TILE_SIZE;
+		const UINT32 th = MIN(SHADOW_CAPTURE_TILE_SIZE, param->nHeight - top);
+		const BYTE* p1 = &param->pData1[top * param->nStep1];
+		const BYTE* p2 = &param->pData2[top * param->nStep2];
+		UINT32 starts[SHADOW_CAPTURE_MAX_RUNS];
+		UINT32 ends[SHADOW_CAPTURE_MAX_RUNS];
+
+		for (tx = 0; tx <= ncol; tx++)
 		{
-			equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+			BOOL equal = TRUE;
 
-			if (!tw)
-				tw = 16;
+			if (tx < ncol)
+			{
+				const UINT32 left = tx * SHADOW_CAPTURE_TILE_SIZE;
+				const UINT32 tw = MIN(SHADOW_CAPTURE_TILE_SIZE, param->nWidth - left);
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+				if (prims->compare_32u(&p1[left * 4], param->nStep1, &p2[left * 4], param->nStep2,
+				                       tw, th, &equal) != PRIMITIVES_SUCCESS)
+				{
+					param->success = FALSE;
+					return;
+				}
+			}
 
-			for (k = 0; k < th; k++)
+			if (!equal && !inRun)
 			{
-				if (memcmp(p1, p2, tw * 4) != 0)
+				runStart = tx;
+				inRun = TRUE;
+			}
+			else if (equal && inRun)
+			{
+				if (runs < SHADOW_CAPTURE_MAX_RUNS)
 				{
-					equal = FALSE;
-					break;
+					starts[runs] = runStart * SHADOW_CAPTURE_TILE_SIZE;
+					ends[runs] = MIN(tx * SHADOW_CAPTURE_TILE_SIZE, param->nWidth);
 				}
 
-				p1 += nStep1;
-				p2 += nStep2;
+				if (runs == 0)
+					spanLeft = runStart * SHADOW_CAPTURE_TILE_SIZE;
+
+				spanRight = MIN(tx * SHADOW_CAPTURE_TILE_SIZE, param->nWidth);
+				runs++;
+				inRun = FALSE;
 			}
+		}
 
-			if (!equal)
+		if (runs > SHADOW_CAPTURE_MAX_RUNS)
+		{
+			if (!shadow_capture_add_run(&param->region, spanLeft, top, spanRight, top + th))
+				param->success = FALSE;
+		}
+		else
+		{
+			for (tx = 0; tx < runs; tx++)
 			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
+				if (!shadow_capture_add_run(&param->region, starts[tx], top, ends[tx], top + th))
+					param->success = FALSE;
+			}
+		}
 
-				if (l > tx)
-					l = tx;
+		if (!param->success)
+			return;
+	}
+}
 
-				if (r < tx)
-					r = tx;
-			}
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+        void* context, PTP_WORK work)
+{
+	SHADOW_CAPTURE_COMPARE_PARAM* param = (SHADOW_CAPTURE_COMPARE_PARAM*) context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	shadow_capture_compare_rows(param);
+}
+
+/**
+ * Function description
+ * Compare two frames in 16x16 tiles and return the dirty tiles as region.
+ * With a capture context and a large enough frame the tile rows are split
+ * across the capture thread pool.
+ *
+ * @return 1 if the frames differ, 0 if they are equal, -1 on failure
+ */
+int shadow_capture_compare_region(rdpShadowCapture* capture, BYTE* pData1, UINT32 nStep1,
+                                  UINT32 nWidth, UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
+                                  REGION16* region)
+{
+	UINT32 index;
+	UINT32 nrow, ncol;
+	UINT32 count = 1;
+	UINT32 rowsPerWork;
+	PTP_WORK* works = NULL;
+	SHADOW_CAPTURE_COMPARE_PARAM* params;
+	BOOL success = TRUE;
+
+	if (!pData1 || !pData2 || !region || (nWidth > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return -1;
+
+	region16_clear(region);
+	nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+
+	if (nrow == 0 || ncol == 0)
+		return 0;
+
+	if (capture && capture->UseThreads && ((nrow * ncol) >= SHADOW_CAPTURE_PARALLEL_MIN_TILES))
+		count = MIN(capture->ThreadCount, nrow);
+
+	rowsPerWork = (nrow + count - 1) / count;
+	count = (nrow + rowsPerWork - 1) / rowsPerWork;
+	params = (SHADOW_CAPTURE_COMPARE_PARAM*) calloc(count, sizeof(SHADOW_CAPTURE_COMPARE_PARAM));
+
+	if (!params)
+		return -1;
+
+	if (count > 1)
+	{
+		if (!(works = (PTP_WORK*) calloc(count, sizeof(PTP_WORK))))
+		{
+			free(params);
+			return -1;
 		}
+	}
 
-		if (!rows[ty])
+	for (index = 0; index < count; index++)
+	{
+		SHADOW_CAPTURE_COMPARE_PARAM* param = &params[index];
+		param->pData1 = pData1;
+		param->nStep1 = nStep1;
+		param->pData2 = pData2;
+		param->nStep2 = nStep2;
+		param->nWidth = nWidth;
+		param->nHeight = nHeight;
+		param->firstRow = index * rowsPerWork;
+		param->lastRow = MIN(param->firstRow + rowsPerWork, nrow);
+		region16_init(&param->region);
+
+		if (works)
 		{
-			allEqual = FALSE;
+			works[index] = CreateThreadpoolWork(shadow_capture_compare_work_callback,
+			                                    (void*) param, &capture->ThreadPoolEnv);
 
-			if (t > ty)
-				t = ty;
+			if (works[index])
+			{
+				SubmitThreadpoolWork(works[index]);
+				continue;
+			}
 
-			if (b < ty)
-				b = ty;
+			WLog_WARN(TAG, "CreateThreadpoolWork failed, comparing inline");
 		}
+
+		shadow_capture_compare_rows(param);
 	}
 
-	if (allEqual)
-		return 0;
+	for (index = 0; index < count; index++)
+	{
+		UINT32 i;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects;
+
+		if (works && works[index])
+		{
+			WaitForThreadpoolWorkCallbacks(works[index], FALSE);
+			CloseThreadpoolWork(works[index]);
+		}
 
-	rect->left = l * 16;
-	rect->top = t * 16;
-	rect->right = (r + 1) * 16;
-	rect->bottom = (b + 1) * 16;
+		if (!params[index].success)
+			success = FALSE;
 
-	if (rect->right > nWidth)
-		rect->right = nWidth;
+		rects = region16_rects(&params[index].region, &numRects);
 
-	if (rect->bottom > nHeight)
-		rect->bottom = nHeight;
+		for (i = 0; success && (i < numRects); i++)
+		{
+			if (!region16_union_rect(region, region, &rects[i]))
+				success = FALSE;
+		}
+
+		region16_uninit(&params[index].region);
+	}
+
+	free(works);
+	free(params);
+
+	if (!success)
+	{
+		region16_clear(region);
+		return -1;
+	}
 
 #ifdef WITH_DEBUG_SHADOW_CAPTURE
-	size_t size = ncol + 1;
-	char* col_str = calloc(size, sizeof(char));
+	{
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects = region16_rects(region, &numRects);
+
+		for (index = 0; index < numRects; index++)
+		{
+			WLog_INFO(TAG, "dirty: left: %"PRIu16" top: %"PRIu16" right: %"PRIu16" bottom: %"PRIu16"",
+			          rects[index].left, rects[index].top, rects[index].right, rects[index].bottom);
+		}
+
+		WLog_INFO(TAG, "ncol: %"PRIu32" nrow: %"PRIu32" works: %"PRIu32"", ncol, nrow, count);
+	}
+#endif
+	return region16_is_empty(region) ? 0 : 1;
+}
 
-	if (!col_str)
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+                           BYTE* pData2, UINT32 nStep2, RECTANGLE_16* rect)
+{
+	int status;
+	REGION16 region;
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	status = shadow_capture_compare_region(NULL, pData1, nStep1, nWidth, nHeight, pData2,
+	                                       nStep2, &region);
+
+	if (status > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return (status > 0) ? 1 : 0;
+}
+
+/* Lines (rows or columns) of a moved area are matched by their hash */
+struct _SHADOW_CAPTURE_LINE
+{
+	UINT64 hash;
+	UINT32 index;
+};
+typedef struct _SHADOW_CAPTURE_LINE SHADOW_CAPTURE_LINE;
+
+static int shadow_capture_line_compare(const void* a, const void* b)
+{
+	const SHADOW_CAPTURE_LINE* l1 = (const SHADOW_CAPTURE_LINE*) a;
+	const SHADOW_CAPTURE_LINE* l2 = (const SHADOW_CAPTURE_LINE*) b;
+
+	if (l1->hash != l2->hash)
+		return (l1->hash < l2->hash) ? -1 : 1;
+
+	return (l1->index < l2->index) ? -1 : ((l1->index > l2->index) ? 1 : 0);
+}
+
+static INLINE UINT64 shadow_capture_hash_step(UINT64 hash, UINT32 pixel)
+{
+	return (hash ^ pixel) * 0x100000001B3ULL;
+}
+
+/* Hash count pixels of a row, uniform rows match anywhere and are flagged */
+static UINT64 shadow_capture_hash_row(const BYTE* pData, UINT32 count, BOOL* uniform)
+{
+	UINT32 x;
+	UINT64 hash[4] = { 0xCBF29CE484222325ULL, 0x84222325CBF29CE4ULL, 1, 2 };
+	const UINT32* pixels = (const UINT32*) pData;
+	UINT32 diff = 0;
+
+	/* four independent lanes to not wait on each multiplication */
+	for (x = 0; x + 4 <= count; x += 4)
 	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
+		hash[0] = shadow_capture_hash_step(hash[0], pixels[x]);
+		hash[1] = shadow_capture_hash_step(hash[1], pixels[x + 1]);
+		hash[2] = shadow_capture_hash_step(hash[2], pixels[x + 2]);
+		hash[3] = shadow_capture_hash_step(hash[3], pixels[x + 3]);
+		diff |= (pixels[x] ^ pixels[0]) | (pixels[x + 1] ^ pixels[0]) |
+		        (pixels[x + 2] ^ pixels[0]) | (pixels[x + 3] ^ pixels[0]);
 	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	for (; x < count; x++)
+	{
+		hash[0] = shadow_capture_hash_step(hash[0], pixels[x]);
+		diff |= pixels[x] ^ pixels[0];
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	*uniform = (diff == 0);
+	return shadow_capture_hash_step(shadow_capture_hash_step(hash[0], (UINT32) hash[1]) ^ hash[2],
+	                                (UINT32) hash[3]) ^ (hash[1] >> 32) ^ (hash[3] >> 32);
+}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+/* Hash the columns of a rectangle, going through a sample of its rows */
+static void shadow_capture_hash_columns(const BYTE* pData, UINT32 nStep, UINT32 count,
+                                        UINT32 rows, UINT64* hashes, BOOL* uniform)
+{
+	UINT32 x, y;
 
-	WLog_INFO(TAG, "%s", col_str);
+	for (x = 0; x < count; x++)
+	{
+		hashes[x] = 0xCBF29CE484222325ULL;
+		uniform[x] = TRUE;
+	}
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	for (y = 0; y < rows; y += SHADOW_CAPTURE_MOVE_COLUMN_STEP)
+	{
+		const UINT32* pixels = (const UINT32*) &pData[y * nStep];
+		const UINT32* first = (const UINT32*) pData;
+
+		for (x = 0; x < count; x++)
+		{
+			hashes[x] = shadow_capture_hash_step(hashes[x], pixels[x]);
+
+			if (pixels[x] != first[x])
+				uniform[x] = FALSE;
+		}
+	}
+}
+
+/**
+ * Every line of the new frame with a unique counterpart in the previous frame
+ * votes for the offset between both. Uniform lines match any offset and do not vote.
+ *
+ * @return the offset (previous index - new index) with the most votes
+ */
+static INT32 shadow_capture_vote_offset(const UINT64* oldHashes, const UINT64* newHashes,
+                                        const BOOL* uniform, UINT32 count, UINT32* pVotes)
+{
+	UINT32 i;
+	UINT32 best = 0;
+	INT32 offset = 0;
+	UINT32* votes;
+	SHADOW_CAPTURE_LINE* lines;
+	*pVotes = 0;
+	lines = (SHADOW_CAPTURE_LINE*) calloc(count, sizeof(SHADOW_CAPTURE_LINE));
+	votes = (UINT32*) calloc(2 * count, sizeof(UINT32));
+
+	if (!lines || !votes)
+		goto out;
+
+	for (i = 0; i < count; i++)
+	{
+		lines[i].hash = oldHashes[i];
+		lines[i].index = i;
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	qsort(lines, count, sizeof(SHADOW_CAPTURE_LINE), shadow_capture_line_compare);
 
-	for (ty = 0; ty < nrow; ty++)
+	for (i = 0; i < count; i++)
 	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+		size_t low = 0;
+		size_t high = count;
+
+		if (uniform[i] || (newHashes[i] == oldHashes[i]))
+			continue;
+
+		while (low < high)
+		{
+			const size_t mid = (low + high) / 2;
 
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+			if (lines[mid].hash < newHashes[i])
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		if ((low >= count) || (lines[low].hash != newHashes[i]))
+			continue;
+
+		/* Repeated lines (text, patterns) give no reliable offset */
+		if ((low + 1 < count) && (lines[low + 1].hash == newHashes[i]))
+			continue;
+
+		if (++votes[lines[low].index + count - i] > best)
+		{
+			best = votes[lines[low].index + count - i];
+			offset = (INT32) lines[low].index - (INT32) i;
+		}
 	}
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d",
-	          l, t, r, b, ncol, nrow);
-	free(col_str);
-#endif
-	return 1;
+	*pVotes = best;
+out:
+	free(lines);
+	free(votes);
+	return offset;
+}
+
+/**
+ * Find the longest run of lines matching the previous frame at the given offset.
+ *
+ * @return the run length, with its first line in pFirst
+ */
+static UINT32 shadow_capture_match_run(const UINT64* oldHashes, const UINT64* newHashes,
+                                       UINT32 count, INT32 offset, UINT32* pFirst)
+{
+	UINT32 i;
+	UINT32 run = 0;
+	UINT32 best = 0;
+	const UINT32 first = (offset < 0) ? (UINT32) - offset : 0;
+	const UINT32 last = (offset > 0) ? count - (UINT32) offset : count;
+
+	for (i = first; i <= last; i++)
+	{
+		if ((i < last) && (newHashes[i] == oldHashes[(INT32) i + offset]))
+		{
+			run++;
+			continue;
+		}
+
+		if (run > best)
+		{
+			best = run;
+			*pFirst = i - run;
+		}
+
+		run = 0;
+	}
+
+	return best;
+}
+
+/**
+ * Function description
+ * Look for a vertical or horizontal shift of screen content within the
+ * extents of the dirty region, as produced by scrolling or dragging a window.
+ * pData1 is the previous frame, pData2 the new one.
+ *
+ * @return 1 if rect (in the previous frame) moved by dx/dy, 0 if no move was found, -1 on failure
+ */
+int shadow_capture_detect_move(BYTE* pData1, UINT32 nStep1, BYTE* pData2, UINT32 nStep2,
+                               const REGION16* region, RECTANGLE_16* rect, INT32* dx, INT32* dy)
+{
+	int status = -1;
+	UINT32 i;
+	UINT32 votes;
+	UINT32 first = 0;
+	UINT32 length;
+	INT32 offset;
+	UINT32 width, height;
+	const RECTANGLE_16* extents;
+	UINT64* oldHashes = NULL;
+	UINT64* newHashes = NULL;
+	BOOL* uniform = NULL;
+	BYTE* pOld;
+	BYTE* pNew;
+
+	if (!pData1 || !pData2 || !region || !rect || !dx || !dy)
+		return -1;
+
+	extents = region16_extents(region);
+	width = extents->right - extents->left;
+	height = extents->bottom - extents->top;
+
+	if ((width < SHADOW_CAPTURE_MOVE_MIN_SIZE) || (height < SHADOW_CAPTURE_MOVE_MIN_SIZE))
+		return 0;
+
+	pOld = &pData1[(extents->top * nStep1) + (extents->left * 4)];
+	pNew = &pData2[(extents->top * nStep2) + (extents->left * 4)];
+	oldHashes = (UINT64*) calloc(MAX(width, height), sizeof(UINT64));
+	newHashes = (UINT64*) calloc(MAX(width, height), sizeof(UINT64));
+	uniform = (BOOL*) calloc(MAX(width, height), sizeof(BOOL));
+
+	if (!oldHashes || !newHashes || !uniform)
+		goto out;
+
+	status = 0;
+
+	/* Scrolling is by far the most common move, try rows first */
+	for (i = 0; i < height; i++)
+	{
+		BOOL unused;
+		oldHashes[i] = shadow_capture_hash_row(&pOld[i * nStep1], width, &unused);
+		newHashes[i] = shadow_capture_hash_row(&pNew[i * nStep2], width, &uniform[i]);
+	}
+
+	offset = shadow_capture_vote_offset(oldHashes, newHashes, uniform, height, &votes);
+
+	if ((votes >= SHADOW_CAPTURE_MOVE_MIN_VOTES) &&
+	    ((length = shadow_capture_match_run(oldHashes, newHashes, height, offset,
+	                                        &first)) >= SHADOW_CAPTURE_MOVE_MIN_LENGTH))
+	{
+		for (i = first; i < first + length; i++)
+		{
+			if (memcmp(&pNew[i * nStep2], &pOld[(i + offset) * nStep1], width * 4) != 0)
+				goto out;
+		}
+
+		rect->left = extents->left;
+		rect->right = extents->right;
+		rect->top = (UINT16)(extents->top + first + offset);
+		rect->bottom = (UINT16)(rect->top + length);
+		*dx = 0;
+		*dy = -offset;
+		status = 1;
+		goto out;
+	}
+
+	shadow_capture_hash_columns(pOld, nStep1, width, height, oldHashes, uniform);
+	shadow_capture_hash_columns(pNew, nStep2, width, height, newHashes, uniform);
+	offset = shadow_capture_vote_offset(oldHashes, newHashes, uniform, width, &votes);
+
+	if ((votes >= SHADOW_CAPTURE_MOVE_MIN_VOTES) &&
+	    ((length = shadow_capture_match_run(oldHashes, newHashes, width, offset,
+	                                        &first)) >= SHADOW_CAPTURE_MOVE_MIN_LENGTH))
+	{
+		for (i = 0; i < height; i++)
+		{
+			if (memcmp(&pNew[(i * nStep2) + (first * 4)],
+			           &pOld[(i * nStep1) + ((first + offset) * 4)], length * 4) != 0)
+				goto out;
+		}
+
+		rect->left = (UINT16)(extents->left + first + offset);
+		rect->right = (UINT16)(rect->left + length);
+		rect->top = extents->top;
+		rect->bottom = extents->bottom;
+		*dx = -offset;
+		*dy = 0;
+		status = 1;
+	}
+
+out:
+	free(oldHashes);
+	free(newHashes);
+	free(uniform);
+	return status;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 {
+	SYSTEM_INFO sysinfo;
 	rdpShadowCapture* capture;
 	capture = (rdpShadowCapture*) calloc(1, sizeof(rdpShadowCapture));
 
@@ -234,6 +666,28 @@ rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 		return NULL;
 	}
 
+	/* Initialize the primitives before the compare work runs on the pool */
+	primitives_get();
+	GetNativeSystemInfo(&sysinfo);
+	capture->UseThreads = (sysinfo.dwNumberOfProcessors > 1);
+
+	if (capture->UseThreads)
+	{
+		capture->ThreadCount = sysinfo.dwNumberOfProcessors;
+		capture->ThreadPool = CreateThreadpool(NULL);
+
+		if (!capture->ThreadPool)
+		{
+			DeleteCriticalSection(&(capture->lock));
+			free(capture);
+			return NULL;
+		}
+
+		InitializeThreadpoolEnvironment(&capture->ThreadPoolEnv);
+		SetThreadpoolCallbackPool(&capture->ThreadPoolEnv, capture->ThreadPool);
+		SetThreadpoolThreadMaximum(capture->ThreadPool, capture->ThreadCount);
+	}
+
 	return capture;
 }
 
@@ -242,6 +696,12 @@ void shadow_capture_free(rdpShadowCapture* capture)
 	if (!capture)
 		return;
 
+	if (capture->UseThreads)
+	{
+		CloseThreadpool(capture->ThreadPool);
+		DestroyThreadpoolEnvironment(&capture->ThreadPoolEnv);
+	}
+
 	DeleteCriticalSection(&(capture->lock));
 	free(capture);
 }
@@ -22,6 +22,7 @@
 #include <freerdp/server/shadow.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/synch.h>
 
 struct rdp_shadow_capture
@@ -31,6 +32,11 @@ struct rdp_shadow_capture
 	int width;
 	int height;
 
+	BOOL UseThreads;
+	UINT32 ThreadCount;
+	PTP_POOL ThreadPool;
+	TP_CALLBACK_ENVIRON ThreadPoolEnv;
+
 	CRITICAL_SECTION lock;
 };
 
@@ -31,6 +31,7 @@
 #include <winpr/interlocked.h>
 
 #include <freerdp/log.h>
+#include <freerdp/primitives.h>
 
 #include "shadow.h"
 
@@ -43,6 +44,26 @@ struct _SHADOW_GFX_STATUS
 };
 typedef struct _SHADOW_GFX_STATUS SHADOW_GFX_STATUS;
 
+/* Surface commands sent within a frame besides the encoded data */
+struct _SHADOW_GFX_SURFACE_OPS
+{
+	const RDPGFX_SURFACE_TO_SURFACE_PDU* move;
+	RDPGFX_SOLID_FILL_PDU* fills;
+	UINT32 numFills;
+	RECTANGLE_16* fillRects;
+	SHADOW_GFX_CACHE_TILE* tiles;
+	UINT32 numTiles;
+	UINT32 numCached;
+};
+typedef struct _SHADOW_GFX_SURFACE_OPS SHADOW_GFX_SURFACE_OPS;
+
+struct _SHADOW_GFX_SOLID_TILE
+{
+	UINT32 color;
+	RECTANGLE_16 rect;
+};
+typedef struct _SHADOW_GFX_SOLID_TILE SHADOW_GFX_SOLID_TILE;
+
 static INLINE BOOL shadow_client_rdpgfx_new_surface(rdpShadowClient* client)
 {
 	UINT error = CHANNEL_RC_OK;
@@ -144,6 +165,9 @@ static BOOL shadow_client_context_new(freerdp_peer* peer,
 	settings->SurfaceFrameMarkerEnabled = TRUE;
 	settings->SupportGraphicsPipeline = TRUE;
 	settings->GfxH264 = FALSE;
+	settings->GfxProgressive = server->gfxProgressive;
+	settings->GfxCompressionLevel = server->gfxCompressionLevel;
+	settings->TlsKernelOffload = server->kernelTls;
 	settings->DrawAllowSkipAlpha = TRUE;
 	settings->DrawAllowColorSubsampling = TRUE;
 	settings->DrawAllowDynamicColorFidelity = TRUE;
@@ -613,6 +637,42 @@ static UINT shadow_client_rdpgfx_frame_acknowledge(RdpgfxServerContext* context,
 	return CHANNEL_RC_OK;
 }
 
+/**
+ * Function description
+ * A reconnecting client offers the bitmaps it kept, answer with the
+ * cache slots the accepted ones go to.
+ *
+ * @return 0 on success, otherwise a Win32 error code
+ */
+static UINT shadow_client_rdpgfx_cache_import_offer(RdpgfxServerContext* context,
+        const RDPGFX_CACHE_IMPORT_OFFER_PDU* cacheImportOffer)
+{
+	UINT rc = CHANNEL_RC_OK;
+	rdpShadowClient* client = (rdpShadowClient*)context->custom;
+	rdpSettings* settings = context->rdpcontext->settings;
+	RDPGFX_CACHE_IMPORT_REPLY_PDU pdu;
+	pdu.cacheSlots = (UINT16*) calloc(SHADOW_GFX_CACHE_MAX_IMPORT, sizeof(UINT16));
+
+	if (!pdu.cacheSlots)
+		return CHANNEL_RC_NO_MEMORY;
+
+	/* H.264 frames never refer to the cache, import nothing */
+	if (settings->GfxH264)
+		pdu.importedEntriesCount = MIN(cacheImportOffer->cacheEntriesCount,
+		                               SHADOW_GFX_CACHE_MAX_IMPORT);
+	else
+		pdu.importedEntriesCount = shadow_gfx_cache_import(client->encoder->gfxCache,
+		                           cacheImportOffer, pdu.cacheSlots);
+
+	IFCALLRET(context->CacheImportReply, rc, context, &pdu);
+
+	if (rc)
+		WLog_ERR(TAG, "CacheImportReply failed with error %"PRIu32"", rc);
+
+	free(pdu.cacheSlots);
+	return rc;
+}
+
 static BOOL shadow_are_caps_filtered(const rdpSettings* settings, UINT32 caps)
 {
 	const UINT32 filter = settings->GfxCapsFilter;
@@ -647,6 +707,7 @@ static BOOL shadow_client_caps_test_version(RdpgfxServerContext* context,
 	UINT32 flags = 0;
 	UINT32 index;
 	rdpSettings* settings;
+	rdpShadowClient* client = (rdpShadowClient*)context->custom;
 	settings = context->rdpcontext->settings;
 
 	if (shadow_are_caps_filtered(settings, capsVersion))
@@ -675,6 +736,11 @@ static BOOL shadow_client_caps_test_version(RdpgfxServerContext* context,
 #endif
 			}
 
+			/* The client starts the channel with an empty bitmap cache */
+			if (settings && !shadow_gfx_cache_reset(client->encoder->gfxCache,
+			                                        settings->GfxSmallCache))
+				WLog_WARN(TAG, "Failed to reset the gfx bitmap cache");
+
 			*rc = context->CapsConfirm(context, &pdu);
 			return TRUE;
 		}
@@ -794,13 +860,287 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(
 	       + havc420->length;
 }
 
+/**
+ * Function description
+ * Replay a move found by the capture on the client surface. It has to be
+ * sent within the frame, before the commands repainting around it.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_move(rdpShadowClient* client,
+        const RDPGFX_SURFACE_TO_SURFACE_PDU* move)
+{
+	UINT error = CHANNEL_RC_OK;
+
+	if (!move)
+		return TRUE;
+
+	IFCALLRET(client->rdpgfx->SurfaceToSurface, error, client->rdpgfx, move);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceToSurface failed with error %"PRIu32"", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send the surface commands which go ahead of the encoded data of a frame:
+ * the move, the solid filled tiles, then the tiles the client copies from
+ * its bitmap cache.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_ops(rdpShadowClient* client,
+        const SHADOW_GFX_SURFACE_OPS* ops)
+{
+	UINT32 index;
+	UINT error = CHANNEL_RC_OK;
+
+	if (!ops)
+		return TRUE;
+
+	if (!shadow_client_send_surface_move(client, ops->move))
+		return FALSE;
+
+	for (index = 0; index < ops->numFills; index++)
+	{
+		IFCALLRET(client->rdpgfx->SolidFill, error, client->rdpgfx, &ops->fills[index]);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SolidFill failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	for (index = 0; index < ops->numTiles; index++)
+	{
+		const SHADOW_GFX_CACHE_TILE* tile = &ops->tiles[index];
+		RDPGFX_CACHE_TO_SURFACE_PDU pdu;
+		RDPGFX_POINT16 destPt;
+
+		if (!tile->cacheSlot)
+			continue;
+
+		destPt.x = tile->rect.left;
+		destPt.y = tile->rect.top;
+		pdu.cacheSlot = tile->cacheSlot;
+		pdu.surfaceId = 0;
+		pdu.destPtsCount = 1;
+		pdu.destPts = &destPt;
+		IFCALLRET(client->rdpgfx->CacheToSurface, error, client->rdpgfx, &pdu);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "CacheToSurface failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Store tiles the client has painted in its bitmap cache. Slots are
+ * reused least recently used first, the client frees them on eviction.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_cache_store(rdpShadowClient* client,
+        const SHADOW_GFX_CACHE_TILE* tiles, UINT32 numTiles)
+{
+	UINT32 index;
+	UINT error = CHANNEL_RC_OK;
+	rdpShadowGfxCache* cache = client->encoder->gfxCache;
+
+	for (index = 0; index < numTiles; index++)
+	{
+		const SHADOW_GFX_CACHE_TILE* tile = &tiles[index];
+		const UINT32 width = tile->rect.right - tile->rect.left;
+		const UINT32 height = tile->rect.bottom - tile->rect.top;
+		RDPGFX_SURFACE_TO_CACHE_PDU pdu;
+		UINT16 evicted[16];
+		UINT32 evictedCount;
+		UINT32 i;
+
+		if (tile->cacheSlot)
+			continue;
+
+		/* Also fails for content stored earlier in this frame */
+		pdu.cacheSlot = shadow_gfx_cache_add(cache, tile->cacheKey, width * height * 4, evicted,
+		                                     ARRAYSIZE(evicted), &evictedCount);
+
+		for (i = 0; i < evictedCount; i++)
+		{
+			RDPGFX_EVICT_CACHE_ENTRY_PDU evict;
+			evict.cacheSlot = evicted[i];
+			IFCALLRET(client->rdpgfx->EvictCacheEntry, error, client->rdpgfx, &evict);
+
+			if (error)
+			{
+				WLog_ERR(TAG, "EvictCacheEntry failed with error %"PRIu32"", error);
+				return FALSE;
+			}
+		}
+
+		if (!pdu.cacheSlot)
+			continue;
+
+		pdu.surfaceId = 0;
+		pdu.cacheKey = tile->cacheKey;
+		pdu.rectSrc = tile->rect;
+		IFCALLRET(client->rdpgfx->SurfaceToCache, error, client->rdpgfx, &pdu);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceToCache failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send a frame made of surface commands around (optional) encoded data.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_frame(rdpShadowClient* client,
+        const RDPGFX_START_FRAME_PDU* cmdstart, const RDPGFX_END_FRAME_PDU* cmdend,
+        const SHADOW_GFX_SURFACE_OPS* ops, const RDPGFX_SURFACE_COMMAND* cmd,
+        const SHADOW_GFX_CACHE_TILE* stores, UINT32 numStores)
+{
+	UINT error = CHANNEL_RC_OK;
+	IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, cmdstart);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "StartFrame failed with error %"PRIu32"", error);
+		return FALSE;
+	}
+
+	if (!shadow_client_send_surface_ops(client, ops))
+		return FALSE;
+
+	if (cmd)
+	{
+		IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, cmd);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceCommand failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	if (!shadow_client_send_cache_store(client, stores, numStores))
+		return FALSE;
+
+	IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, cmdend);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "EndFrame failed with error %"PRIu32"", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Describe the part of an H.264 frame the client shows. The whole surface
+ * is encoded and sent, but solid filled tiles are left to the SolidFill commands.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_h264_metablock(rdpShadowEncoder* encoder,
+        const RDPGFX_SURFACE_COMMAND* cmd, RDPGFX_H264_METABLOCK* meta)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	RECTANGLE_16 surfaceRect;
+	REGION16 region;
+	surfaceRect.left = cmd->left;
+	surfaceRect.top = cmd->top;
+	surfaceRect.right = cmd->right;
+	surfaceRect.bottom = cmd->bottom;
+	region16_init(&region);
+
+	if (!region16_union_rect(&region, &region, &surfaceRect))
+		goto out;
+
+	rects = region16_rects(&encoder->solidRegion, &numRects);
+
+	for (index = 0; index < numRects; index++)
+	{
+		if (!region16_subtract_rect(&region, &region, &rects[index]))
+			goto out;
+	}
+
+	rects = region16_rects(&region, &numRects);
+
+	/*
+	 * A frame has at least one region rectangle. With every tile filled an empty one keeps
+	 * the decoder in step without blitting lossy pixels over the fills.
+	 */
+	if (!numRects)
+	{
+		surfaceRect.right = surfaceRect.left;
+		surfaceRect.bottom = surfaceRect.top;
+		rects = &surfaceRect;
+		numRects = 1;
+	}
+
+	meta->numRegionRects = numRects;
+	meta->regionRects = (RECTANGLE_16*) calloc(numRects, sizeof(RECTANGLE_16));
+	meta->quantQualityVals = (RDPGFX_H264_QUANT_QUALITY*) calloc(numRects,
+	                         sizeof(RDPGFX_H264_QUANT_QUALITY));
+
+	if (!meta->regionRects || !meta->quantQualityVals)
+		goto out;
+
+	for (index = 0; index < numRects; index++)
+	{
+		meta->regionRects[index] = rects[index];
+		meta->quantQualityVals[index].qp = encoder->h264->QP;
+		meta->quantQualityVals[index].r = 0;
+		meta->quantQualityVals[index].p = 0;
+		meta->quantQualityVals[index].qualityVal = 100 - encoder->h264->QP;
+	}
+
+	rc = TRUE;
+out:
+
+	if (!rc)
+	{
+		free(meta->regionRects);
+		free(meta->quantQualityVals);
+		meta->regionRects = NULL;
+		meta->quantQualityVals = NULL;
+	}
+
+	region16_uninit(&region);
+	return rc;
+}
+
 /**
  * Function description
  *
  * @return TRUE on success
  */
 static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
-        const BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
+        const BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight,
+        const REGION16* invalidRegion, const SHADOW_GFX_SURFACE_OPS* ops)
 {
 	UINT error = CHANNEL_RC_OK;
 	rdpContext* context = (rdpContext*) client;
@@ -810,16 +1150,22 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	RDPGFX_START_FRAME_PDU cmdstart;
 	RDPGFX_END_FRAME_PDU cmdend;
 	SYSTEMTIME sTime;
+	BOOL hasOps;
 
-	if (!context || !pSrcData)
+	if (!context)
 		return FALSE;
 
 	settings = context->settings;
 	encoder = client->encoder;
+	hasOps = ops && (ops->move || (ops->numFills > 0) || (ops->numCached > 0));
 
 	if (!settings || !encoder)
 		return FALSE;
 
+	/* Only progressive upgrade passes may be sent without source data */
+	if (!pSrcData && (settings->GfxH264 || !settings->GfxProgressive))
+		return FALSE;
+
 	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
 	GetSystemTime(&sTime);
 	cmdstart.timestamp = sTime.wHour << 22 | sTime.wMinute << 16 |
@@ -842,9 +1188,9 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 	if (settings->GfxAVC444 || settings->GfxAVC444v2)
 	{
 		RDPGFX_AVC444_BITMAP_STREAM avc444;
-		RECTANGLE_16 regionRect;
-		RDPGFX_H264_QUANT_QUALITY quantQualityVal;
+		RDPGFX_H264_METABLOCK meta = { 0 };
 		BYTE version = settings->GfxAVC444v2 ? 2 : 1;
+		BOOL sent = TRUE;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC444) < 0)
 		{
@@ -861,37 +1207,37 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 			return FALSE;
 		}
 
-		regionRect.left = cmd.left;
-		regionRect.top = cmd.top;
-		regionRect.right = cmd.right;
-		regionRect.bottom = cmd.bottom;
-		quantQualityVal.qp = encoder->h264->QP;
-		quantQualityVal.r = 0;
-		quantQualityVal.p = 0;
-		quantQualityVal.qualityVal = 100 - quantQualityVal.qp;
-		avc444.bitstream[0].meta.numRegionRects = 1;
-		avc444.bitstream[0].meta.regionRects = &regionRect;
-		avc444.bitstream[0].meta.quantQualityVals = &quantQualityVal;
-		avc444.bitstream[1].meta.numRegionRects = 1;
-		avc444.bitstream[1].meta.regionRects = &regionRect;
-		avc444.bitstream[1].meta.quantQualityVals = &quantQualityVal;
+		if (!shadow_client_h264_metablock(encoder, &cmd, &meta))
+			return FALSE;
+
+		avc444.bitstream[0].meta = meta;
+		avc444.bitstream[1].meta = meta;
 		avc444.cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444.bitstream[0]);
 		cmd.codecId = settings->GfxAVC444v2 ? RDPGFX_CODECID_AVC444v2 : RDPGFX_CODECID_AVC444;
 		cmd.extra = (void*)&avc444;
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
-		          &cmdstart, &cmdend);
+
+		if (hasOps)
+			sent = shadow_client_send_surface_frame(client, &cmdstart, &cmdend, ops, &cmd, NULL, 0);
+		else
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+			          &cmdstart, &cmdend);
+
+		free(meta.regionRects);
+		free(meta.quantQualityVals);
 
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %"PRIu32"", error);
 			return FALSE;
 		}
+
+		if (!sent)
+			return FALSE;
 	}
 	else if (settings->GfxH264)
 	{
 		RDPGFX_AVC420_BITMAP_STREAM avc420;
-		RECTANGLE_16 regionRect;
-		RDPGFX_H264_QUANT_QUALITY quantQualityVal;
+		BOOL sent = TRUE;
 
 		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
 		{
@@ -908,125 +1254,386 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client,
 
 		cmd.codecId = RDPGFX_CODECID_AVC420;
 		cmd.extra = (void*)&avc420;
-		regionRect.left = cmd.left;
-		regionRect.top = cmd.top;
-		regionRect.right = cmd.right;
-		regionRect.bottom = cmd.bottom;
-		quantQualityVal.qp = encoder->h264->QP;
-		quantQualityVal.r = 0;
-		quantQualityVal.p = 0;
-		quantQualityVal.qualityVal = 100 - quantQualityVal.qp;
-		avc420.meta.numRegionRects = 1;
-		avc420.meta.regionRects = &regionRect;
-		avc420.meta.quantQualityVals = &quantQualityVal;
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
-		          &cmdstart, &cmdend);
+		ZeroMemory(&avc420.meta, sizeof(avc420.meta));
+
+		if (!shadow_client_h264_metablock(encoder, &cmd, &avc420.meta))
+			return FALSE;
+
+		if (hasOps)
+			sent = shadow_client_send_surface_frame(client, &cmdstart, &cmdend, ops, &cmd, NULL, 0);
+		else
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+			          &cmdstart, &cmdend);
+
+		free(avc420.meta.regionRects);
+		free(avc420.meta.quantQualityVals);
 
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %"PRIu32"", error);
 			return FALSE;
 		}
-	}
-
-	return TRUE;
-}
-
-/**
- * Function description
- *
- * @return TRUE on success
- */
-static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
-        BYTE* pSrcData, int nSrcStep, int nXSrc, int nYSrc, int nWidth, int nHeight)
-{
-	BOOL ret = TRUE;
-	int i;
-	BOOL first;
-	BOOL last;
-	wStream* s;
-	int numMessages;
-	UINT32 frameId = 0;
-	rdpUpdate* update;
-	rdpContext* context = (rdpContext*) client;
-	rdpSettings* settings;
-	rdpShadowEncoder* encoder;
-	SURFACE_BITS_COMMAND cmd = { 0 };
-
-	if (!context || !pSrcData)
-		return FALSE;
-
-	update = context->update;
-	settings = context->settings;
-	encoder = client->encoder;
-
-	if (!update || !settings || !encoder)
-		return FALSE;
-
-	if (encoder->frameAck)
-		frameId = shadow_encoder_create_frame_id(encoder);
 
-	if (settings->RemoteFxCodec)
+		if (!sent)
+			return FALSE;
+	}
+	else if (settings->GfxProgressive)
 	{
-		RFX_RECT rect;
-		RFX_MESSAGE* messages;
-		RFX_RECT* messageRects = NULL;
+		UINT32 length = 0;
+		BYTE* data = NULL;
+		SHADOW_GFX_CACHE_TILE* stores = NULL;
+		UINT32 numStores = 0;
+		BOOL sent;
+		int rc;
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
 			return FALSE;
 		}
 
-		s = encoder->bs;
-		rect.x = nXSrc;
-		rect.y = nYSrc;
-		rect.width = nWidth;
-		rect.height = nHeight;
-
-		if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
-		                                     settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
-		                                     settings->MultifragMaxRequestSize)))
+		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight,
+		                          cmd.format, nWidth, nHeight, nSrcStep, invalidRegion,
+		                          cmd.surfaceId, &data, &length);
+
+		if (rc < 0)
 		{
-			WLog_ERR(TAG, "rfx_encode_messages failed");
+			WLog_ERR(TAG, "progressive_compress failed");
 			return FALSE;
 		}
 
-		cmd.bmp.codecID = settings->RemoteFxCodecId;
-		cmd.destLeft = 0;
-		cmd.destTop = 0;
-		cmd.destRight = settings->DesktopWidth;
-		cmd.destBottom = settings->DesktopHeight;
-		cmd.bmp.bpp = 32;
-		cmd.bmp.flags = 0;
-		cmd.bmp.width = settings->DesktopWidth;
-		cmd.bmp.height = settings->DesktopHeight;
-		cmd.skipCompression = TRUE;
-
-		if (numMessages > 0)
-			messageRects = messages[0].rects;
+		/* Tiles with outstanding quality passes are upgraded on the next frames */
+		encoder->progressivePending = (rc > 0);
 
-		for (i = 0; i < numMessages; i++)
+		/* Tiles are only stored in the client cache at their final quality */
+		if (rc > 0)
 		{
-			Stream_SetPosition(s, 0);
+			UINT32 index;
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+			for (index = 0; ops && (index < ops->numTiles); index++)
 			{
-				while (i < numMessages)
-				{
-					rfx_message_free(encoder->rfx, &messages[i++]);
-				}
-
-				WLog_ERR(TAG, "rfx_write_message failed");
-				ret = FALSE;
-				break;
+				if (!ops->tiles[index].cacheSlot &&
+				    !shadow_gfx_cache_defer(encoder->gfxCache, &ops->tiles[index]))
+					return FALSE;
 			}
+		}
+		else
+		{
+			stores = shadow_gfx_cache_take_deferred(encoder->gfxCache, &numStores);
+		}
+
+		if ((rc == 0) && !hasOps && !stores)
+			return TRUE;
+
+		cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+		cmd.data = data;
+		cmd.length = length;
+
+		if (!hasOps && !stores)
+		{
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd,
+			          &cmdstart, &cmdend);
+
+			if (error)
+			{
+				WLog_ERR(TAG, "SurfaceFrameCommand failed with error %"PRIu32"", error);
+				return FALSE;
+			}
+
+			return TRUE;
+		}
+
+		sent = shadow_client_send_surface_frame(client, &cmdstart, &cmdend, ops,
+		                                        (rc > 0) ? &cmd : NULL, stores, numStores);
+		free(stores);
+
+		if (!sent)
+			return FALSE;
+	}
+	else
+	{
+		UINT32 index;
+		UINT32 numRects = 0;
+		const RECTANGLE_16* rects;
+
+		if (!invalidRegion)
+			return TRUE;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_CLEARCODEC) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_CLEARCODEC");
+			return FALSE;
+		}
+
+		rects = region16_rects(invalidRegion, &numRects);
 
-			rfx_message_free(encoder->rfx, &messages[i]);
-			cmd.bmp.bitmapDataLength = Stream_GetPosition(s);
-			cmd.bmp.bitmapData = Stream_Buffer(s);
+		if (!numRects && !hasOps)
+			return TRUE;
+
+		IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, &cmdstart);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "StartFrame failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+
+		if (!shadow_client_send_surface_ops(client, ops))
+			return FALSE;
+
+		cmd.codecId = RDPGFX_CODECID_CLEARCODEC;
+
+		for (index = 0; index < numRects; index++)
+		{
+			const BYTE* pRectData = &pSrcData[(rects[index].top * nSrcStep) + (rects[index].left * 4)];
+			cmd.left = rects[index].left;
+			cmd.top = rects[index].top;
+			cmd.right = rects[index].right;
+			cmd.bottom = rects[index].bottom;
+			cmd.width = cmd.right - cmd.left;
+			cmd.height = cmd.bottom - cmd.top;
+
+			if (clear_compress(encoder->clear, pRectData,
+			                   ((cmd.height - 1) * nSrcStep) + (cmd.width * 4), cmd.format,
+			                   cmd.width, cmd.height, nSrcStep, &cmd.data, &cmd.length) < 0)
+			{
+				WLog_ERR(TAG, "clear_compress failed");
+				return FALSE;
+			}
+
+			IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, &cmd);
+
+			if (error)
+			{
+				WLog_ERR(TAG, "SurfaceCommand failed with error %"PRIu32"", error);
+				return FALSE;
+			}
+		}
+
+		/* ClearCodec is lossless, the client has the final tiles right away */
+		if (ops && !shadow_client_send_cache_store(client, ops->tiles, ops->numTiles))
+			return FALSE;
+
+		IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, &cmdend);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "EndFrame failed with error %"PRIu32"", error);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Look up the shared encode cache for the current update event. The cache
+ * is only worth its copies if more than one client views the surface.
+ *
+ * @return the cache entry, or NULL if the client has to encode on its own
+ */
+static SHADOW_ENCODE_CACHE_ENTRY* shadow_client_encode_cache_acquire(
+    rdpShadowClient* client, SHADOW_ENCODE_CACHE_KEY* key, BOOL* owner)
+{
+	rdpShadowServer* server = client->server;
+	rdpShadowSubsystem* subsystem = client->subsystem;
+	*owner = FALSE;
+
+	if (!server->encodeCache || !subsystem || !subsystem->updateEvent)
+		return NULL;
+
+	if (ArrayList_Count(server->clients) < 2)
+		return NULL;
+
+	key->surface = client->inLobby ? server->lobby : server->surface;
+	return shadow_encode_cache_acquire(server->encodeCache,
+	                                   (UINT32) subsystem->updateEvent->eventid, key, owner);
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
+        BYTE* pSrcData, int nSrcStep, const REGION16* region)
+{
+	BOOL ret = TRUE;
+	int i;
+	UINT32 index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	BOOL first;
+	BOOL last;
+	wStream* s;
+	int numMessages;
+	UINT32 frameId = 0;
+	rdpUpdate* update;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	SURFACE_BITS_COMMAND cmd = { 0 };
+	SHADOW_ENCODE_CACHE_KEY key = { 0 };
+	SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+	BOOL owner = FALSE;
+
+	if (!context || !pSrcData || !region)
+		return FALSE;
+
+	update = context->update;
+	settings = context->settings;
+	encoder = client->encoder;
+
+	if (!update || !settings || !encoder)
+		return FALSE;
+
+	rects = region16_rects(region, &numRects);
+
+	if (numRects < 1)
+		return TRUE;
+
+	if (encoder->frameAck)
+		frameId = shadow_encoder_create_frame_id(encoder);
+
+	if (settings->RemoteFxCodec)
+	{
+		RFX_RECT* rfxRects;
+		RFX_MESSAGE* messages;
+		RFX_RECT* messageRects = NULL;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
+		{
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
+			return FALSE;
+		}
+
+		s = encoder->bs;
+		cmd.bmp.codecID = settings->RemoteFxCodecId;
+		cmd.destLeft = 0;
+		cmd.destTop = 0;
+		cmd.destRight = settings->DesktopWidth;
+		cmd.destBottom = settings->DesktopHeight;
+		cmd.bmp.bpp = 32;
+		cmd.bmp.flags = 0;
+		cmd.bmp.width = settings->DesktopWidth;
+		cmd.bmp.height = settings->DesktopHeight;
+		cmd.skipCompression = TRUE;
+
+		/* A client still owing the codec headers encodes this frame on its own */
+		if (encoder->rfx->state != RFX_STATE_SEND_HEADERS)
+		{
+			key.codecId = FREERDP_CODEC_REMOTEFX;
+			key.rect = *region16_extents(region);
+			key.rects = rects;
+			key.numRects = numRects;
+			key.params[0] = encoder->rfx->mode;
+			key.params[1] = settings->DesktopWidth;
+			key.params[2] = settings->DesktopHeight;
+			key.params[3] = settings->MultifragMaxRequestSize;
+			entry = shadow_client_encode_cache_acquire(client, &key, &owner);
+		}
+
+		if (!entry || owner)
+		{
+			if (!(rfxRects = (RFX_RECT*) calloc(numRects, sizeof(RFX_RECT))))
+			{
+				shadow_encode_cache_commit(client->server->encodeCache, entry, FALSE);
+				return FALSE;
+			}
+
+			/* Only the dirty rectangles are encoded, not their bounding box */
+			for (index = 0; index < numRects; index++)
+			{
+				rfxRects[index].x = rects[index].left;
+				rfxRects[index].y = rects[index].top;
+				rfxRects[index].width = rects[index].right - rects[index].left;
+				rfxRects[index].height = rects[index].bottom - rects[index].top;
+			}
+
+			messages = rfx_encode_messages(encoder->rfx, rfxRects, numRects, pSrcData,
+			                               settings->DesktopWidth, settings->DesktopHeight, nSrcStep, &numMessages,
+			                               settings->MultifragMaxRequestSize);
+			free(rfxRects);
+
+			if (!messages)
+			{
+				WLog_ERR(TAG, "rfx_encode_messages failed");
+				shadow_encode_cache_commit(client->server->encodeCache, entry, FALSE);
+				return FALSE;
+			}
+
+			if (numMessages > 0)
+				messageRects = messages[0].rects;
+
+			for (i = 0; i < numMessages; i++)
+			{
+				Stream_SetPosition(s, 0);
+
+				if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+				{
+					while (i < numMessages)
+					{
+						rfx_message_free(encoder->rfx, &messages[i++]);
+					}
+
+					WLog_ERR(TAG, "rfx_write_message failed");
+					ret = FALSE;
+					break;
+				}
+
+				rfx_message_free(encoder->rfx, &messages[i]);
+
+				/* The frame is published before anything is sent, a slow
+				 * connection must not hold up the other viewers */
+				if (entry)
+				{
+					if (!shadow_encode_cache_add(entry, Stream_Buffer(s), Stream_GetPosition(s), NULL))
+					{
+						while (++i < numMessages)
+						{
+							rfx_message_free(encoder->rfx, &messages[i]);
+						}
+
+						ret = FALSE;
+						break;
+					}
+
+					continue;
+				}
+
+				cmd.bmp.bitmapDataLength = Stream_GetPosition(s);
+				cmd.bmp.bitmapData = Stream_Buffer(s);
+				first = (i == 0) ? TRUE : FALSE;
+				last = ((i + 1) == numMessages) ? TRUE : FALSE;
+
+				if (!encoder->frameAck)
+					IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+				else
+					IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+					          frameId);
+
+				if (!ret)
+				{
+					WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+					break;
+				}
+			}
+
+			shadow_encode_cache_commit(client->server->encodeCache, entry, ret);
+			free(messageRects);
+			free(messages);
+
+			if (!entry || !ret)
+				return ret;
+		}
+
+		for (i = 0; i < (int) entry->count; i++)
+		{
+			cmd.bmp.bitmapDataLength = entry->length[i];
+			cmd.bmp.bitmapData = entry->data[i];
 			first = (i == 0) ? TRUE : FALSE;
-			last = ((i + 1) == numMessages) ? TRUE : FALSE;
+			last = ((i + 1) == (int) entry->count) ? TRUE : FALSE;
 
 			if (!encoder->frameAck)
 				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
@@ -1040,9 +1647,6 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 				break;
 			}
 		}
-
-		free(messageRects);
-		free(messages);
 	}
 	else if (settings->NSCodec)
 	{
@@ -1052,32 +1656,62 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client,
 			return FALSE;
 		}
 
-		s = encoder->bs;
-		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
-		cmd.bmp.bpp = 32;
-		cmd.bmp.codecID = settings->NSCodecId;
-		cmd.destLeft = nXSrc;
-		cmd.destTop = nYSrc;
-		cmd.destRight = cmd.destLeft + nWidth;
-		cmd.destBottom = cmd.destTop + nHeight;
-		cmd.bmp.width = nWidth;
-		cmd.bmp.height = nHeight;
-		cmd.bmp.bitmapDataLength = Stream_GetPosition(s);
-		cmd.bmp.bitmapData = Stream_Buffer(s);
-		first = TRUE;
-		last = TRUE;
-
-		if (!encoder->frameAck)
-			IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-		else
-			IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-			          frameId);
-
-		if (!ret)
+		/* One NSCodec bitmap per dirty rectangle, all in the same frame */
+		for (index = 0; index < numRects; index++)
 		{
-			WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+			const UINT32 nXSrc = rects[index].left;
+			const UINT32 nYSrc = rects[index].top;
+			const UINT32 nWidth = rects[index].right - rects[index].left;
+			const UINT32 nHeight = rects[index].bottom - rects[index].top;
+			key.codecId = FREERDP_CODEC_NSCODEC;
+			key.rect = rects[index];
+			key.params[0] = encoder->nsc->ColorLossLevel;
+			key.params[1] = encoder->nsc->ChromaSubsamplingLevel;
+			key.params[2] = encoder->nsc->DynamicColorFidelity;
+			entry = shadow_client_encode_cache_acquire(client, &key, &owner);
+			cmd.bmp.bpp = 32;
+			cmd.bmp.codecID = settings->NSCodecId;
+			cmd.destLeft = nXSrc;
+			cmd.destTop = nYSrc;
+			cmd.destRight = cmd.destLeft + nWidth;
+			cmd.destBottom = cmd.destTop + nHeight;
+			cmd.bmp.width = nWidth;
+			cmd.bmp.height = nHeight;
+
+			if (entry && !owner)
+			{
+				cmd.bmp.bitmapDataLength = entry->length[0];
+				cmd.bmp.bitmapData = entry->data[0];
+			}
+			else
+			{
+				s = encoder->bs;
+				Stream_SetPosition(s, 0);
+				nsc_compose_message(encoder->nsc, s, &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)],
+				                    nWidth, nHeight, nSrcStep);
+				cmd.bmp.bitmapDataLength = Stream_GetPosition(s);
+				cmd.bmp.bitmapData = Stream_Buffer(s);
+
+				if (entry)
+					shadow_encode_cache_commit(client->server->encodeCache, entry,
+					                           shadow_encode_cache_add(entry, cmd.bmp.bitmapData,
+					                                   cmd.bmp.bitmapDataLength, NULL));
+			}
+
+			first = (index == 0) ? TRUE : FALSE;
+			last = ((index + 1) == numRects) ? TRUE : FALSE;
+
+			if (!encoder->frameAck)
+				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+			else
+				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
+				          frameId);
+
+			if (!ret)
+			{
+				WLog_ERR(TAG, "Send surface bits(NSCodec) failed");
+				break;
+			}
 		}
 	}
 
@@ -1110,6 +1744,9 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 	BITMAP_DATA* bitmapData;
 	BITMAP_UPDATE bitmapUpdate;
 	rdpShadowEncoder* encoder;
+	SHADOW_ENCODE_CACHE_KEY key = { 0 };
+	SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+	BOOL owner = FALSE;
 
 	if (!context || !pSrcData)
 		return FALSE;
@@ -1175,66 +1812,99 @@ static BOOL shadow_client_send_bitmap_update(rdpShadowClient* client,
 		nHeight += (4 - (nHeight % 4));
 	}
 
-	for (yIdx = 0; yIdx < rows; yIdx++)
+	key.codecId = (settings->ColorDepth < 32) ? FREERDP_CODEC_INTERLEAVED :
+	              FREERDP_CODEC_PLANAR;
+	key.rect.left = nXSrc;
+	key.rect.top = nYSrc;
+	key.rect.right = nXSrc + nWidth;
+	key.rect.bottom = nYSrc + nHeight;
+	key.params[0] = settings->ColorDepth;
+	key.params[1] = settings->DrawAllowSkipAlpha;
+	entry = shadow_client_encode_cache_acquire(client, &key, &owner);
+
+	if (entry && !owner)
 	{
-		for (xIdx = 0; xIdx < cols; xIdx++)
+		for (k = 0; k < entry->count; k++)
 		{
-			bitmap = &bitmapData[k];
-			bitmap->width = 64;
-			bitmap->height = 64;
-			bitmap->destLeft = nXSrc + (xIdx * 64);
-			bitmap->destTop = nYSrc + (yIdx * 64);
+			bitmapData[k] = entry->bitmaps[k];
+			totalBitmapSize += bitmapData[k].bitmapLength;
+		}
+	}
+	else
+	{
+		for (yIdx = 0; yIdx < rows; yIdx++)
+		{
+			for (xIdx = 0; xIdx < cols; xIdx++)
+			{
+				bitmap = &bitmapData[k];
+				bitmap->width = 64;
+				bitmap->height = 64;
+				bitmap->destLeft = nXSrc + (xIdx * 64);
+				bitmap->destTop = nYSrc + (yIdx * 64);
 
-			if ((INT64)(bitmap->destLeft + bitmap->width) > (nXSrc + nWidth))
-				bitmap->width = (UINT32)(nXSrc + nWidth) - bitmap->destLeft;
+				if ((INT64)(bitmap->destLeft + bitmap->width) > (nXSrc + nWidth))
+					bitmap->width = (UINT32)(nXSrc + nWidth) - bitmap->destLeft;
 
-			if ((INT64)(bitmap->destTop + bitmap->height) > (nYSrc + nHeight))
-				bitmap->height = (UINT32)(nYSrc + nHeight) - bitmap->destTop;
+				if ((INT64)(bitmap->destTop + bitmap->height) > (nYSrc + nHeight))
+					bitmap->height = (UINT32)(nYSrc + nHeight) - bitmap->destTop;
 
-			bitmap->destRight = bitmap->destLeft + bitmap->width - 1;
-			bitmap->destBottom = bitmap->destTop + bitmap->height - 1;
-			bitmap->compressed = TRUE;
+				bitmap->destRight = bitmap->destLeft + bitmap->width - 1;
+				bitmap->destBottom = bitmap->destTop + bitmap->height - 1;
+				bitmap->compressed = TRUE;
 
-			if ((bitmap->width < 4) || (bitmap->height < 4))
-				continue;
+				if ((bitmap->width < 4) || (bitmap->height < 4))
+					continue;
 
-			if (settings->ColorDepth < 32)
-			{
-				int bitsPerPixel = settings->ColorDepth;
-				int bytesPerPixel = (bitsPerPixel + 7) / 8;
-				DstSize = 64 * 64 * 4;
-				buffer = encoder->grid[k];
-				interleaved_compress(encoder->interleaved, buffer, &DstSize, bitmap->width,
-				                     bitmap->height,
-				                     pSrcData, SrcFormat, nSrcStep, bitmap->destLeft, bitmap->destTop, NULL,
-				                     bitsPerPixel);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = DstSize;
-				bitmap->bitsPerPixel = bitsPerPixel;
-				bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
-			}
-			else
-			{
-				UINT32 dstSize;
-				buffer = encoder->grid[k];
-				data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
-				buffer = freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat,
-				                                        bitmap->width, bitmap->height, nSrcStep, buffer, &dstSize);
-				bitmap->bitmapDataStream = buffer;
-				bitmap->bitmapLength = dstSize;
-				bitmap->bitsPerPixel = 32;
-				bitmap->cbScanWidth = bitmap->width * 4;
-				bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
-			}
+				if (settings->ColorDepth < 32)
+				{
+					int bitsPerPixel = settings->ColorDepth;
+					int bytesPerPixel = (bitsPerPixel + 7) / 8;
+					DstSize = 64 * 64 * 4;
+					buffer = encoder->grid[k];
+					interleaved_compress(encoder->interleaved, buffer, &DstSize, bitmap->width,
+					                     bitmap->height,
+					                     pSrcData, SrcFormat, nSrcStep, bitmap->destLeft, bitmap->destTop, NULL,
+					                     bitsPerPixel);
+					bitmap->bitmapDataStream = buffer;
+					bitmap->bitmapLength = DstSize;
+					bitmap->bitsPerPixel = bitsPerPixel;
+					bitmap->cbScanWidth = bitmap->width * bytesPerPixel;
+					bitmap->cbUncompressedSize = bitmap->width * bitmap->height * bytesPerPixel;
+				}
+				else
+				{
+					UINT32 dstSize;
+					buffer = encoder->grid[k];
+					data = &pSrcData[(bitmap->destTop * nSrcStep) + (bitmap->destLeft * 4)];
+					buffer = freerdp_bitmap_compress_planar(encoder->planar, data, SrcFormat,
+					                                        bitmap->width, bitmap->height, nSrcStep, buffer, &dstSize);
+					bitmap->bitmapDataStream = buffer;
+					bitmap->bitmapLength = dstSize;
+					bitmap->bitsPerPixel = 32;
+					bitmap->cbScanWidth = bitmap->width * 4;
+					bitmap->cbUncompressedSize = bitmap->width * bitmap->height * 4;
+				}
 
-			bitmap->cbCompFirstRowSize = 0;
-			bitmap->cbCompMainBodySize = bitmap->bitmapLength;
-			totalBitmapSize += bitmap->bitmapLength;
-			k++;
+				bitmap->cbCompFirstRowSize = 0;
+				bitmap->cbCompMainBodySize = bitmap->bitmapLength;
+				totalBitmapSize += bitmap->bitmapLength;
+				k++;
+			}
 		}
 	}
 
+	if (entry && owner)
+	{
+		BOOL cached = TRUE;
+		size_t index;
+
+		for (index = 0; cached && (index < k); index++)
+			cached = shadow_encode_cache_add(entry, bitmapData[index].bitmapDataStream,
+			                                 bitmapData[index].bitmapLength, &bitmapData[index]);
+
+		shadow_encode_cache_commit(client->server->encodeCache, entry, cached);
+	}
+
 	bitmapUpdate.count = bitmapUpdate.number = k;
 	updateSizeEstimate = totalBitmapSize + (k * bitmapUpdate.count) + 16;
 
@@ -1302,6 +1972,315 @@ out:
 	return ret;
 }
 
+/**
+ * Function description
+ * Check whether the move found by the capture can be replayed on the client
+ * surface. The source must be up to date on the client and the codec must
+ * leave the destination alone.
+ *
+ * @return TRUE if the move applies, pdu is then set in client surface coordinates
+ */
+static BOOL shadow_client_surface_move(rdpShadowClient* client, rdpShadowSurface* surface,
+                                       SHADOW_GFX_STATUS* pStatus, const REGION16* missedRegion,
+                                       RDPGFX_SURFACE_TO_SURFACE_PDU* pdu, RDPGFX_POINT16* destPt)
+{
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowServer* server = client->server;
+	RECTANGLE_16 src = surface->moveRect;
+	RECTANGLE_16 dst;
+
+	if (!surface->moved || (surface != server->surface) || !settings->SupportGraphicsPipeline ||
+	    !pStatus->gfxOpened || !pStatus->gfxSurfaceCreated)
+		return FALSE;
+
+	/* H.264 frames cover the whole surface and would paint over the copy,
+	 * the encoder finds moved content with its own motion search */
+	if (settings->GfxAVC444 || settings->GfxAVC444v2 || settings->GfxH264)
+		return FALSE;
+
+	/* Upgrade passes repaint whole tiles from the encoder state of the content
+	 * before the move, wait until the tiles are final */
+	if (settings->GfxProgressive && client->encoder->progressivePending)
+		return FALSE;
+
+	/* The client never got (part of) the source */
+	if (region16_intersects_rect(missedRegion, &src))
+		return FALSE;
+
+	dst.left = (UINT16)(src.left + surface->moveX);
+	dst.top = (UINT16)(src.top + surface->moveY);
+	dst.right = (UINT16)(src.right + surface->moveX);
+	dst.bottom = (UINT16)(src.bottom + surface->moveY);
+
+	if (server->shareSubRect)
+	{
+		RECTANGLE_16 common;
+		const RECTANGLE_16* subRect = &(server->subRect);
+
+		if (!rectangles_intersection(&src, subRect, &common) || !rectangles_equal(&src, &common) ||
+		    !rectangles_intersection(&dst, subRect, &common) || !rectangles_equal(&dst, &common))
+			return FALSE;
+
+		src.left -= subRect->left;
+		src.top -= subRect->top;
+		src.right -= subRect->left;
+		src.bottom -= subRect->top;
+		dst.left -= subRect->left;
+		dst.top -= subRect->top;
+	}
+
+	pdu->surfaceIdSrc = 0;
+	pdu->surfaceIdDest = 0;
+	pdu->rectSrc = src;
+	pdu->destPtsCount = 1;
+	pdu->destPts = destPt;
+	destPt->x = dst.left;
+	destPt->y = dst.top;
+	return TRUE;
+}
+
+static int shadow_client_solid_tile_compare(const void* pa, const void* pb)
+{
+	const SHADOW_GFX_SOLID_TILE* a = (const SHADOW_GFX_SOLID_TILE*) pa;
+	const SHADOW_GFX_SOLID_TILE* b = (const SHADOW_GFX_SOLID_TILE*) pb;
+
+	if (a->color != b->color)
+		return (a->color < b->color) ? -1 : 1;
+
+	if (a->rect.top != b->rect.top)
+		return (a->rect.top < b->rect.top) ? -1 : 1;
+
+	if (a->rect.left != b->rect.left)
+		return (a->rect.left < b->rect.left) ? -1 : 1;
+
+	return 0;
+}
+
+/**
+ * Function description
+ * Find the surface tiles touched by the region which hold a single color.
+ * These are painted with one SolidFill per color and leave the region, so
+ * the codec does not spend any time or bandwidth on them.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_surface_solid(rdpShadowClient* client, const BYTE* pSrcData,
+                                        int nSrcStep, UINT32 nWidth, UINT32 nHeight,
+                                        REGION16* region, SHADOW_GFX_SURFACE_OPS* ops)
+{
+	BOOL rc = FALSE;
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowEncoder* encoder = client->encoder;
+	primitives_t* prims = primitives_get();
+	const UINT32 tileSize = SHADOW_GFX_CACHE_TILE_SIZE;
+	const BOOL h264 = settings->GfxAVC444 || settings->GfxAVC444v2 || settings->GfxH264;
+	const RECTANGLE_16* extents;
+	SHADOW_GFX_SOLID_TILE* solid;
+	UINT32 numSolid = 0;
+	UINT32 numRects = 0;
+	UINT32 xIdx, yIdx;
+	UINT32 index;
+
+	if (region16_is_empty(region))
+		return TRUE;
+
+	extents = region16_extents(region);
+	solid = (SHADOW_GFX_SOLID_TILE*) calloc(
+	            ((extents->right + tileSize - 1) / tileSize - extents->left / tileSize) *
+	            ((extents->bottom + tileSize - 1) / tileSize - extents->top / tileSize),
+	            sizeof(SHADOW_GFX_SOLID_TILE));
+
+	if (!solid)
+		return FALSE;
+
+	/* Whole tiles are tested, filling them repaints the same content */
+	for (yIdx = extents->top / tileSize; yIdx * tileSize < extents->bottom; yIdx++)
+	{
+		for (xIdx = extents->left / tileSize; xIdx * tileSize < extents->right; xIdx++)
+		{
+			SHADOW_GFX_SOLID_TILE* tile = &solid[numSolid];
+			BOOL isSolid = FALSE;
+			tile->rect.left = (UINT16)(xIdx * tileSize);
+			tile->rect.top = (UINT16)(yIdx * tileSize);
+			tile->rect.right = (UINT16) MIN(nWidth, tile->rect.left + tileSize);
+			tile->rect.bottom = (UINT16) MIN(nHeight, tile->rect.top + tileSize);
+
+			if (!region16_intersects_rect(region, &tile->rect))
+				continue;
+
+			if (prims->solid_32u(&pSrcData[(tile->rect.top * nSrcStep) + (tile->rect.left * 4)],
+			                     nSrcStep, tile->rect.right - tile->rect.left,
+			                     tile->rect.bottom - tile->rect.top, &tile->color,
+			                     &isSolid) != PRIMITIVES_SUCCESS)
+				goto out;
+
+			/* H.264 frames cover the whole surface, the client only shows the non solid part */
+			if (h264)
+			{
+				if (isSolid)
+				{
+					if (!region16_union_rect(&encoder->solidRegion, &encoder->solidRegion, &tile->rect))
+						goto out;
+				}
+				else if (!region16_subtract_rect(&encoder->solidRegion, &encoder->solidRegion,
+				                                 &tile->rect))
+					goto out;
+			}
+
+			if (isSolid)
+				numSolid++;
+		}
+	}
+
+	if (!numSolid)
+	{
+		rc = TRUE;
+		goto out;
+	}
+
+	/* One fill per color, neighbouring tiles of a row are merged */
+	qsort(solid, numSolid, sizeof(SHADOW_GFX_SOLID_TILE), shadow_client_solid_tile_compare);
+	ops->fillRects = (RECTANGLE_16*) calloc(numSolid, sizeof(RECTANGLE_16));
+	ops->fills = (RDPGFX_SOLID_FILL_PDU*) calloc(numSolid, sizeof(RDPGFX_SOLID_FILL_PDU));
+
+	if (!ops->fillRects || !ops->fills)
+		goto out;
+
+	for (index = 0; index < numSolid; index++)
+	{
+		const SHADOW_GFX_SOLID_TILE* tile = &solid[index];
+		RDPGFX_SOLID_FILL_PDU* fill = ops->numFills ? &ops->fills[ops->numFills - 1] : NULL;
+		RECTANGLE_16* last = numRects ? &ops->fillRects[numRects - 1] : NULL;
+
+		if (fill && (solid[index - 1].color == tile->color))
+		{
+			if ((last->top == tile->rect.top) && (last->bottom == tile->rect.bottom) &&
+			    (last->right == tile->rect.left))
+			{
+				last->right = tile->rect.right;
+				continue;
+			}
+
+			if (fill->fillRectCount < UINT16_MAX)
+			{
+				ops->fillRects[numRects++] = tile->rect;
+				fill->fillRectCount++;
+				continue;
+			}
+		}
+
+		/* Pixels are BGRX32 in memory */
+		fill = &ops->fills[ops->numFills++];
+		fill->surfaceId = 0;
+		fill->fillPixel.B = ((const BYTE*) &tile->color)[0];
+		fill->fillPixel.G = ((const BYTE*) &tile->color)[1];
+		fill->fillPixel.R = ((const BYTE*) &tile->color)[2];
+		fill->fillPixel.XA = 0xFF;
+		fill->fillRectCount = 1;
+		fill->fillRects = &ops->fillRects[numRects];
+		ops->fillRects[numRects++] = tile->rect;
+	}
+
+	for (index = 0; index < numRects; index++)
+	{
+		const RECTANGLE_16* rect = &ops->fillRects[index];
+
+		/* Pending quality passes and cache stores would paint over the fill */
+		if (settings->GfxProgressive && encoder->progressive &&
+		    !progressive_cancel_upgrades(encoder->progressive, 0, rect))
+			goto out;
+
+		shadow_gfx_cache_drop_deferred(encoder->gfxCache, rect);
+
+		if (!region16_subtract_rect(region, region, rect))
+			goto out;
+	}
+
+	rc = TRUE;
+out:
+	free(solid);
+	return rc;
+}
+
+/**
+ * Function description
+ * Look up the surface tiles touched by the region in the client bitmap
+ * cache. Cached tiles are copied by the client and leave the region, the
+ * others are stored after the client got them from the codec.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_surface_cache(rdpShadowClient* client, const BYTE* pSrcData,
+                                        int nSrcStep, UINT32 nWidth, UINT32 nHeight,
+                                        REGION16* region, SHADOW_GFX_SURFACE_OPS* ops)
+{
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings = context->settings;
+	rdpShadowEncoder* encoder = client->encoder;
+	const UINT32 tileSize = SHADOW_GFX_CACHE_TILE_SIZE;
+	const RECTANGLE_16* extents;
+	UINT32 xIdx, yIdx;
+	UINT32 index;
+	BOOL lookup;
+
+	/* H.264 frames cover the whole surface */
+	if (settings->GfxAVC444 || settings->GfxAVC444v2 || settings->GfxH264)
+		return TRUE;
+
+	if (region16_is_empty(region) || !shadow_gfx_cache_enabled(encoder->gfxCache))
+		return TRUE;
+
+	/* Upgrade passes would repaint copied tiles from the encoder state */
+	lookup = !(settings->GfxProgressive && encoder->progressivePending);
+	extents = region16_extents(region);
+	ops->tiles = (SHADOW_GFX_CACHE_TILE*) calloc(
+	                 ((extents->right + tileSize - 1) / tileSize - extents->left / tileSize) *
+	                 ((extents->bottom + tileSize - 1) / tileSize - extents->top / tileSize),
+	                 sizeof(SHADOW_GFX_CACHE_TILE));
+
+	if (!ops->tiles)
+		return FALSE;
+
+	/* The grid matches the progressive codec tiles */
+	for (yIdx = extents->top / tileSize; yIdx * tileSize < extents->bottom; yIdx++)
+	{
+		for (xIdx = extents->left / tileSize; xIdx * tileSize < extents->right; xIdx++)
+		{
+			SHADOW_GFX_CACHE_TILE* tile = &ops->tiles[ops->numTiles];
+			tile->rect.left = (UINT16)(xIdx * tileSize);
+			tile->rect.top = (UINT16)(yIdx * tileSize);
+			tile->rect.right = (UINT16) MIN(nWidth, tile->rect.left + tileSize);
+			tile->rect.bottom = (UINT16) MIN(nHeight, tile->rect.top + tileSize);
+
+			if (!region16_intersects_rect(region, &tile->rect))
+				continue;
+
+			tile->cacheKey = shadow_gfx_cache_key(
+			                     &pSrcData[(tile->rect.top * nSrcStep) + (tile->rect.left * 4)], nSrcStep,
+			                     tile->rect.right - tile->rect.left, tile->rect.bottom - tile->rect.top);
+
+			if (lookup)
+				tile->cacheSlot = shadow_gfx_cache_lookup(encoder->gfxCache, tile->cacheKey);
+
+			if (tile->cacheSlot)
+				ops->numCached++;
+
+			ops->numTiles++;
+		}
+	}
+
+	for (index = 0; index < ops->numTiles; index++)
+	{
+		if (ops->tiles[index].cacheSlot &&
+		    !region16_subtract_rect(region, region, &ops->tiles[index].rect))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Function description
  *
@@ -1311,20 +2290,22 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
         SHADOW_GFX_STATUS* pStatus)
 {
 	BOOL ret = TRUE;
-	int nXSrc, nYSrc;
-	int nWidth, nHeight;
 	rdpContext* context = (rdpContext*) client;
 	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
 	REGION16 invalidRegion;
+	REGION16 surfaceRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
 	BYTE* pSrcData;
 	int nSrcStep;
 	UINT32 index;
 	UINT32 numRects = 0;
 	const RECTANGLE_16* rects;
+	BOOL moved;
+	RDPGFX_SURFACE_TO_SURFACE_PDU move;
+	RDPGFX_POINT16 moveDest;
+	SHADOW_GFX_SURFACE_OPS ops = { 0 };
 
 	if (!context || !pStatus)
 		return FALSE;
@@ -1342,9 +2323,11 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 
 	EnterCriticalSection(&(client->lock));
 	region16_init(&invalidRegion);
+	region16_init(&surfaceRegion);
 	region16_copy(&invalidRegion, &(client->invalidRegion));
 	region16_clear(&(client->invalidRegion));
 	LeaveCriticalSection(&(client->lock));
+	moved = shadow_client_surface_move(client, surface, pStatus, &invalidRegion, &move, &moveDest);
 	rects = region16_rects(&(surface->invalidRegion), &numRects);
 
 	for (index = 0; index < numRects; index++)
@@ -1369,68 +2352,146 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client,
 		goto out;
 	}
 
-	extents = region16_extents(&invalidRegion);
-	nXSrc = extents->left;
-	nYSrc = extents->top;
-	nWidth = extents->right - extents->left;
-	nHeight = extents->bottom - extents->top;
 	pSrcData = surface->data;
 	nSrcStep = surface->scanline;
 
-	/* Move to new pSrcData / nXSrc / nYSrc according to sub rect */
+	/* Move to new pSrcData and region according to sub rect */
 	if (server->shareSubRect)
 	{
+		RECTANGLE_16 rect;
 		int subX, subY;
 		subX = server->subRect.left;
 		subY = server->subRect.top;
-		nXSrc -= subX;
-		nYSrc -= subY;
 		pSrcData = &pSrcData[(subY * nSrcStep) + (subX * 4)];
-	}
+		rects = region16_rects(&invalidRegion, &numRects);
 
-	//WLog_INFO(TAG, "shadow_client_send_surface_update: x: %d y: %d width: %d height: %d right: %d bottom: %d",
-	//	nXSrc, nYSrc, nWidth, nHeight, nXSrc + nWidth, nYSrc + nHeight);
+		for (index = 0; index < numRects; index++)
+		{
+			rect.left = rects[index].left - subX;
+			rect.top = rects[index].top - subY;
+			rect.right = rects[index].right - subX;
+			rect.bottom = rects[index].bottom - subY;
+			region16_union_rect(&surfaceRegion, &surfaceRegion, &rect);
+		}
+	}
+	else
+	{
+		region16_copy(&surfaceRegion, &invalidRegion);
+	}
 
 	if (settings->SupportGraphicsPipeline &&
-	    settings->GfxH264 &&
 	    pStatus->gfxOpened)
 	{
-		/* GFX/h264 always full screen encoded */
-		nWidth = settings->DesktopWidth;
-		nHeight = settings->DesktopHeight;
-
 		/* Create primary surface if have not */
 		if (!pStatus->gfxSurfaceCreated)
 		{
-			/* Only init surface when we have h264 supported */
 			if (!(ret = shadow_client_rdpgfx_reset_graphic(client)))
 				goto out;
 
 			if (!(ret = shadow_client_rdpgfx_new_surface(client)))
 				goto out;
 
+			/* A new surface starts without any progressive tile state */
+			if (client->encoder->progressive)
+				progressive_delete_surface_context(client->encoder->progressive, 0);
+
+			shadow_gfx_cache_drop_deferred(client->encoder->gfxCache, NULL);
+			region16_clear(&client->encoder->solidRegion);
+
 			pStatus->gfxSurfaceCreated = TRUE;
 		}
 
-		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0, nWidth,
-		                                     nHeight);
+		/* The moved area is copied on the client, only what it exposed is encoded */
+		if (moved)
+		{
+			RECTANGLE_16 moveRect;
+			moveRect.left = moveDest.x;
+			moveRect.top = moveDest.y;
+			moveRect.right = moveDest.x + (move.rectSrc.right - move.rectSrc.left);
+			moveRect.bottom = moveDest.y + (move.rectSrc.bottom - move.rectSrc.top);
+
+			if (!(ret = region16_subtract_rect(&surfaceRegion, &surfaceRegion, &moveRect)))
+				goto out;
+		}
+
+		if (!(ret = shadow_client_surface_solid(client, pSrcData, nSrcStep, settings->DesktopWidth,
+		                                        settings->DesktopHeight, &surfaceRegion, &ops)))
+			goto out;
+
+		if (!(ret = shadow_client_surface_cache(client, pSrcData, nSrcStep, settings->DesktopWidth,
+		                                        settings->DesktopHeight, &surfaceRegion, &ops)))
+			goto out;
+
+		ops.move = moved ? &move : NULL;
+		/* GFX always encodes against the full screen surface,
+		 * progressive and ClearCodec only encode the invalid region of it */
+		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, 0, 0,
+		                                     settings->DesktopWidth, settings->DesktopHeight, &surfaceRegion,
+		                                     &ops);
 	}
 	else if (settings->RemoteFxCodec || settings->NSCodec)
 	{
-		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                      nWidth, nHeight);
+		ret = shadow_client_send_surface_bits(client, pSrcData, nSrcStep, &surfaceRegion);
 	}
 	else
 	{
-		ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep, nXSrc, nYSrc,
-		                                       nWidth, nHeight);
+		rects = region16_rects(&surfaceRegion, &numRects);
+
+		for (index = 0; ret && (index < numRects); index++)
+		{
+			ret = shadow_client_send_bitmap_update(client, pSrcData, nSrcStep,
+			                                       rects[index].left, rects[index].top,
+			                                       rects[index].right - rects[index].left,
+			                                       rects[index].bottom - rects[index].top);
+		}
 	}
 
 out:
+	free(ops.fills);
+	free(ops.fillRects);
+	free(ops.tiles);
+	region16_uninit(&surfaceRegion);
 	region16_uninit(&invalidRegion);
 	return ret;
 }
 
+/**
+ * Function description
+ * Send the outstanding progressive quality passes. These only refine
+ * tiles already known to the encoder, so no surface data is needed.
+ *
+ * @return TRUE on success (or nothing need to be updated)
+ */
+static BOOL shadow_client_send_surface_upgrade(rdpShadowClient* client,
+        SHADOW_GFX_STATUS* pStatus)
+{
+	rdpContext* context = (rdpContext*) client;
+	rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+
+	if (!context || !pStatus)
+		return FALSE;
+
+	settings = context->settings;
+	encoder = client->encoder;
+
+	if (!settings || !encoder)
+		return FALSE;
+
+	if (!encoder->progressivePending)
+		return TRUE;
+
+	if (!pStatus->gfxOpened || !pStatus->gfxSurfaceCreated ||
+	    settings->GfxH264 || !settings->GfxProgressive)
+	{
+		encoder->progressivePending = FALSE;
+		return TRUE;
+	}
+
+	return shadow_client_send_surface_gfx(client, NULL, 0, 0, 0, settings->DesktopWidth,
+	                                      settings->DesktopHeight, NULL, NULL);
+}
+
 /**
  * Function description
  * Notify client for resize. The new desktop width/height
@@ -1633,6 +2694,9 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	wMessage pointerAlphaMsg;
 	wMessage audioVolumeMsg;
 	HANDLE events[32];
+	HANDLE registered[32];
+	DWORD nRegistered = 0;
+	PWAIT_SET waitSet = NULL;
 	HANDLE ChannelEvent;
 	void* UpdateSubscriber;
 	HANDLE UpdateEvent;
@@ -1641,6 +2705,7 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	rdpSettings* settings;
 	rdpShadowServer* server;
 	rdpShadowSubsystem* subsystem;
+	DWORD dwTimeout;
 	wMessageQueue* MsgQueue = client->MsgQueue;
 	/* This should only be visited in client thread */
 	SHADOW_GFX_STATUS gfxstatus;
@@ -1673,6 +2738,9 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 	UpdateEvent = shadow_multiclient_getevent(UpdateSubscriber);
 	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(client->vcm);
 
+	if (!(waitSet = CreateWaitSet()))
+		goto fail;
+
 	while (1)
 	{
 		nCount = 0;
@@ -1690,11 +2758,50 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		dwTimeout = INFINITE;
+
+		/* Keep refining progressive tiles while the screen is idle */
+		if (client->encoder && client->encoder->progressivePending)
+			dwTimeout = 1000 / shadow_encoder_preferred_fps(client->encoder);
+
+		/* Only register the handles again if the transport changed them */
+		if ((nCount != nRegistered) ||
+		    (memcmp(events, registered, nCount * sizeof(HANDLE)) != 0))
+		{
+			DWORD index;
+			WaitSetClear(waitSet);
+			nRegistered = 0;
+
+			for (index = 0; index < nCount; index++)
+			{
+				if (!WaitSetAddHandle(waitSet, events[index]))
+				{
+					WLog_ERR(TAG, "Failed to register event handles");
+					goto fail;
+				}
+			}
+
+			CopyMemory(registered, events, nCount * sizeof(HANDLE));
+			nRegistered = nCount;
+		}
+
+		status = WaitForWaitSet(waitSet, dwTimeout);
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		if (status == WAIT_TIMEOUT)
+		{
+			if (client->activated && !client->suppressOutput)
+			{
+				if (!shadow_client_send_surface_upgrade(client, &gfxstatus))
+				{
+					WLog_ERR(TAG, "Failed to send surface upgrade");
+					break;
+				}
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
@@ -1784,6 +2891,7 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 						{
 							client->rdpgfx->FrameAcknowledge = shadow_client_rdpgfx_frame_acknowledge;
 							client->rdpgfx->CapsAdvertise = shadow_client_rdpgfx_caps_advertise;
+							client->rdpgfx->CacheImportOffer = shadow_client_rdpgfx_cache_import_offer;
 
 							if (!client->rdpgfx->Open(client->rdpgfx))
 							{
@@ -1919,6 +3027,7 @@ fail:
 		subsystem->ClientDisconnect(subsystem, client);
 	}
 
+	CloseWaitSet(waitSet);
 out:
 	peer->Disconnect(peer);
 	freerdp_peer_context_free(peer);
@@ -0,0 +1,321 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#define TAG SERVER_TAG("shadow.encodecache")
+
+#define SHADOW_ENCODE_CACHE_PENDING	0
+#define SHADOW_ENCODE_CACHE_READY	1
+#define SHADOW_ENCODE_CACHE_FAILED	2
+
+/* Waiting longer than that costs more than encoding the frame again */
+#define SHADOW_ENCODE_CACHE_WAIT_TIMEOUT	100
+
+struct rdp_shadow_encode_cache
+{
+	CRITICAL_SECTION lock;
+	UINT32 frameId;
+
+	UINT32 count;
+	UINT32 capacity;
+	SHADOW_ENCODE_CACHE_ENTRY** entries;
+};
+
+static void shadow_encode_cache_entry_free(SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	UINT32 index;
+
+	if (!entry)
+		return;
+
+	for (index = 0; index < entry->count; index++)
+		free(entry->data[index]);
+
+	free(entry->data);
+	free(entry->length);
+	free(entry->bitmaps);
+	free((void*) entry->key.rects);
+
+	if (entry->event)
+		CloseHandle(entry->event);
+
+	free(entry);
+}
+
+static SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_entry_new(
+    const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+	entry = (SHADOW_ENCODE_CACHE_ENTRY*) calloc(1, sizeof(SHADOW_ENCODE_CACHE_ENTRY));
+
+	if (!entry)
+		return NULL;
+
+	entry->key = *key;
+	entry->key.rects = NULL;
+	entry->state = SHADOW_ENCODE_CACHE_PENDING;
+
+	if (key->numRects > 0)
+	{
+		RECTANGLE_16* rects = (RECTANGLE_16*) calloc(key->numRects, sizeof(RECTANGLE_16));
+
+		if (!rects)
+		{
+			free(entry);
+			return NULL;
+		}
+
+		CopyMemory(rects, key->rects, key->numRects * sizeof(RECTANGLE_16));
+		entry->key.rects = rects;
+	}
+
+	if (!(entry->event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		free((void*) entry->key.rects);
+		free(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+static BOOL shadow_encode_cache_key_equal(const SHADOW_ENCODE_CACHE_KEY* a,
+        const SHADOW_ENCODE_CACHE_KEY* b)
+{
+	UINT32 index;
+
+	if ((a->surface != b->surface) || (a->codecId != b->codecId))
+		return FALSE;
+
+	if ((a->rect.left != b->rect.left) || (a->rect.top != b->rect.top) ||
+	    (a->rect.right != b->rect.right) || (a->rect.bottom != b->rect.bottom))
+		return FALSE;
+
+	if (a->numRects != b->numRects)
+		return FALSE;
+
+	if ((a->numRects > 0) &&
+	    (memcmp(a->rects, b->rects, a->numRects * sizeof(RECTANGLE_16)) != 0))
+		return FALSE;
+
+	for (index = 0; index < SHADOW_ENCODE_CACHE_MAX_PARAMS; index++)
+	{
+		if (a->params[index] != b->params[index])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Drop all entries of the previous frame.
+ * The update event barrier guarantees no client still references them.
+ */
+static void shadow_encode_cache_flush(rdpShadowEncodeCache* cache)
+{
+	UINT32 index;
+
+	for (index = 0; index < cache->count; index++)
+		shadow_encode_cache_entry_free(cache->entries[index]);
+
+	cache->count = 0;
+}
+
+rdpShadowEncodeCache* shadow_encode_cache_new(void)
+{
+	rdpShadowEncodeCache* cache;
+	cache = (rdpShadowEncodeCache*) calloc(1, sizeof(rdpShadowEncodeCache));
+
+	if (!cache)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&(cache->lock), 4000))
+	{
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	shadow_encode_cache_flush(cache);
+	free(cache->entries);
+	DeleteCriticalSection(&(cache->lock));
+	free(cache);
+}
+
+/**
+ * Function description
+ * Look up the encoded data for key in frame frameId.
+ *
+ * If no client encoded it yet a new pending entry is returned and owner is
+ * set; the caller must fill it with shadow_encode_cache_add and release it
+ * with shadow_encode_cache_commit before sending anything. If another client
+ * is encoding it, wait for its result for a bounded time.
+ *
+ * @return the entry, or NULL if the caller has to encode without the cache
+ */
+SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+        UINT32 frameId, const SHADOW_ENCODE_CACHE_KEY* key, BOOL* owner)
+{
+	UINT32 index;
+	SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+
+	if (!cache || !key || !owner)
+		return NULL;
+
+	*owner = FALSE;
+	EnterCriticalSection(&(cache->lock));
+
+	if (cache->frameId != frameId)
+	{
+		shadow_encode_cache_flush(cache);
+		cache->frameId = frameId;
+	}
+
+	for (index = 0; index < cache->count; index++)
+	{
+		if (shadow_encode_cache_key_equal(&(cache->entries[index]->key), key))
+		{
+			entry = cache->entries[index];
+			break;
+		}
+	}
+
+	if (!entry)
+	{
+		if (cache->count >= cache->capacity)
+		{
+			UINT32 capacity = cache->capacity ? cache->capacity * 2 : 8;
+			SHADOW_ENCODE_CACHE_ENTRY** entries = (SHADOW_ENCODE_CACHE_ENTRY**) realloc(
+			        cache->entries, capacity * sizeof(SHADOW_ENCODE_CACHE_ENTRY*));
+
+			if (!entries)
+				goto fail;
+
+			cache->entries = entries;
+			cache->capacity = capacity;
+		}
+
+		if (!(entry = shadow_encode_cache_entry_new(key)))
+			goto fail;
+
+		cache->entries[cache->count++] = entry;
+		*owner = TRUE;
+		LeaveCriticalSection(&(cache->lock));
+		return entry;
+	}
+
+	LeaveCriticalSection(&(cache->lock));
+
+	if (WaitForSingleObject(entry->event, SHADOW_ENCODE_CACHE_WAIT_TIMEOUT) != WAIT_OBJECT_0)
+		return NULL;
+
+	if (entry->state != SHADOW_ENCODE_CACHE_READY)
+		return NULL;
+
+	return entry;
+fail:
+	LeaveCriticalSection(&(cache->lock));
+	WLog_ERR(TAG, "Failed to allocate encode cache entry");
+	return NULL;
+}
+
+BOOL shadow_encode_cache_add(SHADOW_ENCODE_CACHE_ENTRY* entry, const BYTE* data,
+                             UINT32 length, const BITMAP_DATA* bitmap)
+{
+	BYTE* copy;
+
+	if (!entry || (!data && (length > 0)))
+		return FALSE;
+
+	if (entry->count >= entry->capacity)
+	{
+		BYTE** pData;
+		UINT32* pLength;
+		BITMAP_DATA* pBitmaps;
+		UINT32 capacity = entry->capacity ? entry->capacity * 2 : 4;
+
+		if (!(pData = (BYTE**) realloc(entry->data, capacity * sizeof(BYTE*))))
+			return FALSE;
+
+		entry->data = pData;
+
+		if (!(pLength = (UINT32*) realloc(entry->length, capacity * sizeof(UINT32))))
+			return FALSE;
+
+		entry->length = pLength;
+
+		if (bitmap)
+		{
+			if (!(pBitmaps = (BITMAP_DATA*) realloc(entry->bitmaps,
+			                 capacity * sizeof(BITMAP_DATA))))
+				return FALSE;
+
+			entry->bitmaps = pBitmaps;
+		}
+
+		entry->capacity = capacity;
+	}
+
+	if (!(copy = (BYTE*) malloc(length ? length : 1)))
+		return FALSE;
+
+	if (length > 0)
+		CopyMemory(copy, data, length);
+
+	entry->data[entry->count] = copy;
+	entry->length[entry->count] = length;
+
+	if (bitmap)
+	{
+		entry->bitmaps[entry->count] = *bitmap;
+		entry->bitmaps[entry->count].bitmapDataStream = copy;
+		entry->bitmaps[entry->count].bitmapLength = length;
+	}
+
+	entry->count++;
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Publish a pending entry to the waiting clients. On failure the entry is
+ * kept but marked unusable so that waiters fall back to encoding themselves.
+ */
+void shadow_encode_cache_commit(rdpShadowEncodeCache* cache,
+                                SHADOW_ENCODE_CACHE_ENTRY* entry, BOOL success)
+{
+	if (!cache || !entry)
+		return;
+
+	EnterCriticalSection(&(cache->lock));
+	entry->state = success ? SHADOW_ENCODE_CACHE_READY : SHADOW_ENCODE_CACHE_FAILED;
+	LeaveCriticalSection(&(cache->lock));
+	SetEvent(entry->event);
+}
@@ -0,0 +1,78 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+#define FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerdp/update.h>
+#include <freerdp/server/shadow.h>
+
+/*
+ * Per-frame cache of encoded surface data shared by all clients viewing
+ * the same surface. The first client encoding a given region with given
+ * codec parameters publishes the result, all other clients with matching
+ * parameters reuse it. Entries only live for a single update event.
+ */
+
+#define SHADOW_ENCODE_CACHE_MAX_PARAMS 4
+
+struct _SHADOW_ENCODE_CACHE_KEY
+{
+	const rdpShadowSurface* surface;
+	UINT32 codecId; /* FREERDP_CODEC_* */
+	RECTANGLE_16 rect;
+	const RECTANGLE_16* rects; /* optional, for multi rectangle encodes */
+	UINT32 numRects;
+	UINT32 params[SHADOW_ENCODE_CACHE_MAX_PARAMS]; /* codec specific */
+};
+typedef struct _SHADOW_ENCODE_CACHE_KEY SHADOW_ENCODE_CACHE_KEY;
+
+struct _SHADOW_ENCODE_CACHE_ENTRY
+{
+	SHADOW_ENCODE_CACHE_KEY key;
+	HANDLE event; /* Set once the owner committed (or dropped) the entry */
+	int state;
+
+	UINT32 count;
+	UINT32 capacity;
+	BYTE** data;
+	UINT32* length;
+	BITMAP_DATA* bitmaps; /* Only used for bitmap updates */
+};
+typedef struct _SHADOW_ENCODE_CACHE_ENTRY SHADOW_ENCODE_CACHE_ENTRY;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+rdpShadowEncodeCache* shadow_encode_cache_new(void);
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache);
+
+SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+        UINT32 frameId, const SHADOW_ENCODE_CACHE_KEY* key, BOOL* owner);
+BOOL shadow_encode_cache_add(SHADOW_ENCODE_CACHE_ENTRY* entry, const BYTE* data,
+                             UINT32 length, const BITMAP_DATA* bitmap);
+void shadow_encode_cache_commit(rdpShadowEncodeCache* cache,
+                                SHADOW_ENCODE_CACHE_ENTRY* entry, BOOL success);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_ENCODE_CACHE_H */
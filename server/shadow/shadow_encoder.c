@@ -245,6 +245,41 @@ fail:
 	return -1;
 }
 
+static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
+{
+	if (!encoder->progressive)
+		encoder->progressive = progressive_context_new(TRUE);
+
+	if (!encoder->progressive)
+		goto fail;
+
+	if (!progressive_context_reset(encoder->progressive))
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+fail:
+	progressive_context_free(encoder->progressive);
+	encoder->progressive = NULL;
+	return -1;
+}
+
+static int shadow_encoder_init_clear(rdpShadowEncoder* encoder)
+{
+	if (!encoder->clear)
+		encoder->clear = clear_context_new(TRUE);
+
+	if (!encoder->clear)
+		goto fail;
+
+	encoder->codecs |= FREERDP_CODEC_CLEARCODEC;
+	return 1;
+fail:
+	clear_context_free(encoder->clear);
+	encoder->clear = NULL;
+	return -1;
+}
+
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
 	encoder->width = encoder->server->screen->width;
@@ -323,6 +358,31 @@ static int shadow_encoder_uninit_h264(rdpShadowEncoder* encoder)
 	return 1;
 }
 
+static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
+{
+	if (encoder->progressive)
+	{
+		progressive_context_free(encoder->progressive);
+		encoder->progressive = NULL;
+	}
+
+	encoder->progressivePending = FALSE;
+	encoder->codecs &= ~FREERDP_CODEC_PROGRESSIVE;
+	return 1;
+}
+
+static int shadow_encoder_uninit_clear(rdpShadowEncoder* encoder)
+{
+	if (encoder->clear)
+	{
+		clear_context_free(encoder->clear);
+		encoder->clear = NULL;
+	}
+
+	encoder->codecs &= ~FREERDP_CODEC_CLEARCODEC;
+	return 1;
+}
+
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
 	shadow_encoder_uninit_grid(encoder);
@@ -358,6 +418,16 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 		shadow_encoder_uninit_h264(encoder);
 	}
 
+	if (encoder->codecs & FREERDP_CODEC_PROGRESSIVE)
+	{
+		shadow_encoder_uninit_progressive(encoder);
+	}
+
+	if (encoder->codecs & FREERDP_CODEC_CLEARCODEC)
+	{
+		shadow_encoder_uninit_clear(encoder);
+	}
+
 	return 1;
 }
 
@@ -439,6 +509,24 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_PROGRESSIVE)
+	    && !(encoder->codecs & FREERDP_CODEC_PROGRESSIVE))
+	{
+		status = shadow_encoder_init_progressive(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
+	if ((codecs & FREERDP_CODEC_CLEARCODEC)
+	    && !(encoder->codecs & FREERDP_CODEC_CLEARCODEC))
+	{
+		status = shadow_encoder_init_clear(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
 	return 1;
 }
 
@@ -455,9 +543,18 @@ rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client)
 	encoder->server = server;
 	encoder->fps = 16;
 	encoder->maxFps = 32;
+	region16_init(&encoder->solidRegion);
+
+	/* Follows the client cache, which outlives codec resets */
+	if (!(encoder->gfxCache = shadow_gfx_cache_new()))
+	{
+		free(encoder);
+		return NULL;
+	}
 
 	if (shadow_encoder_init(encoder) < 0)
 	{
+		shadow_gfx_cache_free(encoder->gfxCache);
 		free(encoder);
 		return NULL;
 	}
@@ -471,5 +568,7 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	shadow_gfx_cache_free(encoder->gfxCache);
+	region16_uninit(&encoder->solidRegion);
 	free(encoder);
 }
@@ -24,6 +24,7 @@
 
 #include <freerdp/freerdp.h>
 #include <freerdp/codecs.h>
+#include <freerdp/codec/region.h>
 
 #include <freerdp/server/shadow.h>
 
@@ -50,6 +51,8 @@ struct rdp_shadow_encoder
 	BITMAP_PLANAR_CONTEXT* planar;
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
+	PROGRESSIVE_CONTEXT* progressive;
+	CLEAR_CONTEXT* clear;
 
 	int fps;
 	int maxFps;
@@ -57,6 +60,9 @@ struct rdp_shadow_encoder
 	UINT32 frameId;
 	UINT32 lastAckframeId;
 	UINT32 queueDepth;
+	BOOL progressivePending;
+	rdpShadowGfxCache* gfxCache;
+	REGION16 solidRegion; /* Solid filled, kept out of H.264 frames */
 };
 
 #ifdef __cplusplus
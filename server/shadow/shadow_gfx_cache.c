@@ -0,0 +1,533 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <freerdp/log.h>
+
+#include "shadow.h"
+
+#define TAG SERVER_TAG("shadow.gfxcache")
+
+#define SHADOW_GFX_CACHE_PRIME1 0x9E3779B185EBCA87ULL
+#define SHADOW_GFX_CACHE_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define SHADOW_GFX_CACHE_PRIME3 0x165667B19E3779F9ULL
+
+struct _SHADOW_GFX_CACHE_SLOT
+{
+	UINT64 key;
+	UINT32 size;
+	UINT16 prev;
+	UINT16 next;
+};
+typedef struct _SHADOW_GFX_CACHE_SLOT SHADOW_GFX_CACHE_SLOT;
+
+struct rdp_shadow_gfx_cache
+{
+	CRITICAL_SECTION lock;
+
+	UINT32 maxSlots;
+	UINT64 maxSize;
+	UINT64 size;
+
+	/* Indexed by cache slot. Slot 0 is never handed to the client and
+	 * serves as head of the LRU list, head.next is the oldest entry. */
+	SHADOW_GFX_CACHE_SLOT* slots;
+	UINT16* freeSlots;
+	UINT32 freeCount;
+
+	/* Open addressing key to slot table, 0 marks an empty bucket */
+	UINT16* table;
+	UINT32 tableMask;
+
+	/* Tiles to store once the codec sent them at final quality */
+	SHADOW_GFX_CACHE_TILE* deferred;
+	UINT32 deferredCount;
+	UINT32 deferredCapacity;
+};
+
+static INLINE UINT64 shadow_gfx_cache_rotl(UINT64 value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static INLINE UINT64 shadow_gfx_cache_round(UINT64 lane, UINT64 value)
+{
+	lane += value * SHADOW_GFX_CACHE_PRIME2;
+	return shadow_gfx_cache_rotl(lane, 31) * SHADOW_GFX_CACHE_PRIME1;
+}
+
+/**
+ * Hash the pixels of a tile. The dimensions are part of the key,
+ * identical rows in differently sized tiles never share an entry.
+ */
+UINT64 shadow_gfx_cache_key(const BYTE* pData, UINT32 nStep, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x, y;
+	UINT64 hash;
+	const UINT64 seed = ((UINT64)nWidth << 32) | nHeight;
+	const UINT32 length = nWidth * 4;
+	UINT64 lanes[4];
+	lanes[0] = seed + SHADOW_GFX_CACHE_PRIME1 + SHADOW_GFX_CACHE_PRIME2;
+	lanes[1] = seed + SHADOW_GFX_CACHE_PRIME2;
+	lanes[2] = seed;
+	lanes[3] = seed - SHADOW_GFX_CACHE_PRIME1;
+
+	for (y = 0; y < nHeight; y++)
+	{
+		const BYTE* pRow = &pData[y * nStep];
+
+		for (x = 0; x + 32 <= length; x += 32)
+		{
+			UINT64 value[4];
+			CopyMemory(value, &pRow[x], sizeof(value));
+			lanes[0] = shadow_gfx_cache_round(lanes[0], value[0]);
+			lanes[1] = shadow_gfx_cache_round(lanes[1], value[1]);
+			lanes[2] = shadow_gfx_cache_round(lanes[2], value[2]);
+			lanes[3] = shadow_gfx_cache_round(lanes[3], value[3]);
+		}
+
+		for (; x < length; x += 4)
+		{
+			UINT32 value;
+			CopyMemory(&value, &pRow[x], sizeof(value));
+			lanes[(x >> 2) & 3] = shadow_gfx_cache_round(lanes[(x >> 2) & 3], value);
+		}
+	}
+
+	hash = shadow_gfx_cache_rotl(lanes[0], 1) + shadow_gfx_cache_rotl(lanes[1], 7) +
+	       shadow_gfx_cache_rotl(lanes[2], 12) + shadow_gfx_cache_rotl(lanes[3], 18);
+	hash ^= hash >> 33;
+	hash *= SHADOW_GFX_CACHE_PRIME2;
+	hash ^= hash >> 29;
+	hash *= SHADOW_GFX_CACHE_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static INLINE UINT32 shadow_gfx_cache_bucket(const rdpShadowGfxCache* cache, UINT64 key)
+{
+	return (UINT32)(key ^ (key >> 32)) & cache->tableMask;
+}
+
+static UINT32 shadow_gfx_cache_find(const rdpShadowGfxCache* cache, UINT64 key)
+{
+	UINT32 index = shadow_gfx_cache_bucket(cache, key);
+
+	while (cache->table[index])
+	{
+		if (cache->slots[cache->table[index]].key == key)
+			break;
+
+		index = (index + 1) & cache->tableMask;
+	}
+
+	return index;
+}
+
+/**
+ * Remove a slot from the key table. Following entries of the probe
+ * sequence are shifted back so lookups never need tombstones.
+ */
+static void shadow_gfx_cache_unhash(rdpShadowGfxCache* cache, UINT16 slot)
+{
+	UINT32 index = shadow_gfx_cache_find(cache, cache->slots[slot].key);
+	UINT32 next = index;
+
+	for (;;)
+	{
+		UINT32 home;
+		next = (next + 1) & cache->tableMask;
+
+		if (!cache->table[next])
+			break;
+
+		home = shadow_gfx_cache_bucket(cache, cache->slots[cache->table[next]].key);
+
+		/* Keep entries whose home bucket lies cyclically in (index, next] */
+		if ((index <= next) ? ((index < home) && (home <= next)) :
+		    ((index < home) || (home <= next)))
+			continue;
+
+		cache->table[index] = cache->table[next];
+		index = next;
+	}
+
+	cache->table[index] = 0;
+}
+
+static void shadow_gfx_cache_unlink(rdpShadowGfxCache* cache, UINT16 slot)
+{
+	SHADOW_GFX_CACHE_SLOT* entry = &cache->slots[slot];
+	cache->slots[entry->prev].next = entry->next;
+	cache->slots[entry->next].prev = entry->prev;
+}
+
+/* Link as newest entry, or as oldest one for entries nobody asked for yet */
+static void shadow_gfx_cache_link(rdpShadowGfxCache* cache, UINT16 slot, BOOL newest)
+{
+	SHADOW_GFX_CACHE_SLOT* entry = &cache->slots[slot];
+	SHADOW_GFX_CACHE_SLOT* head = &cache->slots[0];
+	entry->prev = newest ? head->prev : 0;
+	entry->next = newest ? 0 : head->next;
+	cache->slots[entry->prev].next = slot;
+	cache->slots[entry->next].prev = slot;
+}
+
+static UINT16 shadow_gfx_cache_insert(rdpShadowGfxCache* cache, UINT32 bucket, UINT64 key,
+                                      UINT32 size, BOOL newest)
+{
+	const UINT16 slot = cache->freeSlots[--cache->freeCount];
+	cache->slots[slot].key = key;
+	cache->slots[slot].size = size;
+	cache->table[bucket] = slot;
+	cache->size += size;
+	shadow_gfx_cache_link(cache, slot, newest);
+	return slot;
+}
+
+static UINT16 shadow_gfx_cache_evict(rdpShadowGfxCache* cache)
+{
+	const UINT16 slot = cache->slots[0].next;
+
+	if (!slot)
+		return 0;
+
+	shadow_gfx_cache_unhash(cache, slot);
+	shadow_gfx_cache_unlink(cache, slot);
+	cache->size -= cache->slots[slot].size;
+	cache->freeSlots[cache->freeCount++] = slot;
+	return slot;
+}
+
+rdpShadowGfxCache* shadow_gfx_cache_new(void)
+{
+	rdpShadowGfxCache* cache;
+	cache = (rdpShadowGfxCache*) calloc(1, sizeof(rdpShadowGfxCache));
+
+	if (!cache)
+		return NULL;
+
+	if (!InitializeCriticalSectionAndSpinCount(&cache->lock, 4000))
+	{
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void shadow_gfx_cache_free(rdpShadowGfxCache* cache)
+{
+	if (!cache)
+		return;
+
+	free(cache->slots);
+	free(cache->freeSlots);
+	free(cache->table);
+	free(cache->deferred);
+	DeleteCriticalSection(&cache->lock);
+	free(cache);
+}
+
+/**
+ * Start over with an empty cache sized for the capabilities the
+ * client confirmed, as the client does for a new channel.
+ */
+BOOL shadow_gfx_cache_reset(rdpShadowGfxCache* cache, BOOL smallCache)
+{
+	UINT32 index;
+	UINT32 tableSize = 1;
+	BOOL rc = FALSE;
+	const UINT32 maxSlots = smallCache ? SHADOW_GFX_CACHE_MAX_SLOTS_SMALL :
+	                        SHADOW_GFX_CACHE_MAX_SLOTS;
+
+	if (!cache)
+		return FALSE;
+
+	while (tableSize < maxSlots * 2)
+		tableSize <<= 1;
+
+	EnterCriticalSection(&cache->lock);
+	free(cache->slots);
+	free(cache->freeSlots);
+	free(cache->table);
+	cache->slots = (SHADOW_GFX_CACHE_SLOT*) calloc(maxSlots, sizeof(SHADOW_GFX_CACHE_SLOT));
+	cache->freeSlots = (UINT16*) calloc(maxSlots, sizeof(UINT16));
+	cache->table = (UINT16*) calloc(tableSize, sizeof(UINT16));
+	cache->deferredCount = 0;
+	cache->size = 0;
+	cache->freeCount = 0;
+
+	if (!cache->slots || !cache->freeSlots || !cache->table)
+	{
+		free(cache->slots);
+		free(cache->freeSlots);
+		free(cache->table);
+		cache->slots = NULL;
+		cache->freeSlots = NULL;
+		cache->table = NULL;
+		cache->maxSlots = 0;
+		goto out;
+	}
+
+	cache->maxSlots = maxSlots;
+	cache->maxSize = smallCache ? SHADOW_GFX_CACHE_MAX_SIZE_SMALL : SHADOW_GFX_CACHE_MAX_SIZE;
+	cache->tableMask = tableSize - 1;
+
+	/* Hand out low slots first */
+	for (index = maxSlots - 1; index > 0; index--)
+		cache->freeSlots[cache->freeCount++] = (UINT16) index;
+
+	rc = TRUE;
+out:
+	LeaveCriticalSection(&cache->lock);
+	return rc;
+}
+
+BOOL shadow_gfx_cache_enabled(rdpShadowGfxCache* cache)
+{
+	BOOL enabled;
+
+	if (!cache)
+		return FALSE;
+
+	EnterCriticalSection(&cache->lock);
+	enabled = (cache->maxSlots > 0);
+	LeaveCriticalSection(&cache->lock);
+	return enabled;
+}
+
+/**
+ * Function description
+ *
+ * @return the client cache slot holding the content, 0 if it is not cached
+ */
+UINT16 shadow_gfx_cache_lookup(rdpShadowGfxCache* cache, UINT64 key)
+{
+	UINT16 slot = 0;
+
+	if (!cache)
+		return 0;
+
+	EnterCriticalSection(&cache->lock);
+
+	if (cache->maxSlots > 0)
+	{
+		slot = cache->table[shadow_gfx_cache_find(cache, key)];
+
+		if (slot)
+		{
+			shadow_gfx_cache_unlink(cache, slot);
+			shadow_gfx_cache_link(cache, slot, TRUE);
+		}
+	}
+
+	LeaveCriticalSection(&cache->lock);
+	return slot;
+}
+
+/**
+ * Function description
+ * Assign a cache slot to new content. Least recently used entries are
+ * dropped until the entry fits, the client must be told to evict the
+ * returned slots before the new entry is stored.
+ *
+ * @return the slot to store the content in, 0 if it can not be cached
+ */
+UINT16 shadow_gfx_cache_add(rdpShadowGfxCache* cache, UINT64 key, UINT32 size,
+                            UINT16* evicted, UINT32 maxEvicted, UINT32* evictedCount)
+{
+	UINT32 bucket;
+	UINT16 slot = 0;
+
+	if (!cache || !evictedCount)
+		return 0;
+
+	*evictedCount = 0;
+	EnterCriticalSection(&cache->lock);
+
+	if ((cache->maxSlots == 0) || (size == 0) || (size > cache->maxSize))
+		goto out;
+
+	bucket = shadow_gfx_cache_find(cache, key);
+
+	if (cache->table[bucket])
+		goto out;
+
+	while (!cache->freeCount || (cache->size + size > cache->maxSize))
+	{
+		if (*evictedCount >= maxEvicted)
+			goto out;
+
+		evicted[(*evictedCount)++] = shadow_gfx_cache_evict(cache);
+	}
+
+	/* Evictions shift the probe sequence */
+	bucket = shadow_gfx_cache_find(cache, key);
+	slot = shadow_gfx_cache_insert(cache, bucket, key, size, TRUE);
+out:
+	LeaveCriticalSection(&cache->lock);
+	return slot;
+}
+
+/**
+ * Function description
+ * Accept the entries a reconnecting client kept from an earlier session
+ * as long as they fit into the cache. Imported entries are the first to
+ * go once space is needed, they only pay off if the same content shows up.
+ *
+ * @return number of entries in cacheSlots, 0 for a not imported entry
+ */
+UINT16 shadow_gfx_cache_import(rdpShadowGfxCache* cache,
+                               const RDPGFX_CACHE_IMPORT_OFFER_PDU* offer, UINT16* cacheSlots)
+{
+	UINT16 index;
+	UINT16 count;
+
+	if (!cache || !offer || !cacheSlots)
+		return 0;
+
+	count = MIN(offer->cacheEntriesCount, SHADOW_GFX_CACHE_MAX_IMPORT);
+	EnterCriticalSection(&cache->lock);
+
+	for (index = 0; index < count; index++)
+	{
+		const RDPGFX_CACHE_ENTRY_METADATA* entry = &offer->cacheEntries[index];
+		UINT32 bucket;
+		cacheSlots[index] = 0;
+
+		if ((cache->maxSlots == 0) || !cache->freeCount || (entry->bitmapLength == 0) ||
+		    (cache->size + entry->bitmapLength > cache->maxSize))
+			continue;
+
+		bucket = shadow_gfx_cache_find(cache, entry->cacheKey);
+
+		if (cache->table[bucket])
+			continue;
+
+		cacheSlots[index] = shadow_gfx_cache_insert(cache, bucket, entry->cacheKey,
+		                    entry->bitmapLength, FALSE);
+	}
+
+	LeaveCriticalSection(&cache->lock);
+	return count;
+}
+
+/**
+ * Remember a tile to store once its encoding is final. A newer encoding
+ * of the same tile replaces the pending one.
+ */
+BOOL shadow_gfx_cache_defer(rdpShadowGfxCache* cache, const SHADOW_GFX_CACHE_TILE* tile)
+{
+	UINT32 index;
+	BOOL rc = TRUE;
+
+	if (!cache || !tile)
+		return FALSE;
+
+	EnterCriticalSection(&cache->lock);
+
+	for (index = 0; index < cache->deferredCount; index++)
+	{
+		SHADOW_GFX_CACHE_TILE* pending = &cache->deferred[index];
+
+		if ((pending->rect.left == tile->rect.left) && (pending->rect.top == tile->rect.top))
+		{
+			*pending = *tile;
+			goto out;
+		}
+	}
+
+	if (cache->deferredCount >= cache->deferredCapacity)
+	{
+		const UINT32 capacity = MAX(64, cache->deferredCapacity * 2);
+		SHADOW_GFX_CACHE_TILE* deferred = (SHADOW_GFX_CACHE_TILE*) realloc(cache->deferred,
+		                                  capacity * sizeof(SHADOW_GFX_CACHE_TILE));
+
+		if (!deferred)
+		{
+			rc = FALSE;
+			goto out;
+		}
+
+		cache->deferred = deferred;
+		cache->deferredCapacity = capacity;
+	}
+
+	cache->deferred[cache->deferredCount++] = *tile;
+out:
+	LeaveCriticalSection(&cache->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ * Hand the deferred tiles over to the caller, who has to free them.
+ *
+ * @return the deferred tiles, NULL if there are none
+ */
+SHADOW_GFX_CACHE_TILE* shadow_gfx_cache_take_deferred(rdpShadowGfxCache* cache, UINT32* count)
+{
+	SHADOW_GFX_CACHE_TILE* tiles = NULL;
+
+	if (!cache || !count)
+		return NULL;
+
+	*count = 0;
+	EnterCriticalSection(&cache->lock);
+
+	if (cache->deferredCount > 0)
+	{
+		tiles = cache->deferred;
+		*count = cache->deferredCount;
+		cache->deferred = NULL;
+		cache->deferredCount = 0;
+		cache->deferredCapacity = 0;
+	}
+
+	LeaveCriticalSection(&cache->lock);
+	return tiles;
+}
+
+/**
+ * Forget the deferred tiles inside rect, their content is painted otherwise.
+ * Without a rect all are dropped, the surface they belong to is gone.
+ */
+void shadow_gfx_cache_drop_deferred(rdpShadowGfxCache* cache, const RECTANGLE_16* rect)
+{
+	UINT32 index = 0;
+
+	if (!cache)
+		return;
+
+	EnterCriticalSection(&cache->lock);
+
+	while (index < cache->deferredCount)
+	{
+		const RECTANGLE_16* tileRect = &cache->deferred[index].rect;
+
+		if (!rect || ((tileRect->left >= rect->left) && (tileRect->top >= rect->top) &&
+		              (tileRect->right <= rect->right) && (tileRect->bottom <= rect->bottom)))
+			cache->deferred[index] = cache->deferred[--cache->deferredCount];
+		else
+			index++;
+	}
+
+	LeaveCriticalSection(&cache->lock);
+}
@@ -0,0 +1,74 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_GFX_CACHE_H
+#define FREERDP_SERVER_SHADOW_GFX_CACHE_H
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerdp/channels/rdpgfx.h>
+#include <freerdp/server/shadow.h>
+
+/*
+ * Mirror of the bitmap cache of a graphics pipeline client. Surface tiles
+ * are keyed by a hash of their content, the server decides which cache slot
+ * holds which tile and evicts the least recently used ones once the slot or
+ * memory limits negotiated with the client are reached.
+ */
+
+#define SHADOW_GFX_CACHE_TILE_SIZE 64
+
+#define SHADOW_GFX_CACHE_MAX_SLOTS 25600
+#define SHADOW_GFX_CACHE_MAX_SLOTS_SMALL 4096
+#define SHADOW_GFX_CACHE_MAX_SIZE (100 * 1024 * 1024)
+#define SHADOW_GFX_CACHE_MAX_SIZE_SMALL (16 * 1024 * 1024)
+#define SHADOW_GFX_CACHE_MAX_IMPORT 5462
+
+struct _SHADOW_GFX_CACHE_TILE
+{
+	RECTANGLE_16 rect;
+	UINT64 cacheKey;
+	UINT16 cacheSlot; /* 0 if the tile is not (yet) cached on the client */
+};
+typedef struct _SHADOW_GFX_CACHE_TILE SHADOW_GFX_CACHE_TILE;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+rdpShadowGfxCache* shadow_gfx_cache_new(void);
+void shadow_gfx_cache_free(rdpShadowGfxCache* cache);
+
+BOOL shadow_gfx_cache_reset(rdpShadowGfxCache* cache, BOOL smallCache);
+BOOL shadow_gfx_cache_enabled(rdpShadowGfxCache* cache);
+
+UINT64 shadow_gfx_cache_key(const BYTE* pData, UINT32 nStep, UINT32 nWidth, UINT32 nHeight);
+UINT16 shadow_gfx_cache_lookup(rdpShadowGfxCache* cache, UINT64 key);
+UINT16 shadow_gfx_cache_add(rdpShadowGfxCache* cache, UINT64 key, UINT32 size,
+                            UINT16* evicted, UINT32 maxEvicted, UINT32* evictedCount);
+UINT16 shadow_gfx_cache_import(rdpShadowGfxCache* cache,
+                               const RDPGFX_CACHE_IMPORT_OFFER_PDU* offer, UINT16* cacheSlots);
+
+BOOL shadow_gfx_cache_defer(rdpShadowGfxCache* cache, const SHADOW_GFX_CACHE_TILE* tile);
+SHADOW_GFX_CACHE_TILE* shadow_gfx_cache_take_deferred(rdpShadowGfxCache* cache, UINT32* count);
+void shadow_gfx_cache_drop_deferred(rdpShadowGfxCache* cache, const RECTANGLE_16* rect);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_GFX_CACHE_H */
@@ -33,6 +33,7 @@
 
 #include <freerdp/log.h>
 #include <freerdp/version.h>
+#include <freerdp/codec/zgfx.h>
 
 #include <winpr/tools/makecert.h>
 
@@ -54,11 +55,14 @@ static COMMAND_LINE_ARGUMENT_A shadow_args[] =
 	{ "auth", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Clients must authenticate" },
 	{ "may-view", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Clients may view without prompt" },
 	{ "may-interact", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "Clients may interact without prompt" },
+	{ "gfx-codec", COMMAND_LINE_VALUE_REQUIRED, "<progressive|clear>", "progressive", NULL, -1, NULL, "Codec for graphics pipeline updates without H.264" },
+	{ "gfx-compression", COMMAND_LINE_VALUE_REQUIRED, "<0-9>", "0", NULL, -1, NULL, "ZGFX compression level for graphics pipeline PDUs, 0 disables compression" },
 	{ "sec", COMMAND_LINE_VALUE_REQUIRED, "<rdp|tls|nla|ext>", NULL, NULL, -1, NULL, "force specific protocol security" },
 	{ "sec-rdp", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "rdp protocol security" },
 	{ "sec-tls", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "tls protocol security" },
 	{ "sec-nla", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueTrue, NULL, -1, NULL, "nla protocol security" },
 	{ "sec-ext", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "nla extended protocol security" },
+	{ "tls-kernel", COMMAND_LINE_VALUE_BOOL, NULL, BoolValueFalse, NULL, -1, NULL, "Offload TLS record encryption to the kernel (Linux)" },
 	{ "sam-file", COMMAND_LINE_VALUE_REQUIRED, "<file>", NULL, NULL, -1, NULL, "NTLM SAM file for NLA authentication" },
 	{ "version", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_VERSION, NULL, NULL, NULL, -1, NULL, "Print version" },
 	{ "help", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT_HELP, NULL, NULL, NULL, -1, "?", "Print help" },
@@ -289,6 +293,18 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			server->authentication = arg->Value ? TRUE : FALSE;
 		}
+		CommandLineSwitchCase(arg, "gfx-codec")
+		{
+			if (strcmp("progressive", arg->Value) == 0)
+				server->gfxProgressive = TRUE;
+			else if (strcmp("clear", arg->Value) == 0)
+				server->gfxProgressive = FALSE;
+			else
+			{
+				WLog_ERR(TAG, "unknown graphics pipeline codec: %s", arg->Value);
+				return -1;
+			}
+		}
 		CommandLineSwitchCase(arg, "sec")
 		{
 			if (strcmp("rdp", arg->Value) == 0) /* Standard RDP */
@@ -341,6 +357,24 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 		{
 			settings->ExtSecurity = arg->Value ? TRUE : FALSE;
 		}
+		CommandLineSwitchCase(arg, "gfx-compression")
+		{
+			unsigned long val;
+			errno = 0;
+			val = strtoul(arg->Value, NULL, 0);
+
+			if ((errno != 0) || (val > ZGFX_MAX_COMPRESSION_LEVEL))
+			{
+				WLog_ERR(TAG, "invalid graphics pipeline compression level: %s", arg->Value);
+				return -1;
+			}
+
+			server->gfxCompressionLevel = (UINT32) val;
+		}
+		CommandLineSwitchCase(arg, "tls-kernel")
+		{
+			server->kernelTls = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "sam-file")
 		{
 			freerdp_settings_set_string(settings, FreeRDP_NtlmSamFile, arg->Value);
@@ -722,6 +756,11 @@ int shadow_server_init(rdpShadowServer* server)
 
 	server->listener->info = (void*) server;
 	server->listener->PeerAccepted = shadow_client_accepted;
+	server->encodeCache = shadow_encode_cache_new();
+
+	if (!server->encodeCache)
+		goto fail_encode_cache;
+
 	server->subsystem = shadow_subsystem_new();
 
 	if (!server->subsystem)
@@ -734,6 +773,9 @@ int shadow_server_init(rdpShadowServer* server)
 
 	shadow_subsystem_free(server->subsystem);
 fail_subsystem_new:
+	shadow_encode_cache_free(server->encodeCache);
+	server->encodeCache = NULL;
+fail_encode_cache:
 	freerdp_listener_free(server->listener);
 	server->listener = NULL;
 fail_listener:
@@ -765,6 +807,8 @@ int shadow_server_uninit(rdpShadowServer* server)
 	shadow_server_stop(server);
 	shadow_subsystem_uninit(server->subsystem);
 	shadow_subsystem_free(server->subsystem);
+	shadow_encode_cache_free(server->encodeCache);
+	server->encodeCache = NULL;
 	freerdp_listener_free(server->listener);
 	server->listener = NULL;
 	free(server->CertificateFile);
@@ -797,6 +841,8 @@ rdpShadowServer* shadow_server_new(void)
 	server->h264BitRate = 10000000;
 	server->h264FrameRate = 30;
 	server->h264QP = 0;
+	server->gfxProgressive = TRUE;
+	server->gfxCompressionLevel = ZGFX_SERVER_COMPRESSION_LEVEL;
 	server->authentication = FALSE;
 	server->settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
 	return server;
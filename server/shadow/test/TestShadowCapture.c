@@ -0,0 +1,245 @@
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+
+#include <freerdp/codec/region.h>
+#include <freerdp/server/shadow.h>
+
+#include "../shadow_capture.h"
+
+#define TEST_TILE_SIZE 16
+
+struct test_capture_frame
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 step;
+	BYTE* data1;
+	BYTE* data2;
+};
+
+static BOOL test_frame_new(struct test_capture_frame* frame, UINT32 width, UINT32 height)
+{
+	UINT32 x;
+	frame->width = width;
+	frame->height = height;
+	/* Padding between the rows must not be compared */
+	frame->step = width * 4 + 12;
+	frame->data1 = (BYTE*) malloc(frame->step * height);
+	frame->data2 = (BYTE*) malloc(frame->step * height);
+
+	if (!frame->data1 || !frame->data2)
+		return FALSE;
+
+	for (x = 0; x < frame->step * height; x++)
+		frame->data1[x] = (BYTE)(x * 7 + (x >> 9));
+
+	CopyMemory(frame->data2, frame->data1, frame->step * height);
+	return TRUE;
+}
+
+static void test_frame_free(struct test_capture_frame* frame)
+{
+	free(frame->data1);
+	free(frame->data2);
+}
+
+/* Change one pixel of the second frame and add its tile to the expected region */
+static BOOL test_frame_touch(struct test_capture_frame* frame, UINT32 x, UINT32 y,
+                             REGION16* expected)
+{
+	RECTANGLE_16 rect;
+	frame->data2[(y * frame->step) + (x * 4) + (x % 4)] ^= 0x5A;
+	rect.left = (UINT16)(x - (x % TEST_TILE_SIZE));
+	rect.top = (UINT16)(y - (y % TEST_TILE_SIZE));
+	rect.right = (UINT16) MIN(frame->width, rect.left + TEST_TILE_SIZE);
+	rect.bottom = (UINT16) MIN(frame->height, rect.top + TEST_TILE_SIZE);
+	return region16_union_rect(expected, expected, &rect);
+}
+
+/* Region bands depend on the order rects were added in, compare the covered area */
+static BOOL test_region_covers(const REGION16* a, const REGION16* b)
+{
+	UINT32 index;
+	UINT32 numRects = 0;
+	BOOL rc;
+	REGION16 rest;
+	const RECTANGLE_16* rects = region16_rects(b, &numRects);
+	region16_init(&rest);
+	rc = region16_copy(&rest, a);
+
+	for (index = 0; rc && (index < numRects); index++)
+		rc = region16_subtract_rect(&rest, &rest, &rects[index]);
+
+	rc = rc && region16_is_empty(&rest);
+	region16_uninit(&rest);
+	return rc;
+}
+
+static BOOL test_region_equal(const REGION16* a, const REGION16* b)
+{
+	return test_region_covers(a, b) && test_region_covers(b, a);
+}
+
+static BOOL test_compare(rdpShadowCapture* capture, const struct test_capture_frame* frame,
+                         const REGION16* expected, const char* name)
+{
+	int status;
+	BOOL rc;
+	REGION16 region;
+	region16_init(&region);
+	status = shadow_capture_compare_region(capture, frame->data1, frame->step, frame->width,
+	                                       frame->height, frame->data2, frame->step, &region);
+	rc = (status == (region16_is_empty(expected) ? 0 : 1)) &&
+	     test_region_equal(&region, expected);
+
+	if (!rc)
+		printf("%s: %s compare returned %d with an unexpected region\n", name,
+		       capture ? "threaded" : "serial", status);
+
+	region16_uninit(&region);
+	return rc;
+}
+
+/* Single changed pixels map to their tile, tiles at the right and bottom are clipped */
+static BOOL test_capture_grid(void)
+{
+	BOOL rc = FALSE;
+	REGION16 expected;
+	struct test_capture_frame frame = { 0 };
+	region16_init(&expected);
+
+	if (!test_frame_new(&frame, 100, 70))
+		goto fail;
+
+	if (!test_compare(NULL, &frame, &expected, "grid"))
+		goto fail;
+
+	if (!test_frame_touch(&frame, 17, 33, &expected) ||
+	    !test_compare(NULL, &frame, &expected, "grid"))
+		goto fail;
+
+	if (!test_frame_touch(&frame, 0, 0, &expected) ||
+	    !test_frame_touch(&frame, 99, 0, &expected) ||
+	    !test_frame_touch(&frame, 0, 69, &expected) ||
+	    !test_frame_touch(&frame, 99, 69, &expected) ||
+	    !test_compare(NULL, &frame, &expected, "grid edges"))
+		goto fail;
+
+	/* Neighbouring tiles of a row merge into one run */
+	if (!test_frame_touch(&frame, 47, 20, &expected) ||
+	    !test_frame_touch(&frame, 48, 20, &expected) ||
+	    !test_compare(NULL, &frame, &expected, "grid run"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_frame_free(&frame);
+	region16_uninit(&expected);
+	return rc;
+}
+
+/* Rows with too many runs are added as one span from the first to the last run */
+static BOOL test_capture_noisy_row(void)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	REGION16 expected;
+	RECTANGLE_16 span;
+	struct test_capture_frame frame = { 0 };
+	region16_init(&expected);
+
+	if (!test_frame_new(&frame, 1100, 40))
+		goto fail;
+
+	for (x = 16; x < frame.width; x += 2 * TEST_TILE_SIZE)
+	{
+		if (!test_frame_touch(&frame, x, 18, &expected))
+			goto fail;
+	}
+
+	span = *region16_extents(&expected);
+	region16_clear(&expected);
+
+	if (!region16_union_rect(&expected, &expected, &span))
+		goto fail;
+
+	rc = test_compare(NULL, &frame, &expected, "noisy row");
+fail:
+	test_frame_free(&frame);
+	region16_uninit(&expected);
+	return rc;
+}
+
+/* Frames large enough to be split across the pool give the same region as a serial compare */
+static BOOL test_capture_threaded(void)
+{
+	UINT32 i;
+	UINT32 seed = 12345;
+	BOOL rc = FALSE;
+	REGION16 expected;
+	struct test_capture_frame frame = { 0 };
+	rdpShadowCapture* capture = shadow_capture_new(NULL);
+	region16_init(&expected);
+
+	if (!capture)
+		goto fail;
+
+	/* Single processor machines still run the threaded path */
+	if (!capture->UseThreads)
+	{
+		if (!(capture->ThreadPool = CreateThreadpool(NULL)))
+			goto fail;
+
+		InitializeThreadpoolEnvironment(&capture->ThreadPoolEnv);
+		SetThreadpoolCallbackPool(&capture->ThreadPoolEnv, capture->ThreadPool);
+		capture->UseThreads = TRUE;
+	}
+
+	capture->ThreadCount = 7;
+
+	if (!test_frame_new(&frame, 1283, 1031))
+		goto fail;
+
+	if (!test_compare(capture, &frame, &expected, "threaded"))
+		goto fail;
+
+	for (i = 0; i < 300; i++)
+	{
+		UINT32 x, y;
+		seed = seed * 1103515245 + 12345;
+		x = (seed >> 8) % frame.width;
+		seed = seed * 1103515245 + 12345;
+		y = (seed >> 8) % frame.height;
+
+		if (!test_frame_touch(&frame, x, y, &expected))
+			goto fail;
+	}
+
+	if (!test_compare(NULL, &frame, &expected, "threaded") ||
+	    !test_compare(capture, &frame, &expected, "threaded"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	test_frame_free(&frame);
+	region16_uninit(&expected);
+	shadow_capture_free(capture);
+	return rc;
+}
+
+int TestShadowCapture(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_capture_grid())
+		return -1;
+
+	if (!test_capture_noisy_row())
+		return -1;
+
+	if (!test_capture_threaded())
+		return -1;
+
+	return 0;
+}
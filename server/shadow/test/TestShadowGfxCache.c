@@ -0,0 +1,331 @@
+#include <winpr/crt.h>
+
+#include <freerdp/server/shadow.h>
+
+#include "../shadow_gfx_cache.h"
+
+/*
+ * Keys below 2^32 land in bucket key & (buckets - 1). The small cache has 4096 slots and
+ * twice as many buckets, homes close to the end of the table make probe chains wrap.
+ */
+#define TEST_BUCKETS 8192
+#define TEST_KEY(_home, _n) ((UINT64)(_home) + ((UINT64)(_n) * TEST_BUCKETS))
+#define TEST_MAX_SLOTS (SHADOW_GFX_CACHE_MAX_SLOTS_SMALL - 1)
+#define TEST_MODEL_SIZE 16
+#define TEST_KEY_COUNT 48
+
+/* Reference LRU, entries[0] is the oldest one */
+struct test_model
+{
+	UINT64 keys[TEST_MODEL_SIZE];
+	UINT16 slots[TEST_MODEL_SIZE];
+	UINT32 sizes[TEST_MODEL_SIZE];
+	UINT32 count;
+	UINT64 size;
+};
+
+static UINT32 test_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static int test_model_find(const struct test_model* model, UINT64 key)
+{
+	UINT32 x;
+
+	for (x = 0; x < model->count; x++)
+	{
+		if (model->keys[x] == key)
+			return (int) x;
+	}
+
+	return -1;
+}
+
+static void test_model_remove(struct test_model* model, UINT32 index)
+{
+	model->size -= model->sizes[index];
+	model->count--;
+	MoveMemory(&model->keys[index], &model->keys[index + 1],
+	           (model->count - index) * sizeof(model->keys[0]));
+	MoveMemory(&model->slots[index], &model->slots[index + 1],
+	           (model->count - index) * sizeof(model->slots[0]));
+	MoveMemory(&model->sizes[index], &model->sizes[index + 1],
+	           (model->count - index) * sizeof(model->sizes[0]));
+}
+
+static void test_model_append(struct test_model* model, UINT64 key, UINT16 slot, UINT32 size)
+{
+	model->keys[model->count] = key;
+	model->slots[model->count] = slot;
+	model->sizes[model->count] = size;
+	model->count++;
+	model->size += size;
+}
+
+static BOOL test_cache_lookup(rdpShadowGfxCache* cache, struct test_model* model, UINT64 key)
+{
+	UINT32 size;
+	const int index = test_model_find(model, key);
+	const UINT16 slot = shadow_gfx_cache_lookup(cache, key);
+
+	if (index < 0)
+		return slot == 0;
+
+	if (slot != model->slots[index])
+	{
+		fprintf(stderr, "key 0x%016" PRIX64 " found in slot %" PRIu16 " instead of %" PRIu16 "\n",
+		        key, slot, model->slots[index]);
+		return FALSE;
+	}
+
+	/* a hit makes the entry the newest one */
+	size = model->sizes[index];
+	test_model_remove(model, (UINT32) index);
+	test_model_append(model, key, slot, size);
+	return TRUE;
+}
+
+static BOOL test_cache_add(rdpShadowGfxCache* cache, struct test_model* model, UINT64 key,
+                           UINT32 size)
+{
+	UINT32 x;
+	UINT16 slot;
+	UINT16 evicted[TEST_MODEL_SIZE];
+	UINT32 evictedCount = 0;
+	UINT32 evictedSize = 0;
+	const UINT32 maxSize = SHADOW_GFX_CACHE_MAX_SIZE_SMALL;
+	slot = shadow_gfx_cache_add(cache, key, size, evicted, ARRAYSIZE(evicted), &evictedCount);
+
+	if (test_model_find(model, key) >= 0)
+		return (slot == 0) && (evictedCount == 0);
+
+	/* the oldest entries go first, until the new one fits */
+	for (x = 0; x < evictedCount; x++)
+	{
+		if ((model->count == 0) || (evicted[x] != model->slots[0]))
+		{
+			fprintf(stderr, "evicted slot %" PRIu16 " is not the oldest one\n", evicted[x]);
+			return FALSE;
+		}
+
+		evictedSize = model->sizes[0];
+		test_model_remove(model, 0);
+	}
+
+	/* it has to fit now, but not without the last evicted entry gone */
+	if (!slot || (model->size + size > maxSize) ||
+	    ((evictedCount > 0) && (model->size + evictedSize + size <= maxSize)))
+	{
+		fprintf(stderr, "adding %" PRIu32 " bytes evicted %" PRIu32 " entries\n", size,
+		        evictedCount);
+		return FALSE;
+	}
+
+	for (x = 0; x < model->count; x++)
+	{
+		if (model->slots[x] == slot)
+			return FALSE;
+	}
+
+	test_model_append(model, key, slot, size);
+	return TRUE;
+}
+
+/**
+ * Random adds and lookups of keys whose homes are the last and the first buckets. Evictions
+ * delete entries anywhere in probe chains that wrap around the end of the table, every key
+ * still cached has to be found afterwards.
+ */
+static BOOL test_gfx_cache_wrapped_chains(void)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	UINT32 seed = 0xCAC4E;
+	UINT64 keys[TEST_KEY_COUNT];
+	struct test_model model = { 0 };
+	rdpShadowGfxCache* cache = shadow_gfx_cache_new();
+
+	if (!cache || !shadow_gfx_cache_reset(cache, TRUE))
+		goto fail;
+
+	for (x = 0; x < TEST_KEY_COUNT; x++)
+		keys[x] = TEST_KEY((TEST_BUCKETS - 3 + (x % 6)) % TEST_BUCKETS, x + 1);
+
+	for (x = 0; x < 20000; x++)
+	{
+		const UINT64 key = keys[test_rand(&seed) % TEST_KEY_COUNT];
+
+		if (test_rand(&seed) % 3)
+		{
+			/* at most about 12 entries fit */
+			const UINT32 size = SHADOW_GFX_CACHE_MAX_SIZE_SMALL / 16 +
+			                    test_rand(&seed) % (SHADOW_GFX_CACHE_MAX_SIZE_SMALL / 16);
+
+			if (!test_cache_add(cache, &model, key, size))
+				goto fail;
+		}
+		else if (!test_cache_lookup(cache, &model, key))
+			goto fail;
+	}
+
+	/* all keys, cached or not, resolve as the model says */
+	for (x = 0; x < TEST_KEY_COUNT; x++)
+	{
+		if (!test_cache_lookup(cache, &model, keys[x]))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __FUNCTION__);
+
+	shadow_gfx_cache_free(cache);
+	return rc;
+}
+
+/* Evicting the first entries of a wrapped chain shifts the rest back over the wrap */
+static BOOL test_gfx_cache_wrapped_delete(void)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	UINT16 evicted[4];
+	UINT32 evictedCount;
+	struct test_model model = { 0 };
+	const UINT32 big = SHADOW_GFX_CACHE_MAX_SIZE_SMALL - 7;
+	rdpShadowGfxCache* cache = shadow_gfx_cache_new();
+
+	if (!cache || !shadow_gfx_cache_reset(cache, TRUE))
+		goto fail;
+
+	/* buckets 8190, 8191, 0, 1 for the first home, then two entries pushed further */
+	if (!test_cache_add(cache, &model, TEST_KEY(TEST_BUCKETS - 2, 1), big))
+		goto fail;
+
+	for (x = 2; x <= 4; x++)
+	{
+		if (!test_cache_add(cache, &model, TEST_KEY(TEST_BUCKETS - 2, x), 1))
+			goto fail;
+	}
+
+	if (!test_cache_add(cache, &model, TEST_KEY(0, 5), 1) ||
+	    !test_cache_add(cache, &model, TEST_KEY(1, 6), 1) ||
+	    !test_cache_add(cache, &model, TEST_KEY(TEST_BUCKETS - 1, 7), 1))
+		goto fail;
+
+	/* the cache is full, the big entry at the start of the chain has to go */
+	if (!test_cache_add(cache, &model, TEST_KEY(100, 8), 8) || (model.count != 7))
+		goto fail;
+
+	for (x = 1; x <= 8; x++)
+	{
+		const UINT64 key = (x == 8) ? TEST_KEY(100, 8) :
+		                   (x <= 4) ? TEST_KEY(TEST_BUCKETS - 2, x) :
+		                   (x == 5) ? TEST_KEY(0, 5) : (x == 6) ? TEST_KEY(1, 6) :
+		                   TEST_KEY(TEST_BUCKETS - 1, 7);
+
+		if (!test_cache_lookup(cache, &model, key))
+			goto fail;
+	}
+
+	/* too large for the cache at all, nothing is evicted */
+	if (shadow_gfx_cache_add(cache, TEST_KEY(200, 9), SHADOW_GFX_CACHE_MAX_SIZE_SMALL + 1,
+	                         evicted, ARRAYSIZE(evicted), &evictedCount) || (evictedCount != 0))
+		goto fail;
+
+	/* not enough room in evicted for what has to go */
+	if (shadow_gfx_cache_add(cache, TEST_KEY(200, 10), SHADOW_GFX_CACHE_MAX_SIZE_SMALL,
+	                         evicted, 2, &evictedCount) || (evictedCount != 2))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __FUNCTION__);
+
+	shadow_gfx_cache_free(cache);
+	return rc;
+}
+
+/* With small entries the slot count is the limit, imported entries are evicted first */
+static BOOL test_gfx_cache_slots(void)
+{
+	UINT32 x;
+	BOOL rc = FALSE;
+	UINT16 slot;
+	UINT16 evicted[2];
+	UINT16 importSlots[2];
+	UINT32 evictedCount;
+	RDPGFX_CACHE_ENTRY_METADATA entries[2];
+	RDPGFX_CACHE_IMPORT_OFFER_PDU offer;
+	rdpShadowGfxCache* cache = shadow_gfx_cache_new();
+
+	if (!cache || !shadow_gfx_cache_reset(cache, TRUE))
+		goto fail;
+
+	for (x = 0; x < TEST_MAX_SLOTS - 2; x++)
+	{
+		if (!shadow_gfx_cache_add(cache, x + 1, 1, evicted, ARRAYSIZE(evicted), &evictedCount) ||
+		    (evictedCount != 0))
+			goto fail;
+	}
+
+	entries[0].cacheKey = 0x10000001;
+	entries[0].bitmapLength = 1;
+	entries[1].cacheKey = 0x10000002;
+	entries[1].bitmapLength = 1;
+	offer.cacheEntriesCount = ARRAYSIZE(entries);
+	offer.cacheEntries = entries;
+
+	if ((shadow_gfx_cache_import(cache, &offer, importSlots) != ARRAYSIZE(entries)) ||
+	    !importSlots[0] || !importSlots[1])
+		goto fail;
+
+	/* every slot is taken, the imported entries go before the oldest added one */
+	for (x = 0; x < 3; x++)
+	{
+		slot = shadow_gfx_cache_add(cache, 0x20000000 + x, 1, evicted, ARRAYSIZE(evicted),
+		                            &evictedCount);
+
+		if (!slot || (evictedCount != 1) || (evicted[0] != slot))
+			goto fail;
+
+		if ((x < 2) && (slot != importSlots[1 - x]))
+			goto fail;
+	}
+
+	if (shadow_gfx_cache_lookup(cache, 1) || !shadow_gfx_cache_lookup(cache, 2) ||
+	    shadow_gfx_cache_lookup(cache, entries[0].cacheKey) ||
+	    shadow_gfx_cache_lookup(cache, entries[1].cacheKey))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (!rc)
+		fprintf(stderr, "%s failed\n", __FUNCTION__);
+
+	shadow_gfx_cache_free(cache);
+	return rc;
+}
+
+int TestShadowGfxCache(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_gfx_cache_wrapped_delete())
+		return -1;
+
+	if (!test_gfx_cache_wrapped_chains())
+		return -1;
+
+	if (!test_gfx_cache_slots())
+		return -1;
+
+	return 0;
+}
@@ -322,10 +322,20 @@ typedef void* (*HASH_TABLE_VALUE_CLONE_FN)(void* value);
 typedef void (*HASH_TABLE_KEY_FREE_FN)(void* key);
 typedef void (*HASH_TABLE_VALUE_FREE_FN)(void* value);
 
+typedef struct _wHashTableSlot wHashTableSlot;
+
+/**
+ * Store keys and values inline in a single open addressing array (Robin
+ * Hood hashing) instead of chaining allocated wKeyValuePair nodes.
+ * numOfBuckets is the number of slots in this mode.
+ */
+#define HASHTABLE_FLAG_OPEN_ADDRESSING	0x00000001
+
 struct _wHashTable
 {
 	BOOL synchronized;
 	CRITICAL_SECTION lock;
+	DWORD flags;
 
 	int numOfBuckets;
 	int numOfElements;
@@ -333,6 +343,8 @@ struct _wHashTable
 	float lowerRehashThreshold;
 	float upperRehashThreshold;
 	wKeyValuePair** bucketArray;
+	wHashTableSlot* slotArray;
+	int slotShift;
 
 	HASH_TABLE_HASH_FN hash;
 	HASH_TABLE_KEY_COMPARE_FN keyCompare;
@@ -364,17 +376,18 @@ WINPR_API void* HashTable_StringClone(void* str);
 WINPR_API void HashTable_StringFree(void* str);
 
 WINPR_API wHashTable* HashTable_New(BOOL synchronized);
+WINPR_API wHashTable* HashTable_NewEx(BOOL synchronized, DWORD flags);
 WINPR_API void HashTable_Free(wHashTable* table);
 
 /* BufferPool */
 
-struct _wBufferPoolItem
-{
-	int size;
-	void* buffer;
-};
 typedef struct _wBufferPoolItem wBufferPoolItem;
 
+/**
+ * Variable size buffers carry a hidden header in front of the buffer and
+ * are kept in power of two size class free lists (see wStreamPool).
+ */
+
 struct _wBufferPool
 {
 	int fixedSize;
@@ -387,12 +400,13 @@ struct _wBufferPool
 	void** array;
 
 	int aSize;
-	int aCapacity;
-	wBufferPoolItem* aArray;
+	wBufferPoolItem* aList[WINPR_POOL_SIZE_CLASSES];
 
 	int uSize;
-	int uCapacity;
-	wBufferPoolItem* uArray;
+	wBufferPoolItem* uList;
+	wHashTable* uTable;
+
+	wPoolStatistics stats;
 };
 typedef struct _wBufferPool wBufferPool;
 
@@ -402,6 +416,7 @@ WINPR_API int BufferPool_GetBufferSize(wBufferPool* pool, void* buffer);
 WINPR_API void* BufferPool_Take(wBufferPool* pool, int bufferSize);
 WINPR_API BOOL BufferPool_Return(wBufferPool* pool, void* buffer);
 WINPR_API void BufferPool_Clear(wBufferPool* pool);
+WINPR_API BOOL BufferPool_GetStatistics(wBufferPool* pool, wPoolStatistics* stats);
 
 WINPR_API wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment);
 WINPR_API void BufferPool_Free(wBufferPool* pool);
@@ -444,6 +459,8 @@ struct _wMessage
 	MESSAGE_FREE_FN Free;
 };
 
+typedef struct _wMessageQueueCell wMessageQueueCell;
+
 struct _wMessageQueue
 {
 	int head;
@@ -455,11 +472,28 @@ struct _wMessageQueue
 	HANDLE event;
 
 	wObject object;
+
+	/* WMQ_FLAG_LOCKFREE only */
+	DWORD flags;
+	LONG volatile pending;
+	LONG volatile enqueuePos;
+	LONG dequeuePos;
+	LONG ringMask;
+	wMessageQueueCell* ring;
 };
 typedef struct _wMessageQueue wMessageQueue;
 
 #define WMQ_QUIT	0xFFFFFFFF
 
+/**
+ * Producers post into a bounded lock-free ring instead of taking the queue
+ * lock, the array above is only used as overflow when the ring is full.
+ * The queue event is only signalled on the empty to non-empty transition.
+ * Consumers are still serialized, so this pays off for queues with many
+ * producers and a single consumer.
+ */
+#define WMQ_FLAG_LOCKFREE	0x00000001
+
 WINPR_API HANDLE MessageQueue_Event(wMessageQueue* queue);
 WINPR_API BOOL MessageQueue_Wait(wMessageQueue* queue);
 WINPR_API int MessageQueue_Size(wMessageQueue* queue);
@@ -472,6 +506,14 @@ WINPR_API BOOL MessageQueue_PostQuit(wMessageQueue* queue, int nExitCode);
 WINPR_API int MessageQueue_Get(wMessageQueue* queue, wMessage* message);
 WINPR_API int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove);
 
+/*! \brief Removes up to 'count' messages from a message queue.
+ *         Blocks until at least one message is available. A WMQ_QUIT
+ *         message is always the last one returned in a batch.
+ *
+ * \return The number of messages stored in 'messages' or -1 on failure.
+ */
+WINPR_API int MessageQueue_GetBatch(wMessageQueue* queue, wMessage* messages, int count);
+
 /*! \brief Clears all elements in a message queue.
  *
  *  \note If dynamically allocated data is part of the messages,
@@ -497,6 +539,7 @@ WINPR_API int MessageQueue_Clear(wMessageQueue* queue);
  * \return A pointer to a newly allocated MessageQueue or NULL.
  */
 WINPR_API wMessageQueue* MessageQueue_New(const wObject* callback);
+WINPR_API wMessageQueue* MessageQueue_NewEx(const wObject* callback, DWORD flags);
 
 /*! \brief Frees resources allocated by a message queue.
  * 				 This function will only free resources allocated
@@ -267,6 +267,23 @@ WINPR_API VOID winpr_DisassociateCurrentThreadFromCallback(PTP_CALLBACK_INSTANCE
 
 #endif
 
+/* WinPR extensions, also usable on top of the native thread pool */
+
+/**
+ * Submits several work objects at once. All of them should belong to the
+ * same pool, the WinPR pool then only signals its workers once.
+ */
+WINPR_API VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* pwk, DWORD count);
+
+/**
+ * Pins each worker thread of the pool to one processor (round robin).
+ * Returns FALSE if not supported on this platform.
+ */
+WINPR_API BOOL winpr_SetThreadpoolThreadAffinity(PTP_POOL ptpp, BOOL fEnable);
+
+#define SubmitThreadpoolWorkBatch winpr_SubmitThreadpoolWorkBatch
+#define SetThreadpoolThreadAffinity winpr_SetThreadpoolThreadAffinity
+
 #ifdef __cplusplus
 }
 #endif
@@ -370,13 +370,34 @@ static INLINE BOOL Stream_Write_UTF16_String(wStream* s, const WCHAR* src, size_
 	return TRUE;
 }
 
+/* Pool Statistics, shared by StreamPool and BufferPool */
+
+#define WINPR_POOL_SIZE_CLASSES	32
+
+struct _wPoolStatistics
+{
+	UINT64 hits; /* takes served from a free list */
+	UINT64 misses; /* takes that had to allocate */
+	size_t inUse; /* handed out and not yet returned */
+	size_t cached; /* sitting in the free lists */
+	size_t highWaterMark; /* maximum of inUse */
+};
+typedef struct _wPoolStatistics wPoolStatistics;
+
 /* StreamPool */
 
+typedef struct _wStreamPoolItem wStreamPoolItem;
+
+/**
+ * Available streams are kept in power of two size class free lists, class n
+ * holds streams with a capacity of at least 2^n bytes. Streams in use are
+ * tracked in uArray, each stream remembers its own index there.
+ */
+
 struct _wStreamPool
 {
 	int aSize;
-	int aCapacity;
-	wStream** aArray;
+	wStreamPoolItem* aList[WINPR_POOL_SIZE_CLASSES];
 
 	int uSize;
 	int uCapacity;
@@ -385,6 +406,7 @@ struct _wStreamPool
 	CRITICAL_SECTION lock;
 	BOOL synchronized;
 	size_t defaultSize;
+	wPoolStatistics stats;
 };
 
 WINPR_API wStream* StreamPool_Take(wStreamPool* pool, size_t size);
@@ -398,6 +420,7 @@ WINPR_API void StreamPool_AddRef(wStreamPool* pool, BYTE* ptr);
 WINPR_API void StreamPool_Release(wStreamPool* pool, BYTE* ptr);
 
 WINPR_API void StreamPool_Clear(wStreamPool* pool);
+WINPR_API BOOL StreamPool_GetStatistics(wStreamPool* pool, wPoolStatistics* stats);
 
 WINPR_API wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize);
 WINPR_API void StreamPool_Free(wStreamPool* pool);
@@ -412,6 +412,35 @@ WINPR_API int SetEventFileDescriptor(HANDLE hEvent, int FileDescriptor, ULONG mo
 
 WINPR_API void* GetEventWaitObject(HANDLE hEvent);
 
+/**
+ * Wait Set
+ *
+ * A set of handles that is waited on repeatedly. Unlike WaitForMultipleObjects
+ * the handles are only registered once (with epoll where available), so
+ * event loops do not pay for rebuilding the wait list on every iteration.
+ * WaitForWaitSet behaves like WaitForMultipleObjects with bWaitAll = FALSE:
+ * the lowest signalled index is returned. WaitForWaitSetEx stores up to *lpCount
+ * signalled indices in ascending order instead and returns WAIT_OBJECT_0, so a
+ * loop can serve everything that is ready without favouring low indices.
+ * Where epoll is used the set is not limited to MAXIMUM_WAIT_OBJECTS handles,
+ * WaitSetGetMaxCount tells how many handles fit.
+ */
+
+typedef struct _WAIT_SET WAIT_SET, *PWAIT_SET;
+
+WINPR_API PWAIT_SET CreateWaitSet(void);
+WINPR_API VOID CloseWaitSet(PWAIT_SET pWaitSet);
+
+WINPR_API BOOL WaitSetAddHandle(PWAIT_SET pWaitSet, HANDLE hHandle);
+WINPR_API BOOL WaitSetRemoveHandle(PWAIT_SET pWaitSet, HANDLE hHandle);
+WINPR_API VOID WaitSetClear(PWAIT_SET pWaitSet);
+WINPR_API DWORD WaitSetGetCount(PWAIT_SET pWaitSet);
+WINPR_API DWORD WaitSetGetMaxCount(PWAIT_SET pWaitSet);
+
+WINPR_API DWORD WaitForWaitSet(PWAIT_SET pWaitSet, DWORD dwMilliseconds);
+WINPR_API DWORD WaitForWaitSetEx(PWAIT_SET pWaitSet, DWORD dwMilliseconds, DWORD* lpIndices,
+                                 DWORD* lpCount);
+
 #ifdef __cplusplus
 }
 #endif
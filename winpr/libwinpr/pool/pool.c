@@ -21,9 +21,18 @@
 #include "config.h"
 #endif
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/library.h>
+#include <winpr/interlocked.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
 
 #include "pool.h"
 
@@ -54,36 +63,174 @@ static TP_POOL DEFAULT_POOL =
 {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
-	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
 };
 
+static BOOL thread_pool_worker_push(TP_WORKER* worker, PTP_CALLBACK_INSTANCE* callbacks,
+                                    DWORD count)
+{
+	DWORD index;
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count + count > worker->Capacity)
+	{
+		size_t capacity = worker->Capacity ? worker->Capacity : 32;
+		PTP_CALLBACK_INSTANCE* items;
+
+		while (capacity < worker->Count + count)
+			capacity *= 2;
+
+		if (!(items = (PTP_CALLBACK_INSTANCE*) calloc(capacity, sizeof(PTP_CALLBACK_INSTANCE))))
+		{
+			LeaveCriticalSection(&worker->Lock);
+			return FALSE;
+		}
+
+		for (index = 0; index < worker->Count; index++)
+			items[index] = worker->Items[(worker->Head + index) % worker->Capacity];
+
+		free(worker->Items);
+		worker->Items = items;
+		worker->Capacity = capacity;
+		worker->Head = 0;
+	}
+
+	for (index = 0; index < count; index++)
+	{
+		worker->Items[(worker->Head + worker->Count) % worker->Capacity] = callbacks[index];
+		worker->Count++;
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+	return TRUE;
+}
+
+/**
+ * The owner takes the most recent callback, thieves take the oldest one.
+ */
+static PTP_CALLBACK_INSTANCE thread_pool_worker_pop(TP_WORKER* worker, BOOL steal)
+{
+	PTP_CALLBACK_INSTANCE callback = NULL;
+
+	/* unlocked peek, avoids touching the lock of idle workers */
+	if (worker->Count < 1)
+		return NULL;
+
+	EnterCriticalSection(&worker->Lock);
+
+	if (worker->Count > 0)
+	{
+		if (steal)
+		{
+			callback = worker->Items[worker->Head];
+			worker->Head = (worker->Head + 1) % worker->Capacity;
+		}
+		else
+			callback = worker->Items[(worker->Head + worker->Count - 1) % worker->Capacity];
+
+		worker->Count--;
+	}
+
+	LeaveCriticalSection(&worker->Lock);
+	return callback;
+}
+
+/**
+ * Workers are added while others already run, the count is published with
+ * an interlocked increment after the worker slot is filled.
+ */
+static INLINE LONG thread_pool_worker_count(PTP_POOL pool)
+{
+	return InterlockedCompareExchange(&pool->WorkerCount, 0, 0);
+}
+
+static PTP_CALLBACK_INSTANCE thread_pool_next_callback(PTP_POOL pool, TP_WORKER* worker)
+{
+	LONG index;
+	const LONG count = thread_pool_worker_count(pool);
+	PTP_CALLBACK_INSTANCE callback = thread_pool_worker_pop(worker, FALSE);
+
+	for (index = 1; !callback && (index < count); index++)
+	{
+		TP_WORKER* victim = pool->Workers[(worker->Index + index) % count];
+
+		if (victim != worker)
+			callback = thread_pool_worker_pop(victim, TRUE);
+	}
+
+	if (callback)
+		InterlockedDecrement(&pool->Pending);
+
+	return callback;
+}
+
+#if defined(__linux__)
+static void thread_pool_worker_set_affinity(TP_WORKER* worker, const cpu_set_t* initial,
+        BOOL enable)
+{
+	int cpu;
+	int target;
+	cpu_set_t set;
+
+	if (!enable)
+	{
+		sched_setaffinity(0, sizeof(cpu_set_t), initial);
+		return;
+	}
+
+	/* n-th processor of the ones the process may run on */
+	target = (int)(worker->Index % (DWORD) CPU_COUNT(initial));
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, initial))
+			continue;
+
+		if (target-- == 0)
+		{
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			sched_setaffinity(0, sizeof(cpu_set_t), &set);
+			break;
+		}
+	}
+}
+#endif
+
 static DWORD WINAPI thread_pool_work_func(LPVOID arg)
 {
 	DWORD status;
 	PTP_POOL pool;
 	PTP_WORK work;
+	TP_WORKER* worker;
 	HANDLE events[2];
 	PTP_CALLBACK_INSTANCE callbackInstance;
+#if defined(__linux__)
+	cpu_set_t initial;
 
-	pool = (PTP_POOL) arg;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &initial) != 0)
+		CPU_ZERO(&initial);
+#endif
+
+	worker = (TP_WORKER*) arg;
+	pool = worker->Pool;
 
 	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	events[1] = pool->WorkEvent;
 
 	while (1)
 	{
-		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		if (worker->Affinity != pool->Affinity)
+		{
+			worker->Affinity = pool->Affinity;
+#if defined(__linux__)
 
-		if (status == WAIT_OBJECT_0)
-			break;
+			if (CPU_COUNT(&initial) > 0)
+				thread_pool_worker_set_affinity(worker, &initial, worker->Affinity);
 
-		if (status != (WAIT_OBJECT_0 + 1))
-			break;
+#endif
+		}
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE) Queue_Dequeue(pool->PendingQueue);
+		callbackInstance = thread_pool_next_callback(pool, worker);
 
 		if (callbackInstance)
 		{
@@ -91,73 +238,227 @@ static DWORD WINAPI thread_pool_work_func(LPVOID arg)
 			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
 			CountdownEvent_Signal(pool->WorkComplete, 1);
 			free(callbackInstance);
+			continue;
 		}
+
+		/* a counted callback is just being taken by another worker */
+		if (InterlockedCompareExchange(&pool->Pending, 0, 0) > 0)
+		{
+			SwitchToThread();
+			continue;
+		}
+
+		ResetEvent(pool->WorkEvent);
+
+		/* a submission may have raced with the reset */
+		if (InterlockedCompareExchange(&pool->Pending, 0, 0) > 0)
+		{
+			SetEvent(pool->WorkEvent);
+			continue;
+		}
+
+		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+
+		if (status != (WAIT_OBJECT_0 + 1))
+			break;
 	}
 
 	ExitThread(0);
 	return 0;
 }
 
-static void threads_close(void *thread)
+static void thread_pool_worker_free(TP_WORKER* worker)
 {
-	WaitForSingleObject(thread, INFINITE);
-	CloseHandle(thread);
+	size_t index;
+
+	if (!worker)
+		return;
+
+	for (index = 0; index < worker->Count; index++)
+		free(worker->Items[(worker->Head + index) % worker->Capacity]);
+
+	DeleteCriticalSection(&worker->Lock);
+	free(worker->Items);
+	free(worker);
 }
 
-static BOOL InitializeThreadpool(PTP_POOL pool)
+static BOOL thread_pool_add_worker(PTP_POOL pool)
 {
-	int index;
-	HANDLE thread;
+	TP_WORKER* worker;
+	const LONG index = pool->WorkerCount;
 
-	if (pool->Threads)
-		return TRUE;
+	if (index >= TP_POOL_MAX_WORKERS)
+		return FALSE;
 
-	pool->Minimum = 0;
-	pool->Maximum = 500;
+	if (!(worker = (TP_WORKER*) calloc(1, sizeof(TP_WORKER))))
+		return FALSE;
 
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail_queue_new;
+	worker->Pool = pool;
+	worker->Index = (DWORD) index;
 
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail_countdown_event;
+	if (!InitializeCriticalSectionAndSpinCount(&worker->Lock, 4000))
+	{
+		free(worker);
+		return FALSE;
+	}
 
-	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
-		goto fail_terminate_event;
+	pool->Workers[index] = worker;
+
+	if (!(worker->Thread = CreateThread(NULL, 0,
+	                                    thread_pool_work_func,
+	                                    (void*) worker, 0, NULL)))
+	{
+		pool->Workers[index] = NULL;
+		thread_pool_worker_free(worker);
+		return FALSE;
+	}
 
-	if (!(pool->Threads = ArrayList_New(TRUE)))
-		goto fail_thread_array;
+	InterlockedIncrement(&pool->WorkerCount);
+	return TRUE;
+}
+
+/**
+ * Workers are started by the first submission or a minimum, so a maximum set
+ * right after creating the pool still applies. Workers that already run are kept when
+ * the maximum is lowered later on.
+ */
+static LONG thread_pool_worker_target(PTP_POOL pool)
+{
+	DWORD target = (pool->Minimum > TP_POOL_DEFAULT_WORKERS) ? pool->Minimum :
+	               TP_POOL_DEFAULT_WORKERS;
 
-	pool->Threads->object.fnObjectFree = threads_close;
+	if (target > pool->Maximum)
+		target = pool->Maximum;
 
-	for (index = 0; index < 4; index++)
+	if (target > TP_POOL_MAX_WORKERS)
+		target = TP_POOL_MAX_WORKERS;
+
+	return (target > 0) ? (LONG) target : 1;
+}
+
+static BOOL thread_pool_start_workers(PTP_POOL pool)
+{
+	BOOL rc = TRUE;
+	EnterCriticalSection(&pool->Lock);
+
+	while (pool->WorkerCount < thread_pool_worker_target(pool))
 	{
-		if (!(thread = CreateThread(NULL, 0,
-					thread_pool_work_func,
-					(void*) pool, 0, NULL)))
+		if (!thread_pool_add_worker(pool))
 		{
-			goto fail_create_threads;
+			rc = FALSE;
+			break;
 		}
+	}
+
+	LeaveCriticalSection(&pool->Lock);
+	return rc;
+}
+
+static void thread_pool_close_workers(PTP_POOL pool)
+{
+	LONG index;
+
+	SetEvent(pool->TerminateEvent);
+
+	/* workers still running may steal from any other worker */
+	for (index = 0; index < pool->WorkerCount; index++)
+		WaitForSingleObject(pool->Workers[index]->Thread, INFINITE);
 
-		if (ArrayList_Add(pool->Threads, thread) < 0)
-			goto fail_create_threads;
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		TP_WORKER* worker = pool->Workers[index];
+		CloseHandle(worker->Thread);
+		thread_pool_worker_free(worker);
+		pool->Workers[index] = NULL;
 	}
 
+	pool->WorkerCount = 0;
+	pool->Pending = 0;
+}
+
+DWORD ThreadpoolSubmitCallbacks(PTP_POOL pool, PTP_CALLBACK_INSTANCE* callbacks, DWORD count)
+{
+	DWORD index;
+	DWORD chunk;
+	DWORD offset = 0;
+	LONG first;
+	LONG pending;
+	LONG workers = thread_pool_worker_count(pool);
+
+	if (count < 1)
+		return 0;
+
+	if (workers < 1)
+	{
+		thread_pool_start_workers(pool);
+
+		if ((workers = thread_pool_worker_count(pool)) < 1)
+			return 0;
+	}
+
+	CountdownEvent_AddCount(pool->WorkComplete, count);
+	first = InterlockedExchangeAdd(&pool->NextWorker, (LONG) count);
+
+	/* hand out consecutive callbacks in chunks, the workers balance by stealing */
+	chunk = (count + (DWORD) workers - 1) / (DWORD) workers;
+
+	for (index = 0; offset < count; index++)
+	{
+		const DWORD length = (count - offset < chunk) ? (count - offset) : chunk;
+		TP_WORKER* worker = pool->Workers[((ULONG) first + index) % (ULONG) workers];
+
+		if (!thread_pool_worker_push(worker, &callbacks[offset], length))
+			break;
+
+		offset += length;
+	}
+
+	if (offset < count)
+		CountdownEvent_Signal(pool->WorkComplete, count - offset);
+
+	if (offset > 0)
+	{
+		pending = InterlockedExchangeAdd(&pool->Pending, (LONG) offset);
+
+		/* only wake the workers on the idle to busy transition */
+		if ((pending <= 0) && (pending + (LONG) offset > 0))
+			SetEvent(pool->WorkEvent);
+	}
+
+	return offset;
+}
+
+static BOOL InitializeThreadpool(PTP_POOL pool)
+{
+	if (pool->WorkComplete)
+		return TRUE;
+
+	pool->Minimum = 0;
+	pool->Maximum = 500;
+
+	if (!InitializeCriticalSectionAndSpinCount(&pool->Lock, 4000))
+		goto fail_lock;
+
+	if (!(pool->WorkComplete = CountdownEvent_New(0)))
+		goto fail_countdown_event;
+
+	if (!(pool->WorkEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail_work_event;
+
+	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail_terminate_event;
+
 	return TRUE;
 
-fail_create_threads:
-	SetEvent(pool->TerminateEvent);
-	ArrayList_Free(pool->Threads);
-	pool->Threads = NULL;
-fail_thread_array:
-	CloseHandle(pool->TerminateEvent);
-	pool->TerminateEvent = NULL;
 fail_terminate_event:
+	CloseHandle(pool->WorkEvent);
+	pool->WorkEvent = NULL;
+fail_work_event:
 	CountdownEvent_Free(pool->WorkComplete);
 	pool->WorkComplete = NULL;
 fail_countdown_event:
-	Queue_Free(pool->PendingQueue);
-	pool->WorkComplete = NULL;
-fail_queue_new:
+	DeleteCriticalSection(&pool->Lock);
+fail_lock:
 
 	return FALSE;
 }
@@ -204,19 +505,18 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
-
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
+	thread_pool_close_workers(ptpp);
 	CountdownEvent_Free(ptpp->WorkComplete);
+	CloseHandle(ptpp->WorkEvent);
 	CloseHandle(ptpp->TerminateEvent);
+	DeleteCriticalSection(&ptpp->Lock);
 
 	if (ptpp == &DEFAULT_POOL)
 	{
-		ptpp->Threads = NULL;
-		ptpp->PendingQueue = NULL;
 		ptpp->WorkComplete = NULL;
+		ptpp->WorkEvent = NULL;
 		ptpp->TerminateEvent = NULL;
+		ptpp->Affinity = FALSE;
 	}
 	else
 	{
@@ -226,7 +526,6 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -234,20 +533,11 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 #endif
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < (INT64)ptpp->Minimum)
-	{
-		if (!(thread = CreateThread(NULL, 0,
-				thread_pool_work_func,
-				(void*) ptpp, 0, NULL)))
-		{
-			return FALSE;
-		}
-
-		if (ArrayList_Add(ptpp->Threads, thread) < 0)
-			return FALSE;
-	}
+	if (ptpp->Maximum < cthrdMic)
+		ptpp->Maximum = cthrdMic;
 
-	return TRUE;
+	/* workers beyond TP_POOL_MAX_WORKERS would only add contention */
+	return thread_pool_start_workers(ptpp);
 }
 
 VOID winpr_SetThreadpoolThreadMaximum(PTP_POOL ptpp, DWORD cthrdMost)
@@ -261,6 +551,29 @@ VOID winpr_SetThreadpoolThreadMaximum(PTP_POOL ptpp, DWORD cthrdMost)
 	}
 #endif
 	ptpp->Maximum = cthrdMost;
+
+	if (ptpp->Minimum > cthrdMost)
+		ptpp->Minimum = cthrdMost;
+
+	/* a pool that already runs grows to the new target */
+	if (thread_pool_worker_count(ptpp) > 0)
+		thread_pool_start_workers(ptpp);
 }
 
 #endif /* WINPR_THREAD_POOL defined */
+
+BOOL winpr_SetThreadpoolThreadAffinity(PTP_POOL ptpp, BOOL fEnable)
+{
+#if defined(WINPR_THREAD_POOL) && defined(__linux__)
+
+	if (!ptpp)
+		return FALSE;
+
+	/* workers apply it the next time they look for work */
+	ptpp->Affinity = fEnable;
+	SetEvent(ptpp->WorkEvent);
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
@@ -30,12 +30,39 @@ struct _TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+#define TP_POOL_MAX_WORKERS	256
+#define TP_POOL_DEFAULT_WORKERS	4
+
+/**
+ * Each worker owns a deque of pending callbacks. Submissions are spread
+ * round robin over the workers, a worker pops from the back of its own
+ * deque and steals from the front of the others once it ran dry.
+ */
+typedef struct _TP_WORKER
+{
+	PTP_POOL Pool;
+	DWORD Index;
+	HANDLE Thread;
+	CRITICAL_SECTION Lock;
+
+	size_t Head;
+	size_t Count;
+	size_t Capacity;
+	PTP_CALLBACK_INSTANCE* Items;
+	BOOL Affinity;
+} TP_WORKER;
+
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	CRITICAL_SECTION Lock;
+	LONG volatile WorkerCount;
+	TP_WORKER* Workers[TP_POOL_MAX_WORKERS];
+	LONG volatile NextWorker;
+	LONG volatile Pending;
+	BOOL Affinity;
+	HANDLE WorkEvent;
 	HANDLE TerminateEvent;
 	wCountdownEvent* WorkComplete;
 };
@@ -73,6 +100,7 @@ struct _TP_CLEANUP_GROUP
 };
 
 PTP_POOL GetDefaultThreadpool(void);
+DWORD ThreadpoolSubmitCallbacks(PTP_POOL pool, PTP_CALLBACK_INSTANCE* callbacks, DWORD count);
 
 #endif /* WINPR_POOL_PRIVATE_H */
 
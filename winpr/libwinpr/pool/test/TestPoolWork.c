@@ -122,6 +122,169 @@ fail:
 	return rc;
 }
 
+static LONG batchCount = 0;
+
+static void CALLBACK test_BatchCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	InterlockedIncrement(&batchCount);
+	InterlockedIncrement((LONG*) context);
+}
+
+static BOOL test3(void)
+{
+	DWORD index;
+	BOOL rc = FALSE;
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	PTP_WORK work[1000] = { 0 };
+	LONG done[ARRAYSIZE(work)] = { 0 };
+	printf("Batch submission\n");
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		return FALSE;
+	}
+
+	if (!SetThreadpoolThreadMinimum(pool, 8))
+	{
+		printf("SetThreadpoolThreadMinimum failure\n");
+		goto fail;
+	}
+
+	/* optional, not every platform supports it */
+	SetThreadpoolThreadAffinity(pool, TRUE);
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+	{
+		if (!(work[index] = CreateThreadpoolWork(test_BatchCallback, &done[index], &environment)))
+		{
+			printf("CreateThreadpoolWork failure\n");
+			goto fail;
+		}
+	}
+
+	/* the same work object submitted twice, then the whole batch */
+	SubmitThreadpoolWork(work[0]);
+	SubmitThreadpoolWorkBatch(work, ARRAYSIZE(work));
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+		WaitForThreadpoolWorkCallbacks(work[index], FALSE);
+
+	if (batchCount != ARRAYSIZE(work) + 1)
+	{
+		printf("Expected %"PRIuz" callbacks, got %"PRId32"\n", ARRAYSIZE(work) + 1, batchCount);
+		goto fail;
+	}
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+	{
+		if (done[index] != ((index == 0) ? 2 : 1))
+		{
+			printf("Work %"PRIu32" ran %"PRId32" times\n", index, done[index]);
+			goto fail;
+		}
+	}
+
+	SetThreadpoolThreadAffinity(pool, FALSE);
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+	{
+		if (work[index])
+			CloseThreadpoolWork(work[index]);
+	}
+
+	CloseThreadpool(pool);
+	return rc;
+}
+
+static CRITICAL_SECTION maximumLock;
+static DWORD maximumThreads[64];
+static DWORD maximumThreadCount = 0;
+
+static void CALLBACK test_MaximumCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+        PTP_WORK work)
+{
+	DWORD index;
+	const DWORD id = GetCurrentThreadId();
+	EnterCriticalSection(&maximumLock);
+
+	for (index = 0; index < maximumThreadCount; index++)
+	{
+		if (maximumThreads[index] == id)
+			break;
+	}
+
+	if ((index == maximumThreadCount) && (index < ARRAYSIZE(maximumThreads)))
+		maximumThreads[maximumThreadCount++] = id;
+
+	LeaveCriticalSection(&maximumLock);
+	InterlockedIncrement((LONG*) context);
+	Sleep(1);
+}
+
+/* a maximum set before the first submission limits the workers started */
+static BOOL test4(void)
+{
+	DWORD index;
+	BOOL rc = FALSE;
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	PTP_WORK work[64] = { 0 };
+	LONG done = 0;
+	printf("Thread maximum\n");
+
+	if (!InitializeCriticalSectionAndSpinCount(&maximumLock, 0))
+		return FALSE;
+
+	if (!(pool = CreateThreadpool(NULL)))
+	{
+		printf("CreateThreadpool failure\n");
+		DeleteCriticalSection(&maximumLock);
+		return FALSE;
+	}
+
+	SetThreadpoolThreadMaximum(pool, 2);
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+	{
+		if (!(work[index] = CreateThreadpoolWork(test_MaximumCallback, &done, &environment)))
+		{
+			printf("CreateThreadpoolWork failure\n");
+			goto fail;
+		}
+	}
+
+	SubmitThreadpoolWorkBatch(work, ARRAYSIZE(work));
+	WaitForThreadpoolWorkCallbacks(work[0], FALSE);
+
+	if ((done != ARRAYSIZE(work)) || (maximumThreadCount > 2))
+	{
+		printf("%"PRId32" callbacks ran on %"PRIu32" threads\n", done, maximumThreadCount);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < ARRAYSIZE(work); index++)
+	{
+		if (work[index])
+			CloseThreadpoolWork(work[index]);
+	}
+
+	CloseThreadpool(pool);
+	DeleteCriticalSection(&maximumLock);
+	return rc;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 	if (!test1())
@@ -130,5 +293,11 @@ int TestPoolWork(int argc, char* argv[])
 	if (!test2())
 		return -1;
 
+	if (!test3())
+		return -1;
+
+	if (!test4())
+		return -1;
+
 	return 0;
 }
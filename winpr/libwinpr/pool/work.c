@@ -124,6 +124,14 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 	free(pwk);
 }
 
+static void thread_pool_run_inline(PTP_WORK pwk)
+{
+	TP_CALLBACK_INSTANCE callbackInstance = { 0 };
+	WLog_WARN(TAG, "thread pool submission failed, running the work callback inline");
+	callbackInstance.Work = pwk;
+	pwk->WorkCallback(&callbackInstance, pwk->CallbackParameter, pwk);
+}
+
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
 	PTP_POOL pool;
@@ -144,9 +152,14 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 	if (callbackInstance)
 	{
 		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
+
+		if (ThreadpoolSubmitCallbacks(pool, &callbackInstance, 1) == 1)
+			return;
+
+		free(callbackInstance);
 	}
+
+	thread_pool_run_inline(pwk);
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
@@ -185,3 +198,59 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 }
 
 #endif /* WINPR_THREAD_POOL defined */
+
+VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* pwk, DWORD count)
+{
+	DWORD index;
+#ifdef WINPR_THREAD_POOL
+	PTP_POOL pool;
+	DWORD submitted;
+	PTP_CALLBACK_INSTANCE* callbacks;
+#ifdef _WIN32
+	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
+
+	if (pSubmitThreadpoolWork)
+		goto fallback;
+
+#endif
+
+	if (!pwk || (count < 1))
+		return;
+
+	pool = pwk[0]->CallbackEnvironment->Pool;
+
+	for (index = 1; index < count; index++)
+	{
+		if (pwk[index]->CallbackEnvironment->Pool != pool)
+			goto fallback;
+	}
+
+	if (!(callbacks = (PTP_CALLBACK_INSTANCE*) calloc(count, sizeof(PTP_CALLBACK_INSTANCE))))
+		goto fallback;
+
+	for (index = 0; index < count; index++)
+	{
+		if (!(callbacks[index] = (PTP_CALLBACK_INSTANCE) calloc(1, sizeof(TP_CALLBACK_INSTANCE))))
+			break;
+
+		callbacks[index]->Work = pwk[index];
+	}
+
+	submitted = ThreadpoolSubmitCallbacks(pool, callbacks, index);
+
+	for (index = submitted; index < count; index++)
+		free(callbacks[index]);
+
+	free(callbacks);
+
+	/* callers wait for every work object, what the pool did not take runs here */
+	for (index = submitted; index < count; index++)
+		thread_pool_run_inline(pwk[index]);
+
+	return;
+fallback:
+#endif
+
+	for (index = 0; index < count; index++)
+		SubmitThreadpoolWork(pwk[index]);
+}
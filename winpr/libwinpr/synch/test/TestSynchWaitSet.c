@@ -0,0 +1,252 @@
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+/* both handles are signalled, WaitForWaitSetEx has to report both in order */
+static BOOL test_wait_set_signalled(PWAIT_SET set, HANDLE first, HANDLE second, DWORD i1, DWORD i2)
+{
+	DWORD indices[4] = { 0 };
+	DWORD count = ARRAYSIZE(indices);
+	BOOL rc = FALSE;
+	SetEvent(second);
+	SetEvent(first);
+
+	if ((WaitForWaitSetEx(set, 0, indices, &count) != WAIT_OBJECT_0) || (count != 2) ||
+	    (indices[0] != i1) || (indices[1] != i2))
+	{
+		printf("expected events %"PRIu32" and %"PRIu32" to be signalled\n", i1, i2);
+		goto fail;
+	}
+
+	/* only as many as requested */
+	count = 1;
+
+	if ((WaitForWaitSetEx(set, 0, indices, &count) != WAIT_OBJECT_0) || (count != 1) ||
+	    (indices[0] != i1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	ResetEvent(first);
+	ResetEvent(second);
+	return rc;
+}
+
+static BOOL test_wait_set_events(void)
+{
+	int i;
+	BOOL rc = FALSE;
+	HANDLE events[3] = { NULL };
+	PWAIT_SET set;
+
+	if (!(set = CreateWaitSet()))
+		return FALSE;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!(events[i] = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+		    !WaitSetAddHandle(set, events[i]))
+		{
+			printf("failed to add event %d\n", i);
+			goto fail;
+		}
+	}
+
+	if (WaitSetGetCount(set) != 3)
+		goto fail;
+
+	if (WaitForWaitSet(set, 0) != WAIT_TIMEOUT)
+	{
+		printf("unexpected signal on an empty wait set\n");
+		goto fail;
+	}
+
+	/* the set is reused across waits */
+	for (i = 0; i < 10; i++)
+	{
+		SetEvent(events[2]);
+
+		if (WaitForWaitSet(set, INFINITE) != WAIT_OBJECT_0 + 2)
+		{
+			printf("expected event 2 to be signalled\n");
+			goto fail;
+		}
+
+		/* lowest index wins like with WaitForMultipleObjects */
+		SetEvent(events[1]);
+
+		if (WaitForWaitSet(set, 100) != WAIT_OBJECT_0 + 1)
+		{
+			printf("expected event 1 to be signalled\n");
+			goto fail;
+		}
+
+		ResetEvent(events[1]);
+		ResetEvent(events[2]);
+	}
+
+	if (!test_wait_set_signalled(set, events[0], events[2], 0, 2))
+		goto fail;
+
+	if (!WaitSetRemoveHandle(set, events[0]) || (WaitSetGetCount(set) != 2))
+		goto fail;
+
+	SetEvent(events[2]);
+
+	if (WaitForWaitSet(set, 0) != WAIT_OBJECT_0 + 1)
+	{
+		printf("expected indices to shift after removal\n");
+		goto fail;
+	}
+
+	WaitSetClear(set);
+
+	if ((WaitSetGetCount(set) != 0) || !WaitSetAddHandle(set, events[0]) ||
+	    (WaitForWaitSet(set, 0) != WAIT_TIMEOUT))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < 3; i++)
+	{
+		if (events[i])
+			CloseHandle(events[i]);
+	}
+
+	CloseWaitSet(set);
+	return rc;
+}
+
+static BOOL test_wait_set_shared(void)
+{
+	BOOL rc = FALSE;
+	HANDLE event;
+	HANDLE handles[2];
+	PWAIT_SET set;
+
+	if (!(set = CreateWaitSet()))
+		return FALSE;
+
+	if (!(event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		goto fail;
+
+	/* a handle added twice has to keep working */
+	handles[0] = event;
+	handles[1] = event;
+
+	if (!WaitSetAddHandle(set, handles[0]) || !WaitSetAddHandle(set, handles[1]))
+		goto fail;
+
+	SetEvent(event);
+
+	if (WaitForWaitSet(set, 0) != WAIT_OBJECT_0)
+		goto fail;
+
+	ResetEvent(event);
+
+	if (!test_wait_set_signalled(set, handles[0], handles[1], 0, 1))
+		goto fail;
+
+	/* without epoll the set is limited again */
+	if (WaitSetGetMaxCount(set) < WaitSetGetCount(set))
+		goto fail;
+
+	while (WaitSetGetCount(set) < WaitSetGetMaxCount(set))
+	{
+		if (!WaitSetAddHandle(set, event))
+			goto fail;
+	}
+
+	if ((WaitSetGetMaxCount(set) != MAXIMUM_WAIT_OBJECTS) || WaitSetAddHandle(set, event))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	if (event)
+		CloseHandle(event);
+
+	CloseWaitSet(set);
+	return rc;
+}
+
+static BOOL test_wait_set_large(void)
+{
+#if !defined(_WIN32) && defined(__linux__)
+	DWORD i;
+	BOOL rc = FALSE;
+	HANDLE events[MAXIMUM_WAIT_OBJECTS * 3] = { NULL };
+	const DWORD count = ARRAYSIZE(events);
+	PWAIT_SET set;
+
+	if (!(set = CreateWaitSet()))
+		return FALSE;
+
+	/* epoll is not limited to MAXIMUM_WAIT_OBJECTS */
+	for (i = 0; i < count; i++)
+	{
+		if (!(events[i] = CreateEvent(NULL, TRUE, FALSE, NULL)) ||
+		    !WaitSetAddHandle(set, events[i]))
+		{
+			printf("failed to add event %"PRIu32"\n", i);
+			goto fail;
+		}
+	}
+
+	if ((WaitForWaitSet(set, 0) != WAIT_TIMEOUT) || (WaitSetGetMaxCount(set) <= count))
+		goto fail;
+
+	if (!test_wait_set_signalled(set, events[1], events[count - 2], 1, count - 2))
+		goto fail;
+
+	SetEvent(events[count - 1]);
+
+	if (WaitForWaitSet(set, 0) != WAIT_OBJECT_0 + count - 1)
+	{
+		printf("expected the last event to be signalled\n");
+		goto fail;
+	}
+
+	if (!WaitSetRemoveHandle(set, events[0]) ||
+	    (WaitForWaitSet(set, 0) != WAIT_OBJECT_0 + count - 2))
+		goto fail;
+
+	rc = TRUE;
+fail:
+
+	for (i = 0; i < count; i++)
+	{
+		if (events[i])
+			CloseHandle(events[i]);
+	}
+
+	CloseWaitSet(set);
+	return rc;
+#else
+	return TRUE;
+#endif
+}
+
+int TestSynchWaitSet(int argc, char* argv[])
+{
+	if (WaitForWaitSet(NULL, 0) != WAIT_FAILED)
+		return -1;
+
+	if (!test_wait_set_events())
+		return -1;
+
+	if (!test_wait_set_shared())
+	{
+		printf("wait set with duplicate handles failed\n");
+		return -1;
+	}
+
+	if (!test_wait_set_large())
+	{
+		printf("wait set with more than %d handles failed\n", MAXIMUM_WAIT_OBJECTS);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,465 @@
+/**
+ * WinPR: Windows Portable Runtime
+ * Synchronization Functions
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include "../log.h"
+#define TAG WINPR_TAG("sync.waitset")
+
+/**
+ * CreateWaitSet
+ * CloseWaitSet
+ * WaitSetAddHandle
+ * WaitSetRemoveHandle
+ * WaitSetClear
+ * WaitSetGetCount
+ * WaitSetGetMaxCount
+ * WaitForWaitSet
+ * WaitForWaitSetEx
+ */
+
+#if !defined(_WIN32) && defined(HAVE_SYS_EPOLL_H)
+#define WINPR_WAIT_SET_EPOLL	1
+#endif
+
+#ifdef WINPR_WAIT_SET_EPOLL
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "../handle/handle.h"
+#endif
+
+struct _WAIT_SET
+{
+	DWORD count;
+	DWORD capacity;
+	HANDLE* handles;
+#ifdef WINPR_WAIT_SET_EPOLL
+	int epfd; /* -1 falls back to WaitForMultipleObjects */
+	int* fds;
+	ULONG* modes;
+	struct epoll_event* events;
+#endif
+};
+
+/**
+ * Only epoll can wait on more than MAXIMUM_WAIT_OBJECTS handles.
+ */
+static DWORD waitset_max_count(PWAIT_SET pWaitSet)
+{
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (pWaitSet->epfd >= 0)
+		return UINT32_MAX / sizeof(struct epoll_event);
+
+#endif
+	return MAXIMUM_WAIT_OBJECTS;
+}
+
+static BOOL waitset_grow(PWAIT_SET pWaitSet)
+{
+	void* tmp;
+	const DWORD capacity = pWaitSet->capacity ? pWaitSet->capacity * 2 : MAXIMUM_WAIT_OBJECTS;
+
+	if (!(tmp = realloc(pWaitSet->handles, capacity * sizeof(HANDLE))))
+		return FALSE;
+
+	pWaitSet->handles = (HANDLE*) tmp;
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (!(tmp = realloc(pWaitSet->fds, capacity * sizeof(int))))
+		return FALSE;
+
+	pWaitSet->fds = (int*) tmp;
+
+	if (!(tmp = realloc(pWaitSet->modes, capacity * sizeof(ULONG))))
+		return FALSE;
+
+	pWaitSet->modes = (ULONG*) tmp;
+
+	if (!(tmp = realloc(pWaitSet->events, capacity * sizeof(struct epoll_event))))
+		return FALSE;
+
+	pWaitSet->events = (struct epoll_event*) tmp;
+#endif
+	pWaitSet->capacity = capacity;
+	return TRUE;
+}
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+static BOOL waitset_query(HANDLE hHandle, int* fd, ULONG* mode)
+{
+	ULONG Type;
+	WINPR_HANDLE* Object;
+
+	if (!winpr_Handle_GetInfo(hHandle, &Type, &Object))
+		return FALSE;
+
+	*fd = winpr_Handle_getFd(Object);
+	*mode = Object->Mode;
+	return (*fd >= 0);
+}
+
+static BOOL waitset_register(PWAIT_SET pWaitSet, DWORD index, int op)
+{
+	struct epoll_event event;
+	ZeroMemory(&event, sizeof(event));
+
+	if (pWaitSet->modes[index] & WINPR_FD_READ)
+		event.events |= EPOLLIN;
+
+	if (pWaitSet->modes[index] & WINPR_FD_WRITE)
+		event.events |= EPOLLOUT;
+
+	event.data.u32 = index;
+	return epoll_ctl(pWaitSet->epfd, op, pWaitSet->fds[index], &event) == 0;
+}
+
+static void waitset_unregister(PWAIT_SET pWaitSet, DWORD index)
+{
+	struct epoll_event event;
+	ZeroMemory(&event, sizeof(event));
+	/* fails harmlessly if the descriptor was already closed */
+	epoll_ctl(pWaitSet->epfd, EPOLL_CTL_DEL, pWaitSet->fds[index], &event);
+}
+
+static void waitset_disable_epoll(PWAIT_SET pWaitSet, const char* reason)
+{
+	if (pWaitSet->epfd < 0)
+		return;
+
+	WLog_DBG(TAG, "falling back to WaitForMultipleObjects: %s", reason);
+	close(pWaitSet->epfd);
+	pWaitSet->epfd = -1;
+}
+
+/**
+ * Handles may change their descriptor (e.g. SetEventFileDescriptor), check
+ * them before each wait. This only touches memory, no system calls unless
+ * something changed.
+ */
+static BOOL waitset_sync(PWAIT_SET pWaitSet)
+{
+	DWORD index;
+
+	for (index = 0; index < pWaitSet->count; index++)
+	{
+		int fd;
+		ULONG mode;
+
+		if (!waitset_query(pWaitSet->handles[index], &fd, &mode))
+		{
+			SetLastError(ERROR_INVALID_HANDLE);
+			return FALSE;
+		}
+
+		if ((fd == pWaitSet->fds[index]) && (mode == pWaitSet->modes[index]))
+			continue;
+
+		if (pWaitSet->epfd >= 0)
+			waitset_unregister(pWaitSet, index);
+
+		pWaitSet->fds[index] = fd;
+		pWaitSet->modes[index] = mode;
+
+		if ((pWaitSet->epfd >= 0) && !waitset_register(pWaitSet, index, EPOLL_CTL_ADD))
+			waitset_disable_epoll(pWaitSet, strerror(errno));
+	}
+
+	return TRUE;
+}
+
+static int waitset_compare_events(const void* a, const void* b)
+{
+	const struct epoll_event* ea = (const struct epoll_event*) a;
+	const struct epoll_event* eb = (const struct epoll_event*) b;
+
+	if (ea->data.u32 < eb->data.u32)
+		return -1;
+
+	return (ea->data.u32 > eb->data.u32) ? 1 : 0;
+}
+
+static DWORD waitset_epoll_wait(PWAIT_SET pWaitSet, DWORD dwMilliseconds, DWORD* lpIndices,
+                                DWORD* lpCount)
+{
+	int i;
+	int status;
+	DWORD count = 0;
+
+	do
+	{
+		status = epoll_wait(pWaitSet->epfd, pWaitSet->events, (int) pWaitSet->count,
+		                    (dwMilliseconds == INFINITE) ? -1 : (int) dwMilliseconds);
+	}
+	while ((status < 0) && (errno == EINTR));
+
+	if (status < 0)
+	{
+		WLog_ERR(TAG, "epoll_wait() failure [%d] %s", errno, strerror(errno));
+		SetLastError(ERROR_INTERNAL_ERROR);
+		return WAIT_FAILED;
+	}
+
+	if (status == 0)
+		return WAIT_TIMEOUT;
+
+	/* same priority as WaitForMultipleObjects: lowest index first */
+	qsort(pWaitSet->events, (size_t) status, sizeof(struct epoll_event), waitset_compare_events);
+
+	/* the rest stays signalled and is reported by the next wait */
+	for (i = 0; (i < status) && (count < *lpCount); i++)
+	{
+		DWORD rc;
+		const DWORD index = pWaitSet->events[i].data.u32;
+
+		if (index >= pWaitSet->count)
+		{
+			SetLastError(ERROR_INTERNAL_ERROR);
+			return WAIT_FAILED;
+		}
+
+		rc = winpr_Handle_cleanup(pWaitSet->handles[index]);
+
+		if (rc != WAIT_OBJECT_0)
+			return rc;
+
+		lpIndices[count++] = index;
+	}
+
+	*lpCount = count;
+	return WAIT_OBJECT_0;
+}
+
+#endif
+
+PWAIT_SET CreateWaitSet(void)
+{
+	PWAIT_SET pWaitSet = (PWAIT_SET) calloc(1, sizeof(WAIT_SET));
+
+	if (!pWaitSet)
+		return NULL;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+	pWaitSet->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (pWaitSet->epfd < 0)
+		WLog_DBG(TAG, "epoll_create1() failure [%d] %s", errno, strerror(errno));
+
+#endif
+	return pWaitSet;
+}
+
+VOID CloseWaitSet(PWAIT_SET pWaitSet)
+{
+	if (!pWaitSet)
+		return;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (pWaitSet->epfd >= 0)
+		close(pWaitSet->epfd);
+
+	free(pWaitSet->fds);
+	free(pWaitSet->modes);
+	free(pWaitSet->events);
+#endif
+	free(pWaitSet->handles);
+	free(pWaitSet);
+}
+
+BOOL WaitSetAddHandle(PWAIT_SET pWaitSet, HANDLE hHandle)
+{
+	DWORD index;
+
+	if (!pWaitSet || (pWaitSet->count >= waitset_max_count(pWaitSet)))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	if ((pWaitSet->count >= pWaitSet->capacity) && !waitset_grow(pWaitSet))
+	{
+		SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+		return FALSE;
+	}
+
+	index = pWaitSet->count;
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (!waitset_query(hHandle, &pWaitSet->fds[index], &pWaitSet->modes[index]))
+	{
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if ((pWaitSet->epfd >= 0) && !waitset_register(pWaitSet, index, EPOLL_CTL_ADD))
+	{
+		if (errno != EEXIST)
+		{
+			WLog_ERR(TAG, "epoll_ctl() failure [%d] %s", errno, strerror(errno));
+			SetLastError(ERROR_INVALID_HANDLE);
+			return FALSE;
+		}
+
+		/* two handles share a descriptor, epoll can not tell them apart */
+		waitset_disable_epoll(pWaitSet, "shared file descriptor");
+	}
+
+#endif
+	pWaitSet->handles[index] = hHandle;
+	pWaitSet->count++;
+	return TRUE;
+}
+
+BOOL WaitSetRemoveHandle(PWAIT_SET pWaitSet, HANDLE hHandle)
+{
+	DWORD index;
+
+	if (!pWaitSet)
+		return FALSE;
+
+	for (index = 0; index < pWaitSet->count; index++)
+	{
+		if (pWaitSet->handles[index] == hHandle)
+			break;
+	}
+
+	if (index >= pWaitSet->count)
+		return FALSE;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (pWaitSet->epfd >= 0)
+		waitset_unregister(pWaitSet, index);
+
+#endif
+	pWaitSet->count--;
+
+	for (; index < pWaitSet->count; index++)
+	{
+		pWaitSet->handles[index] = pWaitSet->handles[index + 1];
+#ifdef WINPR_WAIT_SET_EPOLL
+		pWaitSet->fds[index] = pWaitSet->fds[index + 1];
+		pWaitSet->modes[index] = pWaitSet->modes[index + 1];
+
+		/* the index is the epoll cookie, update it */
+		if ((pWaitSet->epfd >= 0) && !waitset_register(pWaitSet, index, EPOLL_CTL_MOD))
+			waitset_disable_epoll(pWaitSet, strerror(errno));
+
+#endif
+	}
+
+	return TRUE;
+}
+
+VOID WaitSetClear(PWAIT_SET pWaitSet)
+{
+	if (!pWaitSet)
+		return;
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	/* a fresh instance is cheaper than removing every descriptor */
+	if (pWaitSet->epfd >= 0)
+		close(pWaitSet->epfd);
+
+	pWaitSet->epfd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+	pWaitSet->count = 0;
+}
+
+DWORD WaitSetGetCount(PWAIT_SET pWaitSet)
+{
+	if (!pWaitSet)
+		return 0;
+
+	return pWaitSet->count;
+}
+
+DWORD WaitSetGetMaxCount(PWAIT_SET pWaitSet)
+{
+	if (!pWaitSet)
+		return 0;
+
+	return waitset_max_count(pWaitSet);
+}
+
+DWORD WaitForWaitSet(PWAIT_SET pWaitSet, DWORD dwMilliseconds)
+{
+	DWORD index;
+	DWORD count = 1;
+	const DWORD status = WaitForWaitSetEx(pWaitSet, dwMilliseconds, &index, &count);
+
+	if (status != WAIT_OBJECT_0)
+		return status;
+
+	return WAIT_OBJECT_0 + index;
+}
+
+DWORD WaitForWaitSetEx(PWAIT_SET pWaitSet, DWORD dwMilliseconds, DWORD* lpIndices, DWORD* lpCount)
+{
+	DWORD index;
+	DWORD status;
+	DWORD count = 0;
+
+	if (!pWaitSet || (pWaitSet->count < 1) || !lpIndices || !lpCount || (*lpCount < 1))
+	{
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+#ifdef WINPR_WAIT_SET_EPOLL
+
+	if (!waitset_sync(pWaitSet))
+		return WAIT_FAILED;
+
+	if (pWaitSet->epfd >= 0)
+		return waitset_epoll_wait(pWaitSet, dwMilliseconds, lpIndices, lpCount);
+
+#endif
+
+	if (pWaitSet->count > MAXIMUM_WAIT_OBJECTS)
+	{
+		WLog_ERR(TAG, "%"PRIu32" handles need epoll", pWaitSet->count);
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return WAIT_FAILED;
+	}
+
+	status = WaitForMultipleObjects(pWaitSet->count, pWaitSet->handles, FALSE, dwMilliseconds);
+
+	if ((status < WAIT_OBJECT_0) || (status >= WAIT_OBJECT_0 + pWaitSet->count))
+		return status;
+
+	/* WaitForMultipleObjects only tells the lowest, poll the ones after it */
+	for (index = status - WAIT_OBJECT_0; (index < pWaitSet->count) && (count < *lpCount); index++)
+	{
+		if ((count == 0) || (WaitForSingleObject(pWaitSet->handles[index], 0) == WAIT_OBJECT_0))
+			lpIndices[count++] = index;
+	}
+
+	*lpCount = count;
+	return WAIT_OBJECT_0;
+}
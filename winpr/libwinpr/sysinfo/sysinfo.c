@@ -549,7 +549,7 @@ ULONGLONG winpr_GetTickCount64(void)
 /* If x86 */
 #ifdef _M_IX86_AMD64
 
-#if defined(__GNUC__) && defined(__AVX__)
+#if defined(__GNUC__)
 #define xgetbv(_func_, _lo_, _hi_) \
 	__asm__ __volatile__ ("xgetbv" : "=a" (_lo_), "=d" (_hi_) : "c" (_func_))
 #endif
@@ -574,6 +574,7 @@ ULONGLONG winpr_GetTickCount64(void)
 #define E_BIT_XMM       (1<<1)
 #define E_BIT_YMM       (1<<2)
 #define E_BITS_AVX      (E_BIT_XMM|E_BIT_YMM)
+#define B7_BIT_AVX2     (1<<5)
 
 static void cpuid(
     unsigned info,
@@ -599,11 +600,11 @@ static void cpuid(
 	    "xchg %%rbx, %%rsi;"
 #endif
 	    : "=a"(*eax), "=S"(*ebx), "=c"(*ecx), "=d"(*edx)
-	    : "0"(info)
+	    : "0"(info), "2"(0)
 	);
 #elif defined(_MSC_VER)
 	int a[4];
-	__cpuid(a, info);
+	__cpuidex(a, info, 0);
 	*eax = a[0];
 	*ebx = a[1];
 	*ecx = a[2];
@@ -915,9 +916,10 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 				ret = TRUE;
 
 		    break;
-#if defined(__GNUC__) && defined(__AVX__)
+#if defined(__GNUC__)
 
 	    case PF_EX_AVX:
+	    case PF_EX_AVX2:
 	    case PF_EX_FMA:
 	    case PF_EX_AVX_AES:
 	    case PF_EX_AVX_PCLMULQDQ:
@@ -938,6 +940,16 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 						    ret = TRUE;
 						    break;
 
+					    case PF_EX_AVX2:
+					        {
+						        unsigned a7, b7, c7, d7;
+								cpuid(7, &a7, &b7, &c7, &d7);
+
+								if (b7 & B7_BIT_AVX2)
+									ret = TRUE;
+					        }
+						    break;
+
 					    case PF_EX_FMA:
 						    if (c & C_BIT_FMA)
 								ret = TRUE;
@@ -959,7 +971,7 @@ BOOL IsProcessorFeaturePresentEx(DWORD ProcessorFeature)
 				}
 	        }
 		    break;
-#endif //__AVX__
+#endif //__GNUC__
 
 	    default:
 		    break;
@@ -30,62 +30,137 @@
  * http://msdn.microsoft.com/en-us/library/ms405814.aspx
  */
 
+/**
+ * Variable size buffers are preceded by a pool item, padded so that the
+ * buffer keeps the requested alignment.
+ */
+
+struct _wBufferPoolItem
+{
+	UINT32 magic;
+	UINT32 sizeClass;
+	int size; /* requested size, see BufferPool_GetBufferSize */
+	int capacity;
+	wBufferPoolItem* prev;
+	wBufferPoolItem* next;
+};
+
+#define BUFFERPOOL_MAGIC_USED	0x55534544
+#define BUFFERPOOL_MAGIC_FREE	0x46524545
+#define BUFFERPOOL_MIN_CLASS	6
+
 /**
  * Methods
  */
 
-static BOOL BufferPool_ShiftAvailable(wBufferPool* pool, int index, int count)
+static size_t BufferPool_ItemPadding(wBufferPool* pool)
 {
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			wBufferPoolItem *newArray;
-			int newCapacity = pool->aCapacity * 2;
+	size_t alignment = (pool->alignment > 16) ? pool->alignment : 16;
+	return (sizeof(wBufferPoolItem) + alignment - 1) & ~(alignment - 1);
+}
 
-			newArray = (wBufferPoolItem*) realloc(pool->aArray, sizeof(wBufferPoolItem) * newCapacity);
-			if (!newArray)
-				return FALSE;
-			pool->aArray = newArray;
-			pool->aCapacity = newCapacity;
-		}
+/**
+ * Buffers in use are looked up by address, a pointer the pool did not hand
+ * out must not be dereferenced to find its header.
+ */
+static wBufferPoolItem* BufferPool_GetItem(wBufferPool* pool, void* buffer)
+{
+	if (!buffer)
+		return NULL;
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wBufferPoolItem));
-		pool->aSize += count;
-	}
-	else if (count < 0)
-	{
-		MoveMemory(&pool->aArray[index], &pool->aArray[index - count], (pool->aSize - index) * sizeof(wBufferPoolItem));
-		pool->aSize += count;
-	}
-	return TRUE;
+	return (wBufferPoolItem*) HashTable_GetItemValue(pool->uTable, buffer);
 }
 
-static BOOL BufferPool_ShiftUsed(wBufferPool* pool, int index, int count)
+static void* BufferPool_GetItemBuffer(wBufferPool* pool, wBufferPoolItem* item)
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			int newUCapacity = pool->uCapacity * 2;
-			wBufferPoolItem *newUArray = (wBufferPoolItem *)realloc(pool->uArray, sizeof(wBufferPoolItem) *newUCapacity);
-			if (!newUArray)
-				return FALSE;
-			pool->uCapacity = newUCapacity;
-			pool->uArray = newUArray;
-		}
+	return &((BYTE*) item)[BufferPool_ItemPadding(pool)];
+}
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wBufferPoolItem));
-		pool->uSize += count;
-	}
-	else if (count < 0)
-	{
-		MoveMemory(&pool->uArray[index], &pool->uArray[index - count], (pool->uSize - index) * sizeof(wBufferPoolItem));
-		pool->uSize += count;
-	}
+static UINT32 BufferPool_SizeClass(int size)
+{
+	UINT32 sizeClass = BUFFERPOOL_MIN_CLASS;
+
+	while ((sizeClass + 1 < WINPR_POOL_SIZE_CLASSES) && ((1U << sizeClass) < (UINT32) size))
+		sizeClass++;
+
+	return sizeClass;
+}
+
+static wBufferPoolItem* BufferPool_NewItem(wBufferPool* pool, int size, UINT32 sizeClass)
+{
+	wBufferPoolItem* item;
+	const size_t padding = BufferPool_ItemPadding(pool);
+
+	if (pool->alignment)
+		item = (wBufferPoolItem*) _aligned_malloc(padding + (size_t) size, pool->alignment);
+	else
+		item = (wBufferPoolItem*) malloc(padding + (size_t) size);
+
+	if (!item)
+		return NULL;
+
+	ZeroMemory(item, sizeof(wBufferPoolItem));
+	item->sizeClass = sizeClass;
+	item->capacity = size;
+	return item;
+}
+
+static void BufferPool_FreeItem(wBufferPool* pool, wBufferPoolItem* item)
+{
+	item->magic = 0;
+
+	if (pool->alignment)
+		_aligned_free(item);
+	else
+		free(item);
+}
+
+static BOOL BufferPool_AddUsed(wBufferPool* pool, wBufferPoolItem* item)
+{
+	if (HashTable_Add(pool->uTable, BufferPool_GetItemBuffer(pool, item), item) < 0)
+		return FALSE;
+
+	item->magic = BUFFERPOOL_MAGIC_USED;
+	item->prev = NULL;
+	item->next = pool->uList;
+
+	if (pool->uList)
+		pool->uList->prev = item;
+
+	pool->uList = item;
+	pool->uSize++;
 	return TRUE;
 }
 
+static void BufferPool_RemoveUsed(wBufferPool* pool, wBufferPoolItem* item)
+{
+	HashTable_Remove(pool->uTable, BufferPool_GetItemBuffer(pool, item));
+
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		pool->uList = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+
+	item->prev = item->next = NULL;
+	pool->uSize--;
+}
+
+static void BufferPool_CountTake(wBufferPool* pool, BOOL hit)
+{
+	if (hit)
+		pool->stats.hits++;
+	else
+		pool->stats.misses++;
+
+	pool->stats.inUse++;
+
+	if (pool->stats.inUse > pool->stats.highWaterMark)
+		pool->stats.highWaterMark = pool->stats.inUse;
+}
+
 /**
  * Get the buffer pool size
  */
@@ -120,38 +195,29 @@ int BufferPool_GetPoolSize(wBufferPool* pool)
 
 int BufferPool_GetBufferSize(wBufferPool* pool, void* buffer)
 {
-	int size = 0;
-	int index = 0;
-	BOOL found = FALSE;
-
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	int size = -1;
+	wBufferPoolItem* item;
 
 	if (pool->fixedSize)
 	{
 		/* fixed size buffers */
-		size = pool->fixedSize;
-		found = TRUE;
+		return pool->fixedSize;
 	}
-	else
-	{
-		/* variable size buffers */
 
-		for (index = 0; index < pool->uSize; index++)
-		{
-			if (pool->uArray[index].buffer == buffer)
-			{
-				size = pool->uArray[index].size;
-				found = TRUE;
-				break;
-			}
-		}
-	}
+	/* variable size buffers */
+
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
+
+	item = BufferPool_GetItem(pool, buffer);
+
+	if (item && (item->magic == BUFFERPOOL_MAGIC_USED))
+		size = item->size;
 
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 
-	return (found) ? size : -1;
+	return size;
 }
 
 /**
@@ -160,12 +226,11 @@ int BufferPool_GetBufferSize(wBufferPool* pool, void* buffer)
 
 void* BufferPool_Take(wBufferPool* pool, int size)
 {
-	int index;
-	int maxSize;
-	int maxIndex;
-	int foundIndex;
-	BOOL found = FALSE;
+	UINT32 index;
+	UINT32 sizeClass;
+	BOOL hit = TRUE;
 	void* buffer = NULL;
+	wBufferPoolItem* item = NULL;
 
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
@@ -177,119 +242,66 @@ void* BufferPool_Take(wBufferPool* pool, int size)
 		if (pool->size > 0)
 			buffer = pool->array[--(pool->size)];
 
-		if (!buffer)
+		if (buffer)
+			BufferPool_CountTake(pool, TRUE);
+		else
 		{
 			if (pool->alignment)
 				buffer = _aligned_malloc(pool->fixedSize, pool->alignment);
 			else
 				buffer = malloc(pool->fixedSize);
-		}
 
-		if (!buffer)
-			goto out_error;
+			if (buffer)
+				BufferPool_CountTake(pool, FALSE);
+		}
 	}
-	else
+	else if (size > 0)
 	{
 		/* variable size buffers */
 
-		maxSize = 0;
-		maxIndex = 0;
+		sizeClass = BufferPool_SizeClass(size);
 
-		if (size < 1)
-			size = pool->fixedSize;
-
-		for (index = 0; index < pool->aSize; index++)
+		/* any buffer of a larger class fits as well */
+		for (index = sizeClass; index < WINPR_POOL_SIZE_CLASSES; index++)
 		{
-			if (pool->aArray[index].size > maxSize)
-			{
-				maxIndex = index;
-				maxSize = pool->aArray[index].size;
-			}
+			item = pool->aList[index];
 
-			if (pool->aArray[index].size >= size)
+			if (item && (item->capacity >= size))
 			{
-				foundIndex = index;
-				found = TRUE;
+				pool->aList[index] = item->next;
+				pool->aSize--;
 				break;
 			}
-		}
 
-		if (!found && maxSize)
-		{
-			foundIndex = maxIndex;
-			found = TRUE;
+			item = NULL;
 		}
 
-		if (!found)
+		if (!item)
 		{
-			if (!size)
-				buffer = NULL;
-			else
-			{
-				if (pool->alignment)
-					buffer = _aligned_malloc(size, pool->alignment);
-				else
-					buffer = malloc(size);
-
-				if (!buffer)
-					goto out_error;
-			}
+			/* round up to the size class so the buffer can be reused */
+			const int capacity = ((1U << sizeClass) >= (UINT32) size) ? (int)(1U << sizeClass) : size;
+			item = BufferPool_NewItem(pool, capacity, sizeClass);
+			hit = FALSE;
 		}
-		else
-		{
-			buffer = pool->aArray[foundIndex].buffer;
-
-			if (maxSize < size)
-			{
-				void *newBuffer;
-				if (pool->alignment)
-					newBuffer = _aligned_realloc(buffer, size, pool->alignment);
-				else
-					newBuffer = realloc(buffer, size);
-
-				if (!newBuffer)
-					goto out_error_no_free;
-
-				buffer = newBuffer;
-			}
 
-			if (!BufferPool_ShiftAvailable(pool, foundIndex, -1))
-				goto out_error;
+		if (item && !BufferPool_AddUsed(pool, item))
+		{
+			BufferPool_FreeItem(pool, item);
+			item = NULL;
 		}
 
-		if (!buffer)
-			goto out_error;
-
-		if (pool->uSize + 1 > pool->uCapacity)
+		if (item)
 		{
-			int newUCapacity = pool->uCapacity * 2;
-			wBufferPoolItem *newUArray = (wBufferPoolItem *)realloc(pool->uArray, sizeof(wBufferPoolItem) * newUCapacity);
-			if (!newUArray)
-				goto out_error;
-
-			pool->uCapacity = newUCapacity;
-			pool->uArray = newUArray;
+			BufferPool_CountTake(pool, hit);
+			item->size = size;
+			buffer = BufferPool_GetItemBuffer(pool, item);
 		}
-
-		pool->uArray[pool->uSize].buffer = buffer;
-		pool->uArray[pool->uSize].size = size;
-		(pool->uSize)++;
 	}
 
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 
 	return buffer;
-
-out_error:
-	if (pool->alignment)
-		_aligned_free(buffer);
-	else
-		free(buffer);
-out_error_no_free:
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
-	return NULL;
 }
 
 /**
@@ -298,9 +310,8 @@ out_error_no_free:
 
 BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 {
-	int size = 0;
-	int index = 0;
-	BOOL found = FALSE;
+	BOOL rc = FALSE;
+	wBufferPoolItem* item;
 
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
@@ -312,7 +323,8 @@ BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 		if ((pool->size + 1) >= pool->capacity)
 		{
 			int newCapacity = pool->capacity * 2;
-			void **newArray = (void **)realloc(pool->array, sizeof(void*) * newCapacity);
+			void** newArray = (void**)realloc(pool->array, sizeof(void*) * newCapacity);
+
 			if (!newArray)
 				goto out_error;
 
@@ -326,49 +338,28 @@ BOOL BufferPool_Return(wBufferPool* pool, void* buffer)
 	{
 		/* variable size buffers */
 
-		for (index = 0; index < pool->uSize; index++)
-		{
-			if (pool->uArray[index].buffer == buffer)
-			{
-				found = TRUE;
-				break;
-			}
-		}
-
-		if (found)
-		{
-			size = pool->uArray[index].size;
-			if (!BufferPool_ShiftUsed(pool, index, -1))
-				goto out_error;
-		}
-
-		if (size)
-		{
-			if ((pool->aSize + 1) >= pool->aCapacity)
-			{
-				int newCapacity = pool->aCapacity * 2;
-				wBufferPoolItem *newArray = (wBufferPoolItem*) realloc(pool->aArray, sizeof(wBufferPoolItem) * newCapacity);
-				if (!newArray)
-					goto out_error;
+		item = BufferPool_GetItem(pool, buffer);
 
-				pool->aCapacity = newCapacity;
-				pool->aArray = newArray;
-			}
+		if (!item || (item->magic != BUFFERPOOL_MAGIC_USED))
+			goto out_error;
 
-			pool->aArray[pool->aSize].buffer = buffer;
-			pool->aArray[pool->aSize].size = size;
-			(pool->aSize)++;
-		}
+		BufferPool_RemoveUsed(pool, item);
+		item->magic = BUFFERPOOL_MAGIC_FREE;
+		item->next = pool->aList[item->sizeClass];
+		pool->aList[item->sizeClass] = item;
+		pool->aSize++;
 	}
 
-	if (pool->synchronized)
-		LeaveCriticalSection(&pool->lock);
-	return TRUE;
+	if (pool->stats.inUse > 0)
+		pool->stats.inUse--;
 
+	rc = TRUE;
 out_error:
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
-	return FALSE;
+
+	return rc;
 }
 
 /**
@@ -377,6 +368,9 @@ out_error:
 
 void BufferPool_Clear(wBufferPool* pool)
 {
+	UINT32 index;
+	wBufferPoolItem* item;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
@@ -398,31 +392,53 @@ void BufferPool_Clear(wBufferPool* pool)
 	{
 		/* variable size buffers */
 
-		while (pool->aSize > 0)
+		for (index = 0; index < WINPR_POOL_SIZE_CLASSES; index++)
 		{
-			(pool->aSize)--;
-
-			if (pool->alignment)
-				_aligned_free(pool->aArray[pool->aSize].buffer);
-			else
-				free(pool->aArray[pool->aSize].buffer);
+			while ((item = pool->aList[index]))
+			{
+				pool->aList[index] = item->next;
+				BufferPool_FreeItem(pool, item);
+			}
 		}
 
-		while (pool->uSize > 0)
-		{
-			(pool->uSize)--;
+		pool->aSize = 0;
 
-			if (pool->alignment)
-				_aligned_free(pool->uArray[pool->uSize].buffer);
-			else
-				free(pool->uArray[pool->uSize].buffer);
+		while ((item = pool->uList))
+		{
+			pool->uList = item->next;
+			BufferPool_FreeItem(pool, item);
 		}
+
+		HashTable_Clear(pool->uTable);
+		pool->uSize = 0;
+		pool->stats.inUse = 0;
 	}
 
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 }
 
+/**
+ * Gets the pool statistics.
+ */
+
+BOOL BufferPool_GetStatistics(wBufferPool* pool, wPoolStatistics* stats)
+{
+	if (!pool || !stats)
+		return FALSE;
+
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
+
+	*stats = pool->stats;
+	stats->cached = (size_t)(pool->fixedSize ? pool->size : pool->aSize);
+
+	if (pool->synchronized)
+		LeaveCriticalSection(&pool->lock);
+
+	return TRUE;
+}
+
 /**
  * Construction, Destruction
  */
@@ -431,7 +447,7 @@ wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment)
 {
 	wBufferPool* pool = NULL;
 
-	pool = (wBufferPool*) malloc(sizeof(wBufferPool));
+	pool = (wBufferPool*) calloc(1, sizeof(wBufferPool));
 
 	if (pool)
 	{
@@ -460,20 +476,9 @@ wBufferPool* BufferPool_New(BOOL synchronized, int fixedSize, DWORD alignment)
 		{
 			/* variable size buffers */
 
-			pool->aSize = 0;
-			pool->aCapacity = 32;
-			pool->aArray = (wBufferPoolItem*) calloc(pool->aCapacity, sizeof(wBufferPoolItem));
-			if (!pool->aArray)
+			pool->uTable = HashTable_NewEx(FALSE, HASHTABLE_FLAG_OPEN_ADDRESSING);
+			if (!pool->uTable)
 				goto out_error;
-
-			pool->uSize = 0;
-			pool->uCapacity = 32;
-			pool->uArray = (wBufferPoolItem*) calloc(pool->uCapacity, sizeof(wBufferPoolItem));
-			if (!pool->uArray)
-			{
-				free(pool->aArray);
-				goto out_error;
-			}
 		}
 	}
 
@@ -495,19 +500,11 @@ void BufferPool_Free(wBufferPool* pool)
 		if (pool->synchronized)
 			DeleteCriticalSection(&pool->lock);
 
-		if (pool->fixedSize)
-		{
-			/* fixed size buffers */
-
-			free(pool->array);
-		}
-		else
-		{
-			/* variable size buffers */
+		/* fixed size buffers */
+		free(pool->array);
 
-			free(pool->aArray);
-			free(pool->uArray);
-		}
+		/* variable size buffers */
+		HashTable_Free(pool->uTable);
 
 		free(pool);
 	}
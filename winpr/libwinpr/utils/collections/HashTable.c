@@ -169,6 +169,252 @@ wKeyValuePair* HashTable_Get(wHashTable* table, void* key)
 	return pair;
 }
 
+/**
+ * Open addressing mode (HASHTABLE_FLAG_OPEN_ADDRESSING)
+ *
+ * Robin Hood hashing with linear probing: an entry takes the slot of a
+ * resident entry that is closer to its home slot. This keeps probe sequences
+ * short and lets unsuccessful lookups stop early. Removal shifts the following
+ * entries back instead of leaving tombstones. The slot count is a power of two.
+ */
+
+struct _wHashTableSlot
+{
+	void* key;
+	void* value;
+	UINT32 hash;
+	UINT32 probe; /* distance from the home slot + 1, 0 if empty */
+};
+
+#define HASHTABLE_INITIAL_SLOTS	64
+
+static int HashTable_SlotShift(int numOfSlots)
+{
+	int shift = 32;
+
+	while ((numOfSlots >>= 1) > 0)
+		shift--;
+
+	return shift;
+}
+
+static UINT32 HashTable_SlotIndex(wHashTable* table, UINT32 hash)
+{
+	/* Fibonacci hashing, spreads weak hashes such as small integer keys */
+	return (UINT32)(((UINT64)(hash * 0x9E3779B1U)) >> table->slotShift);
+}
+
+/**
+ * The default pointer hash drops the low bits, small integer keys such as
+ * surface ids would all share the first slots. Mix all bits instead.
+ */
+static UINT32 HashTable_SlotHash(wHashTable* table, void* key)
+{
+	UINT64 value;
+
+	if (table->hash != HashTable_PointerHash)
+		return table->hash(key);
+
+	value = (UINT64)(UINT_PTR) key;
+	value ^= value >> 33;
+	value *= 0xFF51AFD7ED558CCDULL;
+	value ^= value >> 33;
+	return (UINT32) value;
+}
+
+static int HashTable_FindSlot(wHashTable* table, void* key)
+{
+	UINT32 probe;
+	const UINT32 hash = HashTable_SlotHash(table, key);
+	const UINT32 mask = (UINT32) table->numOfBuckets - 1;
+	UINT32 index = HashTable_SlotIndex(table, hash);
+
+	for (probe = 1; ; probe++)
+	{
+		wHashTableSlot* slot = &table->slotArray[index];
+
+		/* the key would have displaced this entry */
+		if (slot->probe < probe)
+			return -1;
+
+		/* skip the indirect call for the default pointer keys */
+		if ((slot->hash == hash) && ((slot->key == key) ||
+		                             ((table->keyCompare != HashTable_PointerCompare) &&
+		                              table->keyCompare(key, slot->key))))
+			return (int) index;
+
+		index = (index + 1) & mask;
+	}
+}
+
+static void HashTable_PlaceSlot(wHashTable* table, void* key, void* value, UINT32 hash)
+{
+	wHashTableSlot entry;
+	const UINT32 mask = (UINT32) table->numOfBuckets - 1;
+	UINT32 index = HashTable_SlotIndex(table, hash);
+	entry.key = key;
+	entry.value = value;
+	entry.hash = hash;
+	entry.probe = 1;
+
+	while (table->slotArray[index].probe != 0)
+	{
+		wHashTableSlot* slot = &table->slotArray[index];
+
+		if (slot->probe < entry.probe)
+		{
+			wHashTableSlot tmp = *slot;
+			*slot = entry;
+			entry = tmp;
+		}
+
+		index = (index + 1) & mask;
+		entry.probe++;
+	}
+
+	table->slotArray[index] = entry;
+}
+
+static BOOL HashTable_ResizeSlots(wHashTable* table, int numOfSlots)
+{
+	int index;
+	const int oldNumOfSlots = table->numOfBuckets;
+	wHashTableSlot* oldSlotArray = table->slotArray;
+	wHashTableSlot* newSlotArray;
+
+	newSlotArray = (wHashTableSlot*) calloc(numOfSlots, sizeof(wHashTableSlot));
+
+	if (!newSlotArray)
+		return FALSE;
+
+	table->slotArray = newSlotArray;
+	table->numOfBuckets = numOfSlots;
+	table->slotShift = HashTable_SlotShift(numOfSlots);
+
+	for (index = 0; index < oldNumOfSlots; index++)
+	{
+		wHashTableSlot* slot = &oldSlotArray[index];
+
+		if (slot->probe)
+			HashTable_PlaceSlot(table, slot->key, slot->value, slot->hash);
+	}
+
+	free(oldSlotArray);
+	return TRUE;
+}
+
+static void HashTable_RemoveSlot(wHashTable* table, int index)
+{
+	const UINT32 mask = (UINT32) table->numOfBuckets - 1;
+	UINT32 current = (UINT32) index;
+
+	for (;;)
+	{
+		const UINT32 next = (current + 1) & mask;
+		wHashTableSlot* slot = &table->slotArray[next];
+
+		/* stop at an empty slot or an entry already in its home slot */
+		if (slot->probe <= 1)
+			break;
+
+		table->slotArray[current] = *slot;
+		table->slotArray[current].probe--;
+		current = next;
+	}
+
+	ZeroMemory(&table->slotArray[current], sizeof(wHashTableSlot));
+}
+
+static void HashTable_FreeSlots(wHashTable* table)
+{
+	int index;
+
+	for (index = 0; index < table->numOfBuckets; index++)
+	{
+		wHashTableSlot* slot = &table->slotArray[index];
+
+		if (!slot->probe)
+			continue;
+
+		if (table->keyFree)
+			table->keyFree(slot->key);
+
+		if (table->valueFree)
+			table->valueFree(slot->value);
+
+		ZeroMemory(slot, sizeof(wHashTableSlot));
+	}
+}
+
+static int HashTable_AddSlot(wHashTable* table, void* key, void* value)
+{
+	int index = HashTable_FindSlot(table, key);
+
+	if (index >= 0)
+	{
+		wHashTableSlot* slot = &table->slotArray[index];
+
+		if (slot->key != key)
+		{
+			if (table->keyFree)
+				table->keyFree(slot->key);
+
+			slot->key = key;
+		}
+
+		if (slot->value != value)
+		{
+			if (table->valueFree)
+				table->valueFree(slot->value);
+
+			slot->value = value;
+		}
+
+		return 0;
+	}
+
+	/* keep the load factor at or below 7/8 */
+	if ((table->numOfElements + 1) * 8 > table->numOfBuckets * 7)
+	{
+		if (!HashTable_ResizeSlots(table, table->numOfBuckets * 2))
+			return -1;
+	}
+
+	HashTable_PlaceSlot(table, key, value, HashTable_SlotHash(table, key));
+	table->numOfElements++;
+	return 0;
+}
+
+/**
+ * Looks up the stored key and value of an entry in either mode.
+ */
+
+static BOOL HashTable_Lookup(wHashTable* table, void* key, void*** ppKey, void*** ppValue)
+{
+	if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+	{
+		const int index = HashTable_FindSlot(table, key);
+
+		if (index < 0)
+			return FALSE;
+
+		*ppKey = &table->slotArray[index].key;
+		*ppValue = &table->slotArray[index].value;
+	}
+	else
+	{
+		wKeyValuePair* pair = HashTable_Get(table, key);
+
+		if (!pair)
+			return FALSE;
+
+		*ppKey = &pair->key;
+		*ppValue = &pair->value;
+	}
+
+	return TRUE;
+}
+
 /**
  * C equivalent of the C# Hashtable Class:
  * http://msdn.microsoft.com/en-us/library/system.collections.hashtable.aspx
@@ -224,6 +470,16 @@ int HashTable_Add(wHashTable* table, void* key, void* value)
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
+	if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+	{
+		status = HashTable_AddSlot(table, key, value);
+
+		if (table->synchronized)
+			LeaveCriticalSection(&table->lock);
+
+		return status;
+	}
+
 	hashValue = table->hash(key) % table->numOfBuckets;
 	pair = table->bucketArray[hashValue];
 
@@ -294,6 +550,30 @@ BOOL HashTable_Remove(wHashTable* table, void* key)
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
+	if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+	{
+		const int index = HashTable_FindSlot(table, key);
+
+		if (index < 0)
+			status = FALSE;
+		else
+		{
+			if (table->keyFree)
+				table->keyFree(table->slotArray[index].key);
+
+			if (table->valueFree)
+				table->valueFree(table->slotArray[index].value);
+
+			HashTable_RemoveSlot(table, index);
+			table->numOfElements--;
+		}
+
+		if (table->synchronized)
+			LeaveCriticalSection(&table->lock);
+
+		return status;
+	}
+
 	hashValue = table->hash(key) % table->numOfBuckets;
 	pair = table->bucketArray[hashValue];
 
@@ -345,15 +625,14 @@ BOOL HashTable_Remove(wHashTable* table, void* key)
 void* HashTable_GetItemValue(wHashTable* table, void* key)
 {
 	void* value = NULL;
-	wKeyValuePair* pair;
+	void** pKey;
+	void** pValue;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	pair = HashTable_Get(table, key);
-
-	if (pair)
-		value = pair->value;
+	if (HashTable_Lookup(table, key, &pKey, &pValue))
+		value = *pValue;
 
 	if (table->synchronized)
 		LeaveCriticalSection(&table->lock);
@@ -368,7 +647,8 @@ void* HashTable_GetItemValue(wHashTable* table, void* key)
 BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value)
 {
 	BOOL status = TRUE;
-	wKeyValuePair* pair;
+	void** pKey;
+	void** pValue;
 
 	if (table->valueClone && value)
 	{
@@ -381,16 +661,14 @@ BOOL HashTable_SetItemValue(wHashTable* table, void* key, void* value)
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	pair = HashTable_Get(table, key);
-
-	if (!pair)
+	if (!HashTable_Lookup(table, key, &pKey, &pValue))
 		status = FALSE;
 	else
 	{
 		if (table->valueClone && table->valueFree)
-			table->valueFree(pair->value);
+			table->valueFree(*pValue);
 
-		pair->value = value;
+		*pValue = value;
 	}
 
 	if (table->synchronized)
@@ -412,6 +690,20 @@ void HashTable_Clear(wHashTable* table)
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
+	if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+	{
+		HashTable_FreeSlots(table);
+		table->numOfElements = 0;
+
+		if (table->numOfBuckets > HASHTABLE_INITIAL_SLOTS)
+			HashTable_ResizeSlots(table, HASHTABLE_INITIAL_SLOTS);
+
+		if (table->synchronized)
+			LeaveCriticalSection(&table->lock);
+
+		return;
+	}
+
 	for (index = 0; index < table->numOfBuckets; index++)
 	{
 		pair = table->bucketArray[index];
@@ -480,6 +772,14 @@ int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys)
 
 	for (index = 0; index < table->numOfBuckets; index++)
 	{
+		if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+		{
+			if (table->slotArray[index].probe)
+				pKeys[iKey++] = (ULONG_PTR) table->slotArray[index].key;
+
+			continue;
+		}
+
 		pair = table->bucketArray[index];
 
 		while (pair)
@@ -504,11 +804,13 @@ int HashTable_GetKeys(wHashTable* table, ULONG_PTR** ppKeys)
 BOOL HashTable_Contains(wHashTable* table, void* key)
 {
 	BOOL status;
+	void** pKey;
+	void** pValue;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	status = (HashTable_Get(table, key) != NULL) ? TRUE : FALSE;
+	status = HashTable_Lookup(table, key, &pKey, &pValue);
 
 	if (table->synchronized)
 		LeaveCriticalSection(&table->lock);
@@ -523,11 +825,13 @@ BOOL HashTable_Contains(wHashTable* table, void* key)
 BOOL HashTable_ContainsKey(wHashTable* table, void* key)
 {
 	BOOL status;
+	void** pKey;
+	void** pValue;
 
 	if (table->synchronized)
 		EnterCriticalSection(&table->lock);
 
-	status = (HashTable_Get(table, key) != NULL) ? TRUE : FALSE;
+	status = HashTable_Lookup(table, key, &pKey, &pValue);
 
 	if (table->synchronized)
 		LeaveCriticalSection(&table->lock);
@@ -550,6 +854,18 @@ BOOL HashTable_ContainsValue(wHashTable* table, void* value)
 
 	for (index = 0; index < table->numOfBuckets; index++)
 	{
+		if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+		{
+			if (table->slotArray[index].probe &&
+			    table->valueCompare(value, table->slotArray[index].value))
+			{
+				status = TRUE;
+				break;
+			}
+
+			continue;
+		}
+
 		pair = table->bucketArray[index];
 
 		while (pair)
@@ -578,6 +894,11 @@ BOOL HashTable_ContainsValue(wHashTable* table, void* value)
  */
 
 wHashTable* HashTable_New(BOOL synchronized)
+{
+	return HashTable_NewEx(synchronized, 0);
+}
+
+wHashTable* HashTable_NewEx(BOOL synchronized, DWORD flags)
 {
 	wHashTable* table;
 	table = (wHashTable*) calloc(1, sizeof(wHashTable));
@@ -585,17 +906,27 @@ wHashTable* HashTable_New(BOOL synchronized)
 	if (table)
 	{
 		table->synchronized = synchronized;
-		InitializeCriticalSectionAndSpinCount(&(table->lock), 4000);
+		table->flags = flags;
 		table->numOfBuckets = 64;
 		table->numOfElements = 0;
-		table->bucketArray = (wKeyValuePair**) calloc(table->numOfBuckets, sizeof(wKeyValuePair*));
 
-		if (!table->bucketArray)
+		if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+		{
+			table->numOfBuckets = HASHTABLE_INITIAL_SLOTS;
+			table->slotShift = HashTable_SlotShift(table->numOfBuckets);
+			table->slotArray = (wHashTableSlot*) calloc(table->numOfBuckets, sizeof(wHashTableSlot));
+		}
+		else
+			table->bucketArray = (wKeyValuePair**) calloc(table->numOfBuckets, sizeof(wKeyValuePair*));
+
+		if (!table->bucketArray && !table->slotArray)
 		{
 			free(table);
 			return NULL;
 		}
 
+		InitializeCriticalSectionAndSpinCount(&(table->lock), 4000);
+
 		table->idealRatio = 3.0;
 		table->lowerRehashThreshold = 0.0;
 		table->upperRehashThreshold = 15.0;
@@ -619,7 +950,10 @@ void HashTable_Free(wHashTable* table)
 
 	if (table)
 	{
-		for (index = 0; index < table->numOfBuckets; index++)
+		if (table->flags & HASHTABLE_FLAG_OPEN_ADDRESSING)
+			HashTable_FreeSlots(table);
+
+		for (index = 0; (index < table->numOfBuckets) && table->bucketArray; index++)
 		{
 			pair = table->bucketArray[index];
 
@@ -640,6 +974,7 @@ void HashTable_Free(wHashTable* table)
 
 		DeleteCriticalSection(&(table->lock));
 		free(table->bucketArray);
+		free(table->slotArray);
 		free(table);
 	}
 }
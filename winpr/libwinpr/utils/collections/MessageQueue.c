@@ -22,7 +22,9 @@
 #endif
 
 #include <winpr/crt.h>
+#include <winpr/thread.h>
 #include <winpr/sysinfo.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
@@ -32,46 +34,111 @@
  */
 
 /**
- * Properties
+ * Lock-free mode (WMQ_FLAG_LOCKFREE):
+ *
+ * Producers claim a cell of a bounded ring with a compare-exchange on
+ * enqueuePos and publish it by bumping the cell sequence (Dmitry Vyukov's
+ * bounded MPMC queue). When the ring is full, or while the overflow array
+ * still holds messages, producers fall back to the locked array so that the
+ * messages of one producer stay in order.
+ *
+ * pending counts the published but not yet removed messages. Only the
+ * producer taking it from 0 to 1 signals the event and only the consumer
+ * taking it back to 0 resets it.
  */
 
-/**
- * Gets an event which is set when the queue is non-empty
- */
+#define WMQ_RING_SIZE	1024
 
-HANDLE MessageQueue_Event(wMessageQueue* queue)
+struct _wMessageQueueCell
 {
-	return queue->event;
-}
+	LONG volatile sequence;
+	wMessage message;
+};
 
-/**
- * Gets the queue size
- */
+static INLINE LONG MessageQueue_Load(LONG volatile* value)
+{
+	return InterlockedCompareExchange(value, 0, 0);
+}
 
-int MessageQueue_Size(wMessageQueue* queue)
+static INLINE LONG MessageQueue_Offset(LONG value, LONG offset)
 {
-	return queue->size;
+	return (LONG)((ULONG) value + (ULONG) offset);
 }
 
-/**
- * Methods
- */
+static BOOL MessageQueue_RingPush(wMessageQueue* queue, const wMessage* message)
+{
+	wMessageQueueCell* cell;
+	LONG pos = MessageQueue_Load(&queue->enqueuePos);
 
-BOOL MessageQueue_Wait(wMessageQueue* queue)
+	for (;;)
+	{
+		LONG diff;
+		cell = &(queue->ring[(ULONG) pos & (ULONG) queue->ringMask]);
+		diff = MessageQueue_Offset(MessageQueue_Load(&cell->sequence), -pos);
+
+		if (diff == 0)
+		{
+			const LONG prev = InterlockedCompareExchange(&queue->enqueuePos,
+			                  MessageQueue_Offset(pos, 1), pos);
+
+			if (prev == pos)
+				break;
+
+			pos = prev;
+		}
+		else if (diff < 0)
+			return FALSE; /* full */
+		else
+			pos = MessageQueue_Load(&queue->enqueuePos);
+	}
+
+	CopyMemory(&(cell->message), message, sizeof(wMessage));
+	InterlockedExchange(&cell->sequence, MessageQueue_Offset(pos, 1));
+	return TRUE;
+}
+
+/* Must be called with the queue lock held */
+static BOOL MessageQueue_RingPop(wMessageQueue* queue, wMessage* message, BOOL remove)
 {
-	BOOL status = FALSE;
+	const LONG pos = queue->dequeuePos;
+	wMessageQueueCell* cell = &(queue->ring[(ULONG) pos & (ULONG) queue->ringMask]);
 
-	if (WaitForSingleObject(queue->event, INFINITE) == WAIT_OBJECT_0)
-		status = TRUE;
+	if (MessageQueue_Load(&cell->sequence) != MessageQueue_Offset(pos, 1))
+		return FALSE; /* empty or not yet published */
 
-	return status;
+	CopyMemory(message, &(cell->message), sizeof(wMessage));
+
+	if (remove)
+	{
+		ZeroMemory(&(cell->message), sizeof(wMessage));
+		queue->dequeuePos = MessageQueue_Offset(pos, 1);
+		InterlockedExchange(&cell->sequence, MessageQueue_Offset(pos, queue->ringMask + 1));
+	}
+
+	return TRUE;
 }
 
-BOOL MessageQueue_Dispatch(wMessageQueue* queue, wMessage* message)
+/* Must be called with the queue lock held */
+static BOOL MessageQueue_RingEmpty(wMessageQueue* queue)
 {
-	BOOL ret = FALSE;
-	EnterCriticalSection(&queue->lock);
+	return MessageQueue_Load(&queue->enqueuePos) == queue->dequeuePos;
+}
+
+static void MessageQueue_Release(wMessageQueue* queue, LONG count)
+{
+	if (InterlockedExchangeAdd(&queue->pending, -count) != count)
+		return;
+
+	ResetEvent(queue->event);
+
+	/* a producer may have raced with the reset */
+	if (MessageQueue_Load(&queue->pending) > 0)
+		SetEvent(queue->event);
+}
 
+/* Must be called with the queue lock held */
+static BOOL MessageQueue_Append(wMessageQueue* queue, const wMessage* message)
+{
 	if (queue->size == queue->capacity)
 	{
 		int old_capacity;
@@ -83,7 +150,7 @@ BOOL MessageQueue_Dispatch(wMessageQueue* queue, wMessage* message)
 
 		new_arr = (wMessage*) realloc(queue->array, sizeof(wMessage) * new_capacity);
 		if (!new_arr)
-			goto out;
+			return FALSE;
 		queue->array = new_arr;
 		queue->capacity = new_capacity;
 		ZeroMemory(&(queue->array[old_capacity]), (new_capacity - old_capacity) * sizeof(wMessage));
@@ -99,6 +166,170 @@ BOOL MessageQueue_Dispatch(wMessageQueue* queue, wMessage* message)
 	CopyMemory(&(queue->array[queue->tail]), message, sizeof(wMessage));
 	queue->tail = (queue->tail + 1) % queue->capacity;
 	queue->size++;
+	return TRUE;
+}
+
+/* Must be called with the queue lock held */
+static void MessageQueue_Shift(wMessageQueue* queue, wMessage* message)
+{
+	CopyMemory(message, &(queue->array[queue->head]), sizeof(wMessage));
+	ZeroMemory(&(queue->array[queue->head]), sizeof(wMessage));
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->size--;
+}
+
+/**
+ * Removes up to count messages without blocking, stopping after WMQ_QUIT.
+ */
+static int MessageQueue_Take(wMessageQueue* queue, wMessage* messages, int count)
+{
+	int taken = 0;
+
+	if (!(queue->flags & WMQ_FLAG_LOCKFREE))
+	{
+		EnterCriticalSection(&queue->lock);
+
+		while ((taken < count) && (queue->size > 0))
+		{
+			MessageQueue_Shift(queue, &messages[taken]);
+
+			if (messages[taken++].id == WMQ_QUIT)
+				break;
+		}
+
+		if (queue->size < 1)
+			ResetEvent(queue->event);
+
+		LeaveCriticalSection(&queue->lock);
+		return taken;
+	}
+
+	for (;;)
+	{
+		if (MessageQueue_Load(&queue->pending) <= 0)
+			return 0;
+
+		EnterCriticalSection(&queue->lock);
+
+		while (taken < count)
+		{
+			if (!MessageQueue_RingPop(queue, &messages[taken], TRUE))
+			{
+				/* overflow messages are older than anything still in the ring */
+				if ((queue->size < 1) || !MessageQueue_RingEmpty(queue))
+					break;
+
+				MessageQueue_Shift(queue, &messages[taken]);
+			}
+
+			if (messages[taken++].id == WMQ_QUIT)
+				break;
+		}
+
+		LeaveCriticalSection(&queue->lock);
+
+		if (taken > 0)
+		{
+			MessageQueue_Release(queue, taken);
+			return taken;
+		}
+
+		/* a message is counted but the cell in front of it is still being written */
+		SwitchToThread();
+	}
+}
+
+/**
+ * Properties
+ */
+
+/**
+ * Gets an event which is set when the queue is non-empty
+ */
+
+HANDLE MessageQueue_Event(wMessageQueue* queue)
+{
+	return queue->event;
+}
+
+/**
+ * Gets the queue size
+ */
+
+int MessageQueue_Size(wMessageQueue* queue)
+{
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		const LONG pending = MessageQueue_Load(&queue->pending);
+		return (pending > 0) ? pending : 0;
+	}
+
+	return queue->size;
+}
+
+/**
+ * Methods
+ */
+
+BOOL MessageQueue_Wait(wMessageQueue* queue)
+{
+	for (;;)
+	{
+		if (WaitForSingleObject(queue->event, INFINITE) != WAIT_OBJECT_0)
+			return FALSE;
+
+		if (!(queue->flags & WMQ_FLAG_LOCKFREE))
+			return TRUE;
+
+		if (MessageQueue_Load(&queue->pending) > 0)
+			return TRUE;
+
+		/* late signal for messages that were already removed */
+		ResetEvent(queue->event);
+
+		if (MessageQueue_Load(&queue->pending) > 0)
+		{
+			SetEvent(queue->event);
+			return TRUE;
+		}
+	}
+}
+
+static BOOL MessageQueue_DispatchLockFree(wMessageQueue* queue, const wMessage* message)
+{
+	wMessage copy;
+	CopyMemory(&copy, message, sizeof(wMessage));
+	copy.time = (UINT64) GetTickCount();
+
+	/* stay on the overflow array until it drained to keep producers in order */
+	if ((queue->size > 0) || !MessageQueue_RingPush(queue, &copy))
+	{
+		BOOL rc;
+		EnterCriticalSection(&queue->lock);
+		rc = MessageQueue_Append(queue, &copy);
+		LeaveCriticalSection(&queue->lock);
+
+		if (!rc)
+			return FALSE;
+	}
+
+	if (InterlockedIncrement(&queue->pending) == 1)
+		SetEvent(queue->event);
+
+	return TRUE;
+}
+
+BOOL MessageQueue_Dispatch(wMessageQueue* queue, wMessage* message)
+{
+	BOOL ret = FALSE;
+
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+		return MessageQueue_DispatchLockFree(queue, message);
+
+	EnterCriticalSection(&queue->lock);
+
+	if (!MessageQueue_Append(queue, message))
+		goto out;
 
 	message = &(queue->array[queue->tail]);
 	message->time = (UINT64) GetTickCount();
@@ -134,6 +365,18 @@ int MessageQueue_Get(wMessageQueue* queue, wMessage* message)
 {
 	int status = -1;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		do
+		{
+			if (!MessageQueue_Wait(queue))
+				return status;
+		}
+		while (MessageQueue_Take(queue, message, 1) < 1);
+
+		return (message->id != WMQ_QUIT) ? 1 : 0;
+	}
+
 	if (!MessageQueue_Wait(queue))
 		return status;
 
@@ -157,10 +400,45 @@ int MessageQueue_Get(wMessageQueue* queue, wMessage* message)
 	return status;
 }
 
+static int MessageQueue_PeekLockFree(wMessageQueue* queue, wMessage* message)
+{
+	for (;;)
+	{
+		BOOL found;
+
+		if (MessageQueue_Load(&queue->pending) <= 0)
+			return 0;
+
+		EnterCriticalSection(&queue->lock);
+		found = MessageQueue_RingPop(queue, message, FALSE);
+
+		if (!found && (queue->size > 0) && MessageQueue_RingEmpty(queue))
+		{
+			CopyMemory(message, &(queue->array[queue->head]), sizeof(wMessage));
+			found = TRUE;
+		}
+
+		LeaveCriticalSection(&queue->lock);
+
+		if (found)
+			return 1;
+
+		SwitchToThread();
+	}
+}
+
 int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
 {
 	int status = 0;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		if (remove)
+			return MessageQueue_Take(queue, message, 1);
+
+		return MessageQueue_PeekLockFree(queue, message);
+	}
+
 	EnterCriticalSection(&queue->lock);
 
 	if (queue->size > 0)
@@ -184,11 +462,34 @@ int MessageQueue_Peek(wMessageQueue* queue, wMessage* message, BOOL remove)
 	return status;
 }
 
+int MessageQueue_GetBatch(wMessageQueue* queue, wMessage* messages, int count)
+{
+	int taken = 0;
+
+	if (!queue || !messages || (count < 1))
+		return -1;
+
+	while (taken < 1)
+	{
+		if (!MessageQueue_Wait(queue))
+			return -1;
+
+		taken = MessageQueue_Take(queue, messages, count);
+	}
+
+	return taken;
+}
+
 /**
  * Construction, Destruction
  */
 
 wMessageQueue* MessageQueue_New(const wObject *callback)
+{
+	return MessageQueue_NewEx(callback, 0);
+}
+
+wMessageQueue* MessageQueue_NewEx(const wObject* callback, DWORD flags)
 {
 	wMessageQueue* queue = NULL;
 
@@ -196,11 +497,25 @@ wMessageQueue* MessageQueue_New(const wObject *callback)
 	if (!queue)
 		return NULL;
 
+	queue->flags = flags;
 	queue->capacity = 32;
 	queue->array = (wMessage*) calloc(queue->capacity, sizeof(wMessage));
 	if (!queue->array)
 		goto error_array;
 
+	if (flags & WMQ_FLAG_LOCKFREE)
+	{
+		LONG index;
+
+		queue->ringMask = WMQ_RING_SIZE - 1;
+		queue->ring = (wMessageQueueCell*) calloc(WMQ_RING_SIZE, sizeof(wMessageQueueCell));
+		if (!queue->ring)
+			goto error_ring;
+
+		for (index = 0; index < WMQ_RING_SIZE; index++)
+			queue->ring[index].sequence = index;
+	}
+
 	if (!InitializeCriticalSectionAndSpinCount(&queue->lock, 4000))
 		goto error_spinlock;
 
@@ -216,6 +531,8 @@ wMessageQueue* MessageQueue_New(const wObject *callback)
 error_event:
 	DeleteCriticalSection(&queue->lock);
 error_spinlock:
+	free(queue->ring);
+error_ring:
 	free(queue->array);
 error_array:
 	free(queue);
@@ -232,6 +549,7 @@ void MessageQueue_Free(wMessageQueue* queue)
 	CloseHandle(queue->event);
 	DeleteCriticalSection(&queue->lock);
 
+	free(queue->ring);
 	free(queue->array);
 	free(queue);
 }
@@ -240,6 +558,21 @@ int MessageQueue_Clear(wMessageQueue *queue)
 {
 	int status = 0;
 
+	if (queue->flags & WMQ_FLAG_LOCKFREE)
+	{
+		wMessage msg;
+
+		while (MessageQueue_Take(queue, &msg, 1) > 0)
+		{
+			if (queue->object.fnObjectUninit)
+				queue->object.fnObjectUninit(&msg);
+			if (queue->object.fnObjectFree)
+				queue->object.fnObjectFree(&msg);
+		}
+
+		return status;
+	}
+
 	EnterCriticalSection(&queue->lock);
 
 	while(queue->size > 0)
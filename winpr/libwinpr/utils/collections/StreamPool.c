@@ -25,116 +25,112 @@
 
 #include <winpr/collections.h>
 
+/**
+ * Streams handed out by the pool are embedded in a pool item. The stream
+ * is the first member so that Stream_Free() releases the whole item.
+ */
+
+struct _wStreamPoolItem
+{
+	wStream s;
+	int index; /* position in uArray while in use */
+	wStreamPoolItem* next; /* free list link while available */
+};
+
+#define STREAMPOOL_MIN_CLASS	6
+
 /**
  * Methods
  */
 
-void StreamPool_ShiftUsed(wStreamPool* pool, int index, int count)
+static UINT32 StreamPool_FloorClass(size_t size)
 {
-	if (count > 0)
-	{
-		if (pool->uSize + count > pool->uCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->uCapacity * 2;
-			new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->uCapacity = new_cap;
-			pool->uArray = new_arr;
-		}
+	UINT32 sizeClass = 0;
 
-		MoveMemory(&pool->uArray[index + count], &pool->uArray[index], (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += count;
-	}
-	else if (count < 0)
-	{
-		if (pool->uSize - index + count > 0)
-		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index - count],
-					(pool->uSize - index + count) * sizeof(wStream*));
-		}
+	while ((sizeClass + 1 < WINPR_POOL_SIZE_CLASSES) && (((size_t) 2 << sizeClass) <= size))
+		sizeClass++;
 
-		pool->uSize += count;
+	return sizeClass;
+}
+
+static UINT32 StreamPool_CeilClass(size_t size)
+{
+	UINT32 sizeClass = StreamPool_FloorClass(size);
+
+	if (((size_t) 1 << sizeClass) < size)
+		sizeClass++;
+
+	return (sizeClass < STREAMPOOL_MIN_CLASS) ? STREAMPOOL_MIN_CLASS : sizeClass;
+}
+
+static wStreamPoolItem* StreamPool_NewItem(size_t size)
+{
+	BYTE* buffer;
+	wStreamPoolItem* item;
+
+	item = (wStreamPoolItem*) calloc(1, sizeof(wStreamPoolItem));
+
+	if (!item)
+		return NULL;
+
+	if (!(buffer = (BYTE*) malloc(size)))
+	{
+		free(item);
+		return NULL;
 	}
+
+	Stream_StaticInit(&item->s, buffer, size);
+	item->s.isAllocatedStream = TRUE;
+	item->s.isOwner = TRUE;
+	return item;
 }
 
 /**
  * Adds a used stream to the pool.
  */
 
-void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+static BOOL StreamPool_AddUsed(wStreamPool* pool, wStreamPoolItem* item)
 {
-	if ((pool->uSize + 1) >= pool->uCapacity)
+	if (pool->uSize >= pool->uCapacity)
 	{
 		int new_cap;
-		wStream **new_arr;
+		wStream** new_arr;
 
 		new_cap = pool->uCapacity * 2;
 		new_arr = (wStream**) realloc(pool->uArray, sizeof(wStream*) * new_cap);
+
 		if (!new_arr)
-			return;
+			return FALSE;
+
 		pool->uCapacity = new_cap;
 		pool->uArray = new_arr;
 	}
 
-	pool->uArray[(pool->uSize)++] = s;
+	item->index = pool->uSize;
+	pool->uArray[(pool->uSize)++] = &item->s;
+
+	if ((size_t) pool->uSize > pool->stats.highWaterMark)
+		pool->stats.highWaterMark = (size_t) pool->uSize;
+
+	return TRUE;
 }
 
 /**
- * Removes a used stream from the pool.
+ * Removes a used stream from the pool, the last one takes its slot.
  */
 
-void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
-{
-	int index;
-	BOOL found = FALSE;
-
-	for (index = 0; index < pool->uSize; index++)
-	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
-			break;
-		}
-	}
-
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
-}
-
-void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
+static void StreamPool_RemoveUsed(wStreamPool* pool, wStreamPoolItem* item)
 {
-	if (count > 0)
-	{
-		if (pool->aSize + count > pool->aCapacity)
-		{
-			int new_cap;
-			wStream **new_arr;
-
-			new_cap = pool->aCapacity * 2;
-			new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-			if (!new_arr)
-				return;
-			pool->aCapacity = new_cap;
-			pool->aArray = new_arr;
-		}
+	wStreamPoolItem* last;
 
-		MoveMemory(&pool->aArray[index + count], &pool->aArray[index], (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += count;
-	}
-	else if (count < 0)
-	{
-		if (pool->aSize - index + count > 0)
-		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index - count],
-					(pool->aSize - index + count) * sizeof(wStream*));
-		}
+	if ((item->index < 0) || (item->index >= pool->uSize) ||
+	    (pool->uArray[item->index] != &item->s))
+		return;
 
-		pool->aSize += count;
-	}
+	last = (wStreamPoolItem*) pool->uArray[--(pool->uSize)];
+	pool->uArray[item->index] = &last->s;
+	last->index = item->index;
+	item->index = -1;
 }
 
 /**
@@ -143,9 +139,9 @@ void StreamPool_ShiftAvailable(wStreamPool* pool, int index, int count)
 
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
-	int index;
-	int foundIndex;
-	wStream* s = NULL;
+	UINT32 sizeClass;
+	UINT32 index;
+	wStreamPoolItem* item = NULL;
 
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
@@ -153,44 +149,64 @@ wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
+	if (size == 0)
+		goto out_fail;
 
-	for (index = 0; index < pool->aSize; index++)
-	{
-		s = pool->aArray[index];
+	sizeClass = StreamPool_CeilClass(size);
 
-		if (Stream_Capacity(s) >= size)
+	/* any stream of a larger class fits as well */
+	for (index = sizeClass; index < WINPR_POOL_SIZE_CLASSES; index++)
+	{
+		if (pool->aList[index])
 		{
-			foundIndex = index;
+			item = pool->aList[index];
+
+			if (Stream_Capacity(&item->s) < size)
+			{
+				item = NULL;
+				continue;
+			}
+
+			pool->aList[index] = item->next;
+			pool->aSize--;
 			break;
 		}
 	}
 
-	if (foundIndex < 0)
+	if (item)
 	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
+		item->next = NULL;
+		Stream_SetPosition(&item->s, 0);
+		Stream_SetLength(&item->s, Stream_Capacity(&item->s));
+		pool->stats.hits++;
 	}
 	else
 	{
-		Stream_SetPosition(s, 0);
-		Stream_SetLength(s, Stream_Capacity(s));
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
+		/* round up to the size class so the stream can be reused */
+		if (((size_t) 1 << sizeClass) > size)
+			size = (size_t) 1 << sizeClass;
+
+		if (!(item = StreamPool_NewItem(size)))
+			goto out_fail;
+
+		pool->stats.misses++;
 	}
 
-	if (s)
+	if (!StreamPool_AddUsed(pool, item))
 	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
+		Stream_Free(&item->s, TRUE);
+		item = NULL;
+		goto out_fail;
 	}
 
+	item->s.pool = pool;
+	item->s.count = 1;
 out_fail:
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 
-	return s;
+	return item ? &item->s : NULL;
 }
 
 /**
@@ -199,38 +215,23 @@ out_fail:
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
 {
-	if (pool->synchronized)
-		EnterCriticalSection(&pool->lock);
+	UINT32 sizeClass;
+	wStreamPoolItem* item = (wStreamPoolItem*) s;
 
-	if ((pool->aSize + 1) >= pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
+	if (!s || (s->pool != pool))
+		return;
 
-		new_cap = pool->aCapacity * 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
-	else if ((pool->aSize + 1) * 3 < pool->aCapacity)
-	{
-		int new_cap;
-		wStream **new_arr;
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
 
-		new_cap = pool->aCapacity / 2;
-		new_arr = (wStream**) realloc(pool->aArray, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			goto out_fail;
-		pool->aCapacity = new_cap;
-		pool->aArray = new_arr;
-	}
+	StreamPool_RemoveUsed(pool, item);
 
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
+	/* the capacity may have grown while the stream was in use */
+	sizeClass = StreamPool_FloorClass(Stream_Capacity(s));
+	item->next = pool->aList[sizeClass];
+	pool->aList[sizeClass] = item;
+	pool->aSize++;
 
-out_fail:
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
 }
@@ -348,17 +349,47 @@ void StreamPool_Release(wStreamPool* pool, BYTE* ptr)
 
 void StreamPool_Clear(wStreamPool* pool)
 {
+	UINT32 index;
+
 	if (pool->synchronized)
 		EnterCriticalSection(&pool->lock);
 
-	while (pool->aSize > 0)
+	for (index = 0; index < WINPR_POOL_SIZE_CLASSES; index++)
 	{
-		(pool->aSize)--;
-		Stream_Free(pool->aArray[pool->aSize], TRUE);
+		while (pool->aList[index])
+		{
+			wStreamPoolItem* item = pool->aList[index];
+			pool->aList[index] = item->next;
+			Stream_Free(&item->s, TRUE);
+		}
 	}
 
+	pool->aSize = 0;
+
+	if (pool->synchronized)
+		LeaveCriticalSection(&pool->lock);
+}
+
+/**
+ * Gets the pool statistics.
+ */
+
+BOOL StreamPool_GetStatistics(wStreamPool* pool, wPoolStatistics* stats)
+{
+	if (!pool || !stats)
+		return FALSE;
+
+	if (pool->synchronized)
+		EnterCriticalSection(&pool->lock);
+
+	*stats = pool->stats;
+	stats->inUse = (size_t) pool->uSize;
+	stats->cached = (size_t) pool->aSize;
+
 	if (pool->synchronized)
 		LeaveCriticalSection(&pool->lock);
+
+	return TRUE;
 }
 
 /**
@@ -376,23 +407,12 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
 
-		pool->aSize = 0;
-		pool->aCapacity = 32;
-		pool->aArray = (wStream**) calloc(pool->aCapacity, sizeof(wStream*));
-
-		if (!pool->aArray)
-		{
-			free(pool);
-			return NULL;
-		}
-
 		pool->uSize = 0;
 		pool->uCapacity = 32;
 		pool->uArray = (wStream**) calloc(pool->uCapacity, sizeof(wStream*));
 
 		if (!pool->uArray)
 		{
-			free(pool->aArray);
 			free(pool);
 			return NULL;
 		}
@@ -411,7 +431,6 @@ void StreamPool_Free(wStreamPool* pool)
 
 		DeleteCriticalSection(&pool->lock);
 
-		free(pool->aArray);
 		free(pool->uArray);
 
 		free(pool);
@@ -10,6 +10,7 @@ int TestBufferPool(int argc, char* argv[])
 	wBufferPool* pool;
 	BYTE* Buffers[10];
 	int DefaultSize = 1234;
+	wPoolStatistics stats;
 
 	pool = BufferPool_New(TRUE, -1, 16);
 	if (!pool)
@@ -55,6 +56,57 @@ int TestBufferPool(int argc, char* argv[])
 		return -1;
 	}
 
+	/* served from the free list of a larger size class */
+	Buffers[3] = BufferPool_Take(pool, 1000);
+
+	if ((Buffers[3] != Buffers[1]) || (BufferPool_GetBufferSize(pool, Buffers[3]) != 1000))
+	{
+		printf("BufferPool_Take failure: returned buffer not reused\n");
+		return -1;
+	}
+
+	if (((size_t) Buffers[0] % 16) || ((size_t) Buffers[2] % 16))
+	{
+		printf("BufferPool_Take failure: buffer not aligned\n");
+		return -1;
+	}
+
+	/* pointers not handed out by the pool are rejected without touching them */
+	Buffers[4] = (BYTE*) malloc(8);
+
+	if (!Buffers[4])
+		return -1;
+
+	if ((BufferPool_GetBufferSize(pool, Buffers[4]) != -1) ||
+	    (BufferPool_GetBufferSize(pool, &Buffers[0][16]) != -1) ||
+	    BufferPool_Return(pool, Buffers[4]) || BufferPool_Return(pool, &Buffers[2][16]))
+	{
+		printf("BufferPool failure: foreign buffer accepted\n");
+		return -1;
+	}
+
+	free(Buffers[4]);
+	BufferPool_Return(pool, Buffers[0]);
+	BufferPool_Return(pool, Buffers[2]);
+	BufferPool_Return(pool, Buffers[3]);
+
+	if (BufferPool_Return(pool, Buffers[3]))
+	{
+		printf("BufferPool_Return failure: buffer returned twice\n");
+		return -1;
+	}
+
+	if (!BufferPool_GetStatistics(pool, &stats))
+		return -1;
+
+	if ((stats.hits != 1) || (stats.misses != 3) || (stats.inUse != 0) ||
+	    (stats.cached != 3) || (stats.highWaterMark != 3))
+	{
+		printf("BufferPool_GetStatistics failure: hits: %"PRIu64" misses: %"PRIu64"\n",
+		       stats.hits, stats.misses);
+		return -1;
+	}
+
 	BufferPool_Clear(pool);
 
 	BufferPool_Free(pool);
@@ -1,8 +1,12 @@
 
 #include <winpr/crt.h>
 #include <winpr/tchar.h>
+#include <winpr/sysinfo.h>
 #include <winpr/collections.h>
 
+#define TEST_KEYS	100000
+#define TEST_ROUNDS	10
+
 static char* key1 = "key1";
 static char* key2 = "key2";
 static char* key3 = "key3";
@@ -11,13 +15,13 @@ static char* val1 = "val1";
 static char* val2 = "val2";
 static char* val3 = "val3";
 
-static int test_hash_table_pointer(void)
+static int test_hash_table_pointer(DWORD flags)
 {
 	int rc = -1;
 	int count;
 	char* value;
 	wHashTable* table;
-	table = HashTable_New(TRUE);
+	table = HashTable_NewEx(TRUE, flags);
 
 	if (!table)
 		return -1;
@@ -137,13 +141,13 @@ fail:
 	return rc;
 }
 
-static int test_hash_table_string(void)
+static int test_hash_table_string(DWORD flags)
 {
 	int rc = -1;
 	int count;
 	char* value;
 	wHashTable* table;
-	table = HashTable_New(TRUE);
+	table = HashTable_NewEx(TRUE, flags);
 
 	if (!table)
 		return -1;
@@ -270,12 +274,178 @@ fail:
 	return rc;
 }
 
+/**
+ * Many integer keys (the rdpgfx surface table pattern) with interleaved
+ * removals, which exercises displacement and backward shift deletion.
+ */
+
+static int test_hash_table_many(DWORD flags)
+{
+	int rc = -1;
+	size_t index;
+	ULONG_PTR* keys = NULL;
+	wHashTable* table = HashTable_NewEx(FALSE, flags);
+
+	if (!table)
+		return -1;
+
+	for (index = 1; index <= 10000; index++)
+	{
+		if (HashTable_Add(table, (void*) index, (void*)(index * 2)) < 0)
+			goto fail;
+	}
+
+	for (index = 1; index <= 10000; index += 3)
+	{
+		if (!HashTable_Remove(table, (void*) index))
+			goto fail;
+	}
+
+	for (index = 1; index <= 10000; index++)
+	{
+		void* value = HashTable_GetItemValue(table, (void*) index);
+		void* expected = ((index - 1) % 3) ? (void*)(index * 2) : NULL;
+
+		if (value != expected)
+		{
+			printf("HashTable_GetItemValue: key %"PRIuz" Expected : %p, Actual: %p\n",
+			       index, expected, value);
+			goto fail;
+		}
+	}
+
+	if ((HashTable_Count(table) != 6666) || (HashTable_GetKeys(table, &keys) != 6666))
+	{
+		printf("HashTable_Count: Expected : 6666, Actual: %d\n", HashTable_Count(table));
+		goto fail;
+	}
+
+	if (!HashTable_ContainsValue(table, (void*) 6) || HashTable_ContainsValue(table, (void*) 2))
+		goto fail;
+
+	rc = 1;
+fail:
+	free(keys);
+	HashTable_Free(table);
+	return rc;
+}
+
+static UINT64 test_hash_table_run(wHashTable* table, void** keys)
+{
+	int round;
+	size_t index;
+	UINT64 start = GetTickCount64();
+
+	for (round = 0; round < TEST_ROUNDS; round++)
+	{
+		for (index = 0; index < TEST_KEYS; index++)
+			HashTable_Add(table, keys[index], keys[index]);
+
+		for (index = 0; index < TEST_KEYS; index++)
+		{
+			if (!HashTable_GetItemValue(table, keys[index]))
+				return 0;
+		}
+
+		for (index = 0; index < TEST_KEYS; index++)
+			HashTable_Remove(table, keys[index]);
+	}
+
+	return GetTickCount64() - start;
+}
+
+static int test_hash_table_benchmark(DWORD flags, BOOL strings, const char* name)
+{
+	int rc = -1;
+	size_t index;
+	UINT64 duration;
+	void** keys;
+	wHashTable* table = NULL;
+
+	if (!(keys = (void**) calloc(TEST_KEYS, sizeof(void*))))
+		return -1;
+
+	for (index = 0; index < TEST_KEYS; index++)
+	{
+		if (strings)
+		{
+			char buffer[32];
+			sprintf_s(buffer, sizeof(buffer), "surface-%08"PRIxz, index);
+
+			if (!(keys[index] = _strdup(buffer)))
+				goto fail;
+		}
+		else
+			keys[index] = (void*)(index + 1);
+	}
+
+	/* random access order, the way handles and surface ids are looked up */
+	for (index = TEST_KEYS - 1; index > 0; index--)
+	{
+		void* tmp;
+		const size_t other = ((index * 2654435761U) ^ (index >> 3)) % (index + 1);
+		tmp = keys[index];
+		keys[index] = keys[other];
+		keys[other] = tmp;
+	}
+
+	if (!(table = HashTable_NewEx(FALSE, flags)))
+		goto fail;
+
+	if (strings)
+	{
+		table->hash = HashTable_StringHash;
+		table->keyCompare = HashTable_StringCompare;
+	}
+
+	duration = test_hash_table_run(table, keys);
+
+	if (HashTable_Count(table) != 0)
+		goto fail;
+
+	printf("%s: %d add/get/remove of %d keys in %"PRIu64" ms\n", name, TEST_ROUNDS, TEST_KEYS,
+	       duration);
+	rc = 1;
+fail:
+
+	if (strings)
+	{
+		for (index = 0; index < TEST_KEYS; index++)
+			free(keys[index]);
+	}
+
+	free(keys);
+	HashTable_Free(table);
+	return rc;
+}
+
 int TestHashTable(int argc, char* argv[])
 {
-	if (test_hash_table_pointer() < 0)
-		return 1;
+	const DWORD flags[] = { 0, HASHTABLE_FLAG_OPEN_ADDRESSING };
+	size_t index;
+
+	for (index = 0; index < ARRAYSIZE(flags); index++)
+	{
+		if (test_hash_table_pointer(flags[index]) < 0)
+			return 1;
+
+		if (test_hash_table_string(flags[index]) < 0)
+			return 1;
+
+		if (test_hash_table_many(flags[index]) < 0)
+			return 1;
+	}
+
+	/* timings are only taken on request: TestHashTable benchmark */
+	if (argc < 2)
+		return 0;
 
-	if (test_hash_table_string() < 0)
+	if ((test_hash_table_benchmark(0, FALSE, "chained, pointer keys") < 0) ||
+	    (test_hash_table_benchmark(HASHTABLE_FLAG_OPEN_ADDRESSING, FALSE,
+	                               "open addressing, pointer keys") < 0) ||
+	    (test_hash_table_benchmark(0, TRUE, "chained, string keys") < 0) ||
+	    (test_hash_table_benchmark(HASHTABLE_FLAG_OPEN_ADDRESSING, TRUE,
+	                               "open addressing, string keys") < 0))
 		return 1;
 
 	return 0;
@@ -1,12 +1,24 @@
 
 #include <winpr/crt.h>
 #include <winpr/thread.h>
+#include <winpr/sysinfo.h>
 #include <winpr/collections.h>
 
+#define TEST_PRODUCERS	4
+#define TEST_MESSAGES	100000
+
+typedef struct
+{
+	wMessageQueue* queue;
+	UINT32 producer;
+} TEST_PRODUCER;
+
 static DWORD WINAPI message_queue_consumer_thread(LPVOID arg)
 {
 	wMessage message;
 	wMessageQueue* queue;
+	const UINT32 expected[] = { 123, 456, 789 };
+	size_t received = 0;
 
 	queue = (wMessageQueue*) arg;
 
@@ -17,29 +29,48 @@ static DWORD WINAPI message_queue_consumer_thread(LPVOID arg)
 			if (message.id == WMQ_QUIT)
 				break;
 
-			printf("Message.Type: %"PRIu32"\n", message.id);
+			if ((received >= ARRAYSIZE(expected)) || (message.id != expected[received++]))
+			{
+				printf("unexpected Message.Type: %"PRIu32"\n", message.id);
+				return 1;
+			}
 		}
 	}
 
+	return (received == ARRAYSIZE(expected)) ? 0 : 1;
+}
+
+static DWORD WINAPI message_queue_producer_thread(LPVOID arg)
+{
+	size_t index;
+	TEST_PRODUCER* producer = (TEST_PRODUCER*) arg;
+
+	for (index = 0; index < TEST_MESSAGES; index++)
+	{
+		if (!MessageQueue_Post(producer->queue, NULL, producer->producer, (void*) index, NULL))
+			return 1;
+	}
+
 	return 0;
 }
 
-int TestMessageQueue(int argc, char* argv[])
+static BOOL test_message_queue_simple(DWORD flags)
 {
+	DWORD status = 1;
 	HANDLE thread;
 	wMessageQueue* queue;
 
-	if (!(queue = MessageQueue_New(NULL)))
+	if (!(queue = MessageQueue_NewEx(NULL, flags)))
 	{
 		printf("failed to create message queue\n");
-		return 1;
+		return FALSE;
 	}
 
 	if (!(thread = CreateThread(NULL, 0, message_queue_consumer_thread, (void*) queue, 0, NULL)))
 	{
 		printf("failed to create thread\n");
 		MessageQueue_Free(queue);
-		return 1;
+		return FALSE;
 	}
 
 	if (!MessageQueue_Post(queue, NULL, 123, NULL, NULL) ||
@@ -47,10 +78,171 @@ int TestMessageQueue(int argc, char* argv[])
 			!MessageQueue_Post(queue, NULL, 789, NULL, NULL) ||
 			!MessageQueue_PostQuit(queue, 0) ||
 			WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0)
-		return -1;
+		return FALSE;
 
+	GetExitCodeThread(thread, &status);
 	MessageQueue_Free(queue);
 	CloseHandle(thread);
+	return status == 0;
+}
+
+/**
+ * Several producers against a batched consumer. Messages of one producer
+ * must arrive in order and nothing may get lost, also when the lock-free
+ * ring overflows.
+ */
+static BOOL test_message_queue_producers(DWORD flags, const char* name, BOOL benchmark)
+{
+	int count;
+	UINT32 index;
+	BOOL rc = FALSE;
+	UINT64 start, end;
+	size_t received = 0;
+	size_t expected[TEST_PRODUCERS] = { 0 };
+	HANDLE threads[TEST_PRODUCERS] = { 0 };
+	TEST_PRODUCER producers[TEST_PRODUCERS];
+	wMessage messages[64];
+	wMessageQueue* queue;
+
+	if (!(queue = MessageQueue_NewEx(NULL, flags)))
+		return FALSE;
+
+	start = GetTickCount64();
+
+	for (index = 0; index < TEST_PRODUCERS; index++)
+	{
+		producers[index].queue = queue;
+		producers[index].producer = index;
+
+		if (!(threads[index] = CreateThread(NULL, 0, message_queue_producer_thread,
+		                                    &producers[index], 0, NULL)))
+			goto fail;
+	}
+
+	while (received < TEST_PRODUCERS * TEST_MESSAGES)
+	{
+		int i;
+
+		if ((count = MessageQueue_GetBatch(queue, messages, ARRAYSIZE(messages))) < 1)
+			goto fail;
+
+		for (i = 0; i < count; i++)
+		{
+			const UINT32 id = messages[i].id;
+
+			if ((id >= TEST_PRODUCERS) || ((size_t) messages[i].wParam != expected[id]))
+			{
+				printf("%s: message out of order from producer %"PRIu32"\n", name, id);
+				goto fail;
+			}
+
+			expected[id]++;
+			received++;
+		}
+	}
+
+	end = GetTickCount64();
+
+	if (MessageQueue_Size(queue) != 0)
+		goto fail;
+
+	if (benchmark)
+		printf("%s: %d producers, %d messages in %"PRIu64" ms\n", name, TEST_PRODUCERS,
+		       TEST_PRODUCERS * TEST_MESSAGES, end - start);
+
+	rc = TRUE;
+fail:
+
+	for (index = 0; index < TEST_PRODUCERS; index++)
+	{
+		if (threads[index])
+		{
+			WaitForSingleObject(threads[index], INFINITE);
+			CloseHandle(threads[index]);
+		}
+	}
+
+	MessageQueue_Free(queue);
+	return rc;
+}
+
+static BOOL test_message_queue_batch(DWORD flags)
+{
+	int count;
+	UINT32 index;
+	BOOL rc = FALSE;
+	wMessage messages[8];
+	wMessageQueue* queue;
+
+	if (!(queue = MessageQueue_NewEx(NULL, flags)))
+		return FALSE;
+
+	/* more than the lock-free ring holds */
+	for (index = 0; index < 3000; index++)
+	{
+		if (!MessageQueue_Post(queue, NULL, index, NULL, NULL))
+			goto fail;
+	}
+
+	if (!MessageQueue_PostQuit(queue, 0) ||
+	    !MessageQueue_Post(queue, NULL, 1, NULL, NULL))
+		goto fail;
+
+	if (MessageQueue_Size(queue) != 3002)
+		goto fail;
+
+	for (index = 0; index < 3000;)
+	{
+		int i;
+
+		if ((count = MessageQueue_GetBatch(queue, messages, ARRAYSIZE(messages))) < 1)
+			goto fail;
+
+		for (i = 0; i < count; i++)
+		{
+			if (messages[i].id != index++)
+				goto fail;
+		}
+	}
+
+	/* the batch stops after the quit message */
+	if ((MessageQueue_GetBatch(queue, messages, ARRAYSIZE(messages)) != 1) ||
+	    (messages[0].id != WMQ_QUIT))
+		goto fail;
+
+	if ((MessageQueue_Get(queue, messages) != 1) || (messages[0].id != 1))
+		goto fail;
+
+	if ((MessageQueue_Size(queue) != 0) || (MessageQueue_Peek(queue, messages, FALSE) != 0) ||
+	    (WaitForSingleObject(MessageQueue_Event(queue), 0) != WAIT_TIMEOUT))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	MessageQueue_Free(queue);
+	return rc;
+}
+
+int TestMessageQueue(int argc, char* argv[])
+{
+	/* timings are only printed on request: TestMessageQueue benchmark */
+	const BOOL benchmark = (argc > 1);
+
+	if (!test_message_queue_simple(0) || !test_message_queue_simple(WMQ_FLAG_LOCKFREE))
+		return -1;
+
+	if (!test_message_queue_batch(0) || !test_message_queue_batch(WMQ_FLAG_LOCKFREE))
+	{
+		printf("batched dequeue failed\n");
+		return -1;
+	}
+
+	if (!test_message_queue_producers(0, "locked", benchmark) ||
+	    !test_message_queue_producers(WMQ_FLAG_LOCKFREE, "lock-free", benchmark))
+	{
+		printf("multiple producer test failed\n");
+		return -1;
+	}
 
 	return 0;
 }
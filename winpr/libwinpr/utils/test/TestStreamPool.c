@@ -9,6 +9,7 @@ int TestStreamPool(int argc, char* argv[])
 {
 	wStream* s[5];
 	wStreamPool* pool;
+	wPoolStatistics stats;
 
 	pool = StreamPool_New(TRUE, BUFFER_SIZE);
 
@@ -94,6 +95,49 @@ int TestStreamPool(int argc, char* argv[])
 
 	printf("StreamPool: aSize: %d uSize: %d\n", pool->aSize, pool->uSize);
 
+	if (!StreamPool_GetStatistics(pool, &stats))
+		return -1;
+
+	printf("StreamPool: hits: %"PRIu64" misses: %"PRIu64" high water mark: %"PRIu32"\n",
+	       stats.hits, stats.misses, (UINT32) stats.highWaterMark);
+
+	if ((stats.hits != 8) || (stats.misses != 3) || (stats.inUse != 0) ||
+	    (stats.cached != 3) || (stats.highWaterMark != 3))
+	{
+		printf("StreamPool_GetStatistics failure\n");
+		return -1;
+	}
+
+	/* requests are rounded up to their size class and served from its free list */
+	StreamPool_Clear(pool);
+	s[0] = StreamPool_Take(pool, 100);
+
+	if (!s[0] || (Stream_Capacity(s[0]) != 128))
+		return -1;
+
+	Stream_Release(s[0]);
+	s[1] = StreamPool_Take(pool, 120);
+
+	if (s[1] != s[0])
+	{
+		printf("StreamPool_Take failure: stream of the same size class not reused\n");
+		return -1;
+	}
+
+	/* streams grown while in use move to a larger class */
+	if (!Stream_EnsureCapacity(s[1], BUFFER_SIZE * 2))
+		return -1;
+
+	Stream_Release(s[1]);
+	s[2] = StreamPool_Take(pool, BUFFER_SIZE * 2);
+
+	if (s[2] != s[1])
+	{
+		printf("StreamPool_Take failure: grown stream not reused\n");
+		return -1;
+	}
+
+	Stream_Release(s[2]);
 	StreamPool_Free(pool);
 
 	return 0;